@@ -52,7 +52,7 @@ static CTxIn MineBlock(const CScript& coinbase_scriptPubKey)
 }
 
 
-static void AssembleBlock(benchmark::State& state)
+static void AssembleBlockTemplate(benchmark::State& state, bool cached)
 {
     const std::vector<unsigned char> op_true{OP_TRUE};
     CScriptWitness witness;
@@ -71,45 +71,60 @@ static void AssembleBlock(benchmark::State& state)
 
     boost::thread_group thread_group;
     CScheduler scheduler;
-    {
+    thread_group.create_thread(boost::bind(&CScheduler::serviceQueue, &scheduler));
+    GetMainSignals().RegisterBackgroundSignalScheduler(scheduler);
+
+    // The chain and mempool are set up once and shared by both benchmarks.
+    static bool chain_ready{false};
+    if (!chain_ready) {
+        chain_ready = true;
         ::pblocktree.reset(new CBlockTreeDB(1 << 20, true));
         ::pcoinsdbview.reset(new CCoinsViewDB(1 << 23, true));
         ::pcoinsTip.reset(new CCoinsViewCache(pcoinsdbview.get()));
 
         const CChainParams& chainparams = Params();
-        thread_group.create_thread(boost::bind(&CScheduler::serviceQueue, &scheduler));
-        GetMainSignals().RegisterBackgroundSignalScheduler(scheduler);
         LoadGenesisBlock(chainparams);
         CValidationState state;
         ActivateBestChain(state, chainparams);
         assert(::chainActive.Tip() != nullptr);
         const bool witness_enabled{IsWitnessEnabled(::chainActive.Tip(), chainparams.GetConsensus())};
         assert(witness_enabled);
-    }
-
-    // Collect some loose transactions that spend the coinbases of our mined blocks
-    constexpr size_t NUM_BLOCKS{200};
-    std::array<CTransactionRef, NUM_BLOCKS - COINBASE_MATURITY + 1> txs;
-    for (size_t b{0}; b < NUM_BLOCKS; ++b) {
-        CMutableTransaction tx;
-        tx.vin.push_back(MineBlock(SCRIPT_PUB));
-        tx.vin.back().scriptWitness = witness;
-        tx.vout.emplace_back(1337, SCRIPT_PUB);
-        if (NUM_BLOCKS - b >= COINBASE_MATURITY)
-            txs.at(b) = MakeTransactionRef(tx);
-    }
-    {
-        LOCK(::cs_main); // Required for ::AcceptToMemoryPool.
 
-        for (const auto& txr : txs) {
-            CValidationState state;
-            bool ret{::AcceptToMemoryPool(::mempool, state, txr, nullptr /* pfMissingInputs */, nullptr /* plTxnReplaced */, false /* bypass_limits */, /* nAbsurdFee */ 0)};
-            assert(ret);
+        // Collect some loose transactions that spend the coinbases of our mined blocks
+        constexpr size_t NUM_BLOCKS{200};
+        std::array<CTransactionRef, NUM_BLOCKS - COINBASE_MATURITY + 1> txs;
+        for (size_t b{0}; b < NUM_BLOCKS; ++b) {
+            CMutableTransaction tx;
+            tx.vin.push_back(MineBlock(SCRIPT_PUB));
+            tx.vin.back().scriptWitness = witness;
+            tx.vout.emplace_back(1337, SCRIPT_PUB);
+            if (NUM_BLOCKS - b >= COINBASE_MATURITY)
+                txs.at(b) = MakeTransactionRef(tx);
+        }
+        {
+            LOCK(::cs_main); // Required for ::AcceptToMemoryPool.
+
+            for (const auto& txr : txs) {
+                CValidationState state;
+                bool ret{::AcceptToMemoryPool(::mempool, state, txr, nullptr /* pfMissingInputs */, nullptr /* plTxnReplaced */, false /* bypass_limits */, /* nAbsurdFee */ 0)};
+                assert(ret);
+            }
         }
     }
 
-    while (state.KeepRunning()) {
-        PrepareBlock(SCRIPT_PUB);
+    if (cached) {
+        // Served from the template kept up to date by BlockTemplateCache,
+        // which is built once on the first request.
+        BlockTemplateCache cache(Params(), SCRIPT_PUB);
+        RegisterValidationInterface(&cache);
+        while (state.KeepRunning()) {
+            cache.GetBlockTemplate(/* fMineWitnessTx */ true, BLOCK_TEMPLATE_MAX_STALE_AGE);
+        }
+        UnregisterValidationInterface(&cache);
+    } else {
+        while (state.KeepRunning()) {
+            PrepareBlock(SCRIPT_PUB);
+        }
     }
 
     thread_group.interrupt_all();
@@ -118,4 +133,15 @@ static void AssembleBlock(benchmark::State& state)
     GetMainSignals().UnregisterBackgroundSignalScheduler();
 }
 
+static void AssembleBlock(benchmark::State& state)
+{
+    AssembleBlockTemplate(state, false);
+}
+
+static void AssembleBlockCached(benchmark::State& state)
+{
+    AssembleBlockTemplate(state, true);
+}
+
 BENCHMARK(AssembleBlock, 700);
+BENCHMARK(AssembleBlockCached, 700);
@@ -2,13 +2,24 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <arith_uint256.h>
 #include <bench/bench.h>
+#include <checkqueue.h>
 #include <coins.h>
+#include <memusage.h>
 #include <policy/policy.h>
+#include <random.h>
 #include <wallet/crypter.h>
 
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
+#include <boost/thread/thread.hpp>
+
 // FIXME: Dedup with SetupDummyInputs in test/transaction_tests.cpp.
 //
 // Helper: create two dummy transactions, each with
@@ -85,3 +96,151 @@ static void CCoinsCaching(benchmark::State& state)
 }
 
 BENCHMARK(CCoinsCaching, 170 * 1000);
+
+// Backing view that answers lookups after a fixed delay, standing in for a
+// coins database that has to go to disk for every cache miss.
+class DelayedCoinsView : public CCoinsView
+{
+    std::map<COutPoint, Coin> m_coins;
+
+public:
+    explicit DelayedCoinsView(size_t count)
+    {
+        for (size_t i = 0; i < count; ++i) {
+            CTxOut out(1 * COIN, CScript() << OP_TRUE);
+            m_coins.emplace(COutPoint(ArithToUint256(arith_uint256(i + 1)), 0), Coin(std::move(out), 1, false));
+        }
+    }
+
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const override
+    {
+        std::this_thread::sleep_for(std::chrono::microseconds(20));
+        auto it = m_coins.find(outpoint);
+        if (it == m_coins.end()) return false;
+        coin = it->second;
+        return true;
+    }
+
+    bool HasConcurrentGetCoin() const override { return true; }
+
+    std::vector<COutPoint> Outpoints() const
+    {
+        std::vector<COutPoint> outpoints;
+        for (const auto& entry : m_coins) outpoints.push_back(entry.first);
+        return outpoints;
+    }
+};
+
+static const size_t FETCH_COUNT = 500;
+static const int PREFETCH_THREADS = 8;
+
+// Cold-cache lookups of a block's worth of inputs, one database read at a time.
+static void CCoinsFetchSerial(benchmark::State& state)
+{
+    DelayedCoinsView base(FETCH_COUNT);
+    std::vector<COutPoint> outpoints = base.Outpoints();
+    while (state.KeepRunning()) {
+        CCoinsViewCache cache(&base);
+        for (const COutPoint& outpoint : outpoints) {
+            assert(!cache.AccessCoin(outpoint).IsSpent());
+        }
+    }
+}
+
+// The same lookups, preceded by a prefetch on the threads of a check queue,
+// as done in ConnectBlock().
+static void CCoinsFetchPrefetch(benchmark::State& state)
+{
+    struct NoCheck {
+        bool operator()() { return true; }
+        void swap(NoCheck& x) {}
+    };
+    CCheckQueue<NoCheck> queue(128);
+    boost::thread_group tg;
+    for (int i = 1; i < PREFETCH_THREADS; ++i) {
+        tg.create_thread([&]{queue.Thread();});
+    }
+    DelayedCoinsView base(FETCH_COUNT);
+    std::vector<COutPoint> outpoints = base.Outpoints();
+    while (state.KeepRunning()) {
+        CCoinsViewCache cache(&base);
+        CCheckQueueControl<NoCheck> control(&queue);
+        cache.PrefetchCoins(outpoints, [&control](size_t count, const std::function<void(size_t)>& fn) { control.ForEach(count, fn); });
+        for (const COutPoint& outpoint : outpoints) {
+            assert(!cache.AccessCoin(outpoint).IsSpent());
+        }
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
+
+BENCHMARK(CCoinsFetchSerial, 20);
+BENCHMARK(CCoinsFetchPrefetch, 120);
+
+// Compare the flat CCoinsMap with the node-based map it replaced.
+typedef std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher> NodeCoinsMap;
+
+static const size_t MAP_ENTRIES = 100000;
+
+static std::vector<COutPoint> RandomOutpoints(size_t count)
+{
+    FastRandomContext rng(true);
+    std::vector<COutPoint> outpoints;
+    outpoints.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        outpoints.emplace_back(rng.rand256(), rng.randbits(2));
+    }
+    return outpoints;
+}
+
+template <typename Map>
+static void FillCoinsMap(Map& map, const std::vector<COutPoint>& outpoints)
+{
+    for (const COutPoint& outpoint : outpoints) {
+        CCoinsCacheEntry& entry = map[outpoint];
+        entry.coin.out.nValue = 1;
+        entry.flags = CCoinsCacheEntry::DIRTY;
+    }
+}
+
+// Insertion throughput. The first run also reports the memory used per entry.
+template <typename Map>
+static void CoinsMapInsert(benchmark::State& state, const char* name)
+{
+    std::vector<COutPoint> outpoints = RandomOutpoints(MAP_ENTRIES);
+    bool reported = false;
+    while (state.KeepRunning()) {
+        Map map;
+        FillCoinsMap(map, outpoints);
+        if (!reported) {
+            std::cerr << name << ": " << memusage::DynamicUsage(map) / map.size() << " bytes per entry" << std::endl;
+            reported = true;
+        }
+    }
+}
+
+// Lookup throughput of existing entries, in random order.
+template <typename Map>
+static void CoinsMapLookup(benchmark::State& state)
+{
+    std::vector<COutPoint> outpoints = RandomOutpoints(MAP_ENTRIES);
+    Map map;
+    FillCoinsMap(map, outpoints);
+    size_t found = 0;
+    while (state.KeepRunning()) {
+        for (size_t i = 0; i < 1000; ++i) {
+            found += map.count(outpoints[(i * 7919) % MAP_ENTRIES]);
+        }
+    }
+    assert(found % 1000 == 0);
+}
+
+static void CCoinsMapInsert(benchmark::State& state) { CoinsMapInsert<CCoinsMap>(state, "CCoinsMap"); }
+static void CCoinsMapInsertNodeBased(benchmark::State& state) { CoinsMapInsert<NodeCoinsMap>(state, "std::unordered_map"); }
+static void CCoinsMapLookup(benchmark::State& state) { CoinsMapLookup<CCoinsMap>(state); }
+static void CCoinsMapLookupNodeBased(benchmark::State& state) { CoinsMapLookup<NodeCoinsMap>(state); }
+
+BENCHMARK(CCoinsMapInsert, 50);
+BENCHMARK(CCoinsMapInsertNodeBased, 30);
+BENCHMARK(CCoinsMapLookup, 15000);
+BENCHMARK(CCoinsMapLookupNodeBased, 10000);
@@ -20,8 +20,9 @@ static const unsigned int QUEUE_BATCH_SIZE = 128;
 
 // This Benchmark tests the CheckQueue with a slightly realistic workload,
 // where checks all contain a prevector that is indirect 50% of the time
-// and there is a little bit of work done between calls to Add.
-static void CCheckQueueSpeedPrevectorJob(benchmark::State& state)
+// and there is a little bit of work done between calls to Add. The given
+// number of worker threads is started besides the master.
+static void CCheckQueueSpeedPrevectorJobThreads(benchmark::State& state, int threads)
 {
     struct PrevectorJob {
         prevector<PREVECTOR_SIZE, uint8_t> p;
@@ -38,7 +39,7 @@ static void CCheckQueueSpeedPrevectorJob(benchmark::State& state)
     };
     CCheckQueue<PrevectorJob> queue {QUEUE_BATCH_SIZE};
     boost::thread_group tg;
-    for (auto x = 0; x < std::max(MIN_CORES, GetNumCores()); ++x) {
+    for (auto x = 0; x < threads; ++x) {
        tg.create_thread([&]{queue.Thread();});
     }
     while (state.KeepRunning()) {
@@ -59,4 +60,20 @@ static void CCheckQueueSpeedPrevectorJob(benchmark::State& state)
     tg.interrupt_all();
     tg.join_all();
 }
+
+static void CCheckQueueSpeedPrevectorJob(benchmark::State& state)
+{
+    CCheckQueueSpeedPrevectorJobThreads(state, std::max(MIN_CORES, GetNumCores()));
+}
+
+// Scaling of the queue overhead with the number of threads.
+static void CCheckQueueSpeedPrevectorJob1(benchmark::State& state) { CCheckQueueSpeedPrevectorJobThreads(state, 0); }
+static void CCheckQueueSpeedPrevectorJob4(benchmark::State& state) { CCheckQueueSpeedPrevectorJobThreads(state, 3); }
+static void CCheckQueueSpeedPrevectorJob16(benchmark::State& state) { CCheckQueueSpeedPrevectorJobThreads(state, 15); }
+static void CCheckQueueSpeedPrevectorJob64(benchmark::State& state) { CCheckQueueSpeedPrevectorJobThreads(state, 63); }
+
 BENCHMARK(CCheckQueueSpeedPrevectorJob, 1400);
+BENCHMARK(CCheckQueueSpeedPrevectorJob1, 1400);
+BENCHMARK(CCheckQueueSpeedPrevectorJob4, 1400);
+BENCHMARK(CCheckQueueSpeedPrevectorJob16, 1400);
+BENCHMARK(CCheckQueueSpeedPrevectorJob64, 1400);
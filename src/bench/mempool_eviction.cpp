@@ -2,6 +2,7 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <arith_uint256.h>
 #include <bench/bench.h>
 #include <policy/policy.h>
 #include <txmempool.h>
@@ -131,4 +132,87 @@ static void MempoolEviction(benchmark::State& state)
     }
 }
 
+// Add a few thousand transactions, half of which spend an output of the one
+// before, and remove them all again as if they were included in a block.
+static void MempoolAddRemoveForBlock(benchmark::State& state)
+{
+    constexpr size_t NUM_TXS{2000};
+    std::vector<CTransactionRef> txs;
+    txs.reserve(NUM_TXS);
+    for (size_t i = 0; i < NUM_TXS; ++i) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        if (i % 2) {
+            tx.vin[0].prevout = COutPoint(txs.back()->GetHash(), 0);
+        } else {
+            tx.vin[0].prevout = COutPoint(ArithToUint256(arith_uint256(i + 1)), 0);
+        }
+        tx.vin[0].scriptSig = CScript() << OP_1;
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+        tx.vout[0].nValue = 10 * COIN;
+        txs.push_back(MakeTransactionRef(tx));
+    }
+
+    CTxMemPool pool;
+    LOCK(pool.cs);
+    while (state.KeepRunning()) {
+        for (const CTransactionRef& tx : txs) {
+            AddTx(tx, 1000LL, pool);
+        }
+        pool.removeForBlock(txs, 1);
+    }
+}
+
+// Build chains of transactions whose feerate drops towards their tips, and
+// evict them all. Eviction takes each chain apart from the tip, one
+// transaction at a time, like a flood of low-feerate chained transactions
+// would have to be during a fee spike.
+static void EvictChains(benchmark::State& state, size_t num_chains, size_t chain_length)
+{
+    std::vector<std::pair<CTransactionRef, CAmount>> txs;
+    txs.reserve(num_chains * chain_length);
+    for (size_t chain = 0; chain < num_chains; ++chain) {
+        for (size_t depth = 0; depth < chain_length; ++depth) {
+            CMutableTransaction tx;
+            tx.vin.resize(1);
+            if (depth) {
+                tx.vin[0].prevout = COutPoint(txs.back().first->GetHash(), 0);
+            } else {
+                tx.vin[0].prevout = COutPoint(ArithToUint256(arith_uint256(chain + 1)), 0);
+            }
+            tx.vin[0].scriptSig = CScript() << OP_1;
+            tx.vout.resize(1);
+            tx.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+            tx.vout[0].nValue = 10 * COIN;
+            // Interleave the chains in eviction order
+            const CAmount fee = 1000 + 100 * (chain_length - depth) + chain;
+            txs.emplace_back(MakeTransactionRef(tx), fee);
+        }
+    }
+
+    CTxMemPool pool;
+    LOCK(pool.cs);
+    while (state.KeepRunning()) {
+        for (const auto& tx : txs) {
+            AddTx(tx.first, tx.second, pool);
+        }
+        pool.TrimToSize(pool.DynamicMemoryUsage() / 2);
+        pool.TrimToSize(0);
+    }
+}
+
+static void MempoolEvictionChains(benchmark::State& state)
+{
+    EvictChains(state, 100, 25);
+}
+
+static void MempoolEvictionLongChains(benchmark::State& state)
+{
+    EvictChains(state, 4, 500);
+}
+
 BENCHMARK(MempoolEviction, 41000);
+BENCHMARK(MempoolEvictionChains, 10);
+BENCHMARK(MempoolEvictionLongChains, 2);
+BENCHMARK(MempoolAddRemoveForBlock, 10);
@@ -0,0 +1,63 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+
+#include <chainparams.h>
+#include <net_processing.h>
+#include <netmessagemaker.h>
+#include <netmsgcache.h>
+#include <primitives/block.h>
+#include <protocol.h>
+#include <streams.h>
+
+namespace block_bench {
+#include <bench/data/block413567.raw.h>
+} // namespace block_bench
+
+static const int RELAY_PEERS = 100;
+
+static CBlock LoadBlock()
+{
+    SelectParams(CBaseChainParams::MAIN);
+    CDataStream stream((const char*)block_bench::block413567,
+            (const char*)&block_bench::block413567[sizeof(block_bench::block413567)],
+            SER_NETWORK, PROTOCOL_VERSION);
+    CBlock block;
+    stream >> block;
+    return block;
+}
+
+// A new block requested by 100 peers, serialized and framed for each of them
+static void RelayBlockUncached(benchmark::State& state)
+{
+    const CBlock block = LoadBlock();
+    const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+    while (state.KeepRunning()) {
+        for (int i = 0; i < RELAY_PEERS; i++) {
+            CFramedNetMsgRef msg = CConnman::FrameMessage(msgMaker.Make(NetMsgType::BLOCK, block));
+            assert(msg->PayloadSize() == sizeof(block_bench::block413567));
+        }
+    }
+}
+
+// The same block, serialized and framed once and then taken from the cache
+static void RelayBlockCached(benchmark::State& state)
+{
+    const CBlock block = LoadBlock();
+    const uint256 hash = block.GetHash();
+    const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+    while (state.KeepRunning()) {
+        NetMsgCache cache(RELAY_MSG_CACHE_SIZE);
+        for (int i = 0; i < RELAY_PEERS; i++) {
+            CFramedNetMsgRef msg = cache.Get(hash, NetMsgType::BLOCK, 0, [&] {
+                return msgMaker.Make(NetMsgType::BLOCK, block);
+            });
+            assert(msg->PayloadSize() == sizeof(block_bench::block413567));
+        }
+    }
+}
+
+BENCHMARK(RelayBlockUncached, 5);
+BENCHMARK(RelayBlockCached, 500);
@@ -0,0 +1,206 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <chainparams.h>
+#include <hash.h>
+#include <net.h>
+#include <netbase.h>
+#include <scheduler.h>
+#include <streams.h>
+#include <util.h>
+#include <utiltime.h>
+
+#include <thread>
+
+// MSG_NOSIGNAL is not available on some platforms, if it doesn't exist define it as 0
+#if !defined(MSG_NOSIGNAL)
+#define MSG_NOSIGNAL 0
+#endif
+
+namespace {
+
+const unsigned short BENCH_PORT = 28610;
+
+/** Command of the messages CountingNetEvents takes a while to process */
+const char* const SLOW_COMMAND = "slow";
+
+/** Takes the messages the socket handler hands over, and counts them */
+class CountingNetEvents final : public NetEventsInterface
+{
+public:
+    std::atomic<uint64_t> nMessages{0};
+    std::atomic<uint64_t> nSlowMessages{0};
+
+    bool ProcessMessages(CNode* pnode, std::atomic<bool>& interrupt) override
+    {
+        std::list<CNetMessage> msgs;
+        {
+            LOCK(pnode->cs_vProcessMsg);
+            msgs.swap(pnode->vProcessMsg);
+            pnode->nProcessQueueSize = 0;
+            pnode->fPauseRecv = false;
+        }
+        for (const CNetMessage& msg : msgs) {
+            if (msg.hdr.GetCommand() == SLOW_COMMAND) {
+                // Stands in for a message that waits on the disk
+                MilliSleep(2);
+                ++nSlowMessages;
+            } else {
+                ++nMessages;
+            }
+        }
+        return false;
+    }
+    bool SendMessages(CNode* pnode) override { return false; }
+    void InitializeNode(CNode* pnode) override {}
+    void FinalizeNode(NodeId id, bool& update_connection_time) override {}
+};
+
+/** A connection manager listening on loopback, with clients connected to it */
+class LoopbackPeers
+{
+public:
+    CountingNetEvents events;
+    CScheduler scheduler;
+    CConnman connman{0x1337, 0x1337};
+    std::vector<SOCKET> clients;
+
+    LoopbackPeers(SocketEventsMode mode, int threads, int peers)
+    {
+        SelectParams(CBaseChainParams::REGTEST);
+        RaiseFileDescriptorLimit(2 * peers + 256);
+        gArgs.ForceSetArg("-dnsseed", "0");
+
+        CConnman::Options options;
+        options.nMaxConnections = peers + 16;
+        options.nMaxAddnode = MAX_ADDNODE_CONNECTIONS;
+        options.m_msgproc = &events;
+        options.nSendBufferMaxSize = 1000 * DEFAULT_MAXSENDBUFFER;
+        options.nReceiveFloodSize = 1000 * DEFAULT_MAXRECEIVEBUFFER;
+        options.m_use_addrman_outgoing = false;
+        options.vBinds.push_back(LookupNumeric("127.0.0.1", BENCH_PORT));
+        options.socketEventsMode = mode;
+        options.nMsgHandlerThreads = threads;
+        if (!connman.Start(scheduler, options)) {
+            fprintf(stderr, "Failed to start the connection manager\n");
+            return;
+        }
+
+        const CService addr = LookupNumeric("127.0.0.1", BENCH_PORT);
+        for (int i = 0; i < peers; i++) {
+            SOCKET hSocket = CreateSocket(addr);
+            if (hSocket == INVALID_SOCKET || !ConnectSocketDirectly(addr, hSocket, 1000, true)) {
+                CloseSocket(hSocket);
+                break;
+            }
+            clients.push_back(hSocket);
+        }
+        while (connman.GetNodeCount(CConnman::CONNECTIONS_IN) < clients.size()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    ~LoopbackPeers()
+    {
+        for (SOCKET& hSocket : clients) {
+            CloseSocket(hSocket);
+        }
+        connman.Interrupt();
+        connman.Stop();
+    }
+
+    static void Send(SOCKET hSocket, const std::vector<unsigned char>& message)
+    {
+        send(hSocket, reinterpret_cast<const char*>(message.data()), message.size(), MSG_NOSIGNAL);
+    }
+};
+
+/** A message with an 8 byte payload, as it is framed on the wire */
+std::vector<unsigned char> MakeMessage(const char* command)
+{
+    std::vector<unsigned char> payload(8, 0);
+    std::vector<unsigned char> message;
+    uint256 hash = Hash(payload.begin(), payload.end());
+    CMessageHeader hdr(Params().MessageStart(), command, payload.size());
+    memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
+    CVectorWriter{SER_NETWORK, INIT_PROTO_VERSION, message, 0, hdr};
+    message.insert(message.end(), payload.begin(), payload.end());
+    return message;
+}
+
+} // namespace
+
+// Latency of one message, sent on one of many otherwise idle loopback
+// connections, from the socket to the message handler. The work select() and
+// poll() do grows with the number of connections, epoll's does not.
+static void SocketEventsRoundTrip(benchmark::State& state, SocketEventsMode mode, int peers)
+{
+    LoopbackPeers net(mode, 1, peers);
+    const std::vector<unsigned char> message = MakeMessage("ping");
+
+    uint64_t nSent = 0;
+    while (state.KeepRunning()) {
+        if (net.clients.empty()) continue;
+        LoopbackPeers::Send(net.clients[nSent % net.clients.size()], message);
+        ++nSent;
+        while (net.events.nMessages < nSent) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+// One message to each of 16 peers while one more peer keeps sending messages
+// that take 2ms each to process. A single message handler thread serves the
+// other peers after the slow one, more threads serve them alongside it.
+static void MessageHandlerSlowPeer(benchmark::State& state, int threads)
+{
+    const size_t peers = 16;
+    LoopbackPeers net(GetSupportedSocketEventsModes().front(), threads, peers + 1);
+    const std::vector<unsigned char> message = MakeMessage("ping");
+    const std::vector<unsigned char> slow_message = MakeMessage(SLOW_COMMAND);
+
+    uint64_t nSent = 0;
+    uint64_t nSlowSent = 0;
+    while (state.KeepRunning()) {
+        if (net.clients.size() != peers + 1) continue;
+        if (net.events.nSlowMessages == nSlowSent) {
+            LoopbackPeers::Send(net.clients[peers], slow_message);
+            ++nSlowSent;
+        }
+        for (size_t i = 0; i < peers; i++) {
+            LoopbackPeers::Send(net.clients[i], message);
+        }
+        nSent += peers;
+        while (net.events.nMessages < nSent) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+static void SocketEventsSelect25(benchmark::State& state) { SocketEventsRoundTrip(state, SocketEventsMode::Select, 25); }
+static void SocketEventsSelect400(benchmark::State& state) { SocketEventsRoundTrip(state, SocketEventsMode::Select, 400); }
+BENCHMARK(SocketEventsSelect25, 2000);
+BENCHMARK(SocketEventsSelect400, 2000);
+
+#ifdef USE_POLL
+static void SocketEventsPoll25(benchmark::State& state) { SocketEventsRoundTrip(state, SocketEventsMode::Poll, 25); }
+static void SocketEventsPoll400(benchmark::State& state) { SocketEventsRoundTrip(state, SocketEventsMode::Poll, 400); }
+BENCHMARK(SocketEventsPoll25, 2000);
+BENCHMARK(SocketEventsPoll400, 2000);
+#endif
+
+#ifdef USE_EPOLL
+static void SocketEventsEPoll25(benchmark::State& state) { SocketEventsRoundTrip(state, SocketEventsMode::EPoll, 25); }
+static void SocketEventsEPoll400(benchmark::State& state) { SocketEventsRoundTrip(state, SocketEventsMode::EPoll, 400); }
+static void SocketEventsEPoll2000(benchmark::State& state) { SocketEventsRoundTrip(state, SocketEventsMode::EPoll, 2000); }
+BENCHMARK(SocketEventsEPoll25, 2000);
+BENCHMARK(SocketEventsEPoll400, 2000);
+BENCHMARK(SocketEventsEPoll2000, 2000);
+#endif
+
+static void MessageHandlerSlowPeer1Thread(benchmark::State& state) { MessageHandlerSlowPeer(state, 1); }
+static void MessageHandlerSlowPeer4Threads(benchmark::State& state) { MessageHandlerSlowPeer(state, 4); }
+BENCHMARK(MessageHandlerSlowPeer1Thread, 500);
+BENCHMARK(MessageHandlerSlowPeer4Threads, 500);
@@ -3,6 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <bench/bench.h>
+#include <checkqueue.h>
 #include <key.h>
 #if defined(HAVE_CONSENSUS_LIB)
 #include <script/bitcoinconsensus.h>
@@ -14,6 +15,8 @@
 
 #include <array>
 
+#include <boost/thread/thread.hpp>
+
 // FIXME: Dedup with BuildCreditingTransaction in test/script_tests.cpp.
 static CMutableTransaction BuildCreditingTransaction(const CScript& scriptPubKey)
 {
@@ -107,3 +110,89 @@ static void VerifyScriptBench(benchmark::State& state)
 }
 
 BENCHMARK(VerifyScriptBench, 6300);
+
+// Spend of a P2WPKH output, verified by VerifyScriptParallel.
+struct P2WPKHSpend {
+    CMutableTransaction txCredit;
+    CMutableTransaction txSpend;
+};
+
+struct P2WPKHSpendCheck {
+    const P2WPKHSpend* spend = nullptr;
+
+    bool operator()()
+    {
+        ScriptError err;
+        return VerifyScript(
+            spend->txSpend.vin[0].scriptSig,
+            spend->txCredit.vout[0].scriptPubKey,
+            &spend->txSpend.vin[0].scriptWitness,
+            SCRIPT_VERIFY_WITNESS | SCRIPT_VERIFY_P2SH,
+            MutableTransactionSignatureChecker(&spend->txSpend, 0, spend->txCredit.vout[0].nValue),
+            &err);
+    }
+    void swap(P2WPKHSpendCheck& x) { std::swap(spend, x.spend); }
+};
+
+static const size_t PARALLEL_SPENDS = 256;
+static const size_t PARALLEL_KEYS = 32;
+
+// Throughput of script verification on a check queue with the given number
+// of threads, for a block-like batch of P2WPKH spends of which several pay to
+// the same key. Every iteration verifies PARALLEL_SPENDS signatures.
+static void VerifyScriptParallel(benchmark::State& state, int threads)
+{
+    std::vector<CKey> keys(PARALLEL_KEYS);
+    for (size_t i = 0; i < keys.size(); ++i) {
+        std::array<unsigned char, 32> vchKey{};
+        vchKey[31] = i + 1;
+        keys[i].Set(vchKey.begin(), vchKey.end(), true);
+    }
+    std::vector<P2WPKHSpend> spends(PARALLEL_SPENDS);
+    for (size_t i = 0; i < spends.size(); ++i) {
+        const CKey& key = keys[i % keys.size()];
+        CPubKey pubkey = key.GetPubKey();
+        uint160 pubkeyHash;
+        CHash160().Write(pubkey.begin(), pubkey.size()).Finalize(pubkeyHash.begin());
+        CScript witScriptPubkey = CScript() << OP_DUP << OP_HASH160 << ToByteVector(pubkeyHash) << OP_EQUALVERIFY << OP_CHECKSIG;
+
+        P2WPKHSpend& spend = spends[i];
+        spend.txCredit = BuildCreditingTransaction(CScript() << 0 << ToByteVector(pubkeyHash));
+        spend.txCredit.nLockTime = i;
+        spend.txSpend = BuildSpendingTransaction(CScript(), spend.txCredit);
+        CScriptWitness& witness = spend.txSpend.vin[0].scriptWitness;
+        witness.stack.emplace_back();
+        key.Sign(SignatureHash(witScriptPubkey, spend.txSpend, 0, SIGHASH_ALL, spend.txCredit.vout[0].nValue, SigVersion::WITNESS_V0), witness.stack.back());
+        witness.stack.back().push_back(static_cast<unsigned char>(SIGHASH_ALL));
+        witness.stack.push_back(ToByteVector(pubkey));
+    }
+
+    CCheckQueue<P2WPKHSpendCheck> queue(128);
+    boost::thread_group tg;
+    // The thread running the benchmark joins the workers while waiting.
+    for (int i = 0; i < threads - 1; ++i) {
+        tg.create_thread([&]{queue.Thread();});
+    }
+    while (state.KeepRunning()) {
+        CCheckQueueControl<P2WPKHSpendCheck> control(&queue);
+        std::vector<P2WPKHSpendCheck> checks(spends.size());
+        for (size_t i = 0; i < spends.size(); ++i) {
+            checks[i].spend = &spends[i];
+        }
+        control.Add(checks);
+        bool success = control.Wait();
+        assert(success);
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
+
+static void VerifyScriptParallel1(benchmark::State& state) { VerifyScriptParallel(state, 1); }
+static void VerifyScriptParallel4(benchmark::State& state) { VerifyScriptParallel(state, 4); }
+static void VerifyScriptParallel16(benchmark::State& state) { VerifyScriptParallel(state, 16); }
+static void VerifyScriptParallel64(benchmark::State& state) { VerifyScriptParallel(state, 64); }
+
+BENCHMARK(VerifyScriptParallel1, 25);
+BENCHMARK(VerifyScriptParallel4, 100);
+BENCHMARK(VerifyScriptParallel16, 100);
+BENCHMARK(VerifyScriptParallel64, 100);
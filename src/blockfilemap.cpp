@@ -0,0 +1,102 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockfilemap.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+
+/** Current size of the file at path, or -1 if it cannot be determined. */
+static int64_t GetFileSize(const fs::path& path)
+{
+#ifndef WIN32
+    struct stat st;
+    if (stat(path.string().c_str(), &st) != 0) return -1;
+    return st.st_size;
+#else
+    return -1;
+#endif
+}
+
+std::shared_ptr<const MappedFile> MappedFile::Open(const fs::path& path)
+{
+#ifndef WIN32
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd == -1) return nullptr;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return nullptr;
+    }
+    size_t size = st.st_size;
+    void* data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    // The mapping keeps its own reference to the file.
+    close(fd);
+    if (data == MAP_FAILED) return nullptr;
+    return std::shared_ptr<const MappedFile>(new MappedFile(static_cast<const uint8_t*>(data), size));
+#else
+    // Not supported; callers fall back to regular file reads.
+    return nullptr;
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+#ifndef WIN32
+    munmap(const_cast<uint8_t*>(m_data), m_size);
+#endif
+}
+
+BlockFileMap::BlockFileMap(size_t max_files, std::function<fs::path(int)> path_of) : m_max_files(max_files), m_path_of(std::move(path_of))
+{
+}
+
+std::shared_ptr<const MappedFile> BlockFileMap::Get(int nFile, size_t min_size)
+{
+    if (m_max_files == 0) return nullptr;
+    // Check the file first, as it may have been truncated since it was mapped.
+    const fs::path path = m_path_of(nFile);
+    const int64_t file_size = GetFileSize(path);
+    if (file_size < 0 || (uint64_t)file_size < min_size) return nullptr;
+
+    LOCK(m_mutex);
+    auto it = std::find_if(m_entries.begin(), m_entries.end(), [nFile](const Entry& entry) { return entry.nFile == nFile; });
+    if (it != m_entries.end() && it->file->size() >= min_size && it->file->size() <= (uint64_t)file_size) {
+        it->last_used = ++m_use_counter;
+        return it->file;
+    }
+
+    // Not mapped yet, or the file has grown or shrunk since it was mapped.
+    std::shared_ptr<const MappedFile> file = MappedFile::Open(path);
+    if (!file || file->size() < min_size) return nullptr;
+    if (it == m_entries.end()) {
+        if (m_entries.size() >= m_max_files) {
+            it = std::min_element(m_entries.begin(), m_entries.end(), [](const Entry& a, const Entry& b) { return a.last_used < b.last_used; });
+        } else {
+            it = m_entries.emplace(m_entries.end());
+        }
+    }
+    it->nFile = nFile;
+    it->last_used = ++m_use_counter;
+    it->file = file;
+    return file;
+}
+
+void BlockFileMap::Erase(int nFile)
+{
+    LOCK(m_mutex);
+    m_entries.erase(std::remove_if(m_entries.begin(), m_entries.end(), [nFile](const Entry& entry) { return entry.nFile == nFile; }), m_entries.end());
+}
+
+size_t BlockFileMap::size() const
+{
+    LOCK(m_mutex);
+    return m_entries.size();
+}
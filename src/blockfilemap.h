@@ -0,0 +1,93 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILEMAP_H
+#define BITCOIN_BLOCKFILEMAP_H
+
+#include <fs.h>
+#include <span.h>
+#include <sync.h>
+
+#include <stdint.h>
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+/** Read-only memory mapping of a whole file, as large as the file was when
+ *  it was mapped. The mapping stays valid for as long as it is referenced,
+ *  even if the file is removed in the meantime.
+ */
+class MappedFile
+{
+public:
+    //! Map the file at path. Returns nullptr if it cannot be mapped.
+    static std::shared_ptr<const MappedFile> Open(const fs::path& path);
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+
+    Span<const uint8_t> Data() const { return Span<const uint8_t>(m_data, m_size); }
+    size_t size() const { return m_size; }
+
+private:
+    MappedFile(const uint8_t* data, size_t size) : m_data(data), m_size(size) {}
+
+    const uint8_t* m_data;
+    size_t m_size;
+};
+
+/** Bounded set of memory mapped block files, keyed by file number.
+ *
+ * Blocks are only ever appended to block files, so the bytes of a block that
+ * was written never change. The rest of a file is preallocated space, which
+ * is filled in as blocks are appended (a shared mapping shows those writes)
+ * and cut off when the file is finalized. A file that has grown beyond its
+ * mapping since it was mapped is mapped again on request. When more than the
+ * configured number of files would be mapped, the least recently used mapping
+ * is dropped.
+ *
+ * Touching a mapped page past the end of its file raises SIGBUS instead of
+ * failing like a read would, so the size of the file is checked before a
+ * mapping is handed out, and a mapping larger than its file is replaced. A
+ * file that is truncated while a mapping of it is being read from, or a disk
+ * error while reading, still raises SIGBUS.
+ */
+class BlockFileMap
+{
+public:
+    /**
+     * @param[in] max_files  maximum number of files kept mapped
+     * @param[in] path_of    returns the path of the block file with a given number
+     */
+    BlockFileMap(size_t max_files, std::function<fs::path(int)> path_of);
+
+    /** Get a mapping of file nFile that is at least min_size bytes large and
+     *  no larger than the file currently is, or nullptr if the file is
+     *  smaller or cannot be mapped. */
+    std::shared_ptr<const MappedFile> Get(int nFile, size_t min_size);
+
+    //! Drop the mapping of file nFile, if any, e.g. because it was deleted.
+    void Erase(int nFile);
+
+    //! Number of files currently mapped.
+    size_t size() const;
+
+private:
+    struct Entry {
+        int nFile;
+        uint64_t last_used;
+        std::shared_ptr<const MappedFile> file;
+    };
+
+    const size_t m_max_files;
+    const std::function<fs::path(int)> m_path_of;
+
+    mutable Mutex m_mutex;
+    std::vector<Entry> m_entries GUARDED_BY(m_mutex);
+    uint64_t m_use_counter GUARDED_BY(m_mutex) = 0;
+};
+
+#endif // BITCOIN_BLOCKFILEMAP_H
@@ -8,6 +8,11 @@
 #include <sync.h>
 
 #include <algorithm>
+#include <assert.h>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
 #include <vector>
 
 #include <boost/thread/condition_variable.hpp>
@@ -25,12 +30,44 @@ class CCheckQueueControl;
   * onto the queue, where they are processed by N-1 worker threads. When
   * the master is done adding work, it temporarily joins the worker pool
   * as an N'th worker, until all jobs are done.
+  *
+  * Every thread has its own work queue, with its own lock. Batches of
+  * verifications are added to the work queues in turn. A thread takes batches
+  * from the back of its own queue, and once that is empty steals batches
+  * from the front of the other queues. The shared mutex is only used by
+  * threads that are about to sleep because there is no work left.
+  *
+  * Besides checks of type T, the workers can be used to run an arbitrary
+  * function over a range of indices, see ForEach().
   */
 template <typename T>
 class CCheckQueue
 {
 private:
-    //! Mutex to protect the inner state
+    //! Work of one thread, which other threads may steal from.
+    struct WorkQueue {
+        boost::mutex mutex;
+        //! Verifications; the owner takes from the back, thieves from the front.
+        std::deque<T> checks;
+        //! ForEach() indices [nRangeBegin, nRangeEnd); the owner takes from the front, thieves from the back.
+        size_t nRangeBegin = 0;
+        size_t nRangeEnd = 0;
+        //! Number of verifications and indices in the queue, readable without the lock.
+        std::atomic<size_t> nSize{0};
+    };
+
+    //! Maximum number of threads with a work queue of their own. Any further
+    //! worker threads only steal.
+    static const int MAX_QUEUES = 128;
+
+    //! Work queues. Queue 0 belongs to the master, the others to worker
+    //! threads in the order in which they started.
+    std::unique_ptr<WorkQueue[]> queues;
+
+    //! Number of worker threads that have started.
+    std::atomic<int> nWorkers;
+
+    //! Mutex to protect sleeping, and waking up, threads.
     boost::mutex mutex;
 
     //! Worker threads block on this when out of work
@@ -39,88 +76,131 @@ private:
     //! Master thread blocks on this when out of work
     boost::condition_variable condMaster;
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
-
-    //! The number of workers (including the master) that are idle.
+    //! The number of worker threads that are idle.
     int nIdle;
 
-    //! The total number of workers (including the master).
-    int nTotal;
-
-    //! The temporary evaluation result.
-    bool fAllOk;
+    //! Number of verifications and indices that have been added to the work
+    //! queues, but have not been taken from them yet.
+    std::atomic<size_t> nQueued;
 
     /**
-     * Number of verifications that haven't completed yet.
-     * This includes elements that are no longer queued, but still in the
-     * worker's own batches.
+     * Number of verifications and indices that haven't completed yet.
+     * This includes elements that are no longer queued, but still in a
+     * thread's own batch.
      */
-    unsigned int nTodo;
+    std::atomic<size_t> nTodo;
+
+    //! The temporary evaluation result.
+    std::atomic<bool> fAllOk;
 
     //! The maximum number of elements to be processed in one batch
     unsigned int nBatchSize;
 
-    /** Internal function that does bulk of the verification work. */
-    bool Loop(bool fMaster = false)
+    //! The work queue the next batch of the master is added to first.
+    unsigned int nNextQueue;
+
+    //! The function being run by ForEach(), if any.
+    const std::function<void(size_t)>* pForEachFn;
+
+    int NumQueues() const
     {
-        boost::condition_variable& cond = fMaster ? condMaster : condWorker;
-        std::vector<T> vChecks;
-        vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
-        do {
-            {
-                boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master it can exit and return the result
-                        condMaster.notify_one();
+        return std::min(1 + nWorkers.load(), MAX_QUEUES);
+    }
+
+    //! Size of a batch taken from a queue holding n elements.
+    size_t BatchSize(size_t n) const
+    {
+        return std::max<size_t>(1, std::min<size_t>(nBatchSize, n / 2));
+    }
+
+    /**
+     * Take a batch of work, from the work queue of thread self if possible,
+     * and from those of the other threads otherwise. The batch is either
+     * a number of verifications, swapped into vChecks, or the range of
+     * ForEach() indices [nBegin, nEnd).
+     */
+    bool Take(int self, std::vector<T>& vChecks, size_t& nBegin, size_t& nEnd)
+    {
+        if (nQueued.load() == 0)
+            return false;
+        const int nQueues = NumQueues();
+        const int nFirst = self >= 0 ? self : 0;
+        for (int k = 0; k < nQueues; k++) {
+            const bool fOwn = k == 0 && self >= 0;
+            WorkQueue& q = queues[(nFirst + k) % nQueues];
+            if (q.nSize.load(std::memory_order_relaxed) == 0)
+                continue;
+            boost::unique_lock<boost::mutex> lock(q.mutex);
+            if (q.nRangeBegin < q.nRangeEnd) {
+                const size_t nNow = BatchSize(q.nRangeEnd - q.nRangeBegin);
+                if (fOwn) {
+                    nBegin = q.nRangeBegin;
+                    q.nRangeBegin += nNow;
+                    nEnd = q.nRangeBegin;
                 } else {
-                    // first iteration
-                    nTotal++;
+                    nEnd = q.nRangeEnd;
+                    q.nRangeEnd -= nNow;
+                    nBegin = q.nRangeEnd;
                 }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if (fMaster && nTodo == 0) {
-                        nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
-                        // return the current status
-                        return fRet;
-                    }
-                    nIdle++;
-                    cond.wait(lock); // wait
-                    nIdle--;
-                }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
+                q.nSize -= nNow;
+                nQueued -= nNow;
+                return true;
+            }
+            if (!q.checks.empty()) {
+                const size_t nNow = BatchSize(q.checks.size());
                 vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                    // queue to the local batch vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
+                for (size_t i = 0; i < nNow; i++) {
+                    // Swap jobs instead of copying, to keep the lock short.
+                    if (fOwn) {
+                        vChecks[i].swap(q.checks.back());
+                        q.checks.pop_back();
+                    } else {
+                        vChecks[i].swap(q.checks.front());
+                        q.checks.pop_front();
+                    }
                 }
-                // Check whether we need to do work at all
-                fOk = fAllOk;
+                q.nSize -= nNow;
+                nQueued -= nNow;
+                return true;
             }
-            // execute work
-            for (T& check : vChecks)
-                if (fOk)
-                    fOk = check();
-            vChecks.clear();
-        } while (true);
+        }
+        return false;
+    }
+
+    //! Run a batch obtained from Take(), and account for its completion.
+    void Run(std::vector<T>& vChecks, size_t nBegin, size_t nEnd)
+    {
+        for (size_t i = nBegin; i < nEnd; i++)
+            (*pForEachFn)(i);
+        // Check whether we need to do work at all
+        bool fOk = fAllOk.load(std::memory_order_relaxed);
+        for (T& check : vChecks)
+            if (fOk)
+                fOk = check();
+        if (!fOk)
+            fAllOk = false;
+        const size_t nNow = vChecks.size() + (nEnd - nBegin);
+        // Destroy the checks before reporting them as done.
+        vChecks.clear();
+        if (nTodo.fetch_sub(nNow) == nNow) {
+            // We processed the last element; inform the master it can exit and return the result
+            boost::unique_lock<boost::mutex> lock(mutex);
+            condMaster.notify_one();
+        }
+    }
+
+    //! Wake up workers for n newly queued elements, but no more than the
+    //! number of batches they will be taken in.
+    void Notify(size_t n)
+    {
+        n = (n + BatchSize(n) - 1) / BatchSize(n);
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (n >= (size_t)nIdle) {
+            condWorker.notify_all();
+        } else {
+            for (size_t i = 0; i < n; i++)
+                condWorker.notify_one();
+        }
     }
 
 public:
@@ -128,33 +208,100 @@ public:
     boost::mutex ControlMutex;
 
     //! Create a new check queue
-    explicit CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), nBatchSize(nBatchSizeIn) {}
+    explicit CCheckQueue(unsigned int nBatchSizeIn) : queues(new WorkQueue[MAX_QUEUES]), nWorkers(0), nIdle(0), nQueued(0), nTodo(0), fAllOk(true), nBatchSize(nBatchSizeIn), nNextQueue(0), pForEachFn(nullptr) {}
 
     //! Worker thread
     void Thread()
     {
-        Loop();
+        const int id = 1 + nWorkers++;
+        const int self = id < MAX_QUEUES ? id : -1;
+        std::vector<T> vChecks;
+        vChecks.reserve(nBatchSize);
+        while (true) {
+            size_t nBegin = 0, nEnd = 0;
+            if (Take(self, vChecks, nBegin, nEnd)) {
+                Run(vChecks, nBegin, nEnd);
+                continue;
+            }
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (nQueued.load() == 0) {
+                nIdle++;
+                condWorker.wait(lock); // wait
+                nIdle--;
+            }
+        }
     }
 
     //! Wait until execution finishes, and return whether all evaluations were successful.
     bool Wait()
     {
-        return Loop(true);
+        std::vector<T> vChecks;
+        vChecks.reserve(nBatchSize);
+        while (true) {
+            size_t nBegin = 0, nEnd = 0;
+            if (Take(0, vChecks, nBegin, nEnd)) {
+                Run(vChecks, nBegin, nEnd);
+                continue;
+            }
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (nTodo.load() == 0)
+                break;
+            if (nQueued.load() == 0)
+                condMaster.wait(lock); // wait
+        }
+        // reset the status for new work later
+        return fAllOk.exchange(true);
     }
 
     //! Add a batch of checks to the queue
     void Add(std::vector<T>& vChecks)
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        for (T& check : vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
+        const size_t n = vChecks.size();
+        if (n == 0)
+            return;
+        // Account for the checks before they can be completed.
+        nTodo += n;
+        // Every batch goes to the next work queue in turn; batches that are
+        // too large for one thread get split up by thieves.
+        WorkQueue& q = queues[nNextQueue++ % NumQueues()];
+        {
+            boost::unique_lock<boost::mutex> lock(q.mutex);
+            for (T& check : vChecks) {
+                q.checks.emplace_back();
+                q.checks.back().swap(check);
+            }
+            q.nSize += n;
+            nQueued += n;
         }
-        nTodo += vChecks.size();
-        if (vChecks.size() == 1)
-            condWorker.notify_one();
-        else if (vChecks.size() > 1)
-            condWorker.notify_all();
+        Notify(n);
+    }
+
+    /**
+     * Call fn(i) for every i in [0, count), spread over the worker threads and
+     * the calling thread, and return once all calls have finished. The order
+     * of the calls is unspecified and fn must not throw. Like Add() and
+     * Wait(), this may only be used by the holder of ControlMutex, and not
+     * while checks are pending.
+     */
+    void ForEach(size_t count, const std::function<void(size_t)>& fn)
+    {
+        if (count == 0)
+            return;
+        assert(nTodo.load() == 0);
+        pForEachFn = &fn;
+        nTodo += count;
+        const int nQueues = NumQueues();
+        for (int i = 0; i < nQueues; i++) {
+            WorkQueue& q = queues[i];
+            boost::unique_lock<boost::mutex> lock(q.mutex);
+            q.nRangeBegin = count * i / nQueues;
+            q.nRangeEnd = count * (i + 1) / nQueues;
+            q.nSize += q.nRangeEnd - q.nRangeBegin;
+            nQueued += q.nRangeEnd - q.nRangeBegin;
+        }
+        Notify(count);
+        Wait();
+        pForEachFn = nullptr;
     }
 
     ~CCheckQueue()
@@ -201,6 +348,17 @@ public:
             pqueue->Add(vChecks);
     }
 
+    //! Call fn(i) for every i in [0, count), see CCheckQueue::ForEach().
+    void ForEach(size_t count, const std::function<void(size_t)>& fn)
+    {
+        if (pqueue != nullptr) {
+            pqueue->ForEach(count, fn);
+        } else {
+            for (size_t i = 0; i < count; i++)
+                fn(i);
+        }
+    }
+
     ~CCheckQueueControl()
     {
         if (!fDone)
@@ -7,10 +7,18 @@
 #include <consensus/consensus.h>
 #include <random.h>
 
+#include <atomic>
+#include <exception>
+#include <map>
+
+//! Number of outpoints a prefetch worker looks up before claiming the next batch
+static const size_t PREFETCH_BATCH_SIZE = 64;
+
 bool CCoinsView::GetCoin(const COutPoint &outpoint, Coin &coin) const { return false; }
 uint256 CCoinsView::GetBestBlock() const { return uint256(); }
 std::vector<uint256> CCoinsView::GetHeadBlocks() const { return std::vector<uint256>(); }
-bool CCoinsView::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) { return false; }
+bool CCoinsView::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase) { return false; }
+bool CCoinsView::BatchWriteAsync(CCoinsMap &mapCoins, const uint256 &hashBlock) { return BatchWrite(mapCoins, hashBlock); }
 CCoinsViewCursor *CCoinsView::Cursor() const { return nullptr; }
 
 bool CCoinsView::HaveCoin(const COutPoint &outpoint) const
@@ -22,16 +30,19 @@ bool CCoinsView::HaveCoin(const COutPoint &outpoint) const
 CCoinsViewBacked::CCoinsViewBacked(CCoinsView *viewIn) : base(viewIn) { }
 bool CCoinsViewBacked::GetCoin(const COutPoint &outpoint, Coin &coin) const { return base->GetCoin(outpoint, coin); }
 bool CCoinsViewBacked::HaveCoin(const COutPoint &outpoint) const { return base->HaveCoin(outpoint); }
+bool CCoinsViewBacked::HasConcurrentGetCoin() const { return base->HasConcurrentGetCoin(); }
+size_t CCoinsViewBacked::PrefetchCoins(const std::vector<COutPoint>& outpoints, const CoinsForEachFn& for_each) const { return base->PrefetchCoins(outpoints, for_each); }
 uint256 CCoinsViewBacked::GetBestBlock() const { return base->GetBestBlock(); }
 std::vector<uint256> CCoinsViewBacked::GetHeadBlocks() const { return base->GetHeadBlocks(); }
 void CCoinsViewBacked::SetBackend(CCoinsView &viewIn) { base = &viewIn; }
-bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) { return base->BatchWrite(mapCoins, hashBlock); }
+bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase) { return base->BatchWrite(mapCoins, hashBlock, erase); }
+bool CCoinsViewBacked::BatchWriteAsync(CCoinsMap &mapCoins, const uint256 &hashBlock) { return base->BatchWriteAsync(mapCoins, hashBlock); }
 CCoinsViewCursor *CCoinsViewBacked::Cursor() const { return base->Cursor(); }
 size_t CCoinsViewBacked::EstimateSize() const { return base->EstimateSize(); }
 
 SaltedOutpointHasher::SaltedOutpointHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
 
-CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), cachedCoinsUsage(0) {}
+CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), cachedCoinsUsage(0), nEpoch(0) {}
 
 size_t CCoinsViewCache::DynamicMemoryUsage() const {
     return memusage::DynamicUsage(cacheCoins) + cachedCoinsUsage;
@@ -39,12 +50,15 @@ size_t CCoinsViewCache::DynamicMemoryUsage() const {
 
 CCoinsMap::iterator CCoinsViewCache::FetchCoin(const COutPoint &outpoint) const {
     CCoinsMap::iterator it = cacheCoins.find(outpoint);
-    if (it != cacheCoins.end())
+    if (it != cacheCoins.end()) {
+        it->second.epoch = nEpoch;
         return it;
+    }
     Coin tmp;
     if (!base->GetCoin(outpoint, tmp))
         return cacheCoins.end();
     CCoinsMap::iterator ret = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(outpoint), std::forward_as_tuple(std::move(tmp))).first;
+    ret->second.epoch = nEpoch;
     if (ret->second.coin.IsSpent()) {
         // The parent only has an empty entry for this outpoint; we can consider our
         // version as fresh.
@@ -81,6 +95,7 @@ void CCoinsViewCache::AddCoin(const COutPoint &outpoint, Coin&& coin, bool possi
     }
     it->second.coin = std::move(coin);
     it->second.flags |= CCoinsCacheEntry::DIRTY | (fresh ? CCoinsCacheEntry::FRESH : 0);
+    it->second.epoch = nEpoch;
     cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
 }
 
@@ -140,10 +155,11 @@ uint256 CCoinsViewCache::GetBestBlock() const {
 
 void CCoinsViewCache::SetBestBlock(const uint256 &hashBlockIn) {
     hashBlock = hashBlockIn;
+    ++nEpoch;
 }
 
-bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn) {
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); it = mapCoins.erase(it)) {
+bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn, bool erase) {
+    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); it = erase ? mapCoins.erase(it) : std::next(it)) {
         // Ignore non-dirty entries (optimization).
         if (!(it->second.flags & CCoinsCacheEntry::DIRTY)) {
             continue;
@@ -156,9 +172,14 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
                 // Otherwise we will need to create it in the parent
                 // and move the data up and mark it as dirty
                 CCoinsCacheEntry& entry = cacheCoins[it->first];
-                entry.coin = std::move(it->second.coin);
+                if (erase) {
+                    entry.coin = std::move(it->second.coin);
+                } else {
+                    entry.coin = it->second.coin;
+                }
                 cachedCoinsUsage += entry.coin.DynamicMemoryUsage();
                 entry.flags = CCoinsCacheEntry::DIRTY;
+                entry.epoch = nEpoch;
                 // We can mark it FRESH in the parent if it was FRESH in the child
                 // Otherwise it might have just been flushed from the parent's cache
                 // and already exist in the grandparent
@@ -185,9 +206,14 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
             } else {
                 // A normal modification.
                 cachedCoinsUsage -= itUs->second.coin.DynamicMemoryUsage();
-                itUs->second.coin = std::move(it->second.coin);
+                if (erase) {
+                    itUs->second.coin = std::move(it->second.coin);
+                } else {
+                    itUs->second.coin = it->second.coin;
+                }
                 cachedCoinsUsage += itUs->second.coin.DynamicMemoryUsage();
                 itUs->second.flags |= CCoinsCacheEntry::DIRTY;
+                itUs->second.epoch = nEpoch;
                 // NOTE: It is possible the child has a FRESH flag here in
                 // the event the entry we found in the parent is pruned. But
                 // we must not copy that FRESH flag to the parent as that
@@ -197,6 +223,7 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
         }
     }
     hashBlock = hashBlockIn;
+    ++nEpoch;
     return true;
 }
 
@@ -207,6 +234,76 @@ bool CCoinsViewCache::Flush() {
     return fOk;
 }
 
+bool CCoinsViewCache::FlushAsync() {
+    bool fOk = base->BatchWriteAsync(cacheCoins, hashBlock);
+    cacheCoins.clear();
+    cachedCoinsUsage = 0;
+    return fOk;
+}
+
+bool CCoinsViewCache::Sync(bool fAsync) {
+    bool fOk;
+    if (fAsync) {
+        // A background write needs its own copy of the modified entries.
+        CCoinsMap dirty;
+        for (const auto& entry : cacheCoins) {
+            if (entry.second.flags & CCoinsCacheEntry::DIRTY) {
+                dirty.emplace(entry.first, entry.second);
+            }
+        }
+        fOk = base->BatchWriteAsync(dirty, hashBlock);
+    } else {
+        fOk = base->BatchWrite(cacheCoins, hashBlock, false);
+    }
+    // The base now agrees with every remaining entry.
+    for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end();) {
+        if (it->second.coin.IsSpent()) {
+            cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+            it = cacheCoins.erase(it);
+        } else {
+            it->second.flags = 0;
+            ++it;
+        }
+    }
+    return fOk;
+}
+
+void CCoinsViewCache::Trim(size_t nTargetUsage) {
+    // The per-entry share of the map overhead is only an estimate, so repeat
+    // until the target is met or only modified entries are left.
+    size_t nUsage;
+    while ((nUsage = DynamicMemoryUsage()) > nTargetUsage && !cacheCoins.empty()) {
+        // Tally the memory held by unmodified entries per age.
+        const size_t nEntryOverhead = memusage::DynamicUsage(cacheCoins) / cacheCoins.size();
+        std::map<uint32_t, size_t> mapUsageByAge;
+        for (const auto& entry : cacheCoins) {
+            if (!(entry.second.flags & CCoinsCacheEntry::DIRTY)) {
+                mapUsageByAge[nEpoch - entry.second.epoch] += nEntryOverhead + entry.second.coin.DynamicMemoryUsage();
+            }
+        }
+        if (mapUsageByAge.empty()) return;
+
+        // Find the youngest age that has to go, starting from the oldest.
+        uint32_t nMinAge = 0;
+        size_t nFreed = 0;
+        for (auto it = mapUsageByAge.rbegin(); it != mapUsageByAge.rend(); ++it) {
+            nMinAge = it->first;
+            nFreed += it->second;
+            if (nFreed >= nUsage - nTargetUsage) break;
+        }
+
+        for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end();) {
+            if (!(it->second.flags & CCoinsCacheEntry::DIRTY) && nEpoch - it->second.epoch >= nMinAge) {
+                cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+                it = cacheCoins.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        cacheCoins.shrink_to_fit();
+    }
+}
+
 void CCoinsViewCache::Uncache(const COutPoint& hash)
 {
     CCoinsMap::iterator it = cacheCoins.find(hash);
@@ -216,6 +313,61 @@ void CCoinsViewCache::Uncache(const COutPoint& hash)
     }
 }
 
+size_t CCoinsViewCache::PrefetchCoins(const std::vector<COutPoint>& outpoints, const CoinsForEachFn& for_each) const
+{
+    std::vector<COutPoint> missing;
+    missing.reserve(outpoints.size());
+    for (const COutPoint& outpoint : outpoints) {
+        if (!cacheCoins.count(outpoint)) {
+            missing.push_back(outpoint);
+        }
+    }
+    if (missing.empty()) return 0;
+
+    std::vector<Coin> coins(missing.size());
+    std::vector<char> found(missing.size(), 0);
+    if (base->HasConcurrentGetCoin()) {
+        std::exception_ptr error;
+        std::atomic_flag error_set = ATOMIC_FLAG_INIT;
+        // Results land in per-index slots, so no further synchronization is
+        // needed until for_each returns. Calls of for_each must not throw.
+        const size_t batches = (missing.size() + PREFETCH_BATCH_SIZE - 1) / PREFETCH_BATCH_SIZE;
+        for_each(batches, [&](size_t batch) {
+            try {
+                const size_t end = std::min((batch + 1) * PREFETCH_BATCH_SIZE, missing.size());
+                for (size_t i = batch * PREFETCH_BATCH_SIZE; i < end; ++i) {
+                    found[i] = base->GetCoin(missing[i], coins[i]);
+                }
+            } catch (...) {
+                if (!error_set.test_and_set()) error = std::current_exception();
+            }
+        });
+        if (error) std::rethrow_exception(error);
+    } else {
+        base->PrefetchCoins(missing, for_each);
+        for (size_t i = 0; i < missing.size(); ++i) {
+            found[i] = base->GetCoin(missing[i], coins[i]);
+        }
+    }
+
+    size_t fetched = 0;
+    for (size_t i = 0; i < missing.size(); ++i) {
+        if (!found[i]) continue;
+        CCoinsMap::iterator it;
+        bool inserted;
+        std::tie(it, inserted) = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(missing[i]), std::forward_as_tuple(std::move(coins[i])));
+        it->second.epoch = nEpoch;
+        if (!inserted) continue; // duplicate outpoint in the input
+        if (it->second.coin.IsSpent()) {
+            // Same reasoning as in FetchCoin().
+            it->second.flags = CCoinsCacheEntry::FRESH;
+        }
+        cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
+        ++fetched;
+    }
+    return fetched;
+}
+
 unsigned int CCoinsViewCache::GetCacheSize() const {
     return cacheCoins.size();
 }
@@ -9,16 +9,16 @@
 #include <primitives/transaction.h>
 #include <compressor.h>
 #include <core_memusage.h>
+#include <flatmap.h>
 #include <hash.h>
 #include <memusage.h>
 #include <serialize.h>
 #include <uint256.h>
 
 #include <assert.h>
+#include <functional>
 #include <stdint.h>
 
-#include <unordered_map>
-
 /**
  * A UTXO entry.
  *
@@ -104,6 +104,7 @@ struct CCoinsCacheEntry
 {
     Coin coin; // The actual cached data.
     unsigned char flags;
+    uint32_t epoch; // Cache epoch in which this entry was last used, for eviction (fits in padding).
 
     enum Flags {
         DIRTY = (1 << 0), // This cache entry is potentially different from the version in the parent view.
@@ -115,11 +116,20 @@ struct CCoinsCacheEntry
          */
     };
 
-    CCoinsCacheEntry() : flags(0) {}
-    explicit CCoinsCacheEntry(Coin&& coin_) : coin(std::move(coin_)), flags(0) {}
+    CCoinsCacheEntry() : flags(0), epoch(0) {}
+    explicit CCoinsCacheEntry(Coin&& coin_) : coin(std::move(coin_)), flags(0), epoch(0) {}
 };
 
-typedef std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher> CCoinsMap;
+/**
+ * Map of cached coins. Entries are stored inline in a flatmap rather than in
+ * one heap node each, which saves the node, bucket and allocator overhead of
+ * std::unordered_map for every cached coin.
+ *
+ * Erasing an entry does not move the others, like with std::unordered_map.
+ * Only shrink_to_fit() does, which is called when trimming the cache after a
+ * flush (see flatmap).
+ */
+typedef flatmap<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher> CCoinsMap;
 
 /** Cursor for iterating over CoinsView state */
 class CCoinsViewCursor
@@ -141,6 +151,9 @@ private:
     uint256 hashBlock;
 };
 
+/** Calls fn(i) for every i in [0, count), possibly on several threads at once. */
+typedef std::function<void(size_t count, const std::function<void(size_t)>& fn)> CoinsForEachFn;
+
 /** Abstract view on the open txout dataset. */
 class CCoinsView
 {
@@ -154,6 +167,13 @@ public:
     //! Just check whether a given outpoint is unspent.
     virtual bool HaveCoin(const COutPoint &outpoint) const;
 
+    //! Whether GetCoin() may be called from several threads at once
+    virtual bool HasConcurrentGetCoin() const { return false; }
+
+    //! Load the given outpoints ahead of their use, see
+    //! CCoinsViewCache::PrefetchCoins(). By default, this does nothing.
+    virtual size_t PrefetchCoins(const std::vector<COutPoint>& outpoints, const CoinsForEachFn& for_each) const { return 0; }
+
     //! Retrieve the block hash whose state this CCoinsView currently represents
     virtual uint256 GetBestBlock() const;
 
@@ -164,8 +184,14 @@ public:
     virtual std::vector<uint256> GetHeadBlocks() const;
 
     //! Do a bulk modification (multiple Coin changes + BestBlock change).
-    //! The passed mapCoins can be modified.
-    virtual bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    //! The passed mapCoins can be modified, and its entries are consumed if
+    //! erase is true. Otherwise, they are copied and mapCoins is left intact.
+    virtual bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase = true);
+
+    //! Like BatchWrite, but the write may complete in the background after
+    //! this returns. The changes are visible to reads through this view
+    //! immediately. By default, this just calls BatchWrite.
+    virtual bool BatchWriteAsync(CCoinsMap &mapCoins, const uint256 &hashBlock);
 
     //! Get a cursor to iterate over the whole state
     virtual CCoinsViewCursor *Cursor() const;
@@ -188,10 +214,13 @@ public:
     CCoinsViewBacked(CCoinsView *viewIn);
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
     bool HaveCoin(const COutPoint &outpoint) const override;
+    bool HasConcurrentGetCoin() const override;
+    size_t PrefetchCoins(const std::vector<COutPoint>& outpoints, const CoinsForEachFn& for_each) const override;
     uint256 GetBestBlock() const override;
     std::vector<uint256> GetHeadBlocks() const override;
     void SetBackend(CCoinsView &viewIn);
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase) override;
+    bool BatchWriteAsync(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
     CCoinsViewCursor *Cursor() const override;
     size_t EstimateSize() const override;
 };
@@ -211,6 +240,9 @@ protected:
     /* Cached dynamic memory usage for the inner Coin objects. */
     mutable size_t cachedCoinsUsage;
 
+    /* Current cache epoch, advanced whenever the best block changes. */
+    uint32_t nEpoch;
+
 public:
     CCoinsViewCache(CCoinsView *baseIn);
 
@@ -222,9 +254,12 @@ public:
     // Standard CCoinsView methods
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
     bool HaveCoin(const COutPoint &outpoint) const override;
+    //! Lookups fill the cache, so they must not run concurrently
+    bool HasConcurrentGetCoin() const override { return false; }
     uint256 GetBestBlock() const override;
     void SetBestBlock(const uint256 &hashBlock);
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase) override;
+    bool BatchWriteAsync(CCoinsMap &mapCoins, const uint256 &hashBlock) override { return BatchWrite(mapCoins, hashBlock, true); }
     CCoinsViewCursor* Cursor() const override {
         throw std::logic_error("CCoinsViewCache cursor iteration not supported.");
     }
@@ -268,12 +303,51 @@ public:
      */
     bool Flush();
 
+    /**
+     * Like Flush(), but let the base view finish the write in the background
+     * if it supports that (see CCoinsView::BatchWriteAsync). The cache is
+     * empty when this returns and can be used right away.
+     */
+    bool FlushAsync();
+
+    /**
+     * Push the modifications applied to this cache to its base, like Flush(),
+     * but keep the cache populated: written entries stay resident as
+     * unmodified ones, and only spent entries are dropped. With fAsync, the
+     * base view may finish the write in the background (see
+     * CCoinsView::BatchWriteAsync).
+     * If false is returned, the state of this cache (and its backing view) will be undefined.
+     */
+    bool Sync(bool fAsync = false);
+
+    /**
+     * Evict unmodified entries, least recently used first, until the cache
+     * uses at most nTargetUsage bytes or only modified entries are left.
+     * Entries are aged by the number of best block changes since their last
+     * use.
+     */
+    void Trim(size_t nTargetUsage);
+
     /**
      * Removes the UTXO with the given outpoint from the cache, if it is
      * not modified.
      */
     void Uncache(const COutPoint &outpoint);
 
+    /**
+     * Load the given outpoints into the cache ahead of their use. Entries
+     * that are not cached yet are looked up in the backing view and then
+     * inserted into the cache just like a regular cache miss would.
+     *
+     * If the backing view supports concurrent GetCoin() calls, as CCoinsViewDB
+     * does, the lookups are done in batches through for_each. Otherwise the
+     * backing view prefetches them first, so that the lookups in it are
+     * served from memory.
+     *
+     * @return  the number of outpoints that were fetched from the backing view
+     */
+    size_t PrefetchCoins(const std::vector<COutPoint>& outpoints, const CoinsForEachFn& for_each) const override;
+
     //! Calculate the size of the cache (in number of transaction outputs)
     unsigned int GetCacheSize() const;
 
@@ -102,8 +102,15 @@ typedef void* sockopt_arg_type;
 typedef char* sockopt_arg_type;
 #endif
 
+// poll() works with sockets of any number, epoll additionally keeps its
+// registrations across waits. Both are only used where they are known to work.
+#if defined(__linux__)
+#define USE_POLL
+#define USE_EPOLL
+#endif
+
 bool static inline IsSelectableSocket(const SOCKET& s) {
-#ifdef WIN32
+#if defined(USE_POLL) || defined(WIN32)
     return true;
 #else
     return (s < FD_SETSIZE);
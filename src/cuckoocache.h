@@ -475,6 +475,20 @@ public:
             }
         return false;
     }
+
+    /** for_each calls fn on every element which is stored in the cache and
+     * has not been marked as discardable, e.g. to save the contents of the
+     * cache. Not threadsafe with any concurrent insert or erase.
+     *
+     * @param fn a callable taking a const Element&
+     */
+    template <typename Fn>
+    void for_each(Fn fn) const
+    {
+        for (uint32_t i = 0; i < size; ++i)
+            if (!collection_flags.bit_is_set(i))
+                fn(table[i]);
+    }
 };
 } // namespace CuckooCache
 
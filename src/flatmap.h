@@ -0,0 +1,398 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_FLATMAP_H
+#define BITCOIN_FLATMAP_H
+
+#include <assert.h>
+#include <stdint.h>
+
+#include <iterator>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/** Hash map that stores its elements inline instead of in one heap node each.
+ *
+ * Elements live in fixed-size chunks. Erasing an element leaves a hole at its
+ * position, which a later insertion reuses; holes at the end of the storage
+ * are released right away. A bitmap tells which positions hold an element.
+ * Lookups go through a separate power-of-two index of (hash, position) pairs
+ * using linear probing with backward-shift deletion, so the index itself has
+ * no tombstones, and there are no per-element allocations.
+ *
+ * Differences with std::unordered_map:
+ * - Inserting never moves elements, so references and iterators stay valid
+ *   on insertion, even when the index grows.
+ * - shrink_to_fit() moves elements into the holes left by erasures, which
+ *   invalidates references and iterators. Nothing else moves elements.
+ * - Iteration runs from the last stored element back to the first, which makes
+ *   both "it = m.erase(it)" and "m.erase(it++)" safe while iterating.
+ */
+template <typename K, typename T, typename Hash>
+class flatmap
+{
+public:
+    typedef K key_type;
+    typedef T mapped_type;
+    typedef std::pair<const K, T> value_type;
+    typedef size_t size_type;
+
+    //! Number of elements per storage chunk.
+    static const size_t CHUNK_SIZE = 256;
+
+private:
+    struct Bucket {
+        uint32_t hash; //!< Low 32 bits of the element's hash
+        uint32_t pos;  //!< Element position plus one, or 0 if the bucket is empty
+    };
+
+    static const size_t END_POS = size_t(-1);
+
+    Hash m_hasher;
+    std::vector<value_type*> m_chunks;
+    std::vector<Bucket> m_buckets;
+    //! Bit per position in [0, m_end), set if the position holds an element.
+    std::vector<uint64_t> m_live;
+    //! Positions of holes, possibly with stale entries for positions that
+    //! were filled or released since; those are skipped when reusing one.
+    std::vector<uint32_t> m_free;
+    size_t m_size;
+    //! Number of positions in use, holding an element or a hole.
+    size_t m_end;
+
+    value_type& Element(size_t pos) const { return m_chunks[pos / CHUNK_SIZE][pos % CHUNK_SIZE]; }
+
+    bool IsLive(size_t pos) const { return (m_live[pos / 64] >> (pos % 64)) & 1; }
+    void SetLive(size_t pos, bool live)
+    {
+        if (live) {
+            m_live[pos / 64] |= uint64_t(1) << (pos % 64);
+        } else {
+            m_live[pos / 64] &= ~(uint64_t(1) << (pos % 64));
+        }
+    }
+
+    //! The first position below pos that holds an element, or END_POS.
+    size_t PrevLive(size_t pos) const
+    {
+        // Positions from m_end on may have been released after pos was taken.
+        if (pos > m_end) pos = m_end;
+        do {
+            --pos;
+        } while (pos != END_POS && !IsLive(pos));
+        return pos;
+    }
+
+    //! Take a position for a new element: a hole if there is one, and a new
+    //! position at the end otherwise.
+    size_t TakePosition()
+    {
+        while (!m_free.empty()) {
+            const size_t pos = m_free.back();
+            if (pos < m_end && !IsLive(pos)) return pos;
+            m_free.pop_back();
+        }
+        ReserveElement();
+        return m_end;
+    }
+
+    //! Mark a position returned by TakePosition() as holding an element.
+    void FillPosition(size_t pos)
+    {
+        if (pos == m_end) {
+            ++m_end;
+            m_live.resize((m_end + 63) / 64, 0);
+        } else {
+            m_free.pop_back();
+        }
+        SetLive(pos, true);
+    }
+
+    //! Release the holes at the end of the storage.
+    void TrimEnd()
+    {
+        while (m_end > 0 && !IsLive(m_end - 1)) --m_end;
+        m_live.resize((m_end + 63) / 64);
+        ShrinkChunks();
+    }
+
+    size_t Mask() const { return m_buckets.size() - 1; }
+
+    //! Find the bucket pointing at the element with the given key, or END_POS.
+    size_t FindBucket(const K& key, size_t hash) const
+    {
+        if (m_buckets.empty()) return END_POS;
+        const size_t mask = Mask();
+        for (size_t i = hash & mask;; i = (i + 1) & mask) {
+            const Bucket& bucket = m_buckets[i];
+            if (bucket.pos == 0) return END_POS;
+            if (bucket.hash == uint32_t(hash) && Element(bucket.pos - 1).first == key) return i;
+        }
+    }
+
+    //! Find the bucket pointing at position pos, whose element has the given hash.
+    size_t FindBucketOfPos(size_t pos, size_t hash) const
+    {
+        const size_t mask = Mask();
+        for (size_t i = hash & mask;; i = (i + 1) & mask) {
+            assert(m_buckets[i].pos != 0);
+            if (m_buckets[i].pos == pos + 1) return i;
+        }
+    }
+
+    void InsertBucket(uint32_t hash, uint32_t pos_plus_one)
+    {
+        const size_t mask = Mask();
+        size_t i = hash & mask;
+        while (m_buckets[i].pos != 0) i = (i + 1) & mask;
+        m_buckets[i].hash = hash;
+        m_buckets[i].pos = pos_plus_one;
+    }
+
+    void EraseBucket(size_t i)
+    {
+        const size_t mask = Mask();
+        size_t j = i;
+        while (true) {
+            j = (j + 1) & mask;
+            if (m_buckets[j].pos == 0) break;
+            size_t home = m_buckets[j].hash & mask;
+            // Move the entry in j back to the hole in i, unless its home
+            // bucket lies cyclically in (i, j].
+            bool stays = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+            if (!stays) {
+                m_buckets[i] = m_buckets[j];
+                i = j;
+            }
+        }
+        m_buckets[i].pos = 0;
+    }
+
+    void Rehash(size_t new_count)
+    {
+        assert(new_count <= (size_t(1) << 32));
+        std::vector<Bucket> old(new_count, Bucket{0, 0});
+        old.swap(m_buckets);
+        for (const Bucket& bucket : old) {
+            if (bucket.pos != 0) InsertBucket(bucket.hash, bucket.pos);
+        }
+    }
+
+    //! Make room in the index for one more element, keeping the load at most 3/4.
+    void ReserveBucket()
+    {
+        if (!m_buckets.empty() && (m_size + 1) * 4 <= m_buckets.size() * 3) return;
+        Rehash(m_buckets.empty() ? 16 : m_buckets.size() * 2);
+    }
+
+    //! Make sure storage for position m_end exists.
+    void ReserveElement()
+    {
+        if (m_end < m_chunks.size() * CHUNK_SIZE) return;
+        m_chunks.push_back(static_cast<value_type*>(::operator new(chunk_bytes())));
+    }
+
+    //! Release trailing chunks, keeping at most one spare chunk around.
+    void ShrinkChunks()
+    {
+        while (m_chunks.size() * CHUNK_SIZE >= m_end + 2 * CHUNK_SIZE) {
+            ::operator delete(m_chunks.back());
+            m_chunks.pop_back();
+        }
+    }
+
+    template <bool Const>
+    class iter
+    {
+        friend class flatmap;
+        friend class iter<!Const>;
+        typedef typename std::conditional<Const, const flatmap, flatmap>::type map_type;
+        typedef typename std::conditional<Const, const typename flatmap::value_type, typename flatmap::value_type>::type elem_type;
+
+        map_type* m_map;
+        size_t m_pos;
+
+        iter(map_type* map, size_t pos) : m_map(map), m_pos(pos) {}
+
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef typename flatmap::value_type value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef elem_type* pointer;
+        typedef elem_type& reference;
+
+        iter() : m_map(nullptr), m_pos(END_POS) {}
+        template <bool OtherConst, typename = typename std::enable_if<Const && !OtherConst>::type>
+        iter(const iter<OtherConst>& other) : m_map(other.m_map), m_pos(other.m_pos) {}
+
+        reference operator*() const { return m_map->Element(m_pos); }
+        pointer operator->() const { return &m_map->Element(m_pos); }
+        iter& operator++() { m_pos = m_map->PrevLive(m_pos); return *this; }
+        iter operator++(int) { iter copy(*this); m_pos = m_map->PrevLive(m_pos); return copy; }
+        friend bool operator==(const iter& a, const iter& b) { return a.m_pos == b.m_pos; }
+        friend bool operator!=(const iter& a, const iter& b) { return a.m_pos != b.m_pos; }
+    };
+
+public:
+    typedef iter<false> iterator;
+    typedef iter<true> const_iterator;
+
+    explicit flatmap(const Hash& hasher = Hash()) : m_hasher(hasher), m_size(0), m_end(0) {}
+
+    flatmap(flatmap&& other) : m_hasher(other.m_hasher), m_chunks(std::move(other.m_chunks)), m_buckets(std::move(other.m_buckets)), m_live(std::move(other.m_live)), m_free(std::move(other.m_free)), m_size(other.m_size), m_end(other.m_end)
+    {
+        other.m_chunks.clear();
+        other.m_buckets.clear();
+        other.m_live.clear();
+        other.m_free.clear();
+        other.m_size = 0;
+        other.m_end = 0;
+    }
+
+    flatmap(const flatmap&) = delete;
+    flatmap& operator=(const flatmap&) = delete;
+
+    ~flatmap()
+    {
+        clear();
+    }
+
+    iterator begin() { return iterator(this, m_end - 1); }
+    iterator end() { return iterator(this, END_POS); }
+    const_iterator begin() const { return const_iterator(this, m_end - 1); }
+    const_iterator end() const { return const_iterator(this, END_POS); }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const { return end(); }
+
+    bool empty() const { return m_size == 0; }
+    size_type size() const { return m_size; }
+
+    iterator find(const K& key)
+    {
+        size_t i = FindBucket(key, m_hasher(key));
+        return i == END_POS ? end() : iterator(this, m_buckets[i].pos - 1);
+    }
+
+    const_iterator find(const K& key) const
+    {
+        size_t i = FindBucket(key, m_hasher(key));
+        return i == END_POS ? end() : const_iterator(this, m_buckets[i].pos - 1);
+    }
+
+    size_type count(const K& key) const { return FindBucket(key, m_hasher(key)) == END_POS ? 0 : 1; }
+
+    /** Construct an element in place, unless one with the same key exists.
+     *  Like std::unordered_map, the element is constructed before its key can
+     *  be looked up, and destroyed again if the key was present already. */
+    template <typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args)
+    {
+        const size_t pos = TakePosition();
+        value_type* elem = &Element(pos);
+        new (elem) value_type(std::forward<Args>(args)...);
+        size_t hash = m_hasher(elem->first);
+        size_t i = FindBucket(elem->first, hash);
+        if (i != END_POS) {
+            elem->~value_type();
+            return std::make_pair(iterator(this, m_buckets[i].pos - 1), false);
+        }
+        ReserveBucket();
+        InsertBucket(uint32_t(hash), pos + 1);
+        FillPosition(pos);
+        ++m_size;
+        return std::make_pair(iterator(this, pos), true);
+    }
+
+    T& operator[](const K& key)
+    {
+        iterator it = find(key);
+        if (it != end()) return it->second;
+        return emplace(std::piecewise_construct, std::forward_as_tuple(key), std::tuple<>()).first->second;
+    }
+
+    /** Erase the element at it and return the iterator to the next element in
+     *  iteration order. */
+    iterator erase(const_iterator it)
+    {
+        const size_t pos = it.m_pos;
+        EraseBucket(FindBucketOfPos(pos, m_hasher(Element(pos).first)));
+        Element(pos).~value_type();
+        SetLive(pos, false);
+        --m_size;
+        if (pos == m_end - 1) {
+            TrimEnd();
+        } else {
+            m_free.push_back(pos);
+        }
+        return iterator(this, PrevLive(pos));
+    }
+
+    size_type erase(const K& key)
+    {
+        const_iterator it = find(key);
+        if (it == end()) return 0;
+        erase(it);
+        return 1;
+    }
+
+    //! Remove all elements and release all memory.
+    void clear()
+    {
+        for (size_t pos = 0; pos < m_end; ++pos) {
+            if (IsLive(pos)) Element(pos).~value_type();
+        }
+        for (value_type* chunk : m_chunks) {
+            ::operator delete(chunk);
+        }
+        std::vector<value_type*>().swap(m_chunks);
+        std::vector<Bucket>().swap(m_buckets);
+        std::vector<uint64_t>().swap(m_live);
+        std::vector<uint32_t>().swap(m_free);
+        m_size = 0;
+        m_end = 0;
+    }
+
+    /** Release the memory left unused by erasures: move the last elements
+     *  into the holes, and shrink the index to the smallest size that keeps
+     *  the load at most 3/4. This invalidates references and iterators. */
+    void shrink_to_fit()
+    {
+        if (m_size == 0) {
+            clear();
+            return;
+        }
+        size_t hole = 0;
+        while (m_end > m_size) {
+            while (IsLive(hole)) ++hole;
+            const size_t last = m_end - 1;
+            value_type& moved = Element(last);
+            new (&Element(hole)) value_type(std::move(moved));
+            m_buckets[FindBucketOfPos(last, m_hasher(moved.first))].pos = hole + 1;
+            moved.~value_type();
+            SetLive(hole, true);
+            SetLive(last, false);
+            TrimEnd();
+        }
+        std::vector<uint32_t>().swap(m_free);
+        m_live.shrink_to_fit();
+        size_t new_count = 16;
+        while (m_size * 4 > new_count * 3) new_count *= 2;
+        if (new_count < m_buckets.size()) Rehash(new_count);
+        m_chunks.shrink_to_fit();
+    }
+
+    // Memory usage accounting (see memusage::DynamicUsage).
+    size_t bucket_count() const { return m_buckets.size(); }
+    size_t chunk_count() const { return m_chunks.size(); }
+    size_t chunk_capacity() const { return m_chunks.capacity(); }
+    size_t bitmap_bytes() const { return sizeof(uint64_t) * m_live.capacity(); }
+    size_t free_list_bytes() const { return sizeof(uint32_t) * m_free.capacity(); }
+    static size_t bucket_bytes() { return sizeof(Bucket); }
+    static size_t chunk_bytes() { return sizeof(value_type) * CHUNK_SIZE; }
+};
+
+#endif // BITCOIN_FLATMAP_H
@@ -7,6 +7,7 @@
 #include <chainparams.h>
 #include <httpserver.h>
 #include <key_io.h>
+#include <rpc/jsonstream.h>
 #include <rpc/protocol.h>
 #include <rpc/server.h>
 #include <random.h>
@@ -84,6 +85,16 @@ static void JSONErrorReply(HTTPRequest* req, const UniValue& objError, const Uni
     req->WriteReply(nStatus, strReply);
 }
 
+/** Abort a reply whose result is being streamed. The status and part of the
+ * result have been sent already, so the client is left with truncated JSON.
+ */
+static bool StreamErrorReply(HTTPRequest* req, const UniValue& objError)
+{
+    LogPrintf("RPC error while streaming result: %s\n", find_value(objError, "message").getValStr());
+    req->EndReply();
+    return false;
+}
+
 //This function checks username and password against -rpcauth
 //entries from config file.
 static bool multiUserAuthorized(std::string strUserPass)
@@ -175,6 +186,8 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
         return false;
     }
 
+    // Whether part of a streamed result has been sent already
+    bool streaming = false;
     try {
         // Parse request
         UniValue valRequest;
@@ -189,8 +202,28 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
         if (valRequest.isObject()) {
             jreq.parse(valRequest);
 
+            // Methods with large results can send them as they are being
+            // produced, as the result member of a chunked reply.
+            JSONStreamWriter stream([&](const std::string& chunk) {
+                if (!streaming) {
+                    req->WriteHeader("Content-Type", "application/json");
+                    req->StartReply(HTTP_OK);
+                    req->WriteReplyChunk("{\"result\":");
+                    streaming = true;
+                }
+                req->WriteReplyChunk(chunk);
+            });
+            jreq.resultStream = &stream;
+
             UniValue result = tableRPC.execute(jreq);
 
+            stream.Flush();
+            if (streaming) {
+                req->WriteReplyChunk(",\"error\":null,\"id\":" + jreq.id.write() + "}\n");
+                req->EndReply();
+                return true;
+            }
+
             // Send reply
             strReply = JSONRPCReply(result, NullUniValue, jreq.id);
 
@@ -203,9 +236,11 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
         req->WriteHeader("Content-Type", "application/json");
         req->WriteReply(HTTP_OK, strReply);
     } catch (const UniValue& objError) {
+        if (streaming) return StreamErrorReply(req, objError);
         JSONErrorReply(req, objError, jreq.id);
         return false;
     } catch (const std::exception& e) {
+        if (streaming) return StreamErrorReply(req, JSONRPCError(RPC_PARSE_ERROR, e.what()));
         JSONErrorReply(req, JSONRPCError(RPC_PARSE_ERROR, e.what()), jreq.id);
         return false;
     }
@@ -516,12 +516,17 @@ void HTTPEvent::trigger(struct timeval* tv)
         evtimer_add(ev, tv); // trigger after timeval passed
 }
 HTTPRequest::HTTPRequest(struct evhttp_request* _req) : req(_req),
-                                                       replySent(false)
+                                                       replySent(false),
+                                                       replyStarted(false)
 {
 }
 HTTPRequest::~HTTPRequest()
 {
-    if (!replySent) {
+    if (replyStarted && !replySent) {
+        // The status has been sent already, so all we can do is end the reply
+        LogPrintf("%s: Unfinished reply\n", __func__);
+        EndReply();
+    } else if (!replySent) {
         // Keep track of whether reply was sent to avoid request leaks
         LogPrintf("%s: Unhandled request\n", __func__);
         WriteReply(HTTP_INTERNAL, "Unhandled request");
@@ -567,6 +572,22 @@ void HTTPRequest::WriteHeader(const std::string& hdr, const std::string& value)
     evhttp_add_header(headers, hdr.c_str(), value.c_str());
 }
 
+/** Re-enable reading from the socket once a reply has been sent. This is the
+ * second part of the libevent workaround in http_request_cb.
+ * Must be called from the main http thread.
+ */
+static void EnableReading(evhttp_connection* conn)
+{
+    if (event_get_version_number() >= 0x02010600 && event_get_version_number() < 0x02020001) {
+        if (conn) {
+            bufferevent* bev = evhttp_connection_get_bufferevent(conn);
+            if (bev) {
+                bufferevent_enable(bev, EV_READ | EV_WRITE);
+            }
+        }
+    }
+}
+
 /** Closure sent to main thread to request a reply to be sent to
  * a HTTP request.
  * Replies must be sent in the main loop in the main http thread,
@@ -574,25 +595,89 @@ void HTTPRequest::WriteHeader(const std::string& hdr, const std::string& value)
  */
 void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
 {
-    assert(!replySent && req);
+    assert(!replySent && !replyStarted && req);
     // Send event to main http thread to send reply message
     struct evbuffer* evb = evhttp_request_get_output_buffer(req);
     assert(evb);
     evbuffer_add(evb, strReply.data(), strReply.size());
     auto req_copy = req;
     HTTPEvent* ev = new HTTPEvent(eventBase, true, [req_copy, nStatus]{
+        evhttp_connection* conn = evhttp_request_get_connection(req_copy);
         evhttp_send_reply(req_copy, nStatus, nullptr, nullptr);
-        // Re-enable reading from the socket. This is the second part of the libevent
-        // workaround above.
-        if (event_get_version_number() >= 0x02010600 && event_get_version_number() < 0x02020001) {
-            evhttp_connection* conn = evhttp_request_get_connection(req_copy);
-            if (conn) {
-                bufferevent* bev = evhttp_connection_get_bufferevent(conn);
-                if (bev) {
-                    bufferevent_enable(bev, EV_READ | EV_WRITE);
-                }
-            }
-        }
+        EnableReading(conn);
+    });
+    ev->trigger(nullptr);
+    replySent = true;
+    req = nullptr; // transferred back to main thread
+}
+
+static void ReleaseReplyOwner(const void* data, size_t len, void* owner)
+{
+    delete static_cast<std::shared_ptr<const void>*>(owner);
+}
+
+void HTTPRequest::WriteReply(int nStatus, Span<const uint8_t> reply, std::shared_ptr<const void> owner)
+{
+    assert(!replySent && !replyStarted && req);
+    struct evbuffer* evb = evhttp_request_get_output_buffer(req);
+    assert(evb);
+    // The buffer references the memory, and keeps owner until it is done with it
+    auto owner_copy = new std::shared_ptr<const void>(std::move(owner));
+    if (evbuffer_add_reference(evb, reply.data(), reply.size(), ReleaseReplyOwner, owner_copy) != 0) {
+        delete owner_copy;
+        evbuffer_add(evb, reply.data(), reply.size());
+    }
+    auto req_copy = req;
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [req_copy, nStatus]{
+        evhttp_connection* conn = evhttp_request_get_connection(req_copy);
+        evhttp_send_reply(req_copy, nStatus, nullptr, nullptr);
+        EnableReading(conn);
+    });
+    ev->trigger(nullptr);
+    replySent = true;
+    req = nullptr; // transferred back to main thread
+}
+
+/** The parts of a chunked reply are sent from the main http thread as well.
+ * Events triggered from the same thread run in the order they were triggered,
+ * so the chunks arrive in order.
+ */
+void HTTPRequest::StartReply(int nStatus)
+{
+    assert(!replySent && !replyStarted && req);
+    auto req_copy = req;
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [req_copy, nStatus]{
+        evhttp_send_reply_start(req_copy, nStatus, nullptr);
+    });
+    ev->trigger(nullptr);
+    replyStarted = true;
+}
+
+void HTTPRequest::WriteReplyChunk(const std::string& chunk)
+{
+    assert(replyStarted && !replySent && req);
+    if (chunk.empty()) return;
+    struct evbuffer* evb = evbuffer_new();
+    assert(evb);
+    evbuffer_add(evb, chunk.data(), chunk.size());
+    auto req_copy = req;
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [req_copy, evb]{
+        // Does nothing if the client has gone away in the meantime
+        evhttp_send_reply_chunk(req_copy, evb);
+        evbuffer_free(evb);
+    });
+    ev->trigger(nullptr);
+}
+
+void HTTPRequest::EndReply()
+{
+    assert(replyStarted && !replySent && req);
+    auto req_copy = req;
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [req_copy]{
+        // The request may be freed by evhttp_send_reply_end
+        evhttp_connection* conn = evhttp_request_get_connection(req_copy);
+        evhttp_send_reply_end(req_copy);
+        EnableReading(conn);
     });
     ev->trigger(nullptr);
     replySent = true;
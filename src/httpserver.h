@@ -5,9 +5,12 @@
 #ifndef BITCOIN_HTTPSERVER_H
 #define BITCOIN_HTTPSERVER_H
 
+#include <span.h>
+
 #include <string>
 #include <stdint.h>
 #include <functional>
+#include <memory>
 
 static const int DEFAULT_HTTP_THREADS=4;
 static const int DEFAULT_HTTP_WORKQUEUE=16;
@@ -59,6 +62,7 @@ class HTTPRequest
 private:
     struct evhttp_request* req;
     bool replySent;
+    bool replyStarted;
 
 public:
     explicit HTTPRequest(struct evhttp_request* req);
@@ -114,6 +118,35 @@ public:
      * main thread, do not call any other HTTPRequest methods after calling this.
      */
     void WriteReply(int nStatus, const std::string& strReply = "");
+
+    /**
+     * Write HTTP reply whose body is sent straight from memory owned by
+     * owner, without copying it. owner is released once the reply has been
+     * sent, from the main http thread.
+     *
+     * @note Same as above.
+     */
+    void WriteReply(int nStatus, Span<const uint8_t> reply, std::shared_ptr<const void> owner);
+
+    /**
+     * Start a HTTP reply whose body is sent piece by piece with
+     * WriteReplyChunk, so that large replies can be sent while they are being
+     * produced. Finish it with EndReply.
+     *
+     * @note Call this instead of WriteReply, and set headers before it.
+     */
+    void StartReply(int nStatus);
+
+    /** Send the next part of the body of a reply started with StartReply. */
+    void WriteReplyChunk(const std::string& chunk);
+
+    /**
+     * Finish a reply started with StartReply.
+     *
+     * @note As this will give the request back to the main thread, do not
+     * call any other HTTPRequest methods after calling this.
+     */
+    void EndReply();
 };
 
 /** Event handler closure.
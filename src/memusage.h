@@ -5,7 +5,9 @@
 #ifndef BITCOIN_MEMUSAGE_H
 #define BITCOIN_MEMUSAGE_H
 
+#include <flatmap.h>
 #include <indirectmap.h>
+#include <prevector.h>
 
 #include <stdlib.h>
 
@@ -165,6 +167,15 @@ static inline size_t DynamicUsage(const std::unordered_map<X, Y, Z>& m)
     return MallocUsage(sizeof(unordered_node<std::pair<const X, Y> >)) * m.size() + MallocUsage(sizeof(void*) * m.bucket_count());
 }
 
+// flatmap has no per-element allocations: elements live in fixed-size chunks
+
+template<typename X, typename Y, typename Z>
+static inline size_t DynamicUsage(const flatmap<X, Y, Z>& m)
+{
+    return MallocUsage(m.chunk_bytes()) * m.chunk_count() + MallocUsage(sizeof(void*) * m.chunk_capacity()) + MallocUsage(m.bucket_bytes() * m.bucket_count()) +
+           MallocUsage(m.bitmap_bytes()) + MallocUsage(m.free_list_bytes());
+}
+
 }
 
 #endif // BITCOIN_MEMUSAGE_H
@@ -82,6 +82,22 @@ static BlockAssembler::Options DefaultOptions()
 
 BlockAssembler::BlockAssembler(const CChainParams& params) : BlockAssembler(params, DefaultOptions()) {}
 
+// Create the coinbase transaction of a template whose other transactions pay
+// nFees in total, along with its witness commitment.
+static void FillCoinbase(CBlockTemplate& tmpl, const CScript& scriptPubKeyIn, int nHeight, CAmount nFees, const CBlockIndex* pindexPrev, const CChainParams& chainparams)
+{
+    CMutableTransaction coinbaseTx;
+    coinbaseTx.vin.resize(1);
+    coinbaseTx.vin[0].prevout.SetNull();
+    coinbaseTx.vout.resize(1);
+    coinbaseTx.vout[0].scriptPubKey = scriptPubKeyIn;
+    coinbaseTx.vout[0].nValue = nFees + GetBlockSubsidy(nHeight, chainparams.GetConsensus());
+    coinbaseTx.vin[0].scriptSig = CScript() << nHeight << OP_0;
+    tmpl.block.vtx[0] = MakeTransactionRef(std::move(coinbaseTx));
+    tmpl.vchCoinbaseCommitment = GenerateCoinbaseCommitment(tmpl.block, pindexPrev, chainparams.GetConsensus());
+    tmpl.vTxFees[0] = -nFees;
+}
+
 void BlockAssembler::resetBlock()
 {
     inBlock.clear();
@@ -151,17 +167,7 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     nLastBlockTx = nBlockTx;
     nLastBlockWeight = nBlockWeight;
 
-    // Create coinbase transaction.
-    CMutableTransaction coinbaseTx;
-    coinbaseTx.vin.resize(1);
-    coinbaseTx.vin[0].prevout.SetNull();
-    coinbaseTx.vout.resize(1);
-    coinbaseTx.vout[0].scriptPubKey = scriptPubKeyIn;
-    coinbaseTx.vout[0].nValue = nFees + GetBlockSubsidy(nHeight, chainparams.GetConsensus());
-    coinbaseTx.vin[0].scriptSig = CScript() << nHeight << OP_0;
-    pblock->vtx[0] = MakeTransactionRef(std::move(coinbaseTx));
-    pblocktemplate->vchCoinbaseCommitment = GenerateCoinbaseCommitment(*pblock, pindexPrev, chainparams.GetConsensus());
-    pblocktemplate->vTxFees[0] = -nFees;
+    FillCoinbase(*pblocktemplate, scriptPubKeyIn, nHeight, nFees, pindexPrev, chainparams);
 
     LogPrintf("CreateNewBlock(): block weight: %u txs: %u fees: %ld sigops %d\n", GetBlockWeight(*pblock), nBlockTx, nFees, nBlockSigOpsCost);
 
@@ -433,6 +439,160 @@ void BlockAssembler::addPackageTxs(int &nPackagesSelected, int &nDescendantsUpda
     }
 }
 
+std::unique_ptr<BlockTemplateCache> g_block_template_cache;
+
+BlockTemplateCache::BlockTemplateCache(const CChainParams& params, const CScript& scriptPubKeyIn) : chainparams(params), m_script(scriptPubKeyIn) {}
+
+std::unique_ptr<CBlockTemplate> BlockTemplateCache::GetBlockTemplate(bool fMineWitnessTx, int64_t nMaxStaleAge)
+{
+    LOCK2(cs_main, mempool.cs);
+    LOCK(m_mutex);
+    if (!m_template || m_tip != chainActive.Tip() || m_mine_witness_tx != fMineWitnessTx ||
+            (m_stale && GetTime() - m_build_time > nMaxStaleAge)) {
+        Rebuild(fMineWitnessTx);
+    } else if (m_coinbase_dirty) {
+        FillCoinbase(*m_template, m_script, m_height, m_fees, m_tip, chainparams);
+        m_coinbase_dirty = false;
+    }
+    return MakeUnique<CBlockTemplate>(*m_template);
+}
+
+void BlockTemplateCache::MarkStale()
+{
+    LOCK(m_mutex);
+    m_stale = true;
+}
+
+uint64_t BlockTemplateCache::GetRebuildCount() const
+{
+    LOCK(m_mutex);
+    return m_rebuilds;
+}
+
+void BlockTemplateCache::Rebuild(bool fMineWitnessTx)
+{
+    // Drop the old template first, so that none is left behind if this fails.
+    Invalidate();
+
+    BlockAssembler assembler(chainparams);
+    std::unique_ptr<CBlockTemplate> tmpl = assembler.CreateNewBlock(m_script, fMineWitnessTx);
+    m_tip = chainActive.Tip();
+    m_mine_witness_tx = fMineWitnessTx;
+    m_include_witness = IsWitnessEnabled(m_tip, chainparams.GetConsensus()) && fMineWitnessTx;
+    m_stale = false;
+    m_coinbase_dirty = false;
+    m_build_time = GetTime();
+    ++m_rebuilds;
+
+    m_height = m_tip->nHeight + 1;
+    m_lock_time_cutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
+                         ? m_tip->GetMedianTimePast()
+                         : tmpl->block.GetBlockTime();
+    m_block_max_weight = assembler.GetBlockMaxWeight();
+    m_block_min_fee_rate = assembler.GetBlockMinFeeRate();
+
+    // Same reservation for the coinbase as BlockAssembler::resetBlock
+    m_block_weight = 4000;
+    m_block_sigops_cost = 400;
+    m_fees = -tmpl->vTxFees[0];
+    m_worst_fee_rate = CFeeRate(MAX_MONEY);
+    for (size_t i = 1; i < tmpl->block.vtx.size(); ++i) {
+        const CTransaction& tx = *tmpl->block.vtx[i];
+        m_block_weight += GetTransactionWeight(tx);
+        m_block_sigops_cost += tmpl->vTxSigOpsCost[i];
+        m_txids.insert(tx.GetHash());
+        CTxMemPool::txiter it = mempool.mapTx.find(tx.GetHash());
+        if (it != mempool.mapTx.end()) {
+            m_worst_fee_rate = std::min(m_worst_fee_rate, CFeeRate(it->GetModifiedFee(), it->GetTxSize()));
+        }
+    }
+    m_template = std::move(tmpl);
+    m_active = true;
+}
+
+void BlockTemplateCache::Invalidate()
+{
+    m_template.reset();
+    m_txids.clear();
+    m_tip = nullptr;
+}
+
+void BlockTemplateCache::TransactionAddedToMempool(const CTransactionRef& ptx)
+{
+    if (!m_active) return;
+
+    LOCK2(cs_main, mempool.cs);
+    LOCK(m_mutex);
+    // A template for an older tip is rebuilt on the next request anyway.
+    if (!m_template || m_tip != chainActive.Tip()) return;
+    const uint256& txid = ptx->GetHash();
+    if (m_txids.count(txid)) return;
+    // The transaction may have left the mempool again since it was added.
+    CTxMemPool::txiter it = mempool.mapTx.find(txid);
+    if (it == mempool.mapTx.end()) return;
+
+    if (!IsFinalTx(*ptx, m_height, m_lock_time_cutoff)) return;
+    if (!m_include_witness && ptx->HasWitness()) return;
+
+    bool fParentsInTemplate = true;
+    for (CTxMemPool::txiter parent : mempool.GetMemPoolParents(it)) {
+        if (!m_txids.count(parent->GetTx().GetHash())) {
+            fParentsInTemplate = false;
+            break;
+        }
+    }
+
+    CFeeRate feeRate;
+    if (fParentsInTemplate) {
+        if (it->GetModifiedFee() < m_block_min_fee_rate.GetFee(it->GetTxSize())) return;
+        feeRate = CFeeRate(it->GetModifiedFee(), it->GetTxSize());
+        // Same limits as BlockAssembler::TestPackage
+        if (m_block_weight + WITNESS_SCALE_FACTOR * it->GetTxSize() < m_block_max_weight &&
+                m_block_sigops_cost + it->GetSigOpCost() < MAX_BLOCK_SIGOPS_COST) {
+            m_template->block.vtx.emplace_back(it->GetSharedTx());
+            m_template->vTxFees.push_back(it->GetFee());
+            m_template->vTxSigOpsCost.push_back(it->GetSigOpCost());
+            m_block_weight += it->GetTxWeight();
+            m_block_sigops_cost += it->GetSigOpCost();
+            m_fees += it->GetFee();
+            m_txids.insert(txid);
+            m_worst_fee_rate = std::min(m_worst_fee_rate, feeRate);
+            m_coinbase_dirty = true;
+            return;
+        }
+    } else {
+        if (it->GetModFeesWithAncestors() < m_block_min_fee_rate.GetFee(it->GetSizeWithAncestors())) return;
+        feeRate = CFeeRate(it->GetModFeesWithAncestors(), it->GetSizeWithAncestors());
+    }
+
+    // A new package selection would pick this up if there is room left, or
+    // if it pays more than something in the template.
+    if (m_block_weight + 4000 <= m_block_max_weight || feeRate > m_worst_fee_rate) {
+        m_stale = true;
+    }
+}
+
+void BlockTemplateCache::TransactionRemovedFromMempool(const CTransactionRef& ptx)
+{
+    LOCK(m_mutex);
+    if (m_txids.count(ptx->GetHash())) Invalidate();
+}
+
+void BlockTemplateCache::BlockConnected(const std::shared_ptr<const CBlock>& pblock, const CBlockIndex* pindex, const std::vector<CTransactionRef>& vtxConflicted)
+{
+    LOCK(m_mutex);
+    // The template may have been rebuilt on top of this block already, or
+    // even on top of its descendants when notifications lag behind.
+    if (m_tip && m_tip->GetAncestor(pindex->nHeight) == pindex) return;
+    Invalidate();
+}
+
+void BlockTemplateCache::BlockDisconnected(const std::shared_ptr<const CBlock>& pblock)
+{
+    LOCK(m_mutex);
+    if (m_tip && m_tip->GetBlockHash() == pblock->GetHash()) Invalidate();
+}
+
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce)
 {
     // Update nExtraNonce
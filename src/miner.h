@@ -9,9 +9,12 @@
 #include <primitives/block.h>
 #include <txmempool.h>
 #include <validation.h>
+#include <validationinterface.h>
 
 #include <stdint.h>
+#include <atomic>
 #include <memory>
+#include <unordered_set>
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/ordered_index.hpp>
 
@@ -22,6 +25,8 @@ class CScript;
 namespace Consensus { struct Params; };
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+/** Seconds a stale cached block template keeps being served before it is rebuilt */
+static const int64_t BLOCK_TEMPLATE_MAX_STALE_AGE = 5;
 
 struct CBlockTemplate
 {
@@ -159,6 +164,9 @@ public:
     /** Construct a new block template with coinbase to scriptPubKeyIn */
     std::unique_ptr<CBlockTemplate> CreateNewBlock(const CScript& scriptPubKeyIn, bool fMineWitnessTx=true);
 
+    unsigned int GetBlockMaxWeight() const { return nBlockMaxWeight; }
+    CFeeRate GetBlockMinFeeRate() const { return blockMinFeeRate; }
+
 private:
     // utility functions
     /** Clear the block's state and prepare for assembling a new block */
@@ -193,6 +201,85 @@ private:
     int UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set &mapModifiedTx) EXCLUSIVE_LOCKS_REQUIRED(mempool.cs);
 };
 
+/**
+ * Block template for the current tip that is kept up to date with the mempool
+ * through validation interface notifications, so that it can be served
+ * without running the package selection of BlockAssembler again.
+ *
+ * A transaction entering the mempool is appended to the template when all of
+ * its unconfirmed parents are in the template already and it fits. A
+ * transaction that cannot be appended but that a new package selection might
+ * include marks the template as stale. Stale templates keep being served until
+ * they are older than the maximum age given by the caller, and are then
+ * rebuilt from scratch. Removal of a transaction in the template or a change of
+ * tip invalidates the template, so that the next request rebuilds it.
+ *
+ * Appended transactions have been validated by the mempool already, so unlike
+ * CreateNewBlock, serving an updated template does not run TestBlockValidity.
+ */
+class BlockTemplateCache final : public CValidationInterface
+{
+public:
+    BlockTemplateCache(const CChainParams& params, const CScript& scriptPubKeyIn);
+
+    /** Return a copy of the template for the current tip, building a new one
+     *  if there is none, if it was built with a different fMineWitnessTx, or
+     *  if it is stale and was built more than nMaxStaleAge seconds ago. */
+    std::unique_ptr<CBlockTemplate> GetBlockTemplate(bool fMineWitnessTx, int64_t nMaxStaleAge);
+
+    /** Mark the template as stale, e.g. after fee deltas changed. */
+    void MarkStale();
+
+    /** Number of times a template was built from scratch. */
+    uint64_t GetRebuildCount() const;
+
+protected:
+    void TransactionAddedToMempool(const CTransactionRef& ptx) override;
+    void TransactionRemovedFromMempool(const CTransactionRef& ptx) override;
+    void BlockConnected(const std::shared_ptr<const CBlock>& pblock, const CBlockIndex* pindex, const std::vector<CTransactionRef>& vtxConflicted) override;
+    void BlockDisconnected(const std::shared_ptr<const CBlock>& pblock) override;
+
+private:
+    /** Build a new template with BlockAssembler and recompute the running totals */
+    void Rebuild(bool fMineWitnessTx) EXCLUSIVE_LOCKS_REQUIRED(cs_main, mempool.cs, m_mutex);
+    /** Drop the template, so that the next request builds a new one */
+    void Invalidate() EXCLUSIVE_LOCKS_REQUIRED(m_mutex);
+
+    const CChainParams& chainparams;
+    const CScript m_script;
+
+    //! Set once the first template was built; notifications are ignored before that.
+    std::atomic<bool> m_active{false};
+
+    mutable Mutex m_mutex;
+    std::unique_ptr<CBlockTemplate> m_template GUARDED_BY(m_mutex);
+    //! Txids of the transactions in m_template, except the coinbase
+    std::unordered_set<uint256, SaltedTxidHasher> m_txids GUARDED_BY(m_mutex);
+    const CBlockIndex* m_tip GUARDED_BY(m_mutex) = nullptr;
+    bool m_mine_witness_tx GUARDED_BY(m_mutex) = false;
+    bool m_include_witness GUARDED_BY(m_mutex) = false;
+    bool m_stale GUARDED_BY(m_mutex) = false;
+    //! Whether transactions were appended since the coinbase was created
+    bool m_coinbase_dirty GUARDED_BY(m_mutex) = false;
+    int64_t m_build_time GUARDED_BY(m_mutex) = 0;
+    uint64_t m_rebuilds GUARDED_BY(m_mutex) = 0;
+
+    // Chain context and limits of the template, as used by BlockAssembler
+    int m_height GUARDED_BY(m_mutex) = 0;
+    int64_t m_lock_time_cutoff GUARDED_BY(m_mutex) = 0;
+    unsigned int m_block_max_weight GUARDED_BY(m_mutex) = 0;
+    CFeeRate m_block_min_fee_rate GUARDED_BY(m_mutex);
+
+    // Totals of the template, including the space reserved for the coinbase
+    uint64_t m_block_weight GUARDED_BY(m_mutex) = 0;
+    int64_t m_block_sigops_cost GUARDED_BY(m_mutex) = 0;
+    CAmount m_fees GUARDED_BY(m_mutex) = 0;
+    //! Lowest modified feerate of a transaction in the template
+    CFeeRate m_worst_fee_rate GUARDED_BY(m_mutex);
+};
+
+extern std::unique_ptr<BlockTemplateCache> g_block_template_cache;
+
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
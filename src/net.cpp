@@ -24,6 +24,15 @@
 #include <string.h>
 #else
 #include <fcntl.h>
+#include <sys/uio.h>
+#endif
+
+#ifdef USE_POLL
+#include <poll.h>
+#endif
+
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
 #endif
 
 #ifdef USE_UPNP
@@ -35,6 +44,7 @@
 
 
 #include <math.h>
+#include <unordered_map>
 
 // Dump addresses to peers.dat and banlist.dat every 15 minutes (900s)
 #define DUMP_ADDRESSES_INTERVAL 900
@@ -75,6 +85,20 @@ const static std::string NET_MESSAGE_COMMAND_OTHER = "*other*";
 
 static const uint64_t RANDOMIZER_ID_NETGROUP = 0x6c0edd8036ef4036ULL; // SHA256("netgroup")[0:8]
 static const uint64_t RANDOMIZER_ID_LOCALHOSTNONCE = 0xd93e69e2bbfa5735ULL; // SHA256("localhostnonce")[0:8]
+
+/** Maximum number of send queue chunks handed to the kernel in one call */
+static const size_t MAX_SEND_IOVECS = 64;
+
+/** Whether the socket handler can wait for the socket in the given mode */
+static bool IsSelectableSocket(const SOCKET& s, SocketEventsMode mode)
+{
+#ifndef WIN32
+    if (mode == SocketEventsMode::Select)
+        return s < FD_SETSIZE;
+#endif
+    return IsSelectableSocket(s);
+}
+
 //
 // Global state variables
 //
@@ -452,6 +476,11 @@ CNode* CConnman::ConnectNode(CAddress addrConnect, const char *pszDest, bool fCo
         CloseSocket(hSocket);
         return nullptr;
     }
+    if (!IsSelectableSocket(hSocket, socketEventsMode)) {
+        LogPrintf("connection to %s dropped: non-selectable socket\n", addrConnect.ToString());
+        CloseSocket(hSocket);
+        return nullptr;
+    }
 
     // Add node
     NodeId id = GetNewNodeId();
@@ -774,16 +803,7 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete
         nBytes -= handled;
 
         if (msg.complete()) {
-
-            //store received bytes per message command
-            //to prevent a memory DOS, only allow valid commands
-            mapMsgCmdSize::iterator i = mapRecvBytesPerMsgCmd.find(msg.hdr.pchCommand);
-            if (i == mapRecvBytesPerMsgCmd.end())
-                i = mapRecvBytesPerMsgCmd.find(NET_MESSAGE_COMMAND_OTHER);
-            assert(i != mapRecvBytesPerMsgCmd.end());
-            i->second += msg.hdr.nMessageSize + CMessageHeader::HEADER_SIZE;
-
-            msg.nTime = nTimeMicros;
+            RecvMessageComplete(msg, nTimeMicros);
             complete = true;
         }
     }
@@ -791,6 +811,46 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete
     return true;
 }
 
+char* CNode::GetRecvBuffer(unsigned int nBytes)
+{
+    if (vRecvMsg.empty() || !vRecvMsg.back().in_data)
+        return nullptr;
+    CNetMessage& msg = vRecvMsg.back();
+    // The tail of the payload is received along with whatever follows it
+    if (msg.hdr.nMessageSize - msg.nDataPos < nBytes)
+        return nullptr;
+    return msg.dataBuffer(nBytes);
+}
+
+void CNode::ReceivedMsgBytes(unsigned int nBytes, bool& complete)
+{
+    complete = false;
+    int64_t nTimeMicros = GetTimeMicros();
+    LOCK(cs_vRecv);
+    nLastRecv = nTimeMicros / 1000000;
+    nRecvBytes += nBytes;
+
+    CNetMessage& msg = vRecvMsg.back();
+    msg.dataReceived(nBytes);
+    if (msg.complete()) {
+        RecvMessageComplete(msg, nTimeMicros);
+        complete = true;
+    }
+}
+
+void CNode::RecvMessageComplete(CNetMessage& msg, int64_t nTimeMicros)
+{
+    //store received bytes per message command
+    //to prevent a memory DOS, only allow valid commands
+    mapMsgCmdSize::iterator i = mapRecvBytesPerMsgCmd.find(msg.hdr.pchCommand);
+    if (i == mapRecvBytesPerMsgCmd.end())
+        i = mapRecvBytesPerMsgCmd.find(NET_MESSAGE_COMMAND_OTHER);
+    assert(i != mapRecvBytesPerMsgCmd.end());
+    i->second += msg.hdr.nMessageSize + CMessageHeader::HEADER_SIZE;
+
+    msg.nTime = nTimeMicros;
+}
+
 void CNode::SetSendVersion(int nVersionIn)
 {
     // Send version may only be changed in the version message, and
@@ -850,20 +910,32 @@ int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
 }
 
 int CNetMessage::readData(const char *pch, unsigned int nBytes)
+{
+    unsigned int nCopy = nBytes;
+    char* buffer = dataBuffer(nCopy);
+    memcpy(buffer, pch, nCopy);
+    dataReceived(nCopy);
+
+    return nCopy;
+}
+
+char* CNetMessage::dataBuffer(unsigned int& nBytes)
 {
     unsigned int nRemaining = hdr.nMessageSize - nDataPos;
-    unsigned int nCopy = std::min(nRemaining, nBytes);
+    nBytes = std::min(nRemaining, nBytes);
 
-    if (vRecv.size() < nDataPos + nCopy) {
+    if (vRecv.size() < nDataPos + nBytes) {
         // Allocate up to 256 KiB ahead, but never more than the total message size.
-        vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nCopy + 256 * 1024));
+        vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nBytes + 256 * 1024));
     }
 
-    hasher.Write((const unsigned char*)pch, nCopy);
-    memcpy(&vRecv[nDataPos], pch, nCopy);
-    nDataPos += nCopy;
+    return vRecv.data() + nDataPos;
+}
 
-    return nCopy;
+void CNetMessage::dataReceived(unsigned int nBytes)
+{
+    hasher.Write((const unsigned char*)vRecv.data() + nDataPos, nBytes);
+    nDataPos += nBytes;
 }
 
 const uint256& CNetMessage::GetMessageHash() const
@@ -885,31 +957,56 @@ const uint256& CNetMessage::GetMessageHash() const
 // requires LOCK(cs_vSend)
 size_t CConnman::SocketSendData(CNode *pnode) const
 {
-    auto it = pnode->vSendMsg.begin();
     size_t nSentSize = 0;
 
-    while (it != pnode->vSendMsg.end()) {
-        const auto &data = *it;
-        assert(data.size() > pnode->nSendOffset);
+    while (!pnode->vSendMsg.empty()) {
+        assert((size_t)pnode->vSendMsg.front().data.size() > pnode->nSendOffset);
+        size_t nToSend = 0;
         int nBytes = 0;
         {
             LOCK(pnode->cs_hSocket);
             if (pnode->hSocket == INVALID_SOCKET)
                 break;
-            nBytes = send(pnode->hSocket, reinterpret_cast<const char*>(data.data()) + pnode->nSendOffset, data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+#ifdef WIN32
+            const CSendChunk& chunk = pnode->vSendMsg.front();
+            nToSend = chunk.data.size() - pnode->nSendOffset;
+            nBytes = send(pnode->hSocket, reinterpret_cast<const char*>(chunk.data.data()) + pnode->nSendOffset, nToSend, MSG_NOSIGNAL | MSG_DONTWAIT);
+#else
+            // Hand the kernel as many queued chunks as fit in one call
+            struct iovec iov[MAX_SEND_IOVECS];
+            size_t nIov = 0;
+            for (auto it = pnode->vSendMsg.begin(); it != pnode->vSendMsg.end() && nIov < MAX_SEND_IOVECS; ++it, ++nIov) {
+                const size_t nOffset = nIov == 0 ? pnode->nSendOffset : 0;
+                iov[nIov].iov_base = const_cast<unsigned char*>(it->data.data()) + nOffset;
+                iov[nIov].iov_len = it->data.size() - nOffset;
+                nToSend += iov[nIov].iov_len;
+            }
+            struct msghdr msg = {};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = nIov;
+            nBytes = sendmsg(pnode->hSocket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
         }
         if (nBytes > 0) {
             pnode->nLastSend = GetSystemTimeInSeconds();
             pnode->nSendBytes += nBytes;
-            pnode->nSendOffset += nBytes;
             nSentSize += nBytes;
-            if (pnode->nSendOffset == data.size()) {
+            // Drop the chunks that were sent completely
+            size_t nLeft = nBytes;
+            while (nLeft > 0) {
+                const size_t nChunkSize = pnode->vSendMsg.front().data.size();
+                if (nLeft < nChunkSize - pnode->nSendOffset) {
+                    pnode->nSendOffset += nLeft;
+                    break;
+                }
+                nLeft -= nChunkSize - pnode->nSendOffset;
                 pnode->nSendOffset = 0;
-                pnode->nSendSize -= data.size();
-                pnode->fPauseSend = pnode->nSendSize > nSendBufferMaxSize;
-                it++;
-            } else {
-                // could not send full message; stop sending more
+                pnode->nSendSize -= nChunkSize;
+                pnode->vSendMsg.pop_front();
+            }
+            pnode->fPauseSend = pnode->nSendSize > nSendBufferMaxSize;
+            if ((size_t)nBytes < nToSend) {
+                // could not send everything; stop sending more
                 break;
             }
         } else {
@@ -927,11 +1024,10 @@ size_t CConnman::SocketSendData(CNode *pnode) const
         }
     }
 
-    if (it == pnode->vSendMsg.end()) {
+    if (pnode->vSendMsg.empty()) {
         assert(pnode->nSendOffset == 0);
         assert(pnode->nSendSize == 0);
     }
-    pnode->vSendMsg.erase(pnode->vSendMsg.begin(), it);
     return nSentSize;
 }
 
@@ -1072,6 +1168,40 @@ bool CConnman::AttemptToEvictConnection()
     return false;
 }
 
+std::vector<SocketEventsMode> GetSupportedSocketEventsModes()
+{
+    std::vector<SocketEventsMode> modes;
+#ifdef USE_EPOLL
+    modes.push_back(SocketEventsMode::EPoll);
+#endif
+#ifdef USE_POLL
+    modes.push_back(SocketEventsMode::Poll);
+#endif
+    modes.push_back(SocketEventsMode::Select);
+    return modes;
+}
+
+std::string SocketEventsModeToString(SocketEventsMode mode)
+{
+    switch (mode) {
+    case SocketEventsMode::Select: return "select";
+    case SocketEventsMode::Poll: return "poll";
+    case SocketEventsMode::EPoll: return "epoll";
+    }
+    assert(false);
+}
+
+bool SocketEventsModeFromString(const std::string& str, SocketEventsMode& mode)
+{
+    for (SocketEventsMode supported : GetSupportedSocketEventsModes()) {
+        if (str == SocketEventsModeToString(supported)) {
+            mode = supported;
+            return true;
+        }
+    }
+    return false;
+}
+
 void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
     struct sockaddr_storage sockaddr;
     socklen_t len = sizeof(sockaddr);
@@ -1108,7 +1238,7 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
         return;
     }
 
-    if (!IsSelectableSocket(hSocket))
+    if (!IsSelectableSocket(hSocket, socketEventsMode))
     {
         LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
         CloseSocket(hSocket);
@@ -1149,324 +1279,666 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
 
     {
         LOCK(cs_vNodes);
+        RegisterNodeSocket(pnode);
         vNodes.push_back(pnode);
     }
 }
 
-void CConnman::ThreadSocketHandler()
+void CConnman::DisconnectNodes()
 {
-    unsigned int nPrevNodeCount = 0;
-    while (!interruptNet)
     {
-        //
-        // Disconnect nodes
-        //
-        {
-            LOCK(cs_vNodes);
+        LOCK(cs_vNodes);
 
-            if (!fNetworkActive) {
-                // Disconnect any connected nodes
-                for (CNode* pnode : vNodes) {
-                    if (!pnode->fDisconnect) {
-                        LogPrint(BCLog::NET, "Network not active, dropping peer=%d\n", pnode->GetId());
-                        pnode->fDisconnect = true;
-                    }
+        if (!fNetworkActive) {
+            // Disconnect any connected nodes
+            for (CNode* pnode : vNodes) {
+                if (!pnode->fDisconnect) {
+                    LogPrint(BCLog::NET, "Network not active, dropping peer=%d\n", pnode->GetId());
+                    pnode->fDisconnect = true;
                 }
             }
+        }
 
-            // Disconnect unused nodes
-            std::vector<CNode*> vNodesCopy = vNodes;
-            for (CNode* pnode : vNodesCopy)
+        // Disconnect unused nodes
+        std::vector<CNode*> vNodesCopy = vNodes;
+        for (CNode* pnode : vNodesCopy)
+        {
+            if (pnode->fDisconnect)
             {
-                if (pnode->fDisconnect)
-                {
-                    // remove from vNodes
-                    vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+                // remove from vNodes
+                vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
 
-                    // release outbound grant (if any)
-                    pnode->grantOutbound.Release();
+                // release outbound grant (if any)
+                pnode->grantOutbound.Release();
 
-                    // close socket and cleanup
-                    pnode->CloseSocketDisconnect();
+                // close socket and cleanup
+                UnregisterNodeSocket(pnode);
+                pnode->CloseSocketDisconnect();
 
-                    // hold in disconnected pool until all refs are released
-                    pnode->Release();
-                    vNodesDisconnected.push_back(pnode);
-                }
+                // hold in disconnected pool until all refs are released
+                pnode->Release();
+                vNodesDisconnected.push_back(pnode);
             }
         }
+    }
+    {
+        // Delete disconnected nodes
+        std::list<CNode*> vNodesDisconnectedCopy = vNodesDisconnected;
+        for (CNode* pnode : vNodesDisconnectedCopy)
         {
-            // Delete disconnected nodes
-            std::list<CNode*> vNodesDisconnectedCopy = vNodesDisconnected;
-            for (CNode* pnode : vNodesDisconnectedCopy)
-            {
-                // wait until threads are done using it
-                if (pnode->GetRefCount() <= 0) {
-                    bool fDelete = false;
-                    {
-                        TRY_LOCK(pnode->cs_inventory, lockInv);
-                        if (lockInv) {
-                            TRY_LOCK(pnode->cs_vSend, lockSend);
-                            if (lockSend) {
-                                fDelete = true;
-                            }
+            // wait until threads are done using it
+            if (pnode->GetRefCount() <= 0) {
+                bool fDelete = false;
+                {
+                    TRY_LOCK(pnode->cs_inventory, lockInv);
+                    if (lockInv) {
+                        TRY_LOCK(pnode->cs_vSend, lockSend);
+                        if (lockSend) {
+                            fDelete = true;
                         }
                     }
-                    if (fDelete) {
-                        vNodesDisconnected.remove(pnode);
-                        DeleteNode(pnode);
-                    }
+                }
+                if (fDelete) {
+                    vNodesDisconnected.remove(pnode);
+                    DeleteNode(pnode);
                 }
             }
         }
-        size_t vNodesSize;
+    }
+}
+
+void CConnman::NotifyNumConnectionsChanged()
+{
+    size_t vNodesSize;
+    {
+        LOCK(cs_vNodes);
+        vNodesSize = vNodes.size();
+    }
+    if(vNodesSize != nPrevNodeCount) {
+        nPrevNodeCount = vNodesSize;
+        if(clientInterface)
+            clientInterface->NotifyNumConnectionsChanged(vNodesSize);
+    }
+}
+
+void CConnman::InactivityCheck(CNode* pnode)
+{
+    int64_t nTime = GetSystemTimeInSeconds();
+    if (nTime - pnode->nTimeConnected > 60)
+    {
+        if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
         {
-            LOCK(cs_vNodes);
-            vNodesSize = vNodes.size();
+            LogPrint(BCLog::NET, "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->GetId());
+            pnode->fDisconnect = true;
+        }
+        else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL)
+        {
+            LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
+            pnode->fDisconnect = true;
         }
-        if(vNodesSize != nPrevNodeCount) {
-            nPrevNodeCount = vNodesSize;
-            if(clientInterface)
-                clientInterface->NotifyNumConnectionsChanged(vNodesSize);
+        else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90*60))
+        {
+            LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
+            pnode->fDisconnect = true;
         }
+        else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros())
+        {
+            LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
+            pnode->fDisconnect = true;
+        }
+        else if (!pnode->fSuccessfullyConnected)
+        {
+            LogPrint(BCLog::NET, "version handshake timeout from %d\n", pnode->GetId());
+            pnode->fDisconnect = true;
+        }
+    }
+}
 
-        //
-        // Find which sockets have data to receive
-        //
-        struct timeval timeout;
-        timeout.tv_sec  = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
-
-        for (const ListenSocket& hListenSocket : vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = std::max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
+bool CConnman::ReceiveFromNode(CNode* pnode)
+{
+    // typical socket buffer is 8K-64K
+    char pchBuf[0x10000];
+    // Large payloads are received straight into the message instead
+    char* pchRecvBuffer = pnode->GetRecvBuffer(sizeof(pchBuf));
+    int nBytes = 0;
+    {
+        LOCK(pnode->cs_hSocket);
+        if (pnode->hSocket == INVALID_SOCKET)
+            return false;
+        nBytes = recv(pnode->hSocket, pchRecvBuffer ? pchRecvBuffer : pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+    }
+    if (nBytes > 0)
+    {
+        bool notify = false;
+        if (pchRecvBuffer)
+            pnode->ReceivedMsgBytes(nBytes, notify);
+        else if (!pnode->ReceiveMsgBytes(pchBuf, nBytes, notify))
+            pnode->CloseSocketDisconnect();
+        RecordBytesRecv(nBytes);
+        if (notify) {
+            size_t nSizeAdded = 0;
+            auto it(pnode->vRecvMsg.begin());
+            for (; it != pnode->vRecvMsg.end(); ++it) {
+                if (!it->complete())
+                    break;
+                nSizeAdded += it->vRecv.size() + CMessageHeader::HEADER_SIZE;
+            }
+            {
+                LOCK(pnode->cs_vProcessMsg);
+                pnode->vProcessMsg.splice(pnode->vProcessMsg.end(), pnode->vRecvMsg, pnode->vRecvMsg.begin(), it);
+                pnode->nProcessQueueSize += nSizeAdded;
+                pnode->fPauseRecv = pnode->nProcessQueueSize > nReceiveFloodSize;
+            }
+            WakeMessageHandler();
         }
+        // A full buffer may have left more data in the socket.
+        return nBytes == (int)sizeof(pchBuf);
+    }
+    else if (nBytes == 0)
+    {
+        // socket closed gracefully
+        if (!pnode->fDisconnect) {
+            LogPrint(BCLog::NET, "socket closed\n");
+        }
+        pnode->CloseSocketDisconnect();
+    }
+    else if (nBytes < 0)
+    {
+        // error
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
+        {
+            if (!pnode->fDisconnect)
+                LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
+            pnode->CloseSocketDisconnect();
+        }
+    }
+    return false;
+}
+
+bool CConnman::GenerateSelectSet(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set)
+{
+    for (const ListenSocket& hListenSocket : vhListenSocket) {
+        recv_set.insert(hListenSocket.socket);
+    }
 
+    {
+        LOCK(cs_vNodes);
+        for (CNode* pnode : vNodes)
         {
-            LOCK(cs_vNodes);
-            for (CNode* pnode : vNodes)
+            // Implement the following logic:
+            // * If there is data to send, select() for sending data. As this only
+            //   happens when optimistic write failed, we choose to first drain the
+            //   write buffer in this case before receiving more. This avoids
+            //   needlessly queueing received data, if the remote peer is not themselves
+            //   receiving data. This means properly utilizing TCP flow control signalling.
+            // * Otherwise, if there is space left in the receive buffer, select() for
+            //   receiving data.
+            // * Hand off all complete messages to the processor, to be handled without
+            //   blocking here.
+
+            bool select_recv = !pnode->fPauseRecv;
+            bool select_send;
             {
-                // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
-                //   happens when optimistic write failed, we choose to first drain the
-                //   write buffer in this case before receiving more. This avoids
-                //   needlessly queueing received data, if the remote peer is not themselves
-                //   receiving data. This means properly utilizing TCP flow control signalling.
-                // * Otherwise, if there is space left in the receive buffer, select() for
-                //   receiving data.
-                // * Hand off all complete messages to the processor, to be handled without
-                //   blocking here.
-
-                bool select_recv = !pnode->fPauseRecv;
-                bool select_send;
-                {
-                    LOCK(pnode->cs_vSend);
-                    select_send = !pnode->vSendMsg.empty();
-                }
-
-                LOCK(pnode->cs_hSocket);
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
+                LOCK(pnode->cs_vSend);
+                select_send = !pnode->vSendMsg.empty();
+            }
 
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = std::max(hSocketMax, pnode->hSocket);
-                have_fds = true;
+            LOCK(pnode->cs_hSocket);
+            if (pnode->hSocket == INVALID_SOCKET)
+                continue;
 
-                if (select_send) {
-                    FD_SET(pnode->hSocket, &fdsetSend);
-                    continue;
-                }
-                if (select_recv) {
-                    FD_SET(pnode->hSocket, &fdsetRecv);
-                }
+            error_set.insert(pnode->hSocket);
+            if (select_send) {
+                send_set.insert(pnode->hSocket);
+                continue;
+            }
+            if (select_recv) {
+                recv_set.insert(pnode->hSocket);
             }
         }
+    }
 
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
-        if (interruptNet)
+    return !recv_set.empty() || !send_set.empty() || !error_set.empty();
+}
+
+void CConnman::SocketEventsSelect(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set)
+{
+    std::set<SOCKET> recv_select_set, send_select_set, error_select_set;
+    if (!GenerateSelectSet(recv_select_set, send_select_set, error_select_set)) {
+        interruptNet.sleep_for(std::chrono::milliseconds(SELECT_TIMEOUT_MILLISECONDS));
+        return;
+    }
+
+    //
+    // Find which sockets have data to receive
+    //
+    struct timeval timeout;
+    timeout.tv_sec  = 0;
+    timeout.tv_usec = SELECT_TIMEOUT_MILLISECONDS * 1000; // frequency to poll pnode->vSend
+
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    fd_set fdsetError;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    FD_ZERO(&fdsetError);
+    SOCKET hSocketMax = 0;
+
+    for (SOCKET hSocket : recv_select_set) {
+        FD_SET(hSocket, &fdsetRecv);
+        hSocketMax = std::max(hSocketMax, hSocket);
+    }
+    for (SOCKET hSocket : send_select_set) {
+        FD_SET(hSocket, &fdsetSend);
+        hSocketMax = std::max(hSocketMax, hSocket);
+    }
+    for (SOCKET hSocket : error_select_set) {
+        FD_SET(hSocket, &fdsetError);
+        hSocketMax = std::max(hSocketMax, hSocket);
+    }
+
+    int nSelect = select(hSocketMax + 1, &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+    if (interruptNet)
+        return;
+
+    if (nSelect == SOCKET_ERROR)
+    {
+        int nErr = WSAGetLastError();
+        LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
+        for (unsigned int i = 0; i <= hSocketMax; i++)
+            FD_SET(i, &fdsetRecv);
+        FD_ZERO(&fdsetSend);
+        FD_ZERO(&fdsetError);
+        if (!interruptNet.sleep_for(std::chrono::milliseconds(SELECT_TIMEOUT_MILLISECONDS)))
             return;
+    }
 
-        if (nSelect == SOCKET_ERROR)
+    for (SOCKET hSocket : recv_select_set) {
+        if (FD_ISSET(hSocket, &fdsetRecv)) {
+            recv_set.insert(hSocket);
+        }
+    }
+    for (SOCKET hSocket : send_select_set) {
+        if (FD_ISSET(hSocket, &fdsetSend)) {
+            send_set.insert(hSocket);
+        }
+    }
+    for (SOCKET hSocket : error_select_set) {
+        if (FD_ISSET(hSocket, &fdsetError)) {
+            error_set.insert(hSocket);
+        }
+    }
+}
+
+#ifdef USE_POLL
+void CConnman::SocketEventsPoll(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set)
+{
+    std::set<SOCKET> recv_select_set, send_select_set, error_select_set;
+    if (!GenerateSelectSet(recv_select_set, send_select_set, error_select_set)) {
+        interruptNet.sleep_for(std::chrono::milliseconds(SELECT_TIMEOUT_MILLISECONDS));
+        return;
+    }
+
+    std::unordered_map<SOCKET, struct pollfd> pollfds;
+    for (SOCKET socket_id : recv_select_set) {
+        pollfds[socket_id].fd = socket_id;
+        pollfds[socket_id].events |= POLLIN;
+    }
+    for (SOCKET socket_id : send_select_set) {
+        pollfds[socket_id].fd = socket_id;
+        pollfds[socket_id].events |= POLLOUT;
+    }
+    for (SOCKET socket_id : error_select_set) {
+        pollfds[socket_id].fd = socket_id;
+        // These flags are ignored, but we set them for clarity
+        pollfds[socket_id].events |= POLLERR|POLLHUP;
+    }
+
+    std::vector<struct pollfd> vpollfds;
+    vpollfds.reserve(pollfds.size());
+    for (const auto& it : pollfds) {
+        vpollfds.push_back(it.second);
+    }
+
+    if (poll(vpollfds.data(), vpollfds.size(), SELECT_TIMEOUT_MILLISECONDS) < 0) {
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEINTR) {
+            LogPrintf("socket poll error %s\n", NetworkErrorString(nErr));
+            interruptNet.sleep_for(std::chrono::milliseconds(SELECT_TIMEOUT_MILLISECONDS));
+        }
+        return;
+    }
+    if (interruptNet)
+        return;
+
+    for (const struct pollfd& pollfd_entry : vpollfds) {
+        if (pollfd_entry.revents & POLLIN)            recv_set.insert(pollfd_entry.fd);
+        if (pollfd_entry.revents & POLLOUT)           send_set.insert(pollfd_entry.fd);
+        if (pollfd_entry.revents & (POLLERR|POLLHUP)) error_set.insert(pollfd_entry.fd);
+    }
+}
+#endif
+
+void CConnman::SocketHandler()
+{
+    std::set<SOCKET> recv_set, send_set, error_set;
+#ifdef USE_POLL
+    if (socketEventsMode == SocketEventsMode::Poll) {
+        SocketEventsPoll(recv_set, send_set, error_set);
+    } else
+#endif
+    {
+        SocketEventsSelect(recv_set, send_set, error_set);
+    }
+
+    if (interruptNet)
+        return;
+
+    //
+    // Accept new connections
+    //
+    for (const ListenSocket& hListenSocket : vhListenSocket)
+    {
+        if (hListenSocket.socket != INVALID_SOCKET && recv_set.count(hListenSocket.socket) > 0)
         {
-            if (have_fds)
-            {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
-            }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            if (!interruptNet.sleep_for(std::chrono::milliseconds(timeout.tv_usec/1000)))
-                return;
+            AcceptConnection(hListenSocket);
         }
+    }
+
+    //
+    // Service each socket
+    //
+    std::vector<CNode*> vNodesCopy;
+    {
+        LOCK(cs_vNodes);
+        vNodesCopy = vNodes;
+        for (CNode* pnode : vNodesCopy)
+            pnode->AddRef();
+    }
+    for (CNode* pnode : vNodesCopy)
+    {
+        if (interruptNet)
+            return;
 
         //
-        // Accept new connections
+        // Receive
         //
-        for (const ListenSocket& hListenSocket : vhListenSocket)
+        bool recvSet = false;
+        bool sendSet = false;
+        bool errorSet = false;
         {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
-            {
-                AcceptConnection(hListenSocket);
-            }
+            LOCK(pnode->cs_hSocket);
+            if (pnode->hSocket == INVALID_SOCKET)
+                continue;
+            recvSet = recv_set.count(pnode->hSocket) > 0;
+            sendSet = send_set.count(pnode->hSocket) > 0;
+            errorSet = error_set.count(pnode->hSocket) > 0;
+        }
+        if (recvSet || errorSet)
+        {
+            ReceiveFromNode(pnode);
         }
 
         //
-        // Service each socket
+        // Send
         //
-        std::vector<CNode*> vNodesCopy;
+        if (sendSet)
         {
-            LOCK(cs_vNodes);
-            vNodesCopy = vNodes;
-            for (CNode* pnode : vNodesCopy)
-                pnode->AddRef();
+            LOCK(pnode->cs_vSend);
+            size_t nBytes = SocketSendData(pnode);
+            if (nBytes) {
+                RecordBytesSent(nBytes);
+            }
         }
+
+        InactivityCheck(pnode);
+    }
+    {
+        LOCK(cs_vNodes);
         for (CNode* pnode : vNodesCopy)
-        {
-            if (interruptNet)
-                return;
+            pnode->Release();
+    }
+}
 
-            //
-            // Receive
-            //
-            bool recvSet = false;
-            bool sendSet = false;
-            bool errorSet = false;
-            {
-                LOCK(pnode->cs_hSocket);
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
-                recvSet = FD_ISSET(pnode->hSocket, &fdsetRecv);
-                sendSet = FD_ISSET(pnode->hSocket, &fdsetSend);
-                errorSet = FD_ISSET(pnode->hSocket, &fdsetError);
-            }
-            if (recvSet || errorSet)
-            {
-                // typical socket buffer is 8K-64K
-                char pchBuf[0x10000];
-                int nBytes = 0;
-                {
-                    LOCK(pnode->cs_hSocket);
-                    if (pnode->hSocket == INVALID_SOCKET)
-                        continue;
-                    nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
-                }
-                if (nBytes > 0)
-                {
-                    bool notify = false;
-                    if (!pnode->ReceiveMsgBytes(pchBuf, nBytes, notify))
-                        pnode->CloseSocketDisconnect();
-                    RecordBytesRecv(nBytes);
-                    if (notify) {
-                        size_t nSizeAdded = 0;
-                        auto it(pnode->vRecvMsg.begin());
-                        for (; it != pnode->vRecvMsg.end(); ++it) {
-                            if (!it->complete())
-                                break;
-                            nSizeAdded += it->vRecv.size() + CMessageHeader::HEADER_SIZE;
-                        }
-                        {
-                            LOCK(pnode->cs_vProcessMsg);
-                            pnode->vProcessMsg.splice(pnode->vProcessMsg.end(), pnode->vRecvMsg, pnode->vRecvMsg.begin(), it);
-                            pnode->nProcessQueueSize += nSizeAdded;
-                            pnode->fPauseRecv = pnode->nProcessQueueSize > nReceiveFloodSize;
-                        }
-                        WakeMessageHandler();
-                    }
-                }
-                else if (nBytes == 0)
-                {
-                    // socket closed gracefully
-                    if (!pnode->fDisconnect) {
-                        LogPrint(BCLog::NET, "socket closed\n");
-                    }
-                    pnode->CloseSocketDisconnect();
-                }
-                else if (nBytes < 0)
-                {
-                    // error
-                    int nErr = WSAGetLastError();
-                    if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
-                    {
-                        if (!pnode->fDisconnect)
-                            LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
-                        pnode->CloseSocketDisconnect();
-                    }
-                }
+#ifdef USE_EPOLL
+bool CConnman::InitEPoll()
+{
+    epollfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollfd == -1) {
+        LogPrintf("epoll_create1 failed: %s\n", NetworkErrorString(errno));
+        return false;
+    }
+    if (pipe(wakeupPipe) != 0) {
+        LogPrintf("Creating the socket handler wakeup pipe failed: %s\n", NetworkErrorString(errno));
+        CloseEPoll();
+        return false;
+    }
+    fWakeupPipeSignaled = false;
+
+    // The wakeup pipe and listening sockets are level-triggered: one byte or
+    // one connection is taken off them per round, and they stay ready until
+    // they are drained.
+    std::vector<std::pair<int, void*>> level_triggered;
+    level_triggered.emplace_back(wakeupPipe[0], &wakeupPipe);
+    for (ListenSocket& hListenSocket : vhListenSocket) {
+        level_triggered.emplace_back(hListenSocket.socket, &hListenSocket);
+    }
+    for (const auto& fd_data : level_triggered) {
+        struct epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.ptr = fd_data.second;
+        if (epoll_ctl(epollfd, EPOLL_CTL_ADD, fd_data.first, &event) != 0) {
+            LogPrintf("epoll_ctl failed: %s\n", NetworkErrorString(errno));
+            CloseEPoll();
+            return false;
+        }
+    }
+    for (int fd : wakeupPipe) {
+        SetSocketNonBlocking(fd, true);
+    }
+    return true;
+}
+
+void CConnman::CloseEPoll()
+{
+    for (int& fd : wakeupPipe) {
+        if (fd != -1) close(fd);
+        fd = -1;
+    }
+    if (epollfd != -1) close(epollfd);
+    epollfd = -1;
+    setEPollReadyNodes.clear();
+}
+
+bool CConnman::HasEPollWork(CNode* pnode)
+{
+    bool fSendQueued;
+    {
+        LOCK(pnode->cs_vSend);
+        fSendQueued = !pnode->vSendMsg.empty();
+    }
+    // As in the other modes, a queued send is drained before receiving more.
+    return fSendQueued ? pnode->fSocketWritable : (pnode->fSocketReadable && !pnode->fPauseRecv);
+}
+
+void CConnman::SocketHandlerEPoll()
+{
+    // Readiness left over from an earlier round, e.g. a receive buffer that
+    // was not drained in one go, is served without sleeping. Nodes that only
+    // wait for their receive to be unpaused are woken up by WakeSocketHandler.
+    int timeout = EPOLL_TIMEOUT_MILLISECONDS;
+    for (CNode* pnode : setEPollReadyNodes) {
+        if (HasEPollWork(pnode)) {
+            timeout = 0;
+            break;
+        }
+    }
+
+    struct epoll_event events[EPOLL_MAX_EVENTS];
+    int nEvents = epoll_wait(epollfd, events, EPOLL_MAX_EVENTS, timeout);
+    if (interruptNet)
+        return;
+    if (nEvents < 0) {
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEINTR) {
+            LogPrintf("socket epoll_wait error %s\n", NetworkErrorString(nErr));
+            interruptNet.sleep_for(std::chrono::milliseconds(SELECT_TIMEOUT_MILLISECONDS));
+        }
+        nEvents = 0;
+    }
+
+    for (int i = 0; i < nEvents; i++) {
+        void* data = events[i].data.ptr;
+        if (data == &wakeupPipe) {
+            fWakeupPipeSignaled = false;
+            char buf[128];
+            while (read(wakeupPipe[0], buf, sizeof(buf)) > 0) {}
+            continue;
+        }
+        bool fListenSocket = false;
+        for (const ListenSocket& hListenSocket : vhListenSocket) {
+            if (data == &hListenSocket) {
+                AcceptConnection(hListenSocket);
+                fListenSocket = true;
+                break;
             }
+        }
+        if (fListenSocket)
+            continue;
 
-            //
-            // Send
-            //
-            if (sendSet)
-            {
-                LOCK(pnode->cs_vSend);
+        // Nodes are only deleted by this thread, after their socket has been
+        // removed from the epoll set, so the pointer is still valid.
+        CNode* pnode = static_cast<CNode*>(data);
+        // Errors and hangups surface on the next recv(), as with select().
+        if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+            pnode->fSocketReadable = true;
+        if (events[i].events & EPOLLOUT)
+            pnode->fSocketWritable = true;
+        setEPollReadyNodes.insert(pnode);
+    }
+
+    //
+    // Service the sockets that are ready
+    //
+    for (auto it = setEPollReadyNodes.begin(); it != setEPollReadyNodes.end(); )
+    {
+        if (interruptNet)
+            return;
+        CNode* pnode = *it;
+
+        bool fSendQueued;
+        {
+            LOCK(pnode->cs_vSend);
+            if (pnode->fSocketWritable && !pnode->vSendMsg.empty()) {
                 size_t nBytes = SocketSendData(pnode);
                 if (nBytes) {
                     RecordBytesSent(nBytes);
                 }
+                // Anything left means the socket buffer is full; the next
+                // EPOLLOUT edge tells when there is room again.
+                if (!pnode->vSendMsg.empty())
+                    pnode->fSocketWritable = false;
             }
+            fSendQueued = !pnode->vSendMsg.empty();
+        }
 
-            //
-            // Inactivity checking
-            //
-            int64_t nTime = GetSystemTimeInSeconds();
-            if (nTime - pnode->nTimeConnected > 60)
-            {
-                if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
-                {
-                    LogPrint(BCLog::NET, "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->GetId());
-                    pnode->fDisconnect = true;
-                }
-                else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL)
-                {
-                    LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
-                    pnode->fDisconnect = true;
-                }
-                else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90*60))
-                {
-                    LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
-                    pnode->fDisconnect = true;
-                }
-                else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros())
-                {
-                    LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
-                    pnode->fDisconnect = true;
-                }
-                else if (!pnode->fSuccessfullyConnected)
-                {
-                    LogPrint(BCLog::NET, "version handshake timeout from %d\n", pnode->GetId());
-                    pnode->fDisconnect = true;
-                }
-            }
+        if (pnode->fSocketReadable && !fSendQueued && !pnode->fPauseRecv) {
+            pnode->fSocketReadable = ReceiveFromNode(pnode);
         }
-        {
-            LOCK(cs_vNodes);
-            for (CNode* pnode : vNodesCopy)
-                pnode->Release();
+
+        if (pnode->fSocketReadable) {
+            ++it;
+        } else {
+            it = setEPollReadyNodes.erase(it);
         }
     }
+
+    //
+    // Inactivity checking, which is only needed once a second
+    //
+    int64_t nTime = GetSystemTimeInSeconds();
+    if (nTime != nLastInactivityCheck) {
+        nLastInactivityCheck = nTime;
+        LOCK(cs_vNodes);
+        for (CNode* pnode : vNodes) {
+            InactivityCheck(pnode);
+        }
+    }
+}
+#endif
+
+void CConnman::RegisterNodeSocket(CNode* pnode)
+{
+#ifdef USE_EPOLL
+    if (socketEventsMode != SocketEventsMode::EPoll)
+        return;
+    LOCK(pnode->cs_hSocket);
+    if (pnode->hSocket == INVALID_SOCKET)
+        return;
+    // Registered for both directions once, for the lifetime of the connection.
+    struct epoll_event event = {};
+    event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    event.data.ptr = pnode;
+    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, pnode->hSocket, &event) != 0) {
+        LogPrintf("epoll_ctl failed for peer=%d: %s\n", pnode->GetId(), NetworkErrorString(errno));
+        pnode->fDisconnect = true;
+    }
+#endif
+}
+
+void CConnman::UnregisterNodeSocket(CNode* pnode)
+{
+#ifdef USE_EPOLL
+    if (socketEventsMode != SocketEventsMode::EPoll)
+        return;
+    setEPollReadyNodes.erase(pnode);
+    LOCK(pnode->cs_hSocket);
+    // Sockets closed elsewhere have left the epoll set already.
+    if (pnode->hSocket != INVALID_SOCKET) {
+        epoll_ctl(epollfd, EPOLL_CTL_DEL, pnode->hSocket, nullptr);
+    }
+#endif
+}
+
+void CConnman::ThreadSocketHandler()
+{
+    while (!interruptNet)
+    {
+        DisconnectNodes();
+        NotifyNumConnectionsChanged();
+#ifdef USE_EPOLL
+        if (socketEventsMode == SocketEventsMode::EPoll) {
+            SocketHandlerEPoll();
+            continue;
+        }
+#endif
+        SocketHandler();
+    }
+}
+
+void CConnman::WakeSocketHandler()
+{
+#ifdef USE_EPOLL
+    if (socketEventsMode != SocketEventsMode::EPoll || wakeupPipe[1] == -1)
+        return;
+    // One byte in the pipe is enough to wake the thread up.
+    if (!fWakeupPipeSignaled.exchange(true)) {
+        char buf = 0;
+        if (write(wakeupPipe[1], &buf, 1) != 1) {
+            LogPrint(BCLog::NET, "write to the socket handler wakeup pipe failed\n");
+        }
+    }
+#endif
 }
 
 void CConnman::WakeMessageHandler()
 {
     {
         std::lock_guard<std::mutex> lock(mutexMsgProc);
-        fMsgProcWake = true;
+        nMsgProcGeneration++;
     }
-    condMsgProc.notify_one();
+    condMsgProc.notify_all();
 }
 
 
@@ -2020,14 +2492,29 @@ void CConnman::OpenNetworkConnection(const CAddress& addrConnect, bool fCountFai
     m_msgproc->InitializeNode(pnode);
     {
         LOCK(cs_vNodes);
+        RegisterNodeSocket(pnode);
         vNodes.push_back(pnode);
     }
 }
 
-void CConnman::ThreadMessageHandler()
+void CConnman::ThreadMessageHandler(int nWorker)
 {
+    uint64_t nGeneration = 0;
     while (!flagInterruptMsgProc)
     {
+        {
+            WAIT_LOCK(mutexMsgProc, lock);
+            if (nMsgProcGeneration == nGeneration) {
+                condMsgProc.wait_until(lock, std::chrono::steady_clock::now() + std::chrono::milliseconds(100), [this, nGeneration] { return nMsgProcGeneration != nGeneration || flagInterruptMsgProc; });
+                // Nothing new arrived, make the periodic pass for SendMessages
+                if (nMsgProcGeneration == nGeneration)
+                    nMsgProcGeneration++;
+            }
+            nGeneration = nMsgProcGeneration;
+        }
+        if (flagInterruptMsgProc)
+            return;
+
         std::vector<CNode*> vNodesCopy;
         {
             LOCK(cs_vNodes);
@@ -2039,10 +2526,22 @@ void CConnman::ThreadMessageHandler()
 
         bool fMoreWork = false;
 
-        for (CNode* pnode : vNodesCopy)
+        // Threads start at different nodes so that they don't all queue up
+        // behind the same one, and skip nodes another thread already served
+        // in this pass.
+        const size_t nNodes = vNodesCopy.size();
+        const size_t nFirst = nNodes * nWorker / nMsgHandlerThreads;
+        for (size_t i = 0; i < nNodes; i++)
         {
-            if (pnode->fDisconnect)
+            CNode* pnode = vNodesCopy[(nFirst + i) % nNodes];
+            if (pnode->fDisconnect || pnode->nMsgProcGeneration >= nGeneration)
+                continue;
+
+            pnode->fMsgProcMissed = true;
+            if (pnode->fMsgProcBusy.exchange(true))
                 continue;
+            pnode->fMsgProcMissed = false;
+            pnode->nMsgProcGeneration = nGeneration;
 
             // Receive messages
             bool fMoreNodeWork = m_msgproc->ProcessMessages(pnode, flagInterruptMsgProc);
@@ -2055,6 +2554,9 @@ void CConnman::ThreadMessageHandler()
                 m_msgproc->SendMessages(pnode);
             }
 
+            pnode->fMsgProcBusy = false;
+            fMoreWork |= pnode->fMsgProcMissed;
+
             if (flagInterruptMsgProc)
                 return;
         }
@@ -2065,11 +2567,14 @@ void CConnman::ThreadMessageHandler()
                 pnode->Release();
         }
 
-        WAIT_LOCK(mutexMsgProc, lock);
-        if (!fMoreWork) {
-            condMsgProc.wait_until(lock, std::chrono::steady_clock::now() + std::chrono::milliseconds(100), [this] { return fMsgProcWake; });
+        if (fMoreWork) {
+            {
+                LOCK(mutexMsgProc);
+                if (nMsgProcGeneration == nGeneration)
+                    nMsgProcGeneration++;
+            }
+            condMsgProc.notify_all();
         }
-        fMsgProcWake = false;
     }
 }
 
@@ -2207,6 +2712,7 @@ void CConnman::SetNetworkActive(bool active)
     }
 
     fNetworkActive = active;
+    WakeSocketHandler();
 
     uiInterface.NotifyNetworkActiveChanged(fNetworkActive);
 }
@@ -2327,6 +2833,14 @@ bool CConnman::Start(CScheduler& scheduler, const Options& connOptions)
 
     uiInterface.InitMessage(_("Starting network threads..."));
 
+#ifdef USE_EPOLL
+    if (socketEventsMode == SocketEventsMode::EPoll && !InitEPoll()) {
+        LogPrintf("Falling back to poll() for socket events\n");
+        socketEventsMode = SocketEventsMode::Poll;
+    }
+#endif
+    LogPrintf("Using %s for socket events\n", SocketEventsModeToString(socketEventsMode));
+
     fAddressesInitialized = true;
 
     if (semOutbound == nullptr) {
@@ -2348,7 +2862,7 @@ bool CConnman::Start(CScheduler& scheduler, const Options& connOptions)
 
     {
         LOCK(mutexMsgProc);
-        fMsgProcWake = false;
+        nMsgProcGeneration = 1;
     }
 
     // Send and receive from sockets, accept connections
@@ -2374,7 +2888,11 @@ bool CConnman::Start(CScheduler& scheduler, const Options& connOptions)
         threadOpenConnections = std::thread(&TraceThread<std::function<void()> >, "opencon", std::function<void()>(std::bind(&CConnman::ThreadOpenConnections, this, connOptions.m_specified_outgoing)));
 
     // Process messages
-    threadMessageHandler = std::thread(&TraceThread<std::function<void()> >, "msghand", std::function<void()>(std::bind(&CConnman::ThreadMessageHandler, this)));
+    LogPrintf("Using %d message handler threads\n", nMsgHandlerThreads);
+    for (int i = 0; i < nMsgHandlerThreads; i++) {
+        std::string strName = i == 0 ? "msghand" : strprintf("msghand.%d", i);
+        threadMessageHandlers.emplace_back([this, i, strName] { TraceThread(strName.c_str(), std::bind(&CConnman::ThreadMessageHandler, this, i)); });
+    }
 
     // Dump network addresses
     scheduler.scheduleEvery(std::bind(&CConnman::DumpData, this), DUMP_ADDRESSES_INTERVAL * 1000);
@@ -2406,6 +2924,7 @@ void CConnman::Interrupt()
     condMsgProc.notify_all();
 
     interruptNet();
+    WakeSocketHandler();
     InterruptSocks5(true);
 
     if (semOutbound) {
@@ -2423,8 +2942,11 @@ void CConnman::Interrupt()
 
 void CConnman::Stop()
 {
-    if (threadMessageHandler.joinable())
-        threadMessageHandler.join();
+    for (std::thread& thread : threadMessageHandlers) {
+        if (thread.joinable())
+            thread.join();
+    }
+    threadMessageHandlers.clear();
     if (threadOpenConnections.joinable())
         threadOpenConnections.join();
     if (threadOpenAddedConnections.joinable())
@@ -2457,6 +2979,9 @@ void CConnman::Stop()
     }
     vNodes.clear();
     vNodesDisconnected.clear();
+#ifdef USE_EPOLL
+    CloseEPoll();
+#endif
     vhListenSocket.clear();
     semOutbound.reset();
     semAddnode.reset();
@@ -2559,6 +3084,7 @@ bool CConnman::DisconnectNode(const std::string& strNode)
     LOCK(cs_vNodes);
     if (CNode* pnode = FindNode(strNode)) {
         pnode->fDisconnect = true;
+        WakeSocketHandler();
         return true;
     }
     return false;
@@ -2569,6 +3095,7 @@ bool CConnman::DisconnectNode(NodeId id)
     for(CNode* pnode : vNodes) {
         if (id == pnode->GetId()) {
             pnode->fDisconnect = true;
+            WakeSocketHandler();
             return true;
         }
     }
@@ -2817,19 +3344,48 @@ bool CConnman::NodeFullyConnected(const CNode* pnode)
     return pnode && pnode->fSuccessfullyConnected && !pnode->fDisconnect;
 }
 
+/** Write the header of a message with the given payload to the start of vch */
+static void WriteMessageHeader(std::vector<unsigned char>& vch, const std::string& command, Span<const unsigned char> payload)
+{
+    uint256 hash = Hash(payload.begin(), payload.end());
+    CMessageHeader hdr(Params().MessageStart(), command.c_str(), payload.size());
+    memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
+    CVectorWriter{SER_NETWORK, INIT_PROTO_VERSION, vch, 0, hdr};
+}
+
+CFramedNetMsgRef CConnman::FrameMessage(CSerializedNetMsg&& msg)
+{
+    assert(msg.data.size() >= CMessageHeader::HEADER_SIZE);
+    std::shared_ptr<CFramedNetMsg> framed = std::make_shared<CFramedNetMsg>();
+    framed->command = std::move(msg.command);
+    framed->data = std::move(msg.data);
+    const Span<const unsigned char> payload(framed->data.data() + CMessageHeader::HEADER_SIZE, framed->PayloadSize());
+    WriteMessageHeader(framed->data, framed->command, payload);
+    return framed;
+}
+
 void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
 {
-    size_t nMessageSize = msg.data.size();
-    size_t nTotalSize = nMessageSize + CMessageHeader::HEADER_SIZE;
-    LogPrint(BCLog::NET, "sending %s (%d bytes) peer=%d\n",  SanitizeString(msg.command.c_str()), nMessageSize, pnode->GetId());
+    PushMessage(pnode, FrameMessage(std::move(msg)));
+}
 
-    std::vector<unsigned char> serializedHeader;
-    serializedHeader.reserve(CMessageHeader::HEADER_SIZE);
-    uint256 hash = Hash(msg.data.data(), msg.data.data() + nMessageSize);
-    CMessageHeader hdr(Params().MessageStart(), msg.command.c_str(), nMessageSize);
-    memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
+void CConnman::PushMessage(CNode* pnode, const CFramedNetMsgRef& msg)
+{
+    QueueSend(pnode, msg->command, msg->PayloadSize(), {CSendChunk{msg, MakeSpan(msg->data)}});
+}
+
+void CConnman::PushMessage(CNode* pnode, const std::string& command, CSendChunk payload)
+{
+    std::shared_ptr<std::vector<unsigned char>> header = std::make_shared<std::vector<unsigned char>>();
+    header->reserve(CMessageHeader::HEADER_SIZE);
+    WriteMessageHeader(*header, command, payload.data);
+    QueueSend(pnode, command, payload.data.size(), {CSendChunk{header, Span<const unsigned char>(header->data(), header->size())}, std::move(payload)});
+}
 
-    CVectorWriter{SER_NETWORK, INIT_PROTO_VERSION, serializedHeader, 0, hdr};
+void CConnman::QueueSend(CNode* pnode, const std::string& command, size_t nPayloadSize, std::initializer_list<CSendChunk> chunks)
+{
+    size_t nTotalSize = nPayloadSize + CMessageHeader::HEADER_SIZE;
+    LogPrint(BCLog::NET, "sending %s (%d bytes) peer=%d\n",  SanitizeString(command.c_str()), nPayloadSize, pnode->GetId());
 
     size_t nBytesSent = 0;
     {
@@ -2837,14 +3393,15 @@ void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
         bool optimisticSend(pnode->vSendMsg.empty());
 
         //log total amount of bytes per command
-        pnode->mapSendBytesPerMsgCmd[msg.command] += nTotalSize;
+        pnode->mapSendBytesPerMsgCmd[command] += nTotalSize;
         pnode->nSendSize += nTotalSize;
 
         if (pnode->nSendSize > nSendBufferMaxSize)
             pnode->fPauseSend = true;
-        pnode->vSendMsg.push_back(std::move(serializedHeader));
-        if (nMessageSize)
-            pnode->vSendMsg.push_back(std::move(msg.data));
+        for (const CSendChunk& chunk : chunks) {
+            if (chunk.data.size())
+                pnode->vSendMsg.push_back(chunk);
+        }
 
         // If write queue empty, attempt "optimistic write"
         if (optimisticSend == true)
@@ -17,10 +17,12 @@
 #include <policy/feerate.h>
 #include <protocol.h>
 #include <random.h>
+#include <span.h>
 #include <streams.h>
 #include <sync.h>
 #include <uint256.h>
 #include <threadinterrupt.h>
+#include <txreconciliation.h>
 
 #include <atomic>
 #include <deque>
@@ -57,6 +59,10 @@ static const unsigned int MAX_SUBVERSION_LENGTH = 256;
 static const int MAX_OUTBOUND_CONNECTIONS = 8;
 /** Maximum number of addnode outgoing nodes */
 static const int MAX_ADDNODE_CONNECTIONS = 8;
+/** Maximum number of message handler threads */
+static const int MAX_MSGHANDLER_THREADS = 16;
+/** -msghandlerthreads default (0 = auto) */
+static const int DEFAULT_MSGHANDLER_THREADS = 0;
 /** -listen default */
 static const bool DEFAULT_LISTEN = true;
 /** -upnp default */
@@ -85,6 +91,26 @@ static const size_t DEFAULT_MAXSENDBUFFER    = 1 * 1000;
 // NOTE: When adjusting this, update rpcnet:setban's help ("24h")
 static const unsigned int DEFAULT_MISBEHAVING_BANTIME = 60 * 60 * 24;  // Default 24-hour ban
 
+/** Time the socket handler waits in select() or poll() before looking at the send buffers again (in milliseconds). */
+static const int SELECT_TIMEOUT_MILLISECONDS = 50;
+/** Longest time the socket handler sleeps in epoll_wait() without being woken up (in milliseconds). */
+static const int EPOLL_TIMEOUT_MILLISECONDS = 1000;
+/** Maximum number of socket events the socket handler takes from epoll_wait() at once. */
+static const int EPOLL_MAX_EVENTS = 256;
+
+/** How the socket handler thread waits for its sockets to become ready */
+enum class SocketEventsMode {
+    Select,  //!< select() over all sockets, limited to FD_SETSIZE
+    Poll,    //!< poll() over all sockets
+    EPoll,   //!< edge-triggered epoll, sockets registered once for their lifetime
+};
+
+/** The socket events modes available on this platform, the default first. */
+std::vector<SocketEventsMode> GetSupportedSocketEventsModes();
+std::string SocketEventsModeToString(SocketEventsMode mode);
+/** Parse a -socketevents value. Returns false if it names no mode available on this platform. */
+bool SocketEventsModeFromString(const std::string& str, SocketEventsMode& mode);
+
 typedef int64_t NodeId;
 
 struct AddedNodeInfo
@@ -107,10 +133,38 @@ struct CSerializedNetMsg
     CSerializedNetMsg(const CSerializedNetMsg& msg) = delete;
     CSerializedNetMsg& operator=(const CSerializedNetMsg&) = delete;
 
+    // Room for the message header, followed by the payload. The header is
+    // written in place when the message is framed, so that the payload is
+    // not copied to put it behind the header.
     std::vector<unsigned char> data;
     std::string command;
 };
 
+/**
+ * A message framed for the wire, header and payload in one buffer. It is not
+ * modified once framed, so it can be pushed to any number of peers, which
+ * only queue a reference to it.
+ */
+struct CFramedNetMsg
+{
+    std::string command;
+    std::vector<unsigned char> data;
+
+    size_t PayloadSize() const { return data.size() - CMessageHeader::HEADER_SIZE; }
+};
+typedef std::shared_ptr<const CFramedNetMsg> CFramedNetMsgRef;
+
+/**
+ * Bytes in a peer's send queue. They belong to owner, a framed message or a
+ * memory mapped block file for example, which the queue keeps alive until
+ * they are sent.
+ */
+struct CSendChunk
+{
+    std::shared_ptr<const void> owner;
+    Span<const unsigned char> data;
+};
+
 class NetEventsInterface;
 class CConnman
 {
@@ -143,6 +197,8 @@ public:
         bool m_use_addrman_outgoing = true;
         std::vector<std::string> m_specified_outgoing;
         std::vector<std::string> m_added_nodes;
+        SocketEventsMode socketEventsMode = SocketEventsMode::Select;
+        int nMsgHandlerThreads = 1;
     };
 
     void Init(const Options& connOptions) {
@@ -157,6 +213,8 @@ public:
         m_msgproc = connOptions.m_msgproc;
         nSendBufferMaxSize = connOptions.nSendBufferMaxSize;
         nReceiveFloodSize = connOptions.nReceiveFloodSize;
+        socketEventsMode = connOptions.socketEventsMode;
+        nMsgHandlerThreads = std::max(1, std::min(connOptions.nMsgHandlerThreads, MAX_MSGHANDLER_THREADS));
         {
             LOCK(cs_totalBytesSent);
             nMaxOutboundTimeframe = connOptions.nMaxOutboundTimeframe;
@@ -183,6 +241,11 @@ public:
     bool ForNode(NodeId id, std::function<bool(CNode* pnode)> func);
 
     void PushMessage(CNode* pnode, CSerializedNetMsg&& msg);
+    void PushMessage(CNode* pnode, const CFramedNetMsgRef& msg);
+    /** Push a message whose payload is sent from where it is, without copying it. */
+    void PushMessage(CNode* pnode, const std::string& command, CSendChunk payload);
+    /** Frame msg once, to push it to several peers. */
+    static CFramedNetMsgRef FrameMessage(CSerializedNetMsg&& msg);
 
     template<typename Callable>
     void ForEachNode(Callable&& func)
@@ -314,6 +377,8 @@ public:
     unsigned int GetReceiveFloodSize() const;
 
     void WakeMessageHandler();
+    /** Interrupt the socket handler's wait for socket events, in modes that wait without a short timeout. */
+    void WakeSocketHandler();
 
     /** Attempts to obfuscate tx time through exponentially distributed emitting.
         Works assuming that a single interval is used.
@@ -336,8 +401,28 @@ private:
     void AddOneShot(const std::string& strDest);
     void ProcessOneShot();
     void ThreadOpenConnections(std::vector<std::string> connect);
-    void ThreadMessageHandler();
+    void ThreadMessageHandler(int nWorker);
     void AcceptConnection(const ListenSocket& hListenSocket);
+    void DisconnectNodes();
+    void NotifyNumConnectionsChanged();
+    void InactivityCheck(CNode* pnode);
+    /** Read from the node's socket once. Returns whether more data may be waiting. */
+    bool ReceiveFromNode(CNode* pnode);
+    bool GenerateSelectSet(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set);
+    void SocketEventsSelect(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set);
+#ifdef USE_POLL
+    void SocketEventsPoll(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set);
+#endif
+    void SocketHandler();
+#ifdef USE_EPOLL
+    bool InitEPoll();
+    void CloseEPoll();
+    bool HasEPollWork(CNode* pnode);
+    void SocketHandlerEPoll();
+#endif
+    /** Register a new node's socket for socket events, in modes that keep registrations. */
+    void RegisterNodeSocket(CNode* pnode);
+    void UnregisterNodeSocket(CNode* pnode);
     void ThreadSocketHandler();
     void ThreadDNSAddressSeed();
 
@@ -357,6 +442,7 @@ private:
     NodeId GetNewNodeId();
 
     size_t SocketSendData(CNode *pnode) const;
+    void QueueSend(CNode* pnode, const std::string& command, size_t nPayloadSize, std::initializer_list<CSendChunk> chunks);
     //!check is the banlist has unwritten changes
     bool BannedSetIsDirty();
     //!set the "dirty" flag for the banlist
@@ -394,6 +480,18 @@ private:
     unsigned int nReceiveFloodSize;
 
     std::vector<ListenSocket> vhListenSocket;
+    SocketEventsMode socketEventsMode;
+#ifdef USE_EPOLL
+    int epollfd = -1;
+    /** Pipe whose read end the socket handler also waits on, to be woken up by other threads */
+    int wakeupPipe[2] = {-1, -1};
+    std::atomic<bool> fWakeupPipeSignaled{false};
+    /** Nodes with socket readiness reported by epoll that is not used up yet.
+     *  Used only by the socket handler thread. */
+    std::set<CNode*> setEPollReadyNodes;
+#endif
+    unsigned int nPrevNodeCount = 0;
+    int64_t nLastInactivityCheck = 0;
     std::atomic<bool> fNetworkActive;
     banmap_t setBanned;
     CCriticalSection cs_setBanned;
@@ -426,8 +524,13 @@ private:
     /** SipHasher seeds for deterministic randomness */
     const uint64_t nSeed0, nSeed1;
 
-    /** flag for waking the message processor. */
-    bool fMsgProcWake;
+    /**
+     * Pass counter of the message handler threads. It is advanced whenever
+     * there is new work for them, and every thread that wakes up for the same
+     * value shares one pass over the nodes instead of each doing its own.
+     */
+    uint64_t nMsgProcGeneration GUARDED_BY(mutexMsgProc) = 0;
+    int nMsgHandlerThreads;
 
     std::condition_variable condMsgProc;
     Mutex mutexMsgProc;
@@ -439,7 +542,7 @@ private:
     std::thread threadSocketHandler;
     std::thread threadOpenAddedConnections;
     std::thread threadOpenConnections;
-    std::thread threadMessageHandler;
+    std::vector<std::thread> threadMessageHandlers;
 
     /** flag for deciding to connect to an extra outbound peer,
      *  in excess of nMaxOutbound
@@ -614,6 +717,12 @@ public:
 
     int readHeader(const char *pch, unsigned int nBytes);
     int readData(const char *pch, unsigned int nBytes);
+
+    // The payload can also be received in place: up to nBytes (which is
+    // lowered to what is left of the payload) can be written to the buffer
+    // dataBuffer returns, and dataReceived then takes in what was written.
+    char* dataBuffer(unsigned int& nBytes);
+    void dataReceived(unsigned int nBytes);
 };
 
 
@@ -628,7 +737,7 @@ public:
     size_t nSendSize; // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
-    std::deque<std::vector<unsigned char>> vSendMsg;
+    std::deque<CSendChunk> vSendMsg;
     CCriticalSection cs_vSend;
     CCriticalSection cs_hSocket;
     CCriticalSection cs_vRecv;
@@ -691,8 +800,9 @@ public:
     std::atomic<int> nStartingHeight;
 
     // flood relay
-    std::vector<CAddress> vAddrToSend;
-    CRollingBloomFilter addrKnown;
+    CCriticalSection cs_vAddrToSend;
+    std::vector<CAddress> vAddrToSend GUARDED_BY(cs_vAddrToSend);
+    CRollingBloomFilter addrKnown GUARDED_BY(cs_vAddrToSend);
     bool fGetAddr;
     std::set<uint256> setKnown;
     int64_t nNextAddrSend;
@@ -716,6 +826,12 @@ public:
     std::vector<uint256> vBlockHashesToAnnounce;
     // Used for BIP35 mempool sending, also protected by cs_inventory
     bool fSendMempool;
+    // Transaction reconciliation, also protected by cs_inventory
+    // Whether we sent sendrecon, and the salt in it
+    bool m_recon_offered{false};
+    uint64_t m_recon_salt{0};
+    // Set once the peer sent sendrecon too
+    std::unique_ptr<TxReconciliationState> m_recon;
 
     // Last time a "MEMPOOL" request was serviced.
     std::atomic<int64_t> timeLastMempoolReq;
@@ -754,6 +870,19 @@ private:
     const int nMyStartingHeight;
     int nSendVersion;
     std::list<CNetMessage> vRecvMsg;  // Used only by SocketHandler thread
+    void RecvMessageComplete(CNetMessage& msg, int64_t nTimeMicros);
+    // Socket readiness reported by edge-triggered epoll that is not used up yet.
+    // Used only by SocketHandler thread
+    bool fSocketReadable = false;
+    bool fSocketWritable = false;
+    // Held by the message handler thread that is processing this node, so
+    // that its messages are handled by one thread at a time, in order.
+    std::atomic_bool fMsgProcBusy{false};
+    // Set by a message handler thread that skipped this node while it was
+    // busy, so that the thread holding it comes back for another pass.
+    std::atomic_bool fMsgProcMissed{false};
+    // Last message handler pass this node was processed in
+    std::atomic<uint64_t> nMsgProcGeneration{0};
 
     mutable CCriticalSection cs_addrName;
     std::string addrName;
@@ -782,6 +911,13 @@ public:
     }
 
     bool ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete);
+    /**
+     * Buffer to receive the next nBytes into in place, when they are all
+     * payload of the message being received, or nullptr. Bytes received into
+     * it are taken in with ReceivedMsgBytes. Used only by SocketHandler thread.
+     */
+    char* GetRecvBuffer(unsigned int nBytes);
+    void ReceivedMsgBytes(unsigned int nBytes, bool& complete);
 
     void SetRecvVersion(int nVersionIn)
     {
@@ -813,11 +949,14 @@ public:
 
     void AddAddressKnown(const CAddress& _addr)
     {
+        LOCK(cs_vAddrToSend);
         addrKnown.insert(_addr.GetKey());
     }
 
     void PushAddress(const CAddress& _addr, FastRandomContext &insecure_rand)
     {
+        // Other peers' message handler threads relay addresses to this node.
+        LOCK(cs_vAddrToSend);
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
@@ -14,6 +14,7 @@
 #include <validation.h>
 #include <merkleblock.h>
 #include <netmessagemaker.h>
+#include <netmsgcache.h>
 #include <netbase.h>
 #include <policy/fees.h>
 #include <policy/policy.h>
@@ -24,6 +25,7 @@
 #include <scheduler.h>
 #include <tinyformat.h>
 #include <txmempool.h>
+#include <txreconciliation.h>
 #include <ui_interface.h>
 #include <util.h>
 #include <utilmoneystr.h>
@@ -57,6 +59,8 @@ static constexpr int64_t EXTRA_PEER_CHECK_INTERVAL = 45;
 static constexpr int64_t MINIMUM_CONNECT_TIME = 30;
 /** SHA256("main address relay")[0:8] */
 static constexpr uint64_t RANDOMIZER_ID_ADDRESS_RELAY = 0x3cac0035b5866b90ULL;
+/** SHA256("tx flooding")[0:8] */
+static constexpr uint64_t RANDOMIZER_ID_TX_FLOOD = 0x806b339c693f29a2ULL;
 /// Age after which a stale block will no longer be served if requested as
 /// protection against fingerprinting. Set to one month, denominated in seconds.
 static constexpr int STALE_RELAY_AGE_LIMIT = 30 * 24 * 60 * 60;
@@ -146,6 +150,9 @@ namespace {
     /** Number of peers from which we're downloading blocks. */
     int nPeersWithValidatedDownloads GUARDED_BY(cs_main) = 0;
 
+    /** Number of outbound peers we reconcile transactions with. */
+    int g_outbound_peers_with_recon GUARDED_BY(cs_main) = 0;
+
     /** Number of outbound peers with m_chain_sync.m_protect. */
     int g_outbound_peers_with_protect_from_disconnect GUARDED_BY(cs_main) = 0;
 
@@ -273,6 +280,9 @@ struct CNodeState {
     //! Time of last new block announcement
     int64_t m_last_block_announcement;
 
+    //! Whether this is an outbound peer we reconcile transactions with
+    bool m_recon_outbound;
+
     CNodeState(CAddress addrIn, std::string addrNameIn) : address(addrIn), name(addrNameIn) {
         fCurrentlyConnected = false;
         nMisbehavior = 0;
@@ -297,6 +307,7 @@ struct CNodeState {
         fSupportsDesiredCmpctVersion = false;
         m_chain_sync = { 0, nullptr, false, false };
         m_last_block_announcement = 0;
+        m_recon_outbound = false;
     }
 };
 
@@ -642,6 +653,8 @@ void PeerLogicValidation::FinalizeNode(NodeId nodeid, bool& fUpdateConnectionTim
     assert(nPeersWithValidatedDownloads >= 0);
     g_outbound_peers_with_protect_from_disconnect -= state->m_chain_sync.m_protect;
     assert(g_outbound_peers_with_protect_from_disconnect >= 0);
+    g_outbound_peers_with_recon -= state->m_recon_outbound;
+    assert(g_outbound_peers_with_recon >= 0);
 
     mapNodeState.erase(nodeid);
 
@@ -651,6 +664,7 @@ void PeerLogicValidation::FinalizeNode(NodeId nodeid, bool& fUpdateConnectionTim
         assert(nPreferredDownload == 0);
         assert(nPeersWithValidatedDownloads == 0);
         assert(g_outbound_peers_with_protect_from_disconnect == 0);
+        assert(g_outbound_peers_with_recon == 0);
     }
     LogPrint(BCLog::NET, "Cleared nodestate for peer=%d\n", nodeid);
 }
@@ -898,6 +912,9 @@ static std::shared_ptr<const CBlockHeaderAndShortTxIDs> most_recent_compact_bloc
 static uint256 most_recent_block_hash GUARDED_BY(cs_most_recent_block);
 static bool fWitnessesPresentInMostRecentCompactBlock GUARDED_BY(cs_most_recent_block);
 
+/** Framed block, cmpctblock and tx messages, shared by the peers they are relayed to */
+static NetMsgCache g_relay_msg_cache(RELAY_MSG_CACHE_SIZE);
+
 /**
  * Maintain state about the best-seen block and fast-announce a compact block
  * to compatible peers.
@@ -924,10 +941,11 @@ void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std:
         fWitnessesPresentInMostRecentCompactBlock = fWitnessEnabled;
     }
 
-    connman->ForEachNode([this, &pcmpctblock, pindex, &msgMaker, fWitnessEnabled, &hashBlock](CNode* pnode) {
+    // Serialized once, for all the peers it is announced to
+    CFramedNetMsgRef cmpctblock_msg;
+    connman->ForEachNode([this, &pcmpctblock, pindex, &msgMaker, fWitnessEnabled, &hashBlock, &cmpctblock_msg](CNode* pnode) {
         AssertLockHeld(cs_main);
 
-        // TODO: Avoid the repeated-serialization here
         if (pnode->nVersion < INVALID_CB_NO_BAN_VERSION || pnode->fDisconnect)
             return;
         ProcessBlockAvailability(pnode->GetId());
@@ -939,7 +957,12 @@ void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std:
 
             LogPrint(BCLog::NET, "%s sending header-and-ids %s to peer=%d\n", "PeerLogicValidation::NewPoWValidBlock",
                     hashBlock.ToString(), pnode->GetId());
-            connman->PushMessage(pnode, msgMaker.Make(NetMsgType::CMPCTBLOCK, *pcmpctblock));
+            if (!cmpctblock_msg) {
+                cmpctblock_msg = CConnman::FrameMessage(msgMaker.Make(NetMsgType::CMPCTBLOCK, *pcmpctblock));
+                // Peers that get it announced later ask for it with getdata
+                g_relay_msg_cache.Insert(hashBlock, 0, cmpctblock_msg);
+            }
+            connman->PushMessage(pnode, cmpctblock_msg);
             state.pindexBestHeaderSent = pindex;
         }
     });
@@ -1105,6 +1128,71 @@ static void RelayAddress(const CAddress& addr, bool fReachable, CConnman* connma
     connman->ForEachNodeThen(std::move(sortfunc), std::move(pushfunc));
 }
 
+/**
+ * The tx message for tx, serialized once for all the peers it is relayed to.
+ * Transactions with the same txid can differ in their witness, so messages
+ * that carry the witness are cached by wtxid.
+ */
+static CFramedNetMsgRef GetTxMessage(const CNetMsgMaker& msgMaker, int nSendFlags, const CTransactionRef& tx)
+{
+    const uint256& hash = (nSendFlags & SERIALIZE_TRANSACTION_NO_WITNESS) ? tx->GetHash() : tx->GetWitnessHash();
+    return g_relay_msg_cache.Get(hash, NetMsgType::TX, nSendFlags, [&] {
+        return msgMaker.Make(nSendFlags, NetMsgType::TX, *tx);
+    });
+}
+
+/**
+ * Whether to announce a transaction to a peer we reconcile with by inv right
+ * away. Each transaction is flooded to RECON_FLOOD_OUTBOUND of our outbound
+ * reconciling peers on average, to get it across the network quickly, and
+ * reconciled with all the others.
+ */
+static bool FloodToReconPeer(CNode* pto, const uint256& hash, CConnman* connman) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    if (!pto->m_recon->m_initiator) return false;
+    const uint64_t nPeers = std::max(g_outbound_peers_with_recon, RECON_FLOOD_OUTBOUND);
+    return connman->GetDeterministicRandomizer(RANDOMIZER_ID_TX_FLOOD).Write(pto->GetId()).Write(hash.GetUint64(0)).Finalize() % nPeers < (uint64_t)RECON_FLOOD_OUTBOUND;
+}
+
+/** Announce transactions by inv, after reconciling them or instead of it */
+static void AnnounceTxs(CNode* pto, const std::vector<uint256>& txids, CConnman* connman)
+{
+    const CNetMsgMaker msgMaker(pto->GetSendVersion());
+    std::vector<CInv> vInv;
+    for (const uint256& txid : txids) {
+        vInv.push_back(CInv(MSG_TX, txid));
+        if (vInv.size() == MAX_INV_SZ) {
+            connman->PushMessage(pto, msgMaker.Make(NetMsgType::INV, vInv));
+            vInv.clear();
+        }
+    }
+    if (!vInv.empty())
+        connman->PushMessage(pto, msgMaker.Make(NetMsgType::INV, vInv));
+}
+
+/** A block read from disk as a send queue chunk, sent from the mapped block file when it is mapped */
+static CSendChunk RawBlockChunk(CRawBlock&& block)
+{
+    if (block.file) {
+        return CSendChunk{std::move(block.file), block.data};
+    }
+    std::shared_ptr<std::vector<uint8_t>> buffer = std::make_shared<std::vector<uint8_t>>(std::move(block.buffer));
+    return CSendChunk{buffer, Span<const uint8_t>(buffer->data(), buffer->size())};
+}
+
+/**
+ * Blocks are read from disk without cs_main held, so a pruning node may have
+ * deleted the block file between the availability check and the read.
+ */
+static void BlockReadFailed(CNode* pfrom, const CInv& inv)
+{
+    if (!fPruneMode) {
+        assert(!"cannot load block from disk");
+    }
+    LogPrint(BCLog::NET, "block %s was pruned while it was being served, disconnect peer=%d\n", inv.hash.ToString(), pfrom->GetId());
+    pfrom->fDisconnect = true;
+}
+
 void static ProcessGetBlockData(CNode* pfrom, const CChainParams& chainparams, const CInv& inv, CConnman* connman)
 {
     bool send = false;
@@ -1142,121 +1230,143 @@ void static ProcessGetBlockData(CNode* pfrom, const CChainParams& chainparams, c
         }
     }
 
-    LOCK(cs_main);
-    const CBlockIndex* pindex = LookupBlockIndex(inv.hash);
-    if (pindex) {
-        send = BlockRequestAllowed(pindex, consensusParams);
-        if (!send) {
-            LogPrint(BCLog::NET, "%s: ignoring request from peer=%i for old block that isn't in the main chain\n", __func__, pfrom->GetId());
-        }
-    }
     const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
-    // disconnect node in case we have reached the outbound limit for serving historical blocks
-    // never disconnect whitelisted nodes
-    if (send && connman->OutboundTargetReached(true) && ( ((pindexBestHeader != nullptr) && (pindexBestHeader->GetBlockTime() - pindex->GetBlockTime() > HISTORICAL_BLOCK_AGE)) || inv.type == MSG_FILTERED_BLOCK) && !pfrom->fWhitelisted)
+    const CBlockIndex* pindex;
+    bool fPeerWantsWitness = false;
+    bool fCompactAllowed = false;
+    uint256 hashTip;
     {
-        LogPrint(BCLog::NET, "historical block serving limit reached, disconnect peer=%d\n", pfrom->GetId());
+        LOCK(cs_main);
+        pindex = LookupBlockIndex(inv.hash);
+        if (pindex) {
+            send = BlockRequestAllowed(pindex, consensusParams);
+            if (!send) {
+                LogPrint(BCLog::NET, "%s: ignoring request from peer=%i for old block that isn't in the main chain\n", __func__, pfrom->GetId());
+            }
+        }
+        // disconnect node in case we have reached the outbound limit for serving historical blocks
+        // never disconnect whitelisted nodes
+        if (send && connman->OutboundTargetReached(true) && ( ((pindexBestHeader != nullptr) && (pindexBestHeader->GetBlockTime() - pindex->GetBlockTime() > HISTORICAL_BLOCK_AGE)) || inv.type == MSG_FILTERED_BLOCK) && !pfrom->fWhitelisted)
+        {
+            LogPrint(BCLog::NET, "historical block serving limit reached, disconnect peer=%d\n", pfrom->GetId());
 
-        //disconnect node
-        pfrom->fDisconnect = true;
-        send = false;
-    }
-    // Avoid leaking prune-height by never sending blocks below the NODE_NETWORK_LIMITED threshold
-    if (send && !pfrom->fWhitelisted && (
-            (((pfrom->GetLocalServices() & NODE_NETWORK_LIMITED) == NODE_NETWORK_LIMITED) && ((pfrom->GetLocalServices() & NODE_NETWORK) != NODE_NETWORK) && (chainActive.Tip()->nHeight - pindex->nHeight > (int)NODE_NETWORK_LIMITED_MIN_BLOCKS + 2 /* add two blocks buffer extension for possible races */) )
-       )) {
-        LogPrint(BCLog::NET, "Ignore block request below NODE_NETWORK_LIMITED threshold from peer=%d\n", pfrom->GetId());
+            //disconnect node
+            pfrom->fDisconnect = true;
+            send = false;
+        }
+        // Avoid leaking prune-height by never sending blocks below the NODE_NETWORK_LIMITED threshold
+        if (send && !pfrom->fWhitelisted && (
+                (((pfrom->GetLocalServices() & NODE_NETWORK_LIMITED) == NODE_NETWORK_LIMITED) && ((pfrom->GetLocalServices() & NODE_NETWORK) != NODE_NETWORK) && (chainActive.Tip()->nHeight - pindex->nHeight > (int)NODE_NETWORK_LIMITED_MIN_BLOCKS + 2 /* add two blocks buffer extension for possible races */) )
+           )) {
+            LogPrint(BCLog::NET, "Ignore block request below NODE_NETWORK_LIMITED threshold from peer=%d\n", pfrom->GetId());
 
-        //disconnect node and prevent it from stalling (would otherwise wait for the missing block)
-        pfrom->fDisconnect = true;
-        send = false;
+            //disconnect node and prevent it from stalling (would otherwise wait for the missing block)
+            pfrom->fDisconnect = true;
+            send = false;
+        }
+        // Pruned nodes may have deleted the block, so check whether
+        // it's available before trying to send.
+        if (!send || !(pindex->nStatus & BLOCK_HAVE_DATA))
+            return;
+        if (inv.type == MSG_CMPCT_BLOCK) {
+            fPeerWantsWitness = State(pfrom->GetId())->fWantsCmpctWitness;
+            fCompactAllowed = CanDirectFetch(consensusParams) && pindex->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH;
+        }
+        if (inv.hash == pfrom->hashContinue)
+            hashTip = chainActive.Tip()->GetBlockHash();
+    } // release cs_main before reading the block from disk
+
+    std::shared_ptr<const CBlock> pblock;
+    if (a_recent_block && a_recent_block->GetHash() == pindex->GetBlockHash()) {
+        pblock = a_recent_block;
+    } else if (inv.type == MSG_WITNESS_BLOCK) {
+        // Fast-path: in this case it is possible to serve the block directly from disk,
+        // as the network format matches the format on disk
+        CRawBlock block_data;
+        if (!ReadRawBlockFromDisk(block_data, pindex, chainparams.MessageStart())) {
+            BlockReadFailed(pfrom, inv);
+            return;
+        }
+        connman->PushMessage(pfrom, NetMsgType::BLOCK, RawBlockChunk(std::move(block_data)));
+        // Don't set pblock as we've sent the block
+    } else {
+        // Send block from disk
+        std::shared_ptr<CBlock> pblockRead = std::make_shared<CBlock>();
+        if (!ReadBlockFromDisk(*pblockRead, pindex, consensusParams)) {
+            BlockReadFailed(pfrom, inv);
+            return;
+        }
+        pblock = pblockRead;
     }
-    // Pruned nodes may have deleted the block, so check whether
-    // it's available before trying to send.
-    if (send && (pindex->nStatus & BLOCK_HAVE_DATA))
-    {
-        std::shared_ptr<const CBlock> pblock;
-        if (a_recent_block && a_recent_block->GetHash() == pindex->GetBlockHash()) {
-            pblock = a_recent_block;
-        } else if (inv.type == MSG_WITNESS_BLOCK) {
-            // Fast-path: in this case it is possible to serve the block directly from disk,
-            // as the network format matches the format on disk
-            std::vector<uint8_t> block_data;
-            if (!ReadRawBlockFromDisk(block_data, pindex, chainparams.MessageStart())) {
-                assert(!"cannot load block from disk");
-            }
-            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, MakeSpan(block_data)));
-            // Don't set pblock as we've sent the block
-        } else {
-            // Send block from disk
-            std::shared_ptr<CBlock> pblockRead = std::make_shared<CBlock>();
-            if (!ReadBlockFromDisk(*pblockRead, pindex, consensusParams))
-                assert(!"cannot load block from disk");
-            pblock = pblockRead;
-        }
-        if (pblock) {
-            if (inv.type == MSG_BLOCK)
-                connman->PushMessage(pfrom, msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, *pblock));
-            else if (inv.type == MSG_WITNESS_BLOCK)
-                connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, *pblock));
-            else if (inv.type == MSG_FILTERED_BLOCK)
+    if (pblock) {
+        if (inv.type == MSG_BLOCK || inv.type == MSG_WITNESS_BLOCK) {
+            int nSendFlags = (inv.type == MSG_BLOCK ? SERIALIZE_TRANSACTION_NO_WITNESS : 0);
+            if (pblock == a_recent_block) {
+                // Peers ask for a new block all at once, serialize it once for all of them
+                connman->PushMessage(pfrom, g_relay_msg_cache.Get(pblock->GetHash(), NetMsgType::BLOCK, nSendFlags, [&] {
+                    return msgMaker.Make(nSendFlags, NetMsgType::BLOCK, *pblock);
+                }));
+            } else {
+                connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::BLOCK, *pblock));
+            }
+        }
+        else if (inv.type == MSG_FILTERED_BLOCK)
+        {
+            bool sendMerkleBlock = false;
+            CMerkleBlock merkleBlock;
             {
-                bool sendMerkleBlock = false;
-                CMerkleBlock merkleBlock;
-                {
-                    LOCK(pfrom->cs_filter);
-                    if (pfrom->pfilter) {
-                        sendMerkleBlock = true;
-                        merkleBlock = CMerkleBlock(*pblock, *pfrom->pfilter);
-                    }
+                LOCK(pfrom->cs_filter);
+                if (pfrom->pfilter) {
+                    sendMerkleBlock = true;
+                    merkleBlock = CMerkleBlock(*pblock, *pfrom->pfilter);
                 }
-                if (sendMerkleBlock) {
-                    connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::MERKLEBLOCK, merkleBlock));
-                    // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
-                    // This avoids hurting performance by pointlessly requiring a round-trip
-                    // Note that there is currently no way for a node to request any single transactions we didn't send here -
-                    // they must either disconnect and retry or request the full block.
-                    // Thus, the protocol spec specified allows for us to provide duplicate txn here,
-                    // however we MUST always provide at least what the remote peer needs
-                    typedef std::pair<unsigned int, uint256> PairType;
-                    for (PairType& pair : merkleBlock.vMatchedTxn)
-                        connman->PushMessage(pfrom, msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::TX, *pblock->vtx[pair.first]));
-                }
-                // else
-                    // no response
             }
-            else if (inv.type == MSG_CMPCT_BLOCK)
-            {
-                // If a peer is asking for old blocks, we're almost guaranteed
-                // they won't have a useful mempool to match against a compact block,
-                // and we don't feel like constructing the object for them, so
-                // instead we respond with the full, non-compact block.
-                bool fPeerWantsWitness = State(pfrom->GetId())->fWantsCmpctWitness;
-                int nSendFlags = fPeerWantsWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS;
-                if (CanDirectFetch(consensusParams) && pindex->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH) {
+            if (sendMerkleBlock) {
+                connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::MERKLEBLOCK, merkleBlock));
+                // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
+                // This avoids hurting performance by pointlessly requiring a round-trip
+                // Note that there is currently no way for a node to request any single transactions we didn't send here -
+                // they must either disconnect and retry or request the full block.
+                // Thus, the protocol spec specified allows for us to provide duplicate txn here,
+                // however we MUST always provide at least what the remote peer needs
+                typedef std::pair<unsigned int, uint256> PairType;
+                for (PairType& pair : merkleBlock.vMatchedTxn)
+                    connman->PushMessage(pfrom, msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::TX, *pblock->vtx[pair.first]));
+            }
+            // else
+                // no response
+        }
+        else if (inv.type == MSG_CMPCT_BLOCK)
+        {
+            // If a peer is asking for old blocks, we're almost guaranteed
+            // they won't have a useful mempool to match against a compact block,
+            // and we don't feel like constructing the object for them, so
+            // instead we respond with the full, non-compact block.
+            int nSendFlags = fPeerWantsWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS;
+            if (fCompactAllowed) {
+                connman->PushMessage(pfrom, g_relay_msg_cache.Get(pindex->GetBlockHash(), NetMsgType::CMPCTBLOCK, nSendFlags, [&] {
                     if ((fPeerWantsWitness || !fWitnessesPresentInARecentCompactBlock) && a_recent_compact_block && a_recent_compact_block->header.GetHash() == pindex->GetBlockHash()) {
-                        connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, *a_recent_compact_block));
-                    } else {
-                        CBlockHeaderAndShortTxIDs cmpctblock(*pblock, fPeerWantsWitness);
-                        connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock));
+                        return msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, *a_recent_compact_block);
                     }
-                } else {
-                    connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::BLOCK, *pblock));
-                }
+                    CBlockHeaderAndShortTxIDs cmpctblock(*pblock, fPeerWantsWitness);
+                    return msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock);
+                }));
+            } else {
+                connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::BLOCK, *pblock));
             }
         }
+    }
 
-        // Trigger the peer node to send a getblocks request for the next batch of inventory
-        if (inv.hash == pfrom->hashContinue)
-        {
-            // Bypass PushInventory, this must send even if redundant,
-            // and we want it right after the last block so they don't
-            // wait for other stuff first.
-            std::vector<CInv> vInv;
-            vInv.push_back(CInv(MSG_BLOCK, chainActive.Tip()->GetBlockHash()));
-            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::INV, vInv));
-            pfrom->hashContinue.SetNull();
-        }
+    // Trigger the peer node to send a getblocks request for the next batch of inventory
+    if (inv.hash == pfrom->hashContinue)
+    {
+        // Bypass PushInventory, this must send even if redundant,
+        // and we want it right after the last block so they don't
+        // wait for other stuff first.
+        std::vector<CInv> vInv;
+        vInv.push_back(CInv(MSG_BLOCK, hashTip));
+        connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::INV, vInv));
+        pfrom->hashContinue.SetNull();
     }
 }
 
@@ -1285,14 +1395,14 @@ void static ProcessGetData(CNode* pfrom, const CChainParams& chainparams, CConnm
             auto mi = mapRelay.find(inv.hash);
             int nSendFlags = (inv.type == MSG_TX ? SERIALIZE_TRANSACTION_NO_WITNESS : 0);
             if (mi != mapRelay.end()) {
-                connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::TX, *mi->second));
+                connman->PushMessage(pfrom, GetTxMessage(msgMaker, nSendFlags, mi->second));
                 push = true;
             } else if (pfrom->timeLastMempoolReq) {
                 auto txinfo = mempool.info(inv.hash);
                 // To protect privacy, do not answer getdata using the mempool when
                 // that TX couldn't have been INVed in reply to a MEMPOOL request.
                 if (txinfo.tx && txinfo.nTime <= pfrom->timeLastMempoolReq) {
-                    connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::TX, *txinfo.tx));
+                    connman->PushMessage(pfrom, GetTxMessage(msgMaker, nSendFlags, txinfo.tx));
                     push = true;
                 }
             }
@@ -1835,6 +1945,21 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
             nCMPCTBLOCKVersion = 1;
             connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::SENDCMPCT, fAnnounceUsingCMPCTBLOCK, nCMPCTBLOCKVersion));
         }
+        if (fRelayTxes && gArgs.GetBoolArg("-txreconciliation", DEFAULT_TXRECONCILIATION)) {
+            // Offer to reconcile the transactions we announce to each other,
+            // unless the peer asked not to get any
+            bool fPeerRelay;
+            {
+                LOCK(pfrom->cs_filter);
+                fPeerRelay = pfrom->fRelayTxes;
+            }
+            if (fPeerRelay) {
+                LOCK(pfrom->cs_inventory);
+                pfrom->m_recon_offered = true;
+                pfrom->m_recon_salt = GetRand(std::numeric_limits<uint64_t>::max());
+                connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::SENDRECON, TXRECON_VERSION, pfrom->m_recon_salt));
+            }
+        }
         pfrom->fSuccessfullyConnected = true;
         return true;
     }
@@ -1925,6 +2050,121 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         return true;
     }
 
+    if (strCommand == NetMsgType::SENDRECON) {
+        uint32_t nReconVersion = 0;
+        uint64_t nRemoteSalt = 0;
+        vRecv >> nReconVersion >> nRemoteSalt;
+        bool fStarted = false;
+        {
+            LOCK(pfrom->cs_inventory);
+            // Both sides offered it, the outbound one initiates the rounds
+            if (pfrom->m_recon_offered && !pfrom->m_recon && nReconVersion >= TXRECON_VERSION) {
+                pfrom->m_recon.reset(new TxReconciliationState(!pfrom->fInbound, pfrom->m_recon_salt, nRemoteSalt));
+                fStarted = true;
+            }
+        }
+        if (fStarted) {
+            LogPrint(BCLog::NET, "reconciling transactions with peer=%d\n", pfrom->GetId());
+            if (!pfrom->fInbound) {
+                LOCK(cs_main);
+                State(pfrom->GetId())->m_recon_outbound = true;
+                g_outbound_peers_with_recon++;
+            }
+        }
+        return true;
+    }
+
+    if (strCommand == NetMsgType::REQRECON) {
+        uint16_t nRemoteSetSize = 0;
+        uint16_t nRemoteQ = 0;
+        vRecv >> nRemoteSetSize >> nRemoteQ;
+        std::vector<uint256> vAbandoned;
+        TxReconSketch sketch;
+        {
+            LOCK(pfrom->cs_inventory);
+            if (!pfrom->m_recon || pfrom->m_recon->m_initiator) {
+                LogPrint(BCLog::NET, "unexpected reqrecon from peer=%d\n", pfrom->GetId());
+                return true;
+            }
+            TxReconciliationState& recon = *pfrom->m_recon;
+            // A new request ends a round the peer gave up on
+            if (recon.m_round_active) vAbandoned = recon.EndRound();
+            recon.StartRound();
+            if (recon.m_round_set.empty()) {
+                // The empty sketch tells the peer there is nothing to reconcile
+                recon.EndRound();
+            } else {
+                const size_t nDifference = std::min(MAX_RECON_DIFFERENCE, EstimateReconDifference(recon.m_round_set.size(), nRemoteSetSize, double(nRemoteQ) / RECON_Q_PRECISION));
+                sketch = recon.SketchRound(TxReconSketch::CellsForDifference(nDifference));
+            }
+        }
+        AnnounceTxs(pfrom, vAbandoned, connman);
+        connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::SKETCH, sketch));
+        return true;
+    }
+
+    if (strCommand == NetMsgType::SKETCH) {
+        TxReconSketch sketch;
+        vRecv >> sketch;
+        if (!sketch.IsValid() || sketch.Cells() > TxReconSketch::CellsForDifference(MAX_RECON_DIFFERENCE)) {
+            LOCK(cs_main);
+            Misbehaving(pfrom->GetId(), 20, strprintf("sketch of %u cells", sketch.Cells()));
+            return false;
+        }
+        std::vector<uint256> vAnnounce;
+        {
+            LOCK(pfrom->cs_inventory);
+            if (!pfrom->m_recon || !pfrom->m_recon->m_initiator || !pfrom->m_recon->m_round_active) {
+                LogPrint(BCLog::NET, "unexpected sketch from peer=%d\n", pfrom->GetId());
+                return true;
+            }
+            TxReconciliationState& recon = *pfrom->m_recon;
+            recon.m_request_time = PoissonNextSend(GetTimeMicros(), RECON_REQUEST_INTERVAL);
+            if (sketch.Cells() == 0) {
+                // The peer has nothing to reconcile and lacks everything we have
+                vAnnounce = recon.EndRound();
+            } else {
+                TxReconSketch difference = recon.SketchRound(sketch.Cells());
+                difference.Merge(sketch);
+                std::vector<uint32_t> vMissing;
+                if (difference.Decode(vMissing)) {
+                    // Ours are the ones we announce, the others are the ones we ask for
+                    const size_t nLocalSize = recon.m_round_set.size();
+                    const size_t nDifference = vMissing.size();
+                    vAnnounce = recon.EndRound(vMissing);
+                    const size_t nRemoteSize = nLocalSize - vAnnounce.size() + vMissing.size();
+                    recon.m_q = EstimateReconQ(nDifference, nLocalSize, nRemoteSize);
+                    connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::RECONCILDIFF, true, vMissing));
+                } else {
+                    // Fall back to announcing the whole round, and expect a larger difference next time
+                    LogPrint(BCLog::NET, "failed to decode sketch of %u cells from peer=%d\n", sketch.Cells(), pfrom->GetId());
+                    recon.m_q = std::min(2.0, recon.m_q + DEFAULT_RECON_Q);
+                    vAnnounce = recon.EndRound();
+                    connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::RECONCILDIFF, false, std::vector<uint32_t>()));
+                }
+            }
+        }
+        AnnounceTxs(pfrom, vAnnounce, connman);
+        return true;
+    }
+
+    if (strCommand == NetMsgType::RECONCILDIFF) {
+        bool fDecoded = false;
+        std::vector<uint32_t> vMissing;
+        vRecv >> fDecoded >> vMissing;
+        std::vector<uint256> vAnnounce;
+        {
+            LOCK(pfrom->cs_inventory);
+            if (!pfrom->m_recon || pfrom->m_recon->m_initiator || !pfrom->m_recon->m_round_active) {
+                LogPrint(BCLog::NET, "unexpected reconcildiff from peer=%d\n", pfrom->GetId());
+                return true;
+            }
+            vAnnounce = fDecoded ? pfrom->m_recon->EndRound(vMissing) : pfrom->m_recon->EndRound();
+        }
+        AnnounceTxs(pfrom, vAnnounce, connman);
+        return true;
+    }
+
     if (strCommand == NetMsgType::INV) {
         std::vector<CInv> vInv;
         vRecv >> vInv;
@@ -1972,6 +2212,11 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
             else
             {
                 pfrom->AddInventoryKnown(inv);
+                {
+                    // The peer has it, so it needs no reconciling
+                    LOCK(pfrom->cs_inventory);
+                    if (pfrom->m_recon) pfrom->m_recon->m_local_set.erase(inv.hash);
+                }
                 if (fBlocksOnly) {
                     LogPrint(BCLog::NET, "transaction (%s) inv sent in violation of protocol peer=%d\n", inv.hash.ToString(), pfrom->GetId());
                 } else if (!fAlreadyHave && !fImporting && !fReindex && !IsInitialBlockDownload()) {
@@ -2743,7 +2988,10 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         }
         pfrom->fSentAddr = true;
 
-        pfrom->vAddrToSend.clear();
+        {
+            LOCK(pfrom->cs_vAddrToSend);
+            pfrom->vAddrToSend.clear();
+        }
         std::vector<CAddress> vAddr = connman->GetAddresses();
         FastRandomContext insecure_rand;
         for (const CAddress &addr : vAddr)
@@ -2984,6 +3232,7 @@ bool PeerLogicValidation::ProcessMessages(CNode* pfrom, std::atomic<bool>& inter
         return false;
 
     std::list<CNetMessage> msgs;
+    bool fUnpausedRecv;
     {
         LOCK(pfrom->cs_vProcessMsg);
         if (pfrom->vProcessMsg.empty())
@@ -2991,9 +3240,13 @@ bool PeerLogicValidation::ProcessMessages(CNode* pfrom, std::atomic<bool>& inter
         // Just take one message
         msgs.splice(msgs.begin(), pfrom->vProcessMsg, pfrom->vProcessMsg.begin());
         pfrom->nProcessQueueSize -= msgs.front().vRecv.size() + CMessageHeader::HEADER_SIZE;
+        fUnpausedRecv = pfrom->fPauseRecv && pfrom->nProcessQueueSize <= connman->GetReceiveFloodSize();
         pfrom->fPauseRecv = pfrom->nProcessQueueSize > connman->GetReceiveFloodSize();
         fMoreWork = !pfrom->vProcessMsg.empty();
     }
+    // The socket handler may be waiting for this to read on.
+    if (fUnpausedRecv)
+        connman->WakeSocketHandler();
     CNetMessage& msg(msgs.front());
 
     msg.SetVersion(pfrom->GetRecvVersion());
@@ -3290,6 +3543,7 @@ bool PeerLogicValidation::SendMessages(CNode* pto)
         // Message: addr
         //
         if (pto->nNextAddrSend < nNow) {
+            LOCK(pto->cs_vAddrToSend);
             pto->nNextAddrSend = PoissonNextSend(nNow, AVG_ADDRESS_BROADCAST_INTERVAL);
             std::vector<CAddress> vAddr;
             vAddr.reserve(pto->vAddrToSend.size());
@@ -3556,8 +3810,9 @@ bool PeerLogicValidation::SendMessages(CNode* pto)
                 pto->timeLastMempoolReq = GetTime();
             }
 
-            // Determine transactions to relay
-            if (fSendTrickle) {
+            // Determine transactions to relay. The ones to reconcile are taken
+            // right away, so that both sides have them in the same round.
+            if (fSendTrickle || pto->m_recon) {
                 // Produce a vector with all candidates for sending
                 std::vector<std::set<uint256>::iterator> vInvTx;
                 vInvTx.reserve(pto->setInventoryTxToSend.size());
@@ -3583,6 +3838,10 @@ bool PeerLogicValidation::SendMessages(CNode* pto)
                     std::set<uint256>::iterator it = vInvTx.back();
                     vInvTx.pop_back();
                     uint256 hash = *it;
+                    const bool fReconcile = pto->m_recon && !FloodToReconPeer(pto, hash, connman) && pto->m_recon->m_local_set.size() < MAX_RECON_SET_SIZE;
+                    if (!fReconcile && !fSendTrickle) {
+                        continue;
+                    }
                     // Remove it from the to-be-sent set
                     pto->setInventoryTxToSend.erase(it);
                     // Check if not in the filter already
@@ -3598,8 +3857,12 @@ bool PeerLogicValidation::SendMessages(CNode* pto)
                         continue;
                     }
                     if (pto->pfilter && !pto->pfilter->IsRelevantAndUpdate(*txinfo.tx)) continue;
-                    // Send
-                    vInv.push_back(CInv(MSG_TX, hash));
+                    // Send, or leave it to the next reconciliation with the peer
+                    if (fReconcile) {
+                        pto->m_recon->m_local_set.insert(hash);
+                    } else {
+                        vInv.push_back(CInv(MSG_TX, hash));
+                    }
                     nRelayedTransactions++;
                     {
                         // Expire old relay messages
@@ -3621,6 +3884,28 @@ bool PeerLogicValidation::SendMessages(CNode* pto)
                     pto->filterInventoryKnown.insert(hash);
                 }
             }
+
+            // Reconcile the transactions we have for the peer with the ones it has for us
+            if (pto->m_recon && pto->m_recon->m_initiator) {
+                TxReconciliationState& recon = *pto->m_recon;
+                if (recon.m_round_active && recon.m_request_time + RECON_RESPONSE_TIMEOUT * 1000000 < nNow) {
+                    LogPrint(BCLog::NET, "reconciliation timed out, peer=%d\n", pto->GetId());
+                    for (const uint256& hash : recon.EndRound()) {
+                        vInv.push_back(CInv(MSG_TX, hash));
+                        if (vInv.size() == MAX_INV_SZ) {
+                            connman->PushMessage(pto, msgMaker.Make(NetMsgType::INV, vInv));
+                            vInv.clear();
+                        }
+                    }
+                    recon.m_request_time = PoissonNextSend(nNow, RECON_REQUEST_INTERVAL);
+                } else if (!recon.m_round_active && recon.m_request_time < nNow) {
+                    recon.StartRound();
+                    const uint16_t nSetSize = recon.m_round_set.size();
+                    const uint16_t nQ = recon.m_q * RECON_Q_PRECISION;
+                    connman->PushMessage(pto, msgMaker.Make(NetMsgType::REQRECON, nSetSize, nQ));
+                    recon.m_request_time = nNow;
+                }
+            }
         }
         if (!vInv.empty())
             connman->PushMessage(pto, msgMaker.Make(NetMsgType::INV, vInv));
@@ -19,6 +19,10 @@ static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
 static const unsigned int DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN = 100;
 /** Default for BIP61 (sending reject messages) */
 static constexpr bool DEFAULT_ENABLE_BIP61{false};
+/** Default for -txreconciliation */
+static const bool DEFAULT_TXRECONCILIATION = false;
+/** Memory limit of the cache of framed messages for relayed blocks and transactions */
+static const size_t RELAY_MSG_CACHE_SIZE = 32 * 1024 * 1024;
 
 class PeerLogicValidation final : public CValidationInterface, public NetEventsInterface {
 private:
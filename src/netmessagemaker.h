@@ -19,7 +19,7 @@ public:
     {
         CSerializedNetMsg msg;
         msg.command = std::move(sCommand);
-        CVectorWriter{ SER_NETWORK, nFlags | nVersion, msg.data, 0, std::forward<Args>(args)... };
+        CVectorWriter{ SER_NETWORK, nFlags | nVersion, msg.data, CMessageHeader::HEADER_SIZE, std::forward<Args>(args)... };
         return msg;
     }
 
@@ -0,0 +1,67 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <netmsgcache.h>
+
+#include <memusage.h>
+
+NetMsgCache::NetMsgCache(size_t max_bytes) : m_max_bytes(max_bytes) {}
+
+size_t NetMsgCache::EntryBytes(const CFramedNetMsg& msg)
+{
+    // The message itself, its list node and its index entry
+    return memusage::DynamicUsage(msg.data) + sizeof(CFramedNetMsg) + 2 * (sizeof(Key) + 4 * sizeof(void*));
+}
+
+CFramedNetMsgRef NetMsgCache::Find(const uint256& hash, const std::string& command, int flags)
+{
+    LOCK(m_mutex);
+    auto it = m_index.find(Key{hash, command, flags});
+    if (it == m_index.end()) return nullptr;
+    m_list.splice(m_list.begin(), m_list, it->second);
+    return it->second->second;
+}
+
+void NetMsgCache::Insert(const uint256& hash, int flags, const CFramedNetMsgRef& msg)
+{
+    const size_t bytes = EntryBytes(*msg);
+    if (bytes > m_max_bytes) return;
+
+    LOCK(m_mutex);
+    Key key{hash, msg->command, flags};
+    auto it = m_index.find(key);
+    if (it != m_index.end()) {
+        m_bytes -= EntryBytes(*it->second->second);
+        m_list.erase(it->second);
+        m_index.erase(it);
+    }
+    while (!m_list.empty() && m_bytes + bytes > m_max_bytes) {
+        m_bytes -= EntryBytes(*m_list.back().second);
+        m_index.erase(m_list.back().first);
+        m_list.pop_back();
+    }
+    m_list.emplace_front(key, msg);
+    m_index.emplace(std::move(key), m_list.begin());
+    m_bytes += bytes;
+}
+
+void NetMsgCache::Clear()
+{
+    LOCK(m_mutex);
+    m_index.clear();
+    m_list.clear();
+    m_bytes = 0;
+}
+
+size_t NetMsgCache::size() const
+{
+    LOCK(m_mutex);
+    return m_list.size();
+}
+
+size_t NetMsgCache::Bytes() const
+{
+    LOCK(m_mutex);
+    return m_bytes;
+}
@@ -0,0 +1,81 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_NETMSGCACHE_H
+#define BITCOIN_NETMSGCACHE_H
+
+#include <net.h>
+#include <sync.h>
+#include <uint256.h>
+
+#include <list>
+#include <map>
+#include <string>
+
+/** Bounded cache of framed messages, ready to be pushed to any peer.
+ *
+ * Entries are keyed by the hash of the block or transaction a message
+ * carries, the message command and the serialization flags it was made
+ * with. The payloads cached here only depend on those flags, not on the
+ * protocol version of the peer. When the cached messages take more than the
+ * configured number of bytes, the least recently used ones are dropped.
+ */
+class NetMsgCache
+{
+public:
+    explicit NetMsgCache(size_t max_bytes);
+
+    /** Get the cached message, or nullptr. */
+    CFramedNetMsgRef Find(const uint256& hash, const std::string& command, int flags);
+
+    /** Add msg, replacing a message cached under the same key. */
+    void Insert(const uint256& hash, int flags, const CFramedNetMsgRef& msg);
+
+    /** Get the cached message, or frame and cache the one make() returns.
+     *  make() is called without the cache locked. */
+    template <typename Make>
+    CFramedNetMsgRef Get(const uint256& hash, const std::string& command, int flags, Make make)
+    {
+        CFramedNetMsgRef msg = Find(hash, command, flags);
+        if (!msg) {
+            msg = CConnman::FrameMessage(make());
+            Insert(hash, flags, msg);
+        }
+        return msg;
+    }
+
+    void Clear();
+
+    //! Number of cached messages.
+    size_t size() const;
+    //! Bytes used by the cached messages.
+    size_t Bytes() const;
+
+private:
+    struct Key {
+        uint256 hash;
+        std::string command;
+        int flags;
+
+        bool operator<(const Key& other) const
+        {
+            if (hash != other.hash) return hash < other.hash;
+            if (flags != other.flags) return flags < other.flags;
+            return command < other.command;
+        }
+    };
+    typedef std::list<std::pair<Key, CFramedNetMsgRef>> List;
+
+    static size_t EntryBytes(const CFramedNetMsg& msg);
+
+    const size_t m_max_bytes;
+
+    mutable Mutex m_mutex;
+    //! Most recently used first
+    List m_list GUARDED_BY(m_mutex);
+    std::map<Key, List::iterator> m_index GUARDED_BY(m_mutex);
+    size_t m_bytes GUARDED_BY(m_mutex) = 0;
+};
+
+#endif // BITCOIN_NETMSGCACHE_H
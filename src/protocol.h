@@ -238,6 +238,31 @@ extern const char *GETBLOCKTXN;
  * @since protocol version 70014 as described by BIP 152
  */
 extern const char *BLOCKTXN;
+/**
+ * Contains a 4-byte LE version number and an 8-byte LE salt.
+ * Indicates that a node with -txreconciliation is willing to announce
+ * transactions by reconciling them. Reconciliation is used with a peer once
+ * both sides have sent it.
+ */
+extern const char *SENDRECON;
+/**
+ * Contains the 2-byte LE size of the set of transactions to reconcile and
+ * the 2-byte LE q coefficient to estimate the set difference with.
+ * Sent by the outbound side to start a reconciliation round, the peer
+ * should respond with a "sketch" message.
+ */
+extern const char *REQRECON;
+/**
+ * Contains a TxReconSketch of the short ids of the peer's transactions to
+ * reconcile. An empty sketch means the peer has nothing to reconcile.
+ */
+extern const char *SKETCH;
+/**
+ * Contains a 1-byte bool telling whether the sketch decoded and a vector of
+ * the 4-byte short ids of the transactions the sender lacks. The peer should
+ * announce those by inv, or all of the round if the sketch did not decode.
+ */
+extern const char *RECONCILDIFF;
 };
 
 /* Get a vector of all valid message types (see above) */
@@ -3,15 +3,84 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#if defined(HAVE_CONFIG_H)
+#include <config/bitcoin-config.h>
+#endif
+
 #include <pubkey.h>
 
+#include <crypto/common.h>
+
 #include <secp256k1.h>
 #include <secp256k1_recovery.h>
 
+#include <memory>
+
 namespace
 {
 /* Global secp256k1_context object used for verification. */
 secp256k1_context* secp256k1_context_verify = nullptr;
+
+/** Small direct-mapped cache of parsed public keys.
+ *
+ * Parsing a compressed public key computes a field square root, which is a
+ * noticeable part of the cost of a signature verification. Outputs to the
+ * same key are often spent together, e.g. within one block, so every thread
+ * that verifies signatures keeps the keys it parsed last. Being per thread,
+ * the cache needs no locking; the verification context itself is never
+ * modified and is shared.
+ */
+class ParsedPubKeyCache
+{
+private:
+    static const size_t SIZE = 256;
+
+    struct Entry {
+        unsigned int size = 0;
+        unsigned char vch[CPubKey::PUBLIC_KEY_SIZE];
+        secp256k1_pubkey pubkey;
+    };
+
+    Entry entries[SIZE];
+
+public:
+    //! Parse a valid-looking serialized public key, which is at least 33 bytes long.
+    bool Parse(const unsigned char* vch, unsigned int size, secp256k1_pubkey& pubkey)
+    {
+        // The bytes after the header are (part of) the X coordinate, which is
+        // random enough to select an entry.
+        Entry& entry = entries[ReadLE32(vch + 1) % SIZE];
+        if (entry.size == size && memcmp(entry.vch, vch, size) == 0) {
+            pubkey = entry.pubkey;
+            return true;
+        }
+        if (!secp256k1_ec_pubkey_parse(secp256k1_context_verify, &pubkey, vch, size)) {
+            return false;
+        }
+        entry.size = size;
+        memcpy(entry.vch, vch, size);
+        entry.pubkey = pubkey;
+        return true;
+    }
+};
+
+#ifdef HAVE_THREAD_LOCAL
+//! Allocated on first use, so threads that never verify do not pay for it.
+thread_local std::unique_ptr<ParsedPubKeyCache> g_parsed_pubkeys;
+#endif
+
+bool ParsePubKey(const unsigned char* vch, unsigned int size, secp256k1_pubkey& pubkey)
+{
+#ifdef HAVE_THREAD_LOCAL
+    if (!g_parsed_pubkeys) {
+        g_parsed_pubkeys.reset(new ParsedPubKeyCache());
+    }
+    return g_parsed_pubkeys->Parse(vch, size, pubkey);
+#else
+    // Without thread_local, there is no cache to share safely.
+    return secp256k1_ec_pubkey_parse(secp256k1_context_verify, &pubkey, vch, size);
+#endif
+}
 } // namespace
 
 /** This function is taken from the libsecp256k1 distribution and implements
@@ -171,7 +240,7 @@ bool CPubKey::Verify(const uint256 &hash, const std::vector<unsigned char>& vchS
         return false;
     secp256k1_pubkey pubkey;
     secp256k1_ecdsa_signature sig;
-    if (!secp256k1_ec_pubkey_parse(secp256k1_context_verify, &pubkey, vch, size())) {
+    if (!ParsePubKey(vch, size(), pubkey)) {
         return false;
     }
     if (!ecdsa_signature_parse_der_lax(secp256k1_context_verify, &sig, vchSig.data(), vchSig.size())) {
@@ -12,6 +12,7 @@
 #include <validation.h>
 #include <httpserver.h>
 #include <rpc/blockchain.h>
+#include <rpc/jsonstream.h>
 #include <rpc/server.h>
 #include <streams.h>
 #include <sync.h>
@@ -205,7 +206,11 @@ static bool rest_block(HTTPRequest* req,
         return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
 
     CBlock block;
+    CRawBlock raw_block;
     CBlockIndex* pblockindex = nullptr;
+    // Blocks are stored on disk in the serialization with witness data, so
+    // binary and hex replies in that format are served without decoding.
+    const bool fRaw = (rf == RetFormat::BINARY || rf == RetFormat::HEX) && RPCSerializationFlags() == 0;
     {
         LOCK(cs_main);
         pblockindex = LookupBlockIndex(hash);
@@ -216,38 +221,56 @@ static bool rest_block(HTTPRequest* req,
         if (IsBlockPruned(pblockindex))
             return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not available (pruned data)");
 
-        if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
+        if (fRaw) {
+            if (!ReadRawBlockFromDisk(raw_block, pblockindex, Params().MessageStart()))
+                return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+        } else if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus())) {
             return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+        }
     }
 
     switch (rf) {
     case RetFormat::BINARY: {
+        req->WriteHeader("Content-Type", "application/octet-stream");
+        if (fRaw) {
+            // Send the block straight from the mapped block file, or from the
+            // buffer it was read into (moving the buffer keeps its data).
+            std::shared_ptr<const void> owner = raw_block.file;
+            if (!owner) owner = std::make_shared<std::vector<uint8_t>>(std::move(raw_block.buffer));
+            req->WriteReply(HTTP_OK, raw_block.data, std::move(owner));
+            return true;
+        }
         CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
         ssBlock << block;
-        std::string binaryBlock = ssBlock.str();
-        req->WriteHeader("Content-Type", "application/octet-stream");
-        req->WriteReply(HTTP_OK, binaryBlock);
+        req->WriteReply(HTTP_OK, ssBlock.str());
         return true;
     }
 
     case RetFormat::HEX: {
-        CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
-        ssBlock << block;
-        std::string strHex = HexStr(ssBlock.begin(), ssBlock.end()) + "\n";
+        std::string strHex;
+        if (fRaw) {
+            strHex = HexStr(raw_block.data.begin(), raw_block.data.end()) + "\n";
+        } else {
+            CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
+            ssBlock << block;
+            strHex = HexStr(ssBlock.begin(), ssBlock.end()) + "\n";
+        }
         req->WriteHeader("Content-Type", "text/plain");
         req->WriteReply(HTTP_OK, strHex);
         return true;
     }
 
     case RetFormat::JSON: {
-        UniValue objBlock;
+        req->WriteHeader("Content-Type", "application/json");
+        req->StartReply(HTTP_OK);
+        JSONStreamWriter writer([req](const std::string& chunk) { req->WriteReplyChunk(chunk); });
         {
             LOCK(cs_main);
-            objBlock = blockToJSON(block, pblockindex, showTxDetails);
+            blockToJSON(writer, block, pblockindex, showTxDetails);
         }
-        std::string strJSON = objBlock.write() + "\n";
-        req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strJSON);
+        writer.Flush();
+        req->WriteReplyChunk("\n");
+        req->EndReply();
         return true;
     }
 
@@ -324,11 +347,13 @@ static bool rest_mempool_contents(HTTPRequest* req, const std::string& strURIPar
 
     switch (rf) {
     case RetFormat::JSON: {
-        UniValue mempoolObject = mempoolToJSON(true);
-
-        std::string strJSON = mempoolObject.write() + "\n";
         req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strJSON);
+        req->StartReply(HTTP_OK);
+        JSONStreamWriter writer([req](const std::string& chunk) { req->WriteReplyChunk(chunk); });
+        mempoolToJSON(writer);
+        writer.Flush();
+        req->WriteReplyChunk("\n");
+        req->EndReply();
         return true;
     }
     default: {
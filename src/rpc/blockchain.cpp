@@ -18,8 +18,8 @@
 #include <key_io.h>
 #include <policy/feerate.h>
 #include <policy/policy.h>
-#include <policy/rbf.h>
 #include <primitives/transaction.h>
+#include <rpc/jsonstream.h>
 #include <rpc/server.h>
 #include <script/descriptor.h>
 #include <streams.h>
@@ -112,10 +112,9 @@ UniValue blockheaderToJSON(const CBlockIndex* blockindex)
     return result;
 }
 
-UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails)
+/** The members of the block description before "tx" */
+static void blockHeadToJSON(UniValue& result, const CBlock& block, const CBlockIndex* blockindex)
 {
-    AssertLockHeld(cs_main);
-    UniValue result(UniValue::VOBJ);
     result.pushKV("hash", blockindex->GetBlockHash().GetHex());
     int confirmations = -1;
     // Only report confirmations if the block is on the main chain
@@ -129,19 +128,11 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
     result.pushKV("version", block.nVersion);
     result.pushKV("versionHex", strprintf("%08x", block.nVersion));
     result.pushKV("merkleroot", block.hashMerkleRoot.GetHex());
-    UniValue txs(UniValue::VARR);
-    for(const auto& tx : block.vtx)
-    {
-        if(txDetails)
-        {
-            UniValue objTx(UniValue::VOBJ);
-            TxToUniv(*tx, uint256(), objTx, true, RPCSerializationFlags());
-            txs.push_back(objTx);
-        }
-        else
-            txs.push_back(tx->GetHash().GetHex());
-    }
-    result.pushKV("tx", txs);
+}
+
+/** The members of the block description after "tx" */
+static void blockTailToJSON(UniValue& result, const CBlock& block, const CBlockIndex* blockindex)
+{
     result.pushKV("time", block.GetBlockTime());
     result.pushKV("mediantime", (int64_t)blockindex->GetMedianTimePast());
     result.pushKV("nonce", (uint64_t)block.nNonce);
@@ -155,9 +146,49 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
     CBlockIndex *pnext = chainActive.Next(blockindex);
     if (pnext)
         result.pushKV("nextblockhash", pnext->GetBlockHash().GetHex());
+}
+
+static UniValue blockTxToJSON(const CTransaction& tx, bool txDetails)
+{
+    if (!txDetails)
+        return tx.GetHash().GetHex();
+    UniValue objTx(UniValue::VOBJ);
+    TxToUniv(tx, uint256(), objTx, true, RPCSerializationFlags());
+    return objTx;
+}
+
+UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails)
+{
+    AssertLockHeld(cs_main);
+    UniValue result(UniValue::VOBJ);
+    blockHeadToJSON(result, block, blockindex);
+    UniValue txs(UniValue::VARR);
+    for(const auto& tx : block.vtx)
+        txs.push_back(blockTxToJSON(*tx, txDetails));
+    result.pushKV("tx", txs);
+    blockTailToJSON(result, block, blockindex);
     return result;
 }
 
+void blockToJSON(JSONStreamWriter& writer, const CBlock& block, const CBlockIndex* blockindex, bool txDetails)
+{
+    AssertLockHeld(cs_main);
+    UniValue head(UniValue::VOBJ);
+    blockHeadToJSON(head, block, blockindex);
+    UniValue tail(UniValue::VOBJ);
+    blockTailToJSON(tail, block, blockindex);
+
+    writer.BeginObject();
+    writer.Members(head);
+    writer.Key("tx");
+    writer.BeginArray();
+    for (const auto& tx : block.vtx)
+        writer.Value(blockTxToJSON(*tx, txDetails));
+    writer.EndArray();
+    writer.Members(tail);
+    writer.EndObject();
+}
+
 static UniValue getblockcount(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 0)
@@ -385,35 +416,31 @@ static std::string EntryDescriptionString()
            "    \"bip125-replaceable\" : true|false,  (boolean) Whether this transaction could be replaced due to BIP125 (replace-by-fee)\n";
 }
 
-static void entryToJSON(UniValue &info, const CTxMemPoolEntry &e) EXCLUSIVE_LOCKS_REQUIRED(::mempool.cs)
+static void entryToJSON(UniValue &info, const MempoolSnapshot& snapshot, const MempoolSnapshot::Entry& e)
 {
-    AssertLockHeld(mempool.cs);
-
     UniValue fees(UniValue::VOBJ);
-    fees.pushKV("base", ValueFromAmount(e.GetFee()));
-    fees.pushKV("modified", ValueFromAmount(e.GetModifiedFee()));
-    fees.pushKV("ancestor", ValueFromAmount(e.GetModFeesWithAncestors()));
-    fees.pushKV("descendant", ValueFromAmount(e.GetModFeesWithDescendants()));
+    fees.pushKV("base", ValueFromAmount(e.fee));
+    fees.pushKV("modified", ValueFromAmount(e.modified_fee));
+    fees.pushKV("ancestor", ValueFromAmount(e.mod_fees_with_ancestors));
+    fees.pushKV("descendant", ValueFromAmount(e.mod_fees_with_descendants));
     info.pushKV("fees", fees);
 
-    info.pushKV("size", (int)e.GetTxSize());
-    info.pushKV("fee", ValueFromAmount(e.GetFee()));
-    info.pushKV("modifiedfee", ValueFromAmount(e.GetModifiedFee()));
-    info.pushKV("time", e.GetTime());
-    info.pushKV("height", (int)e.GetHeight());
-    info.pushKV("descendantcount", e.GetCountWithDescendants());
-    info.pushKV("descendantsize", e.GetSizeWithDescendants());
-    info.pushKV("descendantfees", e.GetModFeesWithDescendants());
-    info.pushKV("ancestorcount", e.GetCountWithAncestors());
-    info.pushKV("ancestorsize", e.GetSizeWithAncestors());
-    info.pushKV("ancestorfees", e.GetModFeesWithAncestors());
-    info.pushKV("wtxid", mempool.vTxHashes[e.vTxHashesIdx].first.ToString());
-    const CTransaction& tx = e.GetTx();
+    info.pushKV("size", (int)e.tx_size);
+    info.pushKV("fee", ValueFromAmount(e.fee));
+    info.pushKV("modifiedfee", ValueFromAmount(e.modified_fee));
+    info.pushKV("time", e.time);
+    info.pushKV("height", (int)e.height);
+    info.pushKV("descendantcount", e.count_with_descendants);
+    info.pushKV("descendantsize", e.size_with_descendants);
+    info.pushKV("descendantfees", e.mod_fees_with_descendants);
+    info.pushKV("ancestorcount", e.count_with_ancestors);
+    info.pushKV("ancestorsize", e.size_with_ancestors);
+    info.pushKV("ancestorfees", e.mod_fees_with_ancestors);
+    info.pushKV("wtxid", e.wtxid.ToString());
     std::set<std::string> setDepends;
-    for (const CTxIn& txin : tx.vin)
+    for (size_t parent : e.parents)
     {
-        if (mempool.exists(txin.prevout.hash))
-            setDepends.insert(txin.prevout.hash.ToString());
+        setDepends.insert(snapshot.Entries()[parent].txid.ToString());
     }
 
     UniValue depends(UniValue::VARR);
@@ -425,54 +452,79 @@ static void entryToJSON(UniValue &info, const CTxMemPoolEntry &e) EXCLUSIVE_LOCK
     info.pushKV("depends", depends);
 
     UniValue spent(UniValue::VARR);
-    const CTxMemPool::txiter &it = mempool.mapTx.find(tx.GetHash());
-    const CTxMemPool::setEntries &setChildren = mempool.GetMemPoolChildren(it);
-    for (CTxMemPool::txiter childiter : setChildren) {
-        spent.push_back(childiter->GetTx().GetHash().ToString());
+    for (size_t child : e.children) {
+        spent.push_back(snapshot.Entries()[child].txid.ToString());
     }
 
     info.pushKV("spentby", spent);
 
     // Add opt-in RBF status
-    bool rbfStatus = false;
-    RBFTransactionState rbfState = IsRBFOptIn(tx, mempool);
-    if (rbfState == RBFTransactionState::UNKNOWN) {
-        throw JSONRPCError(RPC_MISC_ERROR, "Transaction is not in mempool");
-    } else if (rbfState == RBFTransactionState::REPLACEABLE_BIP125) {
-        rbfStatus = true;
-    }
+    info.pushKV("bip125-replaceable", e.bip125_replaceable);
+}
 
-    info.pushKV("bip125-replaceable", rbfStatus);
+/** Entries at the given snapshot positions, ordered by txid, as an array of
+ *  txids or, if fVerbose, as an object mapping txids to entry details. */
+static UniValue entriesToJSON(const MempoolSnapshot& snapshot, const std::set<size_t>& set_positions, bool fVerbose)
+{
+    std::vector<size_t> positions(set_positions.begin(), set_positions.end());
+    std::sort(positions.begin(), positions.end(), [&snapshot](size_t a, size_t b) {
+        return snapshot.Entries()[a].txid < snapshot.Entries()[b].txid;
+    });
+    if (!fVerbose) {
+        UniValue o(UniValue::VARR);
+        for (size_t pos : positions) {
+            o.push_back(snapshot.Entries()[pos].txid.ToString());
+        }
+        return o;
+    }
+    UniValue o(UniValue::VOBJ);
+    for (size_t pos : positions) {
+        const MempoolSnapshot::Entry& e = snapshot.Entries()[pos];
+        UniValue info(UniValue::VOBJ);
+        entryToJSON(info, snapshot, e);
+        o.pushKV(e.txid.ToString(), info);
+    }
+    return o;
 }
 
 UniValue mempoolToJSON(bool fVerbose)
 {
+    const std::shared_ptr<const MempoolSnapshot> snapshot = mempool.GetSnapshot();
     if (fVerbose)
     {
-        LOCK(mempool.cs);
         UniValue o(UniValue::VOBJ);
-        for (const CTxMemPoolEntry& e : mempool.mapTx)
+        for (const MempoolSnapshot::Entry& e : snapshot->Entries())
         {
-            const uint256& hash = e.GetTx().GetHash();
             UniValue info(UniValue::VOBJ);
-            entryToJSON(info, e);
-            o.pushKV(hash.ToString(), info);
+            entryToJSON(info, *snapshot, e);
+            o.pushKV(e.txid.ToString(), info);
         }
         return o;
     }
     else
     {
-        std::vector<uint256> vtxid;
-        mempool.queryHashes(vtxid);
-
         UniValue a(UniValue::VARR);
-        for (const uint256& hash : vtxid)
-            a.push_back(hash.ToString());
+        for (const MempoolSnapshot::Entry& e : snapshot->Entries())
+            a.push_back(e.txid.ToString());
 
         return a;
     }
 }
 
+void mempoolToJSON(JSONStreamWriter& writer)
+{
+    const std::shared_ptr<const MempoolSnapshot> snapshot = mempool.GetSnapshot();
+    writer.BeginObject();
+    for (const MempoolSnapshot::Entry& e : snapshot->Entries())
+    {
+        UniValue info(UniValue::VOBJ);
+        entryToJSON(info, *snapshot, e);
+        writer.Key(e.txid.ToString());
+        writer.Value(info);
+    }
+    writer.EndObject();
+}
+
 static UniValue getrawmempool(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() > 1)
@@ -502,6 +554,10 @@ static UniValue getrawmempool(const JSONRPCRequest& request)
     if (!request.params[0].isNull())
         fVerbose = request.params[0].get_bool();
 
+    if (fVerbose && request.resultStream) {
+        mempoolToJSON(*request.resultStream);
+        return NullUniValue;
+    }
     return mempoolToJSON(fVerbose);
 }
 
@@ -537,36 +593,13 @@ static UniValue getmempoolancestors(const JSONRPCRequest& request)
 
     uint256 hash = ParseHashV(request.params[0], "parameter 1");
 
-    LOCK(mempool.cs);
-
-    CTxMemPool::txiter it = mempool.mapTx.find(hash);
-    if (it == mempool.mapTx.end()) {
+    const std::shared_ptr<const MempoolSnapshot> snapshot = mempool.GetSnapshot();
+    const size_t pos = snapshot->Find(hash);
+    if (pos == MempoolSnapshot::npos) {
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Transaction not in mempool");
     }
 
-    CTxMemPool::setEntries setAncestors;
-    uint64_t noLimit = std::numeric_limits<uint64_t>::max();
-    std::string dummy;
-    mempool.CalculateMemPoolAncestors(*it, setAncestors, noLimit, noLimit, noLimit, noLimit, dummy, false);
-
-    if (!fVerbose) {
-        UniValue o(UniValue::VARR);
-        for (CTxMemPool::txiter ancestorIt : setAncestors) {
-            o.push_back(ancestorIt->GetTx().GetHash().ToString());
-        }
-
-        return o;
-    } else {
-        UniValue o(UniValue::VOBJ);
-        for (CTxMemPool::txiter ancestorIt : setAncestors) {
-            const CTxMemPoolEntry &e = *ancestorIt;
-            const uint256& _hash = e.GetTx().GetHash();
-            UniValue info(UniValue::VOBJ);
-            entryToJSON(info, e);
-            o.pushKV(_hash.ToString(), info);
-        }
-        return o;
-    }
+    return entriesToJSON(*snapshot, snapshot->CalculateAncestors(pos), fVerbose);
 }
 
 static UniValue getmempooldescendants(const JSONRPCRequest& request)
@@ -601,36 +634,13 @@ static UniValue getmempooldescendants(const JSONRPCRequest& request)
 
     uint256 hash = ParseHashV(request.params[0], "parameter 1");
 
-    LOCK(mempool.cs);
-
-    CTxMemPool::txiter it = mempool.mapTx.find(hash);
-    if (it == mempool.mapTx.end()) {
+    const std::shared_ptr<const MempoolSnapshot> snapshot = mempool.GetSnapshot();
+    const size_t pos = snapshot->Find(hash);
+    if (pos == MempoolSnapshot::npos) {
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Transaction not in mempool");
     }
 
-    CTxMemPool::setEntries setDescendants;
-    mempool.CalculateDescendants(it, setDescendants);
-    // CTxMemPool::CalculateDescendants will include the given tx
-    setDescendants.erase(it);
-
-    if (!fVerbose) {
-        UniValue o(UniValue::VARR);
-        for (CTxMemPool::txiter descendantIt : setDescendants) {
-            o.push_back(descendantIt->GetTx().GetHash().ToString());
-        }
-
-        return o;
-    } else {
-        UniValue o(UniValue::VOBJ);
-        for (CTxMemPool::txiter descendantIt : setDescendants) {
-            const CTxMemPoolEntry &e = *descendantIt;
-            const uint256& _hash = e.GetTx().GetHash();
-            UniValue info(UniValue::VOBJ);
-            entryToJSON(info, e);
-            o.pushKV(_hash.ToString(), info);
-        }
-        return o;
-    }
+    return entriesToJSON(*snapshot, snapshot->CalculateDescendants(pos), fVerbose);
 }
 
 static UniValue getmempoolentry(const JSONRPCRequest& request)
@@ -653,16 +663,14 @@ static UniValue getmempoolentry(const JSONRPCRequest& request)
 
     uint256 hash = ParseHashV(request.params[0], "parameter 1");
 
-    LOCK(mempool.cs);
-
-    CTxMemPool::txiter it = mempool.mapTx.find(hash);
-    if (it == mempool.mapTx.end()) {
+    const std::shared_ptr<const MempoolSnapshot> snapshot = mempool.GetSnapshot();
+    const size_t pos = snapshot->Find(hash);
+    if (pos == MempoolSnapshot::npos) {
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Transaction not in mempool");
     }
 
-    const CTxMemPoolEntry &e = *it;
     UniValue info(UniValue::VOBJ);
-    entryToJSON(info, e);
+    entryToJSON(info, *snapshot, snapshot->Entries()[pos]);
     return info;
 }
 
@@ -847,6 +855,10 @@ static UniValue getblock(const JSONRPCRequest& request)
         return strHex;
     }
 
+    if (verbosity >= 2 && request.resultStream) {
+        blockToJSON(*request.resultStream, block, pblockindex, true);
+        return NullUniValue;
+    }
     return blockToJSON(block, pblockindex, verbosity >= 2);
 }
 
@@ -1211,6 +1223,16 @@ UniValue getblockchaininfo(const JSONRPCRequest& request)
             "  \"pruneheight\": xxxxxx,        (numeric) lowest-height complete block stored (only present if pruning is enabled)\n"
             "  \"automatic_pruning\": xx,      (boolean) whether automatic pruning is enabled (only present if pruning is enabled)\n"
             "  \"prune_target_size\": xxxxxx,  (numeric) the target size used by pruning (only present if automatic pruning is enabled)\n"
+            "  \"reindex\": {                  (object) progress of the running reindex (only present while reindexing)\n"
+            "     \"file\": xxxxxx,            (numeric) number of the block file being read\n"
+            "     \"blocks_read\": xxxxxx,     (numeric) blocks read from the block files so far\n"
+            "     \"bytes_read\": xxxxxx,      (numeric) serialized size of those blocks\n"
+            "     \"blocks_checked\": xxxxxx,  (numeric) blocks deserialized and checked\n"
+            "     \"blocks_loaded\": xxxxxx,   (numeric) blocks accepted into the block index\n"
+            "     \"elapsed\": xxxxxx,         (numeric) seconds since the reindex started\n"
+            "     \"blocks_per_second\": xxx,  (numeric) blocks read per second\n"
+            "     \"mib_per_second\": xxx      (numeric) MiB read per second\n"
+            "  },\n"
             "  \"softforks\": [                (array) status of softforks in progress\n"
             "     {\n"
             "        \"id\": \"xxxx\",           (string) name of softfork\n"
@@ -1273,6 +1295,19 @@ UniValue getblockchaininfo(const JSONRPCRequest& request)
             obj.pushKV("prune_target_size",  nPruneTarget);
         }
     }
+    ReindexProgress reindex = GetReindexProgress();
+    if (reindex.fActive) {
+        UniValue progress(UniValue::VOBJ);
+        progress.pushKV("file",              reindex.nFile);
+        progress.pushKV("blocks_read",       reindex.nBlocksRead);
+        progress.pushKV("bytes_read",        reindex.nBytesRead);
+        progress.pushKV("blocks_checked",    reindex.nBlocksChecked);
+        progress.pushKV("blocks_loaded",     reindex.nBlocksLoaded);
+        progress.pushKV("elapsed",           reindex.dElapsed);
+        progress.pushKV("blocks_per_second", reindex.dBlocksPerSecond);
+        progress.pushKV("mib_per_second",    reindex.dMiBPerSecond);
+        obj.pushKV("reindex", progress);
+    }
 
     const Consensus::Params& consensusParams = Params().GetConsensus();
     CBlockIndex* tip = chainActive.Tip();
@@ -1419,6 +1454,10 @@ UniValue mempoolInfoToJSON()
     ret.pushKV("maxmempool", (int64_t) maxmempool);
     ret.pushKV("mempoolminfee", ValueFromAmount(std::max(mempool.GetMinFee(maxmempool), ::minRelayTxFee).GetFeePerK()));
     ret.pushKV("minrelaytxfee", ValueFromAmount(::minRelayTxFee.GetFeePerK()));
+    const CTxMemPool::ArenaStats arena = mempool.GetArenaStats();
+    ret.pushKV("arenabytes", (int64_t) arena.chunk_bytes);
+    ret.pushKV("arenaused", (int64_t) arena.used_bytes);
+    ret.pushKV("fragmentation", arena.chunk_bytes ? 1.0 - (double) arena.used_bytes / arena.chunk_bytes : 0.0);
 
     return ret;
 }
@@ -1437,6 +1476,9 @@ static UniValue getmempoolinfo(const JSONRPCRequest& request)
             "  \"maxmempool\": xxxxx,         (numeric) Maximum memory usage for the mempool\n"
             "  \"mempoolminfee\": xxxxx       (numeric) Minimum fee rate in " + CURRENCY_UNIT + "/kB for tx to be accepted. Is the maximum of minrelaytxfee and minimum mempool fee\n"
             "  \"minrelaytxfee\": xxxxx       (numeric) Current minimum relay fee for transactions\n"
+            "  \"arenabytes\": xxxxx          (numeric) Memory held by the arena that mempool index nodes are allocated from\n"
+            "  \"arenaused\": xxxxx           (numeric) Part of arenabytes used by live index nodes\n"
+            "  \"fragmentation\": x.xxx       (numeric) Fraction of arenabytes that is free, and only reusable by later mempool entries\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getmempoolinfo", "")
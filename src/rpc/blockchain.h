@@ -11,6 +11,7 @@
 
 class CBlock;
 class CBlockIndex;
+class JSONStreamWriter;
 class UniValue;
 
 static constexpr int NUM_GETBLOCKSTATS_PERCENTILES = 5;
@@ -28,12 +29,16 @@ void RPCNotifyBlockChange(bool ibd, const CBlockIndex *);
 
 /** Block description to JSON */
 UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false);
+/** Block description to JSON, written as it is being produced */
+void blockToJSON(JSONStreamWriter& writer, const CBlock& block, const CBlockIndex* blockindex, bool txDetails);
 
 /** Mempool information to JSON */
 UniValue mempoolInfoToJSON();
 
 /** Mempool to JSON */
 UniValue mempoolToJSON(bool fVerbose = false);
+/** Verbose mempool to JSON, written as it is being produced */
+void mempoolToJSON(JSONStreamWriter& writer);
 
 /** Block header to JSON */
 UniValue blockheaderToJSON(const CBlockIndex* blockindex);
@@ -0,0 +1,89 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <rpc/jsonstream.h>
+
+#include <assert.h>
+
+JSONStreamWriter::JSONStreamWriter(Sink sink, size_t flush_size)
+    : m_sink(std::move(sink)), m_flush_size(flush_size), m_after_key(false)
+{
+}
+
+void JSONStreamWriter::Separate()
+{
+    if (m_after_key) {
+        m_after_key = false;
+        return;
+    }
+    if (m_first.empty()) return;
+    if (!m_first.back()) m_buffer += ',';
+    m_first.back() = false;
+}
+
+void JSONStreamWriter::Append(const std::string& str)
+{
+    m_buffer += str;
+    if (m_buffer.size() >= m_flush_size) Flush();
+}
+
+void JSONStreamWriter::BeginObject()
+{
+    Separate();
+    m_first.push_back(true);
+    Append("{");
+}
+
+void JSONStreamWriter::EndObject()
+{
+    assert(!m_first.empty() && !m_after_key);
+    m_first.pop_back();
+    Append("}");
+}
+
+void JSONStreamWriter::BeginArray()
+{
+    Separate();
+    m_first.push_back(true);
+    Append("[");
+}
+
+void JSONStreamWriter::EndArray()
+{
+    assert(!m_first.empty() && !m_after_key);
+    m_first.pop_back();
+    Append("]");
+}
+
+void JSONStreamWriter::Key(const std::string& key)
+{
+    assert(!m_after_key);
+    Separate();
+    Append(UniValue(key).write() + ":");
+    m_after_key = true;
+}
+
+void JSONStreamWriter::Value(const UniValue& value)
+{
+    Separate();
+    Append(value.write());
+}
+
+void JSONStreamWriter::Members(const UniValue& object)
+{
+    assert(object.isObject());
+    const std::vector<std::string>& keys = object.getKeys();
+    const std::vector<UniValue>& values = object.getValues();
+    for (size_t i = 0; i < keys.size(); ++i) {
+        Key(keys[i]);
+        Value(values[i]);
+    }
+}
+
+void JSONStreamWriter::Flush()
+{
+    if (m_buffer.empty()) return;
+    m_sink(m_buffer);
+    m_buffer.clear();
+}
@@ -0,0 +1,57 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_RPC_JSONSTREAM_H
+#define BITCOIN_RPC_JSONSTREAM_H
+
+#include <univalue.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * Writes a JSON document piece by piece, in the same compact format as
+ * UniValue::write(), and hands the output to a sink in chunks of about
+ * flush_size bytes. Only the outer levels of a large document need to be
+ * streamed: its elements can still be built as small UniValue objects, so the
+ * memory needed does not grow with the size of the document.
+ */
+class JSONStreamWriter
+{
+public:
+    typedef std::function<void(const std::string&)> Sink;
+
+    static const size_t DEFAULT_FLUSH_SIZE = 64 * 1024;
+
+    explicit JSONStreamWriter(Sink sink, size_t flush_size = DEFAULT_FLUSH_SIZE);
+
+    void BeginObject();
+    void EndObject();
+    void BeginArray();
+    void EndArray();
+
+    /** Write the key of the next member of the current object. */
+    void Key(const std::string& key);
+    /** Write a value, either as an array element or after Key(). */
+    void Value(const UniValue& value);
+    /** Write all members of a UniValue object into the current object. */
+    void Members(const UniValue& object);
+
+    /** Pass any buffered output to the sink. */
+    void Flush();
+
+private:
+    void Separate();
+    void Append(const std::string& str);
+
+    const Sink m_sink;
+    const size_t m_flush_size;
+    std::string m_buffer;
+    //! One entry per open object or array, true until its first element has been written
+    std::vector<bool> m_first;
+    bool m_after_key;
+};
+
+#endif // BITCOIN_RPC_JSONSTREAM_H
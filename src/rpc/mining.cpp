@@ -256,6 +256,7 @@ static UniValue prioritisetransaction(const JSONRPCRequest& request)
     }
 
     mempool.PrioritiseTransaction(hash, nAmount);
+    if (g_block_template_cache) g_block_template_cache->MarkStale();
     return true;
 }
 
@@ -503,8 +504,10 @@ static UniValue getblocktemplate(const JSONRPCRequest& request)
     // Cache whether the last invocation was with segwit support, to avoid returning
     // a segwit-block to a non-segwit caller.
     static bool fLastTemplateSupportsSegwit = true;
+    // The cached template follows the mempool by itself and rate limits its
+    // own rebuilds, so it can be asked for every mempool change.
     if (pindexPrev != chainActive.Tip() ||
-        (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 5) ||
+        (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && (g_block_template_cache || GetTime() - nStart > BLOCK_TEMPLATE_MAX_STALE_AGE)) ||
         fLastTemplateSupportsSegwit != fSupportsSegwit)
     {
         // Clear pindexPrev so future calls make a new block, despite any failures from here on
@@ -517,8 +520,12 @@ static UniValue getblocktemplate(const JSONRPCRequest& request)
         fLastTemplateSupportsSegwit = fSupportsSegwit;
 
         // Create new block
-        CScript scriptDummy = CScript() << OP_TRUE;
-        pblocktemplate = BlockAssembler(Params()).CreateNewBlock(scriptDummy, fSupportsSegwit);
+        if (g_block_template_cache) {
+            pblocktemplate = g_block_template_cache->GetBlockTemplate(fSupportsSegwit, BLOCK_TEMPLATE_MAX_STALE_AGE);
+        } else {
+            CScript scriptDummy = CScript() << OP_TRUE;
+            pblocktemplate = BlockAssembler(Params()).CreateNewBlock(scriptDummy, fSupportsSegwit);
+        }
         if (!pblocktemplate)
             throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
 
@@ -1075,6 +1075,124 @@ static UniValue sendrawtransaction(const JSONRPCRequest& request)
     return hashTx.GetHex();
 }
 
+static UniValue sendrawtransactions(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 2)
+        throw std::runtime_error(
+            // clang-format off
+            "sendrawtransactions [\"rawtxs\"] ( allowhighfees )\n"
+            "\nSubmits raw transactions (serialized, hex-encoded) to local node and network.\n"
+            "\nThe transactions are validated in order, while holding the validation locks once, and\n"
+            "may spend outputs of transactions earlier in the array. Their scripts are verified in parallel.\n"
+            "Unlike sendrawtransaction, a rejected transaction does not cause an error; its result says why it was rejected.\n"
+            "\nSee sendrawtransaction call.\n"
+            "\nArguments:\n"
+            "1. [\"rawtxs\"]       (array, required) An array of hex strings of raw transactions.\n"
+            "2. allowhighfees    (boolean, optional, default=false) Allow high fees\n"
+            "\nResult:\n"
+            "[                   (array) The result for each raw transaction in the input array.\n"
+            " {\n"
+            "  \"txid\"           (string) The transaction hash in hex\n"
+            "  \"accepted\"       (boolean) If the transaction is in the mempool and was relayed\n"
+            "  \"reject-reason\"  (string) Rejection string (only present when 'accepted' is false)\n"
+            " }\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("sendrawtransactions", "\"[\\\"signedhex\\\",\\\"signedhex\\\"]\"") +
+            "\nAs a json rpc call\n"
+            + HelpExampleRpc("sendrawtransactions", "[\"signedhex\",\"signedhex\"]")
+            // clang-format on
+            );
+
+    RPCTypeCheck(request.params, {UniValue::VARR, UniValue::VBOOL});
+    const UniValue& rawtxs = request.params[0].get_array();
+
+    std::vector<CTransactionRef> txs;
+    txs.reserve(rawtxs.size());
+    for (size_t i = 0; i < rawtxs.size(); i++) {
+        CMutableTransaction mtx;
+        if (!DecodeHexTx(mtx, rawtxs[i].get_str())) {
+            throw JSONRPCError(RPC_DESERIALIZATION_ERROR, strprintf("TX decode failed for transaction %u", i));
+        }
+        txs.push_back(MakeTransactionRef(std::move(mtx)));
+    }
+
+    CAmount nMaxRawTxFee = maxTxFee;
+    if (!request.params[1].isNull() && request.params[1].get_bool())
+        nMaxRawTxFee = 0;
+
+    std::vector<std::string> reject_reasons(txs.size());
+    std::vector<bool> relay(txs.size(), false);
+    bool any_accepted = false;
+    { // cs_main scope
+    LOCK(cs_main);
+    std::vector<CTransactionRef> to_submit;
+    std::vector<size_t> submitted_index;
+    for (size_t i = 0; i < txs.size(); i++) {
+        const uint256& hashTx = txs[i]->GetHash();
+        bool fHaveChain = false;
+        for (size_t o = 0; !fHaveChain && o < txs[i]->vout.size(); o++) {
+            fHaveChain = !pcoinsTip->AccessCoin(COutPoint(hashTx, o)).IsSpent();
+        }
+        if (fHaveChain) {
+            reject_reasons[i] = "transaction already in block chain";
+        } else if (mempool.exists(hashTx)) {
+            // Re-relay transactions that are in the mempool already.
+            relay[i] = true;
+        } else {
+            to_submit.push_back(txs[i]);
+            submitted_index.push_back(i);
+        }
+    }
+
+    std::vector<MempoolAcceptResult> results = AcceptToMemoryPoolBatch(mempool, to_submit, false /* bypass_limits */, nMaxRawTxFee);
+    for (size_t j = 0; j < results.size(); j++) {
+        const size_t i = submitted_index[j];
+        const MempoolAcceptResult& result = results[j];
+        if (result.accepted) {
+            relay[i] = true;
+            any_accepted = true;
+        } else if (mempool.exists(txs[i]->GetHash())) {
+            // Submitted more than once in this batch.
+            relay[i] = true;
+        } else if (!result.state.IsInvalid() && result.missing_inputs) {
+            reject_reasons[i] = "missing-inputs";
+        } else {
+            reject_reasons[i] = FormatStateMessage(result.state);
+        }
+    }
+    } // cs_main
+
+    if (any_accepted) {
+        // See sendrawtransaction: make wallets aware of the new transactions
+        // before returning.
+        SyncWithValidationInterfaceQueue();
+    }
+
+    if(!g_connman)
+        throw JSONRPCError(RPC_CLIENT_P2P_DISABLED, "Error: Peer-to-peer functionality missing or disabled");
+
+    UniValue result(UniValue::VARR);
+    for (size_t i = 0; i < txs.size(); i++) {
+        const uint256& hashTx = txs[i]->GetHash();
+        if (relay[i]) {
+            CInv inv(MSG_TX, hashTx);
+            g_connman->ForEachNode([&inv](CNode* pnode)
+            {
+                pnode->PushInventory(inv);
+            });
+        }
+        UniValue entry(UniValue::VOBJ);
+        entry.pushKV("txid", hashTx.GetHex());
+        entry.pushKV("accepted", bool(relay[i]));
+        if (!relay[i]) {
+            entry.pushKV("reject-reason", reject_reasons[i]);
+        }
+        result.push_back(std::move(entry));
+    }
+    return result;
+}
+
 static UniValue testmempoolaccept(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() < 1 || request.params.size() > 2) {
@@ -1705,6 +1823,7 @@ static const CRPCCommand commands[] =
     { "rawtransactions",    "combinerawtransaction",        &combinerawtransaction,     {"txs"} },
     { "hidden",             "signrawtransaction",           &signrawtransaction,        {"hexstring","prevtxs","privkeys","sighashtype"} },
     { "rawtransactions",    "signrawtransactionwithkey",    &signrawtransactionwithkey, {"hexstring","privkeys","prevtxs","sighashtype"} },
+    { "rawtransactions",    "sendrawtransactions",          &sendrawtransactions,       {"rawtxs","allowhighfees"} },
     { "rawtransactions",    "testmempoolaccept",            &testmempoolaccept,         {"rawtxs","allowhighfees"} },
     { "rawtransactions",    "decodepsbt",                   &decodepsbt,                {"psbt"} },
     { "rawtransactions",    "combinepsbt",                  &combinepsbt,               {"txs"} },
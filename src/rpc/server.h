@@ -20,6 +20,7 @@
 static const unsigned int DEFAULT_RPC_SERIALIZE_VERSION = 1;
 
 class CRPCCommand;
+class JSONStreamWriter;
 
 namespace RPCServer
 {
@@ -46,8 +47,11 @@ public:
     std::string URI;
     std::string authUser;
     std::string peerAddr;
+    /** If set, methods with large results may write their result here
+     *  instead of returning it, to send it while it is being produced. */
+    JSONStreamWriter* resultStream;
 
-    JSONRPCRequest() : id(NullUniValue), params(NullUniValue), fHelp(false) {}
+    JSONRPCRequest() : id(NullUniValue), params(NullUniValue), fHelp(false), resultStream(nullptr) {}
     void parse(const UniValue& valRequest);
 };
 
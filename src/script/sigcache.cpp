@@ -57,6 +57,22 @@ public:
     {
         return setValid.setup_bytes(n);
     }
+
+    void Dump(uint256& nonceOut, std::vector<uint256>& entries)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
+        nonceOut = nonce;
+        setValid.for_each([&entries](const uint256& entry) { entries.push_back(entry); });
+    }
+
+    void Load(const uint256& nonceIn, const std::vector<uint256>& entries)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
+        nonce = nonceIn;
+        for (const uint256& entry : entries) {
+            setValid.insert(entry);
+        }
+    }
 };
 
 /* In previous versions of this code, signatureCache was a local static variable
@@ -80,6 +96,16 @@ void InitSignatureCache()
             (nElems*sizeof(uint256)) >>20, (nMaxCacheSize*2)>>20, nElems);
 }
 
+void DumpSignatureCache(uint256& nonce, std::vector<uint256>& entries)
+{
+    signatureCache.Dump(nonce, entries);
+}
+
+void LoadSignatureCache(const uint256& nonce, const std::vector<uint256>& entries)
+{
+    signatureCache.Load(nonce, entries);
+}
+
 bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
 {
     uint256 entry;
@@ -53,4 +53,13 @@ public:
 
 void InitSignatureCache();
 
+/** Copy the nonce of the signature cache and the entries computed with it,
+ *  so they can be restored by LoadSignatureCache() after a restart. */
+void DumpSignatureCache(uint256& nonce, std::vector<uint256>& entries);
+
+/** Switch the signature cache to a nonce saved by DumpSignatureCache() and
+ *  add the entries computed with it. Entries already in the cache become
+ *  useless, so this should be done right after InitSignatureCache(). */
+void LoadSignatureCache(const uint256& nonce, const std::vector<uint256>& entries);
+
 #endif // BITCOIN_SCRIPT_SIGCACHE_H
@@ -0,0 +1,234 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+#define BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+
+#include <memusage.h>
+
+#include <stddef.h>
+
+#include <algorithm>
+#include <array>
+#include <new>
+#include <vector>
+
+/** Memory resource for node based containers, which allocate their elements
+ * one at a time.
+ *
+ * Small allocations are carved out of large chunks and recycled through one
+ * free list per size, so they need neither a malloc call nor malloc's
+ * per-allocation bookkeeping. Memory of freed blocks is kept for reuse by
+ * later allocations until the resource is destroyed. Larger or overaligned
+ * allocations, like the bucket arrays of hash tables, are passed on to
+ * operator new.
+ *
+ * Not thread safe: containers sharing a resource must be protected by the
+ * same lock.
+ */
+class PoolResource
+{
+public:
+    //! Allocation sizes are rounded up to a multiple of this
+    static const size_t ALIGN = alignof(void*);
+    //! Largest allocation served from the chunks
+    static const size_t MAX_BLOCK_SIZE = 1024;
+    static const size_t CHUNK_SIZE = 256 * 1024;
+
+    PoolResource() {}
+    PoolResource(const PoolResource&) = delete;
+    PoolResource& operator=(const PoolResource&) = delete;
+
+    ~PoolResource()
+    {
+        for (void* chunk : m_chunks) {
+            ::operator delete(chunk);
+        }
+    }
+
+    void* Allocate(size_t bytes, size_t alignment)
+    {
+        if (!IsPooled(bytes, alignment)) {
+            m_large_usage += memusage::MallocUsage(bytes);
+            return ::operator new(bytes);
+        }
+        const size_t index = FreeListIndex(bytes);
+        const size_t size = index * ALIGN;
+        m_pooled_bytes += size;
+        if (FreeBlock* block = m_free_lists[index]) {
+            m_free_lists[index] = block->next;
+            return block;
+        }
+        if (m_available < size) AllocateChunk();
+        void* p = m_available_begin;
+        m_available_begin += size;
+        m_available -= size;
+        return p;
+    }
+
+    void Deallocate(void* p, size_t bytes, size_t alignment) noexcept
+    {
+        if (!IsPooled(bytes, alignment)) {
+            m_large_usage -= memusage::MallocUsage(bytes);
+            ::operator delete(p);
+            return;
+        }
+        const size_t index = FreeListIndex(bytes);
+        m_pooled_bytes -= index * ALIGN;
+        m_free_lists[index] = new (p) FreeBlock{m_free_lists[index]};
+    }
+
+    //! Memory used by live allocations, not counting memory kept for reuse.
+    size_t DynamicMemoryUsage() const { return m_pooled_bytes + m_large_usage; }
+
+    //! Memory held in chunks, including free blocks and not yet used space.
+    size_t ChunkBytes() const { return m_chunks.size() * CHUNK_SIZE; }
+
+    //! Memory of live allocations that are served from the chunks.
+    size_t ChunkUsedBytes() const { return m_pooled_bytes; }
+
+    /** Give chunks that hold no live allocations back to the system, except
+     *  the chunk that new blocks are carved from. This walks all free blocks,
+     *  so it is meant to be called occasionally. Returns the number of bytes
+     *  released. */
+    size_t Compact()
+    {
+        if (m_chunks.size() < 2) return 0;
+        char* const current = static_cast<char*>(m_chunks.back());
+        std::vector<char*> chunks;
+        chunks.reserve(m_chunks.size());
+        for (void* chunk : m_chunks) {
+            chunks.push_back(static_cast<char*>(chunk));
+        }
+        std::sort(chunks.begin(), chunks.end());
+        auto chunk_of = [&chunks](const void* p) {
+            return std::upper_bound(chunks.begin(), chunks.end(), static_cast<const char*>(p)) - chunks.begin() - 1;
+        };
+
+        // Every byte of a chunk other than the current one is either in a
+        // live or in a free block, so a chunk is unused if its free blocks
+        // add up to the whole chunk.
+        std::vector<size_t> free_bytes(chunks.size(), 0);
+        for (size_t index = 0; index < m_free_lists.size(); ++index) {
+            for (FreeBlock* block = m_free_lists[index]; block; block = block->next) {
+                free_bytes[chunk_of(block)] += index * ALIGN;
+            }
+        }
+        std::vector<bool> release(chunks.size(), false);
+        size_t released = 0;
+        for (size_t i = 0; i < chunks.size(); ++i) {
+            if (free_bytes[i] == CHUNK_SIZE && chunks[i] != current) {
+                release[i] = true;
+                ++released;
+            }
+        }
+        if (released == 0) return 0;
+
+        for (FreeBlock*& head : m_free_lists) {
+            FreeBlock** link = &head;
+            while (*link) {
+                if (release[chunk_of(*link)]) {
+                    *link = (*link)->next;
+                } else {
+                    link = &(*link)->next;
+                }
+            }
+        }
+        m_chunks.clear();
+        for (size_t i = 0; i < chunks.size(); ++i) {
+            if (release[i]) {
+                ::operator delete(chunks[i]);
+            } else if (chunks[i] != current) {
+                m_chunks.push_back(chunks[i]);
+            }
+        }
+        // Keep the current chunk last.
+        m_chunks.push_back(current);
+        return released * CHUNK_SIZE;
+    }
+
+private:
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    static bool IsPooled(size_t bytes, size_t alignment)
+    {
+        return bytes <= MAX_BLOCK_SIZE && alignment <= ALIGN;
+    }
+
+    static size_t FreeListIndex(size_t bytes)
+    {
+        return bytes == 0 ? 1 : (bytes + ALIGN - 1) / ALIGN;
+    }
+
+    void AllocateChunk()
+    {
+        // Keep the rest of the current chunk around as a free block. All
+        // sizes are multiples of ALIGN, so the rest is one as well.
+        if (m_available > 0) {
+            const size_t index = m_available / ALIGN;
+            m_free_lists[index] = new (m_available_begin) FreeBlock{m_free_lists[index]};
+        }
+        m_available_begin = static_cast<char*>(::operator new(CHUNK_SIZE));
+        m_chunks.push_back(m_available_begin);
+        m_available = CHUNK_SIZE;
+    }
+
+    std::array<FreeBlock*, MAX_BLOCK_SIZE / ALIGN + 1> m_free_lists{};
+    std::vector<void*> m_chunks;
+    char* m_available_begin = nullptr;
+    size_t m_available = 0;
+    size_t m_pooled_bytes = 0;
+    size_t m_large_usage = 0;
+};
+
+/** Allocator that allocates from a PoolResource. Copies, including copies
+ *  rebound to another type, share the resource. */
+template <typename T>
+class PoolAllocator
+{
+public:
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+
+    template <typename U>
+    struct rebind {
+        typedef PoolAllocator<U> other;
+    };
+
+    explicit PoolAllocator(PoolResource* resource) noexcept : m_resource(resource) {}
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>& other) noexcept : m_resource(other.resource())
+    {
+    }
+
+    T* allocate(size_t n)
+    {
+        return static_cast<T*>(m_resource->Allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, size_t n) noexcept
+    {
+        m_resource->Deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    PoolResource* resource() const noexcept { return m_resource; }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U>& other) const noexcept { return m_resource == other.resource(); }
+    template <typename U>
+    bool operator!=(const PoolAllocator<U>& other) const noexcept { return m_resource != other.resource(); }
+
+private:
+    PoolResource* m_resource;
+};
+
+#endif // BITCOIN_SUPPORT_ALLOCATORS_POOL_H
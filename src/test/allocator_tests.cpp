@@ -4,9 +4,11 @@
 
 #include <util.h>
 
+#include <support/allocators/pool.h>
 #include <support/allocators/secure.h>
 #include <test/test_bitcoin.h>
 
+#include <map>
 #include <memory>
 
 #include <boost/test/unit_test.hpp>
@@ -233,4 +235,76 @@ BOOST_AUTO_TEST_CASE(lockedpool_tests_live)
     BOOST_CHECK(pool.stats().used == initial.used);
 }
 
+BOOST_AUTO_TEST_CASE(pool_resource_tests)
+{
+    PoolResource resource;
+    BOOST_CHECK_EQUAL(resource.DynamicMemoryUsage(), 0U);
+    BOOST_CHECK_EQUAL(resource.ChunkBytes(), 0U);
+
+    // Sizes are rounded up, and freed blocks are reused for the same size.
+    void* a = resource.Allocate(1, 1);
+    void* b = resource.Allocate(PoolResource::ALIGN + 1, 1);
+    BOOST_CHECK_EQUAL(resource.DynamicMemoryUsage(), 3 * PoolResource::ALIGN);
+    BOOST_CHECK(resource.ChunkBytes() == PoolResource::CHUNK_SIZE);
+    BOOST_CHECK_EQUAL(reinterpret_cast<uintptr_t>(b) % PoolResource::ALIGN, 0U);
+    resource.Deallocate(a, 1, 1);
+    BOOST_CHECK_EQUAL(resource.DynamicMemoryUsage(), 2 * PoolResource::ALIGN);
+    BOOST_CHECK(resource.Allocate(PoolResource::ALIGN, 1) == a);
+    resource.Deallocate(b, PoolResource::ALIGN + 1, 1);
+    resource.Deallocate(a, PoolResource::ALIGN, 1);
+    BOOST_CHECK_EQUAL(resource.DynamicMemoryUsage(), 0U);
+
+    // Large allocations do not come from the chunks.
+    void* large = resource.Allocate(PoolResource::MAX_BLOCK_SIZE + 1, 1);
+    BOOST_CHECK_EQUAL(resource.DynamicMemoryUsage(), memusage::MallocUsage(PoolResource::MAX_BLOCK_SIZE + 1));
+    resource.Deallocate(large, PoolResource::MAX_BLOCK_SIZE + 1, 1);
+    BOOST_CHECK_EQUAL(resource.DynamicMemoryUsage(), 0U);
+    BOOST_CHECK(resource.ChunkBytes() == PoolResource::CHUNK_SIZE);
+
+    // Containers allocate from the resource, and give everything back.
+    {
+        std::map<int, int, std::less<int>, PoolAllocator<std::pair<const int, int> > > map{std::less<int>(), PoolAllocator<std::pair<const int, int> >(&resource)};
+        for (int i = 0; i < 100000; ++i) {
+            map.emplace(i, i);
+        }
+        BOOST_CHECK(resource.DynamicMemoryUsage() >= map.size() * sizeof(std::pair<const int, int>));
+        BOOST_CHECK(resource.ChunkBytes() >= resource.DynamicMemoryUsage());
+        for (int i = 0; i < 100000; i += 2) {
+            map.erase(i);
+        }
+        for (int i = 1; i < 100000; i += 2) {
+            BOOST_CHECK_EQUAL(map.at(i), i);
+        }
+    }
+    BOOST_CHECK_EQUAL(resource.DynamicMemoryUsage(), 0U);
+
+    // Compaction releases every chunk but the current one once it is unused.
+    const size_t chunks_before = resource.ChunkBytes() / PoolResource::CHUNK_SIZE;
+    BOOST_CHECK(chunks_before > 2);
+    BOOST_CHECK_EQUAL(resource.Compact(), (chunks_before - 1) * PoolResource::CHUNK_SIZE);
+    BOOST_CHECK(resource.ChunkBytes() == PoolResource::CHUNK_SIZE);
+    BOOST_CHECK_EQUAL(resource.Compact(), 0U);
+
+    // Chunks with live blocks are kept, and the remaining free blocks stay usable.
+    std::vector<void*> blocks;
+    const size_t per_chunk = PoolResource::CHUNK_SIZE / 64;
+    for (size_t i = 0; i < 4 * per_chunk; ++i) {
+        blocks.push_back(resource.Allocate(64, 1));
+    }
+    void* kept = blocks[2 * per_chunk];
+    for (void* block : blocks) {
+        if (block != kept) resource.Deallocate(block, 64, 1);
+    }
+    const size_t chunk_bytes = resource.ChunkBytes();
+    const size_t released = resource.Compact();
+    BOOST_CHECK(released > 0);
+    BOOST_CHECK_EQUAL(resource.ChunkBytes(), chunk_bytes - released);
+    BOOST_CHECK(resource.ChunkBytes() >= 2 * PoolResource::CHUNK_SIZE);
+    BOOST_CHECK_EQUAL(resource.ChunkUsedBytes(), 64U);
+    for (size_t i = 0; i < 2 * per_chunk; ++i) {
+        resource.Allocate(64, 1);
+    }
+    BOOST_CHECK_EQUAL(resource.ChunkUsedBytes(), (2 * per_chunk + 1) * 64);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
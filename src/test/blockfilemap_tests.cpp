@@ -0,0 +1,122 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockfilemap.h>
+#include <chain.h>
+#include <chainparams.h>
+#include <primitives/block.h>
+#include <streams.h>
+#include <validation.h>
+
+#include <test/test_bitcoin.h>
+
+#include <boost/test/unit_test.hpp>
+
+// Memory mapping is not implemented on Windows, where reads fall back to
+// regular file access.
+#ifndef WIN32
+
+namespace {
+
+void AppendToFile(const fs::path& path, const std::vector<uint8_t>& data)
+{
+    FILE* file = fsbridge::fopen(path, "ab");
+    BOOST_REQUIRE(file);
+    BOOST_REQUIRE_EQUAL(fwrite(data.data(), 1, data.size(), file), data.size());
+    fclose(file);
+}
+
+} // namespace
+
+BOOST_FIXTURE_TEST_SUITE(blockfilemap_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(blockfilemap_get)
+{
+    fs::path dir = SetDataDir("blockfilemap");
+    auto path_of = [&dir](int nFile) { return dir / strprintf("blk%05u.dat", nFile); };
+    for (int nFile = 0; nFile < 3; ++nFile) {
+        AppendToFile(path_of(nFile), std::vector<uint8_t>(100, nFile));
+    }
+
+    BlockFileMap map(2, path_of);
+    std::shared_ptr<const MappedFile> file0 = map.Get(0, 100);
+    BOOST_REQUIRE(file0);
+    BOOST_CHECK_EQUAL(file0->size(), 100U);
+    BOOST_CHECK_EQUAL(file0->Data()[99], 0);
+    BOOST_CHECK(map.Get(0, 50) == file0);
+    BOOST_CHECK(!map.Get(0, 101));
+    BOOST_CHECK(!map.Get(3, 1));
+
+    // A file that grew is mapped again, while the old mapping stays usable.
+    AppendToFile(path_of(0), std::vector<uint8_t>(100, 42));
+    std::shared_ptr<const MappedFile> file0_grown = map.Get(0, 150);
+    BOOST_REQUIRE(file0_grown);
+    BOOST_CHECK(file0_grown != file0);
+    BOOST_CHECK_EQUAL(file0_grown->Data()[150], 42);
+    BOOST_CHECK_EQUAL(file0->Data()[0], 0);
+
+    // A mapping larger than its file, which was truncated since, is not
+    // handed out, as reading past the end of the file would fault.
+    fs::resize_file(path_of(0), 120);
+    BOOST_CHECK(!map.Get(0, 150));
+    std::shared_ptr<const MappedFile> file0_truncated = map.Get(0, 100);
+    BOOST_REQUIRE(file0_truncated);
+    BOOST_CHECK(file0_truncated != file0_grown);
+    BOOST_CHECK_EQUAL(file0_truncated->size(), 120U);
+    file0_grown = file0_truncated;
+
+    // The least recently used mapping is dropped when the limit is reached.
+    BOOST_CHECK(map.Get(1, 1));
+    BOOST_CHECK(map.Get(0, 1) == file0_grown);
+    BOOST_CHECK(map.Get(2, 1));
+    BOOST_CHECK_EQUAL(map.size(), 2U);
+    BOOST_CHECK(map.Get(0, 1) == file0_grown);
+    std::shared_ptr<const MappedFile> file1 = map.Get(1, 1);
+    BOOST_CHECK(file1 && file1->Data()[0] == 1);
+
+    // Erased files are mapped again on the next request.
+    map.Erase(1);
+    BOOST_CHECK_EQUAL(map.size(), 1U);
+    BOOST_CHECK(map.Get(1, 1) != file1);
+
+    // Mapping can be disabled.
+    BlockFileMap disabled(0, path_of);
+    BOOST_CHECK(!disabled.Get(0, 1));
+}
+
+BOOST_FIXTURE_TEST_CASE(blockfilemap_read_block, TestingSetup)
+{
+    const CChainParams& chainparams = Params();
+    const CBlockIndex* pindex;
+    {
+        LOCK(cs_main);
+        pindex = chainActive.Genesis();
+    }
+    BOOST_REQUIRE(pindex);
+
+    std::vector<uint8_t> expected;
+    BOOST_REQUIRE(ReadRawBlockFromDisk(expected, pindex, chainparams.MessageStart()));
+
+    InitBlockFileMap(4);
+    CBlock block;
+    BOOST_CHECK(ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()));
+    BOOST_CHECK(block.GetHash() == chainparams.GenesisBlock().GetHash());
+    CRawBlock raw;
+    BOOST_CHECK(ReadRawBlockFromDisk(raw, pindex, chainparams.MessageStart()));
+    BOOST_CHECK(raw.file);
+    BOOST_CHECK(raw.buffer.empty());
+    BOOST_CHECK(std::vector<uint8_t>(raw.data.begin(), raw.data.end()) == expected);
+    InitBlockFileMap(0);
+
+    // Without mapping, the block is read into the buffer.
+    CRawBlock read;
+    BOOST_CHECK(ReadRawBlockFromDisk(read, pindex, chainparams.MessageStart()));
+    BOOST_CHECK(!read.file);
+    BOOST_CHECK(read.buffer == expected);
+    BOOST_CHECK(std::vector<uint8_t>(read.data.begin(), read.data.end()) == expected);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+#endif // WIN32
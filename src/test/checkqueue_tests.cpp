@@ -380,6 +380,34 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_FrozenCleanup)
     BOOST_REQUIRE(!fails);
 }
 
+/** Test that ForEach calls the function once for every index, and that the
+ * queue can still be used for checks afterwards.
+ */
+BOOST_AUTO_TEST_CASE(test_CheckQueue_ForEach)
+{
+    auto queue = MakeUnique<Correct_Queue>(QUEUE_BATCH_SIZE);
+    boost::thread_group tg;
+    for (auto x = 0; x < nScriptCheckThreads; ++x) {
+       tg.create_thread([&]{queue->Thread();});
+    }
+    for (size_t count : {0, 1, 2, 1000, 100000}) {
+        std::vector<std::atomic<int>> calls(count);
+        for (auto& n : calls) n = 0;
+        CCheckQueueControl<FakeCheckCheckCompletion> control(queue.get());
+        control.ForEach(count, [&](size_t i) { ++calls[i]; });
+        for (size_t i = 0; i < count; ++i) {
+            BOOST_REQUIRE_EQUAL(calls[i], 1);
+        }
+        FakeCheckCheckCompletion::n_calls = 0;
+        std::vector<FakeCheckCheckCompletion> vChecks(100);
+        control.Add(vChecks);
+        BOOST_REQUIRE(control.Wait());
+        BOOST_REQUIRE_EQUAL(FakeCheckCheckCompletion::n_calls, 100U);
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
+
 
 /** Test that CCheckQueueControl is threadsafe */
 BOOST_AUTO_TEST_CASE(test_CheckQueueControl_Locks)
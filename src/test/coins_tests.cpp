@@ -4,6 +4,7 @@
 
 #include <coins.h>
 #include <script/standard.h>
+#include <txdb.h>
 #include <uint256.h>
 #include <undo.h>
 #include <utilstrencodings.h>
@@ -13,6 +14,7 @@
 
 #include <vector>
 #include <map>
+#include <thread>
 
 #include <boost/test/unit_test.hpp>
 
@@ -52,7 +54,7 @@ public:
 
     uint256 GetBestBlock() const override { return hashBestBlock_; }
 
-    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock) override
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, bool erase) override
     {
         for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); ) {
             if (it->second.flags & CCoinsCacheEntry::DIRTY) {
@@ -63,7 +65,11 @@ public:
                     map_.erase(it->first);
                 }
             }
-            mapCoins.erase(it++);
+            if (erase) {
+                mapCoins.erase(it++);
+            } else {
+                ++it;
+            }
         }
         if (!hashBlock.IsNull())
             hashBestBlock_ = hashBlock;
@@ -213,6 +219,15 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
                 stack[flushIndex]->Flush();
             }
         }
+        if (InsecureRandRange(100) == 0) {
+            // Every 100 iterations, sync and trim a cache
+            if (stack.size() > 0 && InsecureRandBool() == 0) {
+                unsigned int syncIndex = InsecureRandRange(stack.size());
+                stack[syncIndex]->Sync();
+                stack[syncIndex]->Trim(InsecureRandRange(stack[syncIndex]->DynamicMemoryUsage() + 1));
+                stack[syncIndex]->SelfTest();
+            }
+        }
         if (InsecureRandRange(100) == 0) {
             // Every 100 iterations, change the cache stack.
             if (stack.size() > 0 && InsecureRandBool() == 0) {
@@ -855,4 +870,191 @@ BOOST_AUTO_TEST_CASE(ccoins_write)
                     CheckWriteCoins(parent_value, child_value, parent_value, parent_flags, child_flags, parent_flags);
 }
 
+//! Read-only view, safe to query from several prefetch threads at once.
+class CCoinsViewStatic : public CCoinsView
+{
+public:
+    std::map<COutPoint, Coin> map;
+
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const override
+    {
+        auto it = map.find(outpoint);
+        if (it == map.end()) return false;
+        coin = it->second;
+        return true;
+    }
+
+    bool HasConcurrentGetCoin() const override { return true; }
+};
+
+//! Run the calls of a prefetch on a thread each.
+static void ThreadedForEach(size_t count, const std::function<void(size_t)>& fn)
+{
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < count; ++i) {
+        threads.emplace_back([&fn, i] { fn(i); });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+//! Run the calls of a prefetch one after the other.
+static void SerialForEach(size_t count, const std::function<void(size_t)>& fn)
+{
+    for (size_t i = 0; i < count; ++i) {
+        fn(i);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_prefetch)
+{
+    CCoinsViewStatic base;
+    std::vector<COutPoint> outpoints;
+    for (int i = 0; i < 1000; ++i) {
+        COutPoint outpoint(InsecureRand256(), i % 3);
+        Coin coin;
+        coin.out.nValue = i + 1;
+        coin.out.scriptPubKey = CScript() << std::vector<unsigned char>(i % 50, 0);
+        if (i % 10 != 0) {
+            // Every tenth outpoint is unknown to the base view.
+            base.map.emplace(outpoint, std::move(coin));
+        }
+        outpoints.push_back(outpoint);
+    }
+
+    for (const CoinsForEachFn& for_each : {CoinsForEachFn(SerialForEach), CoinsForEachFn(ThreadedForEach)}) {
+        CCoinsViewCacheTest cache(&base);
+        // An entry that is already cached must not be replaced.
+        Coin modified;
+        modified.out.nValue = 42;
+        cache.AddCoin(outpoints[1], std::move(modified), true);
+
+        BOOST_CHECK_EQUAL(cache.PrefetchCoins(outpoints, for_each), 899U);
+        BOOST_CHECK_EQUAL(cache.GetCacheSize(), 900U);
+        cache.SelfTest();
+        BOOST_CHECK_EQUAL(cache.AccessCoin(outpoints[1]).out.nValue, 42);
+        for (size_t i = 2; i < outpoints.size(); ++i) {
+            BOOST_CHECK(cache.HaveCoinInCache(outpoints[i]) == (i % 10 != 0));
+        }
+        // A second prefetch finds everything cached already.
+        BOOST_CHECK_EQUAL(cache.PrefetchCoins(outpoints, for_each), 0U);
+    }
+
+    // Prefetching into a cache on top of another cache fills both, like
+    // ConnectBlock() does with its view on top of pcoinsTip.
+    CCoinsViewCacheTest tip(&base);
+    CCoinsViewCacheTest view(&tip);
+    BOOST_CHECK(!view.HasConcurrentGetCoin());
+    BOOST_CHECK_EQUAL(view.PrefetchCoins(outpoints, ThreadedForEach), 900U);
+    BOOST_CHECK_EQUAL(tip.GetCacheSize(), 900U);
+    BOOST_CHECK_EQUAL(view.GetCacheSize(), 900U);
+    tip.SelfTest();
+    view.SelfTest();
+}
+
+BOOST_FIXTURE_TEST_CASE(ccoins_async_flush, TestingSetup)
+{
+    CCoinsViewDB db(1 << 20, true);
+    std::vector<COutPoint> outpoints;
+    uint256 hashBlock;
+    for (int round = 0; round < 3; ++round) {
+        CCoinsViewCacheTest cache(&db);
+        // Spend the coins added in the previous round and add new ones.
+        for (const COutPoint& outpoint : outpoints) {
+            BOOST_CHECK(cache.SpendCoin(outpoint));
+        }
+        outpoints.clear();
+        for (int i = 0; i < 100; ++i) {
+            outpoints.emplace_back(InsecureRand256(), i);
+            Coin coin;
+            coin.out.nValue = i + 1;
+            cache.AddCoin(outpoints.back(), std::move(coin), false);
+        }
+        hashBlock = InsecureRand256();
+        cache.SetBestBlock(hashBlock);
+        BOOST_CHECK(cache.FlushAsync());
+        BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0U);
+
+        // The flushed state is visible whether or not the write has completed.
+        BOOST_CHECK(db.GetBestBlock() == hashBlock);
+        for (size_t i = 0; i < outpoints.size(); ++i) {
+            Coin coin;
+            BOOST_CHECK(db.GetCoin(outpoints[i], coin));
+            BOOST_CHECK_EQUAL(coin.out.nValue, int64_t(i + 1));
+            BOOST_CHECK(db.HaveCoin(outpoints[i]));
+        }
+    }
+
+    BOOST_CHECK(db.WaitForWrite());
+    BOOST_CHECK(db.GetBestBlock() == hashBlock);
+    size_t count = 0;
+    std::unique_ptr<CCoinsViewCursor> cursor(db.Cursor());
+    for (; cursor->Valid(); cursor->Next()) {
+        COutPoint key;
+        BOOST_CHECK(cursor->GetKey(key));
+        BOOST_CHECK(std::find(outpoints.begin(), outpoints.end(), key) != outpoints.end());
+        ++count;
+    }
+    BOOST_CHECK_EQUAL(count, outpoints.size());
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_sync_trim)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+    std::vector<COutPoint> outpoints;
+    for (int i = 0; i < 1000; ++i) {
+        outpoints.emplace_back(InsecureRand256(), 0);
+        Coin coin;
+        coin.out.nValue = i + 1;
+        coin.out.scriptPubKey = CScript() << std::vector<unsigned char>(40, 0);
+        cache.AddCoin(outpoints.back(), std::move(coin), false);
+        // Ten new entries per block.
+        if (i % 10 == 9) cache.SetBestBlock(InsecureRand256());
+    }
+    BOOST_CHECK(cache.SpendCoin(outpoints[0]));
+
+    // Syncing writes everything but keeps unspent entries cached.
+    BOOST_CHECK(cache.Sync());
+    cache.SelfTest();
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 999U);
+    BOOST_CHECK(cache.GetBestBlock() == base.GetBestBlock());
+    Coin coin;
+    BOOST_CHECK(!base.GetCoin(outpoints[0], coin) || coin.IsSpent());
+    for (int i = 1; i < 1000; ++i) {
+        BOOST_CHECK(base.GetCoin(outpoints[i], coin) && coin.out.nValue == i + 1);
+        BOOST_CHECK(cache.HaveCoinInCache(outpoints[i]));
+    }
+
+    // Use the oldest entries again, and add a modified one.
+    for (int i = 1; i < 100; ++i) {
+        BOOST_CHECK(cache.HaveCoin(outpoints[i]));
+    }
+    cache.SetBestBlock(InsecureRand256());
+    Coin modified;
+    modified.out.nValue = 42;
+    cache.AddCoin(outpoints[0], std::move(modified), false);
+
+    // Trimming evicts the least recently used unmodified entries first.
+    size_t target = cache.DynamicMemoryUsage() / 2;
+    cache.Trim(target);
+    cache.SelfTest();
+    BOOST_CHECK(cache.DynamicMemoryUsage() <= target);
+    BOOST_CHECK(cache.GetCacheSize() > 100U);
+    BOOST_CHECK(cache.GetCacheSize() < 1000U);
+    BOOST_CHECK(cache.HaveCoinInCache(outpoints[0]));
+    for (int i = 1; i < 100; ++i) {
+        BOOST_CHECK(cache.HaveCoinInCache(outpoints[i]));
+    }
+    BOOST_CHECK(!cache.HaveCoinInCache(outpoints[100]));
+    BOOST_CHECK(cache.HaveCoinInCache(outpoints[999]));
+
+    // Modified entries are never evicted.
+    cache.Trim(0);
+    cache.SelfTest();
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 1U);
+    BOOST_CHECK_EQUAL(cache.AccessCoin(outpoints[0]).out.nValue, 42);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
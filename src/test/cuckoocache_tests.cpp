@@ -6,6 +6,7 @@
 #include <script/sigcache.h>
 #include <test/test_bitcoin.h>
 #include <random.h>
+#include <set>
 #include <thread>
 
 /** Test Suite for CuckooCache
@@ -377,4 +378,26 @@ BOOST_AUTO_TEST_CASE(cuckoocache_generations)
     test_cache_generations<CuckooCache::cache<uint256, SignatureCacheHasher>>();
 }
 
+/* Test that for_each visits exactly the elements that were inserted and not
+ * erased.
+ */
+BOOST_AUTO_TEST_CASE(cuckoocache_for_each)
+{
+    local_rand_ctx = FastRandomContext(true);
+    CuckooCache::cache<uint256, SignatureCacheHasher> cc{};
+    cc.setup_bytes(4 << 20);
+    std::vector<uint256> hashes(1000);
+    for (uint256& h : hashes) {
+        insecure_GetRandHash(h);
+        cc.insert(h);
+    }
+    for (size_t i = 0; i < hashes.size(); i += 2)
+        BOOST_CHECK(cc.contains(hashes[i], true));
+    std::set<uint256> visited;
+    cc.for_each([&visited](const uint256& h) { BOOST_CHECK(visited.insert(h).second); });
+    BOOST_CHECK_EQUAL(visited.size(), hashes.size() / 2);
+    for (size_t i = 1; i < hashes.size(); i += 2)
+        BOOST_CHECK(visited.count(hashes[i]));
+}
+
 BOOST_AUTO_TEST_SUITE_END();
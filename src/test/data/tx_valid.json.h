@@ -0,0 +1,10814 @@
+namespace json_tests{
+static unsigned const char tx_valid[] = {
+0x5b, 0x0a, 0x5b, 0x22, 0x54, 0x68, 0x65, 0x20,
+0x66, 0x6f, 0x6c, 0x6c, 0x6f, 0x77, 0x69, 0x6e,
+0x67, 0x20, 0x61, 0x72, 0x65, 0x20, 0x64, 0x65,
+0x73, 0x65, 0x72, 0x69, 0x61, 0x6c, 0x69, 0x7a,
+0x65, 0x64, 0x20, 0x74, 0x72, 0x61, 0x6e, 0x73,
+0x61, 0x63, 0x74, 0x69, 0x6f, 0x6e, 0x73, 0x20,
+0x77, 0x68, 0x69, 0x63, 0x68, 0x20, 0x61, 0x72,
+0x65, 0x20, 0x76, 0x61, 0x6c, 0x69, 0x64, 0x2e,
+0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x22, 0x54, 0x68,
+0x65, 0x79, 0x20, 0x61, 0x72, 0x65, 0x20, 0x69,
+0x6e, 0x20, 0x74, 0x68, 0x65, 0x20, 0x66, 0x6f,
+0x72, 0x6d, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x22,
+0x5b, 0x5b, 0x5b, 0x70, 0x72, 0x65, 0x76, 0x6f,
+0x75, 0x74, 0x20, 0x68, 0x61, 0x73, 0x68, 0x2c,
+0x20, 0x70, 0x72, 0x65, 0x76, 0x6f, 0x75, 0x74,
+0x20, 0x69, 0x6e, 0x64, 0x65, 0x78, 0x2c, 0x20,
+0x70, 0x72, 0x65, 0x76, 0x6f, 0x75, 0x74, 0x20,
+0x73, 0x63, 0x72, 0x69, 0x70, 0x74, 0x50, 0x75,
+0x62, 0x4b, 0x65, 0x79, 0x2c, 0x20, 0x61, 0x6d,
+0x6f, 0x75, 0x6e, 0x74, 0x3f, 0x5d, 0x2c, 0x20,
+0x5b, 0x69, 0x6e, 0x70, 0x75, 0x74, 0x20, 0x32,
+0x5d, 0x2c, 0x20, 0x2e, 0x2e, 0x2e, 0x5d, 0x2c,
+0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x22, 0x73, 0x65,
+0x72, 0x69, 0x61, 0x6c, 0x69, 0x7a, 0x65, 0x64,
+0x54, 0x72, 0x61, 0x6e, 0x73, 0x61, 0x63, 0x74,
+0x69, 0x6f, 0x6e, 0x2c, 0x20, 0x76, 0x65, 0x72,
+0x69, 0x66, 0x79, 0x46, 0x6c, 0x61, 0x67, 0x73,
+0x5d, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x22, 0x4f,
+0x62, 0x6a, 0x65, 0x63, 0x74, 0x73, 0x20, 0x74,
+0x68, 0x61, 0x74, 0x20, 0x61, 0x72, 0x65, 0x20,
+0x6f, 0x6e, 0x6c, 0x79, 0x20, 0x61, 0x20, 0x73,
+0x69, 0x6e, 0x67, 0x6c, 0x65, 0x20, 0x73, 0x74,
+0x72, 0x69, 0x6e, 0x67, 0x20, 0x28, 0x6c, 0x69,
+0x6b, 0x65, 0x20, 0x74, 0x68, 0x69, 0x73, 0x20,
+0x6f, 0x6e, 0x65, 0x29, 0x20, 0x61, 0x72, 0x65,
+0x20, 0x69, 0x67, 0x6e, 0x6f, 0x72, 0x65, 0x64,
+0x22, 0x5d, 0x2c, 0x0a, 0x0a, 0x5b, 0x22, 0x54,
+0x68, 0x65, 0x20, 0x66, 0x6f, 0x6c, 0x6c, 0x6f,
+0x77, 0x69, 0x6e, 0x67, 0x20, 0x69, 0x73, 0x20,
+0x32, 0x33, 0x62, 0x33, 0x39, 0x37, 0x65, 0x64,
+0x63, 0x63, 0x64, 0x33, 0x37, 0x34, 0x30, 0x61,
+0x37, 0x34, 0x61, 0x64, 0x62, 0x36, 0x30, 0x33,
+0x63, 0x39, 0x37, 0x35, 0x36, 0x33, 0x37, 0x30,
+0x66, 0x61, 0x66, 0x63, 0x64, 0x65, 0x39, 0x62,
+0x63, 0x63, 0x34, 0x34, 0x38, 0x33, 0x65, 0x62,
+0x32, 0x37, 0x31, 0x65, 0x63, 0x61, 0x64, 0x30,
+0x39, 0x61, 0x39, 0x34, 0x64, 0x64, 0x36, 0x33,
+0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x22, 0x49, 0x74,
+0x20, 0x69, 0x73, 0x20, 0x6f, 0x66, 0x20, 0x70,
+0x61, 0x72, 0x74, 0x69, 0x63, 0x75, 0x6c, 0x61,
+0x72, 0x20, 0x69, 0x6e, 0x74, 0x65, 0x72, 0x65,
+0x73, 0x74, 0x20, 0x62, 0x65, 0x63, 0x61, 0x75,
+0x73, 0x65, 0x20, 0x69, 0x74, 0x20, 0x63, 0x6f,
+0x6e, 0x74, 0x61, 0x69, 0x6e, 0x73, 0x20, 0x61,
+0x6e, 0x20, 0x69, 0x6e, 0x76, 0x61, 0x6c, 0x69,
+0x64, 0x6c, 0x79, 0x2d, 0x65, 0x6e, 0x63, 0x6f,
+0x64, 0x65, 0x64, 0x20, 0x73, 0x69, 0x67, 0x6e,
+0x61, 0x74, 0x75, 0x72, 0x65, 0x20, 0x77, 0x68,
+0x69, 0x63, 0x68, 0x20, 0x4f, 0x70, 0x65, 0x6e,
+0x53, 0x53, 0x4c, 0x20, 0x61, 0x63, 0x63, 0x65,
+0x70, 0x74, 0x73, 0x22, 0x5d, 0x2c, 0x0a, 0x5b,
+0x22, 0x53, 0x65, 0x65, 0x20, 0x68, 0x74, 0x74,
+0x70, 0x3a, 0x2f, 0x2f, 0x72, 0x36, 0x2e, 0x63,
+0x61, 0x2f, 0x62, 0x6c, 0x6f, 0x67, 0x2f, 0x32,
+0x30, 0x31, 0x31, 0x31, 0x31, 0x31, 0x39, 0x54,
+0x32, 0x31, 0x31, 0x35, 0x30, 0x34, 0x5a, 0x2e,
+0x68, 0x74, 0x6d, 0x6c, 0x22, 0x5d, 0x2c, 0x0a,
+0x5b, 0x22, 0x49, 0x74, 0x20, 0x69, 0x73, 0x20,
+0x61, 0x6c, 0x73, 0x6f, 0x20, 0x74, 0x68, 0x65,
+0x20, 0x66, 0x69, 0x72, 0x73, 0x74, 0x20, 0x4f,
+0x50, 0x5f, 0x43, 0x48, 0x45, 0x43, 0x4b, 0x4d,
+0x55, 0x4c, 0x54, 0x49, 0x53, 0x49, 0x47, 0x20,
+0x74, 0x72, 0x61, 0x6e, 0x73, 0x61, 0x63, 0x74,
+0x69, 0x6f, 0x6e, 0x20, 0x69, 0x6e, 0x20, 0x73,
+0x74, 0x61, 0x6e, 0x64, 0x61, 0x72, 0x64, 0x20,
+0x66, 0x6f, 0x72, 0x6d, 0x22, 0x5d, 0x2c, 0x0a,
+0x5b, 0x5b, 0x5b, 0x22, 0x36, 0x30, 0x61, 0x32,
+0x30, 0x62, 0x64, 0x39, 0x33, 0x61, 0x61, 0x34,
+0x39, 0x61, 0x62, 0x34, 0x62, 0x32, 0x38, 0x64,
+0x35, 0x31, 0x34, 0x65, 0x63, 0x31, 0x30, 0x62,
+0x30, 0x36, 0x65, 0x31, 0x38, 0x32, 0x39, 0x63,
+0x65, 0x36, 0x38, 0x31, 0x38, 0x65, 0x63, 0x30,
+0x36, 0x63, 0x64, 0x33, 0x61, 0x61, 0x62, 0x64,
+0x30, 0x31, 0x33, 0x65, 0x62, 0x63, 0x64, 0x63,
+0x34, 0x62, 0x62, 0x31, 0x22, 0x2c, 0x20, 0x30,
+0x2c, 0x20, 0x22, 0x31, 0x20, 0x30, 0x78, 0x34,
+0x31, 0x20, 0x30, 0x78, 0x30, 0x34, 0x63, 0x63,
+0x37, 0x31, 0x65, 0x62, 0x33, 0x30, 0x64, 0x36,
+0x35, 0x33, 0x63, 0x30, 0x63, 0x33, 0x31, 0x36,
+0x33, 0x39, 0x39, 0x30, 0x63, 0x34, 0x37, 0x62,
+0x39, 0x37, 0x36, 0x66, 0x33, 0x66, 0x62, 0x33,
+0x66, 0x33, 0x37, 0x63, 0x63, 0x63, 0x64, 0x63,
+0x62, 0x65, 0x64, 0x62, 0x31, 0x36, 0x39, 0x61,
+0x31, 0x64, 0x66, 0x65, 0x66, 0x35, 0x38, 0x62,
+0x62, 0x66, 0x62, 0x66, 0x61, 0x66, 0x66, 0x37,
+0x64, 0x38, 0x61, 0x34, 0x37, 0x33, 0x65, 0x37,
+0x65, 0x32, 0x65, 0x36, 0x64, 0x33, 0x31, 0x37,
+0x62, 0x38, 0x37, 0x62, 0x61, 0x66, 0x65, 0x38,
+0x62, 0x64, 0x65, 0x39, 0x37, 0x65, 0x33, 0x63,
+0x66, 0x38, 0x66, 0x30, 0x36, 0x35, 0x64, 0x65,
+0x63, 0x30, 0x32, 0x32, 0x62, 0x35, 0x31, 0x64,
+0x31, 0x31, 0x66, 0x63, 0x64, 0x64, 0x30, 0x64,
+0x33, 0x34, 0x38, 0x61, 0x63, 0x34, 0x20, 0x30,
+0x78, 0x34, 0x31, 0x20, 0x30, 0x78, 0x30, 0x34,
+0x36, 0x31, 0x63, 0x62, 0x64, 0x63, 0x63, 0x35,
+0x34, 0x30, 0x39, 0x66, 0x62, 0x34, 0x62, 0x34,
+0x64, 0x34, 0x32, 0x62, 0x35, 0x31, 0x64, 0x33,
+0x33, 0x33, 0x38, 0x31, 0x33, 0x35, 0x34, 0x64,
+0x38, 0x30, 0x65, 0x35, 0x35, 0x30, 0x30, 0x37,
+0x38, 0x63, 0x62, 0x35, 0x33, 0x32, 0x61, 0x33,
+0x34, 0x62, 0x66, 0x61, 0x32, 0x66, 0x63, 0x66,
+0x64, 0x65, 0x62, 0x37, 0x64, 0x37, 0x36, 0x35,
+0x31, 0x39, 0x61, 0x65, 0x63, 0x63, 0x36, 0x32,
+0x37, 0x37, 0x30, 0x66, 0x35, 0x62, 0x30, 0x65,
+0x34, 0x65, 0x66, 0x38, 0x35, 0x35, 0x31, 0x39,
+0x34, 0x36, 0x64, 0x38, 0x61, 0x35, 0x34, 0x30,
+0x39, 0x31, 0x31, 0x61, 0x62, 0x65, 0x33, 0x65,
+0x37, 0x38, 0x35, 0x34, 0x61, 0x32, 0x36, 0x66,
+0x33, 0x39, 0x66, 0x35, 0x38, 0x62, 0x32, 0x35,
+0x63, 0x31, 0x35, 0x33, 0x34, 0x32, 0x61, 0x66,
+0x20, 0x32, 0x20, 0x4f, 0x50, 0x5f, 0x43, 0x48,
+0x45, 0x43, 0x4b, 0x4d, 0x55, 0x4c, 0x54, 0x49,
+0x53, 0x49, 0x47, 0x22, 0x5d, 0x5d, 0x2c, 0x0a,
+0x22, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x31, 0x62, 0x31, 0x34, 0x62, 0x64,
+0x63, 0x62, 0x63, 0x33, 0x65, 0x30, 0x31, 0x62,
+0x64, 0x61, 0x61, 0x64, 0x33, 0x36, 0x63, 0x63,
+0x30, 0x38, 0x65, 0x38, 0x31, 0x65, 0x36, 0x39,
+0x63, 0x38, 0x32, 0x65, 0x31, 0x30, 0x36, 0x30,
+0x62, 0x63, 0x31, 0x34, 0x65, 0x35, 0x31, 0x38,
+0x64, 0x62, 0x32, 0x62, 0x34, 0x39, 0x61, 0x61,
+0x34, 0x33, 0x61, 0x64, 0x39, 0x30, 0x62, 0x61,
+0x32, 0x36, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x34, 0x39, 0x30, 0x30, 0x34,
+0x37, 0x33, 0x30, 0x34, 0x34, 0x30, 0x32, 0x32,
+0x30, 0x33, 0x66, 0x31, 0x36, 0x63, 0x36, 0x66,
+0x34, 0x30, 0x31, 0x36, 0x32, 0x61, 0x62, 0x36,
+0x38, 0x36, 0x36, 0x32, 0x31, 0x65, 0x66, 0x33,
+0x30, 0x30, 0x30, 0x62, 0x30, 0x34, 0x65, 0x37,
+0x35, 0x34, 0x31, 0x38, 0x61, 0x30, 0x63, 0x30,
+0x63, 0x62, 0x32, 0x64, 0x38, 0x61, 0x65, 0x62,
+0x65, 0x61, 0x63, 0x38, 0x39, 0x34, 0x61, 0x65,
+0x33, 0x36, 0x30, 0x61, 0x63, 0x31, 0x65, 0x37,
+0x38, 0x30, 0x32, 0x32, 0x30, 0x64, 0x64, 0x63,
+0x31, 0x35, 0x65, 0x63, 0x64, 0x66, 0x63, 0x33,
+0x35, 0x30, 0x37, 0x61, 0x63, 0x34, 0x38, 0x65,
+0x31, 0x36, 0x38, 0x31, 0x61, 0x33, 0x33, 0x65,
+0x62, 0x36, 0x30, 0x39, 0x39, 0x36, 0x36, 0x33,
+0x31, 0x62, 0x66, 0x36, 0x62, 0x66, 0x35, 0x62,
+0x63, 0x30, 0x61, 0x30, 0x36, 0x38, 0x32, 0x63,
+0x34, 0x64, 0x62, 0x37, 0x34, 0x33, 0x63, 0x65,
+0x37, 0x63, 0x61, 0x32, 0x62, 0x30, 0x31, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x30,
+0x31, 0x34, 0x30, 0x34, 0x32, 0x30, 0x66, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x39, 0x37, 0x36, 0x61, 0x39, 0x31,
+0x34, 0x36, 0x36, 0x30, 0x64, 0x34, 0x65, 0x66,
+0x33, 0x61, 0x37, 0x34, 0x33, 0x65, 0x33, 0x65,
+0x36, 0x39, 0x36, 0x61, 0x64, 0x39, 0x39, 0x30,
+0x33, 0x36, 0x34, 0x65, 0x35, 0x35, 0x35, 0x63,
+0x32, 0x37, 0x31, 0x61, 0x64, 0x35, 0x30, 0x34,
+0x62, 0x38, 0x38, 0x61, 0x63, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x22, 0x2c, 0x20,
+0x22, 0x50, 0x32, 0x53, 0x48, 0x22, 0x5d, 0x2c,
+0x0a, 0x0a, 0x5b, 0x22, 0x54, 0x68, 0x65, 0x20,
+0x66, 0x6f, 0x6c, 0x6c, 0x6f, 0x77, 0x69, 0x6e,
+0x67, 0x20, 0x69, 0x73, 0x20, 0x61, 0x20, 0x74,
+0x77, 0x65, 0x61, 0x6b, 0x65, 0x64, 0x20, 0x66,
+0x6f, 0x72, 0x6d, 0x20, 0x6f, 0x66, 0x20, 0x32,
+0x33, 0x62, 0x33, 0x39, 0x37, 0x65, 0x64, 0x63,
+0x63, 0x64, 0x33, 0x37, 0x34, 0x30, 0x61, 0x37,
+0x34, 0x61, 0x64, 0x62, 0x36, 0x30, 0x33, 0x63,
+0x39, 0x37, 0x35, 0x36, 0x33, 0x37, 0x30, 0x66,
+0x61, 0x66, 0x63, 0x64, 0x65, 0x39, 0x62, 0x63,
+0x63, 0x34, 0x34, 0x38, 0x33, 0x65, 0x62, 0x32,
+0x37, 0x31, 0x65, 0x63, 0x61, 0x64, 0x30, 0x39,
+0x61, 0x39, 0x34, 0x64, 0x64, 0x36, 0x33, 0x22,
+0x5d, 0x2c, 0x0a, 0x5b, 0x22, 0x49, 0x74, 0x20,
+0x69, 0x73, 0x20, 0x61, 0x6e, 0x20, 0x4f, 0x50,
+0x5f, 0x43, 0x48, 0x45, 0x43, 0x4b, 0x4d, 0x55,
+0x4c, 0x54, 0x49, 0x53, 0x49, 0x47, 0x20, 0x77,
+0x69, 0x74, 0x68, 0x20, 0x61, 0x6e, 0x20, 0x61,
+0x72, 0x62, 0x69, 0x74, 0x72, 0x61, 0x72, 0x79,
+0x20, 0x65, 0x78, 0x74, 0x72, 0x61, 0x20, 0x62,
+0x79, 0x74, 0x65, 0x20, 0x73, 0x74, 0x75, 0x66,
+0x66, 0x65, 0x64, 0x20, 0x69, 0x6e, 0x74, 0x6f,
+0x20, 0x74, 0x68, 0x65, 0x20, 0x73, 0x69, 0x67,
+0x6e, 0x61, 0x74, 0x75, 0x72, 0x65, 0x20, 0x61,
+0x74, 0x20, 0x70, 0x6f, 0x73, 0x20, 0x6c, 0x65,
+0x6e, 0x67, 0x74, 0x68, 0x20, 0x2d, 0x20, 0x32,
+0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x22, 0x54, 0x68,
+0x65, 0x20, 0x64, 0x75, 0x6d, 0x6d, 0x79, 0x20,
+0x62, 0x79, 0x74, 0x65, 0x20, 0x69, 0x73, 0x20,
+0x66, 0x69, 0x6e, 0x65, 0x20, 0x68, 0x6f, 0x77,
+0x65, 0x76, 0x65, 0x72, 0x2c, 0x20, 0x73, 0x6f,
+0x20, 0x74, 0x68, 0x65, 0x20, 0x4e, 0x55, 0x4c,
+0x4c, 0x44, 0x55, 0x4d, 0x4d, 0x59, 0x20, 0x66,
+0x6c, 0x61, 0x67, 0x20, 0x73, 0x68, 0x6f, 0x75,
+0x6c, 0x64, 0x20, 0x62, 0x65, 0x20, 0x68, 0x61,
+0x70, 0x70, 0x79, 0x22, 0x5d, 0x2c, 0x0a, 0x5b,
+0x5b, 0x5b, 0x22, 0x36, 0x30, 0x61, 0x32, 0x30,
+0x62, 0x64, 0x39, 0x33, 0x61, 0x61, 0x34, 0x39,
+0x61, 0x62, 0x34, 0x62, 0x32, 0x38, 0x64, 0x35,
+0x31, 0x34, 0x65, 0x63, 0x31, 0x30, 0x62, 0x30,
+0x36, 0x65, 0x31, 0x38, 0x32, 0x39, 0x63, 0x65,
+0x36, 0x38, 0x31, 0x38, 0x65, 0x63, 0x30, 0x36,
+0x63, 0x64, 0x33, 0x61, 0x61, 0x62, 0x64, 0x30,
+0x31, 0x33, 0x65, 0x62, 0x63, 0x64, 0x63, 0x34,
+0x62, 0x62, 0x31, 0x22, 0x2c, 0x20, 0x30, 0x2c,
+0x20, 0x22, 0x31, 0x20, 0x30, 0x78, 0x34, 0x31,
+0x20, 0x30, 0x78, 0x30, 0x34, 0x63, 0x63, 0x37,
+0x31, 0x65, 0x62, 0x33, 0x30, 0x64, 0x36, 0x35,
+0x33, 0x63, 0x30, 0x63, 0x33, 0x31, 0x36, 0x33,
+0x39, 0x39, 0x30, 0x63, 0x34, 0x37, 0x62, 0x39,
+0x37, 0x36, 0x66, 0x33, 0x66, 0x62, 0x33, 0x66,
+0x33, 0x37, 0x63, 0x63, 0x63, 0x64, 0x63, 0x62,
+0x65, 0x64, 0x62, 0x31, 0x36, 0x39, 0x61, 0x31,
+0x64, 0x66, 0x65, 0x66, 0x35, 0x38, 0x62, 0x62,
+0x66, 0x62, 0x66, 0x61, 0x66, 0x66, 0x37, 0x64,
+0x38, 0x61, 0x34, 0x37, 0x33, 0x65, 0x37, 0x65,
+0x32, 0x65, 0x36, 0x64, 0x33, 0x31, 0x37, 0x62,
+0x38, 0x37, 0x62, 0x61, 0x66, 0x65, 0x38, 0x62,
+0x64, 0x65, 0x39, 0x37, 0x65, 0x33, 0x63, 0x66,
+0x38, 0x66, 0x30, 0x36, 0x35, 0x64, 0x65, 0x63,
+0x30, 0x32, 0x32, 0x62, 0x35, 0x31, 0x64, 0x31,
+0x31, 0x66, 0x63, 0x64, 0x64, 0x30, 0x64, 0x33,
+0x34, 0x38, 0x61, 0x63, 0x34, 0x20, 0x30, 0x78,
+0x34, 0x31, 0x20, 0x30, 0x78, 0x30, 0x34, 0x36,
+0x31, 0x63, 0x62, 0x64, 0x63, 0x63, 0x35, 0x34,
+0x30, 0x39, 0x66, 0x62, 0x34, 0x62, 0x34, 0x64,
+0x34, 0x32, 0x62, 0x35, 0x31, 0x64, 0x33, 0x33,
+0x33, 0x38, 0x31, 0x33, 0x35, 0x34, 0x64, 0x38,
+0x30, 0x65, 0x35, 0x35, 0x30, 0x30, 0x37, 0x38,
+0x63, 0x62, 0x35, 0x33, 0x32, 0x61, 0x33, 0x34,
+0x62, 0x66, 0x61, 0x32, 0x66, 0x63, 0x66, 0x64,
+0x65, 0x62, 0x37, 0x64, 0x37, 0x36, 0x35, 0x31,
+0x39, 0x61, 0x65, 0x63, 0x63, 0x36, 0x32, 0x37,
+0x37, 0x30, 0x66, 0x35, 0x62, 0x30, 0x65, 0x34,
+0x65, 0x66, 0x38, 0x35, 0x35, 0x31, 0x39, 0x34,
+0x36, 0x64, 0x38, 0x61, 0x35, 0x34, 0x30, 0x39,
+0x31, 0x31, 0x61, 0x62, 0x65, 0x33, 0x65, 0x37,
+0x38, 0x35, 0x34, 0x61, 0x32, 0x36, 0x66, 0x33,
+0x39, 0x66, 0x35, 0x38, 0x62, 0x32, 0x35, 0x63,
+0x31, 0x35, 0x33, 0x34, 0x32, 0x61, 0x66, 0x20,
+0x32, 0x20, 0x4f, 0x50, 0x5f, 0x43, 0x48, 0x45,
+0x43, 0x4b, 0x4d, 0x55, 0x4c, 0x54, 0x49, 0x53,
+0x49, 0x47, 0x22, 0x5d, 0x5d, 0x2c, 0x0a, 0x22,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x62, 0x31, 0x34, 0x62, 0x64, 0x63,
+0x62, 0x63, 0x33, 0x65, 0x30, 0x31, 0x62, 0x64,
+0x61, 0x61, 0x64, 0x33, 0x36, 0x63, 0x63, 0x30,
+0x38, 0x65, 0x38, 0x31, 0x65, 0x36, 0x39, 0x63,
+0x38, 0x32, 0x65, 0x31, 0x30, 0x36, 0x30, 0x62,
+0x63, 0x31, 0x34, 0x65, 0x35, 0x31, 0x38, 0x64,
+0x62, 0x32, 0x62, 0x34, 0x39, 0x61, 0x61, 0x34,
+0x33, 0x61, 0x64, 0x39, 0x30, 0x62, 0x61, 0x32,
+0x36, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x34, 0x61, 0x30, 0x30, 0x34, 0x38,
+0x33, 0x30, 0x34, 0x34, 0x30, 0x32, 0x32, 0x30,
+0x33, 0x66, 0x31, 0x36, 0x63, 0x36, 0x66, 0x34,
+0x30, 0x31, 0x36, 0x32, 0x61, 0x62, 0x36, 0x38,
+0x36, 0x36, 0x32, 0x31, 0x65, 0x66, 0x33, 0x30,
+0x30, 0x30, 0x62, 0x30, 0x34, 0x65, 0x37, 0x35,
+0x34, 0x31, 0x38, 0x61, 0x30, 0x63, 0x30, 0x63,
+0x62, 0x32, 0x64, 0x38, 0x61, 0x65, 0x62, 0x65,
+0x61, 0x63, 0x38, 0x39, 0x34, 0x61, 0x65, 0x33,
+0x36, 0x30, 0x61, 0x63, 0x31, 0x65, 0x37, 0x38,
+0x30, 0x32, 0x32, 0x30, 0x64, 0x64, 0x63, 0x31,
+0x35, 0x65, 0x63, 0x64, 0x66, 0x63, 0x33, 0x35,
+0x30, 0x37, 0x61, 0x63, 0x34, 0x38, 0x65, 0x31,
+0x36, 0x38, 0x31, 0x61, 0x33, 0x33, 0x65, 0x62,
+0x36, 0x30, 0x39, 0x39, 0x36, 0x36, 0x33, 0x31,
+0x62, 0x66, 0x36, 0x62, 0x66, 0x35, 0x62, 0x63,
+0x30, 0x61, 0x30, 0x36, 0x38, 0x32, 0x63, 0x34,
+0x64, 0x62, 0x37, 0x34, 0x33, 0x63, 0x65, 0x37,
+0x63, 0x61, 0x32, 0x62, 0x61, 0x62, 0x30, 0x31,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x30, 0x31, 0x34, 0x30, 0x34, 0x32, 0x30, 0x66,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x31, 0x39, 0x37, 0x36, 0x61, 0x39,
+0x31, 0x34, 0x36, 0x36, 0x30, 0x64, 0x34, 0x65,
+0x66, 0x33, 0x61, 0x37, 0x34, 0x33, 0x65, 0x33,
+0x65, 0x36, 0x39, 0x36, 0x61, 0x64, 0x39, 0x39,
+0x30, 0x33, 0x36, 0x34, 0x65, 0x35, 0x35, 0x35,
+0x63, 0x32, 0x37, 0x31, 0x61, 0x64, 0x35, 0x30,
+0x34, 0x62, 0x38, 0x38, 0x61, 0x63, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x22, 0x2c,
+0x20, 0x22, 0x50, 0x32, 0x53, 0x48, 0x2c, 0x4e,
+0x55, 0x4c, 0x4c, 0x44, 0x55, 0x4d, 0x4d, 0x59,
+0x22, 0x5d, 0x2c, 0x0a, 0x0a, 0x5b, 0x22, 0x54,
+0x68, 0x65, 0x20, 0x66, 0x6f, 0x6c, 0x6c, 0x6f,
+0x77, 0x69, 0x6e, 0x67, 0x20, 0x69, 0x73, 0x20,
+0x61, 0x20, 0x74, 0x77, 0x65, 0x61, 0x6b, 0x65,
+0x64, 0x20, 0x66, 0x6f, 0x72, 0x6d, 0x20, 0x6f,
+0x66, 0x20, 0x32, 0x33, 0x62, 0x33, 0x39, 0x37,
+0x65, 0x64, 0x63, 0x63, 0x64, 0x33, 0x37, 0x34,
+0x30, 0x61, 0x37, 0x34, 0x61, 0x64, 0x62, 0x36,
+0x30, 0x33, 0x63, 0x39, 0x37, 0x35, 0x36, 0x33,
+0x37, 0x30, 0x66, 0x61, 0x66, 0x63, 0x64, 0x65,
+0x39, 0x62, 0x63, 0x63, 0x34, 0x34, 0x38, 0x33,
+0x65, 0x62, 0x32, 0x37, 0x31, 0x65, 0x63, 0x61,
+0x64, 0x30, 0x39, 0x61, 0x39, 0x34, 0x64, 0x64,
+0x36, 0x33, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x22,
+0x49, 0x74, 0x20, 0x69, 0x73, 0x20, 0x61, 0x6e,
+0x20, 0x4f, 0x50, 0x5f, 0x43, 0x48, 0x45, 0x43,
+0x4b, 0x4d, 0x55, 0x4c, 0x54, 0x49, 0x53, 0x49,
+0x47, 0x20, 0x77, 0x69, 0x74, 0x68, 0x20, 0x74,
+0x68, 0x65, 0x20, 0x64, 0x75, 0x6d, 0x6d, 0x79,
+0x20, 0x76, 0x61, 0x6c, 0x75, 0x65, 0x20, 0x73,
+0x65, 0x74, 0x20, 0x74, 0x6f, 0x20, 0x73, 0x6f,
+0x6d, 0x65, 0x74, 0x68, 0x69, 0x6e, 0x67, 0x20,
+0x6f, 0x74, 0x68, 0x65, 0x72, 0x20, 0x74, 0x68,
+0x61, 0x6e, 0x20, 0x61, 0x6e, 0x20, 0x65, 0x6d,
+0x70, 0x74, 0x79, 0x20, 0x73, 0x74, 0x72, 0x69,
+0x6e, 0x67, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b,
+0x5b, 0x22, 0x36, 0x30, 0x61, 0x32, 0x30, 0x62,
+0x64, 0x39, 0x33, 0x61, 0x61, 0x34, 0x39, 0x61,
+0x62, 0x34, 0x62, 0x32, 0x38, 0x64, 0x35, 0x31,
+0x34, 0x65, 0x63, 0x31, 0x30, 0x62, 0x30, 0x36,
+0x65, 0x31, 0x38, 0x32, 0x39, 0x63, 0x65, 0x36,
+0x38, 0x31, 0x38, 0x65, 0x63, 0x30, 0x36, 0x63,
+0x64, 0x33, 0x61, 0x61, 0x62, 0x64, 0x30, 0x31,
+0x33, 0x65, 0x62, 0x63, 0x64, 0x63, 0x34, 0x62,
+0x62, 0x31, 0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20,
+0x22, 0x31, 0x20, 0x30, 0x78, 0x34, 0x31, 0x20,
+0x30, 0x78, 0x30, 0x34, 0x63, 0x63, 0x37, 0x31,
+0x65, 0x62, 0x33, 0x30, 0x64, 0x36, 0x35, 0x33,
+0x63, 0x30, 0x63, 0x33, 0x31, 0x36, 0x33, 0x39,
+0x39, 0x30, 0x63, 0x34, 0x37, 0x62, 0x39, 0x37,
+0x36, 0x66, 0x33, 0x66, 0x62, 0x33, 0x66, 0x33,
+0x37, 0x63, 0x63, 0x63, 0x64, 0x63, 0x62, 0x65,
+0x64, 0x62, 0x31, 0x36, 0x39, 0x61, 0x31, 0x64,
+0x66, 0x65, 0x66, 0x35, 0x38, 0x62, 0x62, 0x66,
+0x62, 0x66, 0x61, 0x66, 0x66, 0x37, 0x64, 0x38,
+0x61, 0x34, 0x37, 0x33, 0x65, 0x37, 0x65, 0x32,
+0x65, 0x36, 0x64, 0x33, 0x31, 0x37, 0x62, 0x38,
+0x37, 0x62, 0x61, 0x66, 0x65, 0x38, 0x62, 0x64,
+0x65, 0x39, 0x37, 0x65, 0x33, 0x63, 0x66, 0x38,
+0x66, 0x30, 0x36, 0x35, 0x64, 0x65, 0x63, 0x30,
+0x32, 0x32, 0x62, 0x35, 0x31, 0x64, 0x31, 0x31,
+0x66, 0x63, 0x64, 0x64, 0x30, 0x64, 0x33, 0x34,
+0x38, 0x61, 0x63, 0x34, 0x20, 0x30, 0x78, 0x34,
+0x31, 0x20, 0x30, 0x78, 0x30, 0x34, 0x36, 0x31,
+0x63, 0x62, 0x64, 0x63, 0x63, 0x35, 0x34, 0x30,
+0x39, 0x66, 0x62, 0x34, 0x62, 0x34, 0x64, 0x34,
+0x32, 0x62, 0x35, 0x31, 0x64, 0x33, 0x33, 0x33,
+0x38, 0x31, 0x33, 0x35, 0x34, 0x64, 0x38, 0x30,
+0x65, 0x35, 0x35, 0x30, 0x30, 0x37, 0x38, 0x63,
+0x62, 0x35, 0x33, 0x32, 0x61, 0x33, 0x34, 0x62,
+0x66, 0x61, 0x32, 0x66, 0x63, 0x66, 0x64, 0x65,
+0x62, 0x37, 0x64, 0x37, 0x36, 0x35, 0x31, 0x39,
+0x61, 0x65, 0x63, 0x63, 0x36, 0x32, 0x37, 0x37,
+0x30, 0x66, 0x35, 0x62, 0x30, 0x65, 0x34, 0x65,
+0x66, 0x38, 0x35, 0x35, 0x31, 0x39, 0x34, 0x36,
+0x64, 0x38, 0x61, 0x35, 0x34, 0x30, 0x39, 0x31,
+0x31, 0x61, 0x62, 0x65, 0x33, 0x65, 0x37, 0x38,
+0x35, 0x34, 0x61, 0x32, 0x36, 0x66, 0x33, 0x39,
+0x66, 0x35, 0x38, 0x62, 0x32, 0x35, 0x63, 0x31,
+0x35, 0x33, 0x34, 0x32, 0x61, 0x66, 0x20, 0x32,
+0x20, 0x4f, 0x50, 0x5f, 0x43, 0x48, 0x45, 0x43,
+0x4b, 0x4d, 0x55, 0x4c, 0x54, 0x49, 0x53, 0x49,
+0x47, 0x22, 0x5d, 0x5d, 0x2c, 0x0a, 0x22, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x62, 0x31, 0x34, 0x62, 0x64, 0x63, 0x62,
+0x63, 0x33, 0x65, 0x30, 0x31, 0x62, 0x64, 0x61,
+0x61, 0x64, 0x33, 0x36, 0x63, 0x63, 0x30, 0x38,
+0x65, 0x38, 0x31, 0x65, 0x36, 0x39, 0x63, 0x38,
+0x32, 0x65, 0x31, 0x30, 0x36, 0x30, 0x62, 0x63,
+0x31, 0x34, 0x65, 0x35, 0x31, 0x38, 0x64, 0x62,
+0x32, 0x62, 0x34, 0x39, 0x61, 0x61, 0x34, 0x33,
+0x61, 0x64, 0x39, 0x30, 0x62, 0x61, 0x32, 0x36,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x34, 0x61, 0x30, 0x31, 0x66, 0x66, 0x34,
+0x37, 0x33, 0x30, 0x34, 0x34, 0x30, 0x32, 0x32,
+0x30, 0x33, 0x66, 0x31, 0x36, 0x63, 0x36, 0x66,
+0x34, 0x30, 0x31, 0x36, 0x32, 0x61, 0x62, 0x36,
+0x38, 0x36, 0x36, 0x32, 0x31, 0x65, 0x66, 0x33,
+0x30, 0x30, 0x30, 0x62, 0x30, 0x34, 0x65, 0x37,
+0x35, 0x34, 0x31, 0x38, 0x61, 0x30, 0x63, 0x30,
+0x63, 0x62, 0x32, 0x64, 0x38, 0x61, 0x65, 0x62,
+0x65, 0x61, 0x63, 0x38, 0x39, 0x34, 0x61, 0x65,
+0x33, 0x36, 0x30, 0x61, 0x63, 0x31, 0x65, 0x37,
+0x38, 0x30, 0x32, 0x32, 0x30, 0x64, 0x64, 0x63,
+0x31, 0x35, 0x65, 0x63, 0x64, 0x66, 0x63, 0x33,
+0x35, 0x30, 0x37, 0x61, 0x63, 0x34, 0x38, 0x65,
+0x31, 0x36, 0x38, 0x31, 0x61, 0x33, 0x33, 0x65,
+0x62, 0x36, 0x30, 0x39, 0x39, 0x36, 0x36, 0x33,
+0x31, 0x62, 0x66, 0x36, 0x62, 0x66, 0x35, 0x62,
+0x63, 0x30, 0x61, 0x30, 0x36, 0x38, 0x32, 0x63,
+0x34, 0x64, 0x62, 0x37, 0x34, 0x33, 0x63, 0x65,
+0x37, 0x63, 0x61, 0x32, 0x62, 0x30, 0x31, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x30,
+0x31, 0x34, 0x30, 0x34, 0x32, 0x30, 0x66, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x39, 0x37, 0x36, 0x61, 0x39, 0x31,
+0x34, 0x36, 0x36, 0x30, 0x64, 0x34, 0x65, 0x66,
+0x33, 0x61, 0x37, 0x34, 0x33, 0x65, 0x33, 0x65,
+0x36, 0x39, 0x36, 0x61, 0x64, 0x39, 0x39, 0x30,
+0x33, 0x36, 0x34, 0x65, 0x35, 0x35, 0x35, 0x63,
+0x32, 0x37, 0x31, 0x61, 0x64, 0x35, 0x30, 0x34,
+0x62, 0x38, 0x38, 0x61, 0x63, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x22, 0x2c, 0x20,
+0x22, 0x50, 0x32, 0x53, 0x48, 0x22, 0x5d, 0x2c,
+0x0a, 0x0a, 0x5b, 0x22, 0x41, 0x73, 0x20, 0x61,
+0x62, 0x6f, 0x76, 0x65, 0x2c, 0x20, 0x62, 0x75,
+0x74, 0x20, 0x75, 0x73, 0x69, 0x6e, 0x67, 0x20,
+0x61, 0x6e, 0x20, 0x4f, 0x50, 0x5f, 0x31, 0x22,
+0x5d, 0x2c, 0x0a, 0x5b, 0x5b, 0x5b, 0x22, 0x36,
+0x30, 0x61, 0x32, 0x30, 0x62, 0x64, 0x39, 0x33,
+0x61, 0x61, 0x34, 0x39, 0x61, 0x62, 0x34, 0x62,
+0x32, 0x38, 0x64, 0x35, 0x31, 0x34, 0x65, 0x63,
+0x31, 0x30, 0x62, 0x30, 0x36, 0x65, 0x31, 0x38,
+0x32, 0x39, 0x63, 0x65, 0x36, 0x38, 0x31, 0x38,
+0x65, 0x63, 0x30, 0x36, 0x63, 0x64, 0x33, 0x61,
+0x61, 0x62, 0x64, 0x30, 0x31, 0x33, 0x65, 0x62,
+0x63, 0x64, 0x63, 0x34, 0x62, 0x62, 0x31, 0x22,
+0x2c, 0x20, 0x30, 0x2c, 0x20, 0x22, 0x31, 0x20,
+0x30, 0x78, 0x34, 0x31, 0x20, 0x30, 0x78, 0x30,
+0x34, 0x63, 0x63, 0x37, 0x31, 0x65, 0x62, 0x33,
+0x30, 0x64, 0x36, 0x35, 0x33, 0x63, 0x30, 0x63,
+0x33, 0x31, 0x36, 0x33, 0x39, 0x39, 0x30, 0x63,
+0x34, 0x37, 0x62, 0x39, 0x37, 0x36, 0x66, 0x33,
+0x66, 0x62, 0x33, 0x66, 0x33, 0x37, 0x63, 0x63,
+0x63, 0x64, 0x63, 0x62, 0x65, 0x64, 0x62, 0x31,
+0x36, 0x39, 0x61, 0x31, 0x64, 0x66, 0x65, 0x66,
+0x35, 0x38, 0x62, 0x62, 0x66, 0x62, 0x66, 0x61,
+0x66, 0x66, 0x37, 0x64, 0x38, 0x61, 0x34, 0x37,
+0x33, 0x65, 0x37, 0x65, 0x32, 0x65, 0x36, 0x64,
+0x33, 0x31, 0x37, 0x62, 0x38, 0x37, 0x62, 0x61,
+0x66, 0x65, 0x38, 0x62, 0x64, 0x65, 0x39, 0x37,
+0x65, 0x33, 0x63, 0x66, 0x38, 0x66, 0x30, 0x36,
+0x35, 0x64, 0x65, 0x63, 0x30, 0x32, 0x32, 0x62,
+0x35, 0x31, 0x64, 0x31, 0x31, 0x66, 0x63, 0x64,
+0x64, 0x30, 0x64, 0x33, 0x34, 0x38, 0x61, 0x63,
+0x34, 0x20, 0x30, 0x78, 0x34, 0x31, 0x20, 0x30,
+0x78, 0x30, 0x34, 0x36, 0x31, 0x63, 0x62, 0x64,
+0x63, 0x63, 0x35, 0x34, 0x30, 0x39, 0x66, 0x62,
+0x34, 0x62, 0x34, 0x64, 0x34, 0x32, 0x62, 0x35,
+0x31, 0x64, 0x33, 0x33, 0x33, 0x38, 0x31, 0x33,
+0x35, 0x34, 0x64, 0x38, 0x30, 0x65, 0x35, 0x35,
+0x30, 0x30, 0x37, 0x38, 0x63, 0x62, 0x35, 0x33,
+0x32, 0x61, 0x33, 0x34, 0x62, 0x66, 0x61, 0x32,
+0x66, 0x63, 0x66, 0x64, 0x65, 0x62, 0x37, 0x64,
+0x37, 0x36, 0x35, 0x31, 0x39, 0x61, 0x65, 0x63,
+0x63, 0x36, 0x32, 0x37, 0x37, 0x30, 0x66, 0x35,
+0x62, 0x30, 0x65, 0x34, 0x65, 0x66, 0x38, 0x35,
+0x35, 0x31, 0x39, 0x34, 0x36, 0x64, 0x38, 0x61,
+0x35, 0x34, 0x30, 0x39, 0x31, 0x31, 0x61, 0x62,
+0x65, 0x33, 0x65, 0x37, 0x38, 0x35, 0x34, 0x61,
+0x32, 0x36, 0x66, 0x33, 0x39, 0x66, 0x35, 0x38,
+0x62, 0x32, 0x35, 0x63, 0x31, 0x35, 0x33, 0x34,
+0x32, 0x61, 0x66, 0x20, 0x32, 0x20, 0x4f, 0x50,
+0x5f, 0x43, 0x48, 0x45, 0x43, 0x4b, 0x4d, 0x55,
+0x4c, 0x54, 0x49, 0x53, 0x49, 0x47, 0x22, 0x5d,
+0x5d, 0x2c, 0x0a, 0x22, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x62, 0x31,
+0x34, 0x62, 0x64, 0x63, 0x62, 0x63, 0x33, 0x65,
+0x30, 0x31, 0x62, 0x64, 0x61, 0x61, 0x64, 0x33,
+0x36, 0x63, 0x63, 0x30, 0x38, 0x65, 0x38, 0x31,
+0x65, 0x36, 0x39, 0x63, 0x38, 0x32, 0x65, 0x31,
+0x30, 0x36, 0x30, 0x62, 0x63, 0x31, 0x34, 0x65,
+0x35, 0x31, 0x38, 0x64, 0x62, 0x32, 0x62, 0x34,
+0x39, 0x61, 0x61, 0x34, 0x33, 0x61, 0x64, 0x39,
+0x30, 0x62, 0x61, 0x32, 0x36, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x34, 0x39,
+0x35, 0x31, 0x34, 0x37, 0x33, 0x30, 0x34, 0x34,
+0x30, 0x32, 0x32, 0x30, 0x33, 0x66, 0x31, 0x36,
+0x63, 0x36, 0x66, 0x34, 0x30, 0x31, 0x36, 0x32,
+0x61, 0x62, 0x36, 0x38, 0x36, 0x36, 0x32, 0x31,
+0x65, 0x66, 0x33, 0x30, 0x30, 0x30, 0x62, 0x30,
+0x34, 0x65, 0x37, 0x35, 0x34, 0x31, 0x38, 0x61,
+0x30, 0x63, 0x30, 0x63, 0x62, 0x32, 0x64, 0x38,
+0x61, 0x65, 0x62, 0x65, 0x61, 0x63, 0x38, 0x39,
+0x34, 0x61, 0x65, 0x33, 0x36, 0x30, 0x61, 0x63,
+0x31, 0x65, 0x37, 0x38, 0x30, 0x32, 0x32, 0x30,
+0x64, 0x64, 0x63, 0x31, 0x35, 0x65, 0x63, 0x64,
+0x66, 0x63, 0x33, 0x35, 0x30, 0x37, 0x61, 0x63,
+0x34, 0x38, 0x65, 0x31, 0x36, 0x38, 0x31, 0x61,
+0x33, 0x33, 0x65, 0x62, 0x36, 0x30, 0x39, 0x39,
+0x36, 0x36, 0x33, 0x31, 0x62, 0x66, 0x36, 0x62,
+0x66, 0x35, 0x62, 0x63, 0x30, 0x61, 0x30, 0x36,
+0x38, 0x32, 0x63, 0x34, 0x64, 0x62, 0x37, 0x34,
+0x33, 0x63, 0x65, 0x37, 0x63, 0x61, 0x32, 0x62,
+0x30, 0x31, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x30, 0x31, 0x34, 0x30, 0x34, 0x32,
+0x30, 0x66, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x31, 0x39, 0x37, 0x36,
+0x61, 0x39, 0x31, 0x34, 0x36, 0x36, 0x30, 0x64,
+0x34, 0x65, 0x66, 0x33, 0x61, 0x37, 0x34, 0x33,
+0x65, 0x33, 0x65, 0x36, 0x39, 0x36, 0x61, 0x64,
+0x39, 0x39, 0x30, 0x33, 0x36, 0x34, 0x65, 0x35,
+0x35, 0x35, 0x63, 0x32, 0x37, 0x31, 0x61, 0x64,
+0x35, 0x30, 0x34, 0x62, 0x38, 0x38, 0x61, 0x63,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x22, 0x2c, 0x20, 0x22, 0x50, 0x32, 0x53, 0x48,
+0x22, 0x5d, 0x2c, 0x0a, 0x0a, 0x5b, 0x22, 0x41,
+0x73, 0x20, 0x61, 0x62, 0x6f, 0x76, 0x65, 0x2c,
+0x20, 0x62, 0x75, 0x74, 0x20, 0x75, 0x73, 0x69,
+0x6e, 0x67, 0x20, 0x61, 0x6e, 0x20, 0x4f, 0x50,
+0x5f, 0x31, 0x4e, 0x45, 0x47, 0x41, 0x54, 0x45,
+0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b, 0x5b, 0x22,
+0x36, 0x30, 0x61, 0x32, 0x30, 0x62, 0x64, 0x39,
+0x33, 0x61, 0x61, 0x34, 0x39, 0x61, 0x62, 0x34,
+0x62, 0x32, 0x38, 0x64, 0x35, 0x31, 0x34, 0x65,
+0x63, 0x31, 0x30, 0x62, 0x30, 0x36, 0x65, 0x31,
+0x38, 0x32, 0x39, 0x63, 0x65, 0x36, 0x38, 0x31,
+0x38, 0x65, 0x63, 0x30, 0x36, 0x63, 0x64, 0x33,
+0x61, 0x61, 0x62, 0x64, 0x30, 0x31, 0x33, 0x65,
+0x62, 0x63, 0x64, 0x63, 0x34, 0x62, 0x62, 0x31,
+0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20, 0x22, 0x31,
+0x20, 0x30, 0x78, 0x34, 0x31, 0x20, 0x30, 0x78,
+0x30, 0x34, 0x63, 0x63, 0x37, 0x31, 0x65, 0x62,
+0x33, 0x30, 0x64, 0x36, 0x35, 0x33, 0x63, 0x30,
+0x63, 0x33, 0x31, 0x36, 0x33, 0x39, 0x39, 0x30,
+0x63, 0x34, 0x37, 0x62, 0x39, 0x37, 0x36, 0x66,
+0x33, 0x66, 0x62, 0x33, 0x66, 0x33, 0x37, 0x63,
+0x63, 0x63, 0x64, 0x63, 0x62, 0x65, 0x64, 0x62,
+0x31, 0x36, 0x39, 0x61, 0x31, 0x64, 0x66, 0x65,
+0x66, 0x35, 0x38, 0x62, 0x62, 0x66, 0x62, 0x66,
+0x61, 0x66, 0x66, 0x37, 0x64, 0x38, 0x61, 0x34,
+0x37, 0x33, 0x65, 0x37, 0x65, 0x32, 0x65, 0x36,
+0x64, 0x33, 0x31, 0x37, 0x62, 0x38, 0x37, 0x62,
+0x61, 0x66, 0x65, 0x38, 0x62, 0x64, 0x65, 0x39,
+0x37, 0x65, 0x33, 0x63, 0x66, 0x38, 0x66, 0x30,
+0x36, 0x35, 0x64, 0x65, 0x63, 0x30, 0x32, 0x32,
+0x62, 0x35, 0x31, 0x64, 0x31, 0x31, 0x66, 0x63,
+0x64, 0x64, 0x30, 0x64, 0x33, 0x34, 0x38, 0x61,
+0x63, 0x34, 0x20, 0x30, 0x78, 0x34, 0x31, 0x20,
+0x30, 0x78, 0x30, 0x34, 0x36, 0x31, 0x63, 0x62,
+0x64, 0x63, 0x63, 0x35, 0x34, 0x30, 0x39, 0x66,
+0x62, 0x34, 0x62, 0x34, 0x64, 0x34, 0x32, 0x62,
+0x35, 0x31, 0x64, 0x33, 0x33, 0x33, 0x38, 0x31,
+0x33, 0x35, 0x34, 0x64, 0x38, 0x30, 0x65, 0x35,
+0x35, 0x30, 0x30, 0x37, 0x38, 0x63, 0x62, 0x35,
+0x33, 0x32, 0x61, 0x33, 0x34, 0x62, 0x66, 0x61,
+0x32, 0x66, 0x63, 0x66, 0x64, 0x65, 0x62, 0x37,
+0x64, 0x37, 0x36, 0x35, 0x31, 0x39, 0x61, 0x65,
+0x63, 0x63, 0x36, 0x32, 0x37, 0x37, 0x30, 0x66,
+0x35, 0x62, 0x30, 0x65, 0x34, 0x65, 0x66, 0x38,
+0x35, 0x35, 0x31, 0x39, 0x34, 0x36, 0x64, 0x38,
+0x61, 0x35, 0x34, 0x30, 0x39, 0x31, 0x31, 0x61,
+0x62, 0x65, 0x33, 0x65, 0x37, 0x38, 0x35, 0x34,
+0x61, 0x32, 0x36, 0x66, 0x33, 0x39, 0x66, 0x35,
+0x38, 0x62, 0x32, 0x35, 0x63, 0x31, 0x35, 0x33,
+0x34, 0x32, 0x61, 0x66, 0x20, 0x32, 0x20, 0x4f,
+0x50, 0x5f, 0x43, 0x48, 0x45, 0x43, 0x4b, 0x4d,
+0x55, 0x4c, 0x54, 0x49, 0x53, 0x49, 0x47, 0x22,
+0x5d, 0x5d, 0x2c, 0x0a, 0x22, 0x30, 0x31, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x62,
+0x31, 0x34, 0x62, 0x64, 0x63, 0x62, 0x63, 0x33,
+0x65, 0x30, 0x31, 0x62, 0x64, 0x61, 0x61, 0x64,
+0x33, 0x36, 0x63, 0x63, 0x30, 0x38, 0x65, 0x38,
+0x31, 0x65, 0x36, 0x39, 0x63, 0x38, 0x32, 0x65,
+0x31, 0x30, 0x36, 0x30, 0x62, 0x63, 0x31, 0x34,
+0x65, 0x35, 0x31, 0x38, 0x64, 0x62, 0x32, 0x62,
+0x34, 0x39, 0x61, 0x61, 0x34, 0x33, 0x61, 0x64,
+0x39, 0x30, 0x62, 0x61, 0x32, 0x36, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x34,
+0x39, 0x34, 0x66, 0x34, 0x37, 0x33, 0x30, 0x34,
+0x34, 0x30, 0x32, 0x32, 0x30, 0x33, 0x66, 0x31,
+0x36, 0x63, 0x36, 0x66, 0x34, 0x30, 0x31, 0x36,
+0x32, 0x61, 0x62, 0x36, 0x38, 0x36, 0x36, 0x32,
+0x31, 0x65, 0x66, 0x33, 0x30, 0x30, 0x30, 0x62,
+0x30, 0x34, 0x65, 0x37, 0x35, 0x34, 0x31, 0x38,
+0x61, 0x30, 0x63, 0x30, 0x63, 0x62, 0x32, 0x64,
+0x38, 0x61, 0x65, 0x62, 0x65, 0x61, 0x63, 0x38,
+0x39, 0x34, 0x61, 0x65, 0x33, 0x36, 0x30, 0x61,
+0x63, 0x31, 0x65, 0x37, 0x38, 0x30, 0x32, 0x32,
+0x30, 0x64, 0x64, 0x63, 0x31, 0x35, 0x65, 0x63,
+0x64, 0x66, 0x63, 0x33, 0x35, 0x30, 0x37, 0x61,
+0x63, 0x34, 0x38, 0x65, 0x31, 0x36, 0x38, 0x31,
+0x61, 0x33, 0x33, 0x65, 0x62, 0x36, 0x30, 0x39,
+0x39, 0x36, 0x36, 0x33, 0x31, 0x62, 0x66, 0x36,
+0x62, 0x66, 0x35, 0x62, 0x63, 0x30, 0x61, 0x30,
+0x36, 0x38, 0x32, 0x63, 0x34, 0x64, 0x62, 0x37,
+0x34, 0x33, 0x63, 0x65, 0x37, 0x63, 0x61, 0x32,
+0x62, 0x30, 0x31, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x30, 0x31, 0x34, 0x30, 0x34,
+0x32, 0x30, 0x66, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x39, 0x37,
+0x36, 0x61, 0x39, 0x31, 0x34, 0x36, 0x36, 0x30,
+0x64, 0x34, 0x65, 0x66, 0x33, 0x61, 0x37, 0x34,
+0x33, 0x65, 0x33, 0x65, 0x36, 0x39, 0x36, 0x61,
+0x64, 0x39, 0x39, 0x30, 0x33, 0x36, 0x34, 0x65,
+0x35, 0x35, 0x35, 0x63, 0x32, 0x37, 0x31, 0x61,
+0x64, 0x35, 0x30, 0x34, 0x62, 0x38, 0x38, 0x61,
+0x63, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x22, 0x2c, 0x20, 0x22, 0x50, 0x32, 0x53,
+0x48, 0x22, 0x5d, 0x2c, 0x0a, 0x0a, 0x5b, 0x22,
+0x54, 0x68, 0x65, 0x20, 0x66, 0x6f, 0x6c, 0x6c,
+0x6f, 0x77, 0x69, 0x6e, 0x67, 0x20, 0x69, 0x73,
+0x20, 0x63, 0x39, 0x39, 0x63, 0x34, 0x39, 0x64,
+0x61, 0x34, 0x63, 0x33, 0x38, 0x61, 0x66, 0x36,
+0x36, 0x39, 0x64, 0x65, 0x61, 0x34, 0x33, 0x36,
+0x64, 0x33, 0x65, 0x37, 0x33, 0x37, 0x38, 0x30,
+0x64, 0x66, 0x64, 0x62, 0x36, 0x63, 0x31, 0x65,
+0x63, 0x66, 0x39, 0x39, 0x35, 0x38, 0x62, 0x61,
+0x61, 0x35, 0x32, 0x39, 0x36, 0x30, 0x65, 0x38,
+0x62, 0x61, 0x65, 0x65, 0x33, 0x30, 0x65, 0x37,
+0x33, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x22, 0x49,
+0x74, 0x20, 0x69, 0x73, 0x20, 0x6f, 0x66, 0x20,
+0x69, 0x6e, 0x74, 0x65, 0x72, 0x65, 0x73, 0x74,
+0x20, 0x62, 0x65, 0x63, 0x61, 0x75, 0x73, 0x65,
+0x20, 0x69, 0x74, 0x20, 0x63, 0x6f, 0x6e, 0x74,
+0x61, 0x69, 0x6e, 0x73, 0x20, 0x61, 0x20, 0x30,
+0x2d, 0x73, 0x65, 0x71, 0x75, 0x65, 0x6e, 0x63,
+0x65, 0x20, 0x61, 0x73, 0x20, 0x77, 0x65, 0x6c,
+0x6c, 0x20, 0x61, 0x73, 0x20, 0x61, 0x20, 0x73,
+0x69, 0x67, 0x6e, 0x61, 0x74, 0x75, 0x72, 0x65,
+0x20, 0x6f, 0x66, 0x20, 0x53, 0x49, 0x47, 0x48,
+0x41, 0x53, 0x48, 0x20, 0x74, 0x79, 0x70, 0x65,
+0x20, 0x30, 0x20, 0x28, 0x77, 0x68, 0x69, 0x63,
+0x68, 0x20, 0x69, 0x73, 0x20, 0x6e, 0x6f, 0x74,
+0x20, 0x61, 0x20, 0x72, 0x65, 0x61, 0x6c, 0x20,
+0x74, 0x79, 0x70, 0x65, 0x29, 0x22, 0x5d, 0x2c,
+0x0a, 0x5b, 0x5b, 0x5b, 0x22, 0x34, 0x30, 0x36,
+0x62, 0x32, 0x62, 0x30, 0x36, 0x62, 0x63, 0x64,
+0x33, 0x34, 0x64, 0x33, 0x63, 0x38, 0x37, 0x33,
+0x33, 0x65, 0x36, 0x62, 0x37, 0x39, 0x66, 0x37,
+0x61, 0x33, 0x39, 0x34, 0x63, 0x38, 0x61, 0x34,
+0x33, 0x31, 0x66, 0x62, 0x66, 0x34, 0x66, 0x66,
+0x35, 0x61, 0x63, 0x37, 0x30, 0x35, 0x63, 0x39,
+0x33, 0x66, 0x34, 0x30, 0x37, 0x36, 0x62, 0x62,
+0x37, 0x37, 0x36, 0x30, 0x32, 0x22, 0x2c, 0x20,
+0x30, 0x2c, 0x20, 0x22, 0x44, 0x55, 0x50, 0x20,
+0x48, 0x41, 0x53, 0x48, 0x31, 0x36, 0x30, 0x20,
+0x30, 0x78, 0x31, 0x34, 0x20, 0x30, 0x78, 0x64,
+0x63, 0x34, 0x34, 0x62, 0x31, 0x31, 0x36, 0x34,
+0x31, 0x38, 0x38, 0x30, 0x36, 0x37, 0x63, 0x33,
+0x61, 0x33, 0x32, 0x64, 0x34, 0x37, 0x38, 0x30,
+0x66, 0x35, 0x39, 0x39, 0x36, 0x66, 0x61, 0x31,
+0x34, 0x61, 0x34, 0x66, 0x32, 0x64, 0x39, 0x20,
+0x45, 0x51, 0x55, 0x41, 0x4c, 0x56, 0x45, 0x52,
+0x49, 0x46, 0x59, 0x20, 0x43, 0x48, 0x45, 0x43,
+0x4b, 0x53, 0x49, 0x47, 0x22, 0x5d, 0x5d, 0x2c,
+0x0a, 0x22, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x32, 0x37, 0x36,
+0x62, 0x37, 0x36, 0x62, 0x30, 0x37, 0x66, 0x34,
+0x39, 0x33, 0x35, 0x63, 0x37, 0x30, 0x61, 0x63,
+0x66, 0x35, 0x34, 0x66, 0x62, 0x66, 0x31, 0x66,
+0x34, 0x33, 0x38, 0x61, 0x34, 0x63, 0x33, 0x39,
+0x37, 0x61, 0x39, 0x66, 0x62, 0x37, 0x65, 0x36,
+0x33, 0x33, 0x38, 0x37, 0x33, 0x63, 0x34, 0x64,
+0x64, 0x33, 0x62, 0x63, 0x30, 0x36, 0x32, 0x62,
+0x36, 0x62, 0x34, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x38, 0x63, 0x34, 0x39,
+0x33, 0x30, 0x34, 0x36, 0x30, 0x32, 0x32, 0x31,
+0x30, 0x30, 0x64, 0x32, 0x33, 0x34, 0x35, 0x39,
+0x64, 0x30, 0x33, 0x65, 0x64, 0x37, 0x65, 0x39,
+0x35, 0x31, 0x31, 0x61, 0x34, 0x37, 0x64, 0x31,
+0x33, 0x32, 0x39, 0x32, 0x64, 0x33, 0x34, 0x33,
+0x30, 0x61, 0x30, 0x34, 0x36, 0x32, 0x37, 0x64,
+0x65, 0x36, 0x32, 0x33, 0x35, 0x62, 0x36, 0x65,
+0x35, 0x31, 0x61, 0x34, 0x30, 0x66, 0x39, 0x63,
+0x64, 0x33, 0x38, 0x36, 0x66, 0x32, 0x61, 0x62,
+0x65, 0x33, 0x30, 0x32, 0x32, 0x31, 0x30, 0x30,
+0x65, 0x37, 0x64, 0x32, 0x35, 0x62, 0x30, 0x38,
+0x30, 0x66, 0x30, 0x62, 0x62, 0x38, 0x64, 0x38,
+0x64, 0x35, 0x66, 0x38, 0x37, 0x38, 0x62, 0x62,
+0x61, 0x37, 0x64, 0x35, 0x34, 0x61, 0x64, 0x32,
+0x66, 0x64, 0x61, 0x36, 0x35, 0x30, 0x65, 0x61,
+0x38, 0x64, 0x31, 0x35, 0x38, 0x61, 0x33, 0x33,
+0x65, 0x65, 0x33, 0x63, 0x62, 0x64, 0x31, 0x31,
+0x37, 0x36, 0x38, 0x31, 0x39, 0x31, 0x66, 0x64,
+0x30, 0x30, 0x34, 0x31, 0x30, 0x34, 0x62, 0x30,
+0x65, 0x32, 0x63, 0x38, 0x37, 0x39, 0x65, 0x34,
+0x64, 0x61, 0x66, 0x37, 0x62, 0x39, 0x61, 0x62,
+0x36, 0x38, 0x33, 0x35, 0x30, 0x32, 0x32, 0x38,
+0x63, 0x31, 0x35, 0x39, 0x37, 0x36, 0x36, 0x36,
+0x37, 0x36, 0x61, 0x31, 0x34, 0x66, 0x35, 0x38,
+0x31, 0x35, 0x30, 0x38, 0x34, 0x62, 0x61, 0x31,
+0x36, 0x36, 0x34, 0x33, 0x32, 0x61, 0x61, 0x62,
+0x34, 0x36, 0x31, 0x39, 0x38, 0x64, 0x34, 0x63,
+0x63, 0x61, 0x39, 0x38, 0x66, 0x61, 0x33, 0x65,
+0x39, 0x39, 0x38, 0x31, 0x64, 0x30, 0x61, 0x39,
+0x30, 0x62, 0x32, 0x65, 0x66, 0x66, 0x63, 0x35,
+0x31, 0x34, 0x62, 0x37, 0x36, 0x32, 0x37, 0x39,
+0x34, 0x37, 0x36, 0x35, 0x35, 0x30, 0x62, 0x61,
+0x33, 0x36, 0x36, 0x33, 0x66, 0x64, 0x63, 0x61,
+0x66, 0x66, 0x39, 0x34, 0x63, 0x33, 0x38, 0x34,
+0x32, 0x30, 0x65, 0x39, 0x64, 0x35, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x30, 0x39, 0x33, 0x64, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x39, 0x37, 0x36, 0x61, 0x39, 0x31, 0x34,
+0x39, 0x61, 0x37, 0x62, 0x30, 0x66, 0x33, 0x62,
+0x38, 0x30, 0x63, 0x36, 0x62, 0x61, 0x61, 0x65,
+0x65, 0x64, 0x63, 0x65, 0x30, 0x61, 0x30, 0x38,
+0x34, 0x32, 0x35, 0x35, 0x33, 0x38, 0x30, 0x30,
+0x66, 0x38, 0x33, 0x32, 0x62, 0x61, 0x31, 0x66,
+0x38, 0x38, 0x61, 0x63, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x22,
+0x50, 0x32, 0x53, 0x48, 0x22, 0x5d, 0x2c, 0x0a,
+0x0a, 0x5b, 0x22, 0x41, 0x20, 0x6e, 0x65, 0x61,
+0x72, 0x6c, 0x79, 0x2d, 0x73, 0x74, 0x61, 0x6e,
+0x64, 0x61, 0x72, 0x64, 0x20, 0x74, 0x72, 0x61,
+0x6e, 0x73, 0x61, 0x63, 0x74, 0x69, 0x6f, 0x6e,
+0x20, 0x77, 0x69, 0x74, 0x68, 0x20, 0x43, 0x48,
+0x45, 0x43, 0x4b, 0x53, 0x49, 0x47, 0x56, 0x45,
+0x52, 0x49, 0x46, 0x59, 0x20, 0x31, 0x20, 0x69,
+0x6e, 0x73, 0x74, 0x65, 0x61, 0x64, 0x20, 0x6f,
+0x66, 0x20, 0x43, 0x48, 0x45, 0x43, 0x4b, 0x53,
+0x49, 0x47, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b,
+0x5b, 0x22, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20,
+0x22, 0x44, 0x55, 0x50, 0x20, 0x48, 0x41, 0x53,
+0x48, 0x31, 0x36, 0x30, 0x20, 0x30, 0x78, 0x31,
+0x34, 0x20, 0x30, 0x78, 0x35, 0x62, 0x36, 0x34,
+0x36, 0x32, 0x34, 0x37, 0x35, 0x34, 0x35, 0x34,
+0x37, 0x31, 0x30, 0x66, 0x33, 0x63, 0x32, 0x32,
+0x66, 0x35, 0x66, 0x64, 0x66, 0x30, 0x62, 0x34,
+0x30, 0x37, 0x30, 0x34, 0x63, 0x39, 0x32, 0x66,
+0x32, 0x35, 0x63, 0x33, 0x20, 0x45, 0x51, 0x55,
+0x41, 0x4c, 0x56, 0x45, 0x52, 0x49, 0x46, 0x59,
+0x20, 0x43, 0x48, 0x45, 0x43, 0x4b, 0x53, 0x49,
+0x47, 0x56, 0x45, 0x52, 0x49, 0x46, 0x59, 0x20,
+0x31, 0x22, 0x5d, 0x5d, 0x2c, 0x0a, 0x22, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x36, 0x61, 0x34, 0x37, 0x33, 0x30, 0x34,
+0x34, 0x30, 0x32, 0x32, 0x30, 0x36, 0x37, 0x32,
+0x38, 0x38, 0x65, 0x61, 0x35, 0x30, 0x61, 0x61,
+0x37, 0x39, 0x39, 0x35, 0x34, 0x33, 0x61, 0x35,
+0x33, 0x36, 0x66, 0x66, 0x39, 0x33, 0x30, 0x36,
+0x66, 0x38, 0x65, 0x31, 0x63, 0x62, 0x61, 0x30,
+0x35, 0x62, 0x39, 0x63, 0x36, 0x62, 0x31, 0x30,
+0x39, 0x35, 0x31, 0x31, 0x37, 0x35, 0x62, 0x39,
+0x32, 0x34, 0x66, 0x39, 0x36, 0x37, 0x33, 0x32,
+0x35, 0x35, 0x35, 0x65, 0x64, 0x30, 0x32, 0x32,
+0x30, 0x32, 0x36, 0x64, 0x37, 0x62, 0x35, 0x32,
+0x36, 0x35, 0x66, 0x33, 0x38, 0x64, 0x32, 0x31,
+0x35, 0x34, 0x31, 0x35, 0x31, 0x39, 0x65, 0x34,
+0x61, 0x31, 0x65, 0x35, 0x35, 0x30, 0x34, 0x34,
+0x64, 0x35, 0x62, 0x39, 0x65, 0x31, 0x37, 0x65,
+0x31, 0x35, 0x63, 0x64, 0x62, 0x61, 0x66, 0x32,
+0x39, 0x61, 0x65, 0x33, 0x37, 0x39, 0x32, 0x65,
+0x39, 0x39, 0x65, 0x38, 0x38, 0x33, 0x65, 0x37,
+0x61, 0x30, 0x31, 0x32, 0x31, 0x30, 0x33, 0x62,
+0x61, 0x38, 0x63, 0x38, 0x62, 0x38, 0x36, 0x64,
+0x65, 0x61, 0x31, 0x33, 0x31, 0x63, 0x32, 0x32,
+0x61, 0x62, 0x39, 0x36, 0x37, 0x65, 0x36, 0x64,
+0x64, 0x39, 0x39, 0x62, 0x64, 0x61, 0x65, 0x38,
+0x65, 0x66, 0x66, 0x37, 0x61, 0x31, 0x66, 0x37,
+0x35, 0x61, 0x32, 0x63, 0x33, 0x35, 0x66, 0x31,
+0x66, 0x39, 0x34, 0x34, 0x31, 0x30, 0x39, 0x65,
+0x33, 0x66, 0x65, 0x35, 0x65, 0x32, 0x32, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x31, 0x35, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x22, 0x2c, 0x20,
+0x22, 0x50, 0x32, 0x53, 0x48, 0x22, 0x5d, 0x2c,
+0x0a, 0x0a, 0x5b, 0x22, 0x53, 0x61, 0x6d, 0x65,
+0x20, 0x61, 0x73, 0x20, 0x61, 0x62, 0x6f, 0x76,
+0x65, 0x2c, 0x20, 0x62, 0x75, 0x74, 0x20, 0x77,
+0x69, 0x74, 0x68, 0x20, 0x74, 0x68, 0x65, 0x20,
+0x73, 0x69, 0x67, 0x6e, 0x61, 0x74, 0x75, 0x72,
+0x65, 0x20, 0x64, 0x75, 0x70, 0x6c, 0x69, 0x63,
+0x61, 0x74, 0x65, 0x64, 0x20, 0x69, 0x6e, 0x20,
+0x74, 0x68, 0x65, 0x20, 0x73, 0x63, 0x72, 0x69,
+0x70, 0x74, 0x50, 0x75, 0x62, 0x4b, 0x65, 0x79,
+0x20, 0x77, 0x69, 0x74, 0x68, 0x20, 0x74, 0x68,
+0x65, 0x20, 0x70, 0x72, 0x6f, 0x70, 0x65, 0x72,
+0x20, 0x70, 0x75, 0x73, 0x68, 0x64, 0x61, 0x74,
+0x61, 0x20, 0x70, 0x72, 0x65, 0x66, 0x69, 0x78,
+0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b, 0x5b, 0x22,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20, 0x22, 0x44,
+0x55, 0x50, 0x20, 0x48, 0x41, 0x53, 0x48, 0x31,
+0x36, 0x30, 0x20, 0x30, 0x78, 0x31, 0x34, 0x20,
+0x30, 0x78, 0x35, 0x62, 0x36, 0x34, 0x36, 0x32,
+0x34, 0x37, 0x35, 0x34, 0x35, 0x34, 0x37, 0x31,
+0x30, 0x66, 0x33, 0x63, 0x32, 0x32, 0x66, 0x35,
+0x66, 0x64, 0x66, 0x30, 0x62, 0x34, 0x30, 0x37,
+0x30, 0x34, 0x63, 0x39, 0x32, 0x66, 0x32, 0x35,
+0x63, 0x33, 0x20, 0x45, 0x51, 0x55, 0x41, 0x4c,
+0x56, 0x45, 0x52, 0x49, 0x46, 0x59, 0x20, 0x43,
+0x48, 0x45, 0x43, 0x4b, 0x53, 0x49, 0x47, 0x56,
+0x45, 0x52, 0x49, 0x46, 0x59, 0x20, 0x31, 0x20,
+0x30, 0x78, 0x34, 0x37, 0x20, 0x30, 0x78, 0x33,
+0x30, 0x34, 0x34, 0x30, 0x32, 0x32, 0x30, 0x36,
+0x37, 0x32, 0x38, 0x38, 0x65, 0x61, 0x35, 0x30,
+0x61, 0x61, 0x37, 0x39, 0x39, 0x35, 0x34, 0x33,
+0x61, 0x35, 0x33, 0x36, 0x66, 0x66, 0x39, 0x33,
+0x30, 0x36, 0x66, 0x38, 0x65, 0x31, 0x63, 0x62,
+0x61, 0x30, 0x35, 0x62, 0x39, 0x63, 0x36, 0x62,
+0x31, 0x30, 0x39, 0x35, 0x31, 0x31, 0x37, 0x35,
+0x62, 0x39, 0x32, 0x34, 0x66, 0x39, 0x36, 0x37,
+0x33, 0x32, 0x35, 0x35, 0x35, 0x65, 0x64, 0x30,
+0x32, 0x32, 0x30, 0x32, 0x36, 0x64, 0x37, 0x62,
+0x35, 0x32, 0x36, 0x35, 0x66, 0x33, 0x38, 0x64,
+0x32, 0x31, 0x35, 0x34, 0x31, 0x35, 0x31, 0x39,
+0x65, 0x34, 0x61, 0x31, 0x65, 0x35, 0x35, 0x30,
+0x34, 0x34, 0x64, 0x35, 0x62, 0x39, 0x65, 0x31,
+0x37, 0x65, 0x31, 0x35, 0x63, 0x64, 0x62, 0x61,
+0x66, 0x32, 0x39, 0x61, 0x65, 0x33, 0x37, 0x39,
+0x32, 0x65, 0x39, 0x39, 0x65, 0x38, 0x38, 0x33,
+0x65, 0x37, 0x61, 0x30, 0x31, 0x22, 0x5d, 0x5d,
+0x2c, 0x0a, 0x22, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x36, 0x61, 0x34,
+0x37, 0x33, 0x30, 0x34, 0x34, 0x30, 0x32, 0x32,
+0x30, 0x36, 0x37, 0x32, 0x38, 0x38, 0x65, 0x61,
+0x35, 0x30, 0x61, 0x61, 0x37, 0x39, 0x39, 0x35,
+0x34, 0x33, 0x61, 0x35, 0x33, 0x36, 0x66, 0x66,
+0x39, 0x33, 0x30, 0x36, 0x66, 0x38, 0x65, 0x31,
+0x63, 0x62, 0x61, 0x30, 0x35, 0x62, 0x39, 0x63,
+0x36, 0x62, 0x31, 0x30, 0x39, 0x35, 0x31, 0x31,
+0x37, 0x35, 0x62, 0x39, 0x32, 0x34, 0x66, 0x39,
+0x36, 0x37, 0x33, 0x32, 0x35, 0x35, 0x35, 0x65,
+0x64, 0x30, 0x32, 0x32, 0x30, 0x32, 0x36, 0x64,
+0x37, 0x62, 0x35, 0x32, 0x36, 0x35, 0x66, 0x33,
+0x38, 0x64, 0x32, 0x31, 0x35, 0x34, 0x31, 0x35,
+0x31, 0x39, 0x65, 0x34, 0x61, 0x31, 0x65, 0x35,
+0x35, 0x30, 0x34, 0x34, 0x64, 0x35, 0x62, 0x39,
+0x65, 0x31, 0x37, 0x65, 0x31, 0x35, 0x63, 0x64,
+0x62, 0x61, 0x66, 0x32, 0x39, 0x61, 0x65, 0x33,
+0x37, 0x39, 0x32, 0x65, 0x39, 0x39, 0x65, 0x38,
+0x38, 0x33, 0x65, 0x37, 0x61, 0x30, 0x31, 0x32,
+0x31, 0x30, 0x33, 0x62, 0x61, 0x38, 0x63, 0x38,
+0x62, 0x38, 0x36, 0x64, 0x65, 0x61, 0x31, 0x33,
+0x31, 0x63, 0x32, 0x32, 0x61, 0x62, 0x39, 0x36,
+0x37, 0x65, 0x36, 0x64, 0x64, 0x39, 0x39, 0x62,
+0x64, 0x61, 0x65, 0x38, 0x65, 0x66, 0x66, 0x37,
+0x61, 0x31, 0x66, 0x37, 0x35, 0x61, 0x32, 0x63,
+0x33, 0x35, 0x66, 0x31, 0x66, 0x39, 0x34, 0x34,
+0x31, 0x30, 0x39, 0x65, 0x33, 0x66, 0x65, 0x35,
+0x65, 0x32, 0x32, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x35,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x22, 0x2c, 0x20, 0x22, 0x50, 0x32, 0x53,
+0x48, 0x22, 0x5d, 0x2c, 0x0a, 0x0a, 0x5b, 0x22,
+0x54, 0x68, 0x65, 0x20, 0x66, 0x6f, 0x6c, 0x6c,
+0x6f, 0x77, 0x69, 0x6e, 0x67, 0x20, 0x69, 0x73,
+0x20, 0x66, 0x37, 0x66, 0x64, 0x64, 0x30, 0x39,
+0x31, 0x66, 0x61, 0x36, 0x64, 0x38, 0x66, 0x35,
+0x65, 0x37, 0x61, 0x38, 0x63, 0x32, 0x34, 0x35,
+0x38, 0x66, 0x35, 0x63, 0x33, 0x38, 0x66, 0x61,
+0x66, 0x66, 0x66, 0x66, 0x32, 0x64, 0x33, 0x66,
+0x31, 0x34, 0x30, 0x36, 0x62, 0x36, 0x65, 0x34,
+0x66, 0x65, 0x32, 0x63, 0x39, 0x39, 0x64, 0x63,
+0x63, 0x30, 0x64, 0x32, 0x64, 0x31, 0x63, 0x62,
+0x62, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x22, 0x49,
+0x74, 0x20, 0x63, 0x61, 0x75, 0x67, 0x68, 0x74,
+0x20, 0x61, 0x20, 0x62, 0x75, 0x67, 0x20, 0x69,
+0x6e, 0x20, 0x74, 0x68, 0x65, 0x20, 0x77, 0x6f,
+0x72, 0x6b, 0x61, 0x72, 0x6f, 0x75, 0x6e, 0x64,
+0x20, 0x66, 0x6f, 0x72, 0x20, 0x32, 0x33, 0x62,
+0x33, 0x39, 0x37, 0x65, 0x64, 0x63, 0x63, 0x64,
+0x33, 0x37, 0x34, 0x30, 0x61, 0x37, 0x34, 0x61,
+0x64, 0x62, 0x36, 0x30, 0x33, 0x63, 0x39, 0x37,
+0x35, 0x36, 0x33, 0x37, 0x30, 0x66, 0x61, 0x66,
+0x63, 0x64, 0x65, 0x39, 0x62, 0x63, 0x63, 0x34,
+0x34, 0x38, 0x33, 0x65, 0x62, 0x32, 0x37, 0x31,
+0x65, 0x63, 0x61, 0x64, 0x30, 0x39, 0x61, 0x39,
+0x34, 0x64, 0x64, 0x36, 0x33, 0x20, 0x69, 0x6e,
+0x20, 0x61, 0x6e, 0x20, 0x6f, 0x76, 0x65, 0x72,
+0x6c, 0x79, 0x20, 0x73, 0x69, 0x6d, 0x70, 0x6c,
+0x65, 0x20, 0x69, 0x6d, 0x70, 0x6c, 0x65, 0x6d,
+0x65, 0x6e, 0x74, 0x61, 0x74, 0x69, 0x6f, 0x6e,
+0x2e, 0x20, 0x49, 0x6e, 0x20, 0x61, 0x20, 0x73,
+0x69, 0x67, 0x6e, 0x61, 0x74, 0x75, 0x72, 0x65,
+0x2c, 0x20, 0x69, 0x74, 0x20, 0x63, 0x6f, 0x6e,
+0x74, 0x61, 0x69, 0x6e, 0x73, 0x20, 0x61, 0x6e,
+0x20, 0x41, 0x53, 0x4e, 0x31, 0x20, 0x69, 0x6e,
+0x74, 0x65, 0x67, 0x65, 0x72, 0x20, 0x77, 0x68,
+0x69, 0x63, 0x68, 0x20, 0x69, 0x73, 0x6e, 0x27,
+0x74, 0x20, 0x73, 0x74, 0x72, 0x69, 0x63, 0x74,
+0x2d, 0x44, 0x45, 0x52, 0x20, 0x63, 0x6f, 0x6e,
+0x66, 0x6f, 0x72, 0x6d, 0x61, 0x6e, 0x74, 0x20,
+0x64, 0x75, 0x65, 0x20, 0x74, 0x6f, 0x20, 0x62,
+0x65, 0x69, 0x6e, 0x67, 0x20, 0x6e, 0x65, 0x67,
+0x61, 0x74, 0x69, 0x76, 0x65, 0x2c, 0x20, 0x77,
+0x68, 0x69, 0x63, 0x68, 0x20, 0x64, 0x6f, 0x65,
+0x73, 0x6e, 0x27, 0x74, 0x20, 0x6d, 0x61, 0x6b,
+0x65, 0x20, 0x73, 0x65, 0x6e, 0x73, 0x65, 0x20,
+0x69, 0x6e, 0x20, 0x61, 0x20, 0x73, 0x69, 0x67,
+0x6e, 0x61, 0x74, 0x75, 0x72, 0x65, 0x2e, 0x20,
+0x42, 0x65, 0x66, 0x6f, 0x72, 0x65, 0x20, 0x42,
+0x49, 0x50, 0x36, 0x36, 0x20, 0x61, 0x63, 0x74,
+0x69, 0x76, 0x61, 0x74, 0x65, 0x64, 0x2c, 0x20,
+0x69, 0x74, 0x20, 0x77, 0x61, 0x73, 0x20, 0x61,
+0x20, 0x76, 0x61, 0x6c, 0x69, 0x64, 0x20, 0x73,
+0x69, 0x67, 0x6e, 0x61, 0x74, 0x75, 0x72, 0x65,
+0x2e, 0x20, 0x41, 0x66, 0x74, 0x65, 0x72, 0x20,
+0x69, 0x74, 0x20, 0x61, 0x63, 0x74, 0x69, 0x76,
+0x61, 0x74, 0x65, 0x64, 0x2c, 0x20, 0x69, 0x74,
+0x27, 0x73, 0x20, 0x6e, 0x6f, 0x74, 0x20, 0x76,
+0x61, 0x6c, 0x69, 0x64, 0x20, 0x61, 0x6e, 0x79,
+0x20, 0x6d, 0x6f, 0x72, 0x65, 0x2e, 0x22, 0x5d,
+0x2c, 0x0a, 0x5b, 0x5b, 0x5b, 0x22, 0x62, 0x34,
+0x36, 0x34, 0x65, 0x38, 0x35, 0x64, 0x66, 0x32,
+0x61, 0x32, 0x33, 0x38, 0x34, 0x31, 0x36, 0x66,
+0x38, 0x62, 0x64, 0x61, 0x65, 0x31, 0x31, 0x64,
+0x31, 0x32, 0x30, 0x61, 0x64, 0x64, 0x36, 0x31,
+0x30, 0x33, 0x38, 0x30, 0x65, 0x61, 0x30, 0x37,
+0x66, 0x34, 0x65, 0x66, 0x31, 0x39, 0x63, 0x35,
+0x66, 0x39, 0x64, 0x66, 0x64, 0x34, 0x37, 0x32,
+0x66, 0x39, 0x36, 0x63, 0x33, 0x64, 0x22, 0x2c,
+0x20, 0x30, 0x2c, 0x20, 0x22, 0x44, 0x55, 0x50,
+0x20, 0x48, 0x41, 0x53, 0x48, 0x31, 0x36, 0x30,
+0x20, 0x30, 0x78, 0x31, 0x34, 0x20, 0x30, 0x78,
+0x62, 0x65, 0x66, 0x38, 0x30, 0x65, 0x63, 0x66,
+0x33, 0x61, 0x34, 0x34, 0x35, 0x30, 0x30, 0x66,
+0x64, 0x61, 0x31, 0x62, 0x63, 0x39, 0x32, 0x31,
+0x37, 0x36, 0x65, 0x34, 0x34, 0x32, 0x38, 0x39,
+0x31, 0x36, 0x36, 0x32, 0x61, 0x65, 0x64, 0x32,
+0x20, 0x45, 0x51, 0x55, 0x41, 0x4c, 0x56, 0x45,
+0x52, 0x49, 0x46, 0x59, 0x20, 0x43, 0x48, 0x45,
+0x43, 0x4b, 0x53, 0x49, 0x47, 0x22, 0x5d, 0x2c,
+0x0a, 0x5b, 0x22, 0x62, 0x37, 0x39, 0x37, 0x38,
+0x63, 0x63, 0x39, 0x36, 0x65, 0x35, 0x39, 0x61,
+0x38, 0x62, 0x31, 0x33, 0x65, 0x30, 0x38, 0x36,
+0x35, 0x64, 0x33, 0x66, 0x39, 0x35, 0x36, 0x35,
+0x37, 0x35, 0x36, 0x31, 0x61, 0x37, 0x66, 0x37,
+0x32, 0x35, 0x62, 0x65, 0x39, 0x35, 0x32, 0x34,
+0x33, 0x38, 0x36, 0x33, 0x37, 0x34, 0x37, 0x35,
+0x39, 0x32, 0x30, 0x62, 0x61, 0x63, 0x39, 0x65,
+0x62, 0x32, 0x31, 0x22, 0x2c, 0x20, 0x31, 0x2c,
+0x20, 0x22, 0x44, 0x55, 0x50, 0x20, 0x48, 0x41,
+0x53, 0x48, 0x31, 0x36, 0x30, 0x20, 0x30, 0x78,
+0x31, 0x34, 0x20, 0x30, 0x78, 0x62, 0x65, 0x66,
+0x38, 0x30, 0x65, 0x63, 0x66, 0x33, 0x61, 0x34,
+0x34, 0x35, 0x30, 0x30, 0x66, 0x64, 0x61, 0x31,
+0x62, 0x63, 0x39, 0x32, 0x31, 0x37, 0x36, 0x65,
+0x34, 0x34, 0x32, 0x38, 0x39, 0x31, 0x36, 0x36,
+0x32, 0x61, 0x65, 0x64, 0x32, 0x20, 0x45, 0x51,
+0x55, 0x41, 0x4c, 0x56, 0x45, 0x52, 0x49, 0x46,
+0x59, 0x20, 0x43, 0x48, 0x45, 0x43, 0x4b, 0x53,
+0x49, 0x47, 0x22, 0x5d, 0x5d, 0x2c, 0x0a, 0x22,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x32, 0x33, 0x64, 0x36, 0x63, 0x66, 0x39,
+0x37, 0x32, 0x64, 0x34, 0x64, 0x66, 0x66, 0x39,
+0x63, 0x35, 0x31, 0x39, 0x65, 0x66, 0x66, 0x34,
+0x30, 0x37, 0x65, 0x61, 0x38, 0x30, 0x30, 0x33,
+0x36, 0x31, 0x64, 0x64, 0x30, 0x61, 0x31, 0x32,
+0x31, 0x64, 0x65, 0x31, 0x64, 0x61, 0x38, 0x62,
+0x36, 0x66, 0x34, 0x31, 0x33, 0x38, 0x61, 0x32,
+0x66, 0x32, 0x35, 0x64, 0x65, 0x38, 0x36, 0x34,
+0x62, 0x34, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x38, 0x61, 0x34, 0x37, 0x33, 0x30,
+0x34, 0x34, 0x30, 0x32, 0x32, 0x30, 0x66, 0x66,
+0x64, 0x61, 0x34, 0x37, 0x62, 0x66, 0x63, 0x37,
+0x37, 0x36, 0x62, 0x63, 0x64, 0x32, 0x36, 0x39,
+0x64, 0x61, 0x34, 0x38, 0x33, 0x32, 0x36, 0x32,
+0x36, 0x61, 0x63, 0x33, 0x33, 0x32, 0x61, 0x64,
+0x66, 0x63, 0x61, 0x36, 0x64, 0x64, 0x38, 0x33,
+0x35, 0x65, 0x38, 0x65, 0x63, 0x64, 0x38, 0x33,
+0x63, 0x64, 0x31, 0x65, 0x62, 0x65, 0x37, 0x64,
+0x37, 0x30, 0x39, 0x62, 0x30, 0x65, 0x30, 0x32,
+0x32, 0x30, 0x34, 0x39, 0x63, 0x66, 0x66, 0x61,
+0x31, 0x63, 0x64, 0x63, 0x31, 0x30, 0x32, 0x61,
+0x30, 0x62, 0x35, 0x36, 0x65, 0x30, 0x65, 0x30,
+0x34, 0x39, 0x31, 0x33, 0x36, 0x30, 0x36, 0x63,
+0x37, 0x30, 0x61, 0x66, 0x37, 0x30, 0x32, 0x61,
+0x31, 0x31, 0x34, 0x39, 0x64, 0x63, 0x33, 0x62,
+0x33, 0x30, 0x35, 0x61, 0x62, 0x39, 0x34, 0x33,
+0x39, 0x32, 0x38, 0x38, 0x66, 0x65, 0x65, 0x30,
+0x39, 0x30, 0x30, 0x31, 0x34, 0x31, 0x30, 0x34,
+0x32, 0x36, 0x36, 0x61, 0x62, 0x62, 0x33, 0x36,
+0x64, 0x36, 0x36, 0x65, 0x62, 0x34, 0x32, 0x31,
+0x38, 0x61, 0x36, 0x64, 0x64, 0x33, 0x31, 0x66,
+0x30, 0x39, 0x62, 0x62, 0x39, 0x32, 0x63, 0x66,
+0x33, 0x63, 0x66, 0x61, 0x38, 0x30, 0x33, 0x63,
+0x37, 0x65, 0x61, 0x37, 0x32, 0x63, 0x31, 0x66,
+0x63, 0x38, 0x30, 0x61, 0x35, 0x30, 0x66, 0x39,
+0x31, 0x39, 0x32, 0x37, 0x33, 0x65, 0x36, 0x31,
+0x33, 0x66, 0x38, 0x39, 0x35, 0x62, 0x38, 0x35,
+0x35, 0x66, 0x62, 0x37, 0x34, 0x36, 0x35, 0x63,
+0x63, 0x62, 0x63, 0x38, 0x39, 0x31, 0x39, 0x61,
+0x64, 0x31, 0x62, 0x64, 0x34, 0x61, 0x33, 0x30,
+0x36, 0x63, 0x37, 0x38, 0x33, 0x66, 0x32, 0x32,
+0x63, 0x64, 0x33, 0x32, 0x32, 0x37, 0x33, 0x32,
+0x37, 0x36, 0x39, 0x34, 0x63, 0x34, 0x66, 0x61,
+0x34, 0x63, 0x31, 0x63, 0x34, 0x33, 0x39, 0x61,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x32, 0x31, 0x65, 0x62, 0x63, 0x39, 0x62, 0x61,
+0x32, 0x30, 0x35, 0x39, 0x34, 0x37, 0x33, 0x37,
+0x38, 0x36, 0x34, 0x33, 0x35, 0x32, 0x65, 0x39,
+0x35, 0x62, 0x37, 0x32, 0x37, 0x66, 0x31, 0x61,
+0x35, 0x36, 0x35, 0x37, 0x35, 0x36, 0x66, 0x39,
+0x64, 0x33, 0x36, 0x35, 0x30, 0x38, 0x33, 0x65,
+0x62, 0x31, 0x61, 0x38, 0x35, 0x39, 0x36, 0x65,
+0x63, 0x39, 0x38, 0x63, 0x39, 0x37, 0x62, 0x37,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x38, 0x61, 0x34, 0x37, 0x33, 0x30, 0x34, 0x34,
+0x30, 0x32, 0x32, 0x30, 0x35, 0x30, 0x33, 0x66,
+0x66, 0x31, 0x30, 0x65, 0x39, 0x66, 0x31, 0x65,
+0x30, 0x64, 0x65, 0x37, 0x33, 0x31, 0x34, 0x30,
+0x37, 0x61, 0x34, 0x61, 0x32, 0x34, 0x35, 0x35,
+0x33, 0x31, 0x63, 0x39, 0x66, 0x66, 0x31, 0x37,
+0x36, 0x37, 0x36, 0x65, 0x64, 0x61, 0x34, 0x36,
+0x31, 0x66, 0x38, 0x63, 0x65, 0x65, 0x62, 0x38,
+0x63, 0x30, 0x36, 0x30, 0x34, 0x39, 0x66, 0x61,
+0x32, 0x63, 0x38, 0x31, 0x30, 0x32, 0x32, 0x30,
+0x63, 0x30, 0x30, 0x38, 0x61, 0x63, 0x33, 0x34,
+0x36, 0x39, 0x34, 0x35, 0x31, 0x30, 0x32, 0x39,
+0x38, 0x66, 0x61, 0x36, 0x30, 0x62, 0x33, 0x66,
+0x30, 0x30, 0x30, 0x64, 0x66, 0x30, 0x31, 0x63,
+0x61, 0x61, 0x32, 0x34, 0x34, 0x66, 0x31, 0x36,
+0x35, 0x62, 0x37, 0x32, 0x37, 0x64, 0x34, 0x38,
+0x39, 0x36, 0x65, 0x62, 0x38, 0x34, 0x66, 0x38,
+0x31, 0x65, 0x34, 0x36, 0x62, 0x63, 0x63, 0x34,
+0x30, 0x31, 0x34, 0x31, 0x30, 0x34, 0x32, 0x36,
+0x36, 0x61, 0x62, 0x62, 0x33, 0x36, 0x64, 0x36,
+0x36, 0x65, 0x62, 0x34, 0x32, 0x31, 0x38, 0x61,
+0x36, 0x64, 0x64, 0x33, 0x31, 0x66, 0x30, 0x39,
+0x62, 0x62, 0x39, 0x32, 0x63, 0x66, 0x33, 0x63,
+0x66, 0x61, 0x38, 0x30, 0x33, 0x63, 0x37, 0x65,
+0x61, 0x37, 0x32, 0x63, 0x31, 0x66, 0x63, 0x38,
+0x30, 0x61, 0x35, 0x30, 0x66, 0x39, 0x31, 0x39,
+0x32, 0x37, 0x33, 0x65, 0x36, 0x31, 0x33, 0x66,
+0x38, 0x39, 0x35, 0x62, 0x38, 0x35, 0x35, 0x66,
+0x62, 0x37, 0x34, 0x36, 0x35, 0x63, 0x63, 0x62,
+0x63, 0x38, 0x39, 0x31, 0x39, 0x61, 0x64, 0x31,
+0x62, 0x64, 0x34, 0x61, 0x33, 0x30, 0x36, 0x63,
+0x37, 0x38, 0x33, 0x66, 0x32, 0x32, 0x63, 0x64,
+0x33, 0x32, 0x32, 0x37, 0x33, 0x32, 0x37, 0x36,
+0x39, 0x34, 0x63, 0x34, 0x66, 0x61, 0x34, 0x63,
+0x31, 0x63, 0x34, 0x33, 0x39, 0x61, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x30, 0x31,
+0x66, 0x30, 0x64, 0x61, 0x35, 0x32, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x39, 0x37, 0x36, 0x61, 0x39, 0x31, 0x34,
+0x38, 0x35, 0x37, 0x63, 0x63, 0x64, 0x34, 0x32,
+0x64, 0x64, 0x65, 0x64, 0x36, 0x64, 0x66, 0x33,
+0x32, 0x39, 0x34, 0x39, 0x64, 0x34, 0x36, 0x34,
+0x36, 0x64, 0x66, 0x61, 0x31, 0x30, 0x61, 0x39,
+0x32, 0x34, 0x35, 0x38, 0x63, 0x66, 0x61, 0x61,
+0x38, 0x38, 0x61, 0x63, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x22,
+0x50, 0x32, 0x53, 0x48, 0x22, 0x5d, 0x2c, 0x0a,
+0x0a, 0x5b, 0x22, 0x54, 0x68, 0x65, 0x20, 0x66,
+0x6f, 0x6c, 0x6c, 0x6f, 0x77, 0x69, 0x6e, 0x67,
+0x20, 0x74, 0x65, 0x73, 0x74, 0x73, 0x20, 0x66,
+0x6f, 0x72, 0x20, 0x74, 0x68, 0x65, 0x20, 0x70,
+0x72, 0x65, 0x73, 0x65, 0x6e, 0x63, 0x65, 0x20,
+0x6f, 0x66, 0x20, 0x61, 0x20, 0x62, 0x75, 0x67,
+0x20, 0x69, 0x6e, 0x20, 0x74, 0x68, 0x65, 0x20,
+0x68, 0x61, 0x6e, 0x64, 0x6c, 0x69, 0x6e, 0x67,
+0x20, 0x6f, 0x66, 0x20, 0x53, 0x49, 0x47, 0x48,
+0x41, 0x53, 0x48, 0x5f, 0x53, 0x49, 0x4e, 0x47,
+0x4c, 0x45, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x22,
+0x49, 0x74, 0x20, 0x72, 0x65, 0x73, 0x75, 0x6c,
+0x74, 0x73, 0x20, 0x69, 0x6e, 0x20, 0x73, 0x69,
+0x67, 0x6e, 0x69, 0x6e, 0x67, 0x20, 0x74, 0x68,
+0x65, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x61,
+0x6e, 0x74, 0x20, 0x31, 0x2c, 0x20, 0x69, 0x6e,
+0x73, 0x74, 0x65, 0x61, 0x64, 0x20, 0x6f, 0x66,
+0x20, 0x73, 0x6f, 0x6d, 0x65, 0x74, 0x68, 0x69,
+0x6e, 0x67, 0x20, 0x67, 0x65, 0x6e, 0x65, 0x72,
+0x61, 0x74, 0x65, 0x64, 0x20, 0x62, 0x61, 0x73,
+0x65, 0x64, 0x20, 0x6f, 0x6e, 0x20, 0x74, 0x68,
+0x65, 0x20, 0x74, 0x72, 0x61, 0x6e, 0x73, 0x61,
+0x63, 0x74, 0x69, 0x6f, 0x6e, 0x2c, 0x22, 0x5d,
+0x2c, 0x0a, 0x5b, 0x22, 0x77, 0x68, 0x65, 0x6e,
+0x20, 0x74, 0x68, 0x65, 0x20, 0x69, 0x6e, 0x70,
+0x75, 0x74, 0x20, 0x64, 0x6f, 0x69, 0x6e, 0x67,
+0x20, 0x74, 0x68, 0x65, 0x20, 0x73, 0x69, 0x67,
+0x6e, 0x69, 0x6e, 0x67, 0x20, 0x68, 0x61, 0x73,
+0x20, 0x61, 0x6e, 0x20, 0x69, 0x6e, 0x64, 0x65,
+0x78, 0x20, 0x67, 0x72, 0x65, 0x61, 0x74, 0x65,
+0x72, 0x20, 0x74, 0x68, 0x61, 0x6e, 0x20, 0x74,
+0x68, 0x65, 0x20, 0x6d, 0x61, 0x78, 0x69, 0x6d,
+0x75, 0x6d, 0x20, 0x6f, 0x75, 0x74, 0x70, 0x75,
+0x74, 0x20, 0x69, 0x6e, 0x64, 0x65, 0x78, 0x22,
+0x5d, 0x2c, 0x0a, 0x5b, 0x5b, 0x5b, 0x22, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x32, 0x30, 0x30, 0x22,
+0x2c, 0x20, 0x30, 0x2c, 0x20, 0x22, 0x31, 0x22,
+0x5d, 0x2c, 0x20, 0x5b, 0x22, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x31, 0x30, 0x30, 0x22, 0x2c, 0x20,
+0x30, 0x2c, 0x20, 0x22, 0x44, 0x55, 0x50, 0x20,
+0x48, 0x41, 0x53, 0x48, 0x31, 0x36, 0x30, 0x20,
+0x30, 0x78, 0x31, 0x34, 0x20, 0x30, 0x78, 0x65,
+0x35, 0x32, 0x62, 0x34, 0x38, 0x32, 0x66, 0x32,
+0x66, 0x61, 0x61, 0x38, 0x65, 0x63, 0x62, 0x66,
+0x30, 0x64, 0x62, 0x33, 0x34, 0x34, 0x66, 0x39,
+0x33, 0x63, 0x38, 0x34, 0x61, 0x63, 0x39, 0x30,
+0x38, 0x35, 0x35, 0x37, 0x66, 0x33, 0x33, 0x20,
+0x45, 0x51, 0x55, 0x41, 0x4c, 0x56, 0x45, 0x52,
+0x49, 0x46, 0x59, 0x20, 0x43, 0x48, 0x45, 0x43,
+0x4b, 0x53, 0x49, 0x47, 0x22, 0x5d, 0x5d, 0x2c,
+0x0a, 0x22, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x32, 0x30, 0x30, 0x30, 0x32,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x35, 0x31,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x36, 0x62, 0x34, 0x38, 0x33, 0x30, 0x34, 0x35,
+0x30, 0x32, 0x32, 0x31, 0x30, 0x30, 0x63, 0x39,
+0x63, 0x64, 0x64, 0x30, 0x38, 0x37, 0x39, 0x38,
+0x61, 0x32, 0x38, 0x61, 0x66, 0x39, 0x64, 0x31,
+0x62, 0x61, 0x66, 0x34, 0x34, 0x61, 0x36, 0x63,
+0x37, 0x37, 0x62, 0x63, 0x63, 0x37, 0x65, 0x32,
+0x37, 0x39, 0x66, 0x34, 0x37, 0x64, 0x63, 0x34,
+0x38, 0x37, 0x63, 0x38, 0x63, 0x38, 0x39, 0x39,
+0x39, 0x31, 0x31, 0x62, 0x63, 0x34, 0x38, 0x66,
+0x65, 0x61, 0x66, 0x66, 0x63, 0x63, 0x30, 0x32,
+0x32, 0x30, 0x35, 0x30, 0x33, 0x63, 0x35, 0x63,
+0x35, 0x30, 0x61, 0x65, 0x33, 0x39, 0x39, 0x38,
+0x61, 0x37, 0x33, 0x33, 0x32, 0x36, 0x33, 0x63,
+0x35, 0x63, 0x30, 0x66, 0x37, 0x30, 0x36, 0x31,
+0x62, 0x34, 0x38, 0x33, 0x65, 0x32, 0x62, 0x35,
+0x36, 0x63, 0x34, 0x63, 0x34, 0x31, 0x62, 0x34,
+0x35, 0x36, 0x65, 0x37, 0x64, 0x32, 0x66, 0x35,
+0x61, 0x37, 0x38, 0x61, 0x37, 0x34, 0x63, 0x30,
+0x37, 0x37, 0x30, 0x33, 0x32, 0x31, 0x30, 0x32,
+0x64, 0x35, 0x63, 0x32, 0x35, 0x61, 0x64, 0x62,
+0x35, 0x31, 0x62, 0x36, 0x31, 0x33, 0x33, 0x39,
+0x64, 0x32, 0x62, 0x30, 0x35, 0x33, 0x31, 0x35,
+0x37, 0x39, 0x31, 0x65, 0x32, 0x31, 0x62, 0x62,
+0x65, 0x38, 0x30, 0x65, 0x61, 0x34, 0x37, 0x30,
+0x61, 0x34, 0x39, 0x64, 0x62, 0x30, 0x31, 0x33,
+0x35, 0x37, 0x32, 0x30, 0x39, 0x38, 0x33, 0x63,
+0x39, 0x30, 0x35, 0x61, 0x61, 0x63, 0x65, 0x30,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x31, 0x35, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x22, 0x2c,
+0x20, 0x22, 0x50, 0x32, 0x53, 0x48, 0x22, 0x5d,
+0x2c, 0x0a, 0x0a, 0x5b, 0x22, 0x54, 0x68, 0x65,
+0x20, 0x66, 0x6f, 0x6c, 0x6c, 0x6f, 0x77, 0x69,
+0x6e, 0x67, 0x20, 0x74, 0x65, 0x73, 0x74, 0x73,
+0x20, 0x53, 0x49, 0x47, 0x48, 0x41, 0x53, 0x48,
+0x5f, 0x53, 0x49, 0x4e, 0x47, 0x4c, 0x45, 0x7c,
+0x53, 0x49, 0x47, 0x48, 0x41, 0x53, 0x48, 0x41,
+0x4e, 0x59, 0x4f, 0x4e, 0x45, 0x43, 0x41, 0x4e,
+0x50, 0x41, 0x59, 0x20, 0x69, 0x6e, 0x70, 0x75,
+0x74, 0x73, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b,
+0x5b, 0x22, 0x34, 0x33, 0x37, 0x61, 0x31, 0x30,
+0x30, 0x32, 0x65, 0x62, 0x31, 0x32, 0x35, 0x64,
+0x65, 0x63, 0x30, 0x66, 0x39, 0x33, 0x66, 0x36,
+0x33, 0x35, 0x37, 0x36, 0x33, 0x65, 0x30, 0x61,
+0x65, 0x34, 0x35, 0x66, 0x32, 0x38, 0x66, 0x66,
+0x38, 0x65, 0x38, 0x31, 0x64, 0x38, 0x32, 0x39,
+0x34, 0x35, 0x37, 0x35, 0x33, 0x64, 0x30, 0x31,
+0x30, 0x37, 0x36, 0x31, 0x31, 0x63, 0x64, 0x33,
+0x39, 0x30, 0x22, 0x2c, 0x20, 0x31, 0x2c, 0x20,
+0x22, 0x44, 0x55, 0x50, 0x20, 0x48, 0x41, 0x53,
+0x48, 0x31, 0x36, 0x30, 0x20, 0x30, 0x78, 0x31,
+0x34, 0x20, 0x30, 0x78, 0x33, 0x38, 0x33, 0x66,
+0x62, 0x38, 0x31, 0x63, 0x62, 0x30, 0x61, 0x33,
+0x66, 0x63, 0x37, 0x32, 0x34, 0x62, 0x35, 0x65,
+0x30, 0x38, 0x63, 0x66, 0x38, 0x62, 0x62, 0x64,
+0x34, 0x30, 0x34, 0x33, 0x33, 0x36, 0x64, 0x37,
+0x31, 0x31, 0x66, 0x36, 0x20, 0x45, 0x51, 0x55,
+0x41, 0x4c, 0x56, 0x45, 0x52, 0x49, 0x46, 0x59,
+0x20, 0x43, 0x48, 0x45, 0x43, 0x4b, 0x53, 0x49,
+0x47, 0x22, 0x5d, 0x2c, 0x0a, 0x20, 0x20, 0x5b,
+0x22, 0x32, 0x64, 0x34, 0x38, 0x64, 0x33, 0x32,
+0x63, 0x63, 0x61, 0x64, 0x30, 0x38, 0x37, 0x62,
+0x63, 0x64, 0x61, 0x30, 0x61, 0x63, 0x35, 0x62,
+0x33, 0x31, 0x35, 0x35, 0x35, 0x62, 0x64, 0x35,
+0x38, 0x64, 0x31, 0x64, 0x32, 0x35, 0x36, 0x38,
+0x31, 0x38, 0x34, 0x63, 0x62, 0x63, 0x38, 0x65,
+0x37, 0x35, 0x32, 0x64, 0x64, 0x32, 0x62, 0x65,
+0x32, 0x36, 0x38, 0x34, 0x61, 0x66, 0x30, 0x33,
+0x66, 0x22, 0x2c, 0x20, 0x31, 0x2c, 0x20, 0x22,
+0x44, 0x55, 0x50, 0x20, 0x48, 0x41, 0x53, 0x48,
+0x31, 0x36, 0x30, 0x20, 0x30, 0x78, 0x31, 0x34,
+0x20, 0x30, 0x78, 0x32, 0x37, 0x35, 0x65, 0x63,
+0x32, 0x61, 0x32, 0x33, 0x33, 0x65, 0x35, 0x62,
+0x32, 0x33, 0x64, 0x34, 0x33, 0x66, 0x61, 0x31,
+0x39, 0x65, 0x37, 0x62, 0x66, 0x39, 0x62, 0x65,
+0x62, 0x30, 0x63, 0x62, 0x33, 0x39, 0x39, 0x36,
+0x31, 0x31, 0x37, 0x20, 0x45, 0x51, 0x55, 0x41,
+0x4c, 0x56, 0x45, 0x52, 0x49, 0x46, 0x59, 0x20,
+0x43, 0x48, 0x45, 0x43, 0x4b, 0x53, 0x49, 0x47,
+0x22, 0x5d, 0x2c, 0x0a, 0x20, 0x20, 0x5b, 0x22,
+0x63, 0x37, 0x36, 0x31, 0x36, 0x38, 0x65, 0x66,
+0x31, 0x61, 0x32, 0x37, 0x32, 0x61, 0x34, 0x66,
+0x31, 0x37, 0x36, 0x65, 0x35, 0x35, 0x65, 0x37,
+0x33, 0x31, 0x35, 0x37, 0x65, 0x63, 0x66, 0x63,
+0x65, 0x30, 0x34, 0x30, 0x63, 0x66, 0x61, 0x64,
+0x31, 0x36, 0x61, 0x35, 0x32, 0x37, 0x32, 0x66,
+0x36, 0x32, 0x39, 0x36, 0x65, 0x62, 0x37, 0x30,
+0x38, 0x39, 0x64, 0x63, 0x61, 0x38, 0x34, 0x36,
+0x22, 0x2c, 0x20, 0x31, 0x2c, 0x20, 0x22, 0x44,
+0x55, 0x50, 0x20, 0x48, 0x41, 0x53, 0x48, 0x31,
+0x36, 0x30, 0x20, 0x30, 0x78, 0x31, 0x34, 0x20,
+0x30, 0x78, 0x33, 0x34, 0x66, 0x65, 0x61, 0x32,
+0x63, 0x35, 0x61, 0x37, 0x35, 0x34, 0x31, 0x34,
+0x66, 0x64, 0x39, 0x34, 0x35, 0x32, 0x37, 0x33,
+0x61, 0x65, 0x32, 0x64, 0x30, 0x32, 0x39, 0x63,
+0x65, 0x31, 0x66, 0x32, 0x38, 0x64, 0x61, 0x66,
+0x63, 0x66, 0x20, 0x45, 0x51, 0x55, 0x41, 0x4c,
+0x56, 0x45, 0x52, 0x49, 0x46, 0x59, 0x20, 0x43,
+0x48, 0x45, 0x43, 0x4b, 0x53, 0x49, 0x47, 0x22,
+0x5d, 0x5d, 0x2c, 0x0a, 0x22, 0x30, 0x31, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x33, 0x39,
+0x30, 0x64, 0x33, 0x31, 0x63, 0x36, 0x31, 0x30,
+0x37, 0x30, 0x31, 0x33, 0x64, 0x37, 0x35, 0x34,
+0x35, 0x32, 0x39, 0x64, 0x38, 0x38, 0x31, 0x38,
+0x65, 0x66, 0x66, 0x32, 0x38, 0x35, 0x66, 0x65,
+0x34, 0x30, 0x61, 0x33, 0x65, 0x37, 0x36, 0x33,
+0x35, 0x66, 0x36, 0x39, 0x33, 0x30, 0x66, 0x65,
+0x63, 0x35, 0x64, 0x31, 0x32, 0x65, 0x62, 0x30,
+0x32, 0x31, 0x30, 0x37, 0x61, 0x34, 0x33, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x36,
+0x62, 0x34, 0x38, 0x33, 0x30, 0x34, 0x35, 0x30,
+0x32, 0x32, 0x31, 0x30, 0x30, 0x66, 0x34, 0x30,
+0x38, 0x31, 0x35, 0x61, 0x65, 0x33, 0x63, 0x38,
+0x31, 0x61, 0x30, 0x64, 0x64, 0x38, 0x35, 0x31,
+0x63, 0x63, 0x38, 0x64, 0x33, 0x37, 0x36, 0x64,
+0x36, 0x66, 0x64, 0x32, 0x32, 0x36, 0x63, 0x38,
+0x38, 0x34, 0x31, 0x36, 0x36, 0x37, 0x31, 0x33,
+0x34, 0x36, 0x61, 0x39, 0x30, 0x33, 0x33, 0x34,
+0x36, 0x38, 0x63, 0x63, 0x61, 0x32, 0x63, 0x64,
+0x63, 0x63, 0x36, 0x63, 0x32, 0x30, 0x32, 0x32,
+0x30, 0x34, 0x66, 0x37, 0x36, 0x34, 0x36, 0x32,
+0x33, 0x39, 0x30, 0x33, 0x65, 0x36, 0x63, 0x34,
+0x62, 0x65, 0x64, 0x31, 0x62, 0x37, 0x33, 0x34,
+0x62, 0x37, 0x35, 0x64, 0x38, 0x32, 0x63, 0x34,
+0x30, 0x66, 0x31, 0x37, 0x32, 0x35, 0x65, 0x34,
+0x34, 0x37, 0x31, 0x61, 0x35, 0x35, 0x61, 0x64,
+0x34, 0x66, 0x35, 0x31, 0x32, 0x31, 0x38, 0x66,
+0x38, 0x36, 0x31, 0x33, 0x30, 0x61, 0x63, 0x30,
+0x33, 0x38, 0x33, 0x32, 0x31, 0x30, 0x33, 0x33,
+0x64, 0x37, 0x31, 0x30, 0x61, 0x62, 0x34, 0x35,
+0x62, 0x62, 0x35, 0x34, 0x61, 0x63, 0x39, 0x39,
+0x36, 0x31, 0x38, 0x61, 0x64, 0x32, 0x33, 0x62,
+0x33, 0x63, 0x31, 0x64, 0x61, 0x36, 0x36, 0x31,
+0x36, 0x33, 0x31, 0x61, 0x61, 0x32, 0x35, 0x66,
+0x32, 0x33, 0x62, 0x66, 0x65, 0x39, 0x64, 0x32,
+0x32, 0x62, 0x34, 0x31, 0x38, 0x37, 0x36, 0x66,
+0x31, 0x64, 0x34, 0x36, 0x65, 0x34, 0x65, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x33,
+0x66, 0x66, 0x30, 0x34, 0x61, 0x36, 0x38, 0x65,
+0x32, 0x32, 0x62, 0x64, 0x64, 0x35, 0x32, 0x65,
+0x37, 0x63, 0x38, 0x63, 0x62, 0x38, 0x34, 0x38,
+0x31, 0x35, 0x36, 0x64, 0x32, 0x64, 0x31, 0x35,
+0x38, 0x62, 0x64, 0x35, 0x35, 0x31, 0x35, 0x62,
+0x33, 0x63, 0x35, 0x30, 0x61, 0x64, 0x61, 0x62,
+0x63, 0x38, 0x37, 0x64, 0x30, 0x63, 0x61, 0x32,
+0x63, 0x64, 0x33, 0x34, 0x38, 0x32, 0x64, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x36,
+0x61, 0x34, 0x37, 0x33, 0x30, 0x34, 0x34, 0x30,
+0x32, 0x32, 0x30, 0x35, 0x39, 0x38, 0x64, 0x32,
+0x36, 0x33, 0x63, 0x31, 0x30, 0x37, 0x30, 0x30,
+0x34, 0x30, 0x30, 0x38, 0x65, 0x39, 0x65, 0x32,
+0x36, 0x62, 0x61, 0x61, 0x31, 0x65, 0x37, 0x37,
+0x30, 0x62, 0x65, 0x33, 0x30, 0x66, 0x64, 0x33,
+0x31, 0x65, 0x65, 0x35, 0x35, 0x64, 0x65, 0x64,
+0x31, 0x38, 0x39, 0x38, 0x66, 0x37, 0x63, 0x30,
+0x30, 0x64, 0x61, 0x30, 0x35, 0x61, 0x37, 0x35,
+0x39, 0x37, 0x37, 0x30, 0x32, 0x32, 0x30, 0x34,
+0x35, 0x35, 0x33, 0x36, 0x62, 0x65, 0x61, 0x64,
+0x33, 0x32, 0x32, 0x63, 0x61, 0x32, 0x34, 0x36,
+0x37, 0x37, 0x39, 0x36, 0x39, 0x38, 0x62, 0x39,
+0x63, 0x33, 0x64, 0x66, 0x33, 0x30, 0x30, 0x33,
+0x33, 0x37, 0x37, 0x30, 0x39, 0x30, 0x66, 0x34,
+0x31, 0x61, 0x66, 0x65, 0x63, 0x61, 0x37, 0x66,
+0x62, 0x32, 0x63, 0x65, 0x39, 0x65, 0x33, 0x32,
+0x38, 0x65, 0x63, 0x34, 0x61, 0x66, 0x32, 0x38,
+0x33, 0x32, 0x31, 0x30, 0x32, 0x62, 0x37, 0x33,
+0x38, 0x62, 0x35, 0x33, 0x31, 0x64, 0x65, 0x66,
+0x37, 0x33, 0x30, 0x32, 0x30, 0x62, 0x64, 0x36,
+0x33, 0x37, 0x66, 0x33, 0x32, 0x39, 0x33, 0x35,
+0x39, 0x32, 0x34, 0x63, 0x63, 0x38, 0x38, 0x35,
+0x34, 0x39, 0x63, 0x38, 0x32, 0x30, 0x36, 0x39,
+0x37, 0x36, 0x32, 0x32, 0x36, 0x64, 0x39, 0x36,
+0x38, 0x65, 0x64, 0x64, 0x33, 0x61, 0x34, 0x32,
+0x66, 0x63, 0x32, 0x64, 0x37, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x34, 0x36, 0x61,
+0x38, 0x64, 0x63, 0x38, 0x39, 0x37, 0x30, 0x65,
+0x62, 0x39, 0x36, 0x36, 0x32, 0x32, 0x66, 0x32,
+0x37, 0x61, 0x35, 0x31, 0x36, 0x61, 0x64, 0x63,
+0x66, 0x34, 0x30, 0x65, 0x30, 0x66, 0x63, 0x65,
+0x63, 0x35, 0x37, 0x33, 0x31, 0x65, 0x37, 0x35,
+0x35, 0x36, 0x65, 0x31, 0x37, 0x34, 0x66, 0x32,
+0x61, 0x32, 0x37, 0x31, 0x61, 0x65, 0x66, 0x36,
+0x38, 0x36, 0x31, 0x63, 0x37, 0x30, 0x31, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x36, 0x62, 0x34,
+0x38, 0x33, 0x30, 0x34, 0x35, 0x30, 0x32, 0x32,
+0x31, 0x30, 0x30, 0x63, 0x35, 0x62, 0x39, 0x30,
+0x61, 0x37, 0x37, 0x37, 0x61, 0x39, 0x66, 0x64,
+0x63, 0x39, 0x30, 0x63, 0x32, 0x30, 0x38, 0x64,
+0x62, 0x65, 0x66, 0x37, 0x32, 0x39, 0x30, 0x64,
+0x31, 0x66, 0x63, 0x31, 0x62, 0x65, 0x36, 0x35,
+0x31, 0x66, 0x34, 0x37, 0x31, 0x35, 0x31, 0x65,
+0x65, 0x34, 0x63, 0x63, 0x66, 0x66, 0x36, 0x34,
+0x36, 0x38, 0x37, 0x32, 0x61, 0x34, 0x35, 0x34,
+0x63, 0x66, 0x39, 0x30, 0x32, 0x32, 0x30, 0x36,
+0x34, 0x30, 0x63, 0x66, 0x62, 0x63, 0x34, 0x35,
+0x35, 0x30, 0x34, 0x34, 0x36, 0x39, 0x36, 0x38,
+0x66, 0x62, 0x62, 0x65, 0x39, 0x64, 0x31, 0x32,
+0x35, 0x32, 0x38, 0x66, 0x33, 0x61, 0x64, 0x66,
+0x37, 0x64, 0x38, 0x37, 0x62, 0x33, 0x31, 0x35,
+0x34, 0x31, 0x35, 0x36, 0x39, 0x63, 0x35, 0x39,
+0x65, 0x37, 0x39, 0x30, 0x64, 0x62, 0x38, 0x61,
+0x32, 0x32, 0x30, 0x34, 0x38, 0x32, 0x35, 0x38,
+0x33, 0x32, 0x31, 0x30, 0x33, 0x39, 0x31, 0x33,
+0x33, 0x32, 0x35, 0x34, 0x36, 0x65, 0x32, 0x32,
+0x62, 0x62, 0x65, 0x38, 0x66, 0x65, 0x33, 0x61,
+0x66, 0x35, 0x34, 0x61, 0x64, 0x64, 0x66, 0x61,
+0x64, 0x36, 0x66, 0x38, 0x62, 0x38, 0x33, 0x64,
+0x30, 0x35, 0x66, 0x61, 0x34, 0x66, 0x35, 0x65,
+0x30, 0x34, 0x37, 0x35, 0x39, 0x33, 0x64, 0x34,
+0x63, 0x30, 0x37, 0x61, 0x65, 0x39, 0x33, 0x38,
+0x37, 0x39, 0x35, 0x62, 0x65, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x30, 0x32, 0x38,
+0x30, 0x33, 0x36, 0x62, 0x65, 0x32, 0x36, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x39, 0x37, 0x36, 0x61, 0x39, 0x31, 0x34, 0x64,
+0x64, 0x66, 0x62, 0x32, 0x39, 0x65, 0x66, 0x61,
+0x64, 0x34, 0x33, 0x61, 0x36, 0x36, 0x37, 0x34,
+0x36, 0x35, 0x61, 0x63, 0x35, 0x39, 0x66, 0x66,
+0x31, 0x34, 0x64, 0x63, 0x36, 0x34, 0x34, 0x32,
+0x61, 0x31, 0x61, 0x64, 0x66, 0x63, 0x61, 0x38,
+0x38, 0x61, 0x63, 0x33, 0x64, 0x35, 0x63, 0x62,
+0x61, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x31, 0x39, 0x37, 0x36, 0x61,
+0x39, 0x31, 0x34, 0x62, 0x36, 0x34, 0x64, 0x64,
+0x65, 0x37, 0x61, 0x35, 0x30, 0x35, 0x61, 0x31,
+0x33, 0x63, 0x61, 0x39, 0x38, 0x36, 0x63, 0x34,
+0x30, 0x65, 0x38, 0x36, 0x65, 0x39, 0x38, 0x34,
+0x61, 0x38, 0x64, 0x63, 0x38, 0x31, 0x33, 0x36,
+0x38, 0x62, 0x36, 0x38, 0x38, 0x61, 0x63, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x22,
+0x2c, 0x20, 0x22, 0x50, 0x32, 0x53, 0x48, 0x22,
+0x5d, 0x2c, 0x0a, 0x0a, 0x5b, 0x22, 0x41, 0x6e,
+0x20, 0x69, 0x6e, 0x76, 0x61, 0x6c, 0x69, 0x64,
+0x20, 0x50, 0x32, 0x53, 0x48, 0x20, 0x54, 0x72,
+0x61, 0x6e, 0x73, 0x61, 0x63, 0x74, 0x69, 0x6f,
+0x6e, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b, 0x5b,
+0x22, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30,
+0x30, 0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20, 0x22,
+0x48, 0x41, 0x53, 0x48, 0x31, 0x36, 0x30, 0x20,
+0x30, 0x78, 0x31, 0x34, 0x20, 0x30, 0x78, 0x37,
+0x61, 0x30, 0x35, 0x32, 0x63, 0x38, 0x34, 0x30,
+0x62, 0x61, 0x37, 0x33, 0x61, 0x66, 0x32, 0x36,
+0x37, 0x35, 0x35, 0x64, 0x65, 0x34, 0x32, 0x63,
+0x66, 0x30, 0x31, 0x63, 0x63, 0x39, 0x65, 0x30,
+0x61, 0x34, 0x39, 0x66, 0x65, 0x66, 0x30, 0x20,
+0x45, 0x51, 0x55, 0x41, 0x4c, 0x22, 0x5d, 0x5d,
+0x2c, 0x0a, 0x22, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x39, 0x30,
+0x38, 0x35, 0x37, 0x36, 0x38, 0x36, 0x31, 0x37,
+0x34, 0x32, 0x30, 0x36, 0x39, 0x37, 0x33, 0x32,
+0x30, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x31, 0x35, 0x31, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x22,
+0x2c, 0x20, 0x22, 0x4e, 0x4f, 0x4e, 0x45, 0x22,
+0x5d, 0x2c, 0x0a, 0x0a, 0x5b, 0x22, 0x41, 0x20,
+0x76, 0x61, 0x6c, 0x69, 0x64, 0x20, 0x50, 0x32,
+0x53, 0x48, 0x20, 0x54, 0x72, 0x61, 0x6e, 0x73,
+0x61, 0x63, 0x74, 0x69, 0x6f, 0x6e, 0x20, 0x75,
+0x73, 0x69, 0x6e, 0x67, 0x20, 0x74, 0x68, 0x65,
+0x20, 0x73, 0x74, 0x61, 0x6e, 0x64, 0x61, 0x72,
+0x64, 0x20, 0x74, 0x72, 0x61, 0x6e, 0x73, 0x61,
+0x63, 0x74, 0x69, 0x6f, 0x6e, 0x20, 0x74, 0x79,
+0x70, 0x65, 0x20, 0x70, 0x75, 0x74, 0x20, 0x66,
+0x6f, 0x72, 0x74, 0x68, 0x20, 0x69, 0x6e, 0x20,
+0x42, 0x49, 0x50, 0x20, 0x31, 0x36, 0x22, 0x5d,
+0x2c, 0x0a, 0x5b, 0x5b, 0x5b, 0x22, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x22, 0x2c,
+0x20, 0x30, 0x2c, 0x20, 0x22, 0x48, 0x41, 0x53,
+0x48, 0x31, 0x36, 0x30, 0x20, 0x30, 0x78, 0x31,
+0x34, 0x20, 0x30, 0x78, 0x38, 0x66, 0x65, 0x62,
+0x62, 0x65, 0x64, 0x34, 0x30, 0x34, 0x38, 0x33,
+0x36, 0x36, 0x31, 0x64, 0x65, 0x36, 0x39, 0x35,
+0x38, 0x64, 0x39, 0x35, 0x37, 0x34, 0x31, 0x32,
+0x66, 0x38, 0x32, 0x64, 0x65, 0x65, 0x64, 0x38,
+0x65, 0x32, 0x66, 0x37, 0x20, 0x45, 0x51, 0x55,
+0x41, 0x4c, 0x22, 0x5d, 0x5d, 0x2c, 0x0a, 0x22,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x36, 0x65, 0x34, 0x39, 0x33, 0x30,
+0x34, 0x36, 0x30, 0x32, 0x32, 0x31, 0x30, 0x30,
+0x63, 0x36, 0x36, 0x63, 0x39, 0x63, 0x64, 0x66,
+0x34, 0x63, 0x34, 0x33, 0x36, 0x30, 0x39, 0x35,
+0x38, 0x36, 0x64, 0x31, 0x35, 0x34, 0x32, 0x34,
+0x63, 0x35, 0x34, 0x37, 0x30, 0x37, 0x31, 0x35,
+0x36, 0x65, 0x33, 0x31, 0x36, 0x64, 0x38, 0x38,
+0x62, 0x30, 0x61, 0x31, 0x35, 0x33, 0x34, 0x63,
+0x39, 0x65, 0x36, 0x62, 0x30, 0x64, 0x34, 0x66,
+0x33, 0x31, 0x31, 0x34, 0x30, 0x36, 0x33, 0x31,
+0x30, 0x32, 0x32, 0x31, 0x30, 0x30, 0x39, 0x63,
+0x30, 0x66, 0x65, 0x35, 0x31, 0x64, 0x62, 0x63,
+0x39, 0x63, 0x34, 0x61, 0x62, 0x37, 0x63, 0x63,
+0x32, 0x35, 0x64, 0x33, 0x66, 0x64, 0x62, 0x65,
+0x63, 0x63, 0x66, 0x36, 0x36, 0x37, 0x39, 0x66,
+0x65, 0x36, 0x38, 0x32, 0x37, 0x66, 0x30, 0x38,
+0x65, 0x64, 0x66, 0x32, 0x62, 0x34, 0x61, 0x39,
+0x66, 0x31, 0x36, 0x65, 0x65, 0x33, 0x65, 0x62,
+0x30, 0x65, 0x34, 0x33, 0x38, 0x61, 0x30, 0x31,
+0x32, 0x33, 0x32, 0x31, 0x30, 0x33, 0x33, 0x38,
+0x65, 0x38, 0x30, 0x33, 0x34, 0x35, 0x30, 0x39,
+0x61, 0x66, 0x35, 0x36, 0x34, 0x63, 0x36, 0x32,
+0x36, 0x34, 0x34, 0x63, 0x30, 0x37, 0x36, 0x39,
+0x31, 0x39, 0x34, 0x32, 0x65, 0x30, 0x63, 0x30,
+0x35, 0x36, 0x37, 0x35, 0x32, 0x30, 0x30, 0x38,
+0x61, 0x31, 0x37, 0x33, 0x63, 0x38, 0x39, 0x66,
+0x36, 0x30, 0x61, 0x62, 0x32, 0x61, 0x38, 0x38,
+0x61, 0x63, 0x32, 0x65, 0x62, 0x66, 0x61, 0x63,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x31, 0x35, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x22, 0x2c,
+0x20, 0x22, 0x50, 0x32, 0x53, 0x48, 0x22, 0x5d,
+0x2c, 0x0a, 0x0a, 0x5b, 0x22, 0x54, 0x65, 0x73,
+0x74, 0x73, 0x20, 0x66, 0x6f, 0x72, 0x20, 0x43,
+0x68, 0x65, 0x63, 0x6b, 0x54, 0x72, 0x61, 0x6e,
+0x73, 0x61, 0x63, 0x74, 0x69, 0x6f, 0x6e, 0x28,
+0x29, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x22, 0x4d,
+0x41, 0x58, 0x5f, 0x4d, 0x4f, 0x4e, 0x45, 0x59,
+0x20, 0x6f, 0x75, 0x74, 0x70, 0x75, 0x74, 0x22,
+0x5d, 0x2c, 0x0a, 0x5b, 0x5b, 0x5b, 0x22, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x22,
+0x2c, 0x20, 0x30, 0x2c, 0x20, 0x22, 0x48, 0x41,
+0x53, 0x48, 0x31, 0x36, 0x30, 0x20, 0x30, 0x78,
+0x31, 0x34, 0x20, 0x30, 0x78, 0x33, 0x32, 0x61,
+0x66, 0x61, 0x63, 0x32, 0x38, 0x31, 0x34, 0x36,
+0x32, 0x62, 0x38, 0x32, 0x32, 0x61, 0x64, 0x62,
+0x65, 0x63, 0x35, 0x30, 0x39, 0x34, 0x62, 0x38,
+0x64, 0x34, 0x64, 0x33, 0x33, 0x37, 0x64, 0x64,
+0x35, 0x62, 0x64, 0x36, 0x61, 0x20, 0x45, 0x51,
+0x55, 0x41, 0x4c, 0x22, 0x5d, 0x5d, 0x2c, 0x0a,
+0x22, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x31, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x36, 0x65, 0x34, 0x39, 0x33,
+0x30, 0x34, 0x36, 0x30, 0x32, 0x32, 0x31, 0x30,
+0x30, 0x65, 0x31, 0x65, 0x61, 0x64, 0x62, 0x61,
+0x30, 0x30, 0x64, 0x39, 0x32, 0x39, 0x36, 0x63,
+0x37, 0x34, 0x33, 0x63, 0x62, 0x36, 0x65, 0x63,
+0x63, 0x37, 0x30, 0x33, 0x66, 0x64, 0x39, 0x64,
+0x64, 0x63, 0x39, 0x62, 0x33, 0x63, 0x64, 0x31,
+0x32, 0x39, 0x30, 0x36, 0x31, 0x37, 0x36, 0x61,
+0x32, 0x32, 0x36, 0x61, 0x65, 0x34, 0x63, 0x31,
+0x38, 0x64, 0x36, 0x62, 0x30, 0x30, 0x37, 0x39,
+0x36, 0x30, 0x32, 0x32, 0x31, 0x30, 0x30, 0x61,
+0x37, 0x31, 0x61, 0x65, 0x66, 0x37, 0x64, 0x32,
+0x38, 0x37, 0x34, 0x64, 0x65, 0x66, 0x66, 0x36,
+0x38, 0x31, 0x62, 0x61, 0x36, 0x30, 0x38, 0x30,
+0x66, 0x31, 0x62, 0x32, 0x37, 0x38, 0x62, 0x61,
+0x63, 0x37, 0x62, 0x62, 0x39, 0x39, 0x63, 0x36,
+0x31, 0x62, 0x30, 0x38, 0x61, 0x38, 0x35, 0x66,
+0x34, 0x33, 0x31, 0x31, 0x39, 0x37, 0x30, 0x66,
+0x66, 0x65, 0x37, 0x66, 0x36, 0x33, 0x66, 0x30,
+0x31, 0x32, 0x33, 0x32, 0x31, 0x30, 0x33, 0x30,
+0x63, 0x30, 0x35, 0x38, 0x38, 0x64, 0x63, 0x34,
+0x34, 0x64, 0x39, 0x32, 0x62, 0x64, 0x63, 0x62,
+0x66, 0x38, 0x65, 0x37, 0x32, 0x30, 0x39, 0x33,
+0x34, 0x36, 0x36, 0x37, 0x36, 0x36, 0x66, 0x64,
+0x63, 0x32, 0x36, 0x35, 0x65, 0x61, 0x64, 0x38,
+0x64, 0x62, 0x36, 0x34, 0x35, 0x31, 0x37, 0x62,
+0x30, 0x63, 0x35, 0x34, 0x32, 0x32, 0x37, 0x35,
+0x62, 0x37, 0x30, 0x66, 0x66, 0x66, 0x62, 0x61,
+0x63, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x30, 0x31, 0x30, 0x30, 0x34, 0x30, 0x30,
+0x37, 0x35, 0x61, 0x66, 0x30, 0x37, 0x35, 0x30,
+0x37, 0x30, 0x30, 0x30, 0x31, 0x35, 0x31, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x22,
+0x2c, 0x20, 0x22, 0x50, 0x32, 0x53, 0x48, 0x22,
+0x5d, 0x2c, 0x0a, 0x0a, 0x5b, 0x22, 0x4d, 0x41,
+0x58, 0x5f, 0x4d, 0x4f, 0x4e, 0x45, 0x59, 0x20,
+0x6f, 0x75, 0x74, 0x70, 0x75, 0x74, 0x20, 0x2b,
+0x20, 0x30, 0x20, 0x6f, 0x75, 0x74, 0x70, 0x75,
+0x74, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b, 0x5b,
+0x22, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30,
+0x30, 0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20, 0x22,
+0x48, 0x41, 0x53, 0x48, 0x31, 0x36, 0x30, 0x20,
+0x30, 0x78, 0x31, 0x34, 0x20, 0x30, 0x78, 0x62,
+0x35, 0x35, 0x38, 0x63, 0x62, 0x66, 0x34, 0x39,
+0x33, 0x30, 0x39, 0x35, 0x34, 0x61, 0x61, 0x36,
+0x61, 0x33, 0x34, 0x34, 0x33, 0x36, 0x33, 0x61,
+0x31, 0x35, 0x36, 0x36, 0x38, 0x64, 0x37, 0x34,
+0x37, 0x37, 0x61, 0x65, 0x37, 0x31, 0x36, 0x20,
+0x45, 0x51, 0x55, 0x41, 0x4c, 0x22, 0x5d, 0x5d,
+0x2c, 0x0a, 0x22, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x36, 0x64, 0x34,
+0x38, 0x33, 0x30, 0x34, 0x35, 0x30, 0x32, 0x32,
+0x30, 0x32, 0x37, 0x64, 0x65, 0x63, 0x63, 0x63,
+0x31, 0x34, 0x61, 0x61, 0x36, 0x36, 0x36, 0x38,
+0x65, 0x37, 0x38, 0x61, 0x38, 0x63, 0x39, 0x64,
+0x61, 0x33, 0x34, 0x38, 0x34, 0x66, 0x62, 0x63,
+0x64, 0x34, 0x66, 0x39, 0x64, 0x63, 0x63, 0x39,
+0x62, 0x62, 0x37, 0x64, 0x31, 0x62, 0x38, 0x35,
+0x31, 0x34, 0x36, 0x33, 0x31, 0x34, 0x62, 0x32,
+0x31, 0x62, 0x39, 0x61, 0x65, 0x34, 0x64, 0x38,
+0x36, 0x30, 0x32, 0x32, 0x31, 0x30, 0x30, 0x64,
+0x30, 0x62, 0x34, 0x33, 0x64, 0x65, 0x63, 0x65,
+0x38, 0x63, 0x66, 0x62, 0x30, 0x37, 0x33, 0x34,
+0x38, 0x64, 0x65, 0x30, 0x63, 0x61, 0x38, 0x62,
+0x63, 0x35, 0x62, 0x38, 0x36, 0x32, 0x37, 0x36,
+0x66, 0x61, 0x38, 0x38, 0x66, 0x37, 0x66, 0x32,
+0x31, 0x33, 0x38, 0x33, 0x38, 0x31, 0x31, 0x32,
+0x38, 0x62, 0x37, 0x63, 0x33, 0x36, 0x61, 0x62,
+0x32, 0x65, 0x34, 0x32, 0x32, 0x36, 0x34, 0x30,
+0x31, 0x32, 0x33, 0x32, 0x31, 0x30, 0x32, 0x39,
+0x62, 0x62, 0x31, 0x33, 0x34, 0x36, 0x33, 0x64,
+0x64, 0x64, 0x35, 0x64, 0x32, 0x63, 0x63, 0x30,
+0x35, 0x64, 0x61, 0x36, 0x65, 0x38, 0x34, 0x65,
+0x33, 0x37, 0x35, 0x33, 0x36, 0x63, 0x62, 0x39,
+0x35, 0x32, 0x35, 0x37, 0x30, 0x33, 0x63, 0x66,
+0x64, 0x38, 0x66, 0x34, 0x33, 0x61, 0x66, 0x64,
+0x62, 0x34, 0x31, 0x34, 0x39, 0x38, 0x38, 0x39,
+0x38, 0x37, 0x61, 0x39, 0x32, 0x66, 0x36, 0x61,
+0x63, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x30, 0x32, 0x30, 0x30, 0x34, 0x30, 0x30,
+0x37, 0x35, 0x61, 0x66, 0x30, 0x37, 0x35, 0x30,
+0x37, 0x30, 0x30, 0x30, 0x31, 0x35, 0x31, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x35, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x22, 0x50,
+0x32, 0x53, 0x48, 0x22, 0x5d, 0x2c, 0x0a, 0x0a,
+0x5b, 0x22, 0x43, 0x6f, 0x69, 0x6e, 0x62, 0x61,
+0x73, 0x65, 0x20, 0x6f, 0x66, 0x20, 0x73, 0x69,
+0x7a, 0x65, 0x20, 0x32, 0x22, 0x5d, 0x2c, 0x0a,
+0x5b, 0x22, 0x4e, 0x6f, 0x74, 0x65, 0x20, 0x74,
+0x68, 0x65, 0x20, 0x69, 0x6e, 0x70, 0x75, 0x74,
+0x20, 0x69, 0x73, 0x20, 0x6a, 0x75, 0x73, 0x74,
+0x20, 0x72, 0x65, 0x71, 0x75, 0x69, 0x72, 0x65,
+0x64, 0x20, 0x74, 0x6f, 0x20, 0x6d, 0x61, 0x6b,
+0x65, 0x20, 0x74, 0x68, 0x65, 0x20, 0x74, 0x65,
+0x73, 0x74, 0x65, 0x72, 0x20, 0x68, 0x61, 0x70,
+0x70, 0x79, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b,
+0x5b, 0x22, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x22, 0x2c, 0x20, 0x2d, 0x31, 0x2c,
+0x20, 0x22, 0x31, 0x22, 0x5d, 0x5d, 0x2c, 0x0a,
+0x22, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x30, 0x32, 0x35, 0x31, 0x35,
+0x31, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x31, 0x35, 0x31, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x22,
+0x2c, 0x20, 0x22, 0x50, 0x32, 0x53, 0x48, 0x22,
+0x5d, 0x2c, 0x0a, 0x0a, 0x5b, 0x22, 0x43, 0x6f,
+0x69, 0x6e, 0x62, 0x61, 0x73, 0x65, 0x20, 0x6f,
+0x66, 0x20, 0x73, 0x69, 0x7a, 0x65, 0x20, 0x31,
+0x30, 0x30, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x22,
+0x4e, 0x6f, 0x74, 0x65, 0x20, 0x74, 0x68, 0x65,
+0x20, 0x69, 0x6e, 0x70, 0x75, 0x74, 0x20, 0x69,
+0x73, 0x20, 0x6a, 0x75, 0x73, 0x74, 0x20, 0x72,
+0x65, 0x71, 0x75, 0x69, 0x72, 0x65, 0x64, 0x20,
+0x74, 0x6f, 0x20, 0x6d, 0x61, 0x6b, 0x65, 0x20,
+0x74, 0x68, 0x65, 0x20, 0x74, 0x65, 0x73, 0x74,
+0x65, 0x72, 0x20, 0x68, 0x61, 0x70, 0x70, 0x79,
+0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b, 0x5b, 0x22,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x22, 0x2c, 0x20, 0x2d, 0x31, 0x2c, 0x20, 0x22,
+0x31, 0x22, 0x5d, 0x5d, 0x2c, 0x0a, 0x22, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x36, 0x34, 0x35, 0x31, 0x35, 0x31, 0x35,
+0x31, 0x35, 0x31, 0x35, 0x31, 0x35, 0x31, 0x35,
+0x31, 0x35, 0x31, 0x35, 0x31, 0x35, 0x31, 0x35,
+0x31, 0x35, 0x31, 0x35, 0x31, 0x35, 0x31, 0x35,
+0x31, 0x35, 0x31, 0x35, 0x31, 0x35, 0x31, 0x35,
+0x31, 0x35, 0x31, 0x35, 0x31, 0x35, 0x31, 0x35,
+0x31, 0x35, 0x31, 0x35, 0x31, 0x35, 0x31, 0x35,
+0x31, 0x35, 0x31, 0x35, 0x31, 0x35, 0x31, 0x35,
+0x31, 0x35, 0x31, 0x35, 0x31, 0x35, 0x31, 0x35,
+0x31, 0x35, 0x31, 0x35, 0x31, 0x35, 0x31, 0x35,
+0x31, 0x35, 0x31, 0x35, 0x31, 0x35, 0x31, 0x35,
+0x31, 0x35, 0x31, 0x35, 0x31, 0x35, 0x31, 0x35,
+0x31, 0x35, 0x31, 0x35, 0x31, 0x35, 0x31, 0x35,
+0x31, 0x35, 0x31, 0x35, 0x31, 0x35, 0x31, 0x35,
+0x31, 0x35, 0x31, 0x35, 0x31, 0x35, 0x31, 0x35,
+0x31, 0x35, 0x31, 0x35, 0x31, 0x35, 0x31, 0x35,
+0x31, 0x35, 0x31, 0x35, 0x31, 0x35, 0x31, 0x35,
+0x31, 0x35, 0x31, 0x35, 0x31, 0x35, 0x31, 0x35,
+0x31, 0x35, 0x31, 0x35, 0x31, 0x35, 0x31, 0x35,
+0x31, 0x35, 0x31, 0x35, 0x31, 0x35, 0x31, 0x35,
+0x31, 0x35, 0x31, 0x35, 0x31, 0x35, 0x31, 0x35,
+0x31, 0x35, 0x31, 0x35, 0x31, 0x35, 0x31, 0x35,
+0x31, 0x35, 0x31, 0x35, 0x31, 0x35, 0x31, 0x35,
+0x31, 0x35, 0x31, 0x35, 0x31, 0x35, 0x31, 0x35,
+0x31, 0x35, 0x31, 0x35, 0x31, 0x35, 0x31, 0x35,
+0x31, 0x35, 0x31, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x35,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x22, 0x2c, 0x20, 0x22, 0x50, 0x32, 0x53,
+0x48, 0x22, 0x5d, 0x2c, 0x0a, 0x0a, 0x5b, 0x22,
+0x53, 0x69, 0x6d, 0x70, 0x6c, 0x65, 0x20, 0x74,
+0x72, 0x61, 0x6e, 0x73, 0x61, 0x63, 0x74, 0x69,
+0x6f, 0x6e, 0x20, 0x77, 0x69, 0x74, 0x68, 0x20,
+0x66, 0x69, 0x72, 0x73, 0x74, 0x20, 0x69, 0x6e,
+0x70, 0x75, 0x74, 0x20, 0x69, 0x73, 0x20, 0x73,
+0x69, 0x67, 0x6e, 0x65, 0x64, 0x20, 0x77, 0x69,
+0x74, 0x68, 0x20, 0x53, 0x49, 0x47, 0x48, 0x41,
+0x53, 0x48, 0x5f, 0x41, 0x4c, 0x4c, 0x2c, 0x20,
+0x73, 0x65, 0x63, 0x6f, 0x6e, 0x64, 0x20, 0x77,
+0x69, 0x74, 0x68, 0x20, 0x53, 0x49, 0x47, 0x48,
+0x41, 0x53, 0x48, 0x5f, 0x41, 0x4e, 0x59, 0x4f,
+0x4e, 0x45, 0x43, 0x41, 0x4e, 0x50, 0x41, 0x59,
+0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b, 0x5b, 0x22,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20, 0x22, 0x30,
+0x78, 0x32, 0x31, 0x20, 0x30, 0x78, 0x30, 0x33,
+0x35, 0x65, 0x37, 0x66, 0x30, 0x64, 0x34, 0x64,
+0x30, 0x38, 0x34, 0x31, 0x62, 0x63, 0x64, 0x35,
+0x36, 0x63, 0x33, 0x39, 0x33, 0x33, 0x37, 0x65,
+0x64, 0x30, 0x38, 0x36, 0x62, 0x31, 0x61, 0x36,
+0x33, 0x33, 0x65, 0x65, 0x37, 0x37, 0x30, 0x63,
+0x31, 0x66, 0x66, 0x64, 0x64, 0x39, 0x34, 0x61,
+0x63, 0x35, 0x35, 0x32, 0x61, 0x39, 0x35, 0x61,
+0x63, 0x32, 0x63, 0x65, 0x30, 0x65, 0x66, 0x63,
+0x20, 0x43, 0x48, 0x45, 0x43, 0x4b, 0x53, 0x49,
+0x47, 0x22, 0x5d, 0x2c, 0x0a, 0x20, 0x20, 0x5b,
+0x22, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x32, 0x30,
+0x30, 0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20, 0x22,
+0x30, 0x78, 0x32, 0x31, 0x20, 0x30, 0x78, 0x30,
+0x33, 0x35, 0x65, 0x37, 0x66, 0x30, 0x64, 0x34,
+0x64, 0x30, 0x38, 0x34, 0x31, 0x62, 0x63, 0x64,
+0x35, 0x36, 0x63, 0x33, 0x39, 0x33, 0x33, 0x37,
+0x65, 0x64, 0x30, 0x38, 0x36, 0x62, 0x31, 0x61,
+0x36, 0x33, 0x33, 0x65, 0x65, 0x37, 0x37, 0x30,
+0x63, 0x31, 0x66, 0x66, 0x64, 0x64, 0x39, 0x34,
+0x61, 0x63, 0x35, 0x35, 0x32, 0x61, 0x39, 0x35,
+0x61, 0x63, 0x32, 0x63, 0x65, 0x30, 0x65, 0x66,
+0x63, 0x20, 0x43, 0x48, 0x45, 0x43, 0x4b, 0x53,
+0x49, 0x47, 0x22, 0x5d, 0x5d, 0x2c, 0x0a, 0x20,
+0x22, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x32, 0x30, 0x30, 0x30, 0x31, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x34, 0x39, 0x34, 0x38, 0x33,
+0x30, 0x34, 0x35, 0x30, 0x32, 0x32, 0x31, 0x30,
+0x30, 0x64, 0x31, 0x38, 0x30, 0x66, 0x64, 0x32,
+0x65, 0x62, 0x39, 0x31, 0x34, 0x30, 0x61, 0x65,
+0x62, 0x34, 0x32, 0x31, 0x30, 0x63, 0x39, 0x32,
+0x30, 0x34, 0x64, 0x33, 0x66, 0x33, 0x35, 0x38,
+0x37, 0x36, 0x36, 0x65, 0x62, 0x35, 0x33, 0x38,
+0x34, 0x32, 0x62, 0x32, 0x61, 0x39, 0x34, 0x37,
+0x33, 0x64, 0x62, 0x36, 0x38, 0x37, 0x66, 0x61,
+0x32, 0x34, 0x62, 0x31, 0x32, 0x61, 0x33, 0x63,
+0x63, 0x30, 0x32, 0x32, 0x30, 0x37, 0x39, 0x37,
+0x38, 0x31, 0x37, 0x39, 0x39, 0x63, 0x64, 0x34,
+0x66, 0x30, 0x33, 0x38, 0x62, 0x38, 0x35, 0x31,
+0x33, 0x35, 0x62, 0x62, 0x65, 0x34, 0x39, 0x65,
+0x63, 0x32, 0x62, 0x35, 0x37, 0x66, 0x33, 0x30,
+0x36, 0x62, 0x32, 0x62, 0x62, 0x31, 0x37, 0x31,
+0x30, 0x31, 0x62, 0x31, 0x37, 0x66, 0x37, 0x31,
+0x66, 0x30, 0x30, 0x30, 0x66, 0x63, 0x61, 0x62,
+0x32, 0x62, 0x36, 0x66, 0x62, 0x30, 0x31, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x30,
+0x30, 0x30, 0x32, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x34,
+0x38, 0x34, 0x37, 0x33, 0x30, 0x34, 0x34, 0x30,
+0x32, 0x32, 0x30, 0x35, 0x66, 0x37, 0x35, 0x33,
+0x30, 0x36, 0x35, 0x33, 0x65, 0x65, 0x61, 0x39,
+0x62, 0x33, 0x38, 0x36, 0x39, 0x39, 0x65, 0x34,
+0x37, 0x36, 0x33, 0x32, 0x30, 0x61, 0x62, 0x31,
+0x33, 0x35, 0x62, 0x37, 0x34, 0x37, 0x37, 0x31,
+0x65, 0x31, 0x63, 0x34, 0x38, 0x62, 0x38, 0x31,
+0x61, 0x35, 0x64, 0x30, 0x34, 0x31, 0x65, 0x32,
+0x63, 0x61, 0x38, 0x34, 0x62, 0x39, 0x62, 0x65,
+0x37, 0x61, 0x38, 0x30, 0x32, 0x32, 0x30, 0x30,
+0x61, 0x63, 0x38, 0x64, 0x31, 0x66, 0x34, 0x30,
+0x66, 0x62, 0x30, 0x32, 0x36, 0x36, 0x37, 0x34,
+0x66, 0x65, 0x35, 0x61, 0x35, 0x65, 0x64, 0x64,
+0x33, 0x64, 0x65, 0x61, 0x37, 0x31, 0x35, 0x63,
+0x32, 0x37, 0x62, 0x61, 0x61, 0x39, 0x62, 0x61,
+0x63, 0x61, 0x35, 0x31, 0x65, 0x64, 0x34, 0x35,
+0x65, 0x61, 0x37, 0x35, 0x30, 0x61, 0x63, 0x39,
+0x64, 0x63, 0x30, 0x61, 0x35, 0x35, 0x65, 0x38,
+0x31, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x30, 0x31, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x31, 0x35, 0x31, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x22,
+0x2c, 0x20, 0x22, 0x50, 0x32, 0x53, 0x48, 0x22,
+0x5d, 0x2c, 0x0a, 0x0a, 0x5b, 0x22, 0x53, 0x61,
+0x6d, 0x65, 0x20, 0x61, 0x73, 0x20, 0x61, 0x62,
+0x6f, 0x76, 0x65, 0x2c, 0x20, 0x62, 0x75, 0x74,
+0x20, 0x77, 0x65, 0x20, 0x63, 0x68, 0x61, 0x6e,
+0x67, 0x65, 0x20, 0x74, 0x68, 0x65, 0x20, 0x73,
+0x65, 0x71, 0x75, 0x65, 0x6e, 0x63, 0x65, 0x20,
+0x6e, 0x75, 0x6d, 0x62, 0x65, 0x72, 0x20, 0x6f,
+0x66, 0x20, 0x74, 0x68, 0x65, 0x20, 0x66, 0x69,
+0x72, 0x73, 0x74, 0x20, 0x69, 0x6e, 0x70, 0x75,
+0x74, 0x20, 0x74, 0x6f, 0x20, 0x63, 0x68, 0x65,
+0x63, 0x6b, 0x20, 0x74, 0x68, 0x61, 0x74, 0x20,
+0x53, 0x49, 0x47, 0x48, 0x41, 0x53, 0x48, 0x5f,
+0x41, 0x4e, 0x59, 0x4f, 0x4e, 0x45, 0x43, 0x41,
+0x4e, 0x50, 0x41, 0x59, 0x20, 0x69, 0x73, 0x20,
+0x62, 0x65, 0x69, 0x6e, 0x67, 0x20, 0x66, 0x6f,
+0x6c, 0x6c, 0x6f, 0x77, 0x65, 0x64, 0x22, 0x5d,
+0x2c, 0x0a, 0x5b, 0x5b, 0x5b, 0x22, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x22, 0x2c,
+0x20, 0x30, 0x2c, 0x20, 0x22, 0x30, 0x78, 0x32,
+0x31, 0x20, 0x30, 0x78, 0x30, 0x33, 0x35, 0x65,
+0x37, 0x66, 0x30, 0x64, 0x34, 0x64, 0x30, 0x38,
+0x34, 0x31, 0x62, 0x63, 0x64, 0x35, 0x36, 0x63,
+0x33, 0x39, 0x33, 0x33, 0x37, 0x65, 0x64, 0x30,
+0x38, 0x36, 0x62, 0x31, 0x61, 0x36, 0x33, 0x33,
+0x65, 0x65, 0x37, 0x37, 0x30, 0x63, 0x31, 0x66,
+0x66, 0x64, 0x64, 0x39, 0x34, 0x61, 0x63, 0x35,
+0x35, 0x32, 0x61, 0x39, 0x35, 0x61, 0x63, 0x32,
+0x63, 0x65, 0x30, 0x65, 0x66, 0x63, 0x20, 0x43,
+0x48, 0x45, 0x43, 0x4b, 0x53, 0x49, 0x47, 0x22,
+0x5d, 0x2c, 0x0a, 0x20, 0x20, 0x5b, 0x22, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x32, 0x30, 0x30, 0x22,
+0x2c, 0x20, 0x30, 0x2c, 0x20, 0x22, 0x30, 0x78,
+0x32, 0x31, 0x20, 0x30, 0x78, 0x30, 0x33, 0x35,
+0x65, 0x37, 0x66, 0x30, 0x64, 0x34, 0x64, 0x30,
+0x38, 0x34, 0x31, 0x62, 0x63, 0x64, 0x35, 0x36,
+0x63, 0x33, 0x39, 0x33, 0x33, 0x37, 0x65, 0x64,
+0x30, 0x38, 0x36, 0x62, 0x31, 0x61, 0x36, 0x33,
+0x33, 0x65, 0x65, 0x37, 0x37, 0x30, 0x63, 0x31,
+0x66, 0x66, 0x64, 0x64, 0x39, 0x34, 0x61, 0x63,
+0x35, 0x35, 0x32, 0x61, 0x39, 0x35, 0x61, 0x63,
+0x32, 0x63, 0x65, 0x30, 0x65, 0x66, 0x63, 0x20,
+0x43, 0x48, 0x45, 0x43, 0x4b, 0x53, 0x49, 0x47,
+0x22, 0x5d, 0x5d, 0x2c, 0x0a, 0x20, 0x22, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x32, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x34, 0x39, 0x34, 0x38, 0x33, 0x30, 0x34,
+0x35, 0x30, 0x32, 0x32, 0x30, 0x33, 0x61, 0x30,
+0x66, 0x35, 0x66, 0x30, 0x65, 0x31, 0x66, 0x32,
+0x62, 0x64, 0x62, 0x63, 0x64, 0x30, 0x34, 0x64,
+0x62, 0x33, 0x30, 0x36, 0x31, 0x64, 0x31, 0x38,
+0x66, 0x33, 0x61, 0x66, 0x37, 0x30, 0x65, 0x30,
+0x37, 0x66, 0x34, 0x66, 0x34, 0x36, 0x37, 0x63,
+0x62, 0x63, 0x31, 0x62, 0x38, 0x31, 0x31, 0x36,
+0x66, 0x32, 0x36, 0x37, 0x30, 0x32, 0x35, 0x66,
+0x35, 0x33, 0x36, 0x30, 0x62, 0x30, 0x32, 0x32,
+0x31, 0x30, 0x30, 0x63, 0x37, 0x39, 0x32, 0x62,
+0x36, 0x65, 0x32, 0x31, 0x35, 0x61, 0x66, 0x63,
+0x35, 0x61, 0x66, 0x63, 0x37, 0x32, 0x31, 0x61,
+0x33, 0x35, 0x31, 0x65, 0x63, 0x34, 0x31, 0x33,
+0x65, 0x37, 0x31, 0x34, 0x33, 0x30, 0x35, 0x63,
+0x62, 0x37, 0x34, 0x39, 0x61, 0x61, 0x65, 0x33,
+0x64, 0x37, 0x66, 0x65, 0x65, 0x37, 0x36, 0x36,
+0x32, 0x31, 0x33, 0x31, 0x33, 0x34, 0x31, 0x38,
+0x64, 0x66, 0x31, 0x30, 0x31, 0x30, 0x31, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x32, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x34, 0x38, 0x34,
+0x37, 0x33, 0x30, 0x34, 0x34, 0x30, 0x32, 0x32,
+0x30, 0x35, 0x66, 0x37, 0x35, 0x33, 0x30, 0x36,
+0x35, 0x33, 0x65, 0x65, 0x61, 0x39, 0x62, 0x33,
+0x38, 0x36, 0x39, 0x39, 0x65, 0x34, 0x37, 0x36,
+0x33, 0x32, 0x30, 0x61, 0x62, 0x31, 0x33, 0x35,
+0x62, 0x37, 0x34, 0x37, 0x37, 0x31, 0x65, 0x31,
+0x63, 0x34, 0x38, 0x62, 0x38, 0x31, 0x61, 0x35,
+0x64, 0x30, 0x34, 0x31, 0x65, 0x32, 0x63, 0x61,
+0x38, 0x34, 0x62, 0x39, 0x62, 0x65, 0x37, 0x61,
+0x38, 0x30, 0x32, 0x32, 0x30, 0x30, 0x61, 0x63,
+0x38, 0x64, 0x31, 0x66, 0x34, 0x30, 0x66, 0x62,
+0x30, 0x32, 0x36, 0x36, 0x37, 0x34, 0x66, 0x65,
+0x35, 0x61, 0x35, 0x65, 0x64, 0x64, 0x33, 0x64,
+0x65, 0x61, 0x37, 0x31, 0x35, 0x63, 0x32, 0x37,
+0x62, 0x61, 0x61, 0x39, 0x62, 0x61, 0x63, 0x61,
+0x35, 0x31, 0x65, 0x64, 0x34, 0x35, 0x65, 0x61,
+0x37, 0x35, 0x30, 0x61, 0x63, 0x39, 0x64, 0x63,
+0x30, 0x61, 0x35, 0x35, 0x65, 0x38, 0x31, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x30,
+0x31, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x31, 0x35, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x22, 0x2c, 0x20,
+0x22, 0x50, 0x32, 0x53, 0x48, 0x22, 0x5d, 0x2c,
+0x0a, 0x0a, 0x5b, 0x22, 0x61, 0x66, 0x64, 0x39,
+0x63, 0x31, 0x37, 0x66, 0x38, 0x39, 0x31, 0x33,
+0x35, 0x37, 0x37, 0x65, 0x63, 0x33, 0x35, 0x30,
+0x39, 0x35, 0x32, 0x30, 0x62, 0x64, 0x36, 0x65,
+0x35, 0x64, 0x36, 0x33, 0x65, 0x39, 0x63, 0x30,
+0x66, 0x64, 0x32, 0x61, 0x35, 0x66, 0x37, 0x30,
+0x63, 0x37, 0x38, 0x37, 0x39, 0x39, 0x33, 0x62,
+0x30, 0x39, 0x37, 0x62, 0x61, 0x36, 0x63, 0x61,
+0x39, 0x66, 0x61, 0x65, 0x20, 0x77, 0x68, 0x69,
+0x63, 0x68, 0x20, 0x68, 0x61, 0x73, 0x20, 0x73,
+0x65, 0x76, 0x65, 0x72, 0x61, 0x6c, 0x20, 0x53,
+0x49, 0x47, 0x48, 0x41, 0x53, 0x48, 0x5f, 0x53,
+0x49, 0x4e, 0x47, 0x4c, 0x45, 0x20, 0x73, 0x69,
+0x67, 0x6e, 0x61, 0x74, 0x75, 0x72, 0x65, 0x73,
+0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b, 0x5b, 0x22,
+0x36, 0x33, 0x63, 0x66, 0x61, 0x35, 0x61, 0x30,
+0x39, 0x64, 0x63, 0x35, 0x34, 0x30, 0x62, 0x66,
+0x36, 0x33, 0x65, 0x35, 0x33, 0x37, 0x31, 0x33,
+0x62, 0x38, 0x32, 0x64, 0x39, 0x65, 0x61, 0x33,
+0x36, 0x39, 0x32, 0x63, 0x61, 0x39, 0x37, 0x63,
+0x64, 0x36, 0x30, 0x38, 0x63, 0x33, 0x38, 0x34,
+0x66, 0x32, 0x61, 0x61, 0x38, 0x38, 0x65, 0x35,
+0x31, 0x61, 0x30, 0x61, 0x61, 0x63, 0x37, 0x30,
+0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20, 0x22, 0x44,
+0x55, 0x50, 0x20, 0x48, 0x41, 0x53, 0x48, 0x31,
+0x36, 0x30, 0x20, 0x30, 0x78, 0x31, 0x34, 0x20,
+0x30, 0x78, 0x64, 0x63, 0x66, 0x37, 0x32, 0x63,
+0x34, 0x66, 0x64, 0x30, 0x32, 0x66, 0x35, 0x61,
+0x39, 0x38, 0x37, 0x63, 0x66, 0x39, 0x62, 0x30,
+0x32, 0x66, 0x32, 0x66, 0x61, 0x62, 0x66, 0x63,
+0x61, 0x63, 0x33, 0x33, 0x34, 0x31, 0x61, 0x38,
+0x37, 0x64, 0x20, 0x45, 0x51, 0x55, 0x41, 0x4c,
+0x56, 0x45, 0x52, 0x49, 0x46, 0x59, 0x20, 0x43,
+0x48, 0x45, 0x43, 0x4b, 0x53, 0x49, 0x47, 0x22,
+0x5d, 0x2c, 0x0a, 0x20, 0x5b, 0x22, 0x30, 0x34,
+0x65, 0x38, 0x64, 0x30, 0x66, 0x63, 0x66, 0x33,
+0x38, 0x34, 0x36, 0x63, 0x36, 0x37, 0x33, 0x34,
+0x34, 0x37, 0x37, 0x62, 0x39, 0x38, 0x66, 0x30,
+0x66, 0x33, 0x64, 0x34, 0x62, 0x61, 0x64, 0x66,
+0x62, 0x37, 0x38, 0x66, 0x30, 0x32, 0x30, 0x65,
+0x65, 0x30, 0x39, 0x37, 0x61, 0x30, 0x62, 0x65,
+0x35, 0x66, 0x65, 0x33, 0x34, 0x37, 0x36, 0x34,
+0x35, 0x62, 0x38, 0x31, 0x37, 0x64, 0x22, 0x2c,
+0x20, 0x31, 0x2c, 0x20, 0x22, 0x44, 0x55, 0x50,
+0x20, 0x48, 0x41, 0x53, 0x48, 0x31, 0x36, 0x30,
+0x20, 0x30, 0x78, 0x31, 0x34, 0x20, 0x30, 0x78,
+0x64, 0x63, 0x66, 0x37, 0x32, 0x63, 0x34, 0x66,
+0x64, 0x30, 0x32, 0x66, 0x35, 0x61, 0x39, 0x38,
+0x37, 0x63, 0x66, 0x39, 0x62, 0x30, 0x32, 0x66,
+0x32, 0x66, 0x61, 0x62, 0x66, 0x63, 0x61, 0x63,
+0x33, 0x33, 0x34, 0x31, 0x61, 0x38, 0x37, 0x64,
+0x20, 0x45, 0x51, 0x55, 0x41, 0x4c, 0x56, 0x45,
+0x52, 0x49, 0x46, 0x59, 0x20, 0x43, 0x48, 0x45,
+0x43, 0x4b, 0x53, 0x49, 0x47, 0x22, 0x5d, 0x2c,
+0x0a, 0x20, 0x5b, 0x22, 0x65, 0x65, 0x31, 0x33,
+0x37, 0x37, 0x61, 0x66, 0x66, 0x35, 0x64, 0x30,
+0x35, 0x37, 0x39, 0x39, 0x30, 0x39, 0x65, 0x31,
+0x31, 0x37, 0x38, 0x32, 0x65, 0x31, 0x64, 0x32,
+0x66, 0x35, 0x66, 0x37, 0x62, 0x38, 0x34, 0x64,
+0x32, 0x36, 0x35, 0x33, 0x37, 0x62, 0x65, 0x37,
+0x66, 0x35, 0x35, 0x31, 0x36, 0x64, 0x64, 0x34,
+0x65, 0x34, 0x33, 0x33, 0x37, 0x33, 0x30, 0x39,
+0x31, 0x66, 0x33, 0x66, 0x22, 0x2c, 0x20, 0x31,
+0x2c, 0x20, 0x22, 0x44, 0x55, 0x50, 0x20, 0x48,
+0x41, 0x53, 0x48, 0x31, 0x36, 0x30, 0x20, 0x30,
+0x78, 0x31, 0x34, 0x20, 0x30, 0x78, 0x64, 0x63,
+0x66, 0x37, 0x32, 0x63, 0x34, 0x66, 0x64, 0x30,
+0x32, 0x66, 0x35, 0x61, 0x39, 0x38, 0x37, 0x63,
+0x66, 0x39, 0x62, 0x30, 0x32, 0x66, 0x32, 0x66,
+0x61, 0x62, 0x66, 0x63, 0x61, 0x63, 0x33, 0x33,
+0x34, 0x31, 0x61, 0x38, 0x37, 0x64, 0x20, 0x45,
+0x51, 0x55, 0x41, 0x4c, 0x56, 0x45, 0x52, 0x49,
+0x46, 0x59, 0x20, 0x43, 0x48, 0x45, 0x43, 0x4b,
+0x53, 0x49, 0x47, 0x22, 0x5d, 0x5d, 0x2c, 0x0a,
+0x20, 0x22, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x33, 0x37, 0x30, 0x61, 0x63,
+0x30, 0x61, 0x31, 0x61, 0x65, 0x35, 0x38, 0x38,
+0x61, 0x61, 0x66, 0x32, 0x38, 0x34, 0x63, 0x33,
+0x30, 0x38, 0x64, 0x36, 0x37, 0x63, 0x61, 0x39,
+0x32, 0x63, 0x36, 0x39, 0x61, 0x33, 0x39, 0x65,
+0x32, 0x64, 0x62, 0x38, 0x31, 0x33, 0x33, 0x37,
+0x65, 0x35, 0x36, 0x33, 0x62, 0x66, 0x34, 0x30,
+0x63, 0x35, 0x39, 0x64, 0x61, 0x30, 0x61, 0x35,
+0x63, 0x66, 0x36, 0x33, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x36, 0x61, 0x34, 0x37,
+0x33, 0x30, 0x34, 0x34, 0x30, 0x32, 0x32, 0x30,
+0x33, 0x36, 0x30, 0x64, 0x32, 0x30, 0x62, 0x61,
+0x66, 0x66, 0x33, 0x38, 0x32, 0x30, 0x35, 0x39,
+0x30, 0x34, 0x30, 0x62, 0x61, 0x39, 0x62, 0x65,
+0x39, 0x38, 0x39, 0x34, 0x37, 0x66, 0x64, 0x36,
+0x37, 0x38, 0x66, 0x62, 0x30, 0x38, 0x61, 0x61,
+0x62, 0x32, 0x62, 0x62, 0x30, 0x63, 0x31, 0x37,
+0x32, 0x65, 0x66, 0x61, 0x39, 0x39, 0x36, 0x66,
+0x64, 0x38, 0x65, 0x63, 0x65, 0x39, 0x62, 0x37,
+0x30, 0x32, 0x32, 0x30, 0x31, 0x62, 0x34, 0x66,
+0x62, 0x30, 0x64, 0x65, 0x36, 0x37, 0x66, 0x30,
+0x31, 0x35, 0x63, 0x39, 0x30, 0x65, 0x37, 0x61,
+0x63, 0x38, 0x61, 0x31, 0x39, 0x33, 0x61, 0x65,
+0x61, 0x62, 0x34, 0x38, 0x36, 0x61, 0x31, 0x66,
+0x35, 0x38, 0x37, 0x65, 0x30, 0x66, 0x35, 0x34,
+0x64, 0x30, 0x66, 0x62, 0x39, 0x35, 0x35, 0x32,
+0x65, 0x66, 0x37, 0x66, 0x35, 0x63, 0x65, 0x36,
+0x63, 0x61, 0x65, 0x63, 0x30, 0x33, 0x32, 0x31,
+0x30, 0x33, 0x35, 0x37, 0x39, 0x63, 0x61, 0x32,
+0x65, 0x36, 0x64, 0x31, 0x30, 0x37, 0x35, 0x32,
+0x32, 0x66, 0x30, 0x31, 0x32, 0x63, 0x64, 0x30,
+0x30, 0x62, 0x35, 0x32, 0x62, 0x39, 0x61, 0x36,
+0x35, 0x66, 0x62, 0x34, 0x36, 0x66, 0x30, 0x63,
+0x35, 0x37, 0x62, 0x39, 0x62, 0x38, 0x62, 0x36,
+0x65, 0x33, 0x37, 0x37, 0x63, 0x34, 0x38, 0x66,
+0x35, 0x32, 0x36, 0x61, 0x34, 0x34, 0x37, 0x34,
+0x31, 0x61, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x37, 0x64, 0x38, 0x31, 0x35, 0x62,
+0x36, 0x34, 0x34, 0x37, 0x65, 0x33, 0x35, 0x66,
+0x62, 0x65, 0x61, 0x30, 0x39, 0x37, 0x65, 0x30,
+0x30, 0x65, 0x30, 0x32, 0x38, 0x66, 0x62, 0x37,
+0x64, 0x66, 0x62, 0x61, 0x64, 0x34, 0x66, 0x33,
+0x66, 0x30, 0x39, 0x38, 0x37, 0x62, 0x34, 0x37,
+0x33, 0x34, 0x36, 0x37, 0x36, 0x63, 0x38, 0x34,
+0x66, 0x33, 0x66, 0x63, 0x64, 0x30, 0x65, 0x38,
+0x30, 0x34, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x36, 0x62, 0x34, 0x38, 0x33, 0x30,
+0x34, 0x35, 0x30, 0x32, 0x32, 0x31, 0x30, 0x30,
+0x63, 0x37, 0x31, 0x34, 0x33, 0x31, 0x30, 0x62,
+0x65, 0x31, 0x65, 0x33, 0x61, 0x39, 0x66, 0x66,
+0x31, 0x63, 0x35, 0x66, 0x37, 0x63, 0x61, 0x63,
+0x63, 0x36, 0x35, 0x63, 0x32, 0x64, 0x38, 0x65,
+0x37, 0x38, 0x31, 0x66, 0x63, 0x33, 0x61, 0x38,
+0x38, 0x63, 0x65, 0x62, 0x30, 0x36, 0x33, 0x63,
+0x36, 0x31, 0x35, 0x33, 0x62, 0x66, 0x39, 0x35,
+0x30, 0x36, 0x35, 0x30, 0x38, 0x30, 0x32, 0x31,
+0x30, 0x32, 0x32, 0x30, 0x30, 0x62, 0x32, 0x64,
+0x30, 0x39, 0x37, 0x39, 0x63, 0x37, 0x36, 0x65,
+0x31, 0x32, 0x62, 0x62, 0x34, 0x38, 0x30, 0x64,
+0x61, 0x36, 0x33, 0x35, 0x66, 0x31, 0x39, 0x32,
+0x63, 0x63, 0x38, 0x64, 0x63, 0x36, 0x66, 0x39,
+0x30, 0x35, 0x33, 0x38, 0x30, 0x64, 0x64, 0x34,
+0x61, 0x63, 0x31, 0x66, 0x66, 0x33, 0x35, 0x61,
+0x34, 0x66, 0x36, 0x38, 0x66, 0x34, 0x36, 0x32,
+0x66, 0x66, 0x66, 0x64, 0x30, 0x33, 0x32, 0x31,
+0x30, 0x33, 0x35, 0x37, 0x39, 0x63, 0x61, 0x32,
+0x65, 0x36, 0x64, 0x31, 0x30, 0x37, 0x35, 0x32,
+0x32, 0x66, 0x30, 0x31, 0x32, 0x63, 0x64, 0x30,
+0x30, 0x62, 0x35, 0x32, 0x62, 0x39, 0x61, 0x36,
+0x35, 0x66, 0x62, 0x34, 0x36, 0x66, 0x30, 0x63,
+0x35, 0x37, 0x62, 0x39, 0x62, 0x38, 0x62, 0x36,
+0x65, 0x33, 0x37, 0x37, 0x63, 0x34, 0x38, 0x66,
+0x35, 0x32, 0x36, 0x61, 0x34, 0x34, 0x37, 0x34,
+0x31, 0x61, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x33, 0x66, 0x31, 0x66, 0x30, 0x39,
+0x37, 0x33, 0x33, 0x33, 0x65, 0x34, 0x64, 0x34,
+0x36, 0x64, 0x35, 0x31, 0x66, 0x35, 0x65, 0x37,
+0x37, 0x62, 0x35, 0x33, 0x32, 0x36, 0x34, 0x64,
+0x62, 0x38, 0x66, 0x37, 0x66, 0x35, 0x64, 0x32,
+0x65, 0x31, 0x38, 0x32, 0x31, 0x37, 0x65, 0x31,
+0x30, 0x39, 0x39, 0x39, 0x35, 0x37, 0x64, 0x30,
+0x66, 0x35, 0x61, 0x66, 0x37, 0x37, 0x31, 0x33,
+0x65, 0x65, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x36, 0x63, 0x34, 0x39, 0x33, 0x30,
+0x34, 0x36, 0x30, 0x32, 0x32, 0x31, 0x30, 0x30,
+0x62, 0x36, 0x36, 0x33, 0x34, 0x39, 0x39, 0x65,
+0x66, 0x37, 0x33, 0x32, 0x37, 0x33, 0x61, 0x33,
+0x37, 0x38, 0x38, 0x64, 0x65, 0x61, 0x33, 0x34,
+0x32, 0x37, 0x31, 0x37, 0x63, 0x32, 0x36, 0x34,
+0x30, 0x61, 0x63, 0x34, 0x33, 0x63, 0x35, 0x61,
+0x31, 0x63, 0x66, 0x38, 0x36, 0x32, 0x63, 0x39,
+0x65, 0x30, 0x39, 0x62, 0x32, 0x30, 0x36, 0x66,
+0x63, 0x62, 0x33, 0x66, 0x36, 0x62, 0x62, 0x38,
+0x30, 0x32, 0x32, 0x31, 0x30, 0x30, 0x62, 0x30,
+0x39, 0x39, 0x37, 0x32, 0x65, 0x37, 0x35, 0x39,
+0x37, 0x32, 0x64, 0x39, 0x31, 0x34, 0x38, 0x66,
+0x32, 0x62, 0x64, 0x64, 0x34, 0x36, 0x32, 0x65,
+0x35, 0x63, 0x62, 0x36, 0x39, 0x62, 0x35, 0x37,
+0x63, 0x31, 0x32, 0x31, 0x34, 0x62, 0x38, 0x38,
+0x66, 0x63, 0x35, 0x35, 0x63, 0x61, 0x36, 0x33,
+0x38, 0x36, 0x37, 0x36, 0x63, 0x30, 0x37, 0x63,
+0x66, 0x63, 0x31, 0x30, 0x64, 0x38, 0x30, 0x33,
+0x32, 0x31, 0x30, 0x33, 0x35, 0x37, 0x39, 0x63,
+0x61, 0x32, 0x65, 0x36, 0x64, 0x31, 0x30, 0x37,
+0x35, 0x32, 0x32, 0x66, 0x30, 0x31, 0x32, 0x63,
+0x64, 0x30, 0x30, 0x62, 0x35, 0x32, 0x62, 0x39,
+0x61, 0x36, 0x35, 0x66, 0x62, 0x34, 0x36, 0x66,
+0x30, 0x63, 0x35, 0x37, 0x62, 0x39, 0x62, 0x38,
+0x62, 0x36, 0x65, 0x33, 0x37, 0x37, 0x63, 0x34,
+0x38, 0x66, 0x35, 0x32, 0x36, 0x61, 0x34, 0x34,
+0x37, 0x34, 0x31, 0x61, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x30, 0x33, 0x38, 0x30,
+0x38, 0x34, 0x31, 0x65, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x39,
+0x37, 0x36, 0x61, 0x39, 0x31, 0x34, 0x62, 0x66,
+0x62, 0x32, 0x38, 0x32, 0x63, 0x37, 0x30, 0x63,
+0x34, 0x31, 0x39, 0x31, 0x66, 0x34, 0x35, 0x62,
+0x35, 0x61, 0x36, 0x36, 0x36, 0x35, 0x63, 0x61,
+0x64, 0x31, 0x36, 0x38, 0x32, 0x66, 0x32, 0x63,
+0x39, 0x63, 0x66, 0x64, 0x66, 0x62, 0x38, 0x38,
+0x61, 0x63, 0x38, 0x30, 0x38, 0x34, 0x31, 0x65,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x31, 0x39, 0x37, 0x36, 0x61, 0x39,
+0x31, 0x34, 0x39, 0x38, 0x35, 0x37, 0x63, 0x63,
+0x30, 0x37, 0x62, 0x65, 0x64, 0x33, 0x33, 0x61,
+0x35, 0x63, 0x66, 0x31, 0x32, 0x62, 0x39, 0x63,
+0x35, 0x65, 0x30, 0x35, 0x30, 0x30, 0x62, 0x36,
+0x37, 0x35, 0x64, 0x35, 0x30, 0x30, 0x63, 0x38,
+0x31, 0x31, 0x38, 0x38, 0x61, 0x63, 0x65, 0x30,
+0x66, 0x64, 0x31, 0x63, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x39,
+0x37, 0x36, 0x61, 0x39, 0x31, 0x34, 0x34, 0x33,
+0x63, 0x35, 0x32, 0x38, 0x35, 0x30, 0x36, 0x30,
+0x36, 0x63, 0x38, 0x37, 0x32, 0x34, 0x30, 0x33,
+0x63, 0x30, 0x36, 0x30, 0x31, 0x65, 0x36, 0x39,
+0x66, 0x61, 0x33, 0x34, 0x62, 0x32, 0x36, 0x66,
+0x36, 0x32, 0x64, 0x62, 0x34, 0x61, 0x38, 0x38,
+0x61, 0x63, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x22, 0x2c, 0x20, 0x22, 0x50, 0x32,
+0x53, 0x48, 0x22, 0x5d, 0x2c, 0x0a, 0x0a, 0x20,
+0x5b, 0x22, 0x64, 0x64, 0x63, 0x34, 0x35, 0x34,
+0x61, 0x31, 0x63, 0x30, 0x63, 0x33, 0x35, 0x63,
+0x31, 0x38, 0x38, 0x63, 0x39, 0x38, 0x39, 0x37,
+0x36, 0x62, 0x31, 0x37, 0x36, 0x37, 0x30, 0x66,
+0x36, 0x39, 0x65, 0x35, 0x38, 0x36, 0x64, 0x39,
+0x63, 0x30, 0x66, 0x33, 0x35, 0x39, 0x33, 0x65,
+0x61, 0x38, 0x37, 0x39, 0x39, 0x32, 0x38, 0x33,
+0x33, 0x32, 0x66, 0x30, 0x61, 0x30, 0x36, 0x39,
+0x65, 0x37, 0x2c, 0x20, 0x77, 0x68, 0x69, 0x63,
+0x68, 0x20, 0x73, 0x70, 0x65, 0x6e, 0x64, 0x73,
+0x20, 0x61, 0x6e, 0x20, 0x69, 0x6e, 0x70, 0x75,
+0x74, 0x20, 0x74, 0x68, 0x61, 0x74, 0x20, 0x70,
+0x75, 0x73, 0x68, 0x65, 0x73, 0x20, 0x75, 0x73,
+0x69, 0x6e, 0x67, 0x20, 0x61, 0x20, 0x50, 0x55,
+0x53, 0x48, 0x44, 0x41, 0x54, 0x41, 0x31, 0x20,
+0x74, 0x68, 0x61, 0x74, 0x20, 0x69, 0x73, 0x20,
+0x6e, 0x65, 0x67, 0x61, 0x74, 0x69, 0x76, 0x65,
+0x20, 0x77, 0x68, 0x65, 0x6e, 0x20, 0x72, 0x65,
+0x61, 0x64, 0x20, 0x61, 0x73, 0x20, 0x73, 0x69,
+0x67, 0x6e, 0x65, 0x64, 0x22, 0x5d, 0x2c, 0x0a,
+0x20, 0x5b, 0x5b, 0x5b, 0x22, 0x63, 0x35, 0x35,
+0x31, 0x30, 0x61, 0x35, 0x64, 0x64, 0x39, 0x37,
+0x61, 0x32, 0x35, 0x66, 0x34, 0x33, 0x31, 0x37,
+0x35, 0x61, 0x66, 0x31, 0x66, 0x65, 0x36, 0x34,
+0x39, 0x62, 0x37, 0x30, 0x37, 0x62, 0x31, 0x64,
+0x66, 0x38, 0x65, 0x31, 0x61, 0x34, 0x31, 0x34,
+0x38, 0x39, 0x62, 0x61, 0x63, 0x33, 0x33, 0x61,
+0x32, 0x33, 0x30, 0x38, 0x37, 0x30, 0x32, 0x37,
+0x61, 0x32, 0x66, 0x34, 0x38, 0x22, 0x2c, 0x20,
+0x30, 0x2c, 0x20, 0x22, 0x30, 0x78, 0x34, 0x63,
+0x20, 0x30, 0x78, 0x61, 0x65, 0x20, 0x30, 0x78,
+0x36, 0x30, 0x36, 0x35, 0x36, 0x33, 0x36, 0x38,
+0x36, 0x66, 0x32, 0x30, 0x32, 0x32, 0x35, 0x35,
+0x33, 0x32, 0x34, 0x36, 0x37, 0x33, 0x36, 0x34,
+0x34, 0x37, 0x35, 0x36, 0x36, 0x62, 0x35, 0x38,
+0x33, 0x31, 0x32, 0x62, 0x35, 0x61, 0x35, 0x33,
+0x36, 0x65, 0x35, 0x38, 0x37, 0x35, 0x37, 0x34,
+0x33, 0x35, 0x36, 0x35, 0x34, 0x32, 0x37, 0x39,
+0x33, 0x30, 0x36, 0x36, 0x37, 0x39, 0x34, 0x37,
+0x37, 0x38, 0x36, 0x32, 0x35, 0x34, 0x35, 0x36,
+0x34, 0x31, 0x35, 0x36, 0x37, 0x35, 0x35, 0x33,
+0x34, 0x61, 0x36, 0x63, 0x33, 0x37, 0x36, 0x61,
+0x36, 0x61, 0x33, 0x33, 0x34, 0x38, 0x37, 0x38,
+0x34, 0x31, 0x36, 0x39, 0x34, 0x35, 0x33, 0x32,
+0x35, 0x33, 0x36, 0x34, 0x36, 0x36, 0x37, 0x36,
+0x35, 0x37, 0x37, 0x33, 0x34, 0x66, 0x35, 0x33,
+0x34, 0x37, 0x34, 0x66, 0x33, 0x36, 0x36, 0x33,
+0x33, 0x33, 0x33, 0x38, 0x35, 0x38, 0x34, 0x64,
+0x37, 0x34, 0x33, 0x39, 0x34, 0x33, 0x35, 0x63,
+0x36, 0x65, 0x35, 0x34, 0x33, 0x32, 0x34, 0x39,
+0x35, 0x38, 0x34, 0x39, 0x36, 0x37, 0x33, 0x30,
+0x36, 0x61, 0x34, 0x38, 0x36, 0x39, 0x35, 0x36,
+0x33, 0x30, 0x34, 0x66, 0x33, 0x37, 0x36, 0x65,
+0x37, 0x37, 0x35, 0x32, 0x33, 0x36, 0x36, 0x34,
+0x34, 0x35, 0x34, 0x36, 0x36, 0x37, 0x33, 0x64,
+0x33, 0x64, 0x32, 0x32, 0x32, 0x30, 0x33, 0x65,
+0x32, 0x30, 0x37, 0x34, 0x33, 0x62, 0x32, 0x30,
+0x36, 0x66, 0x37, 0x30, 0x36, 0x35, 0x36, 0x65,
+0x37, 0x33, 0x37, 0x33, 0x36, 0x63, 0x32, 0x30,
+0x36, 0x35, 0x36, 0x65, 0x36, 0x33, 0x32, 0x30,
+0x32, 0x64, 0x37, 0x30, 0x36, 0x31, 0x37, 0x33,
+0x37, 0x33, 0x32, 0x30, 0x37, 0x30, 0x36, 0x31,
+0x37, 0x33, 0x37, 0x33, 0x33, 0x61, 0x35, 0x62,
+0x33, 0x31, 0x34, 0x61, 0x35, 0x36, 0x34, 0x64,
+0x37, 0x37, 0x35, 0x31, 0x34, 0x33, 0x32, 0x64,
+0x37, 0x30, 0x37, 0x32, 0x36, 0x39, 0x37, 0x36,
+0x36, 0x62, 0x36, 0x35, 0x37, 0x39, 0x32, 0x64,
+0x36, 0x38, 0x36, 0x35, 0x37, 0x38, 0x35, 0x64,
+0x32, 0x30, 0x32, 0x64, 0x36, 0x34, 0x32, 0x30,
+0x32, 0x64, 0x36, 0x31, 0x36, 0x35, 0x37, 0x33,
+0x32, 0x64, 0x33, 0x32, 0x33, 0x35, 0x33, 0x36,
+0x32, 0x64, 0x36, 0x33, 0x36, 0x32, 0x36, 0x33,
+0x32, 0x30, 0x32, 0x64, 0x36, 0x31, 0x32, 0x30,
+0x32, 0x64, 0x36, 0x39, 0x36, 0x65, 0x32, 0x30,
+0x37, 0x34, 0x36, 0x30, 0x20, 0x44, 0x52, 0x4f,
+0x50, 0x20, 0x44, 0x55, 0x50, 0x20, 0x48, 0x41,
+0x53, 0x48, 0x31, 0x36, 0x30, 0x20, 0x30, 0x78,
+0x31, 0x34, 0x20, 0x30, 0x78, 0x62, 0x66, 0x64,
+0x37, 0x34, 0x33, 0x36, 0x62, 0x36, 0x32, 0x36,
+0x35, 0x61, 0x61, 0x39, 0x64, 0x65, 0x35, 0x30,
+0x36, 0x66, 0x38, 0x61, 0x39, 0x39, 0x34, 0x66,
+0x38, 0x38, 0x31, 0x66, 0x66, 0x30, 0x38, 0x63,
+0x63, 0x32, 0x38, 0x37, 0x32, 0x20, 0x45, 0x51,
+0x55, 0x41, 0x4c, 0x56, 0x45, 0x52, 0x49, 0x46,
+0x59, 0x20, 0x43, 0x48, 0x45, 0x43, 0x4b, 0x53,
+0x49, 0x47, 0x22, 0x5d, 0x5d, 0x2c, 0x0a, 0x20,
+0x22, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x31, 0x34, 0x38, 0x32, 0x66, 0x37,
+0x61, 0x30, 0x32, 0x38, 0x37, 0x33, 0x30, 0x61,
+0x32, 0x33, 0x33, 0x61, 0x63, 0x39, 0x62, 0x34,
+0x38, 0x34, 0x31, 0x31, 0x61, 0x38, 0x65, 0x64,
+0x66, 0x62, 0x31, 0x30, 0x37, 0x62, 0x37, 0x34,
+0x39, 0x65, 0x36, 0x31, 0x66, 0x61, 0x66, 0x37,
+0x35, 0x33, 0x31, 0x66, 0x34, 0x32, 0x35, 0x37,
+0x61, 0x64, 0x39, 0x35, 0x64, 0x30, 0x61, 0x35,
+0x31, 0x63, 0x35, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x38, 0x62, 0x34, 0x38, 0x33,
+0x30, 0x34, 0x35, 0x30, 0x32, 0x32, 0x31, 0x30,
+0x30, 0x62, 0x66, 0x30, 0x62, 0x62, 0x61, 0x65,
+0x39, 0x62, 0x64, 0x65, 0x35, 0x31, 0x61, 0x64,
+0x32, 0x62, 0x32, 0x32, 0x32, 0x65, 0x38, 0x37,
+0x66, 0x62, 0x66, 0x36, 0x37, 0x35, 0x33, 0x30,
+0x66, 0x62, 0x61, 0x66, 0x63, 0x32, 0x35, 0x63,
+0x39, 0x30, 0x33, 0x35, 0x31, 0x39, 0x61, 0x31,
+0x65, 0x35, 0x64, 0x63, 0x63, 0x35, 0x32, 0x61,
+0x33, 0x32, 0x66, 0x66, 0x35, 0x38, 0x34, 0x34,
+0x65, 0x30, 0x32, 0x32, 0x30, 0x32, 0x38, 0x63,
+0x34, 0x64, 0x39, 0x61, 0x64, 0x34, 0x39, 0x62,
+0x30, 0x30, 0x36, 0x64, 0x64, 0x35, 0x39, 0x39,
+0x37, 0x34, 0x33, 0x37, 0x32, 0x61, 0x35, 0x34,
+0x32, 0x39, 0x31, 0x64, 0x35, 0x37, 0x36, 0x34,
+0x62, 0x65, 0x35, 0x34, 0x31, 0x35, 0x37, 0x34,
+0x62, 0x62, 0x30, 0x63, 0x34, 0x64, 0x63, 0x32,
+0x30, 0x38, 0x65, 0x63, 0x35, 0x31, 0x66, 0x38,
+0x30, 0x62, 0x37, 0x31, 0x39, 0x30, 0x31, 0x34,
+0x31, 0x30, 0x34, 0x39, 0x64, 0x64, 0x34, 0x61,
+0x61, 0x64, 0x36, 0x32, 0x37, 0x34, 0x31, 0x64,
+0x63, 0x32, 0x37, 0x64, 0x35, 0x66, 0x32, 0x36,
+0x37, 0x66, 0x37, 0x62, 0x37, 0x30, 0x36, 0x38,
+0x32, 0x65, 0x65, 0x65, 0x32, 0x32, 0x65, 0x37,
+0x65, 0x39, 0x63, 0x31, 0x39, 0x32, 0x33, 0x62,
+0x39, 0x63, 0x30, 0x39, 0x35, 0x37, 0x62, 0x64,
+0x61, 0x65, 0x30, 0x62, 0x39, 0x36, 0x33, 0x37,
+0x34, 0x35, 0x36, 0x39, 0x62, 0x34, 0x36, 0x30,
+0x65, 0x62, 0x38, 0x64, 0x35, 0x62, 0x34, 0x30,
+0x64, 0x39, 0x37, 0x32, 0x65, 0x38, 0x63, 0x37,
+0x63, 0x30, 0x61, 0x64, 0x34, 0x34, 0x31, 0x64,
+0x65, 0x33, 0x64, 0x39, 0x34, 0x63, 0x34, 0x61,
+0x32, 0x39, 0x38, 0x36, 0x34, 0x62, 0x32, 0x31,
+0x32, 0x64, 0x35, 0x36, 0x30, 0x35, 0x30, 0x61,
+0x63, 0x62, 0x39, 0x38, 0x30, 0x62, 0x37, 0x32,
+0x62, 0x32, 0x62, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x30, 0x31, 0x38, 0x30, 0x39,
+0x36, 0x39, 0x38, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x39, 0x37,
+0x36, 0x61, 0x39, 0x31, 0x34, 0x65, 0x33, 0x33,
+0x36, 0x64, 0x30, 0x30, 0x31, 0x37, 0x61, 0x39,
+0x64, 0x32, 0x38, 0x64, 0x65, 0x39, 0x39, 0x64,
+0x31, 0x36, 0x34, 0x37, 0x32, 0x66, 0x36, 0x63,
+0x61, 0x36, 0x64, 0x35, 0x61, 0x33, 0x61, 0x38,
+0x65, 0x62, 0x63, 0x39, 0x39, 0x38, 0x38, 0x61,
+0x63, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x22, 0x2c, 0x20, 0x22, 0x50, 0x32, 0x53,
+0x48, 0x22, 0x5d, 0x2c, 0x0a, 0x0a, 0x5b, 0x22,
+0x43, 0x6f, 0x72, 0x72, 0x65, 0x63, 0x74, 0x20,
+0x73, 0x69, 0x67, 0x6e, 0x61, 0x74, 0x75, 0x72,
+0x65, 0x20, 0x6f, 0x72, 0x64, 0x65, 0x72, 0x22,
+0x5d, 0x2c, 0x0a, 0x5b, 0x22, 0x4e, 0x6f, 0x74,
+0x65, 0x20, 0x74, 0x68, 0x65, 0x20, 0x69, 0x6e,
+0x70, 0x75, 0x74, 0x20, 0x69, 0x73, 0x20, 0x6a,
+0x75, 0x73, 0x74, 0x20, 0x72, 0x65, 0x71, 0x75,
+0x69, 0x72, 0x65, 0x64, 0x20, 0x74, 0x6f, 0x20,
+0x6d, 0x61, 0x6b, 0x65, 0x20, 0x74, 0x68, 0x65,
+0x20, 0x74, 0x65, 0x73, 0x74, 0x65, 0x72, 0x20,
+0x68, 0x61, 0x70, 0x70, 0x79, 0x22, 0x5d, 0x2c,
+0x0a, 0x5b, 0x5b, 0x5b, 0x22, 0x62, 0x33, 0x64,
+0x61, 0x30, 0x31, 0x64, 0x64, 0x34, 0x61, 0x61,
+0x65, 0x36, 0x38, 0x33, 0x63, 0x37, 0x61, 0x65,
+0x65, 0x34, 0x64, 0x35, 0x64, 0x38, 0x62, 0x35,
+0x32, 0x61, 0x35, 0x34, 0x30, 0x61, 0x35, 0x30,
+0x38, 0x65, 0x31, 0x31, 0x31, 0x35, 0x66, 0x37,
+0x37, 0x63, 0x64, 0x37, 0x66, 0x61, 0x39, 0x61,
+0x32, 0x39, 0x31, 0x32, 0x34, 0x33, 0x66, 0x35,
+0x30, 0x31, 0x32, 0x32, 0x33, 0x22, 0x2c, 0x20,
+0x30, 0x2c, 0x20, 0x22, 0x48, 0x41, 0x53, 0x48,
+0x31, 0x36, 0x30, 0x20, 0x30, 0x78, 0x31, 0x34,
+0x20, 0x30, 0x78, 0x62, 0x31, 0x63, 0x65, 0x39,
+0x39, 0x32, 0x39, 0x38, 0x64, 0x35, 0x66, 0x30,
+0x37, 0x33, 0x36, 0x34, 0x62, 0x35, 0x37, 0x62,
+0x31, 0x65, 0x35, 0x63, 0x39, 0x63, 0x63, 0x30,
+0x30, 0x62, 0x65, 0x30, 0x62, 0x30, 0x34, 0x61,
+0x39, 0x35, 0x34, 0x20, 0x45, 0x51, 0x55, 0x41,
+0x4c, 0x22, 0x5d, 0x5d, 0x2c, 0x0a, 0x22, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x32, 0x33, 0x31, 0x32, 0x35, 0x30, 0x33,
+0x66, 0x32, 0x34, 0x39, 0x31, 0x61, 0x32, 0x61,
+0x39, 0x37, 0x66, 0x63, 0x64, 0x37, 0x37, 0x35,
+0x66, 0x31, 0x31, 0x65, 0x31, 0x30, 0x38, 0x61,
+0x35, 0x34, 0x30, 0x61, 0x35, 0x35, 0x32, 0x38,
+0x62, 0x35, 0x64, 0x34, 0x64, 0x65, 0x65, 0x37,
+0x61, 0x33, 0x63, 0x36, 0x38, 0x61, 0x65, 0x34,
+0x61, 0x64, 0x64, 0x30, 0x31, 0x64, 0x61, 0x62,
+0x33, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x66, 0x64, 0x66, 0x65, 0x30, 0x30, 0x30,
+0x30, 0x34, 0x38, 0x33, 0x30, 0x34, 0x35, 0x30,
+0x32, 0x32, 0x31, 0x30, 0x30, 0x66, 0x36, 0x36,
+0x34, 0x39, 0x62, 0x30, 0x65, 0x64, 0x64, 0x66,
+0x64, 0x66, 0x64, 0x34, 0x61, 0x64, 0x35, 0x35,
+0x34, 0x32, 0x36, 0x36, 0x36, 0x33, 0x33, 0x38,
+0x35, 0x30, 0x39, 0x30, 0x64, 0x35, 0x31, 0x65,
+0x65, 0x38, 0x36, 0x63, 0x33, 0x34, 0x38, 0x31,
+0x62, 0x64, 0x63, 0x36, 0x62, 0x30, 0x63, 0x31,
+0x38, 0x65, 0x61, 0x36, 0x63, 0x30, 0x65, 0x63,
+0x65, 0x32, 0x63, 0x30, 0x62, 0x30, 0x32, 0x32,
+0x30, 0x35, 0x36, 0x31, 0x63, 0x33, 0x31, 0x35,
+0x62, 0x30, 0x37, 0x63, 0x66, 0x66, 0x61, 0x36,
+0x66, 0x37, 0x64, 0x64, 0x39, 0x64, 0x66, 0x39,
+0x36, 0x64, 0x62, 0x61, 0x65, 0x39, 0x32, 0x30,
+0x30, 0x63, 0x32, 0x64, 0x65, 0x65, 0x30, 0x39,
+0x62, 0x66, 0x39, 0x33, 0x63, 0x63, 0x33, 0x35,
+0x63, 0x61, 0x30, 0x35, 0x65, 0x36, 0x63, 0x64,
+0x66, 0x36, 0x31, 0x33, 0x33, 0x34, 0x30, 0x61,
+0x61, 0x30, 0x31, 0x34, 0x38, 0x33, 0x30, 0x34,
+0x35, 0x30, 0x32, 0x32, 0x30, 0x37, 0x61, 0x61,
+0x63, 0x65, 0x65, 0x38, 0x32, 0x30, 0x65, 0x30,
+0x38, 0x62, 0x30, 0x62, 0x31, 0x37, 0x34, 0x65,
+0x32, 0x34, 0x38, 0x61, 0x62, 0x64, 0x38, 0x64,
+0x37, 0x61, 0x33, 0x34, 0x65, 0x64, 0x36, 0x33,
+0x62, 0x35, 0x64, 0x61, 0x33, 0x61, 0x62, 0x65,
+0x64, 0x62, 0x39, 0x39, 0x39, 0x33, 0x34, 0x64,
+0x66, 0x39, 0x66, 0x64, 0x64, 0x64, 0x36, 0x35,
+0x63, 0x30, 0x35, 0x63, 0x34, 0x30, 0x32, 0x32,
+0x31, 0x30, 0x30, 0x64, 0x66, 0x65, 0x38, 0x37,
+0x38, 0x39, 0x36, 0x61, 0x62, 0x35, 0x65, 0x65,
+0x33, 0x64, 0x66, 0x34, 0x37, 0x36, 0x63, 0x32,
+0x36, 0x35, 0x35, 0x66, 0x39, 0x66, 0x62, 0x65,
+0x35, 0x62, 0x64, 0x30, 0x38, 0x39, 0x64, 0x63,
+0x63, 0x62, 0x65, 0x66, 0x33, 0x65, 0x34, 0x65,
+0x61, 0x30, 0x35, 0x62, 0x35, 0x64, 0x31, 0x32,
+0x31, 0x31, 0x36, 0x39, 0x66, 0x65, 0x37, 0x66,
+0x35, 0x66, 0x34, 0x30, 0x31, 0x34, 0x63, 0x36,
+0x39, 0x35, 0x32, 0x32, 0x31, 0x30, 0x33, 0x31,
+0x64, 0x31, 0x31, 0x64, 0x62, 0x33, 0x38, 0x39,
+0x37, 0x32, 0x62, 0x37, 0x31, 0x32, 0x61, 0x39,
+0x66, 0x65, 0x31, 0x66, 0x63, 0x30, 0x32, 0x33,
+0x35, 0x37, 0x37, 0x63, 0x37, 0x61, 0x65, 0x33,
+0x64, 0x64, 0x62, 0x34, 0x61, 0x33, 0x30, 0x30,
+0x34, 0x31, 0x38, 0x37, 0x64, 0x34, 0x31, 0x63,
+0x34, 0x35, 0x31, 0x32, 0x31, 0x65, 0x65, 0x63,
+0x66, 0x64, 0x62, 0x62, 0x35, 0x62, 0x37, 0x32,
+0x31, 0x30, 0x32, 0x30, 0x37, 0x65, 0x63, 0x33,
+0x36, 0x39, 0x31, 0x31, 0x62, 0x36, 0x61, 0x64,
+0x32, 0x33, 0x38, 0x32, 0x38, 0x36, 0x30, 0x64,
+0x33, 0x32, 0x39, 0x38, 0x39, 0x63, 0x37, 0x62,
+0x38, 0x37, 0x32, 0x38, 0x65, 0x39, 0x34, 0x38,
+0x39, 0x64, 0x37, 0x62, 0x62, 0x63, 0x39, 0x34,
+0x61, 0x36, 0x62, 0x35, 0x35, 0x30, 0x39, 0x65,
+0x66, 0x30, 0x30, 0x32, 0x39, 0x62, 0x65, 0x31,
+0x32, 0x38, 0x38, 0x32, 0x31, 0x30, 0x32, 0x34,
+0x65, 0x61, 0x39, 0x66, 0x61, 0x63, 0x30, 0x36,
+0x66, 0x36, 0x36, 0x36, 0x61, 0x34, 0x61, 0x64,
+0x63, 0x33, 0x66, 0x63, 0x31, 0x33, 0x35, 0x37,
+0x62, 0x37, 0x62, 0x65, 0x63, 0x31, 0x66, 0x64,
+0x30, 0x62, 0x64, 0x65, 0x63, 0x65, 0x32, 0x62,
+0x39, 0x64, 0x30, 0x38, 0x35, 0x37, 0x39, 0x32,
+0x32, 0x36, 0x61, 0x38, 0x65, 0x62, 0x64, 0x65,
+0x35, 0x33, 0x30, 0x35, 0x38, 0x65, 0x34, 0x35,
+0x33, 0x61, 0x65, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x30, 0x31, 0x38, 0x30, 0x33,
+0x38, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x39, 0x37,
+0x36, 0x61, 0x39, 0x31, 0x34, 0x63, 0x39, 0x62,
+0x39, 0x39, 0x63, 0x64, 0x64, 0x66, 0x38, 0x34,
+0x37, 0x64, 0x31, 0x30, 0x36, 0x38, 0x35, 0x61,
+0x34, 0x66, 0x61, 0x62, 0x61, 0x61, 0x30, 0x62,
+0x61, 0x66, 0x35, 0x30, 0x35, 0x66, 0x37, 0x63,
+0x33, 0x64, 0x66, 0x61, 0x62, 0x38, 0x38, 0x61,
+0x63, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x22, 0x2c, 0x20, 0x22, 0x50, 0x32, 0x53,
+0x48, 0x22, 0x5d, 0x2c, 0x0a, 0x0a, 0x5b, 0x22,
+0x63, 0x63, 0x36, 0x30, 0x62, 0x31, 0x66, 0x38,
+0x39, 0x39, 0x65, 0x63, 0x30, 0x61, 0x36, 0x39,
+0x62, 0x37, 0x63, 0x33, 0x66, 0x32, 0x35, 0x64,
+0x64, 0x66, 0x33, 0x32, 0x63, 0x34, 0x35, 0x32,
+0x34, 0x30, 0x39, 0x36, 0x61, 0x39, 0x63, 0x35,
+0x62, 0x30, 0x31, 0x63, 0x62, 0x64, 0x38, 0x34,
+0x63, 0x36, 0x64, 0x30, 0x33, 0x31, 0x32, 0x61,
+0x30, 0x63, 0x34, 0x37, 0x38, 0x39, 0x38, 0x34,
+0x2c, 0x20, 0x77, 0x68, 0x69, 0x63, 0x68, 0x20,
+0x69, 0x73, 0x20, 0x61, 0x20, 0x66, 0x61, 0x69,
+0x72, 0x6c, 0x79, 0x20, 0x73, 0x74, 0x72, 0x61,
+0x6e, 0x67, 0x65, 0x20, 0x74, 0x72, 0x61, 0x6e,
+0x73, 0x61, 0x63, 0x74, 0x69, 0x6f, 0x6e, 0x20,
+0x77, 0x68, 0x69, 0x63, 0x68, 0x20, 0x72, 0x65,
+0x6c, 0x69, 0x65, 0x73, 0x20, 0x6f, 0x6e, 0x20,
+0x4f, 0x50, 0x5f, 0x43, 0x48, 0x45, 0x43, 0x4b,
+0x53, 0x49, 0x47, 0x20, 0x72, 0x65, 0x74, 0x75,
+0x72, 0x6e, 0x69, 0x6e, 0x67, 0x20, 0x30, 0x20,
+0x77, 0x68, 0x65, 0x6e, 0x20, 0x63, 0x68, 0x65,
+0x63, 0x6b, 0x69, 0x6e, 0x67, 0x20, 0x61, 0x20,
+0x63, 0x6f, 0x6d, 0x70, 0x6c, 0x65, 0x74, 0x65,
+0x6c, 0x79, 0x20, 0x69, 0x6e, 0x76, 0x61, 0x6c,
+0x69, 0x64, 0x20, 0x73, 0x69, 0x67, 0x20, 0x6f,
+0x66, 0x20, 0x6c, 0x65, 0x6e, 0x67, 0x74, 0x68,
+0x20, 0x30, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b,
+0x5b, 0x22, 0x63, 0x62, 0x65, 0x62, 0x63, 0x34,
+0x64, 0x61, 0x37, 0x33, 0x31, 0x65, 0x38, 0x39,
+0x39, 0x35, 0x66, 0x65, 0x39, 0x37, 0x66, 0x36,
+0x66, 0x61, 0x64, 0x63, 0x64, 0x37, 0x33, 0x31,
+0x62, 0x33, 0x36, 0x61, 0x64, 0x34, 0x30, 0x65,
+0x35, 0x65, 0x63, 0x62, 0x33, 0x31, 0x65, 0x33,
+0x38, 0x65, 0x39, 0x30, 0x34, 0x66, 0x36, 0x65,
+0x35, 0x39, 0x38, 0x32, 0x66, 0x61, 0x30, 0x39,
+0x66, 0x37, 0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20,
+0x22, 0x30, 0x78, 0x32, 0x31, 0x30, 0x32, 0x30,
+0x38, 0x35, 0x63, 0x36, 0x36, 0x30, 0x30, 0x36,
+0x35, 0x37, 0x35, 0x36, 0x36, 0x61, 0x63, 0x63,
+0x32, 0x64, 0x36, 0x33, 0x38, 0x32, 0x61, 0x34,
+0x37, 0x62, 0x63, 0x33, 0x66, 0x33, 0x32, 0x34,
+0x30, 0x30, 0x38, 0x64, 0x32, 0x61, 0x61, 0x31,
+0x30, 0x39, 0x34, 0x30, 0x64, 0x64, 0x37, 0x37,
+0x30, 0x35, 0x61, 0x34, 0x38, 0x61, 0x61, 0x32,
+0x61, 0x35, 0x61, 0x35, 0x65, 0x33, 0x33, 0x61,
+0x63, 0x37, 0x63, 0x32, 0x31, 0x30, 0x33, 0x66,
+0x35, 0x64, 0x30, 0x66, 0x62, 0x39, 0x35, 0x35,
+0x66, 0x39, 0x35, 0x64, 0x64, 0x36, 0x62, 0x65,
+0x36, 0x31, 0x31, 0x35, 0x63, 0x65, 0x38, 0x35,
+0x36, 0x36, 0x31, 0x64, 0x62, 0x34, 0x31, 0x32,
+0x65, 0x63, 0x36, 0x61, 0x30, 0x38, 0x61, 0x62,
+0x63, 0x62, 0x66, 0x63, 0x65, 0x37, 0x64, 0x61,
+0x30, 0x62, 0x61, 0x38, 0x32, 0x39, 0x37, 0x63,
+0x36, 0x63, 0x63, 0x30, 0x65, 0x63, 0x34, 0x61,
+0x63, 0x37, 0x63, 0x35, 0x33, 0x37, 0x39, 0x61,
+0x38, 0x32, 0x30, 0x64, 0x36, 0x38, 0x64, 0x66,
+0x39, 0x65, 0x33, 0x32, 0x61, 0x31, 0x34, 0x37,
+0x63, 0x66, 0x66, 0x61, 0x33, 0x36, 0x31, 0x39,
+0x33, 0x63, 0x36, 0x66, 0x37, 0x63, 0x34, 0x33,
+0x61, 0x31, 0x63, 0x38, 0x63, 0x36, 0x39, 0x63,
+0x64, 0x61, 0x35, 0x33, 0x30, 0x65, 0x31, 0x63,
+0x36, 0x64, 0x62, 0x33, 0x35, 0x34, 0x62, 0x66,
+0x61, 0x62, 0x64, 0x63, 0x66, 0x65, 0x66, 0x61,
+0x66, 0x33, 0x63, 0x38, 0x37, 0x35, 0x33, 0x37,
+0x39, 0x61, 0x38, 0x32, 0x30, 0x66, 0x35, 0x33,
+0x31, 0x66, 0x33, 0x30, 0x34, 0x31, 0x64, 0x33,
+0x31, 0x33, 0x36, 0x37, 0x30, 0x31, 0x65, 0x61,
+0x30, 0x39, 0x30, 0x36, 0x37, 0x63, 0x35, 0x33,
+0x65, 0x37, 0x31, 0x35, 0x39, 0x63, 0x38, 0x66,
+0x39, 0x62, 0x32, 0x37, 0x34, 0x36, 0x61, 0x35,
+0x36, 0x63, 0x33, 0x64, 0x38, 0x32, 0x39, 0x36,
+0x36, 0x63, 0x35, 0x34, 0x62, 0x62, 0x63, 0x35,
+0x35, 0x33, 0x32, 0x32, 0x36, 0x38, 0x37, 0x39,
+0x61, 0x35, 0x34, 0x37, 0x39, 0x38, 0x32, 0x37,
+0x37, 0x30, 0x31, 0x32, 0x30, 0x30, 0x31, 0x32,
+0x32, 0x61, 0x35, 0x39, 0x61, 0x35, 0x33, 0x37,
+0x39, 0x38, 0x32, 0x37, 0x37, 0x30, 0x31, 0x32,
+0x30, 0x30, 0x31, 0x32, 0x32, 0x61, 0x35, 0x39,
+0x61, 0x36, 0x33, 0x35, 0x33, 0x37, 0x39, 0x38,
+0x32, 0x37, 0x37, 0x35, 0x33, 0x37, 0x39, 0x38,
+0x32, 0x37, 0x37, 0x38, 0x37, 0x37, 0x39, 0x36,
+0x37, 0x39, 0x61, 0x36, 0x38, 0x22, 0x5d, 0x5d,
+0x2c, 0x0a, 0x22, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x31, 0x66, 0x37, 0x30,
+0x39, 0x66, 0x61, 0x38, 0x32, 0x35, 0x39, 0x36,
+0x65, 0x34, 0x66, 0x39, 0x30, 0x38, 0x65, 0x65,
+0x33, 0x33, 0x31, 0x63, 0x62, 0x35, 0x65, 0x30,
+0x65, 0x64, 0x34, 0x36, 0x61, 0x62, 0x33, 0x33,
+0x31, 0x64, 0x37, 0x64, 0x63, 0x66, 0x61, 0x66,
+0x36, 0x39, 0x37, 0x66, 0x65, 0x39, 0x35, 0x38,
+0x39, 0x31, 0x65, 0x37, 0x33, 0x64, 0x61, 0x63,
+0x34, 0x65, 0x62, 0x63, 0x62, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x38, 0x63, 0x32,
+0x30, 0x63, 0x61, 0x34, 0x32, 0x30, 0x39, 0x35,
+0x38, 0x34, 0x30, 0x37, 0x33, 0x35, 0x65, 0x38,
+0x39, 0x32, 0x38, 0x33, 0x66, 0x65, 0x63, 0x32,
+0x39, 0x38, 0x65, 0x36, 0x32, 0x61, 0x63, 0x32,
+0x64, 0x64, 0x65, 0x61, 0x39, 0x62, 0x35, 0x66,
+0x33, 0x34, 0x61, 0x38, 0x63, 0x62, 0x62, 0x37,
+0x30, 0x39, 0x37, 0x61, 0x64, 0x39, 0x36, 0x35,
+0x62, 0x38, 0x37, 0x35, 0x36, 0x38, 0x31, 0x30,
+0x30, 0x32, 0x30, 0x31, 0x62, 0x31, 0x62, 0x30,
+0x31, 0x64, 0x63, 0x38, 0x32, 0x39, 0x31, 0x37,
+0x37, 0x64, 0x61, 0x34, 0x61, 0x31, 0x34, 0x35,
+0x35, 0x31, 0x64, 0x32, 0x66, 0x63, 0x39, 0x36,
+0x61, 0x39, 0x64, 0x62, 0x30, 0x30, 0x63, 0x36,
+0x35, 0x30, 0x31, 0x65, 0x64, 0x66, 0x61, 0x31,
+0x32, 0x66, 0x32, 0x32, 0x63, 0x64, 0x39, 0x63,
+0x65, 0x66, 0x64, 0x33, 0x33, 0x35, 0x63, 0x32,
+0x32, 0x37, 0x66, 0x34, 0x38, 0x33, 0x30, 0x34,
+0x35, 0x30, 0x32, 0x32, 0x31, 0x30, 0x30, 0x61,
+0x39, 0x64, 0x66, 0x36, 0x30, 0x35, 0x33, 0x36,
+0x64, 0x66, 0x35, 0x37, 0x33, 0x33, 0x64, 0x64,
+0x30, 0x64, 0x65, 0x36, 0x62, 0x63, 0x39, 0x32,
+0x31, 0x66, 0x61, 0x62, 0x30, 0x62, 0x33, 0x65,
+0x65, 0x65, 0x36, 0x34, 0x32, 0x36, 0x35, 0x30,
+0x31, 0x62, 0x34, 0x33, 0x61, 0x32, 0x32, 0x38,
+0x61, 0x66, 0x61, 0x32, 0x63, 0x39, 0x30, 0x30,
+0x37, 0x32, 0x65, 0x62, 0x35, 0x63, 0x61, 0x30,
+0x32, 0x32, 0x30, 0x31, 0x63, 0x37, 0x38, 0x62,
+0x37, 0x34, 0x32, 0x36, 0x36, 0x66, 0x61, 0x63,
+0x37, 0x64, 0x31, 0x64, 0x62, 0x35, 0x64, 0x65,
+0x66, 0x66, 0x30, 0x38, 0x30, 0x64, 0x38, 0x61,
+0x34, 0x30, 0x33, 0x37, 0x34, 0x33, 0x32, 0x30,
+0x33, 0x66, 0x31, 0x30, 0x39, 0x66, 0x62, 0x63,
+0x61, 0x62, 0x66, 0x36, 0x64, 0x35, 0x61, 0x37,
+0x36, 0x30, 0x62, 0x66, 0x38, 0x37, 0x33, 0x38,
+0x36, 0x64, 0x32, 0x30, 0x31, 0x30, 0x30, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x30,
+0x31, 0x63, 0x30, 0x37, 0x35, 0x37, 0x39, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x32, 0x33, 0x32, 0x31, 0x30, 0x33, 0x36,
+0x31, 0x31, 0x66, 0x39, 0x61, 0x34, 0x35, 0x63,
+0x31, 0x38, 0x66, 0x32, 0x38, 0x66, 0x30, 0x36,
+0x66, 0x31, 0x39, 0x30, 0x37, 0x36, 0x61, 0x64,
+0x35, 0x37, 0x31, 0x63, 0x33, 0x34, 0x34, 0x63,
+0x38, 0x32, 0x63, 0x65, 0x38, 0x66, 0x63, 0x66,
+0x65, 0x33, 0x34, 0x34, 0x36, 0x34, 0x63, 0x66,
+0x38, 0x30, 0x38, 0x35, 0x32, 0x31, 0x37, 0x61,
+0x32, 0x64, 0x32, 0x39, 0x34, 0x61, 0x36, 0x61,
+0x63, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x22, 0x2c, 0x20, 0x22, 0x50, 0x32, 0x53,
+0x48, 0x22, 0x5d, 0x2c, 0x0a, 0x0a, 0x5b, 0x22,
+0x45, 0x6d, 0x70, 0x74, 0x79, 0x20, 0x70, 0x75,
+0x62, 0x6b, 0x65, 0x79, 0x22, 0x5d, 0x2c, 0x0a,
+0x5b, 0x5b, 0x5b, 0x22, 0x32, 0x32, 0x39, 0x32,
+0x35, 0x37, 0x63, 0x32, 0x39, 0x35, 0x65, 0x37,
+0x66, 0x35, 0x35, 0x35, 0x34, 0x32, 0x31, 0x63,
+0x31, 0x62, 0x66, 0x65, 0x63, 0x38, 0x35, 0x33,
+0x38, 0x64, 0x64, 0x33, 0x30, 0x61, 0x34, 0x62,
+0x35, 0x63, 0x33, 0x37, 0x63, 0x31, 0x63, 0x38,
+0x38, 0x31, 0x30, 0x62, 0x62, 0x65, 0x38, 0x33,
+0x63, 0x61, 0x66, 0x61, 0x37, 0x38, 0x31, 0x31,
+0x36, 0x35, 0x32, 0x63, 0x22, 0x2c, 0x20, 0x30,
+0x2c, 0x20, 0x22, 0x30, 0x78, 0x30, 0x30, 0x20,
+0x43, 0x48, 0x45, 0x43, 0x4b, 0x53, 0x49, 0x47,
+0x20, 0x4e, 0x4f, 0x54, 0x22, 0x5d, 0x5d, 0x2c,
+0x0a, 0x22, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x31, 0x32, 0x63, 0x36, 0x35,
+0x31, 0x31, 0x37, 0x38, 0x66, 0x61, 0x63, 0x61,
+0x38, 0x33, 0x62, 0x65, 0x30, 0x62, 0x38, 0x31,
+0x63, 0x38, 0x63, 0x31, 0x33, 0x37, 0x35, 0x63,
+0x34, 0x62, 0x30, 0x61, 0x64, 0x33, 0x38, 0x64,
+0x35, 0x33, 0x63, 0x38, 0x66, 0x65, 0x31, 0x62,
+0x31, 0x63, 0x34, 0x32, 0x35, 0x35, 0x66, 0x35,
+0x65, 0x37, 0x39, 0x35, 0x63, 0x32, 0x35, 0x37,
+0x39, 0x32, 0x32, 0x32, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x34, 0x39, 0x34, 0x38,
+0x33, 0x30, 0x34, 0x35, 0x30, 0x32, 0x32, 0x31,
+0x30, 0x30, 0x64, 0x36, 0x30, 0x34, 0x34, 0x35,
+0x36, 0x32, 0x32, 0x38, 0x34, 0x61, 0x63, 0x37,
+0x36, 0x63, 0x39, 0x38, 0x35, 0x30, 0x31, 0x38,
+0x66, 0x63, 0x34, 0x61, 0x39, 0x30, 0x31, 0x32,
+0x37, 0x38, 0x34, 0x37, 0x37, 0x30, 0x38, 0x63,
+0x39, 0x65, 0x64, 0x62, 0x32, 0x38, 0x30, 0x39,
+0x39, 0x36, 0x63, 0x35, 0x30, 0x37, 0x62, 0x32,
+0x38, 0x62, 0x61, 0x62, 0x64, 0x63, 0x34, 0x62,
+0x32, 0x61, 0x30, 0x32, 0x32, 0x30, 0x33, 0x64,
+0x37, 0x34, 0x65, 0x63, 0x61, 0x33, 0x66, 0x31,
+0x61, 0x34, 0x64, 0x31, 0x65, 0x65, 0x61, 0x37,
+0x66, 0x66, 0x37, 0x37, 0x62, 0x35, 0x32, 0x38,
+0x66, 0x64, 0x65, 0x36, 0x64, 0x35, 0x64, 0x63,
+0x33, 0x32, 0x34, 0x65, 0x63, 0x32, 0x64, 0x62,
+0x66, 0x64, 0x62, 0x39, 0x36, 0x34, 0x62, 0x61,
+0x38, 0x38, 0x35, 0x66, 0x36, 0x34, 0x33, 0x62,
+0x39, 0x37, 0x30, 0x34, 0x63, 0x64, 0x30, 0x31,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x30, 0x31, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x32, 0x33, 0x32, 0x31, 0x30, 0x32,
+0x63, 0x32, 0x34, 0x31, 0x30, 0x66, 0x38, 0x38,
+0x39, 0x31, 0x61, 0x65, 0x39, 0x31, 0x38, 0x63,
+0x61, 0x62, 0x34, 0x66, 0x66, 0x63, 0x34, 0x62,
+0x62, 0x34, 0x61, 0x33, 0x62, 0x30, 0x38, 0x38,
+0x31, 0x62, 0x65, 0x36, 0x37, 0x63, 0x37, 0x61,
+0x31, 0x65, 0x37, 0x66, 0x61, 0x61, 0x38, 0x62,
+0x35, 0x61, 0x63, 0x66, 0x39, 0x61, 0x62, 0x38,
+0x39, 0x33, 0x32, 0x65, 0x63, 0x33, 0x30, 0x63,
+0x61, 0x63, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x22, 0x2c, 0x20, 0x22, 0x50, 0x32,
+0x53, 0x48, 0x22, 0x5d, 0x2c, 0x0a, 0x0a, 0x5b,
+0x22, 0x45, 0x6d, 0x70, 0x74, 0x79, 0x20, 0x73,
+0x69, 0x67, 0x6e, 0x61, 0x74, 0x75, 0x72, 0x65,
+0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b, 0x5b, 0x22,
+0x39, 0x63, 0x61, 0x39, 0x33, 0x63, 0x66, 0x64,
+0x38, 0x65, 0x33, 0x38, 0x30, 0x36, 0x62, 0x39,
+0x64, 0x39, 0x65, 0x32, 0x62, 0x61, 0x31, 0x63,
+0x66, 0x36, 0x34, 0x65, 0x33, 0x63, 0x63, 0x36,
+0x39, 0x34, 0x36, 0x65, 0x65, 0x30, 0x31, 0x31,
+0x39, 0x36, 0x37, 0x30, 0x62, 0x31, 0x37, 0x39,
+0x36, 0x61, 0x30, 0x39, 0x39, 0x32, 0x38, 0x64,
+0x31, 0x34, 0x65, 0x61, 0x32, 0x35, 0x66, 0x37,
+0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20, 0x22, 0x30,
+0x78, 0x32, 0x31, 0x20, 0x30, 0x78, 0x30, 0x32,
+0x38, 0x61, 0x31, 0x64, 0x36, 0x36, 0x39, 0x37,
+0x35, 0x64, 0x62, 0x64, 0x66, 0x39, 0x37, 0x38,
+0x39, 0x37, 0x65, 0x33, 0x61, 0x34, 0x61, 0x65,
+0x66, 0x34, 0x35, 0x30, 0x65, 0x62, 0x65, 0x62,
+0x35, 0x62, 0x35, 0x32, 0x39, 0x33, 0x65, 0x34,
+0x61, 0x30, 0x62, 0x34, 0x61, 0x36, 0x64, 0x33,
+0x61, 0x32, 0x64, 0x61, 0x61, 0x61, 0x30, 0x62,
+0x32, 0x62, 0x31, 0x31, 0x30, 0x65, 0x30, 0x32,
+0x20, 0x43, 0x48, 0x45, 0x43, 0x4b, 0x53, 0x49,
+0x47, 0x20, 0x4e, 0x4f, 0x54, 0x22, 0x5d, 0x5d,
+0x2c, 0x0a, 0x22, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x31, 0x66, 0x37, 0x32,
+0x35, 0x65, 0x61, 0x31, 0x34, 0x38, 0x64, 0x39,
+0x32, 0x30, 0x39, 0x36, 0x61, 0x37, 0x39, 0x62,
+0x31, 0x37, 0x30, 0x39, 0x36, 0x31, 0x31, 0x65,
+0x30, 0x36, 0x65, 0x39, 0x34, 0x63, 0x36, 0x33,
+0x63, 0x34, 0x65, 0x66, 0x36, 0x31, 0x63, 0x62,
+0x61, 0x65, 0x32, 0x64, 0x39, 0x62, 0x39, 0x30,
+0x36, 0x33, 0x38, 0x38, 0x65, 0x66, 0x64, 0x33,
+0x63, 0x61, 0x39, 0x39, 0x63, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30,
+0x30, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x30, 0x31, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x32, 0x33, 0x32, 0x31, 0x30,
+0x32, 0x38, 0x61, 0x31, 0x64, 0x36, 0x36, 0x39,
+0x37, 0x35, 0x64, 0x62, 0x64, 0x66, 0x39, 0x37,
+0x38, 0x39, 0x37, 0x65, 0x33, 0x61, 0x34, 0x61,
+0x65, 0x66, 0x34, 0x35, 0x30, 0x65, 0x62, 0x65,
+0x62, 0x35, 0x62, 0x35, 0x32, 0x39, 0x33, 0x65,
+0x34, 0x61, 0x30, 0x62, 0x34, 0x61, 0x36, 0x64,
+0x33, 0x61, 0x32, 0x64, 0x61, 0x61, 0x61, 0x30,
+0x62, 0x32, 0x62, 0x31, 0x31, 0x30, 0x65, 0x30,
+0x32, 0x61, 0x63, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x22, 0x50,
+0x32, 0x53, 0x48, 0x22, 0x5d, 0x2c, 0x0a, 0x0a,
+0x5b, 0x5b, 0x5b, 0x22, 0x34, 0x34, 0x34, 0x65,
+0x30, 0x30, 0x65, 0x64, 0x37, 0x38, 0x34, 0x30,
+0x64, 0x34, 0x31, 0x66, 0x32, 0x30, 0x65, 0x63,
+0x64, 0x39, 0x63, 0x31, 0x31, 0x64, 0x33, 0x66,
+0x39, 0x31, 0x39, 0x38, 0x32, 0x33, 0x32, 0x36,
+0x63, 0x37, 0x33, 0x31, 0x61, 0x30, 0x32, 0x66,
+0x33, 0x63, 0x30, 0x35, 0x37, 0x34, 0x38, 0x34,
+0x31, 0x34, 0x61, 0x34, 0x66, 0x61, 0x39, 0x65,
+0x35, 0x39, 0x62, 0x65, 0x22, 0x2c, 0x20, 0x30,
+0x2c, 0x20, 0x22, 0x31, 0x20, 0x30, 0x78, 0x30,
+0x30, 0x20, 0x30, 0x78, 0x32, 0x31, 0x20, 0x30,
+0x78, 0x30, 0x32, 0x31, 0x33, 0x36, 0x62, 0x30,
+0x34, 0x37, 0x35, 0x38, 0x62, 0x30, 0x62, 0x36,
+0x65, 0x33, 0x36, 0x33, 0x65, 0x37, 0x61, 0x36,
+0x66, 0x62, 0x65, 0x38, 0x33, 0x61, 0x61, 0x66,
+0x35, 0x32, 0x37, 0x61, 0x31, 0x35, 0x33, 0x64,
+0x62, 0x32, 0x62, 0x30, 0x36, 0x30, 0x64, 0x33,
+0x36, 0x63, 0x63, 0x32, 0x39, 0x66, 0x37, 0x66,
+0x38, 0x33, 0x30, 0x39, 0x62, 0x61, 0x36, 0x65,
+0x34, 0x35, 0x38, 0x20, 0x32, 0x20, 0x43, 0x48,
+0x45, 0x43, 0x4b, 0x4d, 0x55, 0x4c, 0x54, 0x49,
+0x53, 0x49, 0x47, 0x22, 0x5d, 0x5d, 0x2c, 0x0a,
+0x22, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x31, 0x62, 0x65, 0x35, 0x39, 0x39,
+0x65, 0x66, 0x61, 0x61, 0x34, 0x31, 0x34, 0x38,
+0x34, 0x37, 0x34, 0x30, 0x35, 0x33, 0x63, 0x32,
+0x66, 0x61, 0x30, 0x33, 0x31, 0x63, 0x37, 0x32,
+0x36, 0x32, 0x33, 0x39, 0x38, 0x39, 0x31, 0x33,
+0x66, 0x31, 0x64, 0x63, 0x31, 0x64, 0x39, 0x65,
+0x63, 0x32, 0x30, 0x31, 0x66, 0x64, 0x34, 0x34,
+0x30, 0x37, 0x38, 0x65, 0x64, 0x30, 0x30, 0x34,
+0x65, 0x34, 0x34, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x34, 0x39, 0x30, 0x30, 0x34,
+0x37, 0x33, 0x30, 0x34, 0x34, 0x30, 0x32, 0x32,
+0x30, 0x32, 0x32, 0x62, 0x32, 0x39, 0x37, 0x30,
+0x36, 0x63, 0x62, 0x32, 0x65, 0x64, 0x39, 0x65,
+0x66, 0x30, 0x63, 0x62, 0x33, 0x63, 0x39, 0x37,
+0x62, 0x37, 0x32, 0x36, 0x37, 0x37, 0x63, 0x61,
+0x32, 0x64, 0x66, 0x64, 0x37, 0x62, 0x34, 0x31,
+0x36, 0x30, 0x66, 0x37, 0x62, 0x34, 0x62, 0x65,
+0x62, 0x33, 0x62, 0x61, 0x38, 0x30, 0x36, 0x61,
+0x61, 0x38, 0x35, 0x36, 0x63, 0x34, 0x30, 0x31,
+0x35, 0x30, 0x32, 0x32, 0x30, 0x32, 0x64, 0x31,
+0x65, 0x35, 0x32, 0x35, 0x38, 0x32, 0x34, 0x31,
+0x32, 0x65, 0x62, 0x61, 0x32, 0x65, 0x64, 0x34,
+0x37, 0x34, 0x66, 0x31, 0x66, 0x34, 0x33, 0x37,
+0x61, 0x34, 0x32, 0x37, 0x36, 0x34, 0x30, 0x33,
+0x30, 0x36, 0x66, 0x64, 0x33, 0x38, 0x33, 0x38,
+0x37, 0x32, 0x35, 0x66, 0x61, 0x62, 0x31, 0x37,
+0x33, 0x61, 0x64, 0x65, 0x37, 0x66, 0x65, 0x34,
+0x65, 0x61, 0x65, 0x34, 0x61, 0x30, 0x31, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x30,
+0x31, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x32, 0x33, 0x32, 0x31, 0x30, 0x33, 0x61,
+0x63, 0x34, 0x62, 0x62, 0x61, 0x37, 0x65, 0x37,
+0x63, 0x61, 0x33, 0x65, 0x38, 0x37, 0x33, 0x65,
+0x65, 0x61, 0x34, 0x39, 0x65, 0x30, 0x38, 0x31,
+0x33, 0x32, 0x61, 0x64, 0x33, 0x30, 0x63, 0x37,
+0x66, 0x30, 0x33, 0x36, 0x34, 0x30, 0x62, 0x36,
+0x35, 0x33, 0x39, 0x65, 0x39, 0x62, 0x35, 0x39,
+0x39, 0x30, 0x33, 0x63, 0x66, 0x31, 0x34, 0x66,
+0x64, 0x30, 0x31, 0x36, 0x62, 0x62, 0x62, 0x61,
+0x63, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x22, 0x2c, 0x20, 0x22, 0x50, 0x32, 0x53,
+0x48, 0x22, 0x5d, 0x2c, 0x0a, 0x0a, 0x5b, 0x5b,
+0x5b, 0x22, 0x65, 0x31, 0x36, 0x61, 0x62, 0x62,
+0x65, 0x38, 0x30, 0x62, 0x66, 0x33, 0x30, 0x63,
+0x30, 0x38, 0x30, 0x66, 0x36, 0x33, 0x38, 0x33,
+0x30, 0x63, 0x38, 0x64, 0x62, 0x66, 0x36, 0x36,
+0x39, 0x64, 0x65, 0x61, 0x65, 0x66, 0x30, 0x38,
+0x39, 0x35, 0x37, 0x34, 0x34, 0x36, 0x65, 0x39,
+0x35, 0x39, 0x34, 0x30, 0x32, 0x32, 0x37, 0x64,
+0x38, 0x63, 0x35, 0x65, 0x36, 0x64, 0x62, 0x36,
+0x31, 0x32, 0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20,
+0x22, 0x31, 0x20, 0x30, 0x78, 0x32, 0x31, 0x20,
+0x30, 0x78, 0x30, 0x33, 0x39, 0x30, 0x35, 0x33,
+0x38, 0x30, 0x63, 0x37, 0x30, 0x31, 0x33, 0x65,
+0x33, 0x36, 0x65, 0x36, 0x65, 0x31, 0x39, 0x64,
+0x33, 0x30, 0x35, 0x33, 0x31, 0x31, 0x63, 0x31,
+0x62, 0x38, 0x31, 0x66, 0x63, 0x65, 0x36, 0x35,
+0x38, 0x31, 0x66, 0x35, 0x65, 0x65, 0x31, 0x63,
+0x38, 0x36, 0x65, 0x66, 0x30, 0x36, 0x32, 0x37,
+0x63, 0x36, 0x38, 0x63, 0x39, 0x33, 0x36, 0x32,
+0x66, 0x63, 0x39, 0x66, 0x20, 0x30, 0x78, 0x30,
+0x30, 0x20, 0x32, 0x20, 0x43, 0x48, 0x45, 0x43,
+0x4b, 0x4d, 0x55, 0x4c, 0x54, 0x49, 0x53, 0x49,
+0x47, 0x22, 0x5d, 0x5d, 0x2c, 0x0a, 0x22, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x31, 0x32, 0x62, 0x36, 0x36, 0x64, 0x35,
+0x65, 0x38, 0x63, 0x37, 0x64, 0x32, 0x32, 0x34,
+0x30, 0x35, 0x39, 0x65, 0x39, 0x34, 0x36, 0x37,
+0x34, 0x39, 0x35, 0x30, 0x38, 0x65, 0x66, 0x65,
+0x61, 0x39, 0x64, 0x36, 0x36, 0x62, 0x66, 0x38,
+0x64, 0x30, 0x63, 0x38, 0x33, 0x36, 0x33, 0x30,
+0x66, 0x30, 0x38, 0x30, 0x63, 0x66, 0x33, 0x30,
+0x62, 0x65, 0x38, 0x62, 0x62, 0x36, 0x61, 0x65,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x34, 0x39, 0x30, 0x30, 0x34, 0x37, 0x33,
+0x30, 0x34, 0x34, 0x30, 0x32, 0x32, 0x30, 0x36,
+0x66, 0x66, 0x65, 0x33, 0x66, 0x31, 0x34, 0x63,
+0x61, 0x66, 0x33, 0x38, 0x61, 0x64, 0x35, 0x63,
+0x31, 0x35, 0x34, 0x34, 0x34, 0x32, 0x38, 0x65,
+0x39, 0x39, 0x64, 0x61, 0x37, 0x36, 0x66, 0x66,
+0x61, 0x35, 0x34, 0x35, 0x35, 0x36, 0x37, 0x35,
+0x65, 0x63, 0x38, 0x64, 0x39, 0x37, 0x38, 0x30,
+0x66, 0x61, 0x63, 0x32, 0x31, 0x35, 0x63, 0x61,
+0x31, 0x37, 0x39, 0x35, 0x33, 0x35, 0x32, 0x30,
+0x32, 0x32, 0x30, 0x37, 0x37, 0x39, 0x35, 0x30,
+0x32, 0x39, 0x38, 0x35, 0x65, 0x31, 0x39, 0x34,
+0x64, 0x38, 0x34, 0x62, 0x61, 0x61, 0x33, 0x36,
+0x62, 0x39, 0x62, 0x64, 0x34, 0x30, 0x61, 0x30,
+0x64, 0x62, 0x64, 0x39, 0x38, 0x31, 0x31, 0x36,
+0x33, 0x66, 0x61, 0x31, 0x39, 0x31, 0x65, 0x62,
+0x38, 0x38, 0x34, 0x61, 0x65, 0x38, 0x33, 0x66,
+0x63, 0x35, 0x62, 0x64, 0x31, 0x63, 0x38, 0x36,
+0x62, 0x31, 0x31, 0x30, 0x31, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x30, 0x31, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x32,
+0x33, 0x32, 0x31, 0x30, 0x33, 0x39, 0x30, 0x35,
+0x33, 0x38, 0x30, 0x63, 0x37, 0x30, 0x31, 0x33,
+0x65, 0x33, 0x36, 0x65, 0x36, 0x65, 0x31, 0x39,
+0x64, 0x33, 0x30, 0x35, 0x33, 0x31, 0x31, 0x63,
+0x31, 0x62, 0x38, 0x31, 0x66, 0x63, 0x65, 0x36,
+0x35, 0x38, 0x31, 0x66, 0x35, 0x65, 0x65, 0x31,
+0x63, 0x38, 0x36, 0x65, 0x66, 0x30, 0x36, 0x32,
+0x37, 0x63, 0x36, 0x38, 0x63, 0x39, 0x33, 0x36,
+0x32, 0x66, 0x63, 0x39, 0x66, 0x61, 0x63, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x22,
+0x2c, 0x20, 0x22, 0x50, 0x32, 0x53, 0x48, 0x22,
+0x5d, 0x2c, 0x0a, 0x0a, 0x5b, 0x5b, 0x5b, 0x22,
+0x65, 0x62, 0x62, 0x63, 0x66, 0x34, 0x62, 0x66,
+0x63, 0x65, 0x31, 0x33, 0x32, 0x39, 0x32, 0x62,
+0x64, 0x37, 0x39, 0x31, 0x64, 0x36, 0x61, 0x36,
+0x35, 0x61, 0x32, 0x61, 0x38, 0x35, 0x38, 0x64,
+0x35, 0x39, 0x61, 0x64, 0x62, 0x66, 0x37, 0x33,
+0x37, 0x65, 0x33, 0x38, 0x37, 0x65, 0x34, 0x30,
+0x33, 0x37, 0x30, 0x64, 0x34, 0x65, 0x36, 0x34,
+0x63, 0x63, 0x37, 0x30, 0x65, 0x66, 0x62, 0x30,
+0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20, 0x22, 0x32,
+0x20, 0x30, 0x78, 0x32, 0x31, 0x20, 0x30, 0x78,
+0x30, 0x33, 0x33, 0x62, 0x63, 0x61, 0x61, 0x30,
+0x61, 0x36, 0x30, 0x32, 0x66, 0x30, 0x64, 0x34,
+0x34, 0x63, 0x63, 0x39, 0x64, 0x35, 0x36, 0x33,
+0x37, 0x63, 0x36, 0x65, 0x35, 0x31, 0x35, 0x62,
+0x30, 0x34, 0x37, 0x31, 0x64, 0x62, 0x35, 0x31,
+0x34, 0x63, 0x30, 0x32, 0x30, 0x38, 0x38, 0x33,
+0x38, 0x33, 0x30, 0x62, 0x37, 0x63, 0x65, 0x66,
+0x64, 0x37, 0x33, 0x61, 0x66, 0x30, 0x34, 0x31,
+0x39, 0x34, 0x20, 0x30, 0x78, 0x32, 0x31, 0x20,
+0x30, 0x78, 0x30, 0x33, 0x61, 0x38, 0x38, 0x62,
+0x33, 0x32, 0x36, 0x66, 0x38, 0x37, 0x36, 0x37,
+0x66, 0x34, 0x66, 0x31, 0x39, 0x32, 0x63, 0x65,
+0x32, 0x35, 0x32, 0x61, 0x66, 0x65, 0x33, 0x33,
+0x63, 0x39, 0x34, 0x64, 0x32, 0x35, 0x61, 0x62,
+0x31, 0x64, 0x32, 0x34, 0x66, 0x32, 0x37, 0x66,
+0x31, 0x35, 0x39, 0x62, 0x33, 0x63, 0x62, 0x33,
+0x61, 0x61, 0x36, 0x39, 0x31, 0x66, 0x66, 0x65,
+0x31, 0x34, 0x32, 0x33, 0x20, 0x32, 0x20, 0x43,
+0x48, 0x45, 0x43, 0x4b, 0x4d, 0x55, 0x4c, 0x54,
+0x49, 0x53, 0x49, 0x47, 0x20, 0x4e, 0x4f, 0x54,
+0x22, 0x5d, 0x5d, 0x2c, 0x0a, 0x22, 0x30, 0x31,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x62, 0x30, 0x65, 0x66, 0x37, 0x30, 0x63, 0x63,
+0x36, 0x34, 0x34, 0x65, 0x30, 0x64, 0x33, 0x37,
+0x34, 0x30, 0x37, 0x65, 0x33, 0x38, 0x37, 0x65,
+0x37, 0x33, 0x62, 0x66, 0x61, 0x64, 0x35, 0x39,
+0x38, 0x64, 0x38, 0x35, 0x32, 0x61, 0x35, 0x61,
+0x61, 0x36, 0x64, 0x36, 0x39, 0x31, 0x64, 0x37,
+0x32, 0x62, 0x32, 0x39, 0x31, 0x33, 0x63, 0x65,
+0x62, 0x66, 0x66, 0x34, 0x62, 0x63, 0x65, 0x62,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x34, 0x61, 0x30, 0x30, 0x34, 0x37, 0x33, 0x30,
+0x34, 0x34, 0x30, 0x32, 0x32, 0x30, 0x36, 0x38,
+0x63, 0x64, 0x34, 0x38, 0x35, 0x31, 0x66, 0x63,
+0x37, 0x66, 0x39, 0x61, 0x38, 0x39, 0x32, 0x61,
+0x62, 0x39, 0x31, 0x30, 0x64, 0x66, 0x37, 0x61,
+0x32, 0x34, 0x65, 0x36, 0x31, 0x36, 0x66, 0x32,
+0x39, 0x33, 0x62, 0x63, 0x62, 0x35, 0x63, 0x35,
+0x66, 0x62, 0x64, 0x66, 0x62, 0x63, 0x33, 0x30,
+0x34, 0x61, 0x31, 0x39, 0x34, 0x62, 0x32, 0x36,
+0x62, 0x36, 0x30, 0x66, 0x62, 0x61, 0x30, 0x32,
+0x32, 0x30, 0x37, 0x38, 0x65, 0x36, 0x64, 0x61,
+0x31, 0x33, 0x64, 0x38, 0x63, 0x62, 0x38, 0x38,
+0x31, 0x61, 0x32, 0x32, 0x39, 0x33, 0x39, 0x62,
+0x39, 0x35, 0x32, 0x63, 0x32, 0x34, 0x66, 0x38,
+0x38, 0x62, 0x39, 0x37, 0x61, 0x66, 0x64, 0x30,
+0x36, 0x62, 0x34, 0x63, 0x34, 0x37, 0x61, 0x34,
+0x37, 0x64, 0x37, 0x66, 0x38, 0x30, 0x34, 0x63,
+0x39, 0x61, 0x33, 0x35, 0x32, 0x61, 0x36, 0x64,
+0x36, 0x64, 0x30, 0x31, 0x30, 0x30, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x30, 0x31,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x32, 0x33, 0x32, 0x31, 0x30, 0x33, 0x33, 0x62,
+0x63, 0x61, 0x61, 0x30, 0x61, 0x36, 0x30, 0x32,
+0x66, 0x30, 0x64, 0x34, 0x34, 0x63, 0x63, 0x39,
+0x64, 0x35, 0x36, 0x33, 0x37, 0x63, 0x36, 0x65,
+0x35, 0x31, 0x35, 0x62, 0x30, 0x34, 0x37, 0x31,
+0x64, 0x62, 0x35, 0x31, 0x34, 0x63, 0x30, 0x32,
+0x30, 0x38, 0x38, 0x33, 0x38, 0x33, 0x30, 0x62,
+0x37, 0x63, 0x65, 0x66, 0x64, 0x37, 0x33, 0x61,
+0x66, 0x30, 0x34, 0x31, 0x39, 0x34, 0x61, 0x63,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x22, 0x2c, 0x20, 0x22, 0x50, 0x32, 0x53, 0x48,
+0x22, 0x5d, 0x2c, 0x0a, 0x0a, 0x5b, 0x5b, 0x5b,
+0x22, 0x62, 0x61, 0x34, 0x63, 0x64, 0x37, 0x61,
+0x65, 0x32, 0x61, 0x64, 0x34, 0x64, 0x34, 0x64,
+0x31, 0x33, 0x65, 0x62, 0x66, 0x63, 0x38, 0x61,
+0x62, 0x31, 0x64, 0x39, 0x33, 0x61, 0x36, 0x33,
+0x65, 0x34, 0x61, 0x36, 0x35, 0x36, 0x33, 0x66,
+0x32, 0x35, 0x30, 0x38, 0x39, 0x61, 0x31, 0x38,
+0x62, 0x66, 0x30, 0x66, 0x63, 0x36, 0x38, 0x66,
+0x32, 0x38, 0x32, 0x61, 0x61, 0x38, 0x38, 0x63,
+0x31, 0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20, 0x22,
+0x32, 0x20, 0x30, 0x78, 0x32, 0x31, 0x20, 0x30,
+0x78, 0x30, 0x33, 0x37, 0x63, 0x36, 0x31, 0x35,
+0x64, 0x37, 0x36, 0x31, 0x65, 0x37, 0x31, 0x64,
+0x33, 0x38, 0x39, 0x30, 0x33, 0x36, 0x30, 0x39,
+0x62, 0x66, 0x34, 0x66, 0x34, 0x36, 0x38, 0x34,
+0x37, 0x32, 0x36, 0x36, 0x65, 0x64, 0x63, 0x32,
+0x66, 0x62, 0x33, 0x37, 0x35, 0x33, 0x32, 0x30,
+0x34, 0x37, 0x64, 0x37, 0x34, 0x37, 0x62, 0x61,
+0x34, 0x37, 0x65, 0x61, 0x61, 0x65, 0x35, 0x66,
+0x66, 0x65, 0x31, 0x20, 0x30, 0x78, 0x32, 0x31,
+0x20, 0x30, 0x78, 0x30, 0x32, 0x65, 0x64, 0x63,
+0x38, 0x32, 0x33, 0x63, 0x64, 0x36, 0x33, 0x34,
+0x66, 0x32, 0x63, 0x34, 0x30, 0x33, 0x33, 0x64,
+0x39, 0x34, 0x66, 0x35, 0x37, 0x35, 0x35, 0x32,
+0x30, 0x37, 0x63, 0x62, 0x36, 0x62, 0x36, 0x30,
+0x63, 0x34, 0x62, 0x31, 0x66, 0x31, 0x66, 0x30,
+0x35, 0x36, 0x61, 0x64, 0x37, 0x34, 0x37, 0x31,
+0x63, 0x34, 0x37, 0x64, 0x65, 0x35, 0x66, 0x32,
+0x65, 0x34, 0x64, 0x35, 0x30, 0x20, 0x32, 0x20,
+0x43, 0x48, 0x45, 0x43, 0x4b, 0x4d, 0x55, 0x4c,
+0x54, 0x49, 0x53, 0x49, 0x47, 0x20, 0x4e, 0x4f,
+0x54, 0x22, 0x5d, 0x5d, 0x2c, 0x0a, 0x22, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x63, 0x31, 0x38, 0x38, 0x61, 0x61, 0x38,
+0x32, 0x66, 0x32, 0x36, 0x38, 0x66, 0x63, 0x66,
+0x30, 0x38, 0x62, 0x61, 0x31, 0x38, 0x39, 0x35,
+0x30, 0x66, 0x32, 0x36, 0x33, 0x36, 0x35, 0x34,
+0x61, 0x33, 0x65, 0x61, 0x36, 0x39, 0x33, 0x31,
+0x64, 0x61, 0x62, 0x63, 0x38, 0x62, 0x66, 0x33,
+0x65, 0x64, 0x31, 0x64, 0x34, 0x64, 0x34, 0x32,
+0x61, 0x61, 0x65, 0x64, 0x37, 0x34, 0x63, 0x62,
+0x61, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x34, 0x62, 0x30, 0x30, 0x30, 0x30, 0x34,
+0x38, 0x33, 0x30, 0x34, 0x35, 0x30, 0x32, 0x32,
+0x31, 0x30, 0x30, 0x39, 0x34, 0x30, 0x33, 0x37,
+0x38, 0x35, 0x37, 0x36, 0x65, 0x30, 0x36, 0x39,
+0x61, 0x63, 0x61, 0x32, 0x36, 0x31, 0x61, 0x36,
+0x62, 0x32, 0x36, 0x66, 0x62, 0x33, 0x38, 0x33,
+0x34, 0x34, 0x65, 0x34, 0x34, 0x39, 0x37, 0x63,
+0x61, 0x36, 0x37, 0x35, 0x31, 0x62, 0x62, 0x31,
+0x30, 0x39, 0x30, 0x35, 0x63, 0x37, 0x36, 0x62,
+0x62, 0x36, 0x38, 0x39, 0x66, 0x34, 0x32, 0x32,
+0x32, 0x62, 0x30, 0x30, 0x32, 0x32, 0x30, 0x34,
+0x38, 0x33, 0x33, 0x38, 0x30, 0x36, 0x62, 0x30,
+0x31, 0x34, 0x63, 0x32, 0x36, 0x66, 0x64, 0x38,
+0x30, 0x31, 0x37, 0x32, 0x37, 0x62, 0x37, 0x39,
+0x32, 0x62, 0x31, 0x32, 0x36, 0x30, 0x30, 0x30,
+0x33, 0x63, 0x35, 0x35, 0x37, 0x31, 0x30, 0x66,
+0x38, 0x37, 0x63, 0x35, 0x61, 0x64, 0x62, 0x64,
+0x37, 0x61, 0x39, 0x63, 0x62, 0x35, 0x37, 0x34,
+0x34, 0x36, 0x64, 0x62, 0x63, 0x39, 0x38, 0x30,
+0x31, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x30, 0x31, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x32, 0x33, 0x32, 0x31, 0x30,
+0x33, 0x37, 0x63, 0x36, 0x31, 0x35, 0x64, 0x37,
+0x36, 0x31, 0x65, 0x37, 0x31, 0x64, 0x33, 0x38,
+0x39, 0x30, 0x33, 0x36, 0x30, 0x39, 0x62, 0x66,
+0x34, 0x66, 0x34, 0x36, 0x38, 0x34, 0x37, 0x32,
+0x36, 0x36, 0x65, 0x64, 0x63, 0x32, 0x66, 0x62,
+0x33, 0x37, 0x35, 0x33, 0x32, 0x30, 0x34, 0x37,
+0x64, 0x37, 0x34, 0x37, 0x62, 0x61, 0x34, 0x37,
+0x65, 0x61, 0x61, 0x65, 0x35, 0x66, 0x66, 0x65,
+0x31, 0x61, 0x63, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x22, 0x50,
+0x32, 0x53, 0x48, 0x22, 0x5d, 0x2c, 0x0a, 0x0a,
+0x0a, 0x5b, 0x22, 0x4f, 0x50, 0x5f, 0x43, 0x4f,
+0x44, 0x45, 0x53, 0x45, 0x50, 0x41, 0x52, 0x41,
+0x54, 0x4f, 0x52, 0x20, 0x74, 0x65, 0x73, 0x74,
+0x73, 0x22, 0x5d, 0x2c, 0x0a, 0x0a, 0x5b, 0x22,
+0x54, 0x65, 0x73, 0x74, 0x20, 0x74, 0x68, 0x61,
+0x74, 0x20, 0x53, 0x69, 0x67, 0x6e, 0x61, 0x74,
+0x75, 0x72, 0x65, 0x48, 0x61, 0x73, 0x68, 0x28,
+0x29, 0x20, 0x72, 0x65, 0x6d, 0x6f, 0x76, 0x65,
+0x73, 0x20, 0x4f, 0x50, 0x5f, 0x43, 0x4f, 0x44,
+0x45, 0x53, 0x45, 0x50, 0x41, 0x52, 0x41, 0x54,
+0x4f, 0x52, 0x20, 0x77, 0x69, 0x74, 0x68, 0x20,
+0x46, 0x69, 0x6e, 0x64, 0x41, 0x6e, 0x64, 0x44,
+0x65, 0x6c, 0x65, 0x74, 0x65, 0x28, 0x29, 0x22,
+0x5d, 0x2c, 0x0a, 0x5b, 0x5b, 0x5b, 0x22, 0x62,
+0x63, 0x37, 0x66, 0x64, 0x31, 0x33, 0x32, 0x66,
+0x63, 0x66, 0x38, 0x31, 0x37, 0x39, 0x31, 0x38,
+0x33, 0x33, 0x34, 0x38, 0x32, 0x32, 0x65, 0x65,
+0x36, 0x64, 0x39, 0x62, 0x64, 0x39, 0x35, 0x63,
+0x38, 0x38, 0x39, 0x30, 0x39, 0x39, 0x63, 0x39,
+0x36, 0x65, 0x30, 0x37, 0x63, 0x61, 0x32, 0x63,
+0x31, 0x65, 0x62, 0x32, 0x63, 0x63, 0x37, 0x30,
+0x64, 0x62, 0x36, 0x33, 0x32, 0x32, 0x34, 0x22,
+0x2c, 0x20, 0x30, 0x2c, 0x20, 0x22, 0x43, 0x4f,
+0x44, 0x45, 0x53, 0x45, 0x50, 0x41, 0x52, 0x41,
+0x54, 0x4f, 0x52, 0x20, 0x30, 0x78, 0x32, 0x31,
+0x20, 0x30, 0x78, 0x30, 0x33, 0x38, 0x34, 0x37,
+0x39, 0x61, 0x30, 0x66, 0x61, 0x39, 0x39, 0x38,
+0x63, 0x64, 0x33, 0x35, 0x32, 0x35, 0x39, 0x61,
+0x32, 0x65, 0x66, 0x30, 0x61, 0x37, 0x61, 0x35,
+0x63, 0x36, 0x38, 0x36, 0x36, 0x32, 0x63, 0x31,
+0x34, 0x37, 0x34, 0x66, 0x38, 0x38, 0x63, 0x63,
+0x62, 0x36, 0x64, 0x30, 0x38, 0x61, 0x37, 0x36,
+0x37, 0x37, 0x62, 0x62, 0x65, 0x63, 0x37, 0x66,
+0x32, 0x32, 0x30, 0x34, 0x31, 0x20, 0x43, 0x48,
+0x45, 0x43, 0x4b, 0x53, 0x49, 0x47, 0x22, 0x5d,
+0x5d, 0x2c, 0x0a, 0x22, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x32, 0x34,
+0x33, 0x32, 0x62, 0x36, 0x30, 0x64, 0x63, 0x37,
+0x32, 0x63, 0x65, 0x62, 0x63, 0x31, 0x61, 0x32,
+0x37, 0x63, 0x65, 0x30, 0x39, 0x36, 0x39, 0x63,
+0x30, 0x39, 0x38, 0x39, 0x63, 0x38, 0x39, 0x35,
+0x62, 0x64, 0x64, 0x39, 0x65, 0x36, 0x32, 0x65,
+0x38, 0x32, 0x33, 0x34, 0x38, 0x33, 0x39, 0x31,
+0x31, 0x37, 0x66, 0x38, 0x66, 0x63, 0x33, 0x32,
+0x64, 0x31, 0x37, 0x66, 0x62, 0x63, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x34, 0x61,
+0x34, 0x39, 0x33, 0x30, 0x34, 0x36, 0x30, 0x32,
+0x32, 0x31, 0x30, 0x30, 0x61, 0x35, 0x37, 0x36,
+0x62, 0x35, 0x32, 0x30, 0x35, 0x31, 0x39, 0x36,
+0x32, 0x63, 0x32, 0x35, 0x65, 0x36, 0x34, 0x32,
+0x63, 0x30, 0x66, 0x64, 0x33, 0x64, 0x37, 0x37,
+0x65, 0x65, 0x36, 0x63, 0x39, 0x32, 0x34, 0x38,
+0x37, 0x30, 0x34, 0x38, 0x65, 0x35, 0x64, 0x39,
+0x30, 0x38, 0x31, 0x38, 0x62, 0x63, 0x66, 0x35,
+0x62, 0x35, 0x31, 0x61, 0x62, 0x61, 0x63, 0x63,
+0x64, 0x37, 0x39, 0x30, 0x30, 0x32, 0x32, 0x31,
+0x30, 0x30, 0x38, 0x32, 0x30, 0x34, 0x66, 0x38,
+0x66, 0x62, 0x31, 0x32, 0x31, 0x62, 0x65, 0x34,
+0x65, 0x63, 0x33, 0x62, 0x32, 0x34, 0x34, 0x38,
+0x33, 0x62, 0x31, 0x66, 0x39, 0x32, 0x64, 0x38,
+0x39, 0x62, 0x31, 0x62, 0x30, 0x35, 0x34, 0x38,
+0x35, 0x31, 0x33, 0x61, 0x31, 0x33, 0x34, 0x65,
+0x33, 0x34, 0x35, 0x63, 0x35, 0x34, 0x34, 0x32,
+0x65, 0x38, 0x36, 0x65, 0x38, 0x36, 0x31, 0x37,
+0x61, 0x35, 0x30, 0x31, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x36, 0x61, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x22, 0x2c, 0x20, 0x22, 0x50, 0x32,
+0x53, 0x48, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b,
+0x5b, 0x22, 0x38, 0x33, 0x65, 0x31, 0x39, 0x34,
+0x66, 0x39, 0x30, 0x62, 0x36, 0x65, 0x66, 0x32,
+0x31, 0x66, 0x61, 0x32, 0x65, 0x33, 0x61, 0x33,
+0x36, 0x35, 0x62, 0x36, 0x33, 0x37, 0x39, 0x34,
+0x66, 0x62, 0x35, 0x64, 0x61, 0x61, 0x38, 0x34,
+0x34, 0x62, 0x64, 0x63, 0x39, 0x62, 0x32, 0x35,
+0x64, 0x65, 0x33, 0x30, 0x38, 0x39, 0x39, 0x66,
+0x63, 0x66, 0x65, 0x37, 0x62, 0x30, 0x31, 0x30,
+0x34, 0x37, 0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20,
+0x22, 0x43, 0x4f, 0x44, 0x45, 0x53, 0x45, 0x50,
+0x41, 0x52, 0x41, 0x54, 0x4f, 0x52, 0x20, 0x43,
+0x4f, 0x44, 0x45, 0x53, 0x45, 0x50, 0x41, 0x52,
+0x41, 0x54, 0x4f, 0x52, 0x20, 0x30, 0x78, 0x32,
+0x31, 0x20, 0x30, 0x78, 0x30, 0x33, 0x38, 0x34,
+0x37, 0x39, 0x61, 0x30, 0x66, 0x61, 0x39, 0x39,
+0x38, 0x63, 0x64, 0x33, 0x35, 0x32, 0x35, 0x39,
+0x61, 0x32, 0x65, 0x66, 0x30, 0x61, 0x37, 0x61,
+0x35, 0x63, 0x36, 0x38, 0x36, 0x36, 0x32, 0x63,
+0x31, 0x34, 0x37, 0x34, 0x66, 0x38, 0x38, 0x63,
+0x63, 0x62, 0x36, 0x64, 0x30, 0x38, 0x61, 0x37,
+0x36, 0x37, 0x37, 0x62, 0x62, 0x65, 0x63, 0x37,
+0x66, 0x32, 0x32, 0x30, 0x34, 0x31, 0x20, 0x43,
+0x48, 0x45, 0x43, 0x4b, 0x53, 0x49, 0x47, 0x22,
+0x5d, 0x5d, 0x2c, 0x0a, 0x22, 0x30, 0x31, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x34,
+0x37, 0x31, 0x30, 0x62, 0x30, 0x65, 0x37, 0x63,
+0x66, 0x39, 0x66, 0x38, 0x39, 0x33, 0x30, 0x64,
+0x65, 0x32, 0x35, 0x39, 0x62, 0x64, 0x63, 0x34,
+0x62, 0x38, 0x34, 0x61, 0x61, 0x35, 0x64, 0x66,
+0x62, 0x39, 0x34, 0x33, 0x37, 0x62, 0x36, 0x36,
+0x35, 0x61, 0x33, 0x65, 0x33, 0x61, 0x32, 0x31,
+0x66, 0x66, 0x32, 0x36, 0x65, 0x30, 0x62, 0x66,
+0x39, 0x39, 0x34, 0x65, 0x31, 0x38, 0x33, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x34,
+0x61, 0x34, 0x39, 0x33, 0x30, 0x34, 0x36, 0x30,
+0x32, 0x32, 0x31, 0x30, 0x30, 0x61, 0x31, 0x36,
+0x36, 0x31, 0x32, 0x31, 0x61, 0x36, 0x31, 0x62,
+0x34, 0x65, 0x65, 0x62, 0x31, 0x39, 0x64, 0x38,
+0x66, 0x39, 0x32, 0x32, 0x62, 0x39, 0x37, 0x38,
+0x66, 0x66, 0x36, 0x61, 0x62, 0x35, 0x38, 0x65,
+0x61, 0x64, 0x38, 0x61, 0x35, 0x61, 0x35, 0x35,
+0x35, 0x32, 0x62, 0x66, 0x39, 0x62, 0x65, 0x37,
+0x33, 0x64, 0x63, 0x39, 0x63, 0x31, 0x35, 0x36,
+0x38, 0x37, 0x33, 0x65, 0x61, 0x30, 0x32, 0x32,
+0x31, 0x30, 0x30, 0x39, 0x32, 0x61, 0x64, 0x39,
+0x62, 0x63, 0x34, 0x33, 0x65, 0x65, 0x36, 0x34,
+0x37, 0x64, 0x61, 0x34, 0x66, 0x36, 0x36, 0x35,
+0x32, 0x63, 0x33, 0x32, 0x30, 0x38, 0x30, 0x30,
+0x64, 0x65, 0x62, 0x63, 0x66, 0x30, 0x38, 0x65,
+0x63, 0x32, 0x30, 0x61, 0x30, 0x39, 0x34, 0x61,
+0x30, 0x61, 0x61, 0x66, 0x30, 0x38, 0x35, 0x66,
+0x36, 0x33, 0x65, 0x63, 0x62, 0x33, 0x37, 0x61,
+0x31, 0x37, 0x32, 0x30, 0x31, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x30, 0x31, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x36, 0x61, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x22, 0x50,
+0x32, 0x53, 0x48, 0x22, 0x5d, 0x2c, 0x0a, 0x0a,
+0x5b, 0x22, 0x48, 0x61, 0x73, 0x68, 0x65, 0x64,
+0x20, 0x64, 0x61, 0x74, 0x61, 0x20, 0x73, 0x74,
+0x61, 0x72, 0x74, 0x73, 0x20, 0x61, 0x74, 0x20,
+0x74, 0x68, 0x65, 0x20, 0x43, 0x4f, 0x44, 0x45,
+0x53, 0x45, 0x50, 0x41, 0x52, 0x41, 0x54, 0x4f,
+0x52, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b, 0x5b,
+0x22, 0x33, 0x32, 0x36, 0x38, 0x38, 0x32, 0x61,
+0x37, 0x66, 0x32, 0x32, 0x62, 0x35, 0x31, 0x39,
+0x31, 0x66, 0x31, 0x61, 0x30, 0x63, 0x63, 0x39,
+0x39, 0x36, 0x32, 0x63, 0x61, 0x34, 0x62, 0x38,
+0x37, 0x38, 0x63, 0x64, 0x39, 0x36, 0x39, 0x63,
+0x66, 0x33, 0x62, 0x33, 0x61, 0x37, 0x30, 0x38,
+0x38, 0x37, 0x61, 0x65, 0x63, 0x65, 0x34, 0x64,
+0x38, 0x30, 0x31, 0x61, 0x30, 0x62, 0x61, 0x35,
+0x65, 0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20, 0x22,
+0x30, 0x78, 0x32, 0x31, 0x20, 0x30, 0x78, 0x30,
+0x33, 0x38, 0x34, 0x37, 0x39, 0x61, 0x30, 0x66,
+0x61, 0x39, 0x39, 0x38, 0x63, 0x64, 0x33, 0x35,
+0x32, 0x35, 0x39, 0x61, 0x32, 0x65, 0x66, 0x30,
+0x61, 0x37, 0x61, 0x35, 0x63, 0x36, 0x38, 0x36,
+0x36, 0x32, 0x63, 0x31, 0x34, 0x37, 0x34, 0x66,
+0x38, 0x38, 0x63, 0x63, 0x62, 0x36, 0x64, 0x30,
+0x38, 0x61, 0x37, 0x36, 0x37, 0x37, 0x62, 0x62,
+0x65, 0x63, 0x37, 0x66, 0x32, 0x32, 0x30, 0x34,
+0x31, 0x20, 0x43, 0x4f, 0x44, 0x45, 0x53, 0x45,
+0x50, 0x41, 0x52, 0x41, 0x54, 0x4f, 0x52, 0x20,
+0x43, 0x48, 0x45, 0x43, 0x4b, 0x53, 0x49, 0x47,
+0x22, 0x5d, 0x5d, 0x2c, 0x0a, 0x22, 0x30, 0x31,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x35, 0x65, 0x62, 0x61, 0x61, 0x30, 0x30, 0x31,
+0x64, 0x38, 0x65, 0x34, 0x65, 0x63, 0x37, 0x61,
+0x38, 0x38, 0x37, 0x30, 0x33, 0x61, 0x33, 0x62,
+0x63, 0x66, 0x36, 0x39, 0x64, 0x39, 0x38, 0x63,
+0x38, 0x37, 0x34, 0x62, 0x63, 0x61, 0x36, 0x32,
+0x39, 0x39, 0x63, 0x63, 0x61, 0x30, 0x66, 0x31,
+0x39, 0x31, 0x35, 0x31, 0x32, 0x62, 0x66, 0x32,
+0x61, 0x37, 0x38, 0x32, 0x36, 0x38, 0x33, 0x32,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x34, 0x39, 0x34, 0x38, 0x33, 0x30, 0x34, 0x35,
+0x30, 0x32, 0x32, 0x30, 0x33, 0x62, 0x66, 0x37,
+0x35, 0x34, 0x64, 0x31, 0x63, 0x36, 0x37, 0x33,
+0x32, 0x66, 0x62, 0x66, 0x38, 0x37, 0x63, 0x35,
+0x64, 0x63, 0x64, 0x38, 0x31, 0x32, 0x35, 0x38,
+0x61, 0x65, 0x66, 0x64, 0x33, 0x30, 0x66, 0x32,
+0x30, 0x36, 0x30, 0x64, 0x37, 0x62, 0x64, 0x38,
+0x61, 0x63, 0x34, 0x61, 0x35, 0x36, 0x39, 0x36,
+0x66, 0x37, 0x39, 0x32, 0x37, 0x30, 0x39, 0x31,
+0x64, 0x61, 0x64, 0x31, 0x30, 0x32, 0x32, 0x31,
+0x30, 0x30, 0x66, 0x35, 0x62, 0x63, 0x62, 0x37,
+0x32, 0x36, 0x63, 0x34, 0x63, 0x66, 0x35, 0x65,
+0x64, 0x30, 0x65, 0x64, 0x33, 0x34, 0x63, 0x63,
+0x31, 0x33, 0x64, 0x61, 0x64, 0x65, 0x65, 0x64,
+0x66, 0x36, 0x32, 0x38, 0x61, 0x65, 0x31, 0x30,
+0x34, 0x35, 0x62, 0x37, 0x63, 0x62, 0x33, 0x34,
+0x34, 0x32, 0x31, 0x62, 0x63, 0x36, 0x30, 0x62,
+0x38, 0x39, 0x66, 0x34, 0x63, 0x65, 0x63, 0x61,
+0x65, 0x37, 0x30, 0x31, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x36, 0x61, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x22, 0x2c, 0x20, 0x22, 0x50, 0x32,
+0x53, 0x48, 0x22, 0x5d, 0x2c, 0x0a, 0x0a, 0x5b,
+0x22, 0x42, 0x75, 0x74, 0x20, 0x6f, 0x6e, 0x6c,
+0x79, 0x20, 0x69, 0x66, 0x20, 0x65, 0x78, 0x65,
+0x63, 0x75, 0x74, 0x69, 0x6f, 0x6e, 0x20, 0x68,
+0x61, 0x73, 0x20, 0x72, 0x65, 0x61, 0x63, 0x68,
+0x65, 0x64, 0x20, 0x69, 0x74, 0x22, 0x5d, 0x2c,
+0x0a, 0x5b, 0x5b, 0x5b, 0x22, 0x61, 0x39, 0x35,
+0x35, 0x30, 0x33, 0x32, 0x66, 0x34, 0x64, 0x36,
+0x62, 0x30, 0x63, 0x39, 0x62, 0x66, 0x65, 0x38,
+0x63, 0x61, 0x64, 0x38, 0x66, 0x30, 0x30, 0x61,
+0x38, 0x39, 0x33, 0x33, 0x37, 0x39, 0x30, 0x62,
+0x39, 0x63, 0x31, 0x64, 0x63, 0x32, 0x38, 0x63,
+0x38, 0x32, 0x65, 0x30, 0x66, 0x34, 0x38, 0x65,
+0x37, 0x35, 0x62, 0x33, 0x35, 0x64, 0x61, 0x30,
+0x65, 0x34, 0x39, 0x34, 0x34, 0x22, 0x2c, 0x20,
+0x30, 0x2c, 0x20, 0x22, 0x30, 0x78, 0x32, 0x31,
+0x20, 0x30, 0x78, 0x30, 0x33, 0x38, 0x34, 0x37,
+0x39, 0x61, 0x30, 0x66, 0x61, 0x39, 0x39, 0x38,
+0x63, 0x64, 0x33, 0x35, 0x32, 0x35, 0x39, 0x61,
+0x32, 0x65, 0x66, 0x30, 0x61, 0x37, 0x61, 0x35,
+0x63, 0x36, 0x38, 0x36, 0x36, 0x32, 0x63, 0x31,
+0x34, 0x37, 0x34, 0x66, 0x38, 0x38, 0x63, 0x63,
+0x62, 0x36, 0x64, 0x30, 0x38, 0x61, 0x37, 0x36,
+0x37, 0x37, 0x62, 0x62, 0x65, 0x63, 0x37, 0x66,
+0x32, 0x32, 0x30, 0x34, 0x31, 0x20, 0x43, 0x48,
+0x45, 0x43, 0x4b, 0x53, 0x49, 0x47, 0x56, 0x45,
+0x52, 0x49, 0x46, 0x59, 0x20, 0x43, 0x4f, 0x44,
+0x45, 0x53, 0x45, 0x50, 0x41, 0x52, 0x41, 0x54,
+0x4f, 0x52, 0x20, 0x30, 0x78, 0x32, 0x31, 0x20,
+0x30, 0x78, 0x30, 0x33, 0x38, 0x34, 0x37, 0x39,
+0x61, 0x30, 0x66, 0x61, 0x39, 0x39, 0x38, 0x63,
+0x64, 0x33, 0x35, 0x32, 0x35, 0x39, 0x61, 0x32,
+0x65, 0x66, 0x30, 0x61, 0x37, 0x61, 0x35, 0x63,
+0x36, 0x38, 0x36, 0x36, 0x32, 0x63, 0x31, 0x34,
+0x37, 0x34, 0x66, 0x38, 0x38, 0x63, 0x63, 0x62,
+0x36, 0x64, 0x30, 0x38, 0x61, 0x37, 0x36, 0x37,
+0x37, 0x62, 0x62, 0x65, 0x63, 0x37, 0x66, 0x32,
+0x32, 0x30, 0x34, 0x31, 0x20, 0x43, 0x48, 0x45,
+0x43, 0x4b, 0x53, 0x49, 0x47, 0x56, 0x45, 0x52,
+0x49, 0x46, 0x59, 0x20, 0x43, 0x4f, 0x44, 0x45,
+0x53, 0x45, 0x50, 0x41, 0x52, 0x41, 0x54, 0x4f,
+0x52, 0x20, 0x31, 0x22, 0x5d, 0x5d, 0x2c, 0x0a,
+0x22, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x31, 0x34, 0x34, 0x34, 0x39, 0x30,
+0x65, 0x64, 0x61, 0x33, 0x35, 0x35, 0x62, 0x65,
+0x37, 0x34, 0x38, 0x30, 0x66, 0x32, 0x65, 0x63,
+0x38, 0x32, 0x38, 0x64, 0x63, 0x63, 0x31, 0x62,
+0x39, 0x39, 0x30, 0x33, 0x37, 0x39, 0x33, 0x61,
+0x38, 0x30, 0x30, 0x38, 0x66, 0x61, 0x64, 0x38,
+0x63, 0x66, 0x65, 0x39, 0x62, 0x30, 0x63, 0x36,
+0x62, 0x34, 0x64, 0x32, 0x66, 0x30, 0x33, 0x35,
+0x35, 0x61, 0x39, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x39, 0x32, 0x34, 0x38, 0x33,
+0x30, 0x34, 0x35, 0x30, 0x32, 0x32, 0x31, 0x30,
+0x30, 0x39, 0x63, 0x30, 0x61, 0x32, 0x37, 0x66,
+0x38, 0x38, 0x36, 0x61, 0x31, 0x64, 0x38, 0x63,
+0x62, 0x38, 0x37, 0x66, 0x36, 0x66, 0x35, 0x39,
+0x35, 0x66, 0x62, 0x63, 0x33, 0x31, 0x36, 0x33,
+0x64, 0x32, 0x38, 0x66, 0x37, 0x61, 0x38, 0x31,
+0x65, 0x63, 0x33, 0x63, 0x34, 0x62, 0x32, 0x35,
+0x32, 0x65, 0x65, 0x37, 0x66, 0x33, 0x61, 0x63,
+0x37, 0x37, 0x66, 0x64, 0x31, 0x33, 0x66, 0x66,
+0x61, 0x30, 0x32, 0x32, 0x30, 0x33, 0x63, 0x61,
+0x61, 0x38, 0x64, 0x66, 0x61, 0x30, 0x39, 0x37,
+0x31, 0x33, 0x63, 0x38, 0x63, 0x34, 0x64, 0x37,
+0x65, 0x66, 0x35, 0x37, 0x35, 0x63, 0x37, 0x35,
+0x65, 0x64, 0x39, 0x37, 0x38, 0x31, 0x32, 0x30,
+0x37, 0x32, 0x34, 0x30, 0x35, 0x64, 0x39, 0x33,
+0x32, 0x62, 0x64, 0x31, 0x31, 0x65, 0x36, 0x61,
+0x31, 0x35, 0x39, 0x33, 0x61, 0x39, 0x38, 0x62,
+0x36, 0x37, 0x39, 0x33, 0x37, 0x30, 0x31, 0x34,
+0x38, 0x33, 0x30, 0x34, 0x35, 0x30, 0x32, 0x32,
+0x30, 0x31, 0x65, 0x33, 0x38, 0x36, 0x31, 0x65,
+0x66, 0x33, 0x39, 0x61, 0x35, 0x32, 0x36, 0x34,
+0x30, 0x36, 0x62, 0x61, 0x64, 0x31, 0x65, 0x32,
+0x30, 0x65, 0x63, 0x61, 0x64, 0x30, 0x36, 0x62,
+0x65, 0x37, 0x33, 0x37, 0x35, 0x61, 0x64, 0x34,
+0x30, 0x64, 0x64, 0x62, 0x35, 0x38, 0x32, 0x63,
+0x39, 0x62, 0x65, 0x34, 0x32, 0x64, 0x32, 0x36,
+0x63, 0x33, 0x61, 0x30, 0x64, 0x37, 0x62, 0x32,
+0x34, 0x30, 0x32, 0x32, 0x31, 0x30, 0x30, 0x39,
+0x64, 0x30, 0x61, 0x33, 0x39, 0x38, 0x35, 0x65,
+0x39, 0x36, 0x35, 0x32, 0x32, 0x65, 0x35, 0x39,
+0x36, 0x33, 0x35, 0x64, 0x31, 0x39, 0x63, 0x63,
+0x34, 0x34, 0x34, 0x38, 0x35, 0x34, 0x37, 0x34,
+0x37, 0x37, 0x33, 0x39, 0x36, 0x63, 0x65, 0x30,
+0x65, 0x66, 0x31, 0x37, 0x61, 0x35, 0x38, 0x65,
+0x37, 0x64, 0x37, 0x34, 0x63, 0x33, 0x65, 0x66,
+0x34, 0x36, 0x34, 0x32, 0x39, 0x32, 0x33, 0x30,
+0x31, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x31, 0x36, 0x61, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x22,
+0x2c, 0x20, 0x22, 0x50, 0x32, 0x53, 0x48, 0x22,
+0x5d, 0x2c, 0x0a, 0x0a, 0x5b, 0x22, 0x43, 0x4f,
+0x44, 0x45, 0x53, 0x45, 0x50, 0x41, 0x52, 0x41,
+0x54, 0x4f, 0x52, 0x20, 0x69, 0x6e, 0x20, 0x61,
+0x6e, 0x20, 0x75, 0x6e, 0x65, 0x78, 0x65, 0x63,
+0x75, 0x74, 0x65, 0x64, 0x20, 0x49, 0x46, 0x20,
+0x62, 0x6c, 0x6f, 0x63, 0x6b, 0x20, 0x64, 0x6f,
+0x65, 0x73, 0x20, 0x6e, 0x6f, 0x74, 0x20, 0x63,
+0x68, 0x61, 0x6e, 0x67, 0x65, 0x20, 0x77, 0x68,
+0x61, 0x74, 0x20, 0x69, 0x73, 0x20, 0x68, 0x61,
+0x73, 0x68, 0x65, 0x64, 0x22, 0x5d, 0x2c, 0x0a,
+0x5b, 0x5b, 0x5b, 0x22, 0x61, 0x39, 0x35, 0x35,
+0x30, 0x33, 0x32, 0x66, 0x34, 0x64, 0x36, 0x62,
+0x30, 0x63, 0x39, 0x62, 0x66, 0x65, 0x38, 0x63,
+0x61, 0x64, 0x38, 0x66, 0x30, 0x30, 0x61, 0x38,
+0x39, 0x33, 0x33, 0x37, 0x39, 0x30, 0x62, 0x39,
+0x63, 0x31, 0x64, 0x63, 0x32, 0x38, 0x63, 0x38,
+0x32, 0x65, 0x30, 0x66, 0x34, 0x38, 0x65, 0x37,
+0x35, 0x62, 0x33, 0x35, 0x64, 0x61, 0x30, 0x65,
+0x34, 0x39, 0x34, 0x34, 0x22, 0x2c, 0x20, 0x30,
+0x2c, 0x20, 0x22, 0x49, 0x46, 0x20, 0x43, 0x4f,
+0x44, 0x45, 0x53, 0x45, 0x50, 0x41, 0x52, 0x41,
+0x54, 0x4f, 0x52, 0x20, 0x45, 0x4e, 0x44, 0x49,
+0x46, 0x20, 0x30, 0x78, 0x32, 0x31, 0x20, 0x30,
+0x78, 0x30, 0x33, 0x37, 0x38, 0x64, 0x34, 0x33,
+0x30, 0x32, 0x37, 0x34, 0x66, 0x38, 0x63, 0x35,
+0x65, 0x63, 0x31, 0x33, 0x32, 0x31, 0x33, 0x33,
+0x38, 0x31, 0x35, 0x31, 0x65, 0x39, 0x66, 0x32,
+0x37, 0x66, 0x34, 0x63, 0x36, 0x37, 0x36, 0x61,
+0x30, 0x30, 0x38, 0x62, 0x64, 0x66, 0x38, 0x36,
+0x33, 0x38, 0x64, 0x30, 0x37, 0x63, 0x30, 0x62,
+0x36, 0x62, 0x65, 0x39, 0x61, 0x62, 0x33, 0x35,
+0x63, 0x37, 0x31, 0x20, 0x43, 0x48, 0x45, 0x43,
+0x4b, 0x53, 0x49, 0x47, 0x56, 0x45, 0x52, 0x49,
+0x46, 0x59, 0x20, 0x43, 0x4f, 0x44, 0x45, 0x53,
+0x45, 0x50, 0x41, 0x52, 0x41, 0x54, 0x4f, 0x52,
+0x20, 0x31, 0x22, 0x5d, 0x5d, 0x2c, 0x0a, 0x22,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x34, 0x34, 0x34, 0x39, 0x30, 0x65,
+0x64, 0x61, 0x33, 0x35, 0x35, 0x62, 0x65, 0x37,
+0x34, 0x38, 0x30, 0x66, 0x32, 0x65, 0x63, 0x38,
+0x32, 0x38, 0x64, 0x63, 0x63, 0x31, 0x62, 0x39,
+0x39, 0x30, 0x33, 0x37, 0x39, 0x33, 0x61, 0x38,
+0x30, 0x30, 0x38, 0x66, 0x61, 0x64, 0x38, 0x63,
+0x66, 0x65, 0x39, 0x62, 0x30, 0x63, 0x36, 0x62,
+0x34, 0x64, 0x32, 0x66, 0x30, 0x33, 0x35, 0x35,
+0x61, 0x39, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x34, 0x61, 0x34, 0x38, 0x33, 0x30,
+0x34, 0x35, 0x30, 0x32, 0x32, 0x30, 0x37, 0x61,
+0x36, 0x39, 0x37, 0x34, 0x61, 0x37, 0x37, 0x63,
+0x35, 0x39, 0x31, 0x66, 0x61, 0x31, 0x33, 0x64,
+0x66, 0x66, 0x36, 0x30, 0x63, 0x61, 0x62, 0x62,
+0x62, 0x38, 0x35, 0x61, 0x30, 0x64, 0x65, 0x39,
+0x65, 0x30, 0x32, 0x35, 0x63, 0x30, 0x39, 0x63,
+0x36, 0x35, 0x61, 0x34, 0x62, 0x32, 0x32, 0x38,
+0x35, 0x65, 0x34, 0x37, 0x63, 0x65, 0x38, 0x65,
+0x32, 0x32, 0x66, 0x37, 0x36, 0x31, 0x30, 0x32,
+0x32, 0x31, 0x30, 0x30, 0x66, 0x30, 0x65, 0x66,
+0x61, 0x61, 0x63, 0x39, 0x66, 0x66, 0x38, 0x61,
+0x63, 0x33, 0x36, 0x62, 0x31, 0x30, 0x37, 0x32,
+0x31, 0x65, 0x30, 0x61, 0x61, 0x65, 0x31, 0x66,
+0x62, 0x39, 0x37, 0x35, 0x63, 0x39, 0x30, 0x35,
+0x30, 0x30, 0x62, 0x35, 0x30, 0x63, 0x35, 0x36,
+0x65, 0x38, 0x61, 0x30, 0x63, 0x63, 0x35, 0x32,
+0x62, 0x30, 0x34, 0x30, 0x33, 0x66, 0x30, 0x34,
+0x32, 0x35, 0x64, 0x64, 0x30, 0x31, 0x30, 0x30,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x31, 0x36, 0x61, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x22, 0x2c,
+0x20, 0x22, 0x50, 0x32, 0x53, 0x48, 0x22, 0x5d,
+0x2c, 0x0a, 0x0a, 0x5b, 0x22, 0x41, 0x73, 0x20,
+0x61, 0x62, 0x6f, 0x76, 0x65, 0x2c, 0x20, 0x77,
+0x69, 0x74, 0x68, 0x20, 0x74, 0x68, 0x65, 0x20,
+0x49, 0x46, 0x20, 0x62, 0x6c, 0x6f, 0x63, 0x6b,
+0x20, 0x65, 0x78, 0x65, 0x63, 0x75, 0x74, 0x65,
+0x64, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b, 0x5b,
+0x22, 0x61, 0x39, 0x35, 0x35, 0x30, 0x33, 0x32,
+0x66, 0x34, 0x64, 0x36, 0x62, 0x30, 0x63, 0x39,
+0x62, 0x66, 0x65, 0x38, 0x63, 0x61, 0x64, 0x38,
+0x66, 0x30, 0x30, 0x61, 0x38, 0x39, 0x33, 0x33,
+0x37, 0x39, 0x30, 0x62, 0x39, 0x63, 0x31, 0x64,
+0x63, 0x32, 0x38, 0x63, 0x38, 0x32, 0x65, 0x30,
+0x66, 0x34, 0x38, 0x65, 0x37, 0x35, 0x62, 0x33,
+0x35, 0x64, 0x61, 0x30, 0x65, 0x34, 0x39, 0x34,
+0x34, 0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20, 0x22,
+0x49, 0x46, 0x20, 0x43, 0x4f, 0x44, 0x45, 0x53,
+0x45, 0x50, 0x41, 0x52, 0x41, 0x54, 0x4f, 0x52,
+0x20, 0x45, 0x4e, 0x44, 0x49, 0x46, 0x20, 0x30,
+0x78, 0x32, 0x31, 0x20, 0x30, 0x78, 0x30, 0x33,
+0x37, 0x38, 0x64, 0x34, 0x33, 0x30, 0x32, 0x37,
+0x34, 0x66, 0x38, 0x63, 0x35, 0x65, 0x63, 0x31,
+0x33, 0x32, 0x31, 0x33, 0x33, 0x38, 0x31, 0x35,
+0x31, 0x65, 0x39, 0x66, 0x32, 0x37, 0x66, 0x34,
+0x63, 0x36, 0x37, 0x36, 0x61, 0x30, 0x30, 0x38,
+0x62, 0x64, 0x66, 0x38, 0x36, 0x33, 0x38, 0x64,
+0x30, 0x37, 0x63, 0x30, 0x62, 0x36, 0x62, 0x65,
+0x39, 0x61, 0x62, 0x33, 0x35, 0x63, 0x37, 0x31,
+0x20, 0x43, 0x48, 0x45, 0x43, 0x4b, 0x53, 0x49,
+0x47, 0x56, 0x45, 0x52, 0x49, 0x46, 0x59, 0x20,
+0x43, 0x4f, 0x44, 0x45, 0x53, 0x45, 0x50, 0x41,
+0x52, 0x41, 0x54, 0x4f, 0x52, 0x20, 0x31, 0x22,
+0x5d, 0x5d, 0x2c, 0x0a, 0x22, 0x30, 0x31, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x34,
+0x34, 0x34, 0x39, 0x30, 0x65, 0x64, 0x61, 0x33,
+0x35, 0x35, 0x62, 0x65, 0x37, 0x34, 0x38, 0x30,
+0x66, 0x32, 0x65, 0x63, 0x38, 0x32, 0x38, 0x64,
+0x63, 0x63, 0x31, 0x62, 0x39, 0x39, 0x30, 0x33,
+0x37, 0x39, 0x33, 0x61, 0x38, 0x30, 0x30, 0x38,
+0x66, 0x61, 0x64, 0x38, 0x63, 0x66, 0x65, 0x39,
+0x62, 0x30, 0x63, 0x36, 0x62, 0x34, 0x64, 0x32,
+0x66, 0x30, 0x33, 0x35, 0x35, 0x61, 0x39, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x34,
+0x61, 0x34, 0x38, 0x33, 0x30, 0x34, 0x35, 0x30,
+0x32, 0x32, 0x31, 0x30, 0x30, 0x66, 0x61, 0x34,
+0x61, 0x37, 0x34, 0x62, 0x61, 0x39, 0x66, 0x64,
+0x35, 0x39, 0x63, 0x35, 0x39, 0x66, 0x34, 0x36,
+0x63, 0x33, 0x39, 0x36, 0x30, 0x63, 0x66, 0x39,
+0x30, 0x63, 0x62, 0x65, 0x30, 0x64, 0x32, 0x62,
+0x37, 0x34, 0x33, 0x63, 0x34, 0x37, 0x31, 0x64,
+0x32, 0x34, 0x61, 0x33, 0x64, 0x35, 0x64, 0x36,
+0x64, 0x62, 0x36, 0x30, 0x30, 0x32, 0x61, 0x66,
+0x35, 0x65, 0x65, 0x62, 0x62, 0x30, 0x32, 0x32,
+0x30, 0x34, 0x64, 0x37, 0x30, 0x65, 0x63, 0x34,
+0x39, 0x30, 0x66, 0x64, 0x30, 0x66, 0x37, 0x30,
+0x35, 0x35, 0x61, 0x37, 0x63, 0x34, 0x35, 0x66,
+0x38, 0x36, 0x35, 0x31, 0x34, 0x33, 0x33, 0x36,
+0x65, 0x33, 0x61, 0x37, 0x66, 0x30, 0x33, 0x35,
+0x30, 0x33, 0x64, 0x61, 0x63, 0x65, 0x63, 0x61,
+0x62, 0x62, 0x32, 0x34, 0x37, 0x66, 0x63, 0x32,
+0x33, 0x66, 0x31, 0x35, 0x63, 0x38, 0x33, 0x35,
+0x31, 0x30, 0x31, 0x35, 0x31, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x30, 0x31, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x36, 0x61, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x22, 0x50,
+0x32, 0x53, 0x48, 0x22, 0x5d, 0x2c, 0x0a, 0x0a,
+0x0a, 0x5b, 0x22, 0x43, 0x48, 0x45, 0x43, 0x4b,
+0x53, 0x49, 0x47, 0x20, 0x69, 0x73, 0x20, 0x6c,
+0x65, 0x67, 0x61, 0x6c, 0x20, 0x69, 0x6e, 0x20,
+0x73, 0x63, 0x72, 0x69, 0x70, 0x74, 0x53, 0x69,
+0x67, 0x73, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b,
+0x5b, 0x22, 0x63, 0x63, 0x66, 0x37, 0x66, 0x34,
+0x30, 0x35, 0x33, 0x61, 0x30, 0x32, 0x65, 0x36,
+0x35, 0x33, 0x63, 0x33, 0x36, 0x61, 0x63, 0x37,
+0x35, 0x63, 0x38, 0x39, 0x31, 0x62, 0x37, 0x34,
+0x39, 0x36, 0x64, 0x30, 0x64, 0x63, 0x35, 0x63,
+0x65, 0x35, 0x32, 0x31, 0x34, 0x66, 0x36, 0x63,
+0x39, 0x31, 0x33, 0x64, 0x39, 0x63, 0x66, 0x38,
+0x66, 0x31, 0x33, 0x32, 0x39, 0x65, 0x62, 0x65,
+0x65, 0x30, 0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20,
+0x22, 0x44, 0x55, 0x50, 0x20, 0x48, 0x41, 0x53,
+0x48, 0x31, 0x36, 0x30, 0x20, 0x30, 0x78, 0x31,
+0x34, 0x20, 0x30, 0x78, 0x65, 0x65, 0x35, 0x61,
+0x36, 0x61, 0x61, 0x34, 0x30, 0x66, 0x61, 0x63,
+0x65, 0x66, 0x62, 0x32, 0x36, 0x35, 0x35, 0x61,
+0x63, 0x32, 0x33, 0x63, 0x30, 0x63, 0x32, 0x38,
+0x63, 0x35, 0x37, 0x63, 0x36, 0x35, 0x63, 0x34,
+0x31, 0x66, 0x39, 0x62, 0x20, 0x45, 0x51, 0x55,
+0x41, 0x4c, 0x56, 0x45, 0x52, 0x49, 0x46, 0x59,
+0x20, 0x43, 0x48, 0x45, 0x43, 0x4b, 0x53, 0x49,
+0x47, 0x22, 0x5d, 0x5d, 0x2c, 0x0a, 0x22, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x65, 0x30, 0x62, 0x65, 0x39, 0x65, 0x33,
+0x32, 0x66, 0x31, 0x66, 0x38, 0x39, 0x63, 0x33,
+0x64, 0x39, 0x31, 0x36, 0x63, 0x34, 0x66, 0x32,
+0x31, 0x65, 0x35, 0x35, 0x63, 0x64, 0x63, 0x64,
+0x30, 0x39, 0x36, 0x37, 0x34, 0x31, 0x62, 0x38,
+0x39, 0x35, 0x63, 0x63, 0x37, 0x36, 0x61, 0x63,
+0x33, 0x35, 0x33, 0x65, 0x36, 0x30, 0x32, 0x33,
+0x61, 0x30, 0x35, 0x66, 0x34, 0x66, 0x37, 0x63,
+0x63, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x64, 0x38, 0x36, 0x31, 0x34, 0x39, 0x33,
+0x30, 0x34, 0x36, 0x30, 0x32, 0x32, 0x31, 0x30,
+0x30, 0x38, 0x36, 0x65, 0x35, 0x66, 0x37, 0x33,
+0x36, 0x61, 0x32, 0x63, 0x33, 0x36, 0x32, 0x32,
+0x65, 0x62, 0x62, 0x36, 0x32, 0x62, 0x64, 0x39,
+0x64, 0x39, 0x33, 0x64, 0x38, 0x65, 0x35, 0x64,
+0x37, 0x36, 0x35, 0x30, 0x38, 0x62, 0x39, 0x38,
+0x62, 0x65, 0x39, 0x32, 0x32, 0x62, 0x39, 0x37,
+0x31, 0x36, 0x30, 0x65, 0x64, 0x63, 0x33, 0x64,
+0x63, 0x63, 0x61, 0x36, 0x64, 0x38, 0x63, 0x34,
+0x37, 0x30, 0x32, 0x32, 0x31, 0x30, 0x30, 0x62,
+0x32, 0x33, 0x63, 0x33, 0x31, 0x32, 0x61, 0x63,
+0x32, 0x33, 0x32, 0x61, 0x34, 0x34, 0x37, 0x33,
+0x66, 0x31, 0x39, 0x64, 0x32, 0x61, 0x65, 0x62,
+0x39, 0x35, 0x61, 0x62, 0x37, 0x62, 0x64, 0x66,
+0x32, 0x62, 0x36, 0x35, 0x35, 0x31, 0x38, 0x39,
+0x31, 0x31, 0x61, 0x30, 0x64, 0x37, 0x32, 0x64,
+0x35, 0x30, 0x65, 0x33, 0x38, 0x62, 0x35, 0x64,
+0x64, 0x33, 0x31, 0x64, 0x63, 0x38, 0x32, 0x30,
+0x31, 0x32, 0x31, 0x30, 0x33, 0x38, 0x34, 0x37,
+0x39, 0x61, 0x30, 0x66, 0x61, 0x39, 0x39, 0x38,
+0x63, 0x64, 0x33, 0x35, 0x32, 0x35, 0x39, 0x61,
+0x32, 0x65, 0x66, 0x30, 0x61, 0x37, 0x61, 0x35,
+0x63, 0x36, 0x38, 0x36, 0x36, 0x32, 0x63, 0x31,
+0x34, 0x37, 0x34, 0x66, 0x38, 0x38, 0x63, 0x63,
+0x62, 0x36, 0x64, 0x30, 0x38, 0x61, 0x37, 0x36,
+0x37, 0x37, 0x62, 0x62, 0x65, 0x63, 0x37, 0x66,
+0x32, 0x32, 0x30, 0x34, 0x31, 0x61, 0x63, 0x34,
+0x37, 0x33, 0x30, 0x34, 0x34, 0x30, 0x32, 0x32,
+0x30, 0x35, 0x30, 0x38, 0x66, 0x61, 0x37, 0x36,
+0x31, 0x38, 0x36, 0x35, 0x63, 0x38, 0x61, 0x62,
+0x64, 0x38, 0x31, 0x32, 0x34, 0x34, 0x61, 0x31,
+0x36, 0x38, 0x33, 0x39, 0x32, 0x38, 0x37, 0x36,
+0x65, 0x65, 0x31, 0x64, 0x39, 0x34, 0x65, 0x38,
+0x65, 0x64, 0x38, 0x33, 0x38, 0x39, 0x37, 0x30,
+0x36, 0x36, 0x62, 0x35, 0x65, 0x32, 0x64, 0x66,
+0x32, 0x34, 0x30, 0x30, 0x64, 0x61, 0x64, 0x32,
+0x34, 0x30, 0x32, 0x32, 0x30, 0x34, 0x33, 0x66,
+0x35, 0x65, 0x65, 0x37, 0x35, 0x33, 0x38, 0x65,
+0x38, 0x37, 0x65, 0x39, 0x63, 0x36, 0x61, 0x65,
+0x66, 0x37, 0x65, 0x66, 0x35, 0x35, 0x31, 0x33,
+0x33, 0x64, 0x33, 0x65, 0x35, 0x31, 0x64, 0x61,
+0x37, 0x63, 0x63, 0x35, 0x32, 0x32, 0x38, 0x33,
+0x30, 0x61, 0x39, 0x63, 0x34, 0x64, 0x37, 0x33,
+0x36, 0x39, 0x37, 0x37, 0x61, 0x37, 0x36, 0x65,
+0x66, 0x37, 0x35, 0x35, 0x63, 0x30, 0x31, 0x32,
+0x31, 0x30, 0x33, 0x38, 0x34, 0x37, 0x39, 0x61,
+0x30, 0x66, 0x61, 0x39, 0x39, 0x38, 0x63, 0x64,
+0x33, 0x35, 0x32, 0x35, 0x39, 0x61, 0x32, 0x65,
+0x66, 0x30, 0x61, 0x37, 0x61, 0x35, 0x63, 0x36,
+0x38, 0x36, 0x36, 0x32, 0x63, 0x31, 0x34, 0x37,
+0x34, 0x66, 0x38, 0x38, 0x63, 0x63, 0x62, 0x36,
+0x64, 0x30, 0x38, 0x61, 0x37, 0x36, 0x37, 0x37,
+0x62, 0x62, 0x65, 0x63, 0x37, 0x66, 0x32, 0x32,
+0x30, 0x34, 0x31, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x36,
+0x61, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x22, 0x2c, 0x20, 0x22, 0x50, 0x32, 0x53,
+0x48, 0x22, 0x5d, 0x2c, 0x0a, 0x0a, 0x5b, 0x22,
+0x53, 0x61, 0x6d, 0x65, 0x20, 0x73, 0x65, 0x6d,
+0x61, 0x6e, 0x74, 0x69, 0x63, 0x73, 0x20, 0x66,
+0x6f, 0x72, 0x20, 0x4f, 0x50, 0x5f, 0x43, 0x4f,
+0x44, 0x45, 0x53, 0x45, 0x50, 0x41, 0x52, 0x41,
+0x54, 0x4f, 0x52, 0x22, 0x5d, 0x2c, 0x0a, 0x5b,
+0x5b, 0x5b, 0x22, 0x31, 0x30, 0x63, 0x39, 0x66,
+0x30, 0x65, 0x66, 0x66, 0x65, 0x38, 0x33, 0x65,
+0x39, 0x37, 0x66, 0x38, 0x30, 0x66, 0x30, 0x36,
+0x37, 0x64, 0x65, 0x32, 0x62, 0x31, 0x31, 0x63,
+0x36, 0x61, 0x30, 0x30, 0x63, 0x33, 0x30, 0x38,
+0x38, 0x61, 0x34, 0x62, 0x63, 0x65, 0x34, 0x32,
+0x63, 0x35, 0x61, 0x65, 0x37, 0x36, 0x31, 0x35,
+0x31, 0x39, 0x61, 0x66, 0x39, 0x33, 0x30, 0x36,
+0x66, 0x33, 0x63, 0x22, 0x2c, 0x20, 0x31, 0x2c,
+0x20, 0x22, 0x44, 0x55, 0x50, 0x20, 0x48, 0x41,
+0x53, 0x48, 0x31, 0x36, 0x30, 0x20, 0x30, 0x78,
+0x31, 0x34, 0x20, 0x30, 0x78, 0x65, 0x65, 0x35,
+0x61, 0x36, 0x61, 0x61, 0x34, 0x30, 0x66, 0x61,
+0x63, 0x65, 0x66, 0x62, 0x32, 0x36, 0x35, 0x35,
+0x61, 0x63, 0x32, 0x33, 0x63, 0x30, 0x63, 0x32,
+0x38, 0x63, 0x35, 0x37, 0x63, 0x36, 0x35, 0x63,
+0x34, 0x31, 0x66, 0x39, 0x62, 0x20, 0x45, 0x51,
+0x55, 0x41, 0x4c, 0x56, 0x45, 0x52, 0x49, 0x46,
+0x59, 0x20, 0x43, 0x48, 0x45, 0x43, 0x4b, 0x53,
+0x49, 0x47, 0x22, 0x5d, 0x5d, 0x2c, 0x0a, 0x22,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x33, 0x63, 0x36, 0x66, 0x33, 0x30,
+0x66, 0x39, 0x39, 0x61, 0x35, 0x31, 0x36, 0x31,
+0x65, 0x37, 0x35, 0x61, 0x32, 0x63, 0x65, 0x34,
+0x62, 0x63, 0x61, 0x34, 0x38, 0x38, 0x33, 0x30,
+0x30, 0x63, 0x61, 0x30, 0x63, 0x36, 0x31, 0x31,
+0x32, 0x62, 0x64, 0x65, 0x36, 0x37, 0x66, 0x30,
+0x38, 0x30, 0x37, 0x66, 0x65, 0x39, 0x38, 0x33,
+0x66, 0x65, 0x65, 0x66, 0x66, 0x30, 0x63, 0x39,
+0x31, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x65, 0x36, 0x30, 0x38, 0x36, 0x34,
+0x36, 0x35, 0x36, 0x31, 0x36, 0x34, 0x36, 0x32,
+0x36, 0x35, 0x36, 0x35, 0x36, 0x36, 0x37, 0x35,
+0x61, 0x62, 0x36, 0x31, 0x34, 0x39, 0x33, 0x30,
+0x34, 0x36, 0x30, 0x32, 0x32, 0x31, 0x30, 0x30,
+0x63, 0x65, 0x31, 0x38, 0x64, 0x33, 0x38, 0x34,
+0x32, 0x32, 0x31, 0x61, 0x37, 0x33, 0x31, 0x63,
+0x39, 0x39, 0x33, 0x39, 0x33, 0x39, 0x30, 0x31,
+0x35, 0x65, 0x33, 0x64, 0x31, 0x62, 0x63, 0x65,
+0x62, 0x61, 0x66, 0x62, 0x31, 0x36, 0x65, 0x38,
+0x63, 0x30, 0x62, 0x35, 0x62, 0x35, 0x64, 0x31,
+0x34, 0x30, 0x39, 0x37, 0x65, 0x63, 0x38, 0x31,
+0x37, 0x37, 0x61, 0x65, 0x36, 0x66, 0x32, 0x38,
+0x30, 0x32, 0x32, 0x31, 0x30, 0x30, 0x62, 0x63,
+0x61, 0x62, 0x32, 0x32, 0x37, 0x61, 0x66, 0x39,
+0x30, 0x62, 0x61, 0x62, 0x33, 0x33, 0x63, 0x33,
+0x66, 0x65, 0x30, 0x61, 0x39, 0x61, 0x62, 0x66,
+0x65, 0x65, 0x30, 0x33, 0x62, 0x61, 0x39, 0x37,
+0x36, 0x65, 0x65, 0x32, 0x35, 0x64, 0x63, 0x36,
+0x63, 0x65, 0x35, 0x34, 0x32, 0x35, 0x32, 0x36,
+0x65, 0x39, 0x62, 0x32, 0x65, 0x35, 0x36, 0x65,
+0x31, 0x34, 0x62, 0x37, 0x66, 0x31, 0x30, 0x31,
+0x32, 0x31, 0x30, 0x33, 0x38, 0x34, 0x37, 0x39,
+0x61, 0x30, 0x66, 0x61, 0x39, 0x39, 0x38, 0x63,
+0x64, 0x33, 0x35, 0x32, 0x35, 0x39, 0x61, 0x32,
+0x65, 0x66, 0x30, 0x61, 0x37, 0x61, 0x35, 0x63,
+0x36, 0x38, 0x36, 0x36, 0x32, 0x63, 0x31, 0x34,
+0x37, 0x34, 0x66, 0x38, 0x38, 0x63, 0x63, 0x62,
+0x36, 0x64, 0x30, 0x38, 0x61, 0x37, 0x36, 0x37,
+0x37, 0x62, 0x62, 0x65, 0x63, 0x37, 0x66, 0x32,
+0x32, 0x30, 0x34, 0x31, 0x61, 0x63, 0x34, 0x39,
+0x33, 0x30, 0x34, 0x36, 0x30, 0x32, 0x32, 0x31,
+0x30, 0x30, 0x63, 0x33, 0x62, 0x39, 0x33, 0x65,
+0x64, 0x63, 0x63, 0x30, 0x66, 0x64, 0x36, 0x32,
+0x35, 0x30, 0x65, 0x62, 0x33, 0x32, 0x66, 0x32,
+0x64, 0x64, 0x38, 0x61, 0x30, 0x62, 0x62, 0x61,
+0x31, 0x37, 0x35, 0x34, 0x62, 0x30, 0x66, 0x36,
+0x63, 0x33, 0x62, 0x65, 0x38, 0x65, 0x64, 0x34,
+0x31, 0x30, 0x30, 0x65, 0x64, 0x35, 0x38, 0x32,
+0x66, 0x33, 0x64, 0x62, 0x37, 0x33, 0x65, 0x62,
+0x61, 0x32, 0x30, 0x32, 0x32, 0x31, 0x30, 0x30,
+0x62, 0x66, 0x37, 0x35, 0x62, 0x35, 0x62, 0x64,
+0x32, 0x65, 0x66, 0x66, 0x34, 0x64, 0x36, 0x62,
+0x66, 0x32, 0x62, 0x64, 0x61, 0x32, 0x65, 0x33,
+0x34, 0x61, 0x34, 0x30, 0x66, 0x63, 0x63, 0x30,
+0x37, 0x64, 0x34, 0x61, 0x61, 0x33, 0x63, 0x66,
+0x38, 0x36, 0x32, 0x63, 0x65, 0x61, 0x61, 0x37,
+0x37, 0x62, 0x34, 0x37, 0x62, 0x38, 0x31, 0x65,
+0x66, 0x66, 0x38, 0x32, 0x39, 0x66, 0x39, 0x61,
+0x30, 0x31, 0x61, 0x62, 0x32, 0x31, 0x30, 0x33,
+0x38, 0x34, 0x37, 0x39, 0x61, 0x30, 0x66, 0x61,
+0x39, 0x39, 0x38, 0x63, 0x64, 0x33, 0x35, 0x32,
+0x35, 0x39, 0x61, 0x32, 0x65, 0x66, 0x30, 0x61,
+0x37, 0x61, 0x35, 0x63, 0x36, 0x38, 0x36, 0x36,
+0x32, 0x63, 0x31, 0x34, 0x37, 0x34, 0x66, 0x38,
+0x38, 0x63, 0x63, 0x62, 0x36, 0x64, 0x30, 0x38,
+0x61, 0x37, 0x36, 0x37, 0x37, 0x62, 0x62, 0x65,
+0x63, 0x37, 0x66, 0x32, 0x32, 0x30, 0x34, 0x31,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x31, 0x36, 0x61, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x22, 0x2c,
+0x20, 0x22, 0x50, 0x32, 0x53, 0x48, 0x22, 0x5d,
+0x2c, 0x0a, 0x0a, 0x5b, 0x22, 0x53, 0x69, 0x67,
+0x6e, 0x61, 0x74, 0x75, 0x72, 0x65, 0x73, 0x20,
+0x61, 0x72, 0x65, 0x20, 0x72, 0x65, 0x6d, 0x6f,
+0x76, 0x65, 0x64, 0x20, 0x66, 0x72, 0x6f, 0x6d,
+0x20, 0x74, 0x68, 0x65, 0x20, 0x73, 0x63, 0x72,
+0x69, 0x70, 0x74, 0x20, 0x74, 0x68, 0x65, 0x79,
+0x20, 0x61, 0x72, 0x65, 0x20, 0x69, 0x6e, 0x20,
+0x62, 0x79, 0x20, 0x46, 0x69, 0x6e, 0x64, 0x41,
+0x6e, 0x64, 0x44, 0x65, 0x6c, 0x65, 0x74, 0x65,
+0x28, 0x29, 0x20, 0x69, 0x6e, 0x20, 0x74, 0x68,
+0x65, 0x20, 0x43, 0x48, 0x45, 0x43, 0x4b, 0x53,
+0x49, 0x47, 0x20, 0x63, 0x6f, 0x64, 0x65, 0x3b,
+0x20, 0x65, 0x76, 0x65, 0x6e, 0x20, 0x6d, 0x75,
+0x6c, 0x74, 0x69, 0x70, 0x6c, 0x65, 0x20, 0x69,
+0x6e, 0x73, 0x74, 0x61, 0x6e, 0x63, 0x65, 0x73,
+0x20, 0x6f, 0x66, 0x20, 0x6f, 0x6e, 0x65, 0x20,
+0x73, 0x69, 0x67, 0x6e, 0x61, 0x74, 0x75, 0x72,
+0x65, 0x20, 0x63, 0x61, 0x6e, 0x20, 0x62, 0x65,
+0x20, 0x72, 0x65, 0x6d, 0x6f, 0x76, 0x65, 0x64,
+0x2e, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b, 0x5b,
+0x22, 0x36, 0x30, 0x35, 0x36, 0x65, 0x62, 0x64,
+0x35, 0x34, 0x39, 0x30, 0x30, 0x33, 0x62, 0x31,
+0x30, 0x63, 0x62, 0x62, 0x64, 0x39, 0x31, 0x35,
+0x63, 0x65, 0x61, 0x30, 0x64, 0x38, 0x32, 0x32,
+0x30, 0x39, 0x66, 0x65, 0x34, 0x30, 0x62, 0x38,
+0x36, 0x31, 0x37, 0x31, 0x30, 0x34, 0x62, 0x65,
+0x39, 0x31, 0x37, 0x61, 0x32, 0x36, 0x66, 0x61,
+0x39, 0x32, 0x63, 0x62, 0x65, 0x33, 0x64, 0x36,
+0x66, 0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20, 0x22,
+0x44, 0x55, 0x50, 0x20, 0x48, 0x41, 0x53, 0x48,
+0x31, 0x36, 0x30, 0x20, 0x30, 0x78, 0x31, 0x34,
+0x20, 0x30, 0x78, 0x65, 0x65, 0x35, 0x61, 0x36,
+0x61, 0x61, 0x34, 0x30, 0x66, 0x61, 0x63, 0x65,
+0x66, 0x62, 0x32, 0x36, 0x35, 0x35, 0x61, 0x63,
+0x32, 0x33, 0x63, 0x30, 0x63, 0x32, 0x38, 0x63,
+0x35, 0x37, 0x63, 0x36, 0x35, 0x63, 0x34, 0x31,
+0x66, 0x39, 0x62, 0x20, 0x45, 0x51, 0x55, 0x41,
+0x4c, 0x56, 0x45, 0x52, 0x49, 0x46, 0x59, 0x20,
+0x43, 0x48, 0x45, 0x43, 0x4b, 0x53, 0x49, 0x47,
+0x22, 0x5d, 0x5d, 0x2c, 0x0a, 0x22, 0x30, 0x31,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x36, 0x66, 0x33, 0x64, 0x62, 0x65, 0x32, 0x63,
+0x61, 0x39, 0x36, 0x66, 0x61, 0x32, 0x31, 0x37,
+0x65, 0x39, 0x34, 0x62, 0x31, 0x30, 0x31, 0x37,
+0x38, 0x36, 0x30, 0x62, 0x65, 0x34, 0x39, 0x66,
+0x32, 0x30, 0x38, 0x32, 0x30, 0x64, 0x65, 0x61,
+0x35, 0x63, 0x39, 0x31, 0x62, 0x64, 0x63, 0x62,
+0x31, 0x30, 0x33, 0x62, 0x30, 0x30, 0x34, 0x39,
+0x64, 0x35, 0x65, 0x62, 0x35, 0x36, 0x36, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x66, 0x64, 0x31, 0x64, 0x30, 0x31, 0x34, 0x37,
+0x33, 0x30, 0x34, 0x34, 0x30, 0x32, 0x32, 0x30,
+0x33, 0x39, 0x38, 0x39, 0x61, 0x63, 0x38, 0x66,
+0x39, 0x61, 0x64, 0x33, 0x36, 0x62, 0x35, 0x64,
+0x30, 0x39, 0x31, 0x39, 0x64, 0x39, 0x37, 0x66,
+0x61, 0x30, 0x61, 0x37, 0x66, 0x37, 0x30, 0x63,
+0x35, 0x32, 0x37, 0x32, 0x61, 0x62, 0x65, 0x65,
+0x33, 0x62, 0x31, 0x34, 0x34, 0x37, 0x37, 0x64,
+0x63, 0x36, 0x34, 0x36, 0x32, 0x38, 0x38, 0x61,
+0x38, 0x62, 0x39, 0x37, 0x36, 0x64, 0x66, 0x35,
+0x30, 0x32, 0x32, 0x30, 0x32, 0x37, 0x64, 0x31,
+0x39, 0x64, 0x61, 0x38, 0x34, 0x61, 0x30, 0x36,
+0x36, 0x61, 0x66, 0x39, 0x30, 0x35, 0x33, 0x61,
+0x64, 0x33, 0x64, 0x31, 0x64, 0x37, 0x34, 0x35,
+0x39, 0x64, 0x31, 0x37, 0x31, 0x62, 0x37, 0x65,
+0x33, 0x61, 0x38, 0x30, 0x62, 0x63, 0x36, 0x63,
+0x34, 0x65, 0x66, 0x37, 0x61, 0x33, 0x33, 0x30,
+0x36, 0x37, 0x37, 0x61, 0x36, 0x62, 0x65, 0x35,
+0x34, 0x38, 0x31, 0x34, 0x30, 0x31, 0x34, 0x37,
+0x33, 0x30, 0x34, 0x34, 0x30, 0x32, 0x32, 0x30,
+0x33, 0x39, 0x38, 0x39, 0x61, 0x63, 0x38, 0x66,
+0x39, 0x61, 0x64, 0x33, 0x36, 0x62, 0x35, 0x64,
+0x30, 0x39, 0x31, 0x39, 0x64, 0x39, 0x37, 0x66,
+0x61, 0x30, 0x61, 0x37, 0x66, 0x37, 0x30, 0x63,
+0x35, 0x32, 0x37, 0x32, 0x61, 0x62, 0x65, 0x65,
+0x33, 0x62, 0x31, 0x34, 0x34, 0x37, 0x37, 0x64,
+0x63, 0x36, 0x34, 0x36, 0x32, 0x38, 0x38, 0x61,
+0x38, 0x62, 0x39, 0x37, 0x36, 0x64, 0x66, 0x35,
+0x30, 0x32, 0x32, 0x30, 0x32, 0x37, 0x64, 0x31,
+0x39, 0x64, 0x61, 0x38, 0x34, 0x61, 0x30, 0x36,
+0x36, 0x61, 0x66, 0x39, 0x30, 0x35, 0x33, 0x61,
+0x64, 0x33, 0x64, 0x31, 0x64, 0x37, 0x34, 0x35,
+0x39, 0x64, 0x31, 0x37, 0x31, 0x62, 0x37, 0x65,
+0x33, 0x61, 0x38, 0x30, 0x62, 0x63, 0x36, 0x63,
+0x34, 0x65, 0x66, 0x37, 0x61, 0x33, 0x33, 0x30,
+0x36, 0x37, 0x37, 0x61, 0x36, 0x62, 0x65, 0x35,
+0x34, 0x38, 0x31, 0x34, 0x30, 0x31, 0x32, 0x31,
+0x30, 0x33, 0x38, 0x34, 0x37, 0x39, 0x61, 0x30,
+0x66, 0x61, 0x39, 0x39, 0x38, 0x63, 0x64, 0x33,
+0x35, 0x32, 0x35, 0x39, 0x61, 0x32, 0x65, 0x66,
+0x30, 0x61, 0x37, 0x61, 0x35, 0x63, 0x36, 0x38,
+0x36, 0x36, 0x32, 0x63, 0x31, 0x34, 0x37, 0x34,
+0x66, 0x38, 0x38, 0x63, 0x63, 0x62, 0x36, 0x64,
+0x30, 0x38, 0x61, 0x37, 0x36, 0x37, 0x37, 0x62,
+0x62, 0x65, 0x63, 0x37, 0x66, 0x32, 0x32, 0x30,
+0x34, 0x31, 0x61, 0x63, 0x34, 0x37, 0x33, 0x30,
+0x34, 0x34, 0x30, 0x32, 0x32, 0x30, 0x33, 0x37,
+0x35, 0x37, 0x65, 0x39, 0x33, 0x37, 0x62, 0x61,
+0x38, 0x30, 0x37, 0x65, 0x34, 0x61, 0x35, 0x64,
+0x61, 0x38, 0x35, 0x33, 0x34, 0x63, 0x31, 0x37,
+0x66, 0x39, 0x64, 0x31, 0x32, 0x31, 0x31, 0x37,
+0x36, 0x30, 0x35, 0x36, 0x34, 0x30, 0x36, 0x61,
+0x36, 0x34, 0x36, 0x35, 0x30, 0x35, 0x34, 0x62,
+0x64, 0x64, 0x32, 0x36, 0x30, 0x34, 0x35, 0x37,
+0x35, 0x31, 0x35, 0x63, 0x31, 0x61, 0x30, 0x32,
+0x32, 0x30, 0x30, 0x66, 0x30, 0x32, 0x65, 0x63,
+0x63, 0x66, 0x31, 0x62, 0x65, 0x63, 0x30, 0x66,
+0x33, 0x61, 0x30, 0x64, 0x36, 0x35, 0x64, 0x66,
+0x33, 0x37, 0x38, 0x38, 0x39, 0x31, 0x34, 0x33,
+0x63, 0x32, 0x65, 0x38, 0x38, 0x61, 0x62, 0x37,
+0x61, 0x63, 0x65, 0x63, 0x36, 0x31, 0x61, 0x37,
+0x62, 0x36, 0x66, 0x35, 0x61, 0x61, 0x32, 0x36,
+0x34, 0x31, 0x33, 0x39, 0x31, 0x34, 0x31, 0x61,
+0x32, 0x62, 0x30, 0x31, 0x32, 0x31, 0x30, 0x33,
+0x38, 0x34, 0x37, 0x39, 0x61, 0x30, 0x66, 0x61,
+0x39, 0x39, 0x38, 0x63, 0x64, 0x33, 0x35, 0x32,
+0x35, 0x39, 0x61, 0x32, 0x65, 0x66, 0x30, 0x61,
+0x37, 0x61, 0x35, 0x63, 0x36, 0x38, 0x36, 0x36,
+0x32, 0x63, 0x31, 0x34, 0x37, 0x34, 0x66, 0x38,
+0x38, 0x63, 0x63, 0x62, 0x36, 0x64, 0x30, 0x38,
+0x61, 0x37, 0x36, 0x37, 0x37, 0x62, 0x62, 0x65,
+0x63, 0x37, 0x66, 0x32, 0x32, 0x30, 0x34, 0x31,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x31, 0x36, 0x61, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x22, 0x2c,
+0x20, 0x22, 0x50, 0x32, 0x53, 0x48, 0x22, 0x5d,
+0x2c, 0x0a, 0x0a, 0x5b, 0x22, 0x54, 0x68, 0x61,
+0x74, 0x20, 0x61, 0x6c, 0x73, 0x6f, 0x20, 0x69,
+0x6e, 0x63, 0x6c, 0x75, 0x64, 0x65, 0x73, 0x20,
+0x61, 0x68, 0x65, 0x61, 0x64, 0x20, 0x6f, 0x66,
+0x20, 0x74, 0x68, 0x65, 0x20, 0x6f, 0x70, 0x63,
+0x6f, 0x64, 0x65, 0x20, 0x62, 0x65, 0x69, 0x6e,
+0x67, 0x20, 0x65, 0x78, 0x65, 0x63, 0x75, 0x74,
+0x65, 0x64, 0x2e, 0x22, 0x5d, 0x2c, 0x0a, 0x5b,
+0x5b, 0x5b, 0x22, 0x35, 0x61, 0x36, 0x62, 0x30,
+0x30, 0x32, 0x31, 0x61, 0x36, 0x30, 0x34, 0x32,
+0x61, 0x36, 0x38, 0x36, 0x62, 0x36, 0x62, 0x39,
+0x34, 0x61, 0x62, 0x63, 0x33, 0x36, 0x62, 0x33,
+0x38, 0x37, 0x62, 0x65, 0x66, 0x39, 0x31, 0x30,
+0x39, 0x38, 0x34, 0x37, 0x37, 0x37, 0x34, 0x65,
+0x38, 0x62, 0x31, 0x65, 0x35, 0x31, 0x65, 0x62,
+0x38, 0x63, 0x63, 0x35, 0x35, 0x63, 0x35, 0x33,
+0x39, 0x32, 0x31, 0x22, 0x2c, 0x20, 0x31, 0x2c,
+0x20, 0x22, 0x44, 0x55, 0x50, 0x20, 0x48, 0x41,
+0x53, 0x48, 0x31, 0x36, 0x30, 0x20, 0x30, 0x78,
+0x31, 0x34, 0x20, 0x30, 0x78, 0x65, 0x65, 0x35,
+0x61, 0x36, 0x61, 0x61, 0x34, 0x30, 0x66, 0x61,
+0x63, 0x65, 0x66, 0x62, 0x32, 0x36, 0x35, 0x35,
+0x61, 0x63, 0x32, 0x33, 0x63, 0x30, 0x63, 0x32,
+0x38, 0x63, 0x35, 0x37, 0x63, 0x36, 0x35, 0x63,
+0x34, 0x31, 0x66, 0x39, 0x62, 0x20, 0x45, 0x51,
+0x55, 0x41, 0x4c, 0x56, 0x45, 0x52, 0x49, 0x46,
+0x59, 0x20, 0x43, 0x48, 0x45, 0x43, 0x4b, 0x53,
+0x49, 0x47, 0x22, 0x5d, 0x5d, 0x2c, 0x0a, 0x22,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x32, 0x31, 0x33, 0x39, 0x63, 0x35,
+0x35, 0x35, 0x63, 0x63, 0x62, 0x38, 0x31, 0x65,
+0x65, 0x35, 0x62, 0x31, 0x65, 0x38, 0x37, 0x34,
+0x37, 0x37, 0x38, 0x34, 0x30, 0x39, 0x39, 0x31,
+0x65, 0x66, 0x37, 0x62, 0x33, 0x38, 0x36, 0x62,
+0x63, 0x33, 0x61, 0x62, 0x39, 0x34, 0x36, 0x62,
+0x36, 0x62, 0x36, 0x38, 0x32, 0x61, 0x30, 0x34,
+0x61, 0x36, 0x32, 0x31, 0x30, 0x30, 0x36, 0x62,
+0x35, 0x61, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x66, 0x64, 0x62, 0x34, 0x30, 0x31,
+0x34, 0x38, 0x33, 0x30, 0x34, 0x35, 0x30, 0x32,
+0x32, 0x30, 0x31, 0x37, 0x32, 0x33, 0x65, 0x36,
+0x39, 0x32, 0x65, 0x35, 0x66, 0x34, 0x30, 0x39,
+0x61, 0x37, 0x31, 0x35, 0x31, 0x64, 0x62, 0x33,
+0x38, 0x36, 0x32, 0x39, 0x31, 0x62, 0x36, 0x33,
+0x35, 0x32, 0x34, 0x63, 0x35, 0x65, 0x62, 0x32,
+0x30, 0x33, 0x30, 0x64, 0x66, 0x36, 0x35, 0x32,
+0x62, 0x31, 0x66, 0x35, 0x33, 0x30, 0x32, 0x32,
+0x66, 0x64, 0x38, 0x32, 0x30, 0x37, 0x33, 0x34,
+0x39, 0x66, 0x30, 0x32, 0x32, 0x31, 0x30, 0x30,
+0x62, 0x39, 0x30, 0x64, 0x39, 0x62, 0x62, 0x66,
+0x32, 0x66, 0x33, 0x33, 0x36, 0x36, 0x63, 0x65,
+0x31, 0x37, 0x36, 0x65, 0x35, 0x65, 0x37, 0x38,
+0x30, 0x61, 0x30, 0x30, 0x34, 0x33, 0x33, 0x64,
+0x61, 0x36, 0x37, 0x64, 0x39, 0x65, 0x35, 0x63,
+0x37, 0x39, 0x33, 0x31, 0x32, 0x63, 0x36, 0x33,
+0x38, 0x38, 0x33, 0x31, 0x32, 0x61, 0x32, 0x39,
+0x36, 0x61, 0x35, 0x38, 0x30, 0x30, 0x33, 0x39,
+0x30, 0x31, 0x34, 0x38, 0x33, 0x30, 0x34, 0x35,
+0x30, 0x32, 0x32, 0x30, 0x31, 0x37, 0x32, 0x33,
+0x65, 0x36, 0x39, 0x32, 0x65, 0x35, 0x66, 0x34,
+0x30, 0x39, 0x61, 0x37, 0x31, 0x35, 0x31, 0x64,
+0x62, 0x33, 0x38, 0x36, 0x32, 0x39, 0x31, 0x62,
+0x36, 0x33, 0x35, 0x32, 0x34, 0x63, 0x35, 0x65,
+0x62, 0x32, 0x30, 0x33, 0x30, 0x64, 0x66, 0x36,
+0x35, 0x32, 0x62, 0x31, 0x66, 0x35, 0x33, 0x30,
+0x32, 0x32, 0x66, 0x64, 0x38, 0x32, 0x30, 0x37,
+0x33, 0x34, 0x39, 0x66, 0x30, 0x32, 0x32, 0x31,
+0x30, 0x30, 0x62, 0x39, 0x30, 0x64, 0x39, 0x62,
+0x62, 0x66, 0x32, 0x66, 0x33, 0x33, 0x36, 0x36,
+0x63, 0x65, 0x31, 0x37, 0x36, 0x65, 0x35, 0x65,
+0x37, 0x38, 0x30, 0x61, 0x30, 0x30, 0x34, 0x33,
+0x33, 0x64, 0x61, 0x36, 0x37, 0x64, 0x39, 0x65,
+0x35, 0x63, 0x37, 0x39, 0x33, 0x31, 0x32, 0x63,
+0x36, 0x33, 0x38, 0x38, 0x33, 0x31, 0x32, 0x61,
+0x32, 0x39, 0x36, 0x61, 0x35, 0x38, 0x30, 0x30,
+0x33, 0x39, 0x30, 0x31, 0x32, 0x31, 0x30, 0x33,
+0x38, 0x34, 0x37, 0x39, 0x61, 0x30, 0x66, 0x61,
+0x39, 0x39, 0x38, 0x63, 0x64, 0x33, 0x35, 0x32,
+0x35, 0x39, 0x61, 0x32, 0x65, 0x66, 0x30, 0x61,
+0x37, 0x61, 0x35, 0x63, 0x36, 0x38, 0x36, 0x36,
+0x32, 0x63, 0x31, 0x34, 0x37, 0x34, 0x66, 0x38,
+0x38, 0x63, 0x63, 0x62, 0x36, 0x64, 0x30, 0x38,
+0x61, 0x37, 0x36, 0x37, 0x37, 0x62, 0x62, 0x65,
+0x63, 0x37, 0x66, 0x32, 0x32, 0x30, 0x34, 0x31,
+0x34, 0x38, 0x33, 0x30, 0x34, 0x35, 0x30, 0x32,
+0x32, 0x30, 0x31, 0x37, 0x32, 0x33, 0x65, 0x36,
+0x39, 0x32, 0x65, 0x35, 0x66, 0x34, 0x30, 0x39,
+0x61, 0x37, 0x31, 0x35, 0x31, 0x64, 0x62, 0x33,
+0x38, 0x36, 0x32, 0x39, 0x31, 0x62, 0x36, 0x33,
+0x35, 0x32, 0x34, 0x63, 0x35, 0x65, 0x62, 0x32,
+0x30, 0x33, 0x30, 0x64, 0x66, 0x36, 0x35, 0x32,
+0x62, 0x31, 0x66, 0x35, 0x33, 0x30, 0x32, 0x32,
+0x66, 0x64, 0x38, 0x32, 0x30, 0x37, 0x33, 0x34,
+0x39, 0x66, 0x30, 0x32, 0x32, 0x31, 0x30, 0x30,
+0x62, 0x39, 0x30, 0x64, 0x39, 0x62, 0x62, 0x66,
+0x32, 0x66, 0x33, 0x33, 0x36, 0x36, 0x63, 0x65,
+0x31, 0x37, 0x36, 0x65, 0x35, 0x65, 0x37, 0x38,
+0x30, 0x61, 0x30, 0x30, 0x34, 0x33, 0x33, 0x64,
+0x61, 0x36, 0x37, 0x64, 0x39, 0x65, 0x35, 0x63,
+0x37, 0x39, 0x33, 0x31, 0x32, 0x63, 0x36, 0x33,
+0x38, 0x38, 0x33, 0x31, 0x32, 0x61, 0x32, 0x39,
+0x36, 0x61, 0x35, 0x38, 0x30, 0x30, 0x33, 0x39,
+0x30, 0x31, 0x37, 0x35, 0x61, 0x63, 0x34, 0x38,
+0x33, 0x30, 0x34, 0x35, 0x30, 0x32, 0x32, 0x30,
+0x36, 0x34, 0x36, 0x62, 0x37, 0x32, 0x63, 0x33,
+0x35, 0x62, 0x65, 0x65, 0x65, 0x63, 0x35, 0x31,
+0x66, 0x34, 0x64, 0x35, 0x62, 0x63, 0x31, 0x63,
+0x62, 0x61, 0x65, 0x30, 0x31, 0x38, 0x36, 0x33,
+0x38, 0x32, 0x35, 0x37, 0x35, 0x30, 0x64, 0x37,
+0x66, 0x34, 0x39, 0x30, 0x38, 0x36, 0x34, 0x61,
+0x66, 0x33, 0x35, 0x34, 0x65, 0x36, 0x65, 0x61,
+0x34, 0x66, 0x36, 0x32, 0x35, 0x65, 0x39, 0x63,
+0x30, 0x32, 0x32, 0x31, 0x30, 0x30, 0x66, 0x30,
+0x34, 0x62, 0x39, 0x38, 0x34, 0x33, 0x32, 0x64,
+0x66, 0x33, 0x61, 0x39, 0x36, 0x34, 0x31, 0x37,
+0x31, 0x39, 0x64, 0x62, 0x63, 0x65, 0x64, 0x35,
+0x33, 0x33, 0x39, 0x33, 0x30, 0x32, 0x32, 0x65,
+0x37, 0x32, 0x34, 0x39, 0x66, 0x62, 0x35, 0x39,
+0x64, 0x62, 0x39, 0x39, 0x33, 0x61, 0x66, 0x31,
+0x31, 0x31, 0x38, 0x35, 0x33, 0x39, 0x38, 0x33,
+0x30, 0x61, 0x61, 0x62, 0x38, 0x37, 0x30, 0x31,
+0x34, 0x38, 0x33, 0x30, 0x34, 0x35, 0x30, 0x32,
+0x32, 0x30, 0x31, 0x37, 0x32, 0x33, 0x65, 0x36,
+0x39, 0x32, 0x65, 0x35, 0x66, 0x34, 0x30, 0x39,
+0x61, 0x37, 0x31, 0x35, 0x31, 0x64, 0x62, 0x33,
+0x38, 0x36, 0x32, 0x39, 0x31, 0x62, 0x36, 0x33,
+0x35, 0x32, 0x34, 0x63, 0x35, 0x65, 0x62, 0x32,
+0x30, 0x33, 0x30, 0x64, 0x66, 0x36, 0x35, 0x32,
+0x62, 0x31, 0x66, 0x35, 0x33, 0x30, 0x32, 0x32,
+0x66, 0x64, 0x38, 0x32, 0x30, 0x37, 0x33, 0x34,
+0x39, 0x66, 0x30, 0x32, 0x32, 0x31, 0x30, 0x30,
+0x62, 0x39, 0x30, 0x64, 0x39, 0x62, 0x62, 0x66,
+0x32, 0x66, 0x33, 0x33, 0x36, 0x36, 0x63, 0x65,
+0x31, 0x37, 0x36, 0x65, 0x35, 0x65, 0x37, 0x38,
+0x30, 0x61, 0x30, 0x30, 0x34, 0x33, 0x33, 0x64,
+0x61, 0x36, 0x37, 0x64, 0x39, 0x65, 0x35, 0x63,
+0x37, 0x39, 0x33, 0x31, 0x32, 0x63, 0x36, 0x33,
+0x38, 0x38, 0x33, 0x31, 0x32, 0x61, 0x32, 0x39,
+0x36, 0x61, 0x35, 0x38, 0x30, 0x30, 0x33, 0x39,
+0x30, 0x31, 0x37, 0x35, 0x32, 0x31, 0x30, 0x33,
+0x38, 0x34, 0x37, 0x39, 0x61, 0x30, 0x66, 0x61,
+0x39, 0x39, 0x38, 0x63, 0x64, 0x33, 0x35, 0x32,
+0x35, 0x39, 0x61, 0x32, 0x65, 0x66, 0x30, 0x61,
+0x37, 0x61, 0x35, 0x63, 0x36, 0x38, 0x36, 0x36,
+0x32, 0x63, 0x31, 0x34, 0x37, 0x34, 0x66, 0x38,
+0x38, 0x63, 0x63, 0x62, 0x36, 0x64, 0x30, 0x38,
+0x61, 0x37, 0x36, 0x37, 0x37, 0x62, 0x62, 0x65,
+0x63, 0x37, 0x66, 0x32, 0x32, 0x30, 0x34, 0x31,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x31, 0x36, 0x61, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x22, 0x2c,
+0x20, 0x22, 0x50, 0x32, 0x53, 0x48, 0x22, 0x5d,
+0x2c, 0x0a, 0x0a, 0x5b, 0x22, 0x46, 0x69, 0x6e,
+0x61, 0x6c, 0x6c, 0x79, 0x20, 0x43, 0x48, 0x45,
+0x43, 0x4b, 0x4d, 0x55, 0x4c, 0x54, 0x49, 0x53,
+0x49, 0x47, 0x20, 0x72, 0x65, 0x6d, 0x6f, 0x76,
+0x65, 0x73, 0x20, 0x61, 0x6c, 0x6c, 0x20, 0x73,
+0x69, 0x67, 0x6e, 0x61, 0x74, 0x75, 0x72, 0x65,
+0x73, 0x20, 0x70, 0x72, 0x69, 0x6f, 0x72, 0x20,
+0x74, 0x6f, 0x20, 0x68, 0x61, 0x73, 0x68, 0x69,
+0x6e, 0x67, 0x20, 0x74, 0x68, 0x65, 0x20, 0x73,
+0x63, 0x72, 0x69, 0x70, 0x74, 0x20, 0x63, 0x6f,
+0x6e, 0x74, 0x61, 0x69, 0x6e, 0x69, 0x6e, 0x67,
+0x20, 0x74, 0x68, 0x6f, 0x73, 0x65, 0x20, 0x73,
+0x69, 0x67, 0x6e, 0x61, 0x74, 0x75, 0x72, 0x65,
+0x73, 0x2e, 0x20, 0x49, 0x6e, 0x20, 0x63, 0x6f,
+0x6e, 0x6a, 0x75, 0x6e, 0x63, 0x74, 0x69, 0x6f,
+0x6e, 0x20, 0x77, 0x69, 0x74, 0x68, 0x20, 0x74,
+0x68, 0x65, 0x20, 0x53, 0x49, 0x47, 0x48, 0x41,
+0x53, 0x48, 0x5f, 0x53, 0x49, 0x4e, 0x47, 0x4c,
+0x45, 0x20, 0x62, 0x75, 0x67, 0x20, 0x74, 0x68,
+0x69, 0x73, 0x20, 0x6c, 0x65, 0x74, 0x73, 0x20,
+0x75, 0x73, 0x20, 0x74, 0x65, 0x73, 0x74, 0x20,
+0x77, 0x68, 0x65, 0x74, 0x68, 0x65, 0x72, 0x20,
+0x6f, 0x72, 0x20, 0x6e, 0x6f, 0x74, 0x20, 0x46,
+0x69, 0x6e, 0x64, 0x41, 0x6e, 0x64, 0x44, 0x65,
+0x6c, 0x65, 0x74, 0x65, 0x28, 0x29, 0x20, 0x69,
+0x73, 0x20, 0x61, 0x63, 0x74, 0x75, 0x61, 0x6c,
+0x6c, 0x79, 0x20, 0x70, 0x72, 0x65, 0x73, 0x65,
+0x6e, 0x74, 0x20, 0x69, 0x6e, 0x20, 0x73, 0x63,
+0x72, 0x69, 0x70, 0x74, 0x50, 0x75, 0x62, 0x4b,
+0x65, 0x79, 0x2f, 0x72, 0x65, 0x64, 0x65, 0x65,
+0x6d, 0x53, 0x63, 0x72, 0x69, 0x70, 0x74, 0x20,
+0x65, 0x76, 0x61, 0x6c, 0x75, 0x61, 0x74, 0x69,
+0x6f, 0x6e, 0x20, 0x62, 0x79, 0x20, 0x69, 0x6e,
+0x63, 0x6c, 0x75, 0x64, 0x69, 0x6e, 0x67, 0x20,
+0x61, 0x20, 0x73, 0x69, 0x67, 0x6e, 0x61, 0x74,
+0x75, 0x72, 0x65, 0x20, 0x6f, 0x66, 0x20, 0x74,
+0x68, 0x65, 0x20, 0x64, 0x69, 0x67, 0x65, 0x73,
+0x74, 0x20, 0x30, 0x78, 0x30, 0x31, 0x20, 0x57,
+0x65, 0x20, 0x63, 0x61, 0x6e, 0x20, 0x63, 0x6f,
+0x6d, 0x70, 0x75, 0x74, 0x65, 0x20, 0x69, 0x6e,
+0x20, 0x61, 0x64, 0x76, 0x61, 0x6e, 0x63, 0x65,
+0x20, 0x66, 0x6f, 0x72, 0x20, 0x6f, 0x75, 0x72,
+0x20, 0x70, 0x75, 0x62, 0x6b, 0x65, 0x79, 0x2c,
+0x20, 0x65, 0x6d, 0x62, 0x65, 0x64, 0x20, 0x69,
+0x74, 0x20, 0x69, 0x6e, 0x20, 0x74, 0x68, 0x65,
+0x20, 0x73, 0x63, 0x72, 0x69, 0x70, 0x74, 0x50,
+0x75, 0x62, 0x4b, 0x65, 0x79, 0x2c, 0x20, 0x61,
+0x6e, 0x64, 0x20, 0x74, 0x68, 0x65, 0x6e, 0x20,
+0x61, 0x6c, 0x73, 0x6f, 0x20, 0x75, 0x73, 0x69,
+0x6e, 0x67, 0x20, 0x61, 0x20, 0x6e, 0x6f, 0x72,
+0x6d, 0x61, 0x6c, 0x20, 0x53, 0x49, 0x47, 0x48,
+0x41, 0x53, 0x48, 0x5f, 0x41, 0x4c, 0x4c, 0x20,
+0x73, 0x69, 0x67, 0x6e, 0x61, 0x74, 0x75, 0x72,
+0x65, 0x2e, 0x20, 0x49, 0x66, 0x20, 0x46, 0x69,
+0x6e, 0x64, 0x41, 0x6e, 0x64, 0x44, 0x65, 0x6c,
+0x65, 0x74, 0x65, 0x28, 0x29, 0x20, 0x77, 0x61,
+0x73, 0x6e, 0x27, 0x74, 0x20, 0x72, 0x75, 0x6e,
+0x2c, 0x20, 0x74, 0x68, 0x65, 0x20, 0x27, 0x62,
+0x75, 0x67, 0x67, 0x65, 0x64, 0x27, 0x20, 0x73,
+0x69, 0x67, 0x6e, 0x61, 0x74, 0x75, 0x72, 0x65,
+0x20, 0x77, 0x6f, 0x75, 0x6c, 0x64, 0x20, 0x73,
+0x74, 0x69, 0x6c, 0x6c, 0x20, 0x62, 0x65, 0x20,
+0x69, 0x6e, 0x20, 0x74, 0x68, 0x65, 0x20, 0x68,
+0x61, 0x73, 0x68, 0x65, 0x64, 0x20, 0x73, 0x63,
+0x72, 0x69, 0x70, 0x74, 0x2c, 0x20, 0x61, 0x6e,
+0x64, 0x20, 0x74, 0x68, 0x65, 0x20, 0x6e, 0x6f,
+0x72, 0x6d, 0x61, 0x6c, 0x20, 0x73, 0x69, 0x67,
+0x6e, 0x61, 0x74, 0x75, 0x72, 0x65, 0x20, 0x77,
+0x6f, 0x75, 0x6c, 0x64, 0x20, 0x66, 0x61, 0x69,
+0x6c, 0x2e, 0x22, 0x5d, 0x2c, 0x0a, 0x0a, 0x5b,
+0x22, 0x48, 0x65, 0x72, 0x65, 0x27, 0x73, 0x20,
+0x61, 0x6e, 0x20, 0x65, 0x78, 0x61, 0x6d, 0x70,
+0x6c, 0x65, 0x20, 0x6f, 0x6e, 0x20, 0x6d, 0x61,
+0x69, 0x6e, 0x6e, 0x65, 0x74, 0x20, 0x77, 0x69,
+0x74, 0x68, 0x69, 0x6e, 0x20, 0x61, 0x20, 0x50,
+0x32, 0x53, 0x48, 0x20, 0x72, 0x65, 0x64, 0x65,
+0x65, 0x6d, 0x53, 0x63, 0x72, 0x69, 0x70, 0x74,
+0x2e, 0x20, 0x52, 0x65, 0x6d, 0x61, 0x72, 0x6b,
+0x61, 0x62, 0x6c, 0x79, 0x20, 0x69, 0x74, 0x27,
+0x73, 0x20, 0x61, 0x20, 0x73, 0x74, 0x61, 0x6e,
+0x64, 0x61, 0x72, 0x64, 0x20, 0x74, 0x72, 0x61,
+0x6e, 0x73, 0x61, 0x63, 0x74, 0x69, 0x6f, 0x6e,
+0x20, 0x69, 0x6e, 0x20, 0x3c, 0x30, 0x2e, 0x39,
+0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b, 0x5b, 0x22,
+0x62, 0x35, 0x62, 0x35, 0x39, 0x38, 0x64, 0x65,
+0x39, 0x31, 0x37, 0x38, 0x37, 0x34, 0x33, 0x39,
+0x61, 0x66, 0x64, 0x35, 0x39, 0x33, 0x38, 0x31,
+0x31, 0x36, 0x36, 0x35, 0x34, 0x65, 0x30, 0x62,
+0x31, 0x36, 0x62, 0x37, 0x61, 0x30, 0x64, 0x30,
+0x66, 0x38, 0x32, 0x37, 0x34, 0x32, 0x62, 0x61,
+0x33, 0x37, 0x35, 0x36, 0x34, 0x32, 0x31, 0x39,
+0x63, 0x35, 0x61, 0x66, 0x63, 0x62, 0x66, 0x39,
+0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20, 0x22, 0x44,
+0x55, 0x50, 0x20, 0x48, 0x41, 0x53, 0x48, 0x31,
+0x36, 0x30, 0x20, 0x30, 0x78, 0x31, 0x34, 0x20,
+0x30, 0x78, 0x66, 0x36, 0x66, 0x33, 0x36, 0x35,
+0x63, 0x34, 0x30, 0x66, 0x30, 0x37, 0x33, 0x39,
+0x62, 0x36, 0x31, 0x64, 0x65, 0x38, 0x32, 0x37,
+0x61, 0x34, 0x34, 0x37, 0x35, 0x31, 0x65, 0x35,
+0x65, 0x39, 0x39, 0x30, 0x33, 0x32, 0x65, 0x64,
+0x38, 0x66, 0x20, 0x45, 0x51, 0x55, 0x41, 0x4c,
+0x56, 0x45, 0x52, 0x49, 0x46, 0x59, 0x20, 0x43,
+0x48, 0x45, 0x43, 0x4b, 0x53, 0x49, 0x47, 0x22,
+0x5d, 0x2c, 0x0a, 0x20, 0x20, 0x5b, 0x22, 0x61,
+0x62, 0x39, 0x38, 0x30, 0x35, 0x63, 0x36, 0x64,
+0x35, 0x37, 0x64, 0x37, 0x30, 0x37, 0x30, 0x64,
+0x39, 0x61, 0x34, 0x32, 0x63, 0x35, 0x31, 0x37,
+0x36, 0x65, 0x34, 0x37, 0x62, 0x62, 0x37, 0x30,
+0x35, 0x30, 0x32, 0x33, 0x65, 0x36, 0x62, 0x36,
+0x37, 0x32, 0x34, 0x39, 0x66, 0x62, 0x36, 0x37,
+0x36, 0x30, 0x38, 0x38, 0x30, 0x35, 0x34, 0x38,
+0x32, 0x39, 0x38, 0x65, 0x37, 0x34, 0x32, 0x22,
+0x2c, 0x20, 0x30, 0x2c, 0x20, 0x22, 0x48, 0x41,
+0x53, 0x48, 0x31, 0x36, 0x30, 0x20, 0x30, 0x78,
+0x31, 0x34, 0x20, 0x30, 0x78, 0x64, 0x38, 0x64,
+0x61, 0x63, 0x64, 0x61, 0x64, 0x62, 0x37, 0x34,
+0x36, 0x32, 0x61, 0x65, 0x31, 0x35, 0x63, 0x64,
+0x39, 0x30, 0x36, 0x66, 0x31, 0x38, 0x37, 0x38,
+0x37, 0x30, 0x36, 0x64, 0x30, 0x64, 0x61, 0x38,
+0x36, 0x36, 0x30, 0x65, 0x36, 0x20, 0x45, 0x51,
+0x55, 0x41, 0x4c, 0x22, 0x5d, 0x5d, 0x2c, 0x0a,
+0x22, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x32, 0x66, 0x39, 0x63, 0x62, 0x61,
+0x66, 0x63, 0x35, 0x31, 0x39, 0x34, 0x32, 0x35,
+0x36, 0x33, 0x37, 0x62, 0x61, 0x34, 0x32, 0x32,
+0x37, 0x66, 0x38, 0x64, 0x30, 0x61, 0x30, 0x62,
+0x37, 0x31, 0x36, 0x30, 0x62, 0x34, 0x65, 0x36,
+0x35, 0x31, 0x36, 0x38, 0x31, 0x39, 0x33, 0x64,
+0x35, 0x61, 0x66, 0x33, 0x39, 0x37, 0x34, 0x37,
+0x38, 0x39, 0x31, 0x64, 0x65, 0x39, 0x38, 0x62,
+0x35, 0x62, 0x35, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x36, 0x62, 0x34, 0x38, 0x33,
+0x30, 0x34, 0x35, 0x30, 0x32, 0x32, 0x31, 0x30,
+0x30, 0x38, 0x64, 0x64, 0x36, 0x31, 0x39, 0x63,
+0x35, 0x36, 0x33, 0x65, 0x35, 0x32, 0x37, 0x63,
+0x34, 0x37, 0x64, 0x39, 0x62, 0x64, 0x35, 0x33,
+0x35, 0x33, 0x34, 0x61, 0x37, 0x37, 0x30, 0x62,
+0x31, 0x30, 0x32, 0x65, 0x34, 0x30, 0x66, 0x61,
+0x61, 0x38, 0x37, 0x66, 0x36, 0x31, 0x34, 0x33,
+0x33, 0x35, 0x38, 0x30, 0x65, 0x30, 0x34, 0x65,
+0x32, 0x37, 0x31, 0x65, 0x66, 0x32, 0x66, 0x39,
+0x36, 0x30, 0x32, 0x32, 0x30, 0x30, 0x32, 0x39,
+0x38, 0x38, 0x36, 0x34, 0x33, 0x34, 0x65, 0x31,
+0x38, 0x31, 0x32, 0x32, 0x62, 0x35, 0x33, 0x64,
+0x35, 0x64, 0x65, 0x63, 0x64, 0x32, 0x35, 0x66,
+0x31, 0x66, 0x34, 0x61, 0x63, 0x62, 0x32, 0x34,
+0x38, 0x30, 0x36, 0x35, 0x39, 0x66, 0x65, 0x61,
+0x32, 0x30, 0x61, 0x61, 0x62, 0x64, 0x38, 0x35,
+0x36, 0x39, 0x38, 0x37, 0x62, 0x61, 0x33, 0x63,
+0x33, 0x39, 0x30, 0x37, 0x65, 0x30, 0x31, 0x32,
+0x31, 0x30, 0x32, 0x32, 0x62, 0x37, 0x38, 0x62,
+0x37, 0x35, 0x36, 0x65, 0x32, 0x32, 0x35, 0x38,
+0x61, 0x66, 0x31, 0x33, 0x37, 0x37, 0x39, 0x63,
+0x31, 0x61, 0x31, 0x66, 0x33, 0x37, 0x65, 0x61,
+0x36, 0x38, 0x30, 0x30, 0x32, 0x35, 0x39, 0x37,
+0x31, 0x36, 0x63, 0x61, 0x34, 0x62, 0x37, 0x66,
+0x30, 0x62, 0x38, 0x37, 0x36, 0x31, 0x30, 0x65,
+0x30, 0x62, 0x66, 0x33, 0x61, 0x62, 0x35, 0x32,
+0x61, 0x30, 0x31, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x34, 0x32, 0x65, 0x37, 0x39,
+0x38, 0x38, 0x32, 0x35, 0x34, 0x38, 0x30, 0x30,
+0x38, 0x37, 0x36, 0x62, 0x36, 0x39, 0x66, 0x32,
+0x34, 0x36, 0x37, 0x36, 0x62, 0x33, 0x65, 0x30,
+0x32, 0x30, 0x35, 0x62, 0x37, 0x37, 0x62, 0x65,
+0x34, 0x37, 0x36, 0x35, 0x31, 0x32, 0x63, 0x61,
+0x34, 0x64, 0x39, 0x37, 0x30, 0x37, 0x30, 0x37,
+0x64, 0x64, 0x35, 0x63, 0x36, 0x30, 0x35, 0x39,
+0x38, 0x61, 0x62, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x66, 0x64, 0x32, 0x36, 0x30,
+0x31, 0x30, 0x30, 0x34, 0x38, 0x33, 0x30, 0x34,
+0x35, 0x30, 0x32, 0x32, 0x30, 0x31, 0x35, 0x62,
+0x64, 0x30, 0x31, 0x33, 0x39, 0x62, 0x63, 0x63,
+0x63, 0x66, 0x39, 0x39, 0x30, 0x61, 0x36, 0x61,
+0x66, 0x36, 0x65, 0x63, 0x35, 0x63, 0x31, 0x63,
+0x35, 0x32, 0x65, 0x64, 0x38, 0x32, 0x32, 0x32,
+0x65, 0x30, 0x33, 0x61, 0x30, 0x64, 0x35, 0x31,
+0x63, 0x33, 0x33, 0x34, 0x64, 0x66, 0x31, 0x33,
+0x39, 0x39, 0x36, 0x38, 0x35, 0x32, 0x35, 0x64,
+0x32, 0x66, 0x63, 0x64, 0x32, 0x30, 0x32, 0x32,
+0x31, 0x30, 0x30, 0x39, 0x66, 0x39, 0x65, 0x66,
+0x65, 0x33, 0x32, 0x35, 0x34, 0x37, 0x36, 0x65,
+0x62, 0x36, 0x34, 0x63, 0x33, 0x39, 0x35, 0x38,
+0x65, 0x34, 0x37, 0x31, 0x33, 0x65, 0x39, 0x65,
+0x65, 0x66, 0x65, 0x34, 0x39, 0x62, 0x66, 0x31,
+0x64, 0x38, 0x32, 0x30, 0x65, 0x64, 0x35, 0x38,
+0x64, 0x32, 0x31, 0x31, 0x32, 0x37, 0x32, 0x31,
+0x62, 0x31, 0x33, 0x34, 0x65, 0x32, 0x61, 0x31,
+0x61, 0x35, 0x33, 0x30, 0x33, 0x34, 0x39, 0x33,
+0x30, 0x34, 0x36, 0x30, 0x32, 0x32, 0x31, 0x30,
+0x30, 0x38, 0x34, 0x33, 0x31, 0x62, 0x64, 0x66,
+0x61, 0x37, 0x32, 0x62, 0x63, 0x36, 0x37, 0x66,
+0x39, 0x64, 0x34, 0x31, 0x66, 0x65, 0x37, 0x32,
+0x65, 0x39, 0x34, 0x63, 0x38, 0x38, 0x66, 0x62,
+0x38, 0x66, 0x33, 0x35, 0x39, 0x66, 0x66, 0x61,
+0x33, 0x30, 0x62, 0x33, 0x33, 0x63, 0x37, 0x32,
+0x63, 0x31, 0x32, 0x31, 0x63, 0x35, 0x61, 0x38,
+0x37, 0x37, 0x64, 0x39, 0x32, 0x32, 0x65, 0x31,
+0x30, 0x30, 0x32, 0x32, 0x31, 0x30, 0x30, 0x38,
+0x39, 0x65, 0x66, 0x35, 0x66, 0x63, 0x32, 0x32,
+0x64, 0x64, 0x38, 0x62, 0x66, 0x63, 0x36, 0x62,
+0x66, 0x39, 0x66, 0x66, 0x64, 0x62, 0x30, 0x31,
+0x61, 0x39, 0x38, 0x36, 0x32, 0x64, 0x32, 0x37,
+0x36, 0x38, 0x37, 0x64, 0x34, 0x32, 0x34, 0x64,
+0x31, 0x66, 0x65, 0x66, 0x62, 0x61, 0x62, 0x39,
+0x65, 0x39, 0x63, 0x37, 0x31, 0x37, 0x36, 0x38,
+0x34, 0x34, 0x61, 0x31, 0x38, 0x37, 0x61, 0x30,
+0x31, 0x34, 0x63, 0x39, 0x30, 0x35, 0x32, 0x34,
+0x38, 0x33, 0x30, 0x34, 0x35, 0x30, 0x32, 0x32,
+0x30, 0x31, 0x35, 0x62, 0x64, 0x30, 0x31, 0x33,
+0x39, 0x62, 0x63, 0x63, 0x63, 0x66, 0x39, 0x39,
+0x30, 0x61, 0x36, 0x61, 0x66, 0x36, 0x65, 0x63,
+0x35, 0x63, 0x31, 0x63, 0x35, 0x32, 0x65, 0x64,
+0x38, 0x32, 0x32, 0x32, 0x65, 0x30, 0x33, 0x61,
+0x30, 0x64, 0x35, 0x31, 0x63, 0x33, 0x33, 0x34,
+0x64, 0x66, 0x31, 0x33, 0x39, 0x39, 0x36, 0x38,
+0x35, 0x32, 0x35, 0x64, 0x32, 0x66, 0x63, 0x64,
+0x32, 0x30, 0x32, 0x32, 0x31, 0x30, 0x30, 0x39,
+0x66, 0x39, 0x65, 0x66, 0x65, 0x33, 0x32, 0x35,
+0x34, 0x37, 0x36, 0x65, 0x62, 0x36, 0x34, 0x63,
+0x33, 0x39, 0x35, 0x38, 0x65, 0x34, 0x37, 0x31,
+0x33, 0x65, 0x39, 0x65, 0x65, 0x66, 0x65, 0x34,
+0x39, 0x62, 0x66, 0x31, 0x64, 0x38, 0x32, 0x30,
+0x65, 0x64, 0x35, 0x38, 0x64, 0x32, 0x31, 0x31,
+0x32, 0x37, 0x32, 0x31, 0x62, 0x31, 0x33, 0x34,
+0x65, 0x32, 0x61, 0x31, 0x61, 0x35, 0x33, 0x30,
+0x33, 0x32, 0x31, 0x30, 0x33, 0x37, 0x38, 0x64,
+0x34, 0x33, 0x30, 0x32, 0x37, 0x34, 0x66, 0x38,
+0x63, 0x35, 0x65, 0x63, 0x31, 0x33, 0x32, 0x31,
+0x33, 0x33, 0x38, 0x31, 0x35, 0x31, 0x65, 0x39,
+0x66, 0x32, 0x37, 0x66, 0x34, 0x63, 0x36, 0x37,
+0x36, 0x61, 0x30, 0x30, 0x38, 0x62, 0x64, 0x66,
+0x38, 0x36, 0x33, 0x38, 0x64, 0x30, 0x37, 0x63,
+0x30, 0x62, 0x36, 0x62, 0x65, 0x39, 0x61, 0x62,
+0x33, 0x35, 0x63, 0x37, 0x31, 0x32, 0x31, 0x30,
+0x33, 0x37, 0x38, 0x64, 0x34, 0x33, 0x30, 0x32,
+0x37, 0x34, 0x66, 0x38, 0x63, 0x35, 0x65, 0x63,
+0x31, 0x33, 0x32, 0x31, 0x33, 0x33, 0x38, 0x31,
+0x35, 0x31, 0x65, 0x39, 0x66, 0x32, 0x37, 0x66,
+0x34, 0x63, 0x36, 0x37, 0x36, 0x61, 0x30, 0x30,
+0x38, 0x62, 0x64, 0x66, 0x38, 0x36, 0x33, 0x38,
+0x64, 0x30, 0x37, 0x63, 0x30, 0x62, 0x36, 0x62,
+0x65, 0x39, 0x61, 0x62, 0x33, 0x35, 0x63, 0x37,
+0x31, 0x35, 0x33, 0x61, 0x65, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x30, 0x31, 0x61,
+0x30, 0x38, 0x36, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x37, 0x61, 0x39, 0x31, 0x34, 0x64, 0x38, 0x64,
+0x61, 0x63, 0x64, 0x61, 0x64, 0x62, 0x37, 0x34,
+0x36, 0x32, 0x61, 0x65, 0x31, 0x35, 0x63, 0x64,
+0x39, 0x30, 0x36, 0x66, 0x31, 0x38, 0x37, 0x38,
+0x37, 0x30, 0x36, 0x64, 0x30, 0x64, 0x61, 0x38,
+0x36, 0x36, 0x30, 0x65, 0x36, 0x38, 0x37, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x22,
+0x2c, 0x20, 0x22, 0x50, 0x32, 0x53, 0x48, 0x22,
+0x5d, 0x2c, 0x0a, 0x0a, 0x5b, 0x22, 0x53, 0x61,
+0x6d, 0x65, 0x20, 0x69, 0x64, 0x65, 0x61, 0x2c,
+0x20, 0x62, 0x75, 0x74, 0x20, 0x77, 0x69, 0x74,
+0x68, 0x20, 0x62, 0x61, 0x72, 0x65, 0x20, 0x43,
+0x48, 0x45, 0x43, 0x4b, 0x4d, 0x55, 0x4c, 0x54,
+0x49, 0x53, 0x49, 0x47, 0x22, 0x5d, 0x2c, 0x0a,
+0x5b, 0x5b, 0x5b, 0x22, 0x63, 0x65, 0x61, 0x66,
+0x65, 0x35, 0x38, 0x65, 0x30, 0x66, 0x36, 0x65,
+0x37, 0x64, 0x36, 0x37, 0x63, 0x30, 0x34, 0x30,
+0x39, 0x66, 0x62, 0x62, 0x66, 0x36, 0x37, 0x33,
+0x63, 0x38, 0x34, 0x63, 0x31, 0x36, 0x36, 0x65,
+0x33, 0x63, 0x35, 0x64, 0x33, 0x63, 0x32, 0x34,
+0x61, 0x66, 0x35, 0x38, 0x66, 0x37, 0x31, 0x37,
+0x35, 0x62, 0x31, 0x38, 0x64, 0x66, 0x33, 0x62,
+0x62, 0x33, 0x64, 0x62, 0x22, 0x2c, 0x20, 0x30,
+0x2c, 0x20, 0x22, 0x44, 0x55, 0x50, 0x20, 0x48,
+0x41, 0x53, 0x48, 0x31, 0x36, 0x30, 0x20, 0x30,
+0x78, 0x31, 0x34, 0x20, 0x30, 0x78, 0x66, 0x36,
+0x66, 0x33, 0x36, 0x35, 0x63, 0x34, 0x30, 0x66,
+0x30, 0x37, 0x33, 0x39, 0x62, 0x36, 0x31, 0x64,
+0x65, 0x38, 0x32, 0x37, 0x61, 0x34, 0x34, 0x37,
+0x35, 0x31, 0x65, 0x35, 0x65, 0x39, 0x39, 0x30,
+0x33, 0x32, 0x65, 0x64, 0x38, 0x66, 0x20, 0x45,
+0x51, 0x55, 0x41, 0x4c, 0x56, 0x45, 0x52, 0x49,
+0x46, 0x59, 0x20, 0x43, 0x48, 0x45, 0x43, 0x4b,
+0x53, 0x49, 0x47, 0x22, 0x5d, 0x2c, 0x0a, 0x20,
+0x20, 0x5b, 0x22, 0x63, 0x65, 0x61, 0x66, 0x65,
+0x35, 0x38, 0x65, 0x30, 0x66, 0x36, 0x65, 0x37,
+0x64, 0x36, 0x37, 0x63, 0x30, 0x34, 0x30, 0x39,
+0x66, 0x62, 0x62, 0x66, 0x36, 0x37, 0x33, 0x63,
+0x38, 0x34, 0x63, 0x31, 0x36, 0x36, 0x65, 0x33,
+0x63, 0x35, 0x64, 0x33, 0x63, 0x32, 0x34, 0x61,
+0x66, 0x35, 0x38, 0x66, 0x37, 0x31, 0x37, 0x35,
+0x62, 0x31, 0x38, 0x64, 0x66, 0x33, 0x62, 0x62,
+0x33, 0x64, 0x62, 0x22, 0x2c, 0x20, 0x31, 0x2c,
+0x20, 0x22, 0x32, 0x20, 0x30, 0x78, 0x34, 0x38,
+0x20, 0x30, 0x78, 0x33, 0x30, 0x34, 0x35, 0x30,
+0x32, 0x32, 0x30, 0x31, 0x35, 0x62, 0x64, 0x30,
+0x31, 0x33, 0x39, 0x62, 0x63, 0x63, 0x63, 0x66,
+0x39, 0x39, 0x30, 0x61, 0x36, 0x61, 0x66, 0x36,
+0x65, 0x63, 0x35, 0x63, 0x31, 0x63, 0x35, 0x32,
+0x65, 0x64, 0x38, 0x32, 0x32, 0x32, 0x65, 0x30,
+0x33, 0x61, 0x30, 0x64, 0x35, 0x31, 0x63, 0x33,
+0x33, 0x34, 0x64, 0x66, 0x31, 0x33, 0x39, 0x39,
+0x36, 0x38, 0x35, 0x32, 0x35, 0x64, 0x32, 0x66,
+0x63, 0x64, 0x32, 0x30, 0x32, 0x32, 0x31, 0x30,
+0x30, 0x39, 0x66, 0x39, 0x65, 0x66, 0x65, 0x33,
+0x32, 0x35, 0x34, 0x37, 0x36, 0x65, 0x62, 0x36,
+0x34, 0x63, 0x33, 0x39, 0x35, 0x38, 0x65, 0x34,
+0x37, 0x31, 0x33, 0x65, 0x39, 0x65, 0x65, 0x66,
+0x65, 0x34, 0x39, 0x62, 0x66, 0x31, 0x64, 0x38,
+0x32, 0x30, 0x65, 0x64, 0x35, 0x38, 0x64, 0x32,
+0x31, 0x31, 0x32, 0x37, 0x32, 0x31, 0x62, 0x31,
+0x33, 0x34, 0x65, 0x32, 0x61, 0x31, 0x61, 0x35,
+0x33, 0x30, 0x33, 0x20, 0x30, 0x78, 0x32, 0x31,
+0x20, 0x30, 0x78, 0x30, 0x33, 0x37, 0x38, 0x64,
+0x34, 0x33, 0x30, 0x32, 0x37, 0x34, 0x66, 0x38,
+0x63, 0x35, 0x65, 0x63, 0x31, 0x33, 0x32, 0x31,
+0x33, 0x33, 0x38, 0x31, 0x35, 0x31, 0x65, 0x39,
+0x66, 0x32, 0x37, 0x66, 0x34, 0x63, 0x36, 0x37,
+0x36, 0x61, 0x30, 0x30, 0x38, 0x62, 0x64, 0x66,
+0x38, 0x36, 0x33, 0x38, 0x64, 0x30, 0x37, 0x63,
+0x30, 0x62, 0x36, 0x62, 0x65, 0x39, 0x61, 0x62,
+0x33, 0x35, 0x63, 0x37, 0x31, 0x20, 0x30, 0x78,
+0x32, 0x31, 0x20, 0x30, 0x78, 0x30, 0x33, 0x37,
+0x38, 0x64, 0x34, 0x33, 0x30, 0x32, 0x37, 0x34,
+0x66, 0x38, 0x63, 0x35, 0x65, 0x63, 0x31, 0x33,
+0x32, 0x31, 0x33, 0x33, 0x38, 0x31, 0x35, 0x31,
+0x65, 0x39, 0x66, 0x32, 0x37, 0x66, 0x34, 0x63,
+0x36, 0x37, 0x36, 0x61, 0x30, 0x30, 0x38, 0x62,
+0x64, 0x66, 0x38, 0x36, 0x33, 0x38, 0x64, 0x30,
+0x37, 0x63, 0x30, 0x62, 0x36, 0x62, 0x65, 0x39,
+0x61, 0x62, 0x33, 0x35, 0x63, 0x37, 0x31, 0x20,
+0x33, 0x20, 0x43, 0x48, 0x45, 0x43, 0x4b, 0x4d,
+0x55, 0x4c, 0x54, 0x49, 0x53, 0x49, 0x47, 0x22,
+0x5d, 0x5d, 0x2c, 0x0a, 0x22, 0x30, 0x31, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x32, 0x64,
+0x62, 0x62, 0x33, 0x33, 0x62, 0x64, 0x66, 0x31,
+0x38, 0x35, 0x62, 0x31, 0x37, 0x66, 0x37, 0x35,
+0x38, 0x61, 0x66, 0x32, 0x34, 0x33, 0x63, 0x35,
+0x64, 0x33, 0x63, 0x36, 0x65, 0x31, 0x36, 0x34,
+0x63, 0x63, 0x38, 0x37, 0x33, 0x66, 0x36, 0x62,
+0x62, 0x39, 0x66, 0x34, 0x30, 0x63, 0x30, 0x36,
+0x37, 0x37, 0x64, 0x36, 0x65, 0x30, 0x66, 0x38,
+0x65, 0x65, 0x35, 0x61, 0x66, 0x63, 0x65, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x36,
+0x62, 0x34, 0x38, 0x33, 0x30, 0x34, 0x35, 0x30,
+0x32, 0x32, 0x31, 0x30, 0x30, 0x39, 0x36, 0x32,
+0x37, 0x34, 0x34, 0x34, 0x33, 0x32, 0x30, 0x64,
+0x63, 0x35, 0x65, 0x66, 0x38, 0x64, 0x37, 0x66,
+0x36, 0x38, 0x66, 0x33, 0x35, 0x30, 0x31, 0x30,
+0x62, 0x34, 0x63, 0x30, 0x35, 0x30, 0x61, 0x36,
+0x65, 0x64, 0x30, 0x64, 0x39, 0x36, 0x62, 0x36,
+0x37, 0x61, 0x38, 0x34, 0x64, 0x62, 0x39, 0x39,
+0x66, 0x64, 0x61, 0x39, 0x63, 0x39, 0x64, 0x65,
+0x35, 0x38, 0x62, 0x31, 0x65, 0x30, 0x32, 0x32,
+0x30, 0x33, 0x65, 0x34, 0x62, 0x34, 0x61, 0x61,
+0x61, 0x30, 0x31, 0x39, 0x65, 0x30, 0x31, 0x32,
+0x65, 0x36, 0x35, 0x64, 0x36, 0x39, 0x62, 0x34,
+0x38, 0x37, 0x66, 0x64, 0x66, 0x38, 0x37, 0x31,
+0x39, 0x64, 0x66, 0x37, 0x32, 0x66, 0x34, 0x38,
+0x38, 0x66, 0x61, 0x39, 0x31, 0x35, 0x30, 0x36,
+0x61, 0x38, 0x30, 0x63, 0x34, 0x39, 0x61, 0x33,
+0x33, 0x39, 0x32, 0x39, 0x66, 0x31, 0x66, 0x64,
+0x35, 0x30, 0x31, 0x32, 0x31, 0x30, 0x32, 0x32,
+0x62, 0x37, 0x38, 0x62, 0x37, 0x35, 0x36, 0x65,
+0x32, 0x32, 0x35, 0x38, 0x61, 0x66, 0x31, 0x33,
+0x37, 0x37, 0x39, 0x63, 0x31, 0x61, 0x31, 0x66,
+0x33, 0x37, 0x65, 0x61, 0x36, 0x38, 0x30, 0x30,
+0x32, 0x35, 0x39, 0x37, 0x31, 0x36, 0x63, 0x61,
+0x34, 0x62, 0x37, 0x66, 0x30, 0x62, 0x38, 0x37,
+0x36, 0x31, 0x30, 0x65, 0x30, 0x62, 0x66, 0x33,
+0x61, 0x62, 0x35, 0x32, 0x61, 0x30, 0x31, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x64,
+0x62, 0x62, 0x33, 0x33, 0x62, 0x64, 0x66, 0x31,
+0x38, 0x35, 0x62, 0x31, 0x37, 0x66, 0x37, 0x35,
+0x38, 0x61, 0x66, 0x32, 0x34, 0x33, 0x63, 0x35,
+0x64, 0x33, 0x63, 0x36, 0x65, 0x31, 0x36, 0x34,
+0x63, 0x63, 0x38, 0x37, 0x33, 0x66, 0x36, 0x62,
+0x62, 0x39, 0x66, 0x34, 0x30, 0x63, 0x30, 0x36,
+0x37, 0x37, 0x64, 0x36, 0x65, 0x30, 0x66, 0x38,
+0x65, 0x65, 0x35, 0x61, 0x66, 0x63, 0x65, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x39,
+0x33, 0x30, 0x30, 0x34, 0x38, 0x33, 0x30, 0x34,
+0x35, 0x30, 0x32, 0x32, 0x30, 0x31, 0x35, 0x62,
+0x64, 0x30, 0x31, 0x33, 0x39, 0x62, 0x63, 0x63,
+0x63, 0x66, 0x39, 0x39, 0x30, 0x61, 0x36, 0x61,
+0x66, 0x36, 0x65, 0x63, 0x35, 0x63, 0x31, 0x63,
+0x35, 0x32, 0x65, 0x64, 0x38, 0x32, 0x32, 0x32,
+0x65, 0x30, 0x33, 0x61, 0x30, 0x64, 0x35, 0x31,
+0x63, 0x33, 0x33, 0x34, 0x64, 0x66, 0x31, 0x33,
+0x39, 0x39, 0x36, 0x38, 0x35, 0x32, 0x35, 0x64,
+0x32, 0x66, 0x63, 0x64, 0x32, 0x30, 0x32, 0x32,
+0x31, 0x30, 0x30, 0x39, 0x66, 0x39, 0x65, 0x66,
+0x65, 0x33, 0x32, 0x35, 0x34, 0x37, 0x36, 0x65,
+0x62, 0x36, 0x34, 0x63, 0x33, 0x39, 0x35, 0x38,
+0x65, 0x34, 0x37, 0x31, 0x33, 0x65, 0x39, 0x65,
+0x65, 0x66, 0x65, 0x34, 0x39, 0x62, 0x66, 0x31,
+0x64, 0x38, 0x32, 0x30, 0x65, 0x64, 0x35, 0x38,
+0x64, 0x32, 0x31, 0x31, 0x32, 0x37, 0x32, 0x31,
+0x62, 0x31, 0x33, 0x34, 0x65, 0x32, 0x61, 0x31,
+0x61, 0x35, 0x33, 0x30, 0x33, 0x34, 0x38, 0x33,
+0x30, 0x34, 0x35, 0x30, 0x32, 0x32, 0x30, 0x31,
+0x35, 0x62, 0x64, 0x30, 0x31, 0x33, 0x39, 0x62,
+0x63, 0x63, 0x63, 0x66, 0x39, 0x39, 0x30, 0x61,
+0x36, 0x61, 0x66, 0x36, 0x65, 0x63, 0x35, 0x63,
+0x31, 0x63, 0x35, 0x32, 0x65, 0x64, 0x38, 0x32,
+0x32, 0x32, 0x65, 0x30, 0x33, 0x61, 0x30, 0x64,
+0x35, 0x31, 0x63, 0x33, 0x33, 0x34, 0x64, 0x66,
+0x31, 0x33, 0x39, 0x39, 0x36, 0x38, 0x35, 0x32,
+0x35, 0x64, 0x32, 0x66, 0x63, 0x64, 0x32, 0x30,
+0x32, 0x32, 0x31, 0x30, 0x30, 0x39, 0x66, 0x39,
+0x65, 0x66, 0x65, 0x33, 0x32, 0x35, 0x34, 0x37,
+0x36, 0x65, 0x62, 0x36, 0x34, 0x63, 0x33, 0x39,
+0x35, 0x38, 0x65, 0x34, 0x37, 0x31, 0x33, 0x65,
+0x39, 0x65, 0x65, 0x66, 0x65, 0x34, 0x39, 0x62,
+0x66, 0x31, 0x64, 0x38, 0x32, 0x30, 0x65, 0x64,
+0x35, 0x38, 0x64, 0x32, 0x31, 0x31, 0x32, 0x37,
+0x32, 0x31, 0x62, 0x31, 0x33, 0x34, 0x65, 0x32,
+0x61, 0x31, 0x61, 0x35, 0x33, 0x30, 0x33, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x30,
+0x31, 0x61, 0x30, 0x38, 0x36, 0x30, 0x31, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x39, 0x37, 0x36, 0x61, 0x39, 0x31,
+0x34, 0x39, 0x62, 0x63, 0x30, 0x62, 0x62, 0x64,
+0x64, 0x33, 0x30, 0x32, 0x34, 0x64, 0x61, 0x34,
+0x64, 0x30, 0x63, 0x33, 0x38, 0x65, 0x64, 0x31,
+0x61, 0x65, 0x63, 0x66, 0x35, 0x63, 0x36, 0x38,
+0x64, 0x64, 0x31, 0x64, 0x33, 0x66, 0x61, 0x31,
+0x32, 0x38, 0x38, 0x61, 0x63, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x22, 0x2c, 0x20,
+0x22, 0x50, 0x32, 0x53, 0x48, 0x22, 0x5d, 0x2c,
+0x0a, 0x0a, 0x0a, 0x5b, 0x22, 0x43, 0x48, 0x45,
+0x43, 0x4b, 0x4c, 0x4f, 0x43, 0x4b, 0x54, 0x49,
+0x4d, 0x45, 0x56, 0x45, 0x52, 0x49, 0x46, 0x59,
+0x20, 0x74, 0x65, 0x73, 0x74, 0x73, 0x22, 0x5d,
+0x2c, 0x0a, 0x0a, 0x5b, 0x22, 0x42, 0x79, 0x2d,
+0x68, 0x65, 0x69, 0x67, 0x68, 0x74, 0x20, 0x6c,
+0x6f, 0x63, 0x6b, 0x73, 0x2c, 0x20, 0x77, 0x69,
+0x74, 0x68, 0x20, 0x61, 0x72, 0x67, 0x75, 0x6d,
+0x65, 0x6e, 0x74, 0x20, 0x3d, 0x3d, 0x20, 0x30,
+0x20, 0x61, 0x6e, 0x64, 0x20, 0x3d, 0x3d, 0x20,
+0x74, 0x78, 0x20, 0x6e, 0x4c, 0x6f, 0x63, 0x6b,
+0x54, 0x69, 0x6d, 0x65, 0x22, 0x5d, 0x2c, 0x0a,
+0x5b, 0x5b, 0x5b, 0x22, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x30,
+0x2c, 0x20, 0x22, 0x30, 0x20, 0x43, 0x48, 0x45,
+0x43, 0x4b, 0x4c, 0x4f, 0x43, 0x4b, 0x54, 0x49,
+0x4d, 0x45, 0x56, 0x45, 0x52, 0x49, 0x46, 0x59,
+0x20, 0x31, 0x22, 0x5d, 0x5d, 0x2c, 0x0a, 0x22,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x22, 0x2c, 0x20, 0x22, 0x50, 0x32, 0x53, 0x48,
+0x2c, 0x43, 0x48, 0x45, 0x43, 0x4b, 0x4c, 0x4f,
+0x43, 0x4b, 0x54, 0x49, 0x4d, 0x45, 0x56, 0x45,
+0x52, 0x49, 0x46, 0x59, 0x22, 0x5d, 0x2c, 0x0a,
+0x5b, 0x5b, 0x5b, 0x22, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x30,
+0x2c, 0x20, 0x22, 0x34, 0x39, 0x39, 0x39, 0x39,
+0x39, 0x39, 0x39, 0x39, 0x20, 0x43, 0x48, 0x45,
+0x43, 0x4b, 0x4c, 0x4f, 0x43, 0x4b, 0x54, 0x49,
+0x4d, 0x45, 0x56, 0x45, 0x52, 0x49, 0x46, 0x59,
+0x20, 0x31, 0x22, 0x5d, 0x5d, 0x2c, 0x0a, 0x22,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x66, 0x66, 0x36, 0x34, 0x63, 0x64, 0x31, 0x64,
+0x22, 0x2c, 0x20, 0x22, 0x50, 0x32, 0x53, 0x48,
+0x2c, 0x43, 0x48, 0x45, 0x43, 0x4b, 0x4c, 0x4f,
+0x43, 0x4b, 0x54, 0x49, 0x4d, 0x45, 0x56, 0x45,
+0x52, 0x49, 0x46, 0x59, 0x22, 0x5d, 0x2c, 0x0a,
+0x5b, 0x5b, 0x5b, 0x22, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x30,
+0x2c, 0x20, 0x22, 0x30, 0x20, 0x43, 0x48, 0x45,
+0x43, 0x4b, 0x4c, 0x4f, 0x43, 0x4b, 0x54, 0x49,
+0x4d, 0x45, 0x56, 0x45, 0x52, 0x49, 0x46, 0x59,
+0x20, 0x31, 0x22, 0x5d, 0x5d, 0x2c, 0x0a, 0x22,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x66, 0x66, 0x36, 0x34, 0x63, 0x64, 0x31, 0x64,
+0x22, 0x2c, 0x20, 0x22, 0x50, 0x32, 0x53, 0x48,
+0x2c, 0x43, 0x48, 0x45, 0x43, 0x4b, 0x4c, 0x4f,
+0x43, 0x4b, 0x54, 0x49, 0x4d, 0x45, 0x56, 0x45,
+0x52, 0x49, 0x46, 0x59, 0x22, 0x5d, 0x2c, 0x0a,
+0x0a, 0x5b, 0x22, 0x42, 0x79, 0x2d, 0x74, 0x69,
+0x6d, 0x65, 0x20, 0x6c, 0x6f, 0x63, 0x6b, 0x73,
+0x2c, 0x20, 0x77, 0x69, 0x74, 0x68, 0x20, 0x61,
+0x72, 0x67, 0x75, 0x6d, 0x65, 0x6e, 0x74, 0x20,
+0x6a, 0x75, 0x73, 0x74, 0x20, 0x62, 0x65, 0x79,
+0x6f, 0x6e, 0x64, 0x20, 0x74, 0x78, 0x20, 0x6e,
+0x4c, 0x6f, 0x63, 0x6b, 0x54, 0x69, 0x6d, 0x65,
+0x20, 0x28, 0x62, 0x75, 0x74, 0x20, 0x77, 0x69,
+0x74, 0x68, 0x69, 0x6e, 0x20, 0x6e, 0x75, 0x6d,
+0x65, 0x72, 0x69, 0x63, 0x61, 0x6c, 0x20, 0x62,
+0x6f, 0x75, 0x6e, 0x64, 0x61, 0x72, 0x69, 0x65,
+0x73, 0x29, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b,
+0x5b, 0x22, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20,
+0x22, 0x35, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x20, 0x43, 0x48, 0x45, 0x43, 0x4b,
+0x4c, 0x4f, 0x43, 0x4b, 0x54, 0x49, 0x4d, 0x45,
+0x56, 0x45, 0x52, 0x49, 0x46, 0x59, 0x20, 0x31,
+0x22, 0x5d, 0x5d, 0x2c, 0x0a, 0x22, 0x30, 0x31,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x36, 0x35, 0x63, 0x64, 0x31, 0x64, 0x22, 0x2c,
+0x20, 0x22, 0x50, 0x32, 0x53, 0x48, 0x2c, 0x43,
+0x48, 0x45, 0x43, 0x4b, 0x4c, 0x4f, 0x43, 0x4b,
+0x54, 0x49, 0x4d, 0x45, 0x56, 0x45, 0x52, 0x49,
+0x46, 0x59, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b,
+0x5b, 0x22, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20,
+0x22, 0x34, 0x32, 0x39, 0x34, 0x39, 0x36, 0x37,
+0x32, 0x39, 0x35, 0x20, 0x43, 0x48, 0x45, 0x43,
+0x4b, 0x4c, 0x4f, 0x43, 0x4b, 0x54, 0x49, 0x4d,
+0x45, 0x56, 0x45, 0x52, 0x49, 0x46, 0x59, 0x20,
+0x31, 0x22, 0x5d, 0x5d, 0x2c, 0x0a, 0x22, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x22,
+0x2c, 0x20, 0x22, 0x50, 0x32, 0x53, 0x48, 0x2c,
+0x43, 0x48, 0x45, 0x43, 0x4b, 0x4c, 0x4f, 0x43,
+0x4b, 0x54, 0x49, 0x4d, 0x45, 0x56, 0x45, 0x52,
+0x49, 0x46, 0x59, 0x22, 0x5d, 0x2c, 0x0a, 0x5b,
+0x5b, 0x5b, 0x22, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x30, 0x2c,
+0x20, 0x22, 0x35, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x20, 0x43, 0x48, 0x45, 0x43,
+0x4b, 0x4c, 0x4f, 0x43, 0x4b, 0x54, 0x49, 0x4d,
+0x45, 0x56, 0x45, 0x52, 0x49, 0x46, 0x59, 0x20,
+0x31, 0x22, 0x5d, 0x5d, 0x2c, 0x0a, 0x22, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x22,
+0x2c, 0x20, 0x22, 0x50, 0x32, 0x53, 0x48, 0x2c,
+0x43, 0x48, 0x45, 0x43, 0x4b, 0x4c, 0x4f, 0x43,
+0x4b, 0x54, 0x49, 0x4d, 0x45, 0x56, 0x45, 0x52,
+0x49, 0x46, 0x59, 0x22, 0x5d, 0x2c, 0x0a, 0x0a,
+0x5b, 0x22, 0x41, 0x6e, 0x79, 0x20, 0x6e, 0x6f,
+0x6e, 0x2d, 0x6d, 0x61, 0x78, 0x69, 0x6e, 0x74,
+0x20, 0x6e, 0x53, 0x65, 0x71, 0x75, 0x65, 0x6e,
+0x63, 0x65, 0x20, 0x69, 0x73, 0x20, 0x66, 0x69,
+0x6e, 0x65, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b,
+0x5b, 0x22, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20,
+0x22, 0x30, 0x20, 0x43, 0x48, 0x45, 0x43, 0x4b,
+0x4c, 0x4f, 0x43, 0x4b, 0x54, 0x49, 0x4d, 0x45,
+0x56, 0x45, 0x52, 0x49, 0x46, 0x59, 0x20, 0x31,
+0x22, 0x5d, 0x5d, 0x2c, 0x0a, 0x22, 0x30, 0x31,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x66, 0x65, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x22, 0x2c,
+0x20, 0x22, 0x50, 0x32, 0x53, 0x48, 0x2c, 0x43,
+0x48, 0x45, 0x43, 0x4b, 0x4c, 0x4f, 0x43, 0x4b,
+0x54, 0x49, 0x4d, 0x45, 0x56, 0x45, 0x52, 0x49,
+0x46, 0x59, 0x22, 0x5d, 0x2c, 0x0a, 0x0a, 0x5b,
+0x22, 0x54, 0x68, 0x65, 0x20, 0x61, 0x72, 0x67,
+0x75, 0x6d, 0x65, 0x6e, 0x74, 0x20, 0x63, 0x61,
+0x6e, 0x20, 0x62, 0x65, 0x20, 0x63, 0x61, 0x6c,
+0x63, 0x75, 0x6c, 0x61, 0x74, 0x65, 0x64, 0x20,
+0x72, 0x61, 0x74, 0x68, 0x65, 0x72, 0x20, 0x74,
+0x68, 0x61, 0x6e, 0x20, 0x63, 0x72, 0x65, 0x61,
+0x74, 0x65, 0x64, 0x20, 0x64, 0x69, 0x72, 0x65,
+0x63, 0x74, 0x6c, 0x79, 0x20, 0x62, 0x79, 0x20,
+0x61, 0x20, 0x50, 0x55, 0x53, 0x48, 0x44, 0x41,
+0x54, 0x41, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b,
+0x5b, 0x22, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20,
+0x22, 0x34, 0x39, 0x39, 0x39, 0x39, 0x39, 0x39,
+0x39, 0x39, 0x20, 0x31, 0x41, 0x44, 0x44, 0x20,
+0x43, 0x48, 0x45, 0x43, 0x4b, 0x4c, 0x4f, 0x43,
+0x4b, 0x54, 0x49, 0x4d, 0x45, 0x56, 0x45, 0x52,
+0x49, 0x46, 0x59, 0x20, 0x31, 0x22, 0x5d, 0x5d,
+0x2c, 0x0a, 0x22, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x36, 0x35, 0x63,
+0x64, 0x31, 0x64, 0x22, 0x2c, 0x20, 0x22, 0x50,
+0x32, 0x53, 0x48, 0x2c, 0x43, 0x48, 0x45, 0x43,
+0x4b, 0x4c, 0x4f, 0x43, 0x4b, 0x54, 0x49, 0x4d,
+0x45, 0x56, 0x45, 0x52, 0x49, 0x46, 0x59, 0x22,
+0x5d, 0x2c, 0x0a, 0x0a, 0x5b, 0x22, 0x50, 0x65,
+0x72, 0x68, 0x61, 0x70, 0x73, 0x20, 0x65, 0x76,
+0x65, 0x6e, 0x20, 0x62, 0x79, 0x20, 0x61, 0x6e,
+0x20, 0x41, 0x44, 0x44, 0x20, 0x70, 0x72, 0x6f,
+0x64, 0x75, 0x63, 0x69, 0x6e, 0x67, 0x20, 0x61,
+0x20, 0x35, 0x2d, 0x62, 0x79, 0x74, 0x65, 0x20,
+0x72, 0x65, 0x73, 0x75, 0x6c, 0x74, 0x20, 0x74,
+0x68, 0x61, 0x74, 0x20, 0x69, 0x73, 0x20, 0x6f,
+0x75, 0x74, 0x20, 0x6f, 0x66, 0x20, 0x62, 0x6f,
+0x75, 0x6e, 0x64, 0x73, 0x20, 0x66, 0x6f, 0x72,
+0x20, 0x6f, 0x74, 0x68, 0x65, 0x72, 0x20, 0x6f,
+0x70, 0x63, 0x6f, 0x64, 0x65, 0x73, 0x22, 0x5d,
+0x2c, 0x0a, 0x5b, 0x5b, 0x5b, 0x22, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x22, 0x2c,
+0x20, 0x30, 0x2c, 0x20, 0x22, 0x32, 0x31, 0x34,
+0x37, 0x34, 0x38, 0x33, 0x36, 0x34, 0x37, 0x20,
+0x32, 0x31, 0x34, 0x37, 0x34, 0x38, 0x33, 0x36,
+0x34, 0x37, 0x20, 0x41, 0x44, 0x44, 0x20, 0x43,
+0x48, 0x45, 0x43, 0x4b, 0x4c, 0x4f, 0x43, 0x4b,
+0x54, 0x49, 0x4d, 0x45, 0x56, 0x45, 0x52, 0x49,
+0x46, 0x59, 0x20, 0x31, 0x22, 0x5d, 0x5d, 0x2c,
+0x0a, 0x22, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x66, 0x65, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x22, 0x2c, 0x20, 0x22, 0x50, 0x32,
+0x53, 0x48, 0x2c, 0x43, 0x48, 0x45, 0x43, 0x4b,
+0x4c, 0x4f, 0x43, 0x4b, 0x54, 0x49, 0x4d, 0x45,
+0x56, 0x45, 0x52, 0x49, 0x46, 0x59, 0x22, 0x5d,
+0x2c, 0x0a, 0x0a, 0x5b, 0x22, 0x35, 0x20, 0x62,
+0x79, 0x74, 0x65, 0x20, 0x6e, 0x6f, 0x6e, 0x2d,
+0x6d, 0x69, 0x6e, 0x69, 0x6d, 0x61, 0x6c, 0x6c,
+0x79, 0x2d, 0x65, 0x6e, 0x63, 0x6f, 0x64, 0x65,
+0x64, 0x20, 0x61, 0x72, 0x67, 0x75, 0x6d, 0x65,
+0x6e, 0x74, 0x73, 0x20, 0x61, 0x72, 0x65, 0x20,
+0x76, 0x61, 0x6c, 0x69, 0x64, 0x22, 0x5d, 0x2c,
+0x0a, 0x5b, 0x5b, 0x5b, 0x22, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x31, 0x30, 0x30, 0x22, 0x2c, 0x20,
+0x30, 0x2c, 0x20, 0x22, 0x30, 0x78, 0x30, 0x35,
+0x20, 0x30, 0x78, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x20, 0x43, 0x48,
+0x45, 0x43, 0x4b, 0x4c, 0x4f, 0x43, 0x4b, 0x54,
+0x49, 0x4d, 0x45, 0x56, 0x45, 0x52, 0x49, 0x46,
+0x59, 0x20, 0x31, 0x22, 0x5d, 0x5d, 0x2c, 0x0a,
+0x22, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x31, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x22, 0x2c, 0x20, 0x22, 0x50, 0x32, 0x53,
+0x48, 0x2c, 0x43, 0x48, 0x45, 0x43, 0x4b, 0x4c,
+0x4f, 0x43, 0x4b, 0x54, 0x49, 0x4d, 0x45, 0x56,
+0x45, 0x52, 0x49, 0x46, 0x59, 0x22, 0x5d, 0x2c,
+0x0a, 0x0a, 0x5b, 0x22, 0x56, 0x61, 0x6c, 0x69,
+0x64, 0x20, 0x43, 0x48, 0x45, 0x43, 0x4b, 0x4c,
+0x4f, 0x43, 0x4b, 0x54, 0x49, 0x4d, 0x45, 0x56,
+0x45, 0x52, 0x49, 0x46, 0x59, 0x20, 0x69, 0x6e,
+0x20, 0x73, 0x63, 0x72, 0x69, 0x70, 0x74, 0x53,
+0x69, 0x67, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b,
+0x5b, 0x22, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20,
+0x22, 0x31, 0x22, 0x5d, 0x5d, 0x2c, 0x0a, 0x22,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x32, 0x35, 0x31, 0x62, 0x31,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x22,
+0x50, 0x32, 0x53, 0x48, 0x2c, 0x43, 0x48, 0x45,
+0x43, 0x4b, 0x4c, 0x4f, 0x43, 0x4b, 0x54, 0x49,
+0x4d, 0x45, 0x56, 0x45, 0x52, 0x49, 0x46, 0x59,
+0x22, 0x5d, 0x2c, 0x0a, 0x0a, 0x5b, 0x22, 0x56,
+0x61, 0x6c, 0x69, 0x64, 0x20, 0x43, 0x48, 0x45,
+0x43, 0x4b, 0x4c, 0x4f, 0x43, 0x4b, 0x54, 0x49,
+0x4d, 0x45, 0x56, 0x45, 0x52, 0x49, 0x46, 0x59,
+0x20, 0x69, 0x6e, 0x20, 0x72, 0x65, 0x64, 0x65,
+0x65, 0x6d, 0x53, 0x63, 0x72, 0x69, 0x70, 0x74,
+0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b, 0x5b, 0x22,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20, 0x22, 0x48,
+0x41, 0x53, 0x48, 0x31, 0x36, 0x30, 0x20, 0x30,
+0x78, 0x31, 0x34, 0x20, 0x30, 0x78, 0x63, 0x35,
+0x62, 0x39, 0x33, 0x30, 0x36, 0x34, 0x31, 0x35,
+0x39, 0x62, 0x33, 0x62, 0x32, 0x64, 0x36, 0x61,
+0x62, 0x35, 0x30, 0x36, 0x61, 0x34, 0x31, 0x62,
+0x31, 0x66, 0x35, 0x30, 0x34, 0x36, 0x33, 0x37,
+0x37, 0x31, 0x62, 0x39, 0x38, 0x38, 0x20, 0x45,
+0x51, 0x55, 0x41, 0x4c, 0x22, 0x5d, 0x5d, 0x2c,
+0x0a, 0x22, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x33, 0x30, 0x32,
+0x35, 0x31, 0x62, 0x31, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x22, 0x2c, 0x20, 0x22, 0x50, 0x32, 0x53, 0x48,
+0x2c, 0x43, 0x48, 0x45, 0x43, 0x4b, 0x4c, 0x4f,
+0x43, 0x4b, 0x54, 0x49, 0x4d, 0x45, 0x56, 0x45,
+0x52, 0x49, 0x46, 0x59, 0x22, 0x5d, 0x2c, 0x0a,
+0x0a, 0x5b, 0x22, 0x41, 0x20, 0x74, 0x72, 0x61,
+0x6e, 0x73, 0x61, 0x63, 0x74, 0x69, 0x6f, 0x6e,
+0x20, 0x77, 0x69, 0x74, 0x68, 0x20, 0x61, 0x20,
+0x6e, 0x6f, 0x6e, 0x2d, 0x73, 0x74, 0x61, 0x6e,
+0x64, 0x61, 0x72, 0x64, 0x20, 0x44, 0x45, 0x52,
+0x20, 0x73, 0x69, 0x67, 0x6e, 0x61, 0x74, 0x75,
+0x72, 0x65, 0x2e, 0x22, 0x5d, 0x2c, 0x0a, 0x5b,
+0x5b, 0x5b, 0x22, 0x62, 0x31, 0x64, 0x62, 0x63,
+0x38, 0x31, 0x36, 0x39, 0x36, 0x63, 0x38, 0x61,
+0x39, 0x63, 0x30, 0x66, 0x63, 0x63, 0x64, 0x30,
+0x36, 0x39, 0x33, 0x61, 0x62, 0x36, 0x36, 0x64,
+0x37, 0x63, 0x33, 0x36, 0x38, 0x64, 0x62, 0x63,
+0x33, 0x38, 0x63, 0x30, 0x64, 0x65, 0x66, 0x34,
+0x65, 0x38, 0x30, 0x30, 0x36, 0x38, 0x35, 0x35,
+0x36, 0x30, 0x64, 0x64, 0x64, 0x31, 0x62, 0x32,
+0x31, 0x33, 0x32, 0x22, 0x2c, 0x20, 0x30, 0x2c,
+0x20, 0x22, 0x44, 0x55, 0x50, 0x20, 0x48, 0x41,
+0x53, 0x48, 0x31, 0x36, 0x30, 0x20, 0x30, 0x78,
+0x31, 0x34, 0x20, 0x30, 0x78, 0x34, 0x62, 0x33,
+0x62, 0x64, 0x37, 0x65, 0x62, 0x61, 0x33, 0x62,
+0x63, 0x30, 0x32, 0x38, 0x34, 0x66, 0x64, 0x33,
+0x30, 0x30, 0x37, 0x62, 0x65, 0x37, 0x66, 0x33,
+0x62, 0x65, 0x32, 0x37, 0x35, 0x65, 0x39, 0x34,
+0x66, 0x35, 0x38, 0x32, 0x36, 0x20, 0x45, 0x51,
+0x55, 0x41, 0x4c, 0x56, 0x45, 0x52, 0x49, 0x46,
+0x59, 0x20, 0x43, 0x48, 0x45, 0x43, 0x4b, 0x53,
+0x49, 0x47, 0x22, 0x5d, 0x5d, 0x2c, 0x0a, 0x22,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x33, 0x32, 0x32, 0x31, 0x31, 0x62,
+0x64, 0x64, 0x30, 0x64, 0x35, 0x36, 0x38, 0x35,
+0x30, 0x36, 0x38, 0x30, 0x34, 0x65, 0x65, 0x66,
+0x30, 0x64, 0x38, 0x63, 0x63, 0x33, 0x64, 0x62,
+0x36, 0x38, 0x63, 0x33, 0x64, 0x37, 0x36, 0x36,
+0x61, 0x62, 0x39, 0x33, 0x30, 0x36, 0x63, 0x64,
+0x66, 0x63, 0x63, 0x30, 0x61, 0x39, 0x63, 0x38,
+0x39, 0x36, 0x31, 0x36, 0x63, 0x38, 0x64, 0x62,
+0x62, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x36, 0x63, 0x34, 0x39, 0x33, 0x30,
+0x34, 0x35, 0x30, 0x32, 0x32, 0x31, 0x30, 0x30,
+0x63, 0x37, 0x62, 0x62, 0x30, 0x66, 0x61, 0x65,
+0x61, 0x30, 0x35, 0x32, 0x32, 0x65, 0x37, 0x34,
+0x66, 0x66, 0x32, 0x32, 0x30, 0x63, 0x32, 0x30,
+0x63, 0x30, 0x32, 0x32, 0x64, 0x32, 0x63, 0x62,
+0x36, 0x30, 0x33, 0x33, 0x66, 0x38, 0x64, 0x31,
+0x36, 0x37, 0x66, 0x62, 0x38, 0x39, 0x65, 0x37,
+0x35, 0x61, 0x35, 0x30, 0x65, 0x32, 0x33, 0x37,
+0x61, 0x33, 0x35, 0x66, 0x64, 0x36, 0x64, 0x32,
+0x30, 0x32, 0x32, 0x30, 0x33, 0x30, 0x36, 0x34,
+0x37, 0x31, 0x33, 0x34, 0x39, 0x31, 0x62, 0x31,
+0x66, 0x38, 0x61, 0x64, 0x35, 0x66, 0x37, 0x39,
+0x65, 0x36, 0x32, 0x33, 0x64, 0x30, 0x32, 0x31,
+0x39, 0x61, 0x64, 0x33, 0x32, 0x35, 0x31, 0x30,
+0x62, 0x66, 0x61, 0x61, 0x31, 0x30, 0x30, 0x39,
+0x61, 0x62, 0x33, 0x30, 0x63, 0x62, 0x65, 0x65,
+0x37, 0x37, 0x62, 0x35, 0x39, 0x33, 0x31, 0x37,
+0x64, 0x36, 0x65, 0x33, 0x30, 0x30, 0x30, 0x31,
+0x32, 0x31, 0x30, 0x32, 0x33, 0x37, 0x61, 0x66,
+0x31, 0x33, 0x65, 0x62, 0x32, 0x64, 0x38, 0x34,
+0x65, 0x34, 0x35, 0x34, 0x35, 0x61, 0x66, 0x32,
+0x38, 0x37, 0x62, 0x39, 0x31, 0x39, 0x63, 0x32,
+0x32, 0x38, 0x32, 0x30, 0x31, 0x39, 0x63, 0x39,
+0x36, 0x39, 0x31, 0x63, 0x63, 0x35, 0x30, 0x39,
+0x65, 0x37, 0x38, 0x65, 0x31, 0x39, 0x36, 0x61,
+0x39, 0x64, 0x38, 0x32, 0x37, 0x34, 0x65, 0x64,
+0x31, 0x62, 0x65, 0x30, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x39,
+0x37, 0x36, 0x61, 0x39, 0x31, 0x34, 0x66, 0x31,
+0x62, 0x33, 0x65, 0x64, 0x32, 0x65, 0x64, 0x61,
+0x39, 0x61, 0x32, 0x65, 0x62, 0x65, 0x35, 0x61,
+0x39, 0x33, 0x37, 0x34, 0x66, 0x36, 0x39, 0x32,
+0x38, 0x37, 0x37, 0x63, 0x64, 0x66, 0x38, 0x37,
+0x63, 0x30, 0x66, 0x39, 0x35, 0x62, 0x38, 0x38,
+0x61, 0x63, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x22, 0x2c, 0x20, 0x22, 0x50, 0x32,
+0x53, 0x48, 0x22, 0x5d, 0x2c, 0x0a, 0x0a, 0x5b,
+0x22, 0x43, 0x48, 0x45, 0x43, 0x4b, 0x53, 0x45,
+0x51, 0x55, 0x45, 0x4e, 0x43, 0x45, 0x56, 0x45,
+0x52, 0x49, 0x46, 0x59, 0x20, 0x74, 0x65, 0x73,
+0x74, 0x73, 0x22, 0x5d, 0x2c, 0x0a, 0x0a, 0x5b,
+0x22, 0x42, 0x79, 0x2d, 0x68, 0x65, 0x69, 0x67,
+0x68, 0x74, 0x20, 0x6c, 0x6f, 0x63, 0x6b, 0x73,
+0x2c, 0x20, 0x77, 0x69, 0x74, 0x68, 0x20, 0x61,
+0x72, 0x67, 0x75, 0x6d, 0x65, 0x6e, 0x74, 0x20,
+0x3d, 0x3d, 0x20, 0x30, 0x20, 0x61, 0x6e, 0x64,
+0x20, 0x3d, 0x3d, 0x20, 0x74, 0x78, 0x69, 0x6e,
+0x2e, 0x6e, 0x53, 0x65, 0x71, 0x75, 0x65, 0x6e,
+0x63, 0x65, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b,
+0x5b, 0x22, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20,
+0x22, 0x30, 0x20, 0x43, 0x48, 0x45, 0x43, 0x4b,
+0x53, 0x45, 0x51, 0x55, 0x45, 0x4e, 0x43, 0x45,
+0x56, 0x45, 0x52, 0x49, 0x46, 0x59, 0x20, 0x31,
+0x22, 0x5d, 0x5d, 0x2c, 0x0a, 0x22, 0x30, 0x32,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x22, 0x2c,
+0x20, 0x22, 0x50, 0x32, 0x53, 0x48, 0x2c, 0x43,
+0x48, 0x45, 0x43, 0x4b, 0x53, 0x45, 0x51, 0x55,
+0x45, 0x4e, 0x43, 0x45, 0x56, 0x45, 0x52, 0x49,
+0x46, 0x59, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b,
+0x5b, 0x22, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20,
+0x22, 0x36, 0x35, 0x35, 0x33, 0x35, 0x20, 0x43,
+0x48, 0x45, 0x43, 0x4b, 0x53, 0x45, 0x51, 0x55,
+0x45, 0x4e, 0x43, 0x45, 0x56, 0x45, 0x52, 0x49,
+0x46, 0x59, 0x20, 0x31, 0x22, 0x5d, 0x5d, 0x2c,
+0x0a, 0x22, 0x30, 0x32, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x66, 0x66,
+0x66, 0x66, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x22, 0x2c, 0x20, 0x22, 0x50, 0x32,
+0x53, 0x48, 0x2c, 0x43, 0x48, 0x45, 0x43, 0x4b,
+0x53, 0x45, 0x51, 0x55, 0x45, 0x4e, 0x43, 0x45,
+0x56, 0x45, 0x52, 0x49, 0x46, 0x59, 0x22, 0x5d,
+0x2c, 0x0a, 0x5b, 0x5b, 0x5b, 0x22, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x22, 0x2c,
+0x20, 0x30, 0x2c, 0x20, 0x22, 0x36, 0x35, 0x35,
+0x33, 0x35, 0x20, 0x43, 0x48, 0x45, 0x43, 0x4b,
+0x53, 0x45, 0x51, 0x55, 0x45, 0x4e, 0x43, 0x45,
+0x56, 0x45, 0x52, 0x49, 0x46, 0x59, 0x20, 0x31,
+0x22, 0x5d, 0x5d, 0x2c, 0x0a, 0x22, 0x30, 0x32,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x66, 0x66, 0x66, 0x66, 0x62, 0x66,
+0x37, 0x66, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x22, 0x2c,
+0x20, 0x22, 0x50, 0x32, 0x53, 0x48, 0x2c, 0x43,
+0x48, 0x45, 0x43, 0x4b, 0x53, 0x45, 0x51, 0x55,
+0x45, 0x4e, 0x43, 0x45, 0x56, 0x45, 0x52, 0x49,
+0x46, 0x59, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b,
+0x5b, 0x22, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20,
+0x22, 0x30, 0x20, 0x43, 0x48, 0x45, 0x43, 0x4b,
+0x53, 0x45, 0x51, 0x55, 0x45, 0x4e, 0x43, 0x45,
+0x56, 0x45, 0x52, 0x49, 0x46, 0x59, 0x20, 0x31,
+0x22, 0x5d, 0x5d, 0x2c, 0x0a, 0x22, 0x30, 0x32,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x66, 0x66, 0x66, 0x66, 0x62, 0x66,
+0x37, 0x66, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x22, 0x2c,
+0x20, 0x22, 0x50, 0x32, 0x53, 0x48, 0x2c, 0x43,
+0x48, 0x45, 0x43, 0x4b, 0x53, 0x45, 0x51, 0x55,
+0x45, 0x4e, 0x43, 0x45, 0x56, 0x45, 0x52, 0x49,
+0x46, 0x59, 0x22, 0x5d, 0x2c, 0x0a, 0x0a, 0x5b,
+0x22, 0x42, 0x79, 0x2d, 0x74, 0x69, 0x6d, 0x65,
+0x20, 0x6c, 0x6f, 0x63, 0x6b, 0x73, 0x2c, 0x20,
+0x77, 0x69, 0x74, 0x68, 0x20, 0x61, 0x72, 0x67,
+0x75, 0x6d, 0x65, 0x6e, 0x74, 0x20, 0x3d, 0x3d,
+0x20, 0x30, 0x20, 0x61, 0x6e, 0x64, 0x20, 0x3d,
+0x3d, 0x20, 0x74, 0x78, 0x69, 0x6e, 0x2e, 0x6e,
+0x53, 0x65, 0x71, 0x75, 0x65, 0x6e, 0x63, 0x65,
+0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b, 0x5b, 0x22,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20, 0x22, 0x34,
+0x31, 0x39, 0x34, 0x33, 0x30, 0x34, 0x20, 0x43,
+0x48, 0x45, 0x43, 0x4b, 0x53, 0x45, 0x51, 0x55,
+0x45, 0x4e, 0x43, 0x45, 0x56, 0x45, 0x52, 0x49,
+0x46, 0x59, 0x20, 0x31, 0x22, 0x5d, 0x5d, 0x2c,
+0x0a, 0x22, 0x30, 0x32, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x34, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x22, 0x2c, 0x20, 0x22, 0x50, 0x32,
+0x53, 0x48, 0x2c, 0x43, 0x48, 0x45, 0x43, 0x4b,
+0x53, 0x45, 0x51, 0x55, 0x45, 0x4e, 0x43, 0x45,
+0x56, 0x45, 0x52, 0x49, 0x46, 0x59, 0x22, 0x5d,
+0x2c, 0x0a, 0x5b, 0x5b, 0x5b, 0x22, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x22, 0x2c,
+0x20, 0x30, 0x2c, 0x20, 0x22, 0x34, 0x32, 0x35,
+0x39, 0x38, 0x33, 0x39, 0x20, 0x43, 0x48, 0x45,
+0x43, 0x4b, 0x53, 0x45, 0x51, 0x55, 0x45, 0x4e,
+0x43, 0x45, 0x56, 0x45, 0x52, 0x49, 0x46, 0x59,
+0x20, 0x31, 0x22, 0x5d, 0x5d, 0x2c, 0x0a, 0x22,
+0x30, 0x32, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x66, 0x66, 0x66, 0x66,
+0x34, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x22, 0x2c, 0x20, 0x22, 0x50, 0x32, 0x53, 0x48,
+0x2c, 0x43, 0x48, 0x45, 0x43, 0x4b, 0x53, 0x45,
+0x51, 0x55, 0x45, 0x4e, 0x43, 0x45, 0x56, 0x45,
+0x52, 0x49, 0x46, 0x59, 0x22, 0x5d, 0x2c, 0x0a,
+0x5b, 0x5b, 0x5b, 0x22, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x30,
+0x2c, 0x20, 0x22, 0x34, 0x32, 0x35, 0x39, 0x38,
+0x33, 0x39, 0x20, 0x43, 0x48, 0x45, 0x43, 0x4b,
+0x53, 0x45, 0x51, 0x55, 0x45, 0x4e, 0x43, 0x45,
+0x56, 0x45, 0x52, 0x49, 0x46, 0x59, 0x20, 0x31,
+0x22, 0x5d, 0x5d, 0x2c, 0x0a, 0x22, 0x30, 0x32,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x37, 0x66, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x22, 0x2c,
+0x20, 0x22, 0x50, 0x32, 0x53, 0x48, 0x2c, 0x43,
+0x48, 0x45, 0x43, 0x4b, 0x53, 0x45, 0x51, 0x55,
+0x45, 0x4e, 0x43, 0x45, 0x56, 0x45, 0x52, 0x49,
+0x46, 0x59, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b,
+0x5b, 0x22, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20,
+0x22, 0x34, 0x31, 0x39, 0x34, 0x33, 0x30, 0x34,
+0x20, 0x43, 0x48, 0x45, 0x43, 0x4b, 0x53, 0x45,
+0x51, 0x55, 0x45, 0x4e, 0x43, 0x45, 0x56, 0x45,
+0x52, 0x49, 0x46, 0x59, 0x20, 0x31, 0x22, 0x5d,
+0x5d, 0x2c, 0x0a, 0x22, 0x30, 0x32, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x37, 0x66,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x22,
+0x50, 0x32, 0x53, 0x48, 0x2c, 0x43, 0x48, 0x45,
+0x43, 0x4b, 0x53, 0x45, 0x51, 0x55, 0x45, 0x4e,
+0x43, 0x45, 0x56, 0x45, 0x52, 0x49, 0x46, 0x59,
+0x22, 0x5d, 0x2c, 0x0a, 0x0a, 0x5b, 0x22, 0x55,
+0x70, 0x70, 0x65, 0x72, 0x20, 0x73, 0x65, 0x71,
+0x75, 0x65, 0x6e, 0x63, 0x65, 0x20, 0x77, 0x69,
+0x74, 0x68, 0x20, 0x75, 0x70, 0x70, 0x65, 0x72,
+0x20, 0x73, 0x65, 0x71, 0x75, 0x65, 0x6e, 0x63,
+0x65, 0x20, 0x69, 0x73, 0x20, 0x66, 0x69, 0x6e,
+0x65, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b, 0x5b,
+0x22, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30,
+0x30, 0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20, 0x22,
+0x32, 0x31, 0x34, 0x37, 0x34, 0x38, 0x33, 0x36,
+0x34, 0x38, 0x20, 0x43, 0x48, 0x45, 0x43, 0x4b,
+0x53, 0x45, 0x51, 0x55, 0x45, 0x4e, 0x43, 0x45,
+0x56, 0x45, 0x52, 0x49, 0x46, 0x59, 0x20, 0x31,
+0x22, 0x5d, 0x5d, 0x2c, 0x0a, 0x22, 0x30, 0x32,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x38, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x22, 0x2c,
+0x20, 0x22, 0x50, 0x32, 0x53, 0x48, 0x2c, 0x43,
+0x48, 0x45, 0x43, 0x4b, 0x53, 0x45, 0x51, 0x55,
+0x45, 0x4e, 0x43, 0x45, 0x56, 0x45, 0x52, 0x49,
+0x46, 0x59, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b,
+0x5b, 0x22, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20,
+0x22, 0x34, 0x32, 0x39, 0x34, 0x39, 0x36, 0x37,
+0x32, 0x39, 0x35, 0x20, 0x43, 0x48, 0x45, 0x43,
+0x4b, 0x53, 0x45, 0x51, 0x55, 0x45, 0x4e, 0x43,
+0x45, 0x56, 0x45, 0x52, 0x49, 0x46, 0x59, 0x20,
+0x31, 0x22, 0x5d, 0x5d, 0x2c, 0x0a, 0x22, 0x30,
+0x32, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x38, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x22,
+0x2c, 0x20, 0x22, 0x50, 0x32, 0x53, 0x48, 0x2c,
+0x43, 0x48, 0x45, 0x43, 0x4b, 0x53, 0x45, 0x51,
+0x55, 0x45, 0x4e, 0x43, 0x45, 0x56, 0x45, 0x52,
+0x49, 0x46, 0x59, 0x22, 0x5d, 0x2c, 0x0a, 0x5b,
+0x5b, 0x5b, 0x22, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x30, 0x2c,
+0x20, 0x22, 0x32, 0x31, 0x34, 0x37, 0x34, 0x38,
+0x33, 0x36, 0x34, 0x38, 0x20, 0x43, 0x48, 0x45,
+0x43, 0x4b, 0x53, 0x45, 0x51, 0x55, 0x45, 0x4e,
+0x43, 0x45, 0x56, 0x45, 0x52, 0x49, 0x46, 0x59,
+0x20, 0x31, 0x22, 0x5d, 0x5d, 0x2c, 0x0a, 0x22,
+0x30, 0x32, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x66, 0x65, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x22, 0x2c, 0x20, 0x22, 0x50, 0x32, 0x53, 0x48,
+0x2c, 0x43, 0x48, 0x45, 0x43, 0x4b, 0x53, 0x45,
+0x51, 0x55, 0x45, 0x4e, 0x43, 0x45, 0x56, 0x45,
+0x52, 0x49, 0x46, 0x59, 0x22, 0x5d, 0x2c, 0x0a,
+0x5b, 0x5b, 0x5b, 0x22, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x30,
+0x2c, 0x20, 0x22, 0x34, 0x32, 0x39, 0x34, 0x39,
+0x36, 0x37, 0x32, 0x39, 0x35, 0x20, 0x43, 0x48,
+0x45, 0x43, 0x4b, 0x53, 0x45, 0x51, 0x55, 0x45,
+0x4e, 0x43, 0x45, 0x56, 0x45, 0x52, 0x49, 0x46,
+0x59, 0x20, 0x31, 0x22, 0x5d, 0x5d, 0x2c, 0x0a,
+0x22, 0x30, 0x32, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x31, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x66, 0x65, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x30, 0x31, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x22, 0x2c, 0x20, 0x22, 0x50, 0x32, 0x53,
+0x48, 0x2c, 0x43, 0x48, 0x45, 0x43, 0x4b, 0x53,
+0x45, 0x51, 0x55, 0x45, 0x4e, 0x43, 0x45, 0x56,
+0x45, 0x52, 0x49, 0x46, 0x59, 0x22, 0x5d, 0x2c,
+0x0a, 0x5b, 0x5b, 0x5b, 0x22, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x31, 0x30, 0x30, 0x22, 0x2c, 0x20,
+0x30, 0x2c, 0x20, 0x22, 0x32, 0x31, 0x34, 0x37,
+0x34, 0x38, 0x33, 0x36, 0x34, 0x38, 0x20, 0x43,
+0x48, 0x45, 0x43, 0x4b, 0x53, 0x45, 0x51, 0x55,
+0x45, 0x4e, 0x43, 0x45, 0x56, 0x45, 0x52, 0x49,
+0x46, 0x59, 0x20, 0x31, 0x22, 0x5d, 0x5d, 0x2c,
+0x0a, 0x22, 0x30, 0x32, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x30, 0x31,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x22, 0x2c, 0x20, 0x22, 0x50, 0x32,
+0x53, 0x48, 0x2c, 0x43, 0x48, 0x45, 0x43, 0x4b,
+0x53, 0x45, 0x51, 0x55, 0x45, 0x4e, 0x43, 0x45,
+0x56, 0x45, 0x52, 0x49, 0x46, 0x59, 0x22, 0x5d,
+0x2c, 0x0a, 0x5b, 0x5b, 0x5b, 0x22, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x22, 0x2c,
+0x20, 0x30, 0x2c, 0x20, 0x22, 0x34, 0x32, 0x39,
+0x34, 0x39, 0x36, 0x37, 0x32, 0x39, 0x35, 0x20,
+0x43, 0x48, 0x45, 0x43, 0x4b, 0x53, 0x45, 0x51,
+0x55, 0x45, 0x4e, 0x43, 0x45, 0x56, 0x45, 0x52,
+0x49, 0x46, 0x59, 0x20, 0x31, 0x22, 0x5d, 0x5d,
+0x2c, 0x0a, 0x22, 0x30, 0x32, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x22, 0x50,
+0x32, 0x53, 0x48, 0x2c, 0x43, 0x48, 0x45, 0x43,
+0x4b, 0x53, 0x45, 0x51, 0x55, 0x45, 0x4e, 0x43,
+0x45, 0x56, 0x45, 0x52, 0x49, 0x46, 0x59, 0x22,
+0x5d, 0x2c, 0x0a, 0x0a, 0x5b, 0x22, 0x41, 0x72,
+0x67, 0x75, 0x6d, 0x65, 0x6e, 0x74, 0x20, 0x32,
+0x5e, 0x33, 0x31, 0x20, 0x77, 0x69, 0x74, 0x68,
+0x20, 0x76, 0x61, 0x72, 0x69, 0x6f, 0x75, 0x73,
+0x20, 0x6e, 0x53, 0x65, 0x71, 0x75, 0x65, 0x6e,
+0x63, 0x65, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b,
+0x5b, 0x22, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20,
+0x22, 0x32, 0x31, 0x34, 0x37, 0x34, 0x38, 0x33,
+0x36, 0x34, 0x38, 0x20, 0x43, 0x48, 0x45, 0x43,
+0x4b, 0x53, 0x45, 0x51, 0x55, 0x45, 0x4e, 0x43,
+0x45, 0x56, 0x45, 0x52, 0x49, 0x46, 0x59, 0x20,
+0x31, 0x22, 0x5d, 0x5d, 0x2c, 0x0a, 0x22, 0x30,
+0x32, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x66, 0x66, 0x66, 0x66, 0x62,
+0x66, 0x37, 0x66, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x22,
+0x2c, 0x20, 0x22, 0x50, 0x32, 0x53, 0x48, 0x2c,
+0x43, 0x48, 0x45, 0x43, 0x4b, 0x53, 0x45, 0x51,
+0x55, 0x45, 0x4e, 0x43, 0x45, 0x56, 0x45, 0x52,
+0x49, 0x46, 0x59, 0x22, 0x5d, 0x2c, 0x0a, 0x5b,
+0x5b, 0x5b, 0x22, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x30, 0x2c,
+0x20, 0x22, 0x32, 0x31, 0x34, 0x37, 0x34, 0x38,
+0x33, 0x36, 0x34, 0x38, 0x20, 0x43, 0x48, 0x45,
+0x43, 0x4b, 0x53, 0x45, 0x51, 0x55, 0x45, 0x4e,
+0x43, 0x45, 0x56, 0x45, 0x52, 0x49, 0x46, 0x59,
+0x20, 0x31, 0x22, 0x5d, 0x5d, 0x2c, 0x0a, 0x22,
+0x30, 0x32, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x37, 0x66, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x22, 0x2c, 0x20, 0x22, 0x50, 0x32, 0x53, 0x48,
+0x2c, 0x43, 0x48, 0x45, 0x43, 0x4b, 0x53, 0x45,
+0x51, 0x55, 0x45, 0x4e, 0x43, 0x45, 0x56, 0x45,
+0x52, 0x49, 0x46, 0x59, 0x22, 0x5d, 0x2c, 0x0a,
+0x5b, 0x5b, 0x5b, 0x22, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x30,
+0x2c, 0x20, 0x22, 0x32, 0x31, 0x34, 0x37, 0x34,
+0x38, 0x33, 0x36, 0x34, 0x38, 0x20, 0x43, 0x48,
+0x45, 0x43, 0x4b, 0x53, 0x45, 0x51, 0x55, 0x45,
+0x4e, 0x43, 0x45, 0x56, 0x45, 0x52, 0x49, 0x46,
+0x59, 0x20, 0x31, 0x22, 0x5d, 0x5d, 0x2c, 0x0a,
+0x22, 0x30, 0x32, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x31, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x30, 0x31, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x22, 0x2c, 0x20, 0x22, 0x50, 0x32, 0x53,
+0x48, 0x2c, 0x43, 0x48, 0x45, 0x43, 0x4b, 0x53,
+0x45, 0x51, 0x55, 0x45, 0x4e, 0x43, 0x45, 0x56,
+0x45, 0x52, 0x49, 0x46, 0x59, 0x22, 0x5d, 0x2c,
+0x0a, 0x0a, 0x5b, 0x22, 0x41, 0x72, 0x67, 0x75,
+0x6d, 0x65, 0x6e, 0x74, 0x20, 0x32, 0x5e, 0x33,
+0x32, 0x2d, 0x31, 0x20, 0x77, 0x69, 0x74, 0x68,
+0x20, 0x76, 0x61, 0x72, 0x69, 0x6f, 0x75, 0x73,
+0x20, 0x6e, 0x53, 0x65, 0x71, 0x75, 0x65, 0x6e,
+0x63, 0x65, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b,
+0x5b, 0x22, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20,
+0x22, 0x34, 0x32, 0x39, 0x34, 0x39, 0x36, 0x37,
+0x32, 0x39, 0x35, 0x20, 0x43, 0x48, 0x45, 0x43,
+0x4b, 0x53, 0x45, 0x51, 0x55, 0x45, 0x4e, 0x43,
+0x45, 0x56, 0x45, 0x52, 0x49, 0x46, 0x59, 0x20,
+0x31, 0x22, 0x5d, 0x5d, 0x2c, 0x0a, 0x22, 0x30,
+0x32, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x66, 0x66, 0x66, 0x66, 0x62,
+0x66, 0x37, 0x66, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x22,
+0x2c, 0x20, 0x22, 0x50, 0x32, 0x53, 0x48, 0x2c,
+0x43, 0x48, 0x45, 0x43, 0x4b, 0x53, 0x45, 0x51,
+0x55, 0x45, 0x4e, 0x43, 0x45, 0x56, 0x45, 0x52,
+0x49, 0x46, 0x59, 0x22, 0x5d, 0x2c, 0x0a, 0x5b,
+0x5b, 0x5b, 0x22, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x30, 0x2c,
+0x20, 0x22, 0x34, 0x32, 0x39, 0x34, 0x39, 0x36,
+0x37, 0x32, 0x39, 0x35, 0x20, 0x43, 0x48, 0x45,
+0x43, 0x4b, 0x53, 0x45, 0x51, 0x55, 0x45, 0x4e,
+0x43, 0x45, 0x56, 0x45, 0x52, 0x49, 0x46, 0x59,
+0x20, 0x31, 0x22, 0x5d, 0x5d, 0x2c, 0x0a, 0x22,
+0x30, 0x32, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x37, 0x66, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x22, 0x2c, 0x20, 0x22, 0x50, 0x32, 0x53, 0x48,
+0x2c, 0x43, 0x48, 0x45, 0x43, 0x4b, 0x53, 0x45,
+0x51, 0x55, 0x45, 0x4e, 0x43, 0x45, 0x56, 0x45,
+0x52, 0x49, 0x46, 0x59, 0x22, 0x5d, 0x2c, 0x0a,
+0x5b, 0x5b, 0x5b, 0x22, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x30,
+0x2c, 0x20, 0x22, 0x34, 0x32, 0x39, 0x34, 0x39,
+0x36, 0x37, 0x32, 0x39, 0x35, 0x20, 0x43, 0x48,
+0x45, 0x43, 0x4b, 0x53, 0x45, 0x51, 0x55, 0x45,
+0x4e, 0x43, 0x45, 0x56, 0x45, 0x52, 0x49, 0x46,
+0x59, 0x20, 0x31, 0x22, 0x5d, 0x5d, 0x2c, 0x0a,
+0x22, 0x30, 0x32, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x31, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x30, 0x31, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x22, 0x2c, 0x20, 0x22, 0x50, 0x32, 0x53,
+0x48, 0x2c, 0x43, 0x48, 0x45, 0x43, 0x4b, 0x53,
+0x45, 0x51, 0x55, 0x45, 0x4e, 0x43, 0x45, 0x56,
+0x45, 0x52, 0x49, 0x46, 0x59, 0x22, 0x5d, 0x2c,
+0x0a, 0x0a, 0x5b, 0x22, 0x41, 0x72, 0x67, 0x75,
+0x6d, 0x65, 0x6e, 0x74, 0x20, 0x33, 0x3c, 0x3c,
+0x33, 0x31, 0x20, 0x77, 0x69, 0x74, 0x68, 0x20,
+0x76, 0x61, 0x72, 0x69, 0x6f, 0x75, 0x73, 0x20,
+0x6e, 0x53, 0x65, 0x71, 0x75, 0x65, 0x6e, 0x63,
+0x65, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b, 0x5b,
+0x22, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30,
+0x30, 0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20, 0x22,
+0x36, 0x34, 0x34, 0x32, 0x34, 0x35, 0x30, 0x39,
+0x34, 0x34, 0x20, 0x43, 0x48, 0x45, 0x43, 0x4b,
+0x53, 0x45, 0x51, 0x55, 0x45, 0x4e, 0x43, 0x45,
+0x56, 0x45, 0x52, 0x49, 0x46, 0x59, 0x20, 0x31,
+0x22, 0x5d, 0x5d, 0x2c, 0x0a, 0x22, 0x30, 0x32,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x66, 0x66, 0x66, 0x66, 0x62, 0x66,
+0x37, 0x66, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x22, 0x2c,
+0x20, 0x22, 0x50, 0x32, 0x53, 0x48, 0x2c, 0x43,
+0x48, 0x45, 0x43, 0x4b, 0x53, 0x45, 0x51, 0x55,
+0x45, 0x4e, 0x43, 0x45, 0x56, 0x45, 0x52, 0x49,
+0x46, 0x59, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b,
+0x5b, 0x22, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20,
+0x22, 0x36, 0x34, 0x34, 0x32, 0x34, 0x35, 0x30,
+0x39, 0x34, 0x34, 0x20, 0x43, 0x48, 0x45, 0x43,
+0x4b, 0x53, 0x45, 0x51, 0x55, 0x45, 0x4e, 0x43,
+0x45, 0x56, 0x45, 0x52, 0x49, 0x46, 0x59, 0x20,
+0x31, 0x22, 0x5d, 0x5d, 0x2c, 0x0a, 0x22, 0x30,
+0x32, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x37, 0x66, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x22,
+0x2c, 0x20, 0x22, 0x50, 0x32, 0x53, 0x48, 0x2c,
+0x43, 0x48, 0x45, 0x43, 0x4b, 0x53, 0x45, 0x51,
+0x55, 0x45, 0x4e, 0x43, 0x45, 0x56, 0x45, 0x52,
+0x49, 0x46, 0x59, 0x22, 0x5d, 0x2c, 0x0a, 0x5b,
+0x5b, 0x5b, 0x22, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x30, 0x2c,
+0x20, 0x22, 0x36, 0x34, 0x34, 0x32, 0x34, 0x35,
+0x30, 0x39, 0x34, 0x34, 0x20, 0x43, 0x48, 0x45,
+0x43, 0x4b, 0x53, 0x45, 0x51, 0x55, 0x45, 0x4e,
+0x43, 0x45, 0x56, 0x45, 0x52, 0x49, 0x46, 0x59,
+0x20, 0x31, 0x22, 0x5d, 0x5d, 0x2c, 0x0a, 0x22,
+0x30, 0x32, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x22, 0x2c, 0x20, 0x22, 0x50, 0x32, 0x53, 0x48,
+0x2c, 0x43, 0x48, 0x45, 0x43, 0x4b, 0x53, 0x45,
+0x51, 0x55, 0x45, 0x4e, 0x43, 0x45, 0x56, 0x45,
+0x52, 0x49, 0x46, 0x59, 0x22, 0x5d, 0x2c, 0x0a,
+0x0a, 0x5b, 0x22, 0x35, 0x20, 0x62, 0x79, 0x74,
+0x65, 0x20, 0x6e, 0x6f, 0x6e, 0x2d, 0x6d, 0x69,
+0x6e, 0x69, 0x6d, 0x61, 0x6c, 0x6c, 0x79, 0x2d,
+0x65, 0x6e, 0x63, 0x6f, 0x64, 0x65, 0x64, 0x20,
+0x6f, 0x70, 0x65, 0x72, 0x61, 0x6e, 0x64, 0x73,
+0x73, 0x20, 0x61, 0x72, 0x65, 0x20, 0x76, 0x61,
+0x6c, 0x69, 0x64, 0x22, 0x5d, 0x2c, 0x0a, 0x5b,
+0x5b, 0x5b, 0x22, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x30, 0x2c,
+0x20, 0x22, 0x30, 0x78, 0x30, 0x35, 0x20, 0x30,
+0x78, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x20, 0x43, 0x48, 0x45, 0x43,
+0x4b, 0x53, 0x45, 0x51, 0x55, 0x45, 0x4e, 0x43,
+0x45, 0x56, 0x45, 0x52, 0x49, 0x46, 0x59, 0x20,
+0x31, 0x22, 0x5d, 0x5d, 0x2c, 0x0a, 0x22, 0x30,
+0x32, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x22,
+0x2c, 0x20, 0x22, 0x50, 0x32, 0x53, 0x48, 0x2c,
+0x43, 0x48, 0x45, 0x43, 0x4b, 0x53, 0x45, 0x51,
+0x55, 0x45, 0x4e, 0x43, 0x45, 0x56, 0x45, 0x52,
+0x49, 0x46, 0x59, 0x22, 0x5d, 0x2c, 0x0a, 0x0a,
+0x5b, 0x22, 0x54, 0x68, 0x65, 0x20, 0x61, 0x72,
+0x67, 0x75, 0x6d, 0x65, 0x6e, 0x74, 0x20, 0x63,
+0x61, 0x6e, 0x20, 0x62, 0x65, 0x20, 0x63, 0x61,
+0x6c, 0x63, 0x75, 0x6c, 0x61, 0x74, 0x65, 0x64,
+0x20, 0x72, 0x61, 0x74, 0x68, 0x65, 0x72, 0x20,
+0x74, 0x68, 0x61, 0x6e, 0x20, 0x63, 0x72, 0x65,
+0x61, 0x74, 0x65, 0x64, 0x20, 0x64, 0x69, 0x72,
+0x65, 0x63, 0x74, 0x6c, 0x79, 0x20, 0x62, 0x79,
+0x20, 0x61, 0x20, 0x50, 0x55, 0x53, 0x48, 0x44,
+0x41, 0x54, 0x41, 0x22, 0x5d, 0x2c, 0x0a, 0x5b,
+0x5b, 0x5b, 0x22, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x30, 0x2c,
+0x20, 0x22, 0x34, 0x31, 0x39, 0x34, 0x33, 0x30,
+0x33, 0x20, 0x31, 0x41, 0x44, 0x44, 0x20, 0x43,
+0x48, 0x45, 0x43, 0x4b, 0x53, 0x45, 0x51, 0x55,
+0x45, 0x4e, 0x43, 0x45, 0x56, 0x45, 0x52, 0x49,
+0x46, 0x59, 0x20, 0x31, 0x22, 0x5d, 0x5d, 0x2c,
+0x0a, 0x22, 0x30, 0x32, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x34, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x22, 0x2c, 0x20, 0x22, 0x50, 0x32,
+0x53, 0x48, 0x2c, 0x43, 0x48, 0x45, 0x43, 0x4b,
+0x53, 0x45, 0x51, 0x55, 0x45, 0x4e, 0x43, 0x45,
+0x56, 0x45, 0x52, 0x49, 0x46, 0x59, 0x22, 0x5d,
+0x2c, 0x0a, 0x5b, 0x5b, 0x5b, 0x22, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x22, 0x2c,
+0x20, 0x30, 0x2c, 0x20, 0x22, 0x34, 0x31, 0x39,
+0x34, 0x33, 0x30, 0x34, 0x20, 0x31, 0x53, 0x55,
+0x42, 0x20, 0x43, 0x48, 0x45, 0x43, 0x4b, 0x53,
+0x45, 0x51, 0x55, 0x45, 0x4e, 0x43, 0x45, 0x56,
+0x45, 0x52, 0x49, 0x46, 0x59, 0x20, 0x31, 0x22,
+0x5d, 0x5d, 0x2c, 0x0a, 0x22, 0x30, 0x32, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30,
+0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x66, 0x66, 0x66, 0x66, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x22, 0x2c, 0x20,
+0x22, 0x50, 0x32, 0x53, 0x48, 0x2c, 0x43, 0x48,
+0x45, 0x43, 0x4b, 0x53, 0x45, 0x51, 0x55, 0x45,
+0x4e, 0x43, 0x45, 0x56, 0x45, 0x52, 0x49, 0x46,
+0x59, 0x22, 0x5d, 0x2c, 0x0a, 0x0a, 0x5b, 0x22,
+0x41, 0x6e, 0x20, 0x41, 0x44, 0x44, 0x20, 0x70,
+0x72, 0x6f, 0x64, 0x75, 0x63, 0x69, 0x6e, 0x67,
+0x20, 0x61, 0x20, 0x35, 0x2d, 0x62, 0x79, 0x74,
+0x65, 0x20, 0x72, 0x65, 0x73, 0x75, 0x6c, 0x74,
+0x20, 0x74, 0x68, 0x61, 0x74, 0x20, 0x73, 0x65,
+0x74, 0x73, 0x20, 0x43, 0x54, 0x78, 0x49, 0x6e,
+0x3a, 0x3a, 0x53, 0x45, 0x51, 0x55, 0x45, 0x4e,
+0x43, 0x45, 0x5f, 0x4c, 0x4f, 0x43, 0x4b, 0x54,
+0x49, 0x4d, 0x45, 0x5f, 0x44, 0x49, 0x53, 0x41,
+0x42, 0x4c, 0x45, 0x5f, 0x46, 0x4c, 0x41, 0x47,
+0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b, 0x5b, 0x22,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20, 0x22, 0x32,
+0x31, 0x34, 0x37, 0x34, 0x38, 0x33, 0x36, 0x34,
+0x37, 0x20, 0x36, 0x35, 0x35, 0x33, 0x36, 0x20,
+0x43, 0x48, 0x45, 0x43, 0x4b, 0x53, 0x45, 0x51,
+0x55, 0x45, 0x4e, 0x43, 0x45, 0x56, 0x45, 0x52,
+0x49, 0x46, 0x59, 0x20, 0x31, 0x22, 0x5d, 0x5d,
+0x2c, 0x0a, 0x22, 0x30, 0x32, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x22, 0x50,
+0x32, 0x53, 0x48, 0x2c, 0x43, 0x48, 0x45, 0x43,
+0x4b, 0x53, 0x45, 0x51, 0x55, 0x45, 0x4e, 0x43,
+0x45, 0x56, 0x45, 0x52, 0x49, 0x46, 0x59, 0x22,
+0x5d, 0x2c, 0x0a, 0x5b, 0x5b, 0x5b, 0x22, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x22,
+0x2c, 0x20, 0x30, 0x2c, 0x20, 0x22, 0x32, 0x31,
+0x34, 0x37, 0x34, 0x38, 0x33, 0x36, 0x34, 0x37,
+0x20, 0x34, 0x32, 0x35, 0x39, 0x38, 0x34, 0x30,
+0x20, 0x41, 0x44, 0x44, 0x20, 0x43, 0x48, 0x45,
+0x43, 0x4b, 0x53, 0x45, 0x51, 0x55, 0x45, 0x4e,
+0x43, 0x45, 0x56, 0x45, 0x52, 0x49, 0x46, 0x59,
+0x20, 0x31, 0x22, 0x5d, 0x5d, 0x2c, 0x0a, 0x22,
+0x30, 0x32, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x34, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x22, 0x2c, 0x20, 0x22, 0x50, 0x32, 0x53, 0x48,
+0x2c, 0x43, 0x48, 0x45, 0x43, 0x4b, 0x53, 0x45,
+0x51, 0x55, 0x45, 0x4e, 0x43, 0x45, 0x56, 0x45,
+0x52, 0x49, 0x46, 0x59, 0x22, 0x5d, 0x2c, 0x0a,
+0x0a, 0x5b, 0x22, 0x56, 0x61, 0x6c, 0x69, 0x64,
+0x20, 0x43, 0x48, 0x45, 0x43, 0x4b, 0x53, 0x45,
+0x51, 0x55, 0x45, 0x4e, 0x43, 0x45, 0x56, 0x45,
+0x52, 0x49, 0x46, 0x59, 0x20, 0x69, 0x6e, 0x20,
+0x73, 0x63, 0x72, 0x69, 0x70, 0x74, 0x53, 0x69,
+0x67, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b, 0x5b,
+0x22, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30,
+0x30, 0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20, 0x22,
+0x31, 0x22, 0x5d, 0x5d, 0x2c, 0x0a, 0x22, 0x30,
+0x32, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x32, 0x35, 0x31, 0x62, 0x32, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x22, 0x50,
+0x32, 0x53, 0x48, 0x2c, 0x43, 0x48, 0x45, 0x43,
+0x4b, 0x53, 0x45, 0x51, 0x55, 0x45, 0x4e, 0x43,
+0x45, 0x56, 0x45, 0x52, 0x49, 0x46, 0x59, 0x22,
+0x5d, 0x2c, 0x0a, 0x0a, 0x5b, 0x22, 0x56, 0x61,
+0x6c, 0x69, 0x64, 0x20, 0x43, 0x48, 0x45, 0x43,
+0x4b, 0x53, 0x45, 0x51, 0x55, 0x45, 0x4e, 0x43,
+0x45, 0x56, 0x45, 0x52, 0x49, 0x46, 0x59, 0x20,
+0x69, 0x6e, 0x20, 0x72, 0x65, 0x64, 0x65, 0x65,
+0x6d, 0x53, 0x63, 0x72, 0x69, 0x70, 0x74, 0x22,
+0x5d, 0x2c, 0x0a, 0x5b, 0x5b, 0x5b, 0x22, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x22,
+0x2c, 0x20, 0x30, 0x2c, 0x20, 0x22, 0x48, 0x41,
+0x53, 0x48, 0x31, 0x36, 0x30, 0x20, 0x30, 0x78,
+0x31, 0x34, 0x20, 0x30, 0x78, 0x37, 0x63, 0x31,
+0x37, 0x61, 0x66, 0x66, 0x35, 0x33, 0x32, 0x66,
+0x32, 0x32, 0x62, 0x65, 0x62, 0x35, 0x34, 0x30,
+0x36, 0x39, 0x39, 0x34, 0x32, 0x66, 0x39, 0x62,
+0x66, 0x35, 0x36, 0x37, 0x61, 0x36, 0x36, 0x31,
+0x33, 0x33, 0x65, 0x61, 0x66, 0x20, 0x45, 0x51,
+0x55, 0x41, 0x4c, 0x22, 0x5d, 0x5d, 0x2c, 0x0a,
+0x22, 0x30, 0x32, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x31, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x33, 0x30, 0x32, 0x35,
+0x31, 0x62, 0x32, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x22,
+0x2c, 0x20, 0x22, 0x50, 0x32, 0x53, 0x48, 0x2c,
+0x43, 0x48, 0x45, 0x43, 0x4b, 0x53, 0x45, 0x51,
+0x55, 0x45, 0x4e, 0x43, 0x45, 0x56, 0x45, 0x52,
+0x49, 0x46, 0x59, 0x22, 0x5d, 0x2c, 0x0a, 0x0a,
+0x5b, 0x22, 0x56, 0x61, 0x6c, 0x69, 0x64, 0x20,
+0x50, 0x32, 0x57, 0x50, 0x4b, 0x48, 0x20, 0x28,
+0x50, 0x72, 0x69, 0x76, 0x61, 0x74, 0x65, 0x20,
+0x6b, 0x65, 0x79, 0x20, 0x6f, 0x66, 0x20, 0x73,
+0x65, 0x67, 0x77, 0x69, 0x74, 0x20, 0x74, 0x65,
+0x73, 0x74, 0x73, 0x20, 0x69, 0x73, 0x20, 0x4c,
+0x35, 0x41, 0x51, 0x74, 0x56, 0x32, 0x48, 0x44,
+0x6d, 0x34, 0x78, 0x47, 0x73, 0x73, 0x65, 0x4c,
+0x6f, 0x6b, 0x4b, 0x32, 0x56, 0x41, 0x54, 0x32,
+0x45, 0x74, 0x59, 0x4b, 0x63, 0x54, 0x6d, 0x33,
+0x63, 0x37, 0x48, 0x77, 0x71, 0x6e, 0x4a, 0x42,
+0x46, 0x74, 0x39, 0x4c, 0x64, 0x61, 0x51, 0x55,
+0x4c, 0x73, 0x4d, 0x29, 0x22, 0x5d, 0x2c, 0x0a,
+0x5b, 0x5b, 0x5b, 0x22, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x30,
+0x2c, 0x20, 0x22, 0x30, 0x78, 0x30, 0x30, 0x20,
+0x30, 0x78, 0x31, 0x34, 0x20, 0x30, 0x78, 0x34,
+0x63, 0x39, 0x63, 0x33, 0x64, 0x66, 0x61, 0x63,
+0x34, 0x32, 0x30, 0x37, 0x64, 0x35, 0x64, 0x38,
+0x63, 0x62, 0x38, 0x39, 0x64, 0x66, 0x35, 0x37,
+0x32, 0x32, 0x63, 0x62, 0x33, 0x64, 0x37, 0x31,
+0x32, 0x33, 0x38, 0x35, 0x65, 0x33, 0x66, 0x22,
+0x2c, 0x20, 0x31, 0x30, 0x30, 0x30, 0x5d, 0x5d,
+0x2c, 0x0a, 0x22, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x30, 0x31, 0x65, 0x38, 0x30,
+0x33, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x39, 0x37,
+0x36, 0x61, 0x39, 0x31, 0x34, 0x34, 0x63, 0x39,
+0x63, 0x33, 0x64, 0x66, 0x61, 0x63, 0x34, 0x32,
+0x30, 0x37, 0x64, 0x35, 0x64, 0x38, 0x63, 0x62,
+0x38, 0x39, 0x64, 0x66, 0x35, 0x37, 0x32, 0x32,
+0x63, 0x62, 0x33, 0x64, 0x37, 0x31, 0x32, 0x33,
+0x38, 0x35, 0x65, 0x33, 0x66, 0x38, 0x38, 0x61,
+0x63, 0x30, 0x32, 0x34, 0x38, 0x33, 0x30, 0x34,
+0x35, 0x30, 0x32, 0x32, 0x31, 0x30, 0x30, 0x63,
+0x66, 0x62, 0x30, 0x37, 0x31, 0x36, 0x34, 0x62,
+0x33, 0x36, 0x62, 0x61, 0x36, 0x34, 0x63, 0x31,
+0x62, 0x31, 0x65, 0x38, 0x63, 0x37, 0x37, 0x32,
+0x30, 0x61, 0x35, 0x36, 0x61, 0x64, 0x36, 0x34,
+0x64, 0x39, 0x36, 0x66, 0x36, 0x65, 0x66, 0x33,
+0x33, 0x32, 0x64, 0x33, 0x64, 0x33, 0x37, 0x66,
+0x39, 0x63, 0x62, 0x33, 0x63, 0x39, 0x36, 0x34,
+0x37, 0x37, 0x64, 0x63, 0x34, 0x34, 0x35, 0x30,
+0x32, 0x32, 0x30, 0x30, 0x61, 0x34, 0x36, 0x34,
+0x63, 0x64, 0x37, 0x61, 0x39, 0x63, 0x66, 0x39,
+0x34, 0x63, 0x64, 0x37, 0x30, 0x66, 0x36, 0x36,
+0x63, 0x65, 0x34, 0x66, 0x34, 0x66, 0x30, 0x36,
+0x32, 0x35, 0x65, 0x66, 0x36, 0x35, 0x30, 0x30,
+0x35, 0x32, 0x63, 0x37, 0x61, 0x66, 0x63, 0x66,
+0x65, 0x32, 0x39, 0x64, 0x37, 0x64, 0x37, 0x65,
+0x30, 0x31, 0x38, 0x33, 0x30, 0x66, 0x66, 0x39,
+0x31, 0x65, 0x64, 0x30, 0x31, 0x32, 0x31, 0x30,
+0x33, 0x35, 0x39, 0x36, 0x64, 0x33, 0x34, 0x35,
+0x31, 0x30, 0x32, 0x35, 0x63, 0x31, 0x39, 0x64,
+0x62, 0x62, 0x64, 0x65, 0x62, 0x39, 0x33, 0x32,
+0x64, 0x36, 0x62, 0x66, 0x38, 0x62, 0x66, 0x62,
+0x34, 0x61, 0x64, 0x34, 0x39, 0x39, 0x62, 0x39,
+0x35, 0x62, 0x36, 0x66, 0x38, 0x38, 0x64, 0x62,
+0x38, 0x38, 0x39, 0x39, 0x65, 0x66, 0x61, 0x63,
+0x31, 0x30, 0x32, 0x65, 0x35, 0x66, 0x63, 0x37,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x22, 0x2c, 0x20, 0x22, 0x50, 0x32, 0x53,
+0x48, 0x2c, 0x57, 0x49, 0x54, 0x4e, 0x45, 0x53,
+0x53, 0x22, 0x5d, 0x2c, 0x0a, 0x0a, 0x5b, 0x22,
+0x56, 0x61, 0x6c, 0x69, 0x64, 0x20, 0x50, 0x32,
+0x57, 0x53, 0x48, 0x22, 0x5d, 0x2c, 0x0a, 0x5b,
+0x5b, 0x5b, 0x22, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x30, 0x2c,
+0x20, 0x22, 0x30, 0x78, 0x30, 0x30, 0x20, 0x30,
+0x78, 0x32, 0x30, 0x20, 0x30, 0x78, 0x66, 0x66,
+0x32, 0x35, 0x34, 0x32, 0x39, 0x32, 0x35, 0x31,
+0x62, 0x35, 0x61, 0x38, 0x34, 0x66, 0x34, 0x35,
+0x32, 0x32, 0x33, 0x30, 0x61, 0x33, 0x63, 0x37,
+0x35, 0x66, 0x64, 0x38, 0x38, 0x36, 0x62, 0x37,
+0x66, 0x63, 0x35, 0x61, 0x37, 0x38, 0x36, 0x35,
+0x63, 0x65, 0x34, 0x61, 0x37, 0x62, 0x62, 0x37,
+0x61, 0x39, 0x64, 0x37, 0x63, 0x35, 0x62, 0x65,
+0x36, 0x64, 0x61, 0x33, 0x64, 0x62, 0x22, 0x2c,
+0x20, 0x31, 0x30, 0x30, 0x30, 0x5d, 0x5d, 0x2c,
+0x0a, 0x22, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x31,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x30, 0x31, 0x65, 0x38, 0x30, 0x33,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x31, 0x39, 0x37, 0x36,
+0x61, 0x39, 0x31, 0x34, 0x34, 0x63, 0x39, 0x63,
+0x33, 0x64, 0x66, 0x61, 0x63, 0x34, 0x32, 0x30,
+0x37, 0x64, 0x35, 0x64, 0x38, 0x63, 0x62, 0x38,
+0x39, 0x64, 0x66, 0x35, 0x37, 0x32, 0x32, 0x63,
+0x62, 0x33, 0x64, 0x37, 0x31, 0x32, 0x33, 0x38,
+0x35, 0x65, 0x33, 0x66, 0x38, 0x38, 0x61, 0x63,
+0x30, 0x32, 0x34, 0x38, 0x33, 0x30, 0x34, 0x35,
+0x30, 0x32, 0x32, 0x31, 0x30, 0x30, 0x61, 0x61,
+0x35, 0x64, 0x38, 0x61, 0x61, 0x34, 0x30, 0x61,
+0x39, 0x30, 0x66, 0x32, 0x33, 0x63, 0x65, 0x32,
+0x63, 0x33, 0x64, 0x31, 0x31, 0x62, 0x63, 0x38,
+0x34, 0x35, 0x63, 0x61, 0x34, 0x61, 0x31, 0x32,
+0x61, 0x63, 0x64, 0x39, 0x39, 0x63, 0x62, 0x65,
+0x61, 0x33, 0x37, 0x64, 0x65, 0x36, 0x62, 0x39,
+0x66, 0x36, 0x64, 0x38, 0x36, 0x65, 0x64, 0x65,
+0x62, 0x62, 0x61, 0x38, 0x63, 0x62, 0x30, 0x32,
+0x32, 0x30, 0x32, 0x32, 0x64, 0x65, 0x64, 0x63,
+0x32, 0x61, 0x61, 0x30, 0x61, 0x32, 0x35, 0x35,
+0x66, 0x37, 0x34, 0x64, 0x30, 0x34, 0x63, 0x30,
+0x62, 0x37, 0x36, 0x65, 0x63, 0x65, 0x32, 0x64,
+0x37, 0x63, 0x36, 0x39, 0x31, 0x66, 0x39, 0x64,
+0x64, 0x31, 0x31, 0x61, 0x36, 0x34, 0x61, 0x38,
+0x61, 0x63, 0x34, 0x39, 0x66, 0x36, 0x32, 0x61,
+0x39, 0x39, 0x63, 0x33, 0x61, 0x30, 0x35, 0x66,
+0x39, 0x64, 0x30, 0x31, 0x32, 0x33, 0x32, 0x31,
+0x30, 0x33, 0x35, 0x39, 0x36, 0x64, 0x33, 0x34,
+0x35, 0x31, 0x30, 0x32, 0x35, 0x63, 0x31, 0x39,
+0x64, 0x62, 0x62, 0x64, 0x65, 0x62, 0x39, 0x33,
+0x32, 0x64, 0x36, 0x62, 0x66, 0x38, 0x62, 0x66,
+0x62, 0x34, 0x61, 0x64, 0x34, 0x39, 0x39, 0x62,
+0x39, 0x35, 0x62, 0x36, 0x66, 0x38, 0x38, 0x64,
+0x62, 0x38, 0x38, 0x39, 0x39, 0x65, 0x66, 0x61,
+0x63, 0x31, 0x30, 0x32, 0x65, 0x35, 0x66, 0x63,
+0x37, 0x31, 0x61, 0x63, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x22,
+0x50, 0x32, 0x53, 0x48, 0x2c, 0x57, 0x49, 0x54,
+0x4e, 0x45, 0x53, 0x53, 0x22, 0x5d, 0x2c, 0x0a,
+0x0a, 0x5b, 0x22, 0x56, 0x61, 0x6c, 0x69, 0x64,
+0x20, 0x50, 0x32, 0x53, 0x48, 0x28, 0x50, 0x32,
+0x57, 0x50, 0x4b, 0x48, 0x29, 0x22, 0x5d, 0x2c,
+0x0a, 0x5b, 0x5b, 0x5b, 0x22, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x31, 0x30, 0x30, 0x22, 0x2c, 0x20,
+0x30, 0x2c, 0x20, 0x22, 0x48, 0x41, 0x53, 0x48,
+0x31, 0x36, 0x30, 0x20, 0x30, 0x78, 0x31, 0x34,
+0x20, 0x30, 0x78, 0x66, 0x65, 0x39, 0x63, 0x37,
+0x64, 0x61, 0x63, 0x63, 0x39, 0x66, 0x63, 0x66,
+0x62, 0x66, 0x37, 0x65, 0x33, 0x62, 0x37, 0x64,
+0x35, 0x61, 0x64, 0x30, 0x36, 0x61, 0x61, 0x32,
+0x62, 0x32, 0x38, 0x63, 0x35, 0x61, 0x37, 0x62,
+0x37, 0x65, 0x33, 0x20, 0x45, 0x51, 0x55, 0x41,
+0x4c, 0x22, 0x2c, 0x20, 0x31, 0x30, 0x30, 0x30,
+0x5d, 0x5d, 0x2c, 0x0a, 0x22, 0x30, 0x31, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x31, 0x30, 0x30, 0x30, 0x31, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x31, 0x37, 0x31, 0x36, 0x30,
+0x30, 0x31, 0x34, 0x34, 0x63, 0x39, 0x63, 0x33,
+0x64, 0x66, 0x61, 0x63, 0x34, 0x32, 0x30, 0x37,
+0x64, 0x35, 0x64, 0x38, 0x63, 0x62, 0x38, 0x39,
+0x64, 0x66, 0x35, 0x37, 0x32, 0x32, 0x63, 0x62,
+0x33, 0x64, 0x37, 0x31, 0x32, 0x33, 0x38, 0x35,
+0x65, 0x33, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x30, 0x31, 0x65, 0x38, 0x30,
+0x33, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x39, 0x37,
+0x36, 0x61, 0x39, 0x31, 0x34, 0x34, 0x63, 0x39,
+0x63, 0x33, 0x64, 0x66, 0x61, 0x63, 0x34, 0x32,
+0x30, 0x37, 0x64, 0x35, 0x64, 0x38, 0x63, 0x62,
+0x38, 0x39, 0x64, 0x66, 0x35, 0x37, 0x32, 0x32,
+0x63, 0x62, 0x33, 0x64, 0x37, 0x31, 0x32, 0x33,
+0x38, 0x35, 0x65, 0x33, 0x66, 0x38, 0x38, 0x61,
+0x63, 0x30, 0x32, 0x34, 0x38, 0x33, 0x30, 0x34,
+0x35, 0x30, 0x32, 0x32, 0x31, 0x30, 0x30, 0x63,
+0x66, 0x62, 0x30, 0x37, 0x31, 0x36, 0x34, 0x62,
+0x33, 0x36, 0x62, 0x61, 0x36, 0x34, 0x63, 0x31,
+0x62, 0x31, 0x65, 0x38, 0x63, 0x37, 0x37, 0x32,
+0x30, 0x61, 0x35, 0x36, 0x61, 0x64, 0x36, 0x34,
+0x64, 0x39, 0x36, 0x66, 0x36, 0x65, 0x66, 0x33,
+0x33, 0x32, 0x64, 0x33, 0x64, 0x33, 0x37, 0x66,
+0x39, 0x63, 0x62, 0x33, 0x63, 0x39, 0x36, 0x34,
+0x37, 0x37, 0x64, 0x63, 0x34, 0x34, 0x35, 0x30,
+0x32, 0x32, 0x30, 0x30, 0x61, 0x34, 0x36, 0x34,
+0x63, 0x64, 0x37, 0x61, 0x39, 0x63, 0x66, 0x39,
+0x34, 0x63, 0x64, 0x37, 0x30, 0x66, 0x36, 0x36,
+0x63, 0x65, 0x34, 0x66, 0x34, 0x66, 0x30, 0x36,
+0x32, 0x35, 0x65, 0x66, 0x36, 0x35, 0x30, 0x30,
+0x35, 0x32, 0x63, 0x37, 0x61, 0x66, 0x63, 0x66,
+0x65, 0x32, 0x39, 0x64, 0x37, 0x64, 0x37, 0x65,
+0x30, 0x31, 0x38, 0x33, 0x30, 0x66, 0x66, 0x39,
+0x31, 0x65, 0x64, 0x30, 0x31, 0x32, 0x31, 0x30,
+0x33, 0x35, 0x39, 0x36, 0x64, 0x33, 0x34, 0x35,
+0x31, 0x30, 0x32, 0x35, 0x63, 0x31, 0x39, 0x64,
+0x62, 0x62, 0x64, 0x65, 0x62, 0x39, 0x33, 0x32,
+0x64, 0x36, 0x62, 0x66, 0x38, 0x62, 0x66, 0x62,
+0x34, 0x61, 0x64, 0x34, 0x39, 0x39, 0x62, 0x39,
+0x35, 0x62, 0x36, 0x66, 0x38, 0x38, 0x64, 0x62,
+0x38, 0x38, 0x39, 0x39, 0x65, 0x66, 0x61, 0x63,
+0x31, 0x30, 0x32, 0x65, 0x35, 0x66, 0x63, 0x37,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x22, 0x2c, 0x20, 0x22, 0x50, 0x32, 0x53,
+0x48, 0x2c, 0x57, 0x49, 0x54, 0x4e, 0x45, 0x53,
+0x53, 0x22, 0x5d, 0x2c, 0x0a, 0x0a, 0x5b, 0x22,
+0x56, 0x61, 0x6c, 0x69, 0x64, 0x20, 0x50, 0x32,
+0x53, 0x48, 0x28, 0x50, 0x32, 0x57, 0x53, 0x48,
+0x29, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b, 0x5b,
+0x22, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30,
+0x30, 0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20, 0x22,
+0x48, 0x41, 0x53, 0x48, 0x31, 0x36, 0x30, 0x20,
+0x30, 0x78, 0x31, 0x34, 0x20, 0x30, 0x78, 0x32,
+0x31, 0x33, 0x35, 0x61, 0x62, 0x34, 0x66, 0x30,
+0x39, 0x38, 0x31, 0x38, 0x33, 0x30, 0x33, 0x31,
+0x31, 0x65, 0x33, 0x35, 0x36, 0x30, 0x30, 0x65,
+0x65, 0x62, 0x63, 0x37, 0x33, 0x37, 0x36, 0x64,
+0x63, 0x65, 0x33, 0x61, 0x39, 0x31, 0x34, 0x20,
+0x45, 0x51, 0x55, 0x41, 0x4c, 0x22, 0x2c, 0x20,
+0x31, 0x30, 0x30, 0x30, 0x5d, 0x5d, 0x2c, 0x0a,
+0x22, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x31, 0x30,
+0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x32,
+0x33, 0x32, 0x32, 0x30, 0x30, 0x32, 0x30, 0x66,
+0x66, 0x32, 0x35, 0x34, 0x32, 0x39, 0x32, 0x35,
+0x31, 0x62, 0x35, 0x61, 0x38, 0x34, 0x66, 0x34,
+0x35, 0x32, 0x32, 0x33, 0x30, 0x61, 0x33, 0x63,
+0x37, 0x35, 0x66, 0x64, 0x38, 0x38, 0x36, 0x62,
+0x37, 0x66, 0x63, 0x35, 0x61, 0x37, 0x38, 0x36,
+0x35, 0x63, 0x65, 0x34, 0x61, 0x37, 0x62, 0x62,
+0x37, 0x61, 0x39, 0x64, 0x37, 0x63, 0x35, 0x62,
+0x65, 0x36, 0x64, 0x61, 0x33, 0x64, 0x62, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x30,
+0x31, 0x65, 0x38, 0x30, 0x33, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x39, 0x37, 0x36, 0x61, 0x39, 0x31,
+0x34, 0x34, 0x63, 0x39, 0x63, 0x33, 0x64, 0x66,
+0x61, 0x63, 0x34, 0x32, 0x30, 0x37, 0x64, 0x35,
+0x64, 0x38, 0x63, 0x62, 0x38, 0x39, 0x64, 0x66,
+0x35, 0x37, 0x32, 0x32, 0x63, 0x62, 0x33, 0x64,
+0x37, 0x31, 0x32, 0x33, 0x38, 0x35, 0x65, 0x33,
+0x66, 0x38, 0x38, 0x61, 0x63, 0x30, 0x32, 0x34,
+0x38, 0x33, 0x30, 0x34, 0x35, 0x30, 0x32, 0x32,
+0x31, 0x30, 0x30, 0x61, 0x61, 0x35, 0x64, 0x38,
+0x61, 0x61, 0x34, 0x30, 0x61, 0x39, 0x30, 0x66,
+0x32, 0x33, 0x63, 0x65, 0x32, 0x63, 0x33, 0x64,
+0x31, 0x31, 0x62, 0x63, 0x38, 0x34, 0x35, 0x63,
+0x61, 0x34, 0x61, 0x31, 0x32, 0x61, 0x63, 0x64,
+0x39, 0x39, 0x63, 0x62, 0x65, 0x61, 0x33, 0x37,
+0x64, 0x65, 0x36, 0x62, 0x39, 0x66, 0x36, 0x64,
+0x38, 0x36, 0x65, 0x64, 0x65, 0x62, 0x62, 0x61,
+0x38, 0x63, 0x62, 0x30, 0x32, 0x32, 0x30, 0x32,
+0x32, 0x64, 0x65, 0x64, 0x63, 0x32, 0x61, 0x61,
+0x30, 0x61, 0x32, 0x35, 0x35, 0x66, 0x37, 0x34,
+0x64, 0x30, 0x34, 0x63, 0x30, 0x62, 0x37, 0x36,
+0x65, 0x63, 0x65, 0x32, 0x64, 0x37, 0x63, 0x36,
+0x39, 0x31, 0x66, 0x39, 0x64, 0x64, 0x31, 0x31,
+0x61, 0x36, 0x34, 0x61, 0x38, 0x61, 0x63, 0x34,
+0x39, 0x66, 0x36, 0x32, 0x61, 0x39, 0x39, 0x63,
+0x33, 0x61, 0x30, 0x35, 0x66, 0x39, 0x64, 0x30,
+0x31, 0x32, 0x33, 0x32, 0x31, 0x30, 0x33, 0x35,
+0x39, 0x36, 0x64, 0x33, 0x34, 0x35, 0x31, 0x30,
+0x32, 0x35, 0x63, 0x31, 0x39, 0x64, 0x62, 0x62,
+0x64, 0x65, 0x62, 0x39, 0x33, 0x32, 0x64, 0x36,
+0x62, 0x66, 0x38, 0x62, 0x66, 0x62, 0x34, 0x61,
+0x64, 0x34, 0x39, 0x39, 0x62, 0x39, 0x35, 0x62,
+0x36, 0x66, 0x38, 0x38, 0x64, 0x62, 0x38, 0x38,
+0x39, 0x39, 0x65, 0x66, 0x61, 0x63, 0x31, 0x30,
+0x32, 0x65, 0x35, 0x66, 0x63, 0x37, 0x31, 0x61,
+0x63, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x22, 0x2c, 0x20, 0x22, 0x50, 0x32, 0x53,
+0x48, 0x2c, 0x57, 0x49, 0x54, 0x4e, 0x45, 0x53,
+0x53, 0x22, 0x5d, 0x2c, 0x0a, 0x0a, 0x5b, 0x22,
+0x57, 0x69, 0x74, 0x6e, 0x65, 0x73, 0x73, 0x20,
+0x77, 0x69, 0x74, 0x68, 0x20, 0x53, 0x69, 0x67,
+0x48, 0x61, 0x73, 0x68, 0x20, 0x53, 0x69, 0x6e,
+0x67, 0x6c, 0x65, 0x7c, 0x41, 0x6e, 0x79, 0x6f,
+0x6e, 0x65, 0x43, 0x61, 0x6e, 0x50, 0x61, 0x79,
+0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b, 0x5b, 0x22,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x22, 0x2c, 0x20, 0x32, 0x2c, 0x20, 0x22, 0x30,
+0x78, 0x35, 0x31, 0x22, 0x2c, 0x20, 0x33, 0x31,
+0x30, 0x30, 0x5d, 0x2c, 0x0a, 0x5b, 0x22, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x22,
+0x2c, 0x20, 0x31, 0x2c, 0x20, 0x22, 0x30, 0x78,
+0x30, 0x30, 0x20, 0x30, 0x78, 0x31, 0x34, 0x20,
+0x30, 0x78, 0x34, 0x63, 0x39, 0x63, 0x33, 0x64,
+0x66, 0x61, 0x63, 0x34, 0x32, 0x30, 0x37, 0x64,
+0x35, 0x64, 0x38, 0x63, 0x62, 0x38, 0x39, 0x64,
+0x66, 0x35, 0x37, 0x32, 0x32, 0x63, 0x62, 0x33,
+0x64, 0x37, 0x31, 0x32, 0x33, 0x38, 0x35, 0x65,
+0x33, 0x66, 0x22, 0x2c, 0x20, 0x32, 0x30, 0x30,
+0x30, 0x5d, 0x2c, 0x0a, 0x5b, 0x22, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x22, 0x2c,
+0x20, 0x30, 0x2c, 0x20, 0x22, 0x30, 0x78, 0x35,
+0x31, 0x22, 0x2c, 0x20, 0x31, 0x31, 0x30, 0x30,
+0x5d, 0x2c, 0x0a, 0x5b, 0x22, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x31, 0x30, 0x30, 0x22, 0x2c, 0x20,
+0x33, 0x2c, 0x20, 0x22, 0x30, 0x78, 0x35, 0x31,
+0x22, 0x2c, 0x20, 0x34, 0x31, 0x30, 0x30, 0x5d,
+0x5d, 0x2c, 0x0a, 0x22, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x34, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x32, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x30, 0x30,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x33, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x30, 0x35, 0x35, 0x34, 0x30, 0x62,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x35, 0x31,
+0x64, 0x30, 0x30, 0x37, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x35, 0x31, 0x38, 0x34, 0x30, 0x33,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x35, 0x31,
+0x33, 0x63, 0x30, 0x66, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x35, 0x31, 0x32, 0x63, 0x30, 0x31,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x35, 0x31,
+0x30, 0x30, 0x30, 0x32, 0x34, 0x38, 0x33, 0x30,
+0x34, 0x35, 0x30, 0x32, 0x32, 0x31, 0x30, 0x30,
+0x39, 0x32, 0x66, 0x34, 0x37, 0x37, 0x37, 0x61,
+0x30, 0x66, 0x31, 0x37, 0x62, 0x66, 0x35, 0x61,
+0x65, 0x62, 0x38, 0x61, 0x65, 0x37, 0x36, 0x38,
+0x64, 0x65, 0x63, 0x35, 0x66, 0x32, 0x63, 0x31,
+0x34, 0x66, 0x65, 0x61, 0x62, 0x66, 0x39, 0x64,
+0x31, 0x66, 0x65, 0x32, 0x63, 0x38, 0x39, 0x63,
+0x37, 0x38, 0x64, 0x66, 0x65, 0x64, 0x30, 0x66,
+0x31, 0x33, 0x66, 0x64, 0x62, 0x38, 0x36, 0x39,
+0x30, 0x32, 0x32, 0x30, 0x36, 0x64, 0x61, 0x39,
+0x30, 0x61, 0x38, 0x36, 0x30, 0x34, 0x32, 0x65,
+0x32, 0x35, 0x32, 0x62, 0x63, 0x64, 0x31, 0x65,
+0x38, 0x30, 0x61, 0x31, 0x36, 0x38, 0x63, 0x37,
+0x31, 0x39, 0x65, 0x34, 0x61, 0x31, 0x64, 0x64,
+0x63, 0x63, 0x33, 0x63, 0x65, 0x62, 0x65, 0x61,
+0x32, 0x34, 0x62, 0x39, 0x38, 0x31, 0x32, 0x63,
+0x35, 0x34, 0x35, 0x33, 0x63, 0x37, 0x39, 0x31,
+0x30, 0x37, 0x65, 0x39, 0x38, 0x33, 0x32, 0x31,
+0x30, 0x33, 0x35, 0x39, 0x36, 0x64, 0x33, 0x34,
+0x35, 0x31, 0x30, 0x32, 0x35, 0x63, 0x31, 0x39,
+0x64, 0x62, 0x62, 0x64, 0x65, 0x62, 0x39, 0x33,
+0x32, 0x64, 0x36, 0x62, 0x66, 0x38, 0x62, 0x66,
+0x62, 0x34, 0x61, 0x64, 0x34, 0x39, 0x39, 0x62,
+0x39, 0x35, 0x62, 0x36, 0x66, 0x38, 0x38, 0x64,
+0x62, 0x38, 0x38, 0x39, 0x39, 0x65, 0x66, 0x61,
+0x63, 0x31, 0x30, 0x32, 0x65, 0x35, 0x66, 0x63,
+0x37, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x22, 0x2c,
+0x20, 0x22, 0x50, 0x32, 0x53, 0x48, 0x2c, 0x57,
+0x49, 0x54, 0x4e, 0x45, 0x53, 0x53, 0x22, 0x5d,
+0x2c, 0x0a, 0x0a, 0x5b, 0x22, 0x57, 0x69, 0x74,
+0x6e, 0x65, 0x73, 0x73, 0x20, 0x77, 0x69, 0x74,
+0x68, 0x20, 0x53, 0x69, 0x67, 0x48, 0x61, 0x73,
+0x68, 0x20, 0x53, 0x69, 0x6e, 0x67, 0x6c, 0x65,
+0x7c, 0x41, 0x6e, 0x79, 0x6f, 0x6e, 0x65, 0x43,
+0x61, 0x6e, 0x50, 0x61, 0x79, 0x20, 0x28, 0x73,
+0x61, 0x6d, 0x65, 0x20, 0x73, 0x69, 0x67, 0x6e,
+0x61, 0x74, 0x75, 0x72, 0x65, 0x20, 0x61, 0x73,
+0x20, 0x70, 0x72, 0x65, 0x76, 0x69, 0x6f, 0x75,
+0x73, 0x29, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b,
+0x5b, 0x22, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20,
+0x22, 0x30, 0x78, 0x35, 0x31, 0x22, 0x2c, 0x20,
+0x31, 0x30, 0x30, 0x30, 0x5d, 0x2c, 0x0a, 0x5b,
+0x22, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30,
+0x30, 0x22, 0x2c, 0x20, 0x31, 0x2c, 0x20, 0x22,
+0x30, 0x78, 0x30, 0x30, 0x20, 0x30, 0x78, 0x31,
+0x34, 0x20, 0x30, 0x78, 0x34, 0x63, 0x39, 0x63,
+0x33, 0x64, 0x66, 0x61, 0x63, 0x34, 0x32, 0x30,
+0x37, 0x64, 0x35, 0x64, 0x38, 0x63, 0x62, 0x38,
+0x39, 0x64, 0x66, 0x35, 0x37, 0x32, 0x32, 0x63,
+0x62, 0x33, 0x64, 0x37, 0x31, 0x32, 0x33, 0x38,
+0x35, 0x65, 0x33, 0x66, 0x22, 0x2c, 0x20, 0x32,
+0x30, 0x30, 0x30, 0x5d, 0x2c, 0x0a, 0x5b, 0x22,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x22, 0x2c, 0x20, 0x32, 0x2c, 0x20, 0x22, 0x30,
+0x78, 0x35, 0x31, 0x22, 0x2c, 0x20, 0x33, 0x30,
+0x30, 0x30, 0x5d, 0x5d, 0x2c, 0x0a, 0x22, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x31, 0x30, 0x33, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x30,
+0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x32, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x30, 0x33, 0x65, 0x38, 0x30,
+0x33, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x35,
+0x31, 0x64, 0x30, 0x30, 0x37, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x31, 0x35, 0x31, 0x62, 0x38, 0x30,
+0x62, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x35,
+0x31, 0x30, 0x30, 0x30, 0x32, 0x34, 0x38, 0x33,
+0x30, 0x34, 0x35, 0x30, 0x32, 0x32, 0x31, 0x30,
+0x30, 0x39, 0x32, 0x66, 0x34, 0x37, 0x37, 0x37,
+0x61, 0x30, 0x66, 0x31, 0x37, 0x62, 0x66, 0x35,
+0x61, 0x65, 0x62, 0x38, 0x61, 0x65, 0x37, 0x36,
+0x38, 0x64, 0x65, 0x63, 0x35, 0x66, 0x32, 0x63,
+0x31, 0x34, 0x66, 0x65, 0x61, 0x62, 0x66, 0x39,
+0x64, 0x31, 0x66, 0x65, 0x32, 0x63, 0x38, 0x39,
+0x63, 0x37, 0x38, 0x64, 0x66, 0x65, 0x64, 0x30,
+0x66, 0x31, 0x33, 0x66, 0x64, 0x62, 0x38, 0x36,
+0x39, 0x30, 0x32, 0x32, 0x30, 0x36, 0x64, 0x61,
+0x39, 0x30, 0x61, 0x38, 0x36, 0x30, 0x34, 0x32,
+0x65, 0x32, 0x35, 0x32, 0x62, 0x63, 0x64, 0x31,
+0x65, 0x38, 0x30, 0x61, 0x31, 0x36, 0x38, 0x63,
+0x37, 0x31, 0x39, 0x65, 0x34, 0x61, 0x31, 0x64,
+0x64, 0x63, 0x63, 0x33, 0x63, 0x65, 0x62, 0x65,
+0x61, 0x32, 0x34, 0x62, 0x39, 0x38, 0x31, 0x32,
+0x63, 0x35, 0x34, 0x35, 0x33, 0x63, 0x37, 0x39,
+0x31, 0x30, 0x37, 0x65, 0x39, 0x38, 0x33, 0x32,
+0x31, 0x30, 0x33, 0x35, 0x39, 0x36, 0x64, 0x33,
+0x34, 0x35, 0x31, 0x30, 0x32, 0x35, 0x63, 0x31,
+0x39, 0x64, 0x62, 0x62, 0x64, 0x65, 0x62, 0x39,
+0x33, 0x32, 0x64, 0x36, 0x62, 0x66, 0x38, 0x62,
+0x66, 0x62, 0x34, 0x61, 0x64, 0x34, 0x39, 0x39,
+0x62, 0x39, 0x35, 0x62, 0x36, 0x66, 0x38, 0x38,
+0x64, 0x62, 0x38, 0x38, 0x39, 0x39, 0x65, 0x66,
+0x61, 0x63, 0x31, 0x30, 0x32, 0x65, 0x35, 0x66,
+0x63, 0x37, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x22, 0x2c, 0x20,
+0x22, 0x50, 0x32, 0x53, 0x48, 0x2c, 0x57, 0x49,
+0x54, 0x4e, 0x45, 0x53, 0x53, 0x22, 0x5d, 0x2c,
+0x0a, 0x0a, 0x5b, 0x22, 0x57, 0x69, 0x74, 0x6e,
+0x65, 0x73, 0x73, 0x20, 0x77, 0x69, 0x74, 0x68,
+0x20, 0x53, 0x69, 0x67, 0x48, 0x61, 0x73, 0x68,
+0x20, 0x53, 0x69, 0x6e, 0x67, 0x6c, 0x65, 0x22,
+0x5d, 0x2c, 0x0a, 0x5b, 0x5b, 0x5b, 0x22, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x22,
+0x2c, 0x20, 0x30, 0x2c, 0x20, 0x22, 0x30, 0x78,
+0x35, 0x31, 0x22, 0x2c, 0x20, 0x31, 0x30, 0x30,
+0x30, 0x5d, 0x2c, 0x0a, 0x5b, 0x22, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x22, 0x2c,
+0x20, 0x31, 0x2c, 0x20, 0x22, 0x30, 0x78, 0x30,
+0x30, 0x20, 0x30, 0x78, 0x31, 0x34, 0x20, 0x30,
+0x78, 0x34, 0x63, 0x39, 0x63, 0x33, 0x64, 0x66,
+0x61, 0x63, 0x34, 0x32, 0x30, 0x37, 0x64, 0x35,
+0x64, 0x38, 0x63, 0x62, 0x38, 0x39, 0x64, 0x66,
+0x35, 0x37, 0x32, 0x32, 0x63, 0x62, 0x33, 0x64,
+0x37, 0x31, 0x32, 0x33, 0x38, 0x35, 0x65, 0x33,
+0x66, 0x22, 0x2c, 0x20, 0x32, 0x30, 0x30, 0x30,
+0x5d, 0x2c, 0x0a, 0x5b, 0x22, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x31, 0x30, 0x30, 0x22, 0x2c, 0x20,
+0x32, 0x2c, 0x20, 0x22, 0x30, 0x78, 0x35, 0x31,
+0x22, 0x2c, 0x20, 0x33, 0x30, 0x30, 0x30, 0x5d,
+0x5d, 0x2c, 0x0a, 0x22, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x33, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x30, 0x30,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x32,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x30, 0x34, 0x38, 0x34, 0x30, 0x33, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x31, 0x35, 0x31, 0x64, 0x30,
+0x30, 0x37, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x35, 0x31, 0x35, 0x34, 0x30, 0x62, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x31, 0x35, 0x31, 0x63, 0x38,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x35, 0x31, 0x30, 0x30, 0x30, 0x32, 0x34, 0x37,
+0x33, 0x30, 0x34, 0x34, 0x30, 0x32, 0x32, 0x30,
+0x36, 0x39, 0x39, 0x65, 0x36, 0x62, 0x30, 0x63,
+0x66, 0x65, 0x30, 0x31, 0x35, 0x62, 0x36, 0x34,
+0x63, 0x61, 0x33, 0x32, 0x38, 0x33, 0x65, 0x36,
+0x35, 0x35, 0x31, 0x34, 0x34, 0x30, 0x61, 0x33,
+0x34, 0x66, 0x39, 0x30, 0x31, 0x62, 0x61, 0x36,
+0x32, 0x64, 0x64, 0x34, 0x63, 0x37, 0x32, 0x66,
+0x65, 0x31, 0x63, 0x62, 0x38, 0x31, 0x35, 0x61,
+0x66, 0x62, 0x32, 0x65, 0x36, 0x37, 0x36, 0x31,
+0x30, 0x32, 0x32, 0x30, 0x32, 0x31, 0x63, 0x63,
+0x35, 0x65, 0x38, 0x34, 0x64, 0x62, 0x34, 0x39,
+0x38, 0x62, 0x31, 0x34, 0x37, 0x39, 0x64, 0x65,
+0x31, 0x34, 0x65, 0x66, 0x64, 0x61, 0x34, 0x39,
+0x30, 0x39, 0x33, 0x32, 0x31, 0x39, 0x34, 0x34,
+0x31, 0x61, 0x64, 0x63, 0x36, 0x63, 0x35, 0x34,
+0x33, 0x65, 0x35, 0x35, 0x33, 0x34, 0x39, 0x37,
+0x39, 0x36, 0x30, 0x35, 0x65, 0x32, 0x37, 0x33,
+0x64, 0x38, 0x30, 0x62, 0x30, 0x33, 0x32, 0x31,
+0x30, 0x33, 0x35, 0x39, 0x36, 0x64, 0x33, 0x34,
+0x35, 0x31, 0x30, 0x32, 0x35, 0x63, 0x31, 0x39,
+0x64, 0x62, 0x62, 0x64, 0x65, 0x62, 0x39, 0x33,
+0x32, 0x64, 0x36, 0x62, 0x66, 0x38, 0x62, 0x66,
+0x62, 0x34, 0x61, 0x64, 0x34, 0x39, 0x39, 0x62,
+0x39, 0x35, 0x62, 0x36, 0x66, 0x38, 0x38, 0x64,
+0x62, 0x38, 0x38, 0x39, 0x39, 0x65, 0x66, 0x61,
+0x63, 0x31, 0x30, 0x32, 0x65, 0x35, 0x66, 0x63,
+0x37, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x22,
+0x50, 0x32, 0x53, 0x48, 0x2c, 0x57, 0x49, 0x54,
+0x4e, 0x45, 0x53, 0x53, 0x22, 0x5d, 0x2c, 0x0a,
+0x0a, 0x5b, 0x22, 0x57, 0x69, 0x74, 0x6e, 0x65,
+0x73, 0x73, 0x20, 0x77, 0x69, 0x74, 0x68, 0x20,
+0x53, 0x69, 0x67, 0x48, 0x61, 0x73, 0x68, 0x20,
+0x53, 0x69, 0x6e, 0x67, 0x6c, 0x65, 0x20, 0x28,
+0x73, 0x61, 0x6d, 0x65, 0x20, 0x73, 0x69, 0x67,
+0x6e, 0x61, 0x74, 0x75, 0x72, 0x65, 0x20, 0x61,
+0x73, 0x20, 0x70, 0x72, 0x65, 0x76, 0x69, 0x6f,
+0x75, 0x73, 0x29, 0x22, 0x5d, 0x2c, 0x0a, 0x5b,
+0x5b, 0x5b, 0x22, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x30, 0x2c,
+0x20, 0x22, 0x30, 0x78, 0x35, 0x31, 0x22, 0x2c,
+0x20, 0x31, 0x30, 0x30, 0x30, 0x5d, 0x2c, 0x0a,
+0x5b, 0x22, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x22, 0x2c, 0x20, 0x31, 0x2c, 0x20,
+0x22, 0x30, 0x78, 0x30, 0x30, 0x20, 0x30, 0x78,
+0x31, 0x34, 0x20, 0x30, 0x78, 0x34, 0x63, 0x39,
+0x63, 0x33, 0x64, 0x66, 0x61, 0x63, 0x34, 0x32,
+0x30, 0x37, 0x64, 0x35, 0x64, 0x38, 0x63, 0x62,
+0x38, 0x39, 0x64, 0x66, 0x35, 0x37, 0x32, 0x32,
+0x63, 0x62, 0x33, 0x64, 0x37, 0x31, 0x32, 0x33,
+0x38, 0x35, 0x65, 0x33, 0x66, 0x22, 0x2c, 0x20,
+0x32, 0x30, 0x30, 0x30, 0x5d, 0x2c, 0x0a, 0x5b,
+0x22, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30,
+0x30, 0x22, 0x2c, 0x20, 0x32, 0x2c, 0x20, 0x22,
+0x30, 0x78, 0x35, 0x31, 0x22, 0x2c, 0x20, 0x33,
+0x30, 0x30, 0x30, 0x5d, 0x5d, 0x2c, 0x0a, 0x22,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x33, 0x30, 0x30,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x32, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x30, 0x33, 0x65, 0x38,
+0x30, 0x33, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x35, 0x31, 0x64, 0x30, 0x30, 0x37, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x31, 0x35, 0x31, 0x62, 0x38,
+0x30, 0x62, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x35, 0x31, 0x30, 0x30, 0x30, 0x32, 0x34, 0x37,
+0x33, 0x30, 0x34, 0x34, 0x30, 0x32, 0x32, 0x30,
+0x36, 0x39, 0x39, 0x65, 0x36, 0x62, 0x30, 0x63,
+0x66, 0x65, 0x30, 0x31, 0x35, 0x62, 0x36, 0x34,
+0x63, 0x61, 0x33, 0x32, 0x38, 0x33, 0x65, 0x36,
+0x35, 0x35, 0x31, 0x34, 0x34, 0x30, 0x61, 0x33,
+0x34, 0x66, 0x39, 0x30, 0x31, 0x62, 0x61, 0x36,
+0x32, 0x64, 0x64, 0x34, 0x63, 0x37, 0x32, 0x66,
+0x65, 0x31, 0x63, 0x62, 0x38, 0x31, 0x35, 0x61,
+0x66, 0x62, 0x32, 0x65, 0x36, 0x37, 0x36, 0x31,
+0x30, 0x32, 0x32, 0x30, 0x32, 0x31, 0x63, 0x63,
+0x35, 0x65, 0x38, 0x34, 0x64, 0x62, 0x34, 0x39,
+0x38, 0x62, 0x31, 0x34, 0x37, 0x39, 0x64, 0x65,
+0x31, 0x34, 0x65, 0x66, 0x64, 0x61, 0x34, 0x39,
+0x30, 0x39, 0x33, 0x32, 0x31, 0x39, 0x34, 0x34,
+0x31, 0x61, 0x64, 0x63, 0x36, 0x63, 0x35, 0x34,
+0x33, 0x65, 0x35, 0x35, 0x33, 0x34, 0x39, 0x37,
+0x39, 0x36, 0x30, 0x35, 0x65, 0x32, 0x37, 0x33,
+0x64, 0x38, 0x30, 0x62, 0x30, 0x33, 0x32, 0x31,
+0x30, 0x33, 0x35, 0x39, 0x36, 0x64, 0x33, 0x34,
+0x35, 0x31, 0x30, 0x32, 0x35, 0x63, 0x31, 0x39,
+0x64, 0x62, 0x62, 0x64, 0x65, 0x62, 0x39, 0x33,
+0x32, 0x64, 0x36, 0x62, 0x66, 0x38, 0x62, 0x66,
+0x62, 0x34, 0x61, 0x64, 0x34, 0x39, 0x39, 0x62,
+0x39, 0x35, 0x62, 0x36, 0x66, 0x38, 0x38, 0x64,
+0x62, 0x38, 0x38, 0x39, 0x39, 0x65, 0x66, 0x61,
+0x63, 0x31, 0x30, 0x32, 0x65, 0x35, 0x66, 0x63,
+0x37, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x22,
+0x50, 0x32, 0x53, 0x48, 0x2c, 0x57, 0x49, 0x54,
+0x4e, 0x45, 0x53, 0x53, 0x22, 0x5d, 0x2c, 0x0a,
+0x0a, 0x5b, 0x22, 0x57, 0x69, 0x74, 0x6e, 0x65,
+0x73, 0x73, 0x20, 0x77, 0x69, 0x74, 0x68, 0x20,
+0x53, 0x69, 0x67, 0x48, 0x61, 0x73, 0x68, 0x20,
+0x4e, 0x6f, 0x6e, 0x65, 0x7c, 0x41, 0x6e, 0x79,
+0x6f, 0x6e, 0x65, 0x43, 0x61, 0x6e, 0x50, 0x61,
+0x79, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b, 0x5b,
+0x22, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30,
+0x30, 0x22, 0x2c, 0x20, 0x32, 0x2c, 0x20, 0x22,
+0x30, 0x78, 0x35, 0x31, 0x22, 0x2c, 0x20, 0x33,
+0x31, 0x30, 0x30, 0x5d, 0x2c, 0x0a, 0x5b, 0x22,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20, 0x22, 0x30,
+0x78, 0x35, 0x31, 0x22, 0x2c, 0x20, 0x31, 0x31,
+0x30, 0x30, 0x5d, 0x2c, 0x0a, 0x5b, 0x22, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x22,
+0x2c, 0x20, 0x31, 0x2c, 0x20, 0x22, 0x30, 0x78,
+0x30, 0x30, 0x20, 0x30, 0x78, 0x31, 0x34, 0x20,
+0x30, 0x78, 0x34, 0x63, 0x39, 0x63, 0x33, 0x64,
+0x66, 0x61, 0x63, 0x34, 0x32, 0x30, 0x37, 0x64,
+0x35, 0x64, 0x38, 0x63, 0x62, 0x38, 0x39, 0x64,
+0x66, 0x35, 0x37, 0x32, 0x32, 0x63, 0x62, 0x33,
+0x64, 0x37, 0x31, 0x32, 0x33, 0x38, 0x35, 0x65,
+0x33, 0x66, 0x22, 0x2c, 0x20, 0x32, 0x30, 0x30,
+0x30, 0x5d, 0x2c, 0x0a, 0x5b, 0x22, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x22, 0x2c,
+0x20, 0x33, 0x2c, 0x20, 0x22, 0x30, 0x78, 0x35,
+0x31, 0x22, 0x2c, 0x20, 0x34, 0x31, 0x30, 0x30,
+0x5d, 0x5d, 0x2c, 0x0a, 0x22, 0x30, 0x31, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x34, 0x30, 0x30, 0x30, 0x31, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x32, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x30,
+0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x33, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x30, 0x34, 0x62, 0x36, 0x30,
+0x33, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x35,
+0x31, 0x39, 0x65, 0x30, 0x37, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x31, 0x35, 0x31, 0x38, 0x36, 0x30,
+0x62, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30,
+0x30, 0x39, 0x36, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x31, 0x35, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x32, 0x34, 0x38, 0x33, 0x30, 0x34,
+0x35, 0x30, 0x32, 0x32, 0x31, 0x30, 0x30, 0x39,
+0x31, 0x62, 0x33, 0x32, 0x32, 0x37, 0x34, 0x32,
+0x39, 0x35, 0x63, 0x32, 0x61, 0x33, 0x66, 0x61,
+0x30, 0x32, 0x66, 0x35, 0x62, 0x63, 0x65, 0x39,
+0x32, 0x66, 0x62, 0x32, 0x37, 0x38, 0x39, 0x65,
+0x33, 0x66, 0x63, 0x36, 0x65, 0x61, 0x39, 0x34,
+0x37, 0x66, 0x62, 0x65, 0x31, 0x61, 0x37, 0x36,
+0x65, 0x35, 0x32, 0x65, 0x61, 0x33, 0x66, 0x34,
+0x65, 0x66, 0x32, 0x33, 0x38, 0x31, 0x61, 0x30,
+0x32, 0x32, 0x30, 0x37, 0x39, 0x61, 0x64, 0x37,
+0x32, 0x61, 0x65, 0x66, 0x61, 0x33, 0x38, 0x33,
+0x37, 0x61, 0x32, 0x65, 0x30, 0x63, 0x30, 0x33,
+0x33, 0x61, 0x38, 0x36, 0x35, 0x32, 0x61, 0x35,
+0x39, 0x37, 0x33, 0x31, 0x64, 0x61, 0x30, 0x35,
+0x66, 0x61, 0x34, 0x61, 0x38, 0x31, 0x33, 0x66,
+0x34, 0x66, 0x63, 0x34, 0x38, 0x65, 0x38, 0x37,
+0x63, 0x30, 0x37, 0x35, 0x30, 0x33, 0x37, 0x32,
+0x35, 0x36, 0x62, 0x38, 0x32, 0x32, 0x31, 0x30,
+0x33, 0x35, 0x39, 0x36, 0x64, 0x33, 0x34, 0x35,
+0x31, 0x30, 0x32, 0x35, 0x63, 0x31, 0x39, 0x64,
+0x62, 0x62, 0x64, 0x65, 0x62, 0x39, 0x33, 0x32,
+0x64, 0x36, 0x62, 0x66, 0x38, 0x62, 0x66, 0x62,
+0x34, 0x61, 0x64, 0x34, 0x39, 0x39, 0x62, 0x39,
+0x35, 0x62, 0x36, 0x66, 0x38, 0x38, 0x64, 0x62,
+0x38, 0x38, 0x39, 0x39, 0x65, 0x66, 0x61, 0x63,
+0x31, 0x30, 0x32, 0x65, 0x35, 0x66, 0x63, 0x37,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x22, 0x50,
+0x32, 0x53, 0x48, 0x2c, 0x57, 0x49, 0x54, 0x4e,
+0x45, 0x53, 0x53, 0x22, 0x5d, 0x2c, 0x0a, 0x0a,
+0x5b, 0x22, 0x57, 0x69, 0x74, 0x6e, 0x65, 0x73,
+0x73, 0x20, 0x77, 0x69, 0x74, 0x68, 0x20, 0x53,
+0x69, 0x67, 0x48, 0x61, 0x73, 0x68, 0x20, 0x4e,
+0x6f, 0x6e, 0x65, 0x7c, 0x41, 0x6e, 0x79, 0x6f,
+0x6e, 0x65, 0x43, 0x61, 0x6e, 0x50, 0x61, 0x79,
+0x20, 0x28, 0x73, 0x61, 0x6d, 0x65, 0x20, 0x73,
+0x69, 0x67, 0x6e, 0x61, 0x74, 0x75, 0x72, 0x65,
+0x20, 0x61, 0x73, 0x20, 0x70, 0x72, 0x65, 0x76,
+0x69, 0x6f, 0x75, 0x73, 0x29, 0x22, 0x5d, 0x2c,
+0x0a, 0x5b, 0x5b, 0x5b, 0x22, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x31, 0x30, 0x30, 0x22, 0x2c, 0x20,
+0x30, 0x2c, 0x20, 0x22, 0x30, 0x78, 0x35, 0x31,
+0x22, 0x2c, 0x20, 0x31, 0x30, 0x30, 0x30, 0x5d,
+0x2c, 0x0a, 0x5b, 0x22, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x31,
+0x2c, 0x20, 0x22, 0x30, 0x78, 0x30, 0x30, 0x20,
+0x30, 0x78, 0x31, 0x34, 0x20, 0x30, 0x78, 0x34,
+0x63, 0x39, 0x63, 0x33, 0x64, 0x66, 0x61, 0x63,
+0x34, 0x32, 0x30, 0x37, 0x64, 0x35, 0x64, 0x38,
+0x63, 0x62, 0x38, 0x39, 0x64, 0x66, 0x35, 0x37,
+0x32, 0x32, 0x63, 0x62, 0x33, 0x64, 0x37, 0x31,
+0x32, 0x33, 0x38, 0x35, 0x65, 0x33, 0x66, 0x22,
+0x2c, 0x20, 0x32, 0x30, 0x30, 0x30, 0x5d, 0x2c,
+0x0a, 0x5b, 0x22, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x32, 0x2c,
+0x20, 0x22, 0x30, 0x78, 0x35, 0x31, 0x22, 0x2c,
+0x20, 0x33, 0x30, 0x30, 0x30, 0x5d, 0x5d, 0x2c,
+0x0a, 0x22, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x33,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x32, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x30, 0x33,
+0x65, 0x38, 0x30, 0x33, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x35, 0x31, 0x64, 0x30, 0x30, 0x37,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x35, 0x31,
+0x62, 0x38, 0x30, 0x62, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x35, 0x31, 0x30, 0x30, 0x30, 0x32,
+0x34, 0x38, 0x33, 0x30, 0x34, 0x35, 0x30, 0x32,
+0x32, 0x31, 0x30, 0x30, 0x39, 0x31, 0x62, 0x33,
+0x32, 0x32, 0x37, 0x34, 0x32, 0x39, 0x35, 0x63,
+0x32, 0x61, 0x33, 0x66, 0x61, 0x30, 0x32, 0x66,
+0x35, 0x62, 0x63, 0x65, 0x39, 0x32, 0x66, 0x62,
+0x32, 0x37, 0x38, 0x39, 0x65, 0x33, 0x66, 0x63,
+0x36, 0x65, 0x61, 0x39, 0x34, 0x37, 0x66, 0x62,
+0x65, 0x31, 0x61, 0x37, 0x36, 0x65, 0x35, 0x32,
+0x65, 0x61, 0x33, 0x66, 0x34, 0x65, 0x66, 0x32,
+0x33, 0x38, 0x31, 0x61, 0x30, 0x32, 0x32, 0x30,
+0x37, 0x39, 0x61, 0x64, 0x37, 0x32, 0x61, 0x65,
+0x66, 0x61, 0x33, 0x38, 0x33, 0x37, 0x61, 0x32,
+0x65, 0x30, 0x63, 0x30, 0x33, 0x33, 0x61, 0x38,
+0x36, 0x35, 0x32, 0x61, 0x35, 0x39, 0x37, 0x33,
+0x31, 0x64, 0x61, 0x30, 0x35, 0x66, 0x61, 0x34,
+0x61, 0x38, 0x31, 0x33, 0x66, 0x34, 0x66, 0x63,
+0x34, 0x38, 0x65, 0x38, 0x37, 0x63, 0x30, 0x37,
+0x35, 0x30, 0x33, 0x37, 0x32, 0x35, 0x36, 0x62,
+0x38, 0x32, 0x32, 0x31, 0x30, 0x33, 0x35, 0x39,
+0x36, 0x64, 0x33, 0x34, 0x35, 0x31, 0x30, 0x32,
+0x35, 0x63, 0x31, 0x39, 0x64, 0x62, 0x62, 0x64,
+0x65, 0x62, 0x39, 0x33, 0x32, 0x64, 0x36, 0x62,
+0x66, 0x38, 0x62, 0x66, 0x62, 0x34, 0x61, 0x64,
+0x34, 0x39, 0x39, 0x62, 0x39, 0x35, 0x62, 0x36,
+0x66, 0x38, 0x38, 0x64, 0x62, 0x38, 0x38, 0x39,
+0x39, 0x65, 0x66, 0x61, 0x63, 0x31, 0x30, 0x32,
+0x65, 0x35, 0x66, 0x63, 0x37, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x22, 0x2c, 0x20, 0x22, 0x50, 0x32, 0x53, 0x48,
+0x2c, 0x57, 0x49, 0x54, 0x4e, 0x45, 0x53, 0x53,
+0x22, 0x5d, 0x2c, 0x0a, 0x0a, 0x5b, 0x22, 0x57,
+0x69, 0x74, 0x6e, 0x65, 0x73, 0x73, 0x20, 0x77,
+0x69, 0x74, 0x68, 0x20, 0x53, 0x69, 0x67, 0x48,
+0x61, 0x73, 0x68, 0x20, 0x4e, 0x6f, 0x6e, 0x65,
+0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b, 0x5b, 0x22,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20, 0x22, 0x30,
+0x78, 0x35, 0x31, 0x22, 0x2c, 0x20, 0x31, 0x30,
+0x30, 0x30, 0x5d, 0x2c, 0x0a, 0x5b, 0x22, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x22,
+0x2c, 0x20, 0x31, 0x2c, 0x20, 0x22, 0x30, 0x78,
+0x30, 0x30, 0x20, 0x30, 0x78, 0x31, 0x34, 0x20,
+0x30, 0x78, 0x34, 0x63, 0x39, 0x63, 0x33, 0x64,
+0x66, 0x61, 0x63, 0x34, 0x32, 0x30, 0x37, 0x64,
+0x35, 0x64, 0x38, 0x63, 0x62, 0x38, 0x39, 0x64,
+0x66, 0x35, 0x37, 0x32, 0x32, 0x63, 0x62, 0x33,
+0x64, 0x37, 0x31, 0x32, 0x33, 0x38, 0x35, 0x65,
+0x33, 0x66, 0x22, 0x2c, 0x20, 0x32, 0x30, 0x30,
+0x30, 0x5d, 0x2c, 0x0a, 0x5b, 0x22, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x22, 0x2c,
+0x20, 0x32, 0x2c, 0x20, 0x22, 0x30, 0x78, 0x35,
+0x31, 0x22, 0x2c, 0x20, 0x33, 0x30, 0x30, 0x30,
+0x5d, 0x5d, 0x2c, 0x0a, 0x22, 0x30, 0x31, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x33, 0x30, 0x30, 0x30, 0x31, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x30,
+0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x32, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x30, 0x34, 0x62, 0x36, 0x30, 0x33, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x31, 0x35, 0x31, 0x39,
+0x65, 0x30, 0x37, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x35, 0x31, 0x38, 0x36, 0x30, 0x62, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x39,
+0x36, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x35, 0x31, 0x30, 0x30, 0x30, 0x32, 0x34,
+0x37, 0x33, 0x30, 0x34, 0x34, 0x30, 0x32, 0x32,
+0x30, 0x32, 0x32, 0x66, 0x63, 0x65, 0x62, 0x35,
+0x34, 0x66, 0x36, 0x32, 0x66, 0x38, 0x66, 0x65,
+0x65, 0x61, 0x37, 0x37, 0x66, 0x61, 0x61, 0x63,
+0x37, 0x30, 0x38, 0x33, 0x63, 0x33, 0x62, 0x35,
+0x36, 0x63, 0x34, 0x36, 0x37, 0x36, 0x61, 0x37,
+0x38, 0x66, 0x39, 0x33, 0x37, 0x34, 0x35, 0x61,
+0x64, 0x63, 0x38, 0x61, 0x33, 0x35, 0x38, 0x30,
+0x30, 0x62, 0x63, 0x33, 0x36, 0x61, 0x64, 0x66,
+0x61, 0x30, 0x32, 0x32, 0x30, 0x32, 0x36, 0x39,
+0x32, 0x37, 0x64, 0x66, 0x39, 0x61, 0x62, 0x63,
+0x66, 0x30, 0x61, 0x38, 0x37, 0x37, 0x37, 0x38,
+0x32, 0x39, 0x62, 0x63, 0x66, 0x63, 0x63, 0x65,
+0x33, 0x66, 0x66, 0x30, 0x61, 0x33, 0x38, 0x35,
+0x66, 0x61, 0x35, 0x34, 0x63, 0x33, 0x66, 0x39,
+0x64, 0x66, 0x35, 0x37, 0x37, 0x34, 0x30, 0x35,
+0x65, 0x33, 0x65, 0x66, 0x32, 0x34, 0x65, 0x65,
+0x35, 0x36, 0x34, 0x37, 0x39, 0x30, 0x32, 0x32,
+0x31, 0x30, 0x33, 0x35, 0x39, 0x36, 0x64, 0x33,
+0x34, 0x35, 0x31, 0x30, 0x32, 0x35, 0x63, 0x31,
+0x39, 0x64, 0x62, 0x62, 0x64, 0x65, 0x62, 0x39,
+0x33, 0x32, 0x64, 0x36, 0x62, 0x66, 0x38, 0x62,
+0x66, 0x62, 0x34, 0x61, 0x64, 0x34, 0x39, 0x39,
+0x62, 0x39, 0x35, 0x62, 0x36, 0x66, 0x38, 0x38,
+0x64, 0x62, 0x38, 0x38, 0x39, 0x39, 0x65, 0x66,
+0x61, 0x63, 0x31, 0x30, 0x32, 0x65, 0x35, 0x66,
+0x63, 0x37, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x22, 0x2c, 0x20,
+0x22, 0x50, 0x32, 0x53, 0x48, 0x2c, 0x57, 0x49,
+0x54, 0x4e, 0x45, 0x53, 0x53, 0x22, 0x5d, 0x2c,
+0x0a, 0x0a, 0x5b, 0x22, 0x57, 0x69, 0x74, 0x6e,
+0x65, 0x73, 0x73, 0x20, 0x77, 0x69, 0x74, 0x68,
+0x20, 0x53, 0x69, 0x67, 0x48, 0x61, 0x73, 0x68,
+0x20, 0x4e, 0x6f, 0x6e, 0x65, 0x20, 0x28, 0x73,
+0x61, 0x6d, 0x65, 0x20, 0x73, 0x69, 0x67, 0x6e,
+0x61, 0x74, 0x75, 0x72, 0x65, 0x20, 0x61, 0x73,
+0x20, 0x70, 0x72, 0x65, 0x76, 0x69, 0x6f, 0x75,
+0x73, 0x29, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b,
+0x5b, 0x22, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20,
+0x22, 0x30, 0x78, 0x35, 0x31, 0x22, 0x2c, 0x20,
+0x31, 0x30, 0x30, 0x30, 0x5d, 0x2c, 0x0a, 0x5b,
+0x22, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30,
+0x30, 0x22, 0x2c, 0x20, 0x31, 0x2c, 0x20, 0x22,
+0x30, 0x78, 0x30, 0x30, 0x20, 0x30, 0x78, 0x31,
+0x34, 0x20, 0x30, 0x78, 0x34, 0x63, 0x39, 0x63,
+0x33, 0x64, 0x66, 0x61, 0x63, 0x34, 0x32, 0x30,
+0x37, 0x64, 0x35, 0x64, 0x38, 0x63, 0x62, 0x38,
+0x39, 0x64, 0x66, 0x35, 0x37, 0x32, 0x32, 0x63,
+0x62, 0x33, 0x64, 0x37, 0x31, 0x32, 0x33, 0x38,
+0x35, 0x65, 0x33, 0x66, 0x22, 0x2c, 0x20, 0x32,
+0x30, 0x30, 0x30, 0x5d, 0x2c, 0x0a, 0x5b, 0x22,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x22, 0x2c, 0x20, 0x32, 0x2c, 0x20, 0x22, 0x30,
+0x78, 0x35, 0x31, 0x22, 0x2c, 0x20, 0x33, 0x30,
+0x30, 0x30, 0x5d, 0x5d, 0x2c, 0x0a, 0x22, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x31, 0x30, 0x33, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x30,
+0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x32, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x30, 0x33, 0x65, 0x38, 0x30,
+0x33, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x35,
+0x31, 0x64, 0x30, 0x30, 0x37, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x31, 0x35, 0x31, 0x62, 0x38, 0x30,
+0x62, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x35,
+0x31, 0x30, 0x30, 0x30, 0x32, 0x34, 0x37, 0x33,
+0x30, 0x34, 0x34, 0x30, 0x32, 0x32, 0x30, 0x32,
+0x32, 0x66, 0x63, 0x65, 0x62, 0x35, 0x34, 0x66,
+0x36, 0x32, 0x66, 0x38, 0x66, 0x65, 0x65, 0x61,
+0x37, 0x37, 0x66, 0x61, 0x61, 0x63, 0x37, 0x30,
+0x38, 0x33, 0x63, 0x33, 0x62, 0x35, 0x36, 0x63,
+0x34, 0x36, 0x37, 0x36, 0x61, 0x37, 0x38, 0x66,
+0x39, 0x33, 0x37, 0x34, 0x35, 0x61, 0x64, 0x63,
+0x38, 0x61, 0x33, 0x35, 0x38, 0x30, 0x30, 0x62,
+0x63, 0x33, 0x36, 0x61, 0x64, 0x66, 0x61, 0x30,
+0x32, 0x32, 0x30, 0x32, 0x36, 0x39, 0x32, 0x37,
+0x64, 0x66, 0x39, 0x61, 0x62, 0x63, 0x66, 0x30,
+0x61, 0x38, 0x37, 0x37, 0x37, 0x38, 0x32, 0x39,
+0x62, 0x63, 0x66, 0x63, 0x63, 0x65, 0x33, 0x66,
+0x66, 0x30, 0x61, 0x33, 0x38, 0x35, 0x66, 0x61,
+0x35, 0x34, 0x63, 0x33, 0x66, 0x39, 0x64, 0x66,
+0x35, 0x37, 0x37, 0x34, 0x30, 0x35, 0x65, 0x33,
+0x65, 0x66, 0x32, 0x34, 0x65, 0x65, 0x35, 0x36,
+0x34, 0x37, 0x39, 0x30, 0x32, 0x32, 0x31, 0x30,
+0x33, 0x35, 0x39, 0x36, 0x64, 0x33, 0x34, 0x35,
+0x31, 0x30, 0x32, 0x35, 0x63, 0x31, 0x39, 0x64,
+0x62, 0x62, 0x64, 0x65, 0x62, 0x39, 0x33, 0x32,
+0x64, 0x36, 0x62, 0x66, 0x38, 0x62, 0x66, 0x62,
+0x34, 0x61, 0x64, 0x34, 0x39, 0x39, 0x62, 0x39,
+0x35, 0x62, 0x36, 0x66, 0x38, 0x38, 0x64, 0x62,
+0x38, 0x38, 0x39, 0x39, 0x65, 0x66, 0x61, 0x63,
+0x31, 0x30, 0x32, 0x65, 0x35, 0x66, 0x63, 0x37,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x22, 0x50,
+0x32, 0x53, 0x48, 0x2c, 0x57, 0x49, 0x54, 0x4e,
+0x45, 0x53, 0x53, 0x22, 0x5d, 0x2c, 0x0a, 0x0a,
+0x5b, 0x22, 0x57, 0x69, 0x74, 0x6e, 0x65, 0x73,
+0x73, 0x20, 0x77, 0x69, 0x74, 0x68, 0x20, 0x53,
+0x69, 0x67, 0x48, 0x61, 0x73, 0x68, 0x20, 0x4e,
+0x6f, 0x6e, 0x65, 0x20, 0x28, 0x73, 0x61, 0x6d,
+0x65, 0x20, 0x73, 0x69, 0x67, 0x6e, 0x61, 0x74,
+0x75, 0x72, 0x65, 0x2c, 0x20, 0x6f, 0x6e, 0x6c,
+0x79, 0x20, 0x73, 0x65, 0x71, 0x75, 0x65, 0x6e,
+0x63, 0x65, 0x73, 0x20, 0x63, 0x68, 0x61, 0x6e,
+0x67, 0x65, 0x64, 0x29, 0x22, 0x5d, 0x2c, 0x0a,
+0x5b, 0x5b, 0x5b, 0x22, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x30,
+0x2c, 0x20, 0x22, 0x30, 0x78, 0x35, 0x31, 0x22,
+0x2c, 0x20, 0x31, 0x30, 0x30, 0x30, 0x5d, 0x2c,
+0x0a, 0x5b, 0x22, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x31, 0x2c,
+0x20, 0x22, 0x30, 0x78, 0x30, 0x30, 0x20, 0x30,
+0x78, 0x31, 0x34, 0x20, 0x30, 0x78, 0x34, 0x63,
+0x39, 0x63, 0x33, 0x64, 0x66, 0x61, 0x63, 0x34,
+0x32, 0x30, 0x37, 0x64, 0x35, 0x64, 0x38, 0x63,
+0x62, 0x38, 0x39, 0x64, 0x66, 0x35, 0x37, 0x32,
+0x32, 0x63, 0x62, 0x33, 0x64, 0x37, 0x31, 0x32,
+0x33, 0x38, 0x35, 0x65, 0x33, 0x66, 0x22, 0x2c,
+0x20, 0x32, 0x30, 0x30, 0x30, 0x5d, 0x2c, 0x0a,
+0x5b, 0x22, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x22, 0x2c, 0x20, 0x32, 0x2c, 0x20,
+0x22, 0x30, 0x78, 0x35, 0x31, 0x22, 0x2c, 0x20,
+0x33, 0x30, 0x30, 0x30, 0x5d, 0x5d, 0x2c, 0x0a,
+0x22, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x33, 0x30,
+0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x32, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x30, 0x30, 0x30, 0x31, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x32, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x32, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x33, 0x65,
+0x38, 0x30, 0x33, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x35, 0x31, 0x64, 0x30, 0x30, 0x37, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x31, 0x35, 0x31, 0x62,
+0x38, 0x30, 0x62, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x35, 0x31, 0x30, 0x30, 0x30, 0x32, 0x34,
+0x37, 0x33, 0x30, 0x34, 0x34, 0x30, 0x32, 0x32,
+0x30, 0x32, 0x32, 0x66, 0x63, 0x65, 0x62, 0x35,
+0x34, 0x66, 0x36, 0x32, 0x66, 0x38, 0x66, 0x65,
+0x65, 0x61, 0x37, 0x37, 0x66, 0x61, 0x61, 0x63,
+0x37, 0x30, 0x38, 0x33, 0x63, 0x33, 0x62, 0x35,
+0x36, 0x63, 0x34, 0x36, 0x37, 0x36, 0x61, 0x37,
+0x38, 0x66, 0x39, 0x33, 0x37, 0x34, 0x35, 0x61,
+0x64, 0x63, 0x38, 0x61, 0x33, 0x35, 0x38, 0x30,
+0x30, 0x62, 0x63, 0x33, 0x36, 0x61, 0x64, 0x66,
+0x61, 0x30, 0x32, 0x32, 0x30, 0x32, 0x36, 0x39,
+0x32, 0x37, 0x64, 0x66, 0x39, 0x61, 0x62, 0x63,
+0x66, 0x30, 0x61, 0x38, 0x37, 0x37, 0x37, 0x38,
+0x32, 0x39, 0x62, 0x63, 0x66, 0x63, 0x63, 0x65,
+0x33, 0x66, 0x66, 0x30, 0x61, 0x33, 0x38, 0x35,
+0x66, 0x61, 0x35, 0x34, 0x63, 0x33, 0x66, 0x39,
+0x64, 0x66, 0x35, 0x37, 0x37, 0x34, 0x30, 0x35,
+0x65, 0x33, 0x65, 0x66, 0x32, 0x34, 0x65, 0x65,
+0x35, 0x36, 0x34, 0x37, 0x39, 0x30, 0x32, 0x32,
+0x31, 0x30, 0x33, 0x35, 0x39, 0x36, 0x64, 0x33,
+0x34, 0x35, 0x31, 0x30, 0x32, 0x35, 0x63, 0x31,
+0x39, 0x64, 0x62, 0x62, 0x64, 0x65, 0x62, 0x39,
+0x33, 0x32, 0x64, 0x36, 0x62, 0x66, 0x38, 0x62,
+0x66, 0x62, 0x34, 0x61, 0x64, 0x34, 0x39, 0x39,
+0x62, 0x39, 0x35, 0x62, 0x36, 0x66, 0x38, 0x38,
+0x64, 0x62, 0x38, 0x38, 0x39, 0x39, 0x65, 0x66,
+0x61, 0x63, 0x31, 0x30, 0x32, 0x65, 0x35, 0x66,
+0x63, 0x37, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x22, 0x2c, 0x20,
+0x22, 0x50, 0x32, 0x53, 0x48, 0x2c, 0x57, 0x49,
+0x54, 0x4e, 0x45, 0x53, 0x53, 0x22, 0x5d, 0x2c,
+0x0a, 0x0a, 0x5b, 0x22, 0x57, 0x69, 0x74, 0x6e,
+0x65, 0x73, 0x73, 0x20, 0x77, 0x69, 0x74, 0x68,
+0x20, 0x53, 0x69, 0x67, 0x48, 0x61, 0x73, 0x68,
+0x20, 0x41, 0x6c, 0x6c, 0x7c, 0x41, 0x6e, 0x79,
+0x6f, 0x6e, 0x65, 0x43, 0x61, 0x6e, 0x50, 0x61,
+0x79, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b, 0x5b,
+0x22, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30,
+0x30, 0x22, 0x2c, 0x20, 0x32, 0x2c, 0x20, 0x22,
+0x30, 0x78, 0x35, 0x31, 0x22, 0x2c, 0x20, 0x33,
+0x31, 0x30, 0x30, 0x5d, 0x2c, 0x0a, 0x5b, 0x22,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20, 0x22, 0x30,
+0x78, 0x35, 0x31, 0x22, 0x2c, 0x20, 0x31, 0x31,
+0x30, 0x30, 0x5d, 0x2c, 0x0a, 0x5b, 0x22, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x22,
+0x2c, 0x20, 0x31, 0x2c, 0x20, 0x22, 0x30, 0x78,
+0x30, 0x30, 0x20, 0x30, 0x78, 0x31, 0x34, 0x20,
+0x30, 0x78, 0x34, 0x63, 0x39, 0x63, 0x33, 0x64,
+0x66, 0x61, 0x63, 0x34, 0x32, 0x30, 0x37, 0x64,
+0x35, 0x64, 0x38, 0x63, 0x62, 0x38, 0x39, 0x64,
+0x66, 0x35, 0x37, 0x32, 0x32, 0x63, 0x62, 0x33,
+0x64, 0x37, 0x31, 0x32, 0x33, 0x38, 0x35, 0x65,
+0x33, 0x66, 0x22, 0x2c, 0x20, 0x32, 0x30, 0x30,
+0x30, 0x5d, 0x2c, 0x0a, 0x5b, 0x22, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x22, 0x2c,
+0x20, 0x33, 0x2c, 0x20, 0x22, 0x30, 0x78, 0x35,
+0x31, 0x22, 0x2c, 0x20, 0x34, 0x31, 0x30, 0x30,
+0x5d, 0x5d, 0x2c, 0x0a, 0x22, 0x30, 0x31, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x34, 0x30, 0x30, 0x30, 0x31, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x32, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x30,
+0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x33, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x30, 0x33, 0x65, 0x38, 0x30,
+0x33, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x35,
+0x31, 0x64, 0x30, 0x30, 0x37, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x31, 0x35, 0x31, 0x62, 0x38, 0x30,
+0x62, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x35,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x32, 0x34,
+0x38, 0x33, 0x30, 0x34, 0x35, 0x30, 0x32, 0x32,
+0x31, 0x30, 0x30, 0x61, 0x33, 0x63, 0x65, 0x63,
+0x36, 0x39, 0x62, 0x35, 0x32, 0x63, 0x62, 0x61,
+0x32, 0x64, 0x32, 0x64, 0x65, 0x36, 0x32, 0x33,
+0x65, 0x65, 0x65, 0x66, 0x38, 0x39, 0x65, 0x30,
+0x62, 0x61, 0x31, 0x36, 0x30, 0x36, 0x31, 0x38,
+0x34, 0x65, 0x61, 0x35, 0x35, 0x34, 0x37, 0x36,
+0x63, 0x30, 0x66, 0x38, 0x31, 0x38, 0x39, 0x66,
+0x64, 0x61, 0x32, 0x33, 0x31, 0x62, 0x63, 0x39,
+0x63, 0x62, 0x62, 0x30, 0x32, 0x32, 0x30, 0x30,
+0x33, 0x31, 0x38, 0x31, 0x61, 0x64, 0x35, 0x39,
+0x37, 0x66, 0x37, 0x63, 0x33, 0x38, 0x30, 0x61,
+0x37, 0x64, 0x31, 0x63, 0x37, 0x34, 0x30, 0x32,
+0x38, 0x36, 0x62, 0x31, 0x64, 0x30, 0x32, 0x32,
+0x62, 0x38, 0x62, 0x30, 0x34, 0x64, 0x65, 0x64,
+0x30, 0x32, 0x38, 0x62, 0x38, 0x33, 0x33, 0x32,
+0x38, 0x32, 0x65, 0x30, 0x35, 0x35, 0x65, 0x30,
+0x33, 0x62, 0x38, 0x65, 0x66, 0x65, 0x66, 0x38,
+0x31, 0x32, 0x31, 0x30, 0x33, 0x35, 0x39, 0x36,
+0x64, 0x33, 0x34, 0x35, 0x31, 0x30, 0x32, 0x35,
+0x63, 0x31, 0x39, 0x64, 0x62, 0x62, 0x64, 0x65,
+0x62, 0x39, 0x33, 0x32, 0x64, 0x36, 0x62, 0x66,
+0x38, 0x62, 0x66, 0x62, 0x34, 0x61, 0x64, 0x34,
+0x39, 0x39, 0x62, 0x39, 0x35, 0x62, 0x36, 0x66,
+0x38, 0x38, 0x64, 0x62, 0x38, 0x38, 0x39, 0x39,
+0x65, 0x66, 0x61, 0x63, 0x31, 0x30, 0x32, 0x65,
+0x35, 0x66, 0x63, 0x37, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x22,
+0x2c, 0x20, 0x22, 0x50, 0x32, 0x53, 0x48, 0x2c,
+0x57, 0x49, 0x54, 0x4e, 0x45, 0x53, 0x53, 0x22,
+0x5d, 0x2c, 0x0a, 0x0a, 0x5b, 0x22, 0x57, 0x69,
+0x74, 0x6e, 0x65, 0x73, 0x73, 0x20, 0x77, 0x69,
+0x74, 0x68, 0x20, 0x53, 0x69, 0x67, 0x48, 0x61,
+0x73, 0x68, 0x20, 0x41, 0x6c, 0x6c, 0x7c, 0x41,
+0x6e, 0x79, 0x6f, 0x6e, 0x65, 0x43, 0x61, 0x6e,
+0x50, 0x61, 0x79, 0x20, 0x28, 0x73, 0x61, 0x6d,
+0x65, 0x20, 0x73, 0x69, 0x67, 0x6e, 0x61, 0x74,
+0x75, 0x72, 0x65, 0x20, 0x61, 0x73, 0x20, 0x70,
+0x72, 0x65, 0x76, 0x69, 0x6f, 0x75, 0x73, 0x29,
+0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b, 0x5b, 0x22,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20, 0x22, 0x30,
+0x78, 0x35, 0x31, 0x22, 0x2c, 0x20, 0x31, 0x30,
+0x30, 0x30, 0x5d, 0x2c, 0x0a, 0x5b, 0x22, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x22,
+0x2c, 0x20, 0x31, 0x2c, 0x20, 0x22, 0x30, 0x78,
+0x30, 0x30, 0x20, 0x30, 0x78, 0x31, 0x34, 0x20,
+0x30, 0x78, 0x34, 0x63, 0x39, 0x63, 0x33, 0x64,
+0x66, 0x61, 0x63, 0x34, 0x32, 0x30, 0x37, 0x64,
+0x35, 0x64, 0x38, 0x63, 0x62, 0x38, 0x39, 0x64,
+0x66, 0x35, 0x37, 0x32, 0x32, 0x63, 0x62, 0x33,
+0x64, 0x37, 0x31, 0x32, 0x33, 0x38, 0x35, 0x65,
+0x33, 0x66, 0x22, 0x2c, 0x20, 0x32, 0x30, 0x30,
+0x30, 0x5d, 0x2c, 0x0a, 0x5b, 0x22, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x22, 0x2c,
+0x20, 0x32, 0x2c, 0x20, 0x22, 0x30, 0x78, 0x35,
+0x31, 0x22, 0x2c, 0x20, 0x33, 0x30, 0x30, 0x30,
+0x5d, 0x5d, 0x2c, 0x0a, 0x22, 0x30, 0x31, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x33, 0x30, 0x30, 0x30, 0x31, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x30,
+0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x32, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x30, 0x33, 0x65, 0x38, 0x30, 0x33, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x31, 0x35, 0x31, 0x64,
+0x30, 0x30, 0x37, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x35, 0x31, 0x62, 0x38, 0x30, 0x62, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x31, 0x35, 0x31, 0x30,
+0x30, 0x30, 0x32, 0x34, 0x38, 0x33, 0x30, 0x34,
+0x35, 0x30, 0x32, 0x32, 0x31, 0x30, 0x30, 0x61,
+0x33, 0x63, 0x65, 0x63, 0x36, 0x39, 0x62, 0x35,
+0x32, 0x63, 0x62, 0x61, 0x32, 0x64, 0x32, 0x64,
+0x65, 0x36, 0x32, 0x33, 0x65, 0x65, 0x65, 0x66,
+0x38, 0x39, 0x65, 0x30, 0x62, 0x61, 0x31, 0x36,
+0x30, 0x36, 0x31, 0x38, 0x34, 0x65, 0x61, 0x35,
+0x35, 0x34, 0x37, 0x36, 0x63, 0x30, 0x66, 0x38,
+0x31, 0x38, 0x39, 0x66, 0x64, 0x61, 0x32, 0x33,
+0x31, 0x62, 0x63, 0x39, 0x63, 0x62, 0x62, 0x30,
+0x32, 0x32, 0x30, 0x30, 0x33, 0x31, 0x38, 0x31,
+0x61, 0x64, 0x35, 0x39, 0x37, 0x66, 0x37, 0x63,
+0x33, 0x38, 0x30, 0x61, 0x37, 0x64, 0x31, 0x63,
+0x37, 0x34, 0x30, 0x32, 0x38, 0x36, 0x62, 0x31,
+0x64, 0x30, 0x32, 0x32, 0x62, 0x38, 0x62, 0x30,
+0x34, 0x64, 0x65, 0x64, 0x30, 0x32, 0x38, 0x62,
+0x38, 0x33, 0x33, 0x32, 0x38, 0x32, 0x65, 0x30,
+0x35, 0x35, 0x65, 0x30, 0x33, 0x62, 0x38, 0x65,
+0x66, 0x65, 0x66, 0x38, 0x31, 0x32, 0x31, 0x30,
+0x33, 0x35, 0x39, 0x36, 0x64, 0x33, 0x34, 0x35,
+0x31, 0x30, 0x32, 0x35, 0x63, 0x31, 0x39, 0x64,
+0x62, 0x62, 0x64, 0x65, 0x62, 0x39, 0x33, 0x32,
+0x64, 0x36, 0x62, 0x66, 0x38, 0x62, 0x66, 0x62,
+0x34, 0x61, 0x64, 0x34, 0x39, 0x39, 0x62, 0x39,
+0x35, 0x62, 0x36, 0x66, 0x38, 0x38, 0x64, 0x62,
+0x38, 0x38, 0x39, 0x39, 0x65, 0x66, 0x61, 0x63,
+0x31, 0x30, 0x32, 0x65, 0x35, 0x66, 0x63, 0x37,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x22, 0x50,
+0x32, 0x53, 0x48, 0x2c, 0x57, 0x49, 0x54, 0x4e,
+0x45, 0x53, 0x53, 0x22, 0x5d, 0x2c, 0x0a, 0x0a,
+0x5b, 0x22, 0x55, 0x6e, 0x6b, 0x6e, 0x6f, 0x77,
+0x6e, 0x20, 0x77, 0x69, 0x74, 0x6e, 0x65, 0x73,
+0x73, 0x20, 0x70, 0x72, 0x6f, 0x67, 0x72, 0x61,
+0x6d, 0x20, 0x76, 0x65, 0x72, 0x73, 0x69, 0x6f,
+0x6e, 0x20, 0x20, 0x28, 0x77, 0x69, 0x74, 0x68,
+0x6f, 0x75, 0x74, 0x20, 0x44, 0x49, 0x53, 0x43,
+0x4f, 0x55, 0x52, 0x41, 0x47, 0x45, 0x5f, 0x55,
+0x50, 0x47, 0x52, 0x41, 0x44, 0x41, 0x42, 0x4c,
+0x45, 0x5f, 0x57, 0x49, 0x54, 0x4e, 0x45, 0x53,
+0x53, 0x5f, 0x50, 0x52, 0x4f, 0x47, 0x52, 0x41,
+0x4d, 0x29, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b,
+0x5b, 0x22, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20,
+0x22, 0x30, 0x78, 0x35, 0x31, 0x22, 0x2c, 0x20,
+0x31, 0x30, 0x30, 0x30, 0x5d, 0x2c, 0x0a, 0x5b,
+0x22, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30,
+0x30, 0x22, 0x2c, 0x20, 0x31, 0x2c, 0x20, 0x22,
+0x30, 0x78, 0x36, 0x30, 0x20, 0x30, 0x78, 0x31,
+0x34, 0x20, 0x30, 0x78, 0x34, 0x63, 0x39, 0x63,
+0x33, 0x64, 0x66, 0x61, 0x63, 0x34, 0x32, 0x30,
+0x37, 0x64, 0x35, 0x64, 0x38, 0x63, 0x62, 0x38,
+0x39, 0x64, 0x66, 0x35, 0x37, 0x32, 0x32, 0x63,
+0x62, 0x33, 0x64, 0x37, 0x31, 0x32, 0x33, 0x38,
+0x35, 0x65, 0x33, 0x66, 0x22, 0x2c, 0x20, 0x32,
+0x30, 0x30, 0x30, 0x5d, 0x2c, 0x0a, 0x5b, 0x22,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x22, 0x2c, 0x20, 0x32, 0x2c, 0x20, 0x22, 0x30,
+0x78, 0x35, 0x31, 0x22, 0x2c, 0x20, 0x33, 0x30,
+0x30, 0x30, 0x5d, 0x5d, 0x2c, 0x0a, 0x22, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x31, 0x30, 0x33, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x30,
+0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x32, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x30, 0x33, 0x65, 0x38, 0x30,
+0x33, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x35,
+0x31, 0x64, 0x30, 0x30, 0x37, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x31, 0x35, 0x31, 0x62, 0x38, 0x30,
+0x62, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x35,
+0x31, 0x30, 0x30, 0x30, 0x32, 0x34, 0x38, 0x33,
+0x30, 0x34, 0x35, 0x30, 0x32, 0x32, 0x31, 0x30,
+0x30, 0x61, 0x33, 0x63, 0x65, 0x63, 0x36, 0x39,
+0x62, 0x35, 0x32, 0x63, 0x62, 0x61, 0x32, 0x64,
+0x32, 0x64, 0x65, 0x36, 0x32, 0x33, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x31, 0x36, 0x30, 0x36, 0x31, 0x38, 0x34, 0x65,
+0x61, 0x35, 0x35, 0x34, 0x37, 0x36, 0x63, 0x30,
+0x66, 0x38, 0x31, 0x38, 0x39, 0x66, 0x64, 0x61,
+0x32, 0x33, 0x31, 0x62, 0x63, 0x39, 0x63, 0x62,
+0x62, 0x30, 0x32, 0x32, 0x30, 0x30, 0x33, 0x31,
+0x38, 0x31, 0x61, 0x64, 0x35, 0x39, 0x37, 0x66,
+0x37, 0x63, 0x33, 0x38, 0x30, 0x61, 0x37, 0x64,
+0x31, 0x63, 0x37, 0x34, 0x30, 0x32, 0x38, 0x36,
+0x62, 0x31, 0x64, 0x30, 0x32, 0x32, 0x62, 0x38,
+0x62, 0x30, 0x34, 0x64, 0x65, 0x64, 0x30, 0x32,
+0x38, 0x62, 0x38, 0x33, 0x33, 0x32, 0x38, 0x32,
+0x65, 0x30, 0x35, 0x35, 0x65, 0x30, 0x33, 0x62,
+0x38, 0x65, 0x66, 0x65, 0x66, 0x38, 0x31, 0x32,
+0x31, 0x30, 0x33, 0x35, 0x39, 0x36, 0x64, 0x33,
+0x34, 0x35, 0x31, 0x30, 0x32, 0x35, 0x63, 0x31,
+0x39, 0x64, 0x62, 0x62, 0x64, 0x65, 0x62, 0x39,
+0x33, 0x32, 0x64, 0x36, 0x62, 0x66, 0x38, 0x62,
+0x66, 0x62, 0x34, 0x61, 0x64, 0x34, 0x39, 0x39,
+0x62, 0x39, 0x35, 0x62, 0x36, 0x66, 0x38, 0x38,
+0x64, 0x62, 0x38, 0x38, 0x39, 0x39, 0x65, 0x66,
+0x61, 0x63, 0x31, 0x30, 0x32, 0x65, 0x35, 0x66,
+0x63, 0x37, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x22, 0x2c, 0x20,
+0x22, 0x50, 0x32, 0x53, 0x48, 0x2c, 0x57, 0x49,
+0x54, 0x4e, 0x45, 0x53, 0x53, 0x22, 0x5d, 0x2c,
+0x0a, 0x0a, 0x5b, 0x22, 0x57, 0x69, 0x74, 0x6e,
+0x65, 0x73, 0x73, 0x20, 0x77, 0x69, 0x74, 0x68,
+0x20, 0x61, 0x20, 0x70, 0x75, 0x73, 0x68, 0x20,
+0x6f, 0x66, 0x20, 0x35, 0x32, 0x30, 0x20, 0x62,
+0x79, 0x74, 0x65, 0x73, 0x22, 0x5d, 0x2c, 0x0a,
+0x5b, 0x5b, 0x5b, 0x22, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x30,
+0x2c, 0x20, 0x22, 0x30, 0x78, 0x30, 0x30, 0x20,
+0x30, 0x78, 0x32, 0x30, 0x20, 0x30, 0x78, 0x33,
+0x33, 0x31, 0x39, 0x38, 0x61, 0x39, 0x62, 0x66,
+0x65, 0x66, 0x36, 0x37, 0x34, 0x65, 0x62, 0x64,
+0x64, 0x62, 0x39, 0x66, 0x66, 0x61, 0x61, 0x35,
+0x32, 0x39, 0x32, 0x38, 0x30, 0x31, 0x37, 0x62,
+0x38, 0x34, 0x37, 0x32, 0x37, 0x39, 0x31, 0x65,
+0x35, 0x34, 0x63, 0x36, 0x30, 0x39, 0x63, 0x62,
+0x39, 0x35, 0x66, 0x32, 0x37, 0x38, 0x61, 0x63,
+0x36, 0x62, 0x31, 0x65, 0x33, 0x34, 0x39, 0x22,
+0x2c, 0x20, 0x31, 0x30, 0x30, 0x30, 0x5d, 0x5d,
+0x2c, 0x0a, 0x22, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x35,
+0x31, 0x30, 0x32, 0x66, 0x64, 0x30, 0x38, 0x30,
+0x32, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x32, 0x37, 0x35, 0x35, 0x31, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x22,
+0x2c, 0x20, 0x22, 0x50, 0x32, 0x53, 0x48, 0x2c,
+0x57, 0x49, 0x54, 0x4e, 0x45, 0x53, 0x53, 0x22,
+0x5d, 0x2c, 0x0a, 0x0a, 0x5b, 0x22, 0x54, 0x72,
+0x61, 0x6e, 0x73, 0x61, 0x63, 0x74, 0x69, 0x6f,
+0x6e, 0x20, 0x6d, 0x69, 0x78, 0x69, 0x6e, 0x67,
+0x20, 0x61, 0x6c, 0x6c, 0x20, 0x53, 0x69, 0x67,
+0x48, 0x61, 0x73, 0x68, 0x2c, 0x20, 0x73, 0x65,
+0x67, 0x77, 0x69, 0x74, 0x20, 0x61, 0x6e, 0x64,
+0x20, 0x6e, 0x6f, 0x72, 0x6d, 0x61, 0x6c, 0x20,
+0x69, 0x6e, 0x70, 0x75, 0x74, 0x73, 0x22, 0x5d,
+0x2c, 0x0a, 0x5b, 0x5b, 0x5b, 0x22, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x22, 0x2c,
+0x20, 0x30, 0x2c, 0x20, 0x22, 0x30, 0x78, 0x30,
+0x30, 0x20, 0x30, 0x78, 0x31, 0x34, 0x20, 0x30,
+0x78, 0x34, 0x63, 0x39, 0x63, 0x33, 0x64, 0x66,
+0x61, 0x63, 0x34, 0x32, 0x30, 0x37, 0x64, 0x35,
+0x64, 0x38, 0x63, 0x62, 0x38, 0x39, 0x64, 0x66,
+0x35, 0x37, 0x32, 0x32, 0x63, 0x62, 0x33, 0x64,
+0x37, 0x31, 0x32, 0x33, 0x38, 0x35, 0x65, 0x33,
+0x66, 0x22, 0x2c, 0x20, 0x31, 0x30, 0x30, 0x30,
+0x5d, 0x2c, 0x0a, 0x5b, 0x22, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x31, 0x30, 0x30, 0x22, 0x2c, 0x20,
+0x31, 0x2c, 0x20, 0x22, 0x30, 0x78, 0x30, 0x30,
+0x20, 0x30, 0x78, 0x31, 0x34, 0x20, 0x30, 0x78,
+0x34, 0x63, 0x39, 0x63, 0x33, 0x64, 0x66, 0x61,
+0x63, 0x34, 0x32, 0x30, 0x37, 0x64, 0x35, 0x64,
+0x38, 0x63, 0x62, 0x38, 0x39, 0x64, 0x66, 0x35,
+0x37, 0x32, 0x32, 0x63, 0x62, 0x33, 0x64, 0x37,
+0x31, 0x32, 0x33, 0x38, 0x35, 0x65, 0x33, 0x66,
+0x22, 0x2c, 0x20, 0x31, 0x30, 0x30, 0x31, 0x5d,
+0x2c, 0x0a, 0x5b, 0x22, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x32,
+0x2c, 0x20, 0x22, 0x44, 0x55, 0x50, 0x20, 0x48,
+0x41, 0x53, 0x48, 0x31, 0x36, 0x30, 0x20, 0x30,
+0x78, 0x31, 0x34, 0x20, 0x30, 0x78, 0x34, 0x63,
+0x39, 0x63, 0x33, 0x64, 0x66, 0x61, 0x63, 0x34,
+0x32, 0x30, 0x37, 0x64, 0x35, 0x64, 0x38, 0x63,
+0x62, 0x38, 0x39, 0x64, 0x66, 0x35, 0x37, 0x32,
+0x32, 0x63, 0x62, 0x33, 0x64, 0x37, 0x31, 0x32,
+0x33, 0x38, 0x35, 0x65, 0x33, 0x66, 0x20, 0x45,
+0x51, 0x55, 0x41, 0x4c, 0x56, 0x45, 0x52, 0x49,
+0x46, 0x59, 0x20, 0x43, 0x48, 0x45, 0x43, 0x4b,
+0x53, 0x49, 0x47, 0x22, 0x2c, 0x20, 0x31, 0x30,
+0x30, 0x32, 0x5d, 0x2c, 0x0a, 0x5b, 0x22, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x22,
+0x2c, 0x20, 0x33, 0x2c, 0x20, 0x22, 0x44, 0x55,
+0x50, 0x20, 0x48, 0x41, 0x53, 0x48, 0x31, 0x36,
+0x30, 0x20, 0x30, 0x78, 0x31, 0x34, 0x20, 0x30,
+0x78, 0x34, 0x63, 0x39, 0x63, 0x33, 0x64, 0x66,
+0x61, 0x63, 0x34, 0x32, 0x30, 0x37, 0x64, 0x35,
+0x64, 0x38, 0x63, 0x62, 0x38, 0x39, 0x64, 0x66,
+0x35, 0x37, 0x32, 0x32, 0x63, 0x62, 0x33, 0x64,
+0x37, 0x31, 0x32, 0x33, 0x38, 0x35, 0x65, 0x33,
+0x66, 0x20, 0x45, 0x51, 0x55, 0x41, 0x4c, 0x56,
+0x45, 0x52, 0x49, 0x46, 0x59, 0x20, 0x43, 0x48,
+0x45, 0x43, 0x4b, 0x53, 0x49, 0x47, 0x22, 0x2c,
+0x20, 0x31, 0x30, 0x30, 0x33, 0x5d, 0x2c, 0x0a,
+0x5b, 0x22, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x22, 0x2c, 0x20, 0x34, 0x2c, 0x20,
+0x22, 0x44, 0x55, 0x50, 0x20, 0x48, 0x41, 0x53,
+0x48, 0x31, 0x36, 0x30, 0x20, 0x30, 0x78, 0x31,
+0x34, 0x20, 0x30, 0x78, 0x34, 0x63, 0x39, 0x63,
+0x33, 0x64, 0x66, 0x61, 0x63, 0x34, 0x32, 0x30,
+0x37, 0x64, 0x35, 0x64, 0x38, 0x63, 0x62, 0x38,
+0x39, 0x64, 0x66, 0x35, 0x37, 0x32, 0x32, 0x63,
+0x62, 0x33, 0x64, 0x37, 0x31, 0x32, 0x33, 0x38,
+0x35, 0x65, 0x33, 0x66, 0x20, 0x45, 0x51, 0x55,
+0x41, 0x4c, 0x56, 0x45, 0x52, 0x49, 0x46, 0x59,
+0x20, 0x43, 0x48, 0x45, 0x43, 0x4b, 0x53, 0x49,
+0x47, 0x22, 0x2c, 0x20, 0x31, 0x30, 0x30, 0x34,
+0x5d, 0x2c, 0x0a, 0x5b, 0x22, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x31, 0x30, 0x30, 0x22, 0x2c, 0x20,
+0x35, 0x2c, 0x20, 0x22, 0x44, 0x55, 0x50, 0x20,
+0x48, 0x41, 0x53, 0x48, 0x31, 0x36, 0x30, 0x20,
+0x30, 0x78, 0x31, 0x34, 0x20, 0x30, 0x78, 0x34,
+0x63, 0x39, 0x63, 0x33, 0x64, 0x66, 0x61, 0x63,
+0x34, 0x32, 0x30, 0x37, 0x64, 0x35, 0x64, 0x38,
+0x63, 0x62, 0x38, 0x39, 0x64, 0x66, 0x35, 0x37,
+0x32, 0x32, 0x63, 0x62, 0x33, 0x64, 0x37, 0x31,
+0x32, 0x33, 0x38, 0x35, 0x65, 0x33, 0x66, 0x20,
+0x45, 0x51, 0x55, 0x41, 0x4c, 0x56, 0x45, 0x52,
+0x49, 0x46, 0x59, 0x20, 0x43, 0x48, 0x45, 0x43,
+0x4b, 0x53, 0x49, 0x47, 0x22, 0x2c, 0x20, 0x31,
+0x30, 0x30, 0x35, 0x5d, 0x2c, 0x0a, 0x5b, 0x22,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x22, 0x2c, 0x20, 0x36, 0x2c, 0x20, 0x22, 0x44,
+0x55, 0x50, 0x20, 0x48, 0x41, 0x53, 0x48, 0x31,
+0x36, 0x30, 0x20, 0x30, 0x78, 0x31, 0x34, 0x20,
+0x30, 0x78, 0x34, 0x63, 0x39, 0x63, 0x33, 0x64,
+0x66, 0x61, 0x63, 0x34, 0x32, 0x30, 0x37, 0x64,
+0x35, 0x64, 0x38, 0x63, 0x62, 0x38, 0x39, 0x64,
+0x66, 0x35, 0x37, 0x32, 0x32, 0x63, 0x62, 0x33,
+0x64, 0x37, 0x31, 0x32, 0x33, 0x38, 0x35, 0x65,
+0x33, 0x66, 0x20, 0x45, 0x51, 0x55, 0x41, 0x4c,
+0x56, 0x45, 0x52, 0x49, 0x46, 0x59, 0x20, 0x43,
+0x48, 0x45, 0x43, 0x4b, 0x53, 0x49, 0x47, 0x22,
+0x2c, 0x20, 0x31, 0x30, 0x30, 0x36, 0x5d, 0x2c,
+0x0a, 0x5b, 0x22, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x37, 0x2c,
+0x20, 0x22, 0x30, 0x78, 0x30, 0x30, 0x20, 0x30,
+0x78, 0x31, 0x34, 0x20, 0x30, 0x78, 0x34, 0x63,
+0x39, 0x63, 0x33, 0x64, 0x66, 0x61, 0x63, 0x34,
+0x32, 0x30, 0x37, 0x64, 0x35, 0x64, 0x38, 0x63,
+0x62, 0x38, 0x39, 0x64, 0x66, 0x35, 0x37, 0x32,
+0x32, 0x63, 0x62, 0x33, 0x64, 0x37, 0x31, 0x32,
+0x33, 0x38, 0x35, 0x65, 0x33, 0x66, 0x22, 0x2c,
+0x20, 0x31, 0x30, 0x30, 0x37, 0x5d, 0x2c, 0x0a,
+0x5b, 0x22, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x22, 0x2c, 0x20, 0x38, 0x2c, 0x20,
+0x22, 0x30, 0x78, 0x30, 0x30, 0x20, 0x30, 0x78,
+0x31, 0x34, 0x20, 0x30, 0x78, 0x34, 0x63, 0x39,
+0x63, 0x33, 0x64, 0x66, 0x61, 0x63, 0x34, 0x32,
+0x30, 0x37, 0x64, 0x35, 0x64, 0x38, 0x63, 0x62,
+0x38, 0x39, 0x64, 0x66, 0x35, 0x37, 0x32, 0x32,
+0x63, 0x62, 0x33, 0x64, 0x37, 0x31, 0x32, 0x33,
+0x38, 0x35, 0x65, 0x33, 0x66, 0x22, 0x2c, 0x20,
+0x31, 0x30, 0x30, 0x38, 0x5d, 0x2c, 0x0a, 0x5b,
+0x22, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30,
+0x30, 0x22, 0x2c, 0x20, 0x39, 0x2c, 0x20, 0x22,
+0x30, 0x78, 0x30, 0x30, 0x20, 0x30, 0x78, 0x31,
+0x34, 0x20, 0x30, 0x78, 0x34, 0x63, 0x39, 0x63,
+0x33, 0x64, 0x66, 0x61, 0x63, 0x34, 0x32, 0x30,
+0x37, 0x64, 0x35, 0x64, 0x38, 0x63, 0x62, 0x38,
+0x39, 0x64, 0x66, 0x35, 0x37, 0x32, 0x32, 0x63,
+0x62, 0x33, 0x64, 0x37, 0x31, 0x32, 0x33, 0x38,
+0x35, 0x65, 0x33, 0x66, 0x22, 0x2c, 0x20, 0x31,
+0x30, 0x30, 0x39, 0x5d, 0x2c, 0x0a, 0x5b, 0x22,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x22, 0x2c, 0x20, 0x31, 0x30, 0x2c, 0x20, 0x22,
+0x30, 0x78, 0x30, 0x30, 0x20, 0x30, 0x78, 0x31,
+0x34, 0x20, 0x30, 0x78, 0x34, 0x63, 0x39, 0x63,
+0x33, 0x64, 0x66, 0x61, 0x63, 0x34, 0x32, 0x30,
+0x37, 0x64, 0x35, 0x64, 0x38, 0x63, 0x62, 0x38,
+0x39, 0x64, 0x66, 0x35, 0x37, 0x32, 0x32, 0x63,
+0x62, 0x33, 0x64, 0x37, 0x31, 0x32, 0x33, 0x38,
+0x35, 0x65, 0x33, 0x66, 0x22, 0x2c, 0x20, 0x31,
+0x30, 0x31, 0x30, 0x5d, 0x2c, 0x0a, 0x5b, 0x22,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x22, 0x2c, 0x20, 0x31, 0x31, 0x2c, 0x20, 0x22,
+0x44, 0x55, 0x50, 0x20, 0x48, 0x41, 0x53, 0x48,
+0x31, 0x36, 0x30, 0x20, 0x30, 0x78, 0x31, 0x34,
+0x20, 0x30, 0x78, 0x34, 0x63, 0x39, 0x63, 0x33,
+0x64, 0x66, 0x61, 0x63, 0x34, 0x32, 0x30, 0x37,
+0x64, 0x35, 0x64, 0x38, 0x63, 0x62, 0x38, 0x39,
+0x64, 0x66, 0x35, 0x37, 0x32, 0x32, 0x63, 0x62,
+0x33, 0x64, 0x37, 0x31, 0x32, 0x33, 0x38, 0x35,
+0x65, 0x33, 0x66, 0x20, 0x45, 0x51, 0x55, 0x41,
+0x4c, 0x56, 0x45, 0x52, 0x49, 0x46, 0x59, 0x20,
+0x43, 0x48, 0x45, 0x43, 0x4b, 0x53, 0x49, 0x47,
+0x22, 0x2c, 0x20, 0x31, 0x30, 0x31, 0x31, 0x5d,
+0x5d, 0x2c, 0x0a, 0x22, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x63, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x30, 0x30,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x32,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x36, 0x61,
+0x34, 0x37, 0x33, 0x30, 0x34, 0x34, 0x30, 0x32,
+0x32, 0x30, 0x32, 0x36, 0x63, 0x32, 0x65, 0x36,
+0x35, 0x62, 0x33, 0x33, 0x66, 0x63, 0x64, 0x30,
+0x33, 0x62, 0x32, 0x61, 0x33, 0x62, 0x30, 0x66,
+0x32, 0x35, 0x30, 0x33, 0x30, 0x66, 0x30, 0x32,
+0x34, 0x34, 0x62, 0x64, 0x32, 0x33, 0x63, 0x63,
+0x34, 0x35, 0x61, 0x65, 0x34, 0x64, 0x65, 0x63,
+0x30, 0x66, 0x34, 0x38, 0x61, 0x65, 0x36, 0x32,
+0x32, 0x35, 0x35, 0x62, 0x31, 0x39, 0x39, 0x38,
+0x61, 0x30, 0x30, 0x32, 0x32, 0x30, 0x34, 0x36,
+0x33, 0x61, 0x61, 0x33, 0x39, 0x38, 0x32, 0x62,
+0x37, 0x31, 0x38, 0x64, 0x35, 0x39, 0x33, 0x61,
+0x36, 0x62, 0x39, 0x65, 0x30, 0x30, 0x34, 0x34,
+0x35, 0x31, 0x33, 0x66, 0x64, 0x36, 0x37, 0x61,
+0x35, 0x30, 0x30, 0x39, 0x63, 0x32, 0x66, 0x64,
+0x63, 0x63, 0x63, 0x35, 0x39, 0x39, 0x39, 0x32,
+0x63, 0x66, 0x66, 0x63, 0x32, 0x62, 0x31, 0x36,
+0x37, 0x38, 0x38, 0x39, 0x66, 0x34, 0x30, 0x31,
+0x32, 0x31, 0x30, 0x33, 0x35, 0x39, 0x36, 0x64,
+0x33, 0x34, 0x35, 0x31, 0x30, 0x32, 0x35, 0x63,
+0x31, 0x39, 0x64, 0x62, 0x62, 0x64, 0x65, 0x62,
+0x39, 0x33, 0x32, 0x64, 0x36, 0x62, 0x66, 0x38,
+0x62, 0x66, 0x62, 0x34, 0x61, 0x64, 0x34, 0x39,
+0x39, 0x62, 0x39, 0x35, 0x62, 0x36, 0x66, 0x38,
+0x38, 0x64, 0x62, 0x38, 0x38, 0x39, 0x39, 0x65,
+0x66, 0x61, 0x63, 0x31, 0x30, 0x32, 0x65, 0x35,
+0x66, 0x63, 0x37, 0x31, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x33, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x36, 0x61, 0x34, 0x37,
+0x33, 0x30, 0x34, 0x34, 0x30, 0x32, 0x32, 0x30,
+0x30, 0x30, 0x38, 0x62, 0x64, 0x38, 0x33, 0x38,
+0x32, 0x39, 0x31, 0x31, 0x32, 0x31, 0x38, 0x64,
+0x63, 0x62, 0x34, 0x63, 0x39, 0x66, 0x32, 0x65,
+0x37, 0x35, 0x62, 0x66, 0x35, 0x63, 0x35, 0x63,
+0x33, 0x36, 0x33, 0x35, 0x66, 0x32, 0x66, 0x32,
+0x64, 0x66, 0x34, 0x39, 0x62, 0x33, 0x36, 0x39,
+0x39, 0x34, 0x66, 0x64, 0x65, 0x38, 0x35, 0x62,
+0x30, 0x62, 0x65, 0x32, 0x31, 0x61, 0x31, 0x61,
+0x30, 0x32, 0x32, 0x30, 0x35, 0x61, 0x35, 0x33,
+0x39, 0x65, 0x66, 0x31, 0x30, 0x66, 0x62, 0x34,
+0x63, 0x37, 0x37, 0x38, 0x62, 0x35, 0x32, 0x32,
+0x63, 0x31, 0x62, 0x65, 0x38, 0x35, 0x32, 0x33,
+0x35, 0x32, 0x65, 0x61, 0x30, 0x36, 0x63, 0x36,
+0x37, 0x61, 0x62, 0x37, 0x34, 0x32, 0x30, 0x30,
+0x39, 0x37, 0x37, 0x63, 0x37, 0x32, 0x32, 0x62,
+0x30, 0x62, 0x63, 0x36, 0x38, 0x39, 0x37, 0x32,
+0x35, 0x37, 0x35, 0x61, 0x30, 0x31, 0x32, 0x31,
+0x30, 0x33, 0x35, 0x39, 0x36, 0x64, 0x33, 0x34,
+0x35, 0x31, 0x30, 0x32, 0x35, 0x63, 0x31, 0x39,
+0x64, 0x62, 0x62, 0x64, 0x65, 0x62, 0x39, 0x33,
+0x32, 0x64, 0x36, 0x62, 0x66, 0x38, 0x62, 0x66,
+0x62, 0x34, 0x61, 0x64, 0x34, 0x39, 0x39, 0x62,
+0x39, 0x35, 0x62, 0x36, 0x66, 0x38, 0x38, 0x64,
+0x62, 0x38, 0x38, 0x39, 0x39, 0x65, 0x66, 0x61,
+0x63, 0x31, 0x30, 0x32, 0x65, 0x35, 0x66, 0x63,
+0x37, 0x31, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x34, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x36, 0x62, 0x34, 0x38, 0x33, 0x30,
+0x34, 0x35, 0x30, 0x32, 0x32, 0x31, 0x30, 0x30,
+0x64, 0x39, 0x34, 0x33, 0x36, 0x63, 0x33, 0x32,
+0x66, 0x66, 0x30, 0x36, 0x35, 0x31, 0x32, 0x37,
+0x64, 0x37, 0x31, 0x65, 0x31, 0x61, 0x32, 0x30,
+0x65, 0x33, 0x31, 0x39, 0x65, 0x34, 0x66, 0x65,
+0x30, 0x61, 0x31, 0x30, 0x33, 0x62, 0x61, 0x30,
+0x32, 0x37, 0x32, 0x37, 0x34, 0x33, 0x64, 0x62,
+0x64, 0x38, 0x35, 0x38, 0x30, 0x62, 0x65, 0x34,
+0x36, 0x35, 0x39, 0x61, 0x62, 0x35, 0x64, 0x33,
+0x30, 0x32, 0x32, 0x30, 0x33, 0x66, 0x64, 0x36,
+0x32, 0x35, 0x37, 0x31, 0x65, 0x65, 0x31, 0x66,
+0x65, 0x37, 0x39, 0x30, 0x62, 0x31, 0x38, 0x32,
+0x64, 0x30, 0x37, 0x38, 0x65, 0x63, 0x66, 0x64,
+0x30, 0x39, 0x32, 0x61, 0x35, 0x30, 0x39, 0x65,
+0x61, 0x63, 0x31, 0x31, 0x32, 0x62, 0x65, 0x61,
+0x35, 0x35, 0x38, 0x64, 0x31, 0x32, 0x32, 0x39,
+0x37, 0x34, 0x65, 0x66, 0x39, 0x63, 0x63, 0x30,
+0x31, 0x32, 0x63, 0x37, 0x30, 0x31, 0x32, 0x31,
+0x30, 0x33, 0x35, 0x39, 0x36, 0x64, 0x33, 0x34,
+0x35, 0x31, 0x30, 0x32, 0x35, 0x63, 0x31, 0x39,
+0x64, 0x62, 0x62, 0x64, 0x65, 0x62, 0x39, 0x33,
+0x32, 0x64, 0x36, 0x62, 0x66, 0x38, 0x62, 0x66,
+0x62, 0x34, 0x61, 0x64, 0x34, 0x39, 0x39, 0x62,
+0x39, 0x35, 0x62, 0x36, 0x66, 0x38, 0x38, 0x64,
+0x62, 0x38, 0x38, 0x39, 0x39, 0x65, 0x66, 0x61,
+0x63, 0x31, 0x30, 0x32, 0x65, 0x35, 0x66, 0x63,
+0x37, 0x31, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x35, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x36, 0x61, 0x34, 0x37, 0x33, 0x30,
+0x34, 0x34, 0x30, 0x32, 0x32, 0x30, 0x30, 0x65,
+0x32, 0x63, 0x31, 0x34, 0x39, 0x62, 0x31, 0x31,
+0x34, 0x65, 0x63, 0x35, 0x34, 0x36, 0x30, 0x31,
+0x35, 0x63, 0x31, 0x33, 0x62, 0x32, 0x62, 0x34,
+0x36, 0x34, 0x62, 0x62, 0x63, 0x62, 0x30, 0x63,
+0x64, 0x63, 0x35, 0x38, 0x37, 0x32, 0x65, 0x36,
+0x37, 0x37, 0x35, 0x37, 0x38, 0x37, 0x35, 0x32,
+0x37, 0x61, 0x66, 0x36, 0x63, 0x62, 0x63, 0x34,
+0x38, 0x33, 0x30, 0x62, 0x36, 0x63, 0x30, 0x32,
+0x32, 0x30, 0x37, 0x65, 0x39, 0x33, 0x39, 0x36,
+0x63, 0x36, 0x39, 0x37, 0x39, 0x66, 0x62, 0x31,
+0x35, 0x61, 0x39, 0x61, 0x32, 0x62, 0x39, 0x36,
+0x63, 0x61, 0x30, 0x38, 0x61, 0x36, 0x33, 0x33,
+0x38, 0x36, 0x36, 0x65, 0x61, 0x66, 0x32, 0x30,
+0x64, 0x63, 0x30, 0x66, 0x66, 0x33, 0x63, 0x30,
+0x33, 0x65, 0x35, 0x31, 0x32, 0x63, 0x31, 0x64,
+0x35, 0x61, 0x31, 0x36, 0x35, 0x34, 0x66, 0x31,
+0x34, 0x38, 0x30, 0x31, 0x32, 0x31, 0x30, 0x33,
+0x35, 0x39, 0x36, 0x64, 0x33, 0x34, 0x35, 0x31,
+0x30, 0x32, 0x35, 0x63, 0x31, 0x39, 0x64, 0x62,
+0x62, 0x64, 0x65, 0x62, 0x39, 0x33, 0x32, 0x64,
+0x36, 0x62, 0x66, 0x38, 0x62, 0x66, 0x62, 0x34,
+0x61, 0x64, 0x34, 0x39, 0x39, 0x62, 0x39, 0x35,
+0x62, 0x36, 0x66, 0x38, 0x38, 0x64, 0x62, 0x38,
+0x38, 0x39, 0x39, 0x65, 0x66, 0x61, 0x63, 0x31,
+0x30, 0x32, 0x65, 0x35, 0x66, 0x63, 0x37, 0x31,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x36, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x36, 0x62, 0x34, 0x38, 0x33, 0x30, 0x34, 0x35,
+0x30, 0x32, 0x32, 0x31, 0x30, 0x30, 0x62, 0x32,
+0x30, 0x65, 0x37, 0x30, 0x64, 0x38, 0x39, 0x37,
+0x64, 0x63, 0x31, 0x35, 0x34, 0x32, 0x30, 0x62,
+0x63, 0x63, 0x62, 0x35, 0x65, 0x30, 0x64, 0x33,
+0x65, 0x32, 0x30, 0x38, 0x64, 0x32, 0x37, 0x62,
+0x64, 0x64, 0x36, 0x37, 0x36, 0x61, 0x66, 0x31,
+0x30, 0x39, 0x61, 0x62, 0x62, 0x64, 0x33, 0x66,
+0x38, 0x38, 0x64, 0x62, 0x64, 0x62, 0x37, 0x37,
+0x32, 0x31, 0x65, 0x36, 0x64, 0x36, 0x30, 0x32,
+0x32, 0x30, 0x30, 0x35, 0x38, 0x33, 0x36, 0x65,
+0x36, 0x36, 0x33, 0x31, 0x37, 0x33, 0x66, 0x62,
+0x64, 0x66, 0x65, 0x30, 0x36, 0x39, 0x66, 0x35,
+0x34, 0x63, 0x64, 0x65, 0x33, 0x63, 0x32, 0x64,
+0x65, 0x63, 0x64, 0x33, 0x64, 0x30, 0x65, 0x61,
+0x38, 0x34, 0x33, 0x37, 0x38, 0x30, 0x39, 0x32,
+0x61, 0x35, 0x64, 0x39, 0x64, 0x38, 0x35, 0x65,
+0x63, 0x38, 0x36, 0x34, 0x32, 0x65, 0x38, 0x61,
+0x34, 0x31, 0x30, 0x31, 0x32, 0x31, 0x30, 0x33,
+0x35, 0x39, 0x36, 0x64, 0x33, 0x34, 0x35, 0x31,
+0x30, 0x32, 0x35, 0x63, 0x31, 0x39, 0x64, 0x62,
+0x62, 0x64, 0x65, 0x62, 0x39, 0x33, 0x32, 0x64,
+0x36, 0x62, 0x66, 0x38, 0x62, 0x66, 0x62, 0x34,
+0x61, 0x64, 0x34, 0x39, 0x39, 0x62, 0x39, 0x35,
+0x62, 0x36, 0x66, 0x38, 0x38, 0x64, 0x62, 0x38,
+0x38, 0x39, 0x39, 0x65, 0x66, 0x61, 0x63, 0x31,
+0x30, 0x32, 0x65, 0x35, 0x66, 0x63, 0x37, 0x31,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x37, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x38, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x39, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x30, 0x30,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x61,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x62, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x36, 0x61, 0x34, 0x37, 0x33, 0x30, 0x34, 0x34,
+0x30, 0x32, 0x32, 0x30, 0x36, 0x36, 0x33, 0x39,
+0x63, 0x36, 0x65, 0x30, 0x35, 0x65, 0x33, 0x62,
+0x39, 0x64, 0x32, 0x36, 0x37, 0x35, 0x61, 0x37,
+0x66, 0x33, 0x38, 0x37, 0x36, 0x32, 0x38, 0x36,
+0x62, 0x64, 0x66, 0x37, 0x35, 0x38, 0x34, 0x66,
+0x65, 0x32, 0x62, 0x62, 0x64, 0x31, 0x35, 0x65,
+0x30, 0x63, 0x65, 0x35, 0x32, 0x64, 0x64, 0x34,
+0x65, 0x30, 0x32, 0x63, 0x30, 0x30, 0x39, 0x32,
+0x63, 0x64, 0x63, 0x36, 0x30, 0x32, 0x32, 0x30,
+0x37, 0x35, 0x37, 0x64, 0x36, 0x30, 0x62, 0x30,
+0x61, 0x36, 0x31, 0x66, 0x63, 0x39, 0x35, 0x61,
+0x64, 0x61, 0x37, 0x39, 0x64, 0x32, 0x33, 0x37,
+0x34, 0x36, 0x37, 0x34, 0x34, 0x63, 0x37, 0x32,
+0x62, 0x61, 0x63, 0x31, 0x35, 0x34, 0x35, 0x61,
+0x37, 0x35, 0x66, 0x66, 0x36, 0x63, 0x32, 0x63,
+0x37, 0x63, 0x64, 0x62, 0x36, 0x61, 0x65, 0x30,
+0x34, 0x65, 0x37, 0x65, 0x39, 0x35, 0x39, 0x32,
+0x30, 0x31, 0x32, 0x31, 0x30, 0x33, 0x35, 0x39,
+0x36, 0x64, 0x33, 0x34, 0x35, 0x31, 0x30, 0x32,
+0x35, 0x63, 0x31, 0x39, 0x64, 0x62, 0x62, 0x64,
+0x65, 0x62, 0x39, 0x33, 0x32, 0x64, 0x36, 0x62,
+0x66, 0x38, 0x62, 0x66, 0x62, 0x34, 0x61, 0x64,
+0x34, 0x39, 0x39, 0x62, 0x39, 0x35, 0x62, 0x36,
+0x66, 0x38, 0x38, 0x64, 0x62, 0x38, 0x38, 0x39,
+0x39, 0x65, 0x66, 0x61, 0x63, 0x31, 0x30, 0x32,
+0x65, 0x35, 0x66, 0x63, 0x37, 0x31, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x30, 0x63,
+0x65, 0x38, 0x30, 0x33, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x35, 0x31, 0x65, 0x39, 0x30, 0x33,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x35, 0x31,
+0x65, 0x61, 0x30, 0x33, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x35, 0x31, 0x65, 0x62, 0x30, 0x33,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x35, 0x31,
+0x65, 0x63, 0x30, 0x33, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x35, 0x31, 0x65, 0x64, 0x30, 0x33,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x35, 0x31,
+0x65, 0x65, 0x30, 0x33, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x35, 0x31, 0x65, 0x66, 0x30, 0x33,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x35, 0x31,
+0x66, 0x30, 0x30, 0x33, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x35, 0x31, 0x66, 0x31, 0x30, 0x33,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x35, 0x31,
+0x66, 0x32, 0x30, 0x33, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x35, 0x31, 0x66, 0x33, 0x30, 0x33,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x35, 0x31,
+0x30, 0x32, 0x34, 0x38, 0x33, 0x30, 0x34, 0x35,
+0x30, 0x32, 0x32, 0x31, 0x30, 0x30, 0x38, 0x32,
+0x32, 0x31, 0x39, 0x61, 0x35, 0x34, 0x66, 0x36,
+0x31, 0x62, 0x66, 0x31, 0x32, 0x36, 0x62, 0x66,
+0x63, 0x33, 0x66, 0x61, 0x30, 0x36, 0x38, 0x63,
+0x36, 0x65, 0x33, 0x33, 0x38, 0x33, 0x31, 0x32,
+0x32, 0x32, 0x64, 0x31, 0x64, 0x37, 0x31, 0x33,
+0x38, 0x63, 0x36, 0x66, 0x61, 0x61, 0x39, 0x64,
+0x33, 0x33, 0x63, 0x61, 0x38, 0x37, 0x66, 0x64,
+0x34, 0x32, 0x30, 0x32, 0x64, 0x36, 0x30, 0x32,
+0x32, 0x30, 0x36, 0x33, 0x66, 0x39, 0x39, 0x30,
+0x32, 0x35, 0x31, 0x39, 0x36, 0x32, 0x34, 0x32,
+0x35, 0x34, 0x64, 0x37, 0x63, 0x32, 0x63, 0x38,
+0x65, 0x61, 0x37, 0x62, 0x61, 0x32, 0x64, 0x36,
+0x36, 0x61, 0x65, 0x39, 0x37, 0x35, 0x65, 0x34,
+0x65, 0x32, 0x32, 0x39, 0x61, 0x65, 0x33, 0x38,
+0x30, 0x34, 0x33, 0x39, 0x37, 0x33, 0x65, 0x63,
+0x37, 0x30, 0x37, 0x64, 0x35, 0x64, 0x34, 0x61,
+0x38, 0x33, 0x30, 0x31, 0x32, 0x31, 0x30, 0x33,
+0x35, 0x39, 0x36, 0x64, 0x33, 0x34, 0x35, 0x31,
+0x30, 0x32, 0x35, 0x63, 0x31, 0x39, 0x64, 0x62,
+0x62, 0x64, 0x65, 0x62, 0x39, 0x33, 0x32, 0x64,
+0x36, 0x62, 0x66, 0x38, 0x62, 0x66, 0x62, 0x34,
+0x61, 0x64, 0x34, 0x39, 0x39, 0x62, 0x39, 0x35,
+0x62, 0x36, 0x66, 0x38, 0x38, 0x64, 0x62, 0x38,
+0x38, 0x39, 0x39, 0x65, 0x66, 0x61, 0x63, 0x31,
+0x30, 0x32, 0x65, 0x35, 0x66, 0x63, 0x37, 0x31,
+0x30, 0x32, 0x34, 0x37, 0x33, 0x30, 0x34, 0x34,
+0x30, 0x32, 0x32, 0x30, 0x31, 0x37, 0x66, 0x62,
+0x35, 0x38, 0x35, 0x30, 0x32, 0x34, 0x37, 0x35,
+0x38, 0x34, 0x38, 0x63, 0x31, 0x62, 0x30, 0x39,
+0x66, 0x31, 0x36, 0x32, 0x63, 0x62, 0x31, 0x36,
+0x38, 0x38, 0x64, 0x30, 0x39, 0x32, 0x30, 0x66,
+0x66, 0x37, 0x66, 0x31, 0x34, 0x32, 0x62, 0x65,
+0x64, 0x30, 0x65, 0x66, 0x39, 0x30, 0x34, 0x64,
+0x61, 0x32, 0x63, 0x63, 0x63, 0x38, 0x38, 0x62,
+0x31, 0x36, 0x38, 0x66, 0x30, 0x32, 0x32, 0x30,
+0x31, 0x37, 0x39, 0x38, 0x61, 0x66, 0x61, 0x36,
+0x31, 0x38, 0x35, 0x30, 0x63, 0x36, 0x35, 0x65,
+0x37, 0x37, 0x38, 0x38, 0x39, 0x63, 0x62, 0x63,
+0x64, 0x36, 0x34, 0x38, 0x61, 0x35, 0x37, 0x30,
+0x33, 0x62, 0x34, 0x38, 0x37, 0x38, 0x39, 0x35,
+0x35, 0x31, 0x37, 0x63, 0x38, 0x38, 0x66, 0x38,
+0x35, 0x63, 0x64, 0x64, 0x31, 0x38, 0x62, 0x30,
+0x32, 0x31, 0x65, 0x65, 0x32, 0x34, 0x36, 0x61,
+0x30, 0x31, 0x32, 0x31, 0x30, 0x33, 0x35, 0x39,
+0x36, 0x64, 0x33, 0x34, 0x35, 0x31, 0x30, 0x32,
+0x35, 0x63, 0x31, 0x39, 0x64, 0x62, 0x62, 0x64,
+0x65, 0x62, 0x39, 0x33, 0x32, 0x64, 0x36, 0x62,
+0x66, 0x38, 0x62, 0x66, 0x62, 0x34, 0x61, 0x64,
+0x34, 0x39, 0x39, 0x62, 0x39, 0x35, 0x62, 0x36,
+0x66, 0x38, 0x38, 0x64, 0x62, 0x38, 0x38, 0x39,
+0x39, 0x65, 0x66, 0x61, 0x63, 0x31, 0x30, 0x32,
+0x65, 0x35, 0x66, 0x63, 0x37, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x32, 0x34, 0x37, 0x33, 0x30, 0x34, 0x34,
+0x30, 0x32, 0x32, 0x30, 0x32, 0x38, 0x33, 0x30,
+0x62, 0x37, 0x39, 0x32, 0x36, 0x65, 0x34, 0x38,
+0x38, 0x64, 0x61, 0x37, 0x35, 0x37, 0x38, 0x32,
+0x63, 0x38, 0x31, 0x61, 0x35, 0x34, 0x63, 0x64,
+0x32, 0x38, 0x31, 0x37, 0x32, 0x30, 0x38, 0x39,
+0x30, 0x64, 0x31, 0x61, 0x66, 0x30, 0x36, 0x34,
+0x36, 0x32, 0x39, 0x65, 0x62, 0x66, 0x32, 0x65,
+0x33, 0x31, 0x62, 0x66, 0x39, 0x66, 0x35, 0x34,
+0x33, 0x35, 0x66, 0x33, 0x30, 0x32, 0x32, 0x30,
+0x30, 0x38, 0x39, 0x61, 0x66, 0x61, 0x61, 0x38,
+0x62, 0x34, 0x35, 0x35, 0x62, 0x62, 0x65, 0x62,
+0x37, 0x64, 0x39, 0x62, 0x39, 0x63, 0x33, 0x66,
+0x65, 0x31, 0x65, 0x64, 0x33, 0x37, 0x64, 0x30,
+0x37, 0x36, 0x38, 0x35, 0x61, 0x64, 0x65, 0x38,
+0x34, 0x35, 0x35, 0x63, 0x37, 0x36, 0x34, 0x37,
+0x32, 0x63, 0x64, 0x61, 0x34, 0x32, 0x34, 0x64,
+0x39, 0x33, 0x65, 0x34, 0x30, 0x37, 0x34, 0x61,
+0x30, 0x31, 0x32, 0x31, 0x30, 0x33, 0x35, 0x39,
+0x36, 0x64, 0x33, 0x34, 0x35, 0x31, 0x30, 0x32,
+0x35, 0x63, 0x31, 0x39, 0x64, 0x62, 0x62, 0x64,
+0x65, 0x62, 0x39, 0x33, 0x32, 0x64, 0x36, 0x62,
+0x66, 0x38, 0x62, 0x66, 0x62, 0x34, 0x61, 0x64,
+0x34, 0x39, 0x39, 0x62, 0x39, 0x35, 0x62, 0x36,
+0x66, 0x38, 0x38, 0x64, 0x62, 0x38, 0x38, 0x39,
+0x39, 0x65, 0x66, 0x61, 0x63, 0x31, 0x30, 0x32,
+0x65, 0x35, 0x66, 0x63, 0x37, 0x31, 0x30, 0x32,
+0x34, 0x37, 0x33, 0x30, 0x34, 0x34, 0x30, 0x32,
+0x32, 0x30, 0x32, 0x36, 0x33, 0x32, 0x36, 0x66,
+0x63, 0x64, 0x61, 0x65, 0x39, 0x32, 0x30, 0x37,
+0x62, 0x35, 0x39, 0x36, 0x63, 0x32, 0x62, 0x30,
+0x35, 0x39, 0x32, 0x31, 0x64, 0x62, 0x61, 0x63,
+0x31, 0x31, 0x64, 0x38, 0x31, 0x30, 0x34, 0x30,
+0x63, 0x34, 0x64, 0x34, 0x30, 0x33, 0x37, 0x38,
+0x35, 0x31, 0x33, 0x36, 0x37, 0x30, 0x66, 0x31,
+0x39, 0x64, 0x39, 0x66, 0x34, 0x61, 0x66, 0x38,
+0x39, 0x33, 0x30, 0x32, 0x32, 0x30, 0x33, 0x34,
+0x65, 0x63, 0x64, 0x37, 0x61, 0x32, 0x38, 0x32,
+0x63, 0x30, 0x31, 0x36, 0x33, 0x62, 0x38, 0x39,
+0x61, 0x61, 0x61, 0x36, 0x32, 0x63, 0x32, 0x32,
+0x65, 0x63, 0x32, 0x30, 0x32, 0x63, 0x65, 0x66,
+0x34, 0x37, 0x33, 0x36, 0x63, 0x35, 0x38, 0x63,
+0x64, 0x32, 0x35, 0x31, 0x36, 0x34, 0x39, 0x62,
+0x61, 0x64, 0x30, 0x64, 0x38, 0x31, 0x33, 0x39,
+0x62, 0x63, 0x62, 0x66, 0x35, 0x35, 0x30, 0x31,
+0x32, 0x31, 0x30, 0x33, 0x35, 0x39, 0x36, 0x64,
+0x33, 0x34, 0x35, 0x31, 0x30, 0x32, 0x35, 0x63,
+0x31, 0x39, 0x64, 0x62, 0x62, 0x64, 0x65, 0x62,
+0x39, 0x33, 0x32, 0x64, 0x36, 0x62, 0x66, 0x38,
+0x62, 0x66, 0x62, 0x34, 0x61, 0x64, 0x34, 0x39,
+0x39, 0x62, 0x39, 0x35, 0x62, 0x36, 0x66, 0x38,
+0x38, 0x64, 0x62, 0x38, 0x38, 0x39, 0x39, 0x65,
+0x66, 0x61, 0x63, 0x31, 0x30, 0x32, 0x65, 0x35,
+0x66, 0x63, 0x37, 0x31, 0x30, 0x32, 0x34, 0x37,
+0x33, 0x30, 0x34, 0x34, 0x30, 0x32, 0x32, 0x30,
+0x32, 0x31, 0x34, 0x39, 0x37, 0x38, 0x64, 0x61,
+0x65, 0x62, 0x32, 0x66, 0x33, 0x38, 0x63, 0x64,
+0x34, 0x32, 0x36, 0x65, 0x65, 0x36, 0x65, 0x32,
+0x66, 0x34, 0x34, 0x31, 0x33, 0x31, 0x61, 0x33,
+0x33, 0x64, 0x36, 0x62, 0x31, 0x39, 0x31, 0x61,
+0x66, 0x31, 0x63, 0x32, 0x31, 0x36, 0x32, 0x34,
+0x37, 0x66, 0x31, 0x64, 0x64, 0x37, 0x64, 0x37,
+0x34, 0x63, 0x31, 0x36, 0x64, 0x38, 0x34, 0x61,
+0x30, 0x32, 0x32, 0x30, 0x35, 0x66, 0x64, 0x63,
+0x30, 0x35, 0x35, 0x32, 0x39, 0x62, 0x30, 0x62,
+0x63, 0x30, 0x63, 0x34, 0x33, 0x30, 0x62, 0x34,
+0x64, 0x35, 0x39, 0x38, 0x37, 0x32, 0x36, 0x34,
+0x64, 0x39, 0x64, 0x30, 0x37, 0x35, 0x33, 0x35,
+0x31, 0x63, 0x34, 0x66, 0x34, 0x34, 0x38, 0x34,
+0x63, 0x31, 0x36, 0x65, 0x39, 0x31, 0x36, 0x36,
+0x32, 0x65, 0x39, 0x30, 0x61, 0x37, 0x32, 0x61,
+0x61, 0x62, 0x32, 0x34, 0x30, 0x31, 0x32, 0x31,
+0x30, 0x33, 0x35, 0x39, 0x36, 0x64, 0x33, 0x34,
+0x35, 0x31, 0x30, 0x32, 0x35, 0x63, 0x31, 0x39,
+0x64, 0x62, 0x62, 0x64, 0x65, 0x62, 0x39, 0x33,
+0x32, 0x64, 0x36, 0x62, 0x66, 0x38, 0x62, 0x66,
+0x62, 0x34, 0x61, 0x64, 0x34, 0x39, 0x39, 0x62,
+0x39, 0x35, 0x62, 0x36, 0x66, 0x38, 0x38, 0x64,
+0x62, 0x38, 0x38, 0x39, 0x39, 0x65, 0x66, 0x61,
+0x63, 0x31, 0x30, 0x32, 0x65, 0x35, 0x66, 0x63,
+0x37, 0x31, 0x30, 0x32, 0x34, 0x37, 0x33, 0x30,
+0x34, 0x34, 0x30, 0x32, 0x32, 0x30, 0x34, 0x61,
+0x36, 0x65, 0x39, 0x66, 0x31, 0x39, 0x39, 0x64,
+0x63, 0x39, 0x36, 0x37, 0x32, 0x63, 0x66, 0x32,
+0x66, 0x66, 0x38, 0x30, 0x39, 0x34, 0x61, 0x61,
+0x61, 0x37, 0x38, 0x34, 0x33, 0x36, 0x33, 0x62,
+0x65, 0x31, 0x65, 0x62, 0x36, 0x32, 0x62, 0x36,
+0x37, 0x39, 0x66, 0x37, 0x66, 0x66, 0x32, 0x64,
+0x66, 0x33, 0x36, 0x31, 0x31, 0x32, 0x34, 0x66,
+0x31, 0x64, 0x63, 0x61, 0x33, 0x33, 0x30, 0x32,
+0x32, 0x30, 0x35, 0x65, 0x65, 0x62, 0x31, 0x31,
+0x66, 0x37, 0x30, 0x66, 0x61, 0x62, 0x35, 0x33,
+0x35, 0x35, 0x63, 0x39, 0x63, 0x38, 0x61, 0x64,
+0x31, 0x61, 0x30, 0x37, 0x30, 0x30, 0x65, 0x61,
+0x33, 0x35, 0x35, 0x64, 0x33, 0x31, 0x35, 0x65,
+0x33, 0x33, 0x34, 0x38, 0x32, 0x32, 0x66, 0x61,
+0x31, 0x38, 0x32, 0x32, 0x32, 0x37, 0x65, 0x39,
+0x38, 0x31, 0x35, 0x33, 0x30, 0x38, 0x65, 0x65,
+0x38, 0x66, 0x30, 0x31, 0x32, 0x31, 0x30, 0x33,
+0x35, 0x39, 0x36, 0x64, 0x33, 0x34, 0x35, 0x31,
+0x30, 0x32, 0x35, 0x63, 0x31, 0x39, 0x64, 0x62,
+0x62, 0x64, 0x65, 0x62, 0x39, 0x33, 0x32, 0x64,
+0x36, 0x62, 0x66, 0x38, 0x62, 0x66, 0x62, 0x34,
+0x61, 0x64, 0x34, 0x39, 0x39, 0x62, 0x39, 0x35,
+0x62, 0x36, 0x66, 0x38, 0x38, 0x64, 0x62, 0x38,
+0x38, 0x39, 0x39, 0x65, 0x66, 0x61, 0x63, 0x31,
+0x30, 0x32, 0x65, 0x35, 0x66, 0x63, 0x37, 0x31,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x22, 0x2c, 0x20, 0x22, 0x50, 0x32,
+0x53, 0x48, 0x2c, 0x57, 0x49, 0x54, 0x4e, 0x45,
+0x53, 0x53, 0x22, 0x5d, 0x2c, 0x0a, 0x0a, 0x5b,
+0x22, 0x55, 0x6e, 0x6b, 0x6e, 0x6f, 0x77, 0x6e,
+0x20, 0x76, 0x65, 0x72, 0x73, 0x69, 0x6f, 0x6e,
+0x20, 0x77, 0x69, 0x74, 0x6e, 0x65, 0x73, 0x73,
+0x20, 0x70, 0x72, 0x6f, 0x67, 0x72, 0x61, 0x6d,
+0x20, 0x77, 0x69, 0x74, 0x68, 0x20, 0x65, 0x6d,
+0x70, 0x74, 0x79, 0x20, 0x77, 0x69, 0x74, 0x6e,
+0x65, 0x73, 0x73, 0x22, 0x5d, 0x2c, 0x0a, 0x5b,
+0x5b, 0x5b, 0x22, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x30, 0x2c,
+0x20, 0x22, 0x30, 0x78, 0x36, 0x30, 0x20, 0x30,
+0x78, 0x31, 0x34, 0x20, 0x30, 0x78, 0x34, 0x63,
+0x39, 0x63, 0x33, 0x64, 0x66, 0x61, 0x63, 0x34,
+0x32, 0x30, 0x37, 0x64, 0x35, 0x64, 0x38, 0x63,
+0x62, 0x38, 0x39, 0x64, 0x66, 0x35, 0x37, 0x32,
+0x32, 0x63, 0x62, 0x33, 0x64, 0x37, 0x31, 0x32,
+0x33, 0x38, 0x35, 0x65, 0x33, 0x66, 0x22, 0x2c,
+0x20, 0x31, 0x30, 0x30, 0x30, 0x5d, 0x5d, 0x2c,
+0x0a, 0x22, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x30, 0x31,
+0x65, 0x38, 0x30, 0x33, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x35, 0x31, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x22,
+0x50, 0x32, 0x53, 0x48, 0x2c, 0x57, 0x49, 0x54,
+0x4e, 0x45, 0x53, 0x53, 0x22, 0x5d, 0x2c, 0x0a,
+0x0a, 0x5b, 0x22, 0x57, 0x69, 0x74, 0x6e, 0x65,
+0x73, 0x73, 0x20, 0x53, 0x49, 0x47, 0x48, 0x41,
+0x53, 0x48, 0x5f, 0x53, 0x49, 0x4e, 0x47, 0x4c,
+0x45, 0x20, 0x77, 0x69, 0x74, 0x68, 0x20, 0x6f,
+0x75, 0x74, 0x70, 0x75, 0x74, 0x20, 0x6f, 0x75,
+0x74, 0x20, 0x6f, 0x66, 0x20, 0x62, 0x6f, 0x75,
+0x6e, 0x64, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b,
+0x5b, 0x22, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20,
+0x22, 0x30, 0x78, 0x35, 0x31, 0x22, 0x2c, 0x20,
+0x31, 0x30, 0x30, 0x30, 0x5d, 0x2c, 0x0a, 0x5b,
+0x22, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30,
+0x30, 0x22, 0x2c, 0x20, 0x31, 0x2c, 0x20, 0x22,
+0x30, 0x78, 0x30, 0x30, 0x20, 0x30, 0x78, 0x32,
+0x30, 0x20, 0x30, 0x78, 0x34, 0x64, 0x36, 0x63,
+0x32, 0x61, 0x33, 0x32, 0x63, 0x38, 0x37, 0x38,
+0x32, 0x31, 0x64, 0x36, 0x38, 0x66, 0x63, 0x30,
+0x31, 0x36, 0x66, 0x63, 0x61, 0x37, 0x30, 0x37,
+0x39, 0x37, 0x61, 0x62, 0x64, 0x62, 0x38, 0x30,
+0x64, 0x66, 0x36, 0x63, 0x64, 0x38, 0x34, 0x36,
+0x35, 0x31, 0x64, 0x34, 0x30, 0x61, 0x39, 0x33,
+0x30, 0x30, 0x63, 0x36, 0x62, 0x61, 0x64, 0x37,
+0x39, 0x65, 0x36, 0x32, 0x22, 0x2c, 0x20, 0x31,
+0x30, 0x30, 0x30, 0x5d, 0x5d, 0x2c, 0x0a, 0x22,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x32, 0x30, 0x30,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x30, 0x31, 0x64, 0x30, 0x30, 0x37,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x35, 0x31,
+0x30, 0x30, 0x30, 0x33, 0x34, 0x38, 0x33, 0x30,
+0x34, 0x35, 0x30, 0x32, 0x32, 0x31, 0x30, 0x30,
+0x65, 0x30, 0x37, 0x38, 0x64, 0x65, 0x34, 0x65,
+0x39, 0x36, 0x61, 0x30, 0x65, 0x30, 0x35, 0x64,
+0x63, 0x64, 0x63, 0x30, 0x61, 0x34, 0x31, 0x34,
+0x31, 0x32, 0x34, 0x64, 0x64, 0x38, 0x34, 0x37,
+0x35, 0x37, 0x38, 0x32, 0x62, 0x35, 0x66, 0x33,
+0x66, 0x30, 0x65, 0x64, 0x33, 0x66, 0x36, 0x30,
+0x37, 0x39, 0x31, 0x39, 0x65, 0x39, 0x61, 0x35,
+0x65, 0x65, 0x65, 0x62, 0x32, 0x32, 0x62, 0x66,
+0x30, 0x32, 0x32, 0x30, 0x31, 0x64, 0x65, 0x33,
+0x30, 0x39, 0x62, 0x33, 0x61, 0x33, 0x31, 0x30,
+0x39, 0x61, 0x64, 0x62, 0x33, 0x64, 0x65, 0x38,
+0x30, 0x37, 0x34, 0x62, 0x33, 0x36, 0x31, 0x30,
+0x64, 0x34, 0x63, 0x66, 0x34, 0x35, 0x34, 0x63,
+0x34, 0x39, 0x62, 0x36, 0x31, 0x32, 0x34, 0x37,
+0x61, 0x32, 0x37, 0x37, 0x39, 0x61, 0x30, 0x62,
+0x63, 0x62, 0x66, 0x33, 0x31, 0x63, 0x38, 0x38,
+0x39, 0x33, 0x33, 0x33, 0x30, 0x33, 0x32, 0x31,
+0x30, 0x33, 0x35, 0x39, 0x36, 0x64, 0x33, 0x34,
+0x35, 0x31, 0x30, 0x32, 0x35, 0x63, 0x31, 0x39,
+0x64, 0x62, 0x62, 0x64, 0x65, 0x62, 0x39, 0x33,
+0x32, 0x64, 0x36, 0x62, 0x66, 0x38, 0x62, 0x66,
+0x62, 0x34, 0x61, 0x64, 0x34, 0x39, 0x39, 0x62,
+0x39, 0x35, 0x62, 0x36, 0x66, 0x38, 0x38, 0x64,
+0x62, 0x38, 0x38, 0x39, 0x39, 0x65, 0x66, 0x61,
+0x63, 0x31, 0x30, 0x32, 0x65, 0x35, 0x66, 0x63,
+0x37, 0x31, 0x31, 0x39, 0x37, 0x36, 0x61, 0x39,
+0x31, 0x34, 0x34, 0x63, 0x39, 0x63, 0x33, 0x64,
+0x66, 0x61, 0x63, 0x34, 0x32, 0x30, 0x37, 0x64,
+0x35, 0x64, 0x38, 0x63, 0x62, 0x38, 0x39, 0x64,
+0x66, 0x35, 0x37, 0x32, 0x32, 0x63, 0x62, 0x33,
+0x64, 0x37, 0x31, 0x32, 0x33, 0x38, 0x35, 0x65,
+0x33, 0x66, 0x38, 0x38, 0x61, 0x63, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x22, 0x2c,
+0x20, 0x22, 0x50, 0x32, 0x53, 0x48, 0x2c, 0x57,
+0x49, 0x54, 0x4e, 0x45, 0x53, 0x53, 0x22, 0x5d,
+0x2c, 0x0a, 0x0a, 0x5b, 0x22, 0x31, 0x20, 0x62,
+0x79, 0x74, 0x65, 0x20, 0x70, 0x75, 0x73, 0x68,
+0x20, 0x73, 0x68, 0x6f, 0x75, 0x6c, 0x64, 0x20,
+0x6e, 0x6f, 0x74, 0x20, 0x62, 0x65, 0x20, 0x63,
+0x6f, 0x6e, 0x73, 0x69, 0x64, 0x65, 0x72, 0x65,
+0x64, 0x20, 0x61, 0x20, 0x77, 0x69, 0x74, 0x6e,
+0x65, 0x73, 0x73, 0x20, 0x73, 0x63, 0x72, 0x69,
+0x70, 0x74, 0x50, 0x75, 0x62, 0x4b, 0x65, 0x79,
+0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b, 0x5b, 0x22,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20, 0x22, 0x30,
+0x78, 0x36, 0x30, 0x20, 0x30, 0x78, 0x30, 0x31,
+0x20, 0x30, 0x78, 0x30, 0x31, 0x22, 0x2c, 0x20,
+0x31, 0x30, 0x30, 0x30, 0x5d, 0x5d, 0x2c, 0x0a,
+0x22, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x31, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x30, 0x31, 0x65,
+0x38, 0x30, 0x33, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x35, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x22, 0x50,
+0x32, 0x53, 0x48, 0x2c, 0x57, 0x49, 0x54, 0x4e,
+0x45, 0x53, 0x53, 0x2c, 0x44, 0x49, 0x53, 0x43,
+0x4f, 0x55, 0x52, 0x41, 0x47, 0x45, 0x5f, 0x55,
+0x50, 0x47, 0x52, 0x41, 0x44, 0x41, 0x42, 0x4c,
+0x45, 0x5f, 0x57, 0x49, 0x54, 0x4e, 0x45, 0x53,
+0x53, 0x5f, 0x50, 0x52, 0x4f, 0x47, 0x52, 0x41,
+0x4d, 0x22, 0x5d, 0x2c, 0x0a, 0x0a, 0x5b, 0x22,
+0x34, 0x31, 0x20, 0x62, 0x79, 0x74, 0x65, 0x73,
+0x20, 0x70, 0x75, 0x73, 0x68, 0x20, 0x73, 0x68,
+0x6f, 0x75, 0x6c, 0x64, 0x20, 0x6e, 0x6f, 0x74,
+0x20, 0x62, 0x65, 0x20, 0x63, 0x6f, 0x6e, 0x73,
+0x69, 0x64, 0x65, 0x72, 0x65, 0x64, 0x20, 0x61,
+0x20, 0x77, 0x69, 0x74, 0x6e, 0x65, 0x73, 0x73,
+0x20, 0x73, 0x63, 0x72, 0x69, 0x70, 0x74, 0x50,
+0x75, 0x62, 0x4b, 0x65, 0x79, 0x22, 0x5d, 0x2c,
+0x0a, 0x5b, 0x5b, 0x5b, 0x22, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x31, 0x30, 0x30, 0x22, 0x2c, 0x20,
+0x30, 0x2c, 0x20, 0x22, 0x30, 0x78, 0x36, 0x30,
+0x20, 0x30, 0x78, 0x32, 0x39, 0x20, 0x30, 0x78,
+0x66, 0x66, 0x32, 0x35, 0x34, 0x32, 0x39, 0x32,
+0x35, 0x31, 0x62, 0x35, 0x61, 0x38, 0x34, 0x66,
+0x34, 0x35, 0x32, 0x32, 0x33, 0x30, 0x61, 0x33,
+0x63, 0x37, 0x35, 0x66, 0x64, 0x38, 0x38, 0x36,
+0x62, 0x37, 0x66, 0x63, 0x35, 0x61, 0x37, 0x38,
+0x36, 0x35, 0x63, 0x65, 0x34, 0x61, 0x37, 0x62,
+0x62, 0x37, 0x61, 0x39, 0x64, 0x37, 0x63, 0x35,
+0x62, 0x65, 0x36, 0x64, 0x61, 0x33, 0x64, 0x62,
+0x66, 0x66, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x22, 0x2c, 0x20, 0x31, 0x30, 0x30,
+0x30, 0x5d, 0x5d, 0x2c, 0x0a, 0x22, 0x30, 0x31,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x30, 0x31, 0x65, 0x38, 0x30, 0x33,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x35, 0x31,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x22, 0x2c, 0x20, 0x22, 0x50, 0x32, 0x53, 0x48,
+0x2c, 0x57, 0x49, 0x54, 0x4e, 0x45, 0x53, 0x53,
+0x2c, 0x44, 0x49, 0x53, 0x43, 0x4f, 0x55, 0x52,
+0x41, 0x47, 0x45, 0x5f, 0x55, 0x50, 0x47, 0x52,
+0x41, 0x44, 0x41, 0x42, 0x4c, 0x45, 0x5f, 0x57,
+0x49, 0x54, 0x4e, 0x45, 0x53, 0x53, 0x5f, 0x50,
+0x52, 0x4f, 0x47, 0x52, 0x41, 0x4d, 0x22, 0x5d,
+0x2c, 0x0a, 0x0a, 0x5b, 0x22, 0x54, 0x68, 0x65,
+0x20, 0x77, 0x69, 0x74, 0x6e, 0x65, 0x73, 0x73,
+0x20, 0x76, 0x65, 0x72, 0x73, 0x69, 0x6f, 0x6e,
+0x20, 0x6d, 0x75, 0x73, 0x74, 0x20, 0x75, 0x73,
+0x65, 0x20, 0x4f, 0x50, 0x5f, 0x31, 0x20, 0x74,
+0x6f, 0x20, 0x4f, 0x50, 0x5f, 0x31, 0x36, 0x20,
+0x6f, 0x6e, 0x6c, 0x79, 0x22, 0x5d, 0x2c, 0x0a,
+0x5b, 0x5b, 0x5b, 0x22, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x30,
+0x2c, 0x20, 0x22, 0x30, 0x78, 0x30, 0x31, 0x20,
+0x30, 0x78, 0x31, 0x30, 0x20, 0x30, 0x78, 0x30,
+0x32, 0x20, 0x30, 0x78, 0x30, 0x30, 0x30, 0x31,
+0x22, 0x2c, 0x20, 0x31, 0x30, 0x30, 0x30, 0x5d,
+0x5d, 0x2c, 0x0a, 0x22, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x30, 0x31, 0x65, 0x38, 0x30, 0x33, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x31, 0x35, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x22, 0x2c,
+0x20, 0x22, 0x50, 0x32, 0x53, 0x48, 0x2c, 0x57,
+0x49, 0x54, 0x4e, 0x45, 0x53, 0x53, 0x2c, 0x44,
+0x49, 0x53, 0x43, 0x4f, 0x55, 0x52, 0x41, 0x47,
+0x45, 0x5f, 0x55, 0x50, 0x47, 0x52, 0x41, 0x44,
+0x41, 0x42, 0x4c, 0x45, 0x5f, 0x57, 0x49, 0x54,
+0x4e, 0x45, 0x53, 0x53, 0x5f, 0x50, 0x52, 0x4f,
+0x47, 0x52, 0x41, 0x4d, 0x22, 0x5d, 0x2c, 0x0a,
+0x0a, 0x5b, 0x22, 0x54, 0x68, 0x65, 0x20, 0x77,
+0x69, 0x74, 0x6e, 0x65, 0x73, 0x73, 0x20, 0x70,
+0x72, 0x6f, 0x67, 0x72, 0x61, 0x6d, 0x20, 0x70,
+0x75, 0x73, 0x68, 0x20, 0x6d, 0x75, 0x73, 0x74,
+0x20, 0x62, 0x65, 0x20, 0x63, 0x61, 0x6e, 0x6f,
+0x6e, 0x69, 0x63, 0x61, 0x6c, 0x22, 0x5d, 0x2c,
+0x0a, 0x5b, 0x5b, 0x5b, 0x22, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x31, 0x30, 0x30, 0x22, 0x2c, 0x20,
+0x30, 0x2c, 0x20, 0x22, 0x30, 0x78, 0x36, 0x30,
+0x20, 0x30, 0x78, 0x34, 0x63, 0x30, 0x32, 0x20,
+0x30, 0x78, 0x30, 0x30, 0x30, 0x31, 0x22, 0x2c,
+0x20, 0x31, 0x30, 0x30, 0x30, 0x5d, 0x5d, 0x2c,
+0x0a, 0x22, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x30, 0x31,
+0x65, 0x38, 0x30, 0x33, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x35, 0x31, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x22,
+0x50, 0x32, 0x53, 0x48, 0x2c, 0x57, 0x49, 0x54,
+0x4e, 0x45, 0x53, 0x53, 0x2c, 0x44, 0x49, 0x53,
+0x43, 0x4f, 0x55, 0x52, 0x41, 0x47, 0x45, 0x5f,
+0x55, 0x50, 0x47, 0x52, 0x41, 0x44, 0x41, 0x42,
+0x4c, 0x45, 0x5f, 0x57, 0x49, 0x54, 0x4e, 0x45,
+0x53, 0x53, 0x5f, 0x50, 0x52, 0x4f, 0x47, 0x52,
+0x41, 0x4d, 0x22, 0x5d, 0x2c, 0x0a, 0x0a, 0x5b,
+0x22, 0x57, 0x69, 0x74, 0x6e, 0x65, 0x73, 0x73,
+0x20, 0x53, 0x69, 0x6e, 0x67, 0x6c, 0x65, 0x7c,
+0x41, 0x6e, 0x79, 0x6f, 0x6e, 0x65, 0x43, 0x61,
+0x6e, 0x50, 0x61, 0x79, 0x20, 0x64, 0x6f, 0x65,
+0x73, 0x20, 0x6e, 0x6f, 0x74, 0x20, 0x68, 0x61,
+0x73, 0x68, 0x20, 0x69, 0x6e, 0x70, 0x75, 0x74,
+0x27, 0x73, 0x20, 0x70, 0x6f, 0x73, 0x69, 0x74,
+0x69, 0x6f, 0x6e, 0x22, 0x5d, 0x2c, 0x0a, 0x5b,
+0x5b, 0x5b, 0x22, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x30, 0x2c,
+0x20, 0x22, 0x30, 0x78, 0x30, 0x30, 0x20, 0x30,
+0x78, 0x31, 0x34, 0x20, 0x30, 0x78, 0x34, 0x63,
+0x39, 0x63, 0x33, 0x64, 0x66, 0x61, 0x63, 0x34,
+0x32, 0x30, 0x37, 0x64, 0x35, 0x64, 0x38, 0x63,
+0x62, 0x38, 0x39, 0x64, 0x66, 0x35, 0x37, 0x32,
+0x32, 0x63, 0x62, 0x33, 0x64, 0x37, 0x31, 0x32,
+0x33, 0x38, 0x35, 0x65, 0x33, 0x66, 0x22, 0x2c,
+0x20, 0x31, 0x30, 0x30, 0x30, 0x5d, 0x2c, 0x0a,
+0x5b, 0x22, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x22, 0x2c, 0x20, 0x31, 0x2c, 0x20,
+0x22, 0x30, 0x78, 0x30, 0x30, 0x20, 0x30, 0x78,
+0x31, 0x34, 0x20, 0x30, 0x78, 0x34, 0x63, 0x39,
+0x63, 0x33, 0x64, 0x66, 0x61, 0x63, 0x34, 0x32,
+0x30, 0x37, 0x64, 0x35, 0x64, 0x38, 0x63, 0x62,
+0x38, 0x39, 0x64, 0x66, 0x35, 0x37, 0x32, 0x32,
+0x63, 0x62, 0x33, 0x64, 0x37, 0x31, 0x32, 0x33,
+0x38, 0x35, 0x65, 0x33, 0x66, 0x22, 0x2c, 0x20,
+0x31, 0x30, 0x30, 0x31, 0x5d, 0x5d, 0x2c, 0x0a,
+0x22, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x32, 0x30,
+0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x30, 0x32, 0x65, 0x38, 0x30,
+0x33, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x35,
+0x31, 0x65, 0x39, 0x30, 0x33, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x31, 0x35, 0x31, 0x30, 0x32, 0x34,
+0x37, 0x33, 0x30, 0x34, 0x34, 0x30, 0x32, 0x32,
+0x30, 0x36, 0x64, 0x35, 0x39, 0x36, 0x38, 0x32,
+0x36, 0x36, 0x33, 0x66, 0x61, 0x61, 0x62, 0x35,
+0x65, 0x34, 0x63, 0x62, 0x37, 0x33, 0x33, 0x63,
+0x35, 0x36, 0x32, 0x65, 0x32, 0x32, 0x63, 0x64,
+0x61, 0x65, 0x35, 0x39, 0x32, 0x39, 0x34, 0x38,
+0x39, 0x35, 0x39, 0x32, 0x39, 0x65, 0x63, 0x33,
+0x38, 0x64, 0x37, 0x63, 0x30, 0x31, 0x36, 0x36,
+0x32, 0x31, 0x66, 0x66, 0x39, 0x30, 0x64, 0x61,
+0x30, 0x30, 0x32, 0x32, 0x30, 0x36, 0x33, 0x65,
+0x66, 0x30, 0x61, 0x66, 0x35, 0x66, 0x39, 0x37,
+0x30, 0x61, 0x66, 0x65, 0x38, 0x61, 0x34, 0x35,
+0x65, 0x61, 0x38, 0x33, 0x36, 0x65, 0x33, 0x35,
+0x30, 0x39, 0x62, 0x38, 0x38, 0x34, 0x37, 0x65,
+0x64, 0x33, 0x39, 0x34, 0x36, 0x33, 0x32, 0x35,
+0x33, 0x31, 0x30, 0x36, 0x61, 0x63, 0x31, 0x37,
+0x64, 0x31, 0x39, 0x63, 0x34, 0x33, 0x37, 0x64,
+0x33, 0x64, 0x35, 0x36, 0x62, 0x38, 0x33, 0x32,
+0x31, 0x30, 0x33, 0x35, 0x39, 0x36, 0x64, 0x33,
+0x34, 0x35, 0x31, 0x30, 0x32, 0x35, 0x63, 0x31,
+0x39, 0x64, 0x62, 0x62, 0x64, 0x65, 0x62, 0x39,
+0x33, 0x32, 0x64, 0x36, 0x62, 0x66, 0x38, 0x62,
+0x66, 0x62, 0x34, 0x61, 0x64, 0x34, 0x39, 0x39,
+0x62, 0x39, 0x35, 0x62, 0x36, 0x66, 0x38, 0x38,
+0x64, 0x62, 0x38, 0x38, 0x39, 0x39, 0x65, 0x66,
+0x61, 0x63, 0x31, 0x30, 0x32, 0x65, 0x35, 0x66,
+0x63, 0x37, 0x31, 0x30, 0x32, 0x34, 0x38, 0x33,
+0x30, 0x34, 0x35, 0x30, 0x32, 0x32, 0x31, 0x30,
+0x30, 0x38, 0x35, 0x30, 0x30, 0x31, 0x61, 0x38,
+0x32, 0x30, 0x62, 0x66, 0x63, 0x62, 0x63, 0x39,
+0x66, 0x39, 0x64, 0x65, 0x30, 0x32, 0x39, 0x38,
+0x61, 0x66, 0x37, 0x31, 0x34, 0x34, 0x39, 0x33,
+0x66, 0x38, 0x61, 0x33, 0x37, 0x62, 0x33, 0x62,
+0x33, 0x35, 0x34, 0x62, 0x66, 0x64, 0x32, 0x31,
+0x61, 0x37, 0x30, 0x39, 0x37, 0x63, 0x33, 0x65,
+0x30, 0x30, 0x39, 0x66, 0x32, 0x30, 0x31, 0x38,
+0x63, 0x30, 0x32, 0x32, 0x30, 0x35, 0x30, 0x61,
+0x38, 0x62, 0x34, 0x64, 0x62, 0x63, 0x38, 0x31,
+0x35, 0x35, 0x64, 0x34, 0x64, 0x30, 0x34, 0x64,
+0x61, 0x32, 0x66, 0x35, 0x63, 0x64, 0x64, 0x35,
+0x37, 0x35, 0x64, 0x63, 0x66, 0x38, 0x64, 0x64,
+0x30, 0x31, 0x30, 0x38, 0x64, 0x65, 0x38, 0x62,
+0x65, 0x63, 0x37, 0x35, 0x39, 0x62, 0x64, 0x38,
+0x39, 0x37, 0x65, 0x61, 0x30, 0x31, 0x65, 0x63,
+0x62, 0x33, 0x61, 0x66, 0x37, 0x38, 0x33, 0x32,
+0x31, 0x30, 0x33, 0x35, 0x39, 0x36, 0x64, 0x33,
+0x34, 0x35, 0x31, 0x30, 0x32, 0x35, 0x63, 0x31,
+0x39, 0x64, 0x62, 0x62, 0x64, 0x65, 0x62, 0x39,
+0x33, 0x32, 0x64, 0x36, 0x62, 0x66, 0x38, 0x62,
+0x66, 0x62, 0x34, 0x61, 0x64, 0x34, 0x39, 0x39,
+0x62, 0x39, 0x35, 0x62, 0x36, 0x66, 0x38, 0x38,
+0x64, 0x62, 0x38, 0x38, 0x39, 0x39, 0x65, 0x66,
+0x61, 0x63, 0x31, 0x30, 0x32, 0x65, 0x35, 0x66,
+0x63, 0x37, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x22, 0x50,
+0x32, 0x53, 0x48, 0x2c, 0x57, 0x49, 0x54, 0x4e,
+0x45, 0x53, 0x53, 0x22, 0x5d, 0x2c, 0x0a, 0x0a,
+0x5b, 0x22, 0x57, 0x69, 0x74, 0x6e, 0x65, 0x73,
+0x73, 0x20, 0x53, 0x69, 0x6e, 0x67, 0x6c, 0x65,
+0x7c, 0x41, 0x6e, 0x79, 0x6f, 0x6e, 0x65, 0x43,
+0x61, 0x6e, 0x50, 0x61, 0x79, 0x20, 0x64, 0x6f,
+0x65, 0x73, 0x20, 0x6e, 0x6f, 0x74, 0x20, 0x68,
+0x61, 0x73, 0x68, 0x20, 0x69, 0x6e, 0x70, 0x75,
+0x74, 0x27, 0x73, 0x20, 0x70, 0x6f, 0x73, 0x69,
+0x74, 0x69, 0x6f, 0x6e, 0x20, 0x28, 0x70, 0x65,
+0x72, 0x6d, 0x75, 0x74, 0x61, 0x74, 0x69, 0x6f,
+0x6e, 0x29, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b,
+0x5b, 0x22, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x22, 0x2c, 0x20, 0x31, 0x2c, 0x20,
+0x22, 0x30, 0x78, 0x30, 0x30, 0x20, 0x30, 0x78,
+0x31, 0x34, 0x20, 0x30, 0x78, 0x34, 0x63, 0x39,
+0x63, 0x33, 0x64, 0x66, 0x61, 0x63, 0x34, 0x32,
+0x30, 0x37, 0x64, 0x35, 0x64, 0x38, 0x63, 0x62,
+0x38, 0x39, 0x64, 0x66, 0x35, 0x37, 0x32, 0x32,
+0x63, 0x62, 0x33, 0x64, 0x37, 0x31, 0x32, 0x33,
+0x38, 0x35, 0x65, 0x33, 0x66, 0x22, 0x2c, 0x20,
+0x31, 0x30, 0x30, 0x31, 0x5d, 0x2c, 0x0a, 0x5b,
+0x22, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30,
+0x30, 0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20, 0x22,
+0x30, 0x78, 0x30, 0x30, 0x20, 0x30, 0x78, 0x31,
+0x34, 0x20, 0x30, 0x78, 0x34, 0x63, 0x39, 0x63,
+0x33, 0x64, 0x66, 0x61, 0x63, 0x34, 0x32, 0x30,
+0x37, 0x64, 0x35, 0x64, 0x38, 0x63, 0x62, 0x38,
+0x39, 0x64, 0x66, 0x35, 0x37, 0x32, 0x32, 0x63,
+0x62, 0x33, 0x64, 0x37, 0x31, 0x32, 0x33, 0x38,
+0x35, 0x65, 0x33, 0x66, 0x22, 0x2c, 0x20, 0x31,
+0x30, 0x30, 0x30, 0x5d, 0x5d, 0x2c, 0x0a, 0x22,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x32, 0x30, 0x30,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x30, 0x32, 0x65, 0x39, 0x30, 0x33,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x35, 0x31,
+0x65, 0x38, 0x30, 0x33, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x35, 0x31, 0x30, 0x32, 0x34, 0x38,
+0x33, 0x30, 0x34, 0x35, 0x30, 0x32, 0x32, 0x31,
+0x30, 0x30, 0x38, 0x35, 0x30, 0x30, 0x31, 0x61,
+0x38, 0x32, 0x30, 0x62, 0x66, 0x63, 0x62, 0x63,
+0x39, 0x66, 0x39, 0x64, 0x65, 0x30, 0x32, 0x39,
+0x38, 0x61, 0x66, 0x37, 0x31, 0x34, 0x34, 0x39,
+0x33, 0x66, 0x38, 0x61, 0x33, 0x37, 0x62, 0x33,
+0x62, 0x33, 0x35, 0x34, 0x62, 0x66, 0x64, 0x32,
+0x31, 0x61, 0x37, 0x30, 0x39, 0x37, 0x63, 0x33,
+0x65, 0x30, 0x30, 0x39, 0x66, 0x32, 0x30, 0x31,
+0x38, 0x63, 0x30, 0x32, 0x32, 0x30, 0x35, 0x30,
+0x61, 0x38, 0x62, 0x34, 0x64, 0x62, 0x63, 0x38,
+0x31, 0x35, 0x35, 0x64, 0x34, 0x64, 0x30, 0x34,
+0x64, 0x61, 0x32, 0x66, 0x35, 0x63, 0x64, 0x64,
+0x35, 0x37, 0x35, 0x64, 0x63, 0x66, 0x38, 0x64,
+0x64, 0x30, 0x31, 0x30, 0x38, 0x64, 0x65, 0x38,
+0x62, 0x65, 0x63, 0x37, 0x35, 0x39, 0x62, 0x64,
+0x38, 0x39, 0x37, 0x65, 0x61, 0x30, 0x31, 0x65,
+0x63, 0x62, 0x33, 0x61, 0x66, 0x37, 0x38, 0x33,
+0x32, 0x31, 0x30, 0x33, 0x35, 0x39, 0x36, 0x64,
+0x33, 0x34, 0x35, 0x31, 0x30, 0x32, 0x35, 0x63,
+0x31, 0x39, 0x64, 0x62, 0x62, 0x64, 0x65, 0x62,
+0x39, 0x33, 0x32, 0x64, 0x36, 0x62, 0x66, 0x38,
+0x62, 0x66, 0x62, 0x34, 0x61, 0x64, 0x34, 0x39,
+0x39, 0x62, 0x39, 0x35, 0x62, 0x36, 0x66, 0x38,
+0x38, 0x64, 0x62, 0x38, 0x38, 0x39, 0x39, 0x65,
+0x66, 0x61, 0x63, 0x31, 0x30, 0x32, 0x65, 0x35,
+0x66, 0x63, 0x37, 0x31, 0x30, 0x32, 0x34, 0x37,
+0x33, 0x30, 0x34, 0x34, 0x30, 0x32, 0x32, 0x30,
+0x36, 0x64, 0x35, 0x39, 0x36, 0x38, 0x32, 0x36,
+0x36, 0x33, 0x66, 0x61, 0x61, 0x62, 0x35, 0x65,
+0x34, 0x63, 0x62, 0x37, 0x33, 0x33, 0x63, 0x35,
+0x36, 0x32, 0x65, 0x32, 0x32, 0x63, 0x64, 0x61,
+0x65, 0x35, 0x39, 0x32, 0x39, 0x34, 0x38, 0x39,
+0x35, 0x39, 0x32, 0x39, 0x65, 0x63, 0x33, 0x38,
+0x64, 0x37, 0x63, 0x30, 0x31, 0x36, 0x36, 0x32,
+0x31, 0x66, 0x66, 0x39, 0x30, 0x64, 0x61, 0x30,
+0x30, 0x32, 0x32, 0x30, 0x36, 0x33, 0x65, 0x66,
+0x30, 0x61, 0x66, 0x35, 0x66, 0x39, 0x37, 0x30,
+0x61, 0x66, 0x65, 0x38, 0x61, 0x34, 0x35, 0x65,
+0x61, 0x38, 0x33, 0x36, 0x65, 0x33, 0x35, 0x30,
+0x39, 0x62, 0x38, 0x38, 0x34, 0x37, 0x65, 0x64,
+0x33, 0x39, 0x34, 0x36, 0x33, 0x32, 0x35, 0x33,
+0x31, 0x30, 0x36, 0x61, 0x63, 0x31, 0x37, 0x64,
+0x31, 0x39, 0x63, 0x34, 0x33, 0x37, 0x64, 0x33,
+0x64, 0x35, 0x36, 0x62, 0x38, 0x33, 0x32, 0x31,
+0x30, 0x33, 0x35, 0x39, 0x36, 0x64, 0x33, 0x34,
+0x35, 0x31, 0x30, 0x32, 0x35, 0x63, 0x31, 0x39,
+0x64, 0x62, 0x62, 0x64, 0x65, 0x62, 0x39, 0x33,
+0x32, 0x64, 0x36, 0x62, 0x66, 0x38, 0x62, 0x66,
+0x62, 0x34, 0x61, 0x64, 0x34, 0x39, 0x39, 0x62,
+0x39, 0x35, 0x62, 0x36, 0x66, 0x38, 0x38, 0x64,
+0x62, 0x38, 0x38, 0x39, 0x39, 0x65, 0x66, 0x61,
+0x63, 0x31, 0x30, 0x32, 0x65, 0x35, 0x66, 0x63,
+0x37, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x22, 0x2c, 0x20, 0x22, 0x50, 0x32,
+0x53, 0x48, 0x2c, 0x57, 0x49, 0x54, 0x4e, 0x45,
+0x53, 0x53, 0x22, 0x5d, 0x2c, 0x0a, 0x0a, 0x5b,
+0x22, 0x4e, 0x6f, 0x6e, 0x20, 0x77, 0x69, 0x74,
+0x6e, 0x65, 0x73, 0x73, 0x20, 0x53, 0x69, 0x6e,
+0x67, 0x6c, 0x65, 0x7c, 0x41, 0x6e, 0x79, 0x6f,
+0x6e, 0x65, 0x43, 0x61, 0x6e, 0x50, 0x61, 0x79,
+0x20, 0x68, 0x61, 0x73, 0x68, 0x20, 0x69, 0x6e,
+0x70, 0x75, 0x74, 0x27, 0x73, 0x20, 0x70, 0x6f,
+0x73, 0x69, 0x74, 0x69, 0x6f, 0x6e, 0x22, 0x5d,
+0x2c, 0x0a, 0x5b, 0x5b, 0x5b, 0x22, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x31, 0x30, 0x30, 0x22, 0x2c,
+0x20, 0x30, 0x2c, 0x20, 0x22, 0x30, 0x78, 0x32,
+0x31, 0x20, 0x30, 0x78, 0x30, 0x33, 0x35, 0x39,
+0x36, 0x64, 0x33, 0x34, 0x35, 0x31, 0x30, 0x32,
+0x35, 0x63, 0x31, 0x39, 0x64, 0x62, 0x62, 0x64,
+0x65, 0x62, 0x39, 0x33, 0x32, 0x64, 0x36, 0x62,
+0x66, 0x38, 0x62, 0x66, 0x62, 0x34, 0x61, 0x64,
+0x34, 0x39, 0x39, 0x62, 0x39, 0x35, 0x62, 0x36,
+0x66, 0x38, 0x38, 0x64, 0x62, 0x38, 0x38, 0x39,
+0x39, 0x65, 0x66, 0x61, 0x63, 0x31, 0x30, 0x32,
+0x65, 0x35, 0x66, 0x63, 0x37, 0x31, 0x20, 0x43,
+0x48, 0x45, 0x43, 0x4b, 0x53, 0x49, 0x47, 0x22,
+0x2c, 0x20, 0x31, 0x30, 0x30, 0x30, 0x5d, 0x2c,
+0x0a, 0x5b, 0x22, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x22, 0x2c, 0x20, 0x31, 0x2c,
+0x20, 0x22, 0x30, 0x78, 0x32, 0x31, 0x20, 0x30,
+0x78, 0x30, 0x33, 0x35, 0x39, 0x36, 0x64, 0x33,
+0x34, 0x35, 0x31, 0x30, 0x32, 0x35, 0x63, 0x31,
+0x39, 0x64, 0x62, 0x62, 0x64, 0x65, 0x62, 0x39,
+0x33, 0x32, 0x64, 0x36, 0x62, 0x66, 0x38, 0x62,
+0x66, 0x62, 0x34, 0x61, 0x64, 0x34, 0x39, 0x39,
+0x62, 0x39, 0x35, 0x62, 0x36, 0x66, 0x38, 0x38,
+0x64, 0x62, 0x38, 0x38, 0x39, 0x39, 0x65, 0x66,
+0x61, 0x63, 0x31, 0x30, 0x32, 0x65, 0x35, 0x66,
+0x63, 0x37, 0x31, 0x20, 0x43, 0x48, 0x45, 0x43,
+0x4b, 0x53, 0x49, 0x47, 0x22, 0x2c, 0x20, 0x31,
+0x30, 0x30, 0x31, 0x5d, 0x5d, 0x2c, 0x0a, 0x22,
+0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x32, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x34, 0x38, 0x34, 0x37, 0x33, 0x30,
+0x34, 0x34, 0x30, 0x32, 0x32, 0x30, 0x32, 0x61,
+0x30, 0x62, 0x34, 0x62, 0x31, 0x32, 0x39, 0x34,
+0x64, 0x37, 0x30, 0x35, 0x34, 0x30, 0x32, 0x33,
+0x35, 0x61, 0x65, 0x30, 0x33, 0x33, 0x64, 0x37,
+0x38, 0x65, 0x36, 0x34, 0x62, 0x34, 0x38, 0x39,
+0x37, 0x65, 0x63, 0x38, 0x35, 0x39, 0x63, 0x37,
+0x62, 0x36, 0x66, 0x31, 0x62, 0x32, 0x62, 0x31,
+0x64, 0x38, 0x61, 0x30, 0x32, 0x65, 0x31, 0x64,
+0x34, 0x36, 0x30, 0x30, 0x36, 0x37, 0x30, 0x32,
+0x32, 0x30, 0x31, 0x34, 0x34, 0x35, 0x65, 0x37,
+0x35, 0x36, 0x64, 0x32, 0x32, 0x35, 0x34, 0x62,
+0x30, 0x66, 0x31, 0x64, 0x66, 0x64, 0x61, 0x39,
+0x61, 0x62, 0x38, 0x65, 0x31, 0x65, 0x31, 0x62,
+0x63, 0x32, 0x36, 0x64, 0x66, 0x39, 0x36, 0x36,
+0x38, 0x30, 0x37, 0x37, 0x34, 0x30, 0x33, 0x32,
+0x30, 0x34, 0x66, 0x33, 0x32, 0x64, 0x31, 0x36,
+0x61, 0x34, 0x39, 0x61, 0x33, 0x36, 0x65, 0x62,
+0x36, 0x39, 0x38, 0x33, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x30, 0x30, 0x30, 0x31,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x34, 0x39, 0x34, 0x38,
+0x33, 0x30, 0x34, 0x35, 0x30, 0x32, 0x32, 0x31,
+0x30, 0x30, 0x61, 0x63, 0x62, 0x39, 0x36, 0x63,
+0x66, 0x64, 0x62, 0x64, 0x61, 0x36, 0x64, 0x63,
+0x39, 0x34, 0x62, 0x34, 0x38, 0x39, 0x66, 0x64,
+0x30, 0x36, 0x66, 0x32, 0x64, 0x37, 0x32, 0x30,
+0x39, 0x38, 0x33, 0x62, 0x35, 0x66, 0x33, 0x35,
+0x30, 0x65, 0x33, 0x31, 0x62, 0x61, 0x39, 0x30,
+0x36, 0x63, 0x64, 0x62, 0x64, 0x38, 0x30, 0x30,
+0x37, 0x37, 0x33, 0x65, 0x38, 0x30, 0x62, 0x32,
+0x31, 0x63, 0x30, 0x32, 0x32, 0x30, 0x30, 0x64,
+0x37, 0x34, 0x65, 0x61, 0x35, 0x62, 0x64, 0x66,
+0x31, 0x31, 0x34, 0x32, 0x31, 0x32, 0x62, 0x34,
+0x62, 0x62, 0x65, 0x39, 0x65, 0x64, 0x38, 0x32,
+0x63, 0x33, 0x36, 0x64, 0x32, 0x65, 0x33, 0x36,
+0x39, 0x65, 0x33, 0x30, 0x32, 0x64, 0x66, 0x66,
+0x35, 0x37, 0x63, 0x62, 0x36, 0x30, 0x64, 0x30,
+0x31, 0x63, 0x34, 0x32, 0x38, 0x66, 0x30, 0x62,
+0x64, 0x33, 0x64, 0x61, 0x61, 0x62, 0x38, 0x33,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x30, 0x32, 0x65, 0x38, 0x30, 0x33, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x31, 0x35, 0x31, 0x65, 0x39,
+0x30, 0x33, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x35, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x22, 0x2c, 0x20, 0x22, 0x50, 0x32,
+0x53, 0x48, 0x2c, 0x57, 0x49, 0x54, 0x4e, 0x45,
+0x53, 0x53, 0x22, 0x5d, 0x2c, 0x0a, 0x0a, 0x5b,
+0x22, 0x42, 0x49, 0x50, 0x31, 0x34, 0x33, 0x20,
+0x65, 0x78, 0x61, 0x6d, 0x70, 0x6c, 0x65, 0x73,
+0x3a, 0x20, 0x64, 0x65, 0x74, 0x61, 0x69, 0x6c,
+0x73, 0x20, 0x61, 0x6e, 0x64, 0x20, 0x70, 0x72,
+0x69, 0x76, 0x61, 0x74, 0x65, 0x20, 0x6b, 0x65,
+0x79, 0x73, 0x20, 0x61, 0x72, 0x65, 0x20, 0x61,
+0x76, 0x61, 0x69, 0x6c, 0x61, 0x62, 0x6c, 0x65,
+0x20, 0x69, 0x6e, 0x20, 0x42, 0x49, 0x50, 0x31,
+0x34, 0x33, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x22,
+0x42, 0x49, 0x50, 0x31, 0x34, 0x33, 0x20, 0x65,
+0x78, 0x61, 0x6d, 0x70, 0x6c, 0x65, 0x3a, 0x20,
+0x50, 0x32, 0x57, 0x53, 0x48, 0x20, 0x77, 0x69,
+0x74, 0x68, 0x20, 0x4f, 0x50, 0x5f, 0x43, 0x4f,
+0x44, 0x45, 0x53, 0x45, 0x50, 0x41, 0x52, 0x41,
+0x54, 0x4f, 0x52, 0x20, 0x61, 0x6e, 0x64, 0x20,
+0x6f, 0x75, 0x74, 0x2d, 0x6f, 0x66, 0x2d, 0x72,
+0x61, 0x6e, 0x67, 0x65, 0x20, 0x53, 0x49, 0x47,
+0x48, 0x41, 0x53, 0x48, 0x5f, 0x53, 0x49, 0x4e,
+0x47, 0x4c, 0x45, 0x2e, 0x22, 0x5d, 0x2c, 0x0a,
+0x5b, 0x5b, 0x5b, 0x22, 0x36, 0x65, 0x62, 0x33,
+0x31, 0x36, 0x39, 0x32, 0x36, 0x62, 0x31, 0x63,
+0x35, 0x64, 0x35, 0x36, 0x37, 0x63, 0x64, 0x36,
+0x66, 0x35, 0x65, 0x36, 0x61, 0x38, 0x34, 0x66,
+0x65, 0x63, 0x36, 0x30, 0x36, 0x66, 0x63, 0x35,
+0x33, 0x64, 0x37, 0x62, 0x34, 0x37, 0x34, 0x35,
+0x32, 0x36, 0x64, 0x31, 0x66, 0x66, 0x66, 0x33,
+0x39, 0x34, 0x38, 0x30, 0x32, 0x30, 0x63, 0x39,
+0x33, 0x64, 0x66, 0x65, 0x22, 0x2c, 0x20, 0x30,
+0x2c, 0x20, 0x22, 0x30, 0x78, 0x32, 0x31, 0x20,
+0x30, 0x78, 0x30, 0x33, 0x36, 0x64, 0x35, 0x63,
+0x32, 0x30, 0x66, 0x61, 0x31, 0x34, 0x66, 0x62,
+0x32, 0x66, 0x36, 0x33, 0x35, 0x34, 0x37, 0x34,
+0x63, 0x31, 0x64, 0x63, 0x34, 0x65, 0x66, 0x35,
+0x39, 0x30, 0x39, 0x64, 0x34, 0x35, 0x36, 0x38,
+0x65, 0x35, 0x35, 0x36, 0x39, 0x62, 0x37, 0x39,
+0x66, 0x63, 0x39, 0x34, 0x64, 0x33, 0x34, 0x34,
+0x38, 0x34, 0x38, 0x36, 0x65, 0x31, 0x34, 0x36,
+0x38, 0x35, 0x66, 0x38, 0x20, 0x43, 0x48, 0x45,
+0x43, 0x4b, 0x53, 0x49, 0x47, 0x22, 0x2c, 0x20,
+0x31, 0x35, 0x36, 0x32, 0x35, 0x30, 0x30, 0x30,
+0x30, 0x5d, 0x2c, 0x0a, 0x5b, 0x22, 0x66, 0x38,
+0x32, 0x35, 0x36, 0x39, 0x30, 0x61, 0x65, 0x65,
+0x31, 0x62, 0x33, 0x64, 0x63, 0x32, 0x34, 0x37,
+0x64, 0x61, 0x37, 0x39, 0x36, 0x63, 0x61, 0x63,
+0x62, 0x31, 0x32, 0x36, 0x38, 0x37, 0x61, 0x35,
+0x65, 0x38, 0x30, 0x32, 0x34, 0x32, 0x39, 0x66,
+0x64, 0x32, 0x39, 0x31, 0x63, 0x66, 0x64, 0x36,
+0x33, 0x65, 0x30, 0x31, 0x30, 0x66, 0x30, 0x32,
+0x63, 0x66, 0x31, 0x35, 0x30, 0x38, 0x22, 0x2c,
+0x20, 0x30, 0x2c, 0x20, 0x22, 0x30, 0x78, 0x30,
+0x30, 0x20, 0x30, 0x78, 0x32, 0x30, 0x20, 0x30,
+0x78, 0x35, 0x64, 0x31, 0x62, 0x35, 0x36, 0x62,
+0x36, 0x33, 0x64, 0x37, 0x31, 0x34, 0x65, 0x65,
+0x62, 0x65, 0x35, 0x34, 0x32, 0x33, 0x30, 0x39,
+0x35, 0x32, 0x35, 0x66, 0x34, 0x38, 0x34, 0x62,
+0x37, 0x65, 0x39, 0x64, 0x36, 0x66, 0x36, 0x38,
+0x36, 0x62, 0x33, 0x37, 0x38, 0x31, 0x62, 0x36,
+0x66, 0x36, 0x31, 0x65, 0x66, 0x39, 0x32, 0x35,
+0x64, 0x36, 0x36, 0x64, 0x36, 0x66, 0x36, 0x61,
+0x30, 0x22, 0x2c, 0x20, 0x34, 0x39, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x5d, 0x5d,
+0x2c, 0x0a, 0x22, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30,
+0x32, 0x66, 0x65, 0x33, 0x64, 0x63, 0x39, 0x32,
+0x30, 0x38, 0x30, 0x39, 0x34, 0x66, 0x33, 0x66,
+0x66, 0x64, 0x31, 0x32, 0x36, 0x34, 0x35, 0x34,
+0x37, 0x37, 0x62, 0x33, 0x64, 0x63, 0x35, 0x36,
+0x66, 0x36, 0x30, 0x65, 0x63, 0x34, 0x66, 0x61,
+0x38, 0x65, 0x36, 0x66, 0x35, 0x64, 0x36, 0x37,
+0x63, 0x35, 0x36, 0x35, 0x64, 0x31, 0x63, 0x36,
+0x62, 0x39, 0x32, 0x31, 0x36, 0x62, 0x33, 0x36,
+0x65, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x34, 0x38, 0x34, 0x37, 0x33, 0x30, 0x34,
+0x34, 0x30, 0x32, 0x32, 0x30, 0x30, 0x61, 0x66,
+0x34, 0x65, 0x34, 0x37, 0x63, 0x39, 0x62, 0x39,
+0x36, 0x32, 0x39, 0x64, 0x62, 0x65, 0x63, 0x63,
+0x32, 0x31, 0x66, 0x37, 0x33, 0x61, 0x66, 0x39,
+0x38, 0x39, 0x62, 0x64, 0x61, 0x61, 0x39, 0x31,
+0x31, 0x66, 0x37, 0x65, 0x36, 0x66, 0x36, 0x63,
+0x32, 0x65, 0x39, 0x33, 0x39, 0x34, 0x35, 0x38,
+0x38, 0x61, 0x33, 0x61, 0x61, 0x36, 0x38, 0x66,
+0x38, 0x31, 0x65, 0x39, 0x39, 0x30, 0x32, 0x32,
+0x30, 0x34, 0x66, 0x33, 0x66, 0x63, 0x66, 0x36,
+0x61, 0x64, 0x65, 0x37, 0x65, 0x35, 0x61, 0x62,
+0x62, 0x31, 0x32, 0x39, 0x35, 0x62, 0x36, 0x37,
+0x37, 0x34, 0x63, 0x38, 0x65, 0x30, 0x61, 0x62,
+0x64, 0x39, 0x34, 0x61, 0x65, 0x36, 0x32, 0x32,
+0x31, 0x37, 0x33, 0x36, 0x37, 0x30, 0x39, 0x36,
+0x62, 0x63, 0x30, 0x32, 0x65, 0x65, 0x35, 0x65,
+0x34, 0x33, 0x35, 0x62, 0x36, 0x37, 0x64, 0x61,
+0x32, 0x30, 0x31, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x30, 0x38, 0x31, 0x35, 0x63,
+0x66, 0x30, 0x32, 0x30, 0x66, 0x30, 0x31, 0x33,
+0x65, 0x64, 0x36, 0x63, 0x66, 0x39, 0x31, 0x64,
+0x32, 0x39, 0x66, 0x34, 0x32, 0x30, 0x32, 0x65,
+0x38, 0x61, 0x35, 0x38, 0x37, 0x32, 0x36, 0x62,
+0x31, 0x61, 0x63, 0x36, 0x63, 0x37, 0x39, 0x64,
+0x61, 0x34, 0x37, 0x63, 0x32, 0x33, 0x64, 0x31,
+0x62, 0x65, 0x65, 0x30, 0x61, 0x36, 0x39, 0x32,
+0x35, 0x66, 0x38, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x30, 0x31, 0x30,
+0x30, 0x66, 0x32, 0x30, 0x35, 0x32, 0x61, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x39, 0x37, 0x36, 0x61, 0x39, 0x31, 0x34, 0x61,
+0x33, 0x30, 0x37, 0x34, 0x31, 0x66, 0x38, 0x31,
+0x34, 0x35, 0x65, 0x35, 0x61, 0x63, 0x61, 0x64,
+0x66, 0x32, 0x33, 0x66, 0x37, 0x35, 0x31, 0x38,
+0x36, 0x34, 0x31, 0x36, 0x37, 0x66, 0x33, 0x32,
+0x65, 0x30, 0x39, 0x36, 0x33, 0x66, 0x37, 0x38,
+0x38, 0x61, 0x63, 0x30, 0x30, 0x30, 0x33, 0x34,
+0x37, 0x33, 0x30, 0x34, 0x34, 0x30, 0x32, 0x32,
+0x30, 0x30, 0x64, 0x65, 0x36, 0x36, 0x61, 0x63,
+0x66, 0x34, 0x35, 0x32, 0x37, 0x37, 0x38, 0x39,
+0x62, 0x66, 0x64, 0x61, 0x35, 0x35, 0x66, 0x63,
+0x35, 0x34, 0x35, 0x39, 0x65, 0x32, 0x31, 0x34,
+0x66, 0x61, 0x36, 0x30, 0x38, 0x33, 0x66, 0x39,
+0x33, 0x36, 0x62, 0x34, 0x33, 0x30, 0x61, 0x37,
+0x36, 0x32, 0x63, 0x36, 0x32, 0x39, 0x36, 0x35,
+0x36, 0x32, 0x31, 0x36, 0x38, 0x30, 0x35, 0x61,
+0x63, 0x30, 0x32, 0x32, 0x30, 0x33, 0x39, 0x36,
+0x66, 0x35, 0x35, 0x30, 0x36, 0x39, 0x32, 0x63,
+0x64, 0x33, 0x34, 0x37, 0x31, 0x37, 0x31, 0x63,
+0x62, 0x63, 0x31, 0x65, 0x66, 0x31, 0x66, 0x35,
+0x31, 0x65, 0x31, 0x35, 0x32, 0x38, 0x32, 0x65,
+0x38, 0x33, 0x37, 0x62, 0x62, 0x32, 0x62, 0x33,
+0x30, 0x38, 0x36, 0x30, 0x64, 0x63, 0x37, 0x37,
+0x63, 0x38, 0x66, 0x37, 0x38, 0x62, 0x63, 0x38,
+0x35, 0x30, 0x31, 0x65, 0x35, 0x30, 0x33, 0x34,
+0x37, 0x33, 0x30, 0x34, 0x34, 0x30, 0x32, 0x32,
+0x30, 0x32, 0x37, 0x64, 0x63, 0x39, 0x35, 0x61,
+0x64, 0x36, 0x62, 0x37, 0x34, 0x30, 0x66, 0x65,
+0x35, 0x31, 0x32, 0x39, 0x65, 0x37, 0x65, 0x36,
+0x32, 0x61, 0x37, 0x35, 0x64, 0x64, 0x30, 0x30,
+0x66, 0x32, 0x39, 0x31, 0x61, 0x32, 0x61, 0x65,
+0x62, 0x31, 0x32, 0x30, 0x30, 0x62, 0x38, 0x34,
+0x62, 0x30, 0x39, 0x64, 0x39, 0x65, 0x33, 0x37,
+0x38, 0x39, 0x34, 0x30, 0x36, 0x62, 0x36, 0x63,
+0x30, 0x30, 0x32, 0x32, 0x30, 0x31, 0x61, 0x39,
+0x65, 0x63, 0x64, 0x33, 0x31, 0x35, 0x64, 0x64,
+0x36, 0x61, 0x30, 0x65, 0x36, 0x33, 0x32, 0x61,
+0x62, 0x32, 0x30, 0x62, 0x62, 0x62, 0x39, 0x38,
+0x39, 0x34, 0x38, 0x62, 0x63, 0x30, 0x63, 0x36,
+0x66, 0x62, 0x32, 0x30, 0x34, 0x66, 0x32, 0x63,
+0x32, 0x38, 0x36, 0x39, 0x36, 0x33, 0x62, 0x62,
+0x34, 0x38, 0x35, 0x31, 0x37, 0x61, 0x37, 0x30,
+0x35, 0x38, 0x65, 0x32, 0x37, 0x30, 0x33, 0x34,
+0x37, 0x32, 0x31, 0x30, 0x32, 0x36, 0x64, 0x63,
+0x63, 0x63, 0x37, 0x34, 0x39, 0x61, 0x64, 0x63,
+0x32, 0x61, 0x39, 0x64, 0x30, 0x64, 0x38, 0x39,
+0x34, 0x39, 0x37, 0x61, 0x63, 0x35, 0x31, 0x31,
+0x66, 0x37, 0x36, 0x30, 0x66, 0x34, 0x35, 0x63,
+0x34, 0x37, 0x64, 0x63, 0x35, 0x65, 0x64, 0x39,
+0x63, 0x66, 0x33, 0x35, 0x32, 0x61, 0x35, 0x38,
+0x61, 0x63, 0x37, 0x30, 0x36, 0x34, 0x35, 0x33,
+0x38, 0x38, 0x30, 0x61, 0x65, 0x61, 0x64, 0x61,
+0x62, 0x32, 0x31, 0x30, 0x32, 0x35, 0x35, 0x61,
+0x39, 0x36, 0x32, 0x36, 0x61, 0x65, 0x62, 0x66,
+0x35, 0x65, 0x32, 0x39, 0x63, 0x30, 0x65, 0x36,
+0x35, 0x33, 0x38, 0x34, 0x32, 0x38, 0x62, 0x61,
+0x30, 0x64, 0x31, 0x64, 0x63, 0x66, 0x36, 0x63,
+0x61, 0x39, 0x38, 0x66, 0x66, 0x64, 0x66, 0x30,
+0x38, 0x36, 0x61, 0x61, 0x38, 0x63, 0x65, 0x64,
+0x35, 0x65, 0x30, 0x64, 0x30, 0x32, 0x31, 0x35,
+0x65, 0x61, 0x34, 0x36, 0x35, 0x61, 0x63, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x22,
+0x2c, 0x20, 0x22, 0x50, 0x32, 0x53, 0x48, 0x2c,
+0x57, 0x49, 0x54, 0x4e, 0x45, 0x53, 0x53, 0x2c,
+0x43, 0x4f, 0x4e, 0x53, 0x54, 0x5f, 0x53, 0x43,
+0x52, 0x49, 0x50, 0x54, 0x43, 0x4f, 0x44, 0x45,
+0x22, 0x5d, 0x2c, 0x0a, 0x0a, 0x5b, 0x22, 0x42,
+0x49, 0x50, 0x31, 0x34, 0x33, 0x20, 0x65, 0x78,
+0x61, 0x6d, 0x70, 0x6c, 0x65, 0x3a, 0x20, 0x50,
+0x32, 0x57, 0x53, 0x48, 0x20, 0x77, 0x69, 0x74,
+0x68, 0x20, 0x75, 0x6e, 0x65, 0x78, 0x65, 0x63,
+0x75, 0x74, 0x65, 0x64, 0x20, 0x4f, 0x50, 0x5f,
+0x43, 0x4f, 0x44, 0x45, 0x53, 0x45, 0x50, 0x41,
+0x52, 0x41, 0x54, 0x4f, 0x52, 0x20, 0x61, 0x6e,
+0x64, 0x20, 0x53, 0x49, 0x4e, 0x47, 0x4c, 0x45,
+0x7c, 0x41, 0x4e, 0x59, 0x4f, 0x4e, 0x45, 0x43,
+0x41, 0x4e, 0x50, 0x41, 0x59, 0x22, 0x5d, 0x2c,
+0x0a, 0x5b, 0x5b, 0x5b, 0x22, 0x30, 0x31, 0x63,
+0x30, 0x63, 0x66, 0x37, 0x66, 0x62, 0x61, 0x36,
+0x35, 0x30, 0x36, 0x33, 0x38, 0x65, 0x35, 0x35,
+0x65, 0x62, 0x39, 0x31, 0x32, 0x36, 0x31, 0x62,
+0x31, 0x38, 0x33, 0x32, 0x35, 0x31, 0x66, 0x62,
+0x62, 0x34, 0x36, 0x36, 0x66, 0x39, 0x30, 0x64,
+0x66, 0x66, 0x31, 0x37, 0x66, 0x31, 0x30, 0x30,
+0x38, 0x36, 0x38, 0x31, 0x37, 0x63, 0x35, 0x34,
+0x32, 0x62, 0x35, 0x65, 0x39, 0x22, 0x2c, 0x20,
+0x30, 0x2c, 0x20, 0x22, 0x30, 0x78, 0x30, 0x30,
+0x20, 0x30, 0x78, 0x32, 0x30, 0x20, 0x30, 0x78,
+0x62, 0x61, 0x34, 0x36, 0x38, 0x65, 0x65, 0x61,
+0x35, 0x36, 0x31, 0x62, 0x32, 0x36, 0x33, 0x30,
+0x31, 0x65, 0x34, 0x63, 0x66, 0x36, 0x39, 0x66,
+0x61, 0x33, 0x34, 0x62, 0x64, 0x65, 0x34, 0x61,
+0x64, 0x36, 0x30, 0x63, 0x38, 0x31, 0x65, 0x37,
+0x30, 0x66, 0x30, 0x35, 0x39, 0x66, 0x30, 0x34,
+0x35, 0x63, 0x61, 0x39, 0x61, 0x37, 0x39, 0x39,
+0x33, 0x31, 0x30, 0x30, 0x34, 0x61, 0x34, 0x64,
+0x22, 0x2c, 0x20, 0x31, 0x36, 0x37, 0x37, 0x37,
+0x32, 0x31, 0x35, 0x5d, 0x2c, 0x0a, 0x5b, 0x22,
+0x31, 0x62, 0x32, 0x61, 0x39, 0x61, 0x34, 0x32,
+0x36, 0x62, 0x61, 0x36, 0x30, 0x33, 0x62, 0x61,
+0x33, 0x35, 0x37, 0x63, 0x65, 0x37, 0x37, 0x37,
+0x33, 0x63, 0x62, 0x35, 0x38, 0x30, 0x35, 0x63,
+0x62, 0x39, 0x63, 0x37, 0x63, 0x32, 0x62, 0x33,
+0x38, 0x36, 0x64, 0x31, 0x30, 0x30, 0x64, 0x31,
+0x66, 0x63, 0x39, 0x32, 0x36, 0x33, 0x35, 0x31,
+0x33, 0x31, 0x38, 0x38, 0x65, 0x36, 0x38, 0x30,
+0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20, 0x22, 0x30,
+0x78, 0x30, 0x30, 0x20, 0x30, 0x78, 0x32, 0x30,
+0x20, 0x30, 0x78, 0x64, 0x39, 0x62, 0x62, 0x66,
+0x62, 0x65, 0x35, 0x36, 0x61, 0x66, 0x37, 0x63,
+0x34, 0x62, 0x37, 0x66, 0x39, 0x36, 0x30, 0x61,
+0x37, 0x30, 0x64, 0x37, 0x65, 0x61, 0x31, 0x30,
+0x37, 0x31, 0x35, 0x36, 0x39, 0x31, 0x33, 0x64,
+0x39, 0x65, 0x35, 0x61, 0x32, 0x36, 0x62, 0x30,
+0x61, 0x37, 0x31, 0x34, 0x32, 0x39, 0x64, 0x66,
+0x35, 0x65, 0x30, 0x39, 0x37, 0x63, 0x61, 0x36,
+0x35, 0x33, 0x37, 0x22, 0x2c, 0x20, 0x31, 0x36,
+0x37, 0x37, 0x37, 0x32, 0x31, 0x35, 0x5d, 0x5d,
+0x2c, 0x0a, 0x22, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30,
+0x32, 0x65, 0x39, 0x62, 0x35, 0x34, 0x32, 0x63,
+0x35, 0x31, 0x37, 0x36, 0x38, 0x30, 0x38, 0x31,
+0x30, 0x37, 0x66, 0x66, 0x31, 0x64, 0x66, 0x39,
+0x30, 0x36, 0x66, 0x34, 0x36, 0x62, 0x62, 0x31,
+0x66, 0x32, 0x35, 0x38, 0x33, 0x62, 0x31, 0x36,
+0x31, 0x31, 0x32, 0x62, 0x39, 0x35, 0x65, 0x65,
+0x35, 0x33, 0x38, 0x30, 0x36, 0x36, 0x35, 0x62,
+0x61, 0x37, 0x66, 0x63, 0x66, 0x63, 0x30, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x38, 0x30, 0x65, 0x36, 0x38,
+0x38, 0x33, 0x31, 0x35, 0x31, 0x36, 0x33, 0x39,
+0x32, 0x66, 0x63, 0x64, 0x31, 0x30, 0x30, 0x64,
+0x31, 0x38, 0x36, 0x62, 0x33, 0x63, 0x32, 0x63,
+0x37, 0x62, 0x39, 0x35, 0x63, 0x38, 0x30, 0x62,
+0x35, 0x33, 0x63, 0x37, 0x37, 0x65, 0x37, 0x37,
+0x63, 0x33, 0x35, 0x62, 0x61, 0x30, 0x33, 0x61,
+0x36, 0x36, 0x62, 0x34, 0x32, 0x39, 0x61, 0x32,
+0x61, 0x31, 0x62, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x30, 0x32, 0x38,
+0x30, 0x39, 0x36, 0x39, 0x38, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x39, 0x37, 0x36, 0x61, 0x39, 0x31, 0x34, 0x64,
+0x65, 0x34, 0x62, 0x32, 0x33, 0x31, 0x36, 0x32,
+0x36, 0x65, 0x66, 0x35, 0x30, 0x38, 0x63, 0x39,
+0x61, 0x37, 0x34, 0x61, 0x38, 0x35, 0x31, 0x37,
+0x65, 0x36, 0x37, 0x38, 0x33, 0x63, 0x30, 0x35,
+0x34, 0x36, 0x64, 0x36, 0x62, 0x32, 0x38, 0x38,
+0x38, 0x61, 0x63, 0x38, 0x30, 0x39, 0x36, 0x39,
+0x38, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x31, 0x39, 0x37, 0x36, 0x61,
+0x39, 0x31, 0x34, 0x36, 0x36, 0x34, 0x38, 0x61,
+0x38, 0x63, 0x64, 0x34, 0x35, 0x33, 0x31, 0x65,
+0x31, 0x65, 0x63, 0x34, 0x37, 0x66, 0x33, 0x35,
+0x39, 0x31, 0x36, 0x64, 0x65, 0x38, 0x65, 0x32,
+0x35, 0x39, 0x32, 0x33, 0x37, 0x32, 0x39, 0x34,
+0x64, 0x31, 0x65, 0x38, 0x38, 0x61, 0x63, 0x30,
+0x32, 0x34, 0x38, 0x33, 0x30, 0x34, 0x35, 0x30,
+0x32, 0x32, 0x31, 0x30, 0x30, 0x66, 0x36, 0x61,
+0x31, 0x30, 0x62, 0x38, 0x36, 0x30, 0x34, 0x65,
+0x36, 0x64, 0x63, 0x39, 0x31, 0x30, 0x31, 0x39,
+0x34, 0x62, 0x37, 0x39, 0x63, 0x63, 0x66, 0x63,
+0x39, 0x33, 0x65, 0x31, 0x62, 0x63, 0x30, 0x65,
+0x63, 0x37, 0x63, 0x30, 0x33, 0x34, 0x35, 0x33,
+0x63, 0x61, 0x61, 0x61, 0x38, 0x39, 0x38, 0x37,
+0x66, 0x37, 0x64, 0x36, 0x63, 0x33, 0x34, 0x31,
+0x33, 0x35, 0x36, 0x36, 0x30, 0x30, 0x32, 0x32,
+0x30, 0x36, 0x32, 0x31, 0x36, 0x32, 0x32, 0x39,
+0x65, 0x64, 0x65, 0x39, 0x62, 0x34, 0x64, 0x36,
+0x65, 0x63, 0x32, 0x64, 0x33, 0x32, 0x35, 0x62,
+0x65, 0x32, 0x34, 0x35, 0x63, 0x35, 0x62, 0x35,
+0x30, 0x38, 0x66, 0x66, 0x30, 0x33, 0x33, 0x39,
+0x62, 0x66, 0x31, 0x37, 0x39, 0x34, 0x30, 0x37,
+0x38, 0x65, 0x32, 0x30, 0x62, 0x66, 0x65, 0x30,
+0x62, 0x61, 0x62, 0x63, 0x37, 0x66, 0x66, 0x65,
+0x36, 0x38, 0x33, 0x32, 0x37, 0x30, 0x30, 0x36,
+0x33, 0x61, 0x62, 0x36, 0x38, 0x32, 0x31, 0x30,
+0x33, 0x39, 0x32, 0x39, 0x37, 0x32, 0x65, 0x32,
+0x65, 0x62, 0x36, 0x31, 0x37, 0x62, 0x32, 0x33,
+0x38, 0x38, 0x37, 0x37, 0x31, 0x61, 0x62, 0x65,
+0x32, 0x37, 0x32, 0x33, 0x35, 0x66, 0x64, 0x35,
+0x61, 0x63, 0x34, 0x34, 0x61, 0x66, 0x38, 0x65,
+0x36, 0x31, 0x36, 0x39, 0x33, 0x32, 0x36, 0x31,
+0x35, 0x35, 0x30, 0x34, 0x34, 0x37, 0x61, 0x34,
+0x63, 0x33, 0x65, 0x33, 0x39, 0x64, 0x61, 0x39,
+0x38, 0x61, 0x63, 0x30, 0x32, 0x34, 0x37, 0x33,
+0x30, 0x34, 0x34, 0x30, 0x32, 0x32, 0x30, 0x30,
+0x33, 0x32, 0x35, 0x32, 0x31, 0x38, 0x30, 0x32,
+0x61, 0x37, 0x36, 0x61, 0x64, 0x37, 0x62, 0x66,
+0x37, 0x34, 0x64, 0x30, 0x65, 0x32, 0x63, 0x32,
+0x31, 0x38, 0x62, 0x37, 0x32, 0x63, 0x66, 0x30,
+0x63, 0x62, 0x63, 0x38, 0x36, 0x37, 0x30, 0x36,
+0x36, 0x65, 0x32, 0x65, 0x35, 0x33, 0x64, 0x62,
+0x39, 0x30, 0x35, 0x62, 0x61, 0x33, 0x37, 0x66,
+0x31, 0x33, 0x30, 0x33, 0x39, 0x37, 0x65, 0x30,
+0x32, 0x32, 0x30, 0x37, 0x37, 0x30, 0x39, 0x65,
+0x32, 0x31, 0x38, 0x38, 0x65, 0x64, 0x37, 0x66,
+0x30, 0x38, 0x66, 0x34, 0x63, 0x39, 0x35, 0x32,
+0x64, 0x39, 0x64, 0x31, 0x33, 0x39, 0x38, 0x36,
+0x64, 0x61, 0x35, 0x30, 0x34, 0x35, 0x30, 0x32,
+0x62, 0x38, 0x63, 0x33, 0x62, 0x65, 0x35, 0x39,
+0x36, 0x31, 0x37, 0x65, 0x30, 0x34, 0x33, 0x35,
+0x35, 0x32, 0x66, 0x35, 0x30, 0x36, 0x63, 0x34,
+0x36, 0x66, 0x66, 0x38, 0x33, 0x32, 0x37, 0x35,
+0x31, 0x36, 0x33, 0x61, 0x62, 0x36, 0x38, 0x32,
+0x31, 0x30, 0x33, 0x39, 0x32, 0x39, 0x37, 0x32,
+0x65, 0x32, 0x65, 0x62, 0x36, 0x31, 0x37, 0x62,
+0x32, 0x33, 0x38, 0x38, 0x37, 0x37, 0x31, 0x61,
+0x62, 0x65, 0x32, 0x37, 0x32, 0x33, 0x35, 0x66,
+0x64, 0x35, 0x61, 0x63, 0x34, 0x34, 0x61, 0x66,
+0x38, 0x65, 0x36, 0x31, 0x36, 0x39, 0x33, 0x32,
+0x36, 0x31, 0x35, 0x35, 0x30, 0x34, 0x34, 0x37,
+0x61, 0x34, 0x63, 0x33, 0x65, 0x33, 0x39, 0x64,
+0x61, 0x39, 0x38, 0x61, 0x63, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x22, 0x2c, 0x20,
+0x22, 0x50, 0x32, 0x53, 0x48, 0x2c, 0x57, 0x49,
+0x54, 0x4e, 0x45, 0x53, 0x53, 0x2c, 0x43, 0x4f,
+0x4e, 0x53, 0x54, 0x5f, 0x53, 0x43, 0x52, 0x49,
+0x50, 0x54, 0x43, 0x4f, 0x44, 0x45, 0x22, 0x5d,
+0x2c, 0x0a, 0x0a, 0x5b, 0x22, 0x42, 0x49, 0x50,
+0x31, 0x34, 0x33, 0x20, 0x65, 0x78, 0x61, 0x6d,
+0x70, 0x6c, 0x65, 0x3a, 0x20, 0x53, 0x61, 0x6d,
+0x65, 0x20, 0x61, 0x73, 0x20, 0x74, 0x68, 0x65,
+0x20, 0x70, 0x72, 0x65, 0x76, 0x69, 0x6f, 0x75,
+0x73, 0x20, 0x65, 0x78, 0x61, 0x6d, 0x70, 0x6c,
+0x65, 0x20, 0x77, 0x69, 0x74, 0x68, 0x20, 0x69,
+0x6e, 0x70, 0x75, 0x74, 0x2d, 0x6f, 0x75, 0x74,
+0x70, 0x75, 0x74, 0x20, 0x70, 0x61, 0x69, 0x72,
+0x73, 0x20, 0x73, 0x77, 0x61, 0x70, 0x70, 0x65,
+0x64, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b, 0x5b,
+0x22, 0x31, 0x62, 0x32, 0x61, 0x39, 0x61, 0x34,
+0x32, 0x36, 0x62, 0x61, 0x36, 0x30, 0x33, 0x62,
+0x61, 0x33, 0x35, 0x37, 0x63, 0x65, 0x37, 0x37,
+0x37, 0x33, 0x63, 0x62, 0x35, 0x38, 0x30, 0x35,
+0x63, 0x62, 0x39, 0x63, 0x37, 0x63, 0x32, 0x62,
+0x33, 0x38, 0x36, 0x64, 0x31, 0x30, 0x30, 0x64,
+0x31, 0x66, 0x63, 0x39, 0x32, 0x36, 0x33, 0x35,
+0x31, 0x33, 0x31, 0x38, 0x38, 0x65, 0x36, 0x38,
+0x30, 0x22, 0x2c, 0x20, 0x30, 0x2c, 0x20, 0x22,
+0x30, 0x78, 0x30, 0x30, 0x20, 0x30, 0x78, 0x32,
+0x30, 0x20, 0x30, 0x78, 0x64, 0x39, 0x62, 0x62,
+0x66, 0x62, 0x65, 0x35, 0x36, 0x61, 0x66, 0x37,
+0x63, 0x34, 0x62, 0x37, 0x66, 0x39, 0x36, 0x30,
+0x61, 0x37, 0x30, 0x64, 0x37, 0x65, 0x61, 0x31,
+0x30, 0x37, 0x31, 0x35, 0x36, 0x39, 0x31, 0x33,
+0x64, 0x39, 0x65, 0x35, 0x61, 0x32, 0x36, 0x62,
+0x30, 0x61, 0x37, 0x31, 0x34, 0x32, 0x39, 0x64,
+0x66, 0x35, 0x65, 0x30, 0x39, 0x37, 0x63, 0x61,
+0x36, 0x35, 0x33, 0x37, 0x22, 0x2c, 0x20, 0x31,
+0x36, 0x37, 0x37, 0x37, 0x32, 0x31, 0x35, 0x5d,
+0x2c, 0x0a, 0x5b, 0x22, 0x30, 0x31, 0x63, 0x30,
+0x63, 0x66, 0x37, 0x66, 0x62, 0x61, 0x36, 0x35,
+0x30, 0x36, 0x33, 0x38, 0x65, 0x35, 0x35, 0x65,
+0x62, 0x39, 0x31, 0x32, 0x36, 0x31, 0x62, 0x31,
+0x38, 0x33, 0x32, 0x35, 0x31, 0x66, 0x62, 0x62,
+0x34, 0x36, 0x36, 0x66, 0x39, 0x30, 0x64, 0x66,
+0x66, 0x31, 0x37, 0x66, 0x31, 0x30, 0x30, 0x38,
+0x36, 0x38, 0x31, 0x37, 0x63, 0x35, 0x34, 0x32,
+0x62, 0x35, 0x65, 0x39, 0x22, 0x2c, 0x20, 0x30,
+0x2c, 0x20, 0x22, 0x30, 0x78, 0x30, 0x30, 0x20,
+0x30, 0x78, 0x32, 0x30, 0x20, 0x30, 0x78, 0x62,
+0x61, 0x34, 0x36, 0x38, 0x65, 0x65, 0x61, 0x35,
+0x36, 0x31, 0x62, 0x32, 0x36, 0x33, 0x30, 0x31,
+0x65, 0x34, 0x63, 0x66, 0x36, 0x39, 0x66, 0x61,
+0x33, 0x34, 0x62, 0x64, 0x65, 0x34, 0x61, 0x64,
+0x36, 0x30, 0x63, 0x38, 0x31, 0x65, 0x37, 0x30,
+0x66, 0x30, 0x35, 0x39, 0x66, 0x30, 0x34, 0x35,
+0x63, 0x61, 0x39, 0x61, 0x37, 0x39, 0x39, 0x33,
+0x31, 0x30, 0x30, 0x34, 0x61, 0x34, 0x64, 0x22,
+0x2c, 0x20, 0x31, 0x36, 0x37, 0x37, 0x37, 0x32,
+0x31, 0x35, 0x5d, 0x5d, 0x2c, 0x0a, 0x22, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x31, 0x30, 0x32, 0x38, 0x30, 0x65,
+0x36, 0x38, 0x38, 0x33, 0x31, 0x35, 0x31, 0x36,
+0x33, 0x39, 0x32, 0x66, 0x63, 0x64, 0x31, 0x30,
+0x30, 0x64, 0x31, 0x38, 0x36, 0x62, 0x33, 0x63,
+0x32, 0x63, 0x37, 0x62, 0x39, 0x35, 0x63, 0x38,
+0x30, 0x62, 0x35, 0x33, 0x63, 0x37, 0x37, 0x65,
+0x37, 0x37, 0x63, 0x33, 0x35, 0x62, 0x61, 0x30,
+0x33, 0x61, 0x36, 0x36, 0x62, 0x34, 0x32, 0x39,
+0x61, 0x32, 0x61, 0x31, 0x62, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x65,
+0x39, 0x62, 0x35, 0x34, 0x32, 0x63, 0x35, 0x31,
+0x37, 0x36, 0x38, 0x30, 0x38, 0x31, 0x30, 0x37,
+0x66, 0x66, 0x31, 0x64, 0x66, 0x39, 0x30, 0x36,
+0x66, 0x34, 0x36, 0x62, 0x62, 0x31, 0x66, 0x32,
+0x35, 0x38, 0x33, 0x62, 0x31, 0x36, 0x31, 0x31,
+0x32, 0x62, 0x39, 0x35, 0x65, 0x65, 0x35, 0x33,
+0x38, 0x30, 0x36, 0x36, 0x35, 0x62, 0x61, 0x37,
+0x66, 0x63, 0x66, 0x63, 0x30, 0x30, 0x31, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x30, 0x32, 0x38, 0x30, 0x39, 0x36, 0x39,
+0x38, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x31, 0x39, 0x37, 0x36, 0x61,
+0x39, 0x31, 0x34, 0x36, 0x36, 0x34, 0x38, 0x61,
+0x38, 0x63, 0x64, 0x34, 0x35, 0x33, 0x31, 0x65,
+0x31, 0x65, 0x63, 0x34, 0x37, 0x66, 0x33, 0x35,
+0x39, 0x31, 0x36, 0x64, 0x65, 0x38, 0x65, 0x32,
+0x35, 0x39, 0x32, 0x33, 0x37, 0x32, 0x39, 0x34,
+0x64, 0x31, 0x65, 0x38, 0x38, 0x61, 0x63, 0x38,
+0x30, 0x39, 0x36, 0x39, 0x38, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31,
+0x39, 0x37, 0x36, 0x61, 0x39, 0x31, 0x34, 0x64,
+0x65, 0x34, 0x62, 0x32, 0x33, 0x31, 0x36, 0x32,
+0x36, 0x65, 0x66, 0x35, 0x30, 0x38, 0x63, 0x39,
+0x61, 0x37, 0x34, 0x61, 0x38, 0x35, 0x31, 0x37,
+0x65, 0x36, 0x37, 0x38, 0x33, 0x63, 0x30, 0x35,
+0x34, 0x36, 0x64, 0x36, 0x62, 0x32, 0x38, 0x38,
+0x38, 0x61, 0x63, 0x30, 0x32, 0x34, 0x37, 0x33,
+0x30, 0x34, 0x34, 0x30, 0x32, 0x32, 0x30, 0x30,
+0x33, 0x32, 0x35, 0x32, 0x31, 0x38, 0x30, 0x32,
+0x61, 0x37, 0x36, 0x61, 0x64, 0x37, 0x62, 0x66,
+0x37, 0x34, 0x64, 0x30, 0x65, 0x32, 0x63, 0x32,
+0x31, 0x38, 0x62, 0x37, 0x32, 0x63, 0x66, 0x30,
+0x63, 0x62, 0x63, 0x38, 0x36, 0x37, 0x30, 0x36,
+0x36, 0x65, 0x32, 0x65, 0x35, 0x33, 0x64, 0x62,
+0x39, 0x30, 0x35, 0x62, 0x61, 0x33, 0x37, 0x66,
+0x31, 0x33, 0x30, 0x33, 0x39, 0x37, 0x65, 0x30,
+0x32, 0x32, 0x30, 0x37, 0x37, 0x30, 0x39, 0x65,
+0x32, 0x31, 0x38, 0x38, 0x65, 0x64, 0x37, 0x66,
+0x30, 0x38, 0x66, 0x34, 0x63, 0x39, 0x35, 0x32,
+0x64, 0x39, 0x64, 0x31, 0x33, 0x39, 0x38, 0x36,
+0x64, 0x61, 0x35, 0x30, 0x34, 0x35, 0x30, 0x32,
+0x62, 0x38, 0x63, 0x33, 0x62, 0x65, 0x35, 0x39,
+0x36, 0x31, 0x37, 0x65, 0x30, 0x34, 0x33, 0x35,
+0x35, 0x32, 0x66, 0x35, 0x30, 0x36, 0x63, 0x34,
+0x36, 0x66, 0x66, 0x38, 0x33, 0x32, 0x37, 0x35,
+0x31, 0x36, 0x33, 0x61, 0x62, 0x36, 0x38, 0x32,
+0x31, 0x30, 0x33, 0x39, 0x32, 0x39, 0x37, 0x32,
+0x65, 0x32, 0x65, 0x62, 0x36, 0x31, 0x37, 0x62,
+0x32, 0x33, 0x38, 0x38, 0x37, 0x37, 0x31, 0x61,
+0x62, 0x65, 0x32, 0x37, 0x32, 0x33, 0x35, 0x66,
+0x64, 0x35, 0x61, 0x63, 0x34, 0x34, 0x61, 0x66,
+0x38, 0x65, 0x36, 0x31, 0x36, 0x39, 0x33, 0x32,
+0x36, 0x31, 0x35, 0x35, 0x30, 0x34, 0x34, 0x37,
+0x61, 0x34, 0x63, 0x33, 0x65, 0x33, 0x39, 0x64,
+0x61, 0x39, 0x38, 0x61, 0x63, 0x30, 0x32, 0x34,
+0x38, 0x33, 0x30, 0x34, 0x35, 0x30, 0x32, 0x32,
+0x31, 0x30, 0x30, 0x66, 0x36, 0x61, 0x31, 0x30,
+0x62, 0x38, 0x36, 0x30, 0x34, 0x65, 0x36, 0x64,
+0x63, 0x39, 0x31, 0x30, 0x31, 0x39, 0x34, 0x62,
+0x37, 0x39, 0x63, 0x63, 0x66, 0x63, 0x39, 0x33,
+0x65, 0x31, 0x62, 0x63, 0x30, 0x65, 0x63, 0x37,
+0x63, 0x30, 0x33, 0x34, 0x35, 0x33, 0x63, 0x61,
+0x61, 0x61, 0x38, 0x39, 0x38, 0x37, 0x66, 0x37,
+0x64, 0x36, 0x63, 0x33, 0x34, 0x31, 0x33, 0x35,
+0x36, 0x36, 0x30, 0x30, 0x32, 0x32, 0x30, 0x36,
+0x32, 0x31, 0x36, 0x32, 0x32, 0x39, 0x65, 0x64,
+0x65, 0x39, 0x62, 0x34, 0x64, 0x36, 0x65, 0x63,
+0x32, 0x64, 0x33, 0x32, 0x35, 0x62, 0x65, 0x32,
+0x34, 0x35, 0x63, 0x35, 0x62, 0x35, 0x30, 0x38,
+0x66, 0x66, 0x30, 0x33, 0x33, 0x39, 0x62, 0x66,
+0x31, 0x37, 0x39, 0x34, 0x30, 0x37, 0x38, 0x65,
+0x32, 0x30, 0x62, 0x66, 0x65, 0x30, 0x62, 0x61,
+0x62, 0x63, 0x37, 0x66, 0x66, 0x65, 0x36, 0x38,
+0x33, 0x32, 0x37, 0x30, 0x30, 0x36, 0x33, 0x61,
+0x62, 0x36, 0x38, 0x32, 0x31, 0x30, 0x33, 0x39,
+0x32, 0x39, 0x37, 0x32, 0x65, 0x32, 0x65, 0x62,
+0x36, 0x31, 0x37, 0x62, 0x32, 0x33, 0x38, 0x38,
+0x37, 0x37, 0x31, 0x61, 0x62, 0x65, 0x32, 0x37,
+0x32, 0x33, 0x35, 0x66, 0x64, 0x35, 0x61, 0x63,
+0x34, 0x34, 0x61, 0x66, 0x38, 0x65, 0x36, 0x31,
+0x36, 0x39, 0x33, 0x32, 0x36, 0x31, 0x35, 0x35,
+0x30, 0x34, 0x34, 0x37, 0x61, 0x34, 0x63, 0x33,
+0x65, 0x33, 0x39, 0x64, 0x61, 0x39, 0x38, 0x61,
+0x63, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x22, 0x2c, 0x20, 0x22, 0x50, 0x32, 0x53,
+0x48, 0x2c, 0x57, 0x49, 0x54, 0x4e, 0x45, 0x53,
+0x53, 0x2c, 0x43, 0x4f, 0x4e, 0x53, 0x54, 0x5f,
+0x53, 0x43, 0x52, 0x49, 0x50, 0x54, 0x43, 0x4f,
+0x44, 0x45, 0x22, 0x5d, 0x2c, 0x0a, 0x0a, 0x5b,
+0x22, 0x42, 0x49, 0x50, 0x31, 0x34, 0x33, 0x20,
+0x65, 0x78, 0x61, 0x6d, 0x70, 0x6c, 0x65, 0x3a,
+0x20, 0x50, 0x32, 0x53, 0x48, 0x2d, 0x50, 0x32,
+0x57, 0x53, 0x48, 0x20, 0x36, 0x2d, 0x6f, 0x66,
+0x2d, 0x36, 0x20, 0x6d, 0x75, 0x6c, 0x74, 0x69,
+0x73, 0x69, 0x67, 0x20, 0x73, 0x69, 0x67, 0x6e,
+0x65, 0x64, 0x20, 0x77, 0x69, 0x74, 0x68, 0x20,
+0x36, 0x20, 0x64, 0x69, 0x66, 0x66, 0x65, 0x72,
+0x65, 0x6e, 0x74, 0x20, 0x53, 0x49, 0x47, 0x48,
+0x41, 0x53, 0x48, 0x20, 0x74, 0x79, 0x70, 0x65,
+0x73, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b, 0x5b,
+0x22, 0x36, 0x65, 0x62, 0x39, 0x38, 0x37, 0x39,
+0x37, 0x61, 0x32, 0x31, 0x63, 0x36, 0x63, 0x31,
+0x30, 0x61, 0x61, 0x37, 0x34, 0x65, 0x64, 0x66,
+0x32, 0x39, 0x64, 0x36, 0x31, 0x38, 0x62, 0x65,
+0x31, 0x30, 0x39, 0x66, 0x34, 0x38, 0x61, 0x38,
+0x65, 0x39, 0x34, 0x63, 0x36, 0x39, 0x34, 0x66,
+0x33, 0x37, 0x30, 0x31, 0x65, 0x30, 0x38, 0x63,
+0x61, 0x36, 0x39, 0x31, 0x38, 0x36, 0x34, 0x33,
+0x36, 0x22, 0x2c, 0x20, 0x31, 0x2c, 0x20, 0x22,
+0x48, 0x41, 0x53, 0x48, 0x31, 0x36, 0x30, 0x20,
+0x30, 0x78, 0x31, 0x34, 0x20, 0x30, 0x78, 0x39,
+0x39, 0x39, 0x33, 0x61, 0x34, 0x32, 0x39, 0x30,
+0x33, 0x37, 0x62, 0x35, 0x64, 0x39, 0x31, 0x32,
+0x34, 0x30, 0x37, 0x61, 0x37, 0x31, 0x63, 0x32,
+0x35, 0x32, 0x30, 0x31, 0x39, 0x32, 0x38, 0x37,
+0x62, 0x38, 0x64, 0x32, 0x37, 0x61, 0x35, 0x20,
+0x45, 0x51, 0x55, 0x41, 0x4c, 0x22, 0x2c, 0x20,
+0x39, 0x38, 0x37, 0x36, 0x35, 0x34, 0x33, 0x32,
+0x31, 0x5d, 0x5d, 0x2c, 0x0a, 0x22, 0x30, 0x31,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x31, 0x30, 0x31, 0x33, 0x36, 0x36, 0x34,
+0x31, 0x38, 0x36, 0x39, 0x63, 0x61, 0x30, 0x38,
+0x31, 0x65, 0x37, 0x30, 0x66, 0x33, 0x39, 0x34,
+0x63, 0x36, 0x39, 0x34, 0x38, 0x65, 0x38, 0x61,
+0x66, 0x34, 0x30, 0x39, 0x65, 0x31, 0x38, 0x62,
+0x36, 0x31, 0x39, 0x64, 0x66, 0x32, 0x65, 0x64,
+0x37, 0x34, 0x61, 0x61, 0x31, 0x30, 0x36, 0x63,
+0x31, 0x63, 0x61, 0x32, 0x39, 0x37, 0x38, 0x37,
+0x62, 0x39, 0x36, 0x65, 0x30, 0x31, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x32, 0x33, 0x32, 0x32,
+0x30, 0x30, 0x32, 0x30, 0x61, 0x31, 0x36, 0x62,
+0x35, 0x37, 0x35, 0x35, 0x66, 0x37, 0x66, 0x36,
+0x66, 0x39, 0x36, 0x64, 0x62, 0x64, 0x36, 0x35,
+0x66, 0x35, 0x66, 0x30, 0x64, 0x36, 0x61, 0x62,
+0x39, 0x34, 0x31, 0x38, 0x62, 0x38, 0x39, 0x61,
+0x66, 0x34, 0x62, 0x31, 0x66, 0x31, 0x34, 0x61,
+0x31, 0x62, 0x62, 0x38, 0x61, 0x30, 0x39, 0x30,
+0x36, 0x32, 0x63, 0x33, 0x35, 0x66, 0x30, 0x64,
+0x63, 0x62, 0x35, 0x34, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x30, 0x32, 0x30, 0x30,
+0x65, 0x39, 0x61, 0x34, 0x33, 0x35, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x39,
+0x37, 0x36, 0x61, 0x39, 0x31, 0x34, 0x33, 0x38,
+0x39, 0x66, 0x66, 0x63, 0x65, 0x39, 0x63, 0x64,
+0x39, 0x61, 0x65, 0x38, 0x38, 0x64, 0x63, 0x63,
+0x30, 0x36, 0x33, 0x31, 0x65, 0x38, 0x38, 0x61,
+0x38, 0x32, 0x31, 0x66, 0x66, 0x64, 0x62, 0x65,
+0x39, 0x62, 0x66, 0x65, 0x32, 0x36, 0x38, 0x38,
+0x61, 0x63, 0x63, 0x30, 0x38, 0x33, 0x32, 0x66,
+0x30, 0x35, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x31, 0x39, 0x37, 0x36, 0x61, 0x39,
+0x31, 0x34, 0x37, 0x34, 0x38, 0x30, 0x61, 0x33,
+0x33, 0x66, 0x39, 0x35, 0x30, 0x36, 0x38, 0x39,
+0x61, 0x66, 0x35, 0x31, 0x31, 0x65, 0x36, 0x65,
+0x38, 0x34, 0x63, 0x31, 0x33, 0x38, 0x64, 0x62,
+0x62, 0x64, 0x33, 0x63, 0x33, 0x65, 0x65, 0x34,
+0x31, 0x35, 0x38, 0x38, 0x61, 0x63, 0x30, 0x38,
+0x30, 0x30, 0x34, 0x37, 0x33, 0x30, 0x34, 0x34,
+0x30, 0x32, 0x32, 0x30, 0x36, 0x61, 0x63, 0x34,
+0x34, 0x64, 0x36, 0x37, 0x32, 0x64, 0x61, 0x63,
+0x34, 0x31, 0x66, 0x39, 0x62, 0x30, 0x30, 0x65,
+0x32, 0x38, 0x66, 0x34, 0x64, 0x66, 0x32, 0x30,
+0x63, 0x35, 0x32, 0x65, 0x65, 0x62, 0x30, 0x38,
+0x37, 0x32, 0x30, 0x37, 0x65, 0x38, 0x64, 0x37,
+0x35, 0x38, 0x64, 0x37, 0x36, 0x64, 0x39, 0x32,
+0x63, 0x36, 0x66, 0x61, 0x62, 0x33, 0x62, 0x37,
+0x33, 0x65, 0x32, 0x62, 0x30, 0x32, 0x32, 0x30,
+0x33, 0x36, 0x37, 0x37, 0x35, 0x30, 0x64, 0x62,
+0x62, 0x65, 0x31, 0x39, 0x32, 0x39, 0x30, 0x30,
+0x36, 0x39, 0x63, 0x62, 0x61, 0x35, 0x33, 0x64,
+0x30, 0x39, 0x36, 0x66, 0x34, 0x34, 0x35, 0x33,
+0x30, 0x65, 0x34, 0x66, 0x39, 0x38, 0x61, 0x63,
+0x61, 0x61, 0x35, 0x39, 0x34, 0x38, 0x31, 0x30,
+0x33, 0x38, 0x38, 0x63, 0x66, 0x37, 0x34, 0x30,
+0x39, 0x61, 0x31, 0x38, 0x37, 0x30, 0x63, 0x65,
+0x30, 0x31, 0x34, 0x37, 0x33, 0x30, 0x34, 0x34,
+0x30, 0x32, 0x32, 0x30, 0x36, 0x38, 0x63, 0x37,
+0x39, 0x34, 0x36, 0x61, 0x34, 0x33, 0x32, 0x33,
+0x32, 0x37, 0x35, 0x37, 0x63, 0x62, 0x64, 0x66,
+0x39, 0x31, 0x37, 0x36, 0x66, 0x30, 0x30, 0x39,
+0x61, 0x39, 0x32, 0x38, 0x65, 0x31, 0x63, 0x64,
+0x39, 0x61, 0x31, 0x61, 0x38, 0x63, 0x32, 0x31,
+0x32, 0x66, 0x31, 0x35, 0x63, 0x31, 0x65, 0x31,
+0x31, 0x61, 0x63, 0x39, 0x66, 0x32, 0x39, 0x32,
+0x35, 0x64, 0x39, 0x30, 0x30, 0x32, 0x32, 0x30,
+0x35, 0x62, 0x37, 0x35, 0x66, 0x39, 0x33, 0x37,
+0x66, 0x66, 0x32, 0x66, 0x39, 0x66, 0x33, 0x63,
+0x31, 0x32, 0x34, 0x36, 0x65, 0x35, 0x34, 0x37,
+0x65, 0x35, 0x34, 0x66, 0x36, 0x32, 0x65, 0x30,
+0x32, 0x37, 0x66, 0x36, 0x34, 0x65, 0x65, 0x66,
+0x61, 0x32, 0x36, 0x39, 0x35, 0x35, 0x37, 0x38,
+0x63, 0x63, 0x36, 0x34, 0x33, 0x32, 0x63, 0x64,
+0x61, 0x62, 0x63, 0x65, 0x32, 0x37, 0x31, 0x35,
+0x30, 0x32, 0x34, 0x37, 0x33, 0x30, 0x34, 0x34,
+0x30, 0x32, 0x32, 0x30, 0x35, 0x39, 0x65, 0x62,
+0x66, 0x35, 0x36, 0x64, 0x39, 0x38, 0x30, 0x31,
+0x30, 0x61, 0x39, 0x33, 0x32, 0x63, 0x66, 0x38,
+0x65, 0x63, 0x66, 0x65, 0x63, 0x35, 0x34, 0x63,
+0x34, 0x38, 0x65, 0x36, 0x31, 0x33, 0x39, 0x65,
+0x64, 0x36, 0x61, 0x64, 0x62, 0x30, 0x37, 0x32,
+0x38, 0x63, 0x30, 0x39, 0x63, 0x62, 0x65, 0x31,
+0x65, 0x34, 0x66, 0x61, 0x30, 0x39, 0x31, 0x35,
+0x33, 0x30, 0x32, 0x65, 0x30, 0x32, 0x32, 0x30,
+0x30, 0x37, 0x63, 0x64, 0x39, 0x38, 0x36, 0x63,
+0x38, 0x66, 0x61, 0x38, 0x37, 0x30, 0x66, 0x66,
+0x35, 0x64, 0x32, 0x62, 0x33, 0x61, 0x38, 0x39,
+0x31, 0x33, 0x39, 0x63, 0x39, 0x66, 0x65, 0x37,
+0x65, 0x34, 0x39, 0x39, 0x32, 0x35, 0x39, 0x38,
+0x37, 0x35, 0x33, 0x35, 0x37, 0x65, 0x32, 0x30,
+0x66, 0x63, 0x62, 0x62, 0x31, 0x35, 0x35, 0x37,
+0x31, 0x63, 0x37, 0x36, 0x37, 0x39, 0x35, 0x34,
+0x30, 0x33, 0x34, 0x38, 0x33, 0x30, 0x34, 0x35,
+0x30, 0x32, 0x32, 0x31, 0x30, 0x30, 0x66, 0x62,
+0x65, 0x66, 0x64, 0x39, 0x34, 0x62, 0x64, 0x30,
+0x61, 0x34, 0x38, 0x38, 0x64, 0x35, 0x30, 0x62,
+0x37, 0x39, 0x31, 0x30, 0x32, 0x62, 0x35, 0x64,
+0x61, 0x64, 0x34, 0x61, 0x62, 0x36, 0x63, 0x65,
+0x64, 0x33, 0x30, 0x63, 0x34, 0x30, 0x36, 0x39,
+0x66, 0x31, 0x65, 0x61, 0x61, 0x36, 0x39, 0x61,
+0x34, 0x62, 0x35, 0x61, 0x37, 0x36, 0x33, 0x34,
+0x31, 0x34, 0x30, 0x36, 0x37, 0x65, 0x30, 0x32,
+0x32, 0x30, 0x33, 0x31, 0x35, 0x36, 0x63, 0x36,
+0x61, 0x35, 0x63, 0x39, 0x63, 0x66, 0x38, 0x38,
+0x66, 0x39, 0x31, 0x32, 0x36, 0x35, 0x66, 0x35,
+0x61, 0x39, 0x34, 0x32, 0x65, 0x39, 0x36, 0x32,
+0x31, 0x33, 0x61, 0x66, 0x61, 0x65, 0x31, 0x36,
+0x64, 0x38, 0x33, 0x33, 0x32, 0x31, 0x63, 0x38,
+0x62, 0x33, 0x31, 0x62, 0x62, 0x33, 0x34, 0x32,
+0x31, 0x34, 0x32, 0x61, 0x31, 0x34, 0x64, 0x31,
+0x36, 0x33, 0x38, 0x31, 0x34, 0x38, 0x33, 0x30,
+0x34, 0x35, 0x30, 0x32, 0x32, 0x31, 0x30, 0x30,
+0x61, 0x35, 0x32, 0x36, 0x33, 0x65, 0x61, 0x30,
+0x35, 0x35, 0x33, 0x62, 0x61, 0x38, 0x39, 0x32,
+0x32, 0x31, 0x39, 0x38, 0x34, 0x62, 0x64, 0x37,
+0x66, 0x30, 0x62, 0x31, 0x33, 0x36, 0x31, 0x33,
+0x64, 0x62, 0x31, 0x36, 0x65, 0x37, 0x61, 0x37,
+0x30, 0x63, 0x35, 0x34, 0x39, 0x61, 0x38, 0x36,
+0x64, 0x65, 0x30, 0x63, 0x63, 0x30, 0x34, 0x34,
+0x34, 0x31, 0x34, 0x31, 0x61, 0x34, 0x30, 0x37,
+0x30, 0x32, 0x32, 0x30, 0x30, 0x35, 0x63, 0x33,
+0x36, 0x30, 0x65, 0x66, 0x30, 0x61, 0x65, 0x35,
+0x61, 0x35, 0x64, 0x34, 0x66, 0x39, 0x66, 0x32,
+0x66, 0x38, 0x37, 0x61, 0x35, 0x36, 0x63, 0x31,
+0x35, 0x34, 0x36, 0x63, 0x63, 0x38, 0x32, 0x36,
+0x38, 0x63, 0x61, 0x62, 0x30, 0x38, 0x63, 0x37,
+0x33, 0x35, 0x30, 0x31, 0x64, 0x36, 0x62, 0x33,
+0x62, 0x65, 0x32, 0x65, 0x31, 0x65, 0x31, 0x61,
+0x38, 0x61, 0x30, 0x38, 0x38, 0x32, 0x34, 0x37,
+0x33, 0x30, 0x34, 0x34, 0x30, 0x32, 0x32, 0x30,
+0x35, 0x32, 0x35, 0x34, 0x30, 0x36, 0x61, 0x31,
+0x34, 0x38, 0x32, 0x39, 0x33, 0x36, 0x64, 0x35,
+0x61, 0x32, 0x31, 0x38, 0x38, 0x38, 0x32, 0x36,
+0x30, 0x64, 0x63, 0x31, 0x36, 0x35, 0x34, 0x39,
+0x37, 0x61, 0x39, 0x30, 0x61, 0x31, 0x35, 0x36,
+0x36, 0x39, 0x36, 0x33, 0x36, 0x64, 0x38, 0x65,
+0x64, 0x63, 0x61, 0x36, 0x62, 0x39, 0x66, 0x65,
+0x34, 0x39, 0x30, 0x64, 0x33, 0x30, 0x39, 0x63,
+0x30, 0x32, 0x32, 0x30, 0x33, 0x32, 0x61, 0x66,
+0x30, 0x63, 0x36, 0x34, 0x36, 0x61, 0x33, 0x34,
+0x61, 0x34, 0x34, 0x64, 0x31, 0x66, 0x34, 0x35,
+0x37, 0x36, 0x62, 0x66, 0x36, 0x61, 0x34, 0x61,
+0x37, 0x34, 0x62, 0x36, 0x37, 0x39, 0x34, 0x30,
+0x66, 0x38, 0x66, 0x61, 0x61, 0x38, 0x34, 0x63,
+0x37, 0x64, 0x66, 0x39, 0x61, 0x62, 0x65, 0x31,
+0x32, 0x61, 0x30, 0x31, 0x61, 0x31, 0x31, 0x65,
+0x32, 0x62, 0x34, 0x37, 0x38, 0x33, 0x63, 0x66,
+0x35, 0x36, 0x32, 0x31, 0x30, 0x33, 0x30, 0x37,
+0x62, 0x38, 0x61, 0x65, 0x34, 0x39, 0x61, 0x63,
+0x39, 0x30, 0x61, 0x30, 0x34, 0x38, 0x65, 0x39,
+0x62, 0x35, 0x33, 0x33, 0x35, 0x37, 0x61, 0x32,
+0x33, 0x35, 0x34, 0x62, 0x33, 0x33, 0x33, 0x34,
+0x65, 0x39, 0x63, 0x38, 0x62, 0x65, 0x65, 0x38,
+0x31, 0x33, 0x65, 0x63, 0x62, 0x39, 0x38, 0x65,
+0x39, 0x39, 0x61, 0x37, 0x65, 0x30, 0x37, 0x65,
+0x38, 0x63, 0x33, 0x62, 0x61, 0x33, 0x32, 0x31,
+0x30, 0x33, 0x62, 0x32, 0x38, 0x66, 0x30, 0x63,
+0x32, 0x38, 0x62, 0x66, 0x61, 0x62, 0x35, 0x34,
+0x35, 0x35, 0x34, 0x61, 0x65, 0x38, 0x63, 0x36,
+0x35, 0x38, 0x61, 0x63, 0x35, 0x63, 0x33, 0x65,
+0x30, 0x63, 0x65, 0x36, 0x65, 0x37, 0x39, 0x61,
+0x64, 0x33, 0x33, 0x36, 0x33, 0x33, 0x31, 0x66,
+0x37, 0x38, 0x63, 0x34, 0x32, 0x38, 0x64, 0x64,
+0x34, 0x33, 0x65, 0x65, 0x61, 0x38, 0x34, 0x34,
+0x39, 0x62, 0x32, 0x31, 0x30, 0x33, 0x34, 0x62,
+0x38, 0x31, 0x31, 0x33, 0x64, 0x37, 0x30, 0x33,
+0x34, 0x31, 0x33, 0x64, 0x35, 0x37, 0x37, 0x36,
+0x31, 0x62, 0x38, 0x62, 0x39, 0x37, 0x38, 0x31,
+0x39, 0x35, 0x37, 0x62, 0x38, 0x63, 0x30, 0x61,
+0x63, 0x31, 0x64, 0x66, 0x65, 0x36, 0x39, 0x66,
+0x34, 0x39, 0x32, 0x35, 0x38, 0x30, 0x63, 0x61,
+0x34, 0x31, 0x39, 0x35, 0x66, 0x35, 0x30, 0x33,
+0x37, 0x36, 0x62, 0x61, 0x34, 0x61, 0x32, 0x31,
+0x30, 0x33, 0x33, 0x34, 0x30, 0x30, 0x66, 0x36,
+0x61, 0x66, 0x65, 0x63, 0x62, 0x38, 0x33, 0x33,
+0x30, 0x39, 0x32, 0x61, 0x39, 0x61, 0x32, 0x31,
+0x63, 0x66, 0x64, 0x66, 0x31, 0x65, 0x64, 0x31,
+0x33, 0x37, 0x36, 0x65, 0x35, 0x38, 0x63, 0x35,
+0x64, 0x31, 0x66, 0x34, 0x37, 0x64, 0x65, 0x37,
+0x34, 0x36, 0x38, 0x33, 0x31, 0x32, 0x33, 0x39,
+0x38, 0x37, 0x65, 0x39, 0x36, 0x37, 0x61, 0x38,
+0x66, 0x34, 0x32, 0x31, 0x30, 0x33, 0x61, 0x36,
+0x64, 0x34, 0x38, 0x62, 0x31, 0x31, 0x33, 0x31,
+0x65, 0x39, 0x34, 0x62, 0x61, 0x30, 0x34, 0x64,
+0x39, 0x37, 0x33, 0x37, 0x64, 0x36, 0x31, 0x61,
+0x63, 0x64, 0x61, 0x61, 0x31, 0x33, 0x32, 0x32,
+0x30, 0x30, 0x38, 0x61, 0x66, 0x39, 0x36, 0x30,
+0x32, 0x62, 0x33, 0x62, 0x31, 0x34, 0x38, 0x36,
+0x32, 0x63, 0x30, 0x37, 0x61, 0x31, 0x37, 0x38,
+0x39, 0x61, 0x61, 0x63, 0x31, 0x36, 0x32, 0x31,
+0x30, 0x32, 0x64, 0x38, 0x62, 0x36, 0x36, 0x31,
+0x62, 0x30, 0x62, 0x33, 0x33, 0x30, 0x32, 0x65,
+0x65, 0x32, 0x66, 0x31, 0x36, 0x32, 0x62, 0x30,
+0x39, 0x65, 0x30, 0x37, 0x61, 0x35, 0x35, 0x61,
+0x64, 0x35, 0x64, 0x66, 0x62, 0x65, 0x36, 0x37,
+0x33, 0x61, 0x39, 0x66, 0x30, 0x31, 0x64, 0x39,
+0x66, 0x30, 0x63, 0x31, 0x39, 0x36, 0x31, 0x37,
+0x36, 0x38, 0x31, 0x30, 0x32, 0x34, 0x33, 0x30,
+0x36, 0x62, 0x35, 0x36, 0x61, 0x65, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x22, 0x2c,
+0x20, 0x22, 0x50, 0x32, 0x53, 0x48, 0x2c, 0x57,
+0x49, 0x54, 0x4e, 0x45, 0x53, 0x53, 0x22, 0x5d,
+0x2c, 0x0a, 0x0a, 0x5b, 0x22, 0x46, 0x69, 0x6e,
+0x64, 0x41, 0x6e, 0x64, 0x44, 0x65, 0x6c, 0x65,
+0x74, 0x65, 0x20, 0x74, 0x65, 0x73, 0x74, 0x73,
+0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x22, 0x54, 0x68,
+0x69, 0x73, 0x20, 0x69, 0x73, 0x20, 0x61, 0x20,
+0x74, 0x65, 0x73, 0x74, 0x20, 0x6f, 0x66, 0x20,
+0x46, 0x69, 0x6e, 0x64, 0x41, 0x6e, 0x64, 0x44,
+0x65, 0x6c, 0x65, 0x74, 0x65, 0x2e, 0x20, 0x54,
+0x68, 0x65, 0x20, 0x66, 0x69, 0x72, 0x73, 0x74,
+0x20, 0x74, 0x78, 0x20, 0x69, 0x73, 0x20, 0x61,
+0x20, 0x73, 0x70, 0x65, 0x6e, 0x64, 0x20, 0x6f,
+0x66, 0x20, 0x6e, 0x6f, 0x72, 0x6d, 0x61, 0x6c,
+0x20, 0x50, 0x32, 0x53, 0x48, 0x20, 0x61, 0x6e,
+0x64, 0x20, 0x74, 0x68, 0x65, 0x20, 0x73, 0x65,
+0x63, 0x6f, 0x6e, 0x64, 0x20, 0x74, 0x78, 0x20,
+0x69, 0x73, 0x20, 0x61, 0x20, 0x73, 0x70, 0x65,
+0x6e, 0x64, 0x20, 0x6f, 0x66, 0x20, 0x62, 0x61,
+0x72, 0x65, 0x20, 0x50, 0x32, 0x57, 0x53, 0x48,
+0x2e, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x22, 0x54,
+0x68, 0x65, 0x20, 0x72, 0x65, 0x64, 0x65, 0x65,
+0x6d, 0x53, 0x63, 0x72, 0x69, 0x70, 0x74, 0x2f,
+0x77, 0x69, 0x74, 0x6e, 0x65, 0x73, 0x73, 0x53,
+0x63, 0x72, 0x69, 0x70, 0x74, 0x20, 0x69, 0x73,
+0x20, 0x43, 0x48, 0x45, 0x43, 0x4b, 0x53, 0x49,
+0x47, 0x56, 0x45, 0x52, 0x49, 0x46, 0x59, 0x20,
+0x3c, 0x30, 0x78, 0x33, 0x30, 0x34, 0x35, 0x30,
+0x32, 0x32, 0x30, 0x34, 0x38, 0x37, 0x66, 0x62,
+0x33, 0x38, 0x32, 0x63, 0x34, 0x39, 0x37, 0x34,
+0x64, 0x65, 0x33, 0x66, 0x37, 0x64, 0x38, 0x33,
+0x34, 0x63, 0x31, 0x62, 0x36, 0x31, 0x37, 0x66,
+0x65, 0x31, 0x35, 0x38, 0x36, 0x30, 0x38, 0x32,
+0x38, 0x63, 0x37, 0x66, 0x39, 0x36, 0x34, 0x35,
+0x34, 0x34, 0x39, 0x30, 0x65, 0x64, 0x64, 0x36,
+0x64, 0x38, 0x39, 0x31, 0x35, 0x35, 0x36, 0x64,
+0x63, 0x63, 0x39, 0x30, 0x32, 0x32, 0x31, 0x30,
+0x30, 0x62, 0x61, 0x66, 0x39, 0x35, 0x66, 0x65,
+0x62, 0x34, 0x38, 0x66, 0x38, 0x34, 0x35, 0x64,
+0x35, 0x62, 0x66, 0x63, 0x39, 0x38, 0x38, 0x32,
+0x65, 0x62, 0x36, 0x61, 0x65, 0x65, 0x66, 0x61,
+0x31, 0x62, 0x63, 0x33, 0x37, 0x39, 0x30, 0x65,
+0x33, 0x39, 0x66, 0x35, 0x39, 0x65, 0x61, 0x61,
+0x34, 0x36, 0x66, 0x66, 0x37, 0x66, 0x31, 0x35,
+0x61, 0x65, 0x36, 0x32, 0x36, 0x63, 0x35, 0x33,
+0x65, 0x30, 0x31, 0x3e, 0x2e, 0x22, 0x5d, 0x2c,
+0x0a, 0x5b, 0x22, 0x54, 0x68, 0x65, 0x20, 0x73,
+0x69, 0x67, 0x6e, 0x61, 0x74, 0x75, 0x72, 0x65,
+0x20, 0x69, 0x73, 0x20, 0x3c, 0x30, 0x78, 0x33,
+0x30, 0x34, 0x35, 0x30, 0x32, 0x32, 0x30, 0x34,
+0x38, 0x37, 0x66, 0x62, 0x33, 0x38, 0x32, 0x63,
+0x34, 0x39, 0x37, 0x34, 0x64, 0x65, 0x33, 0x66,
+0x37, 0x64, 0x38, 0x33, 0x34, 0x63, 0x31, 0x62,
+0x36, 0x31, 0x37, 0x66, 0x65, 0x31, 0x35, 0x38,
+0x36, 0x30, 0x38, 0x32, 0x38, 0x63, 0x37, 0x66,
+0x39, 0x36, 0x34, 0x35, 0x34, 0x34, 0x39, 0x30,
+0x65, 0x64, 0x64, 0x36, 0x64, 0x38, 0x39, 0x31,
+0x35, 0x35, 0x36, 0x64, 0x63, 0x63, 0x39, 0x30,
+0x32, 0x32, 0x31, 0x30, 0x30, 0x62, 0x61, 0x66,
+0x39, 0x35, 0x66, 0x65, 0x62, 0x34, 0x38, 0x66,
+0x38, 0x34, 0x35, 0x64, 0x35, 0x62, 0x66, 0x63,
+0x39, 0x38, 0x38, 0x32, 0x65, 0x62, 0x36, 0x61,
+0x65, 0x65, 0x66, 0x61, 0x31, 0x62, 0x63, 0x33,
+0x37, 0x39, 0x30, 0x65, 0x33, 0x39, 0x66, 0x35,
+0x39, 0x65, 0x61, 0x61, 0x34, 0x36, 0x66, 0x66,
+0x37, 0x66, 0x31, 0x35, 0x61, 0x65, 0x36, 0x32,
+0x36, 0x63, 0x35, 0x33, 0x65, 0x30, 0x31, 0x3e,
+0x20, 0x3c, 0x70, 0x75, 0x62, 0x6b, 0x65, 0x79,
+0x3e, 0x2c, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x22,
+0x77, 0x68, 0x65, 0x72, 0x65, 0x20, 0x74, 0x68,
+0x65, 0x20, 0x70, 0x75, 0x62, 0x6b, 0x65, 0x79,
+0x20, 0x69, 0x73, 0x20, 0x6f, 0x62, 0x74, 0x61,
+0x69, 0x6e, 0x65, 0x64, 0x20, 0x74, 0x68, 0x72,
+0x6f, 0x75, 0x67, 0x68, 0x20, 0x6b, 0x65, 0x79,
+0x20, 0x72, 0x65, 0x63, 0x6f, 0x76, 0x65, 0x72,
+0x79, 0x20, 0x77, 0x69, 0x74, 0x68, 0x20, 0x73,
+0x69, 0x67, 0x20, 0x61, 0x6e, 0x64, 0x20, 0x63,
+0x6f, 0x72, 0x72, 0x65, 0x63, 0x74, 0x20, 0x73,
+0x69, 0x67, 0x68, 0x61, 0x73, 0x68, 0x2e, 0x22,
+0x5d, 0x2c, 0x0a, 0x5b, 0x22, 0x54, 0x68, 0x69,
+0x73, 0x20, 0x69, 0x73, 0x20, 0x74, 0x6f, 0x20,
+0x73, 0x68, 0x6f, 0x77, 0x20, 0x74, 0x68, 0x61,
+0x74, 0x20, 0x46, 0x69, 0x6e, 0x64, 0x41, 0x6e,
+0x64, 0x44, 0x65, 0x6c, 0x65, 0x74, 0x65, 0x20,
+0x69, 0x73, 0x20, 0x61, 0x70, 0x70, 0x6c, 0x69,
+0x65, 0x64, 0x20, 0x6f, 0x6e, 0x6c, 0x79, 0x20,
+0x74, 0x6f, 0x20, 0x6e, 0x6f, 0x6e, 0x2d, 0x73,
+0x65, 0x67, 0x77, 0x69, 0x74, 0x20, 0x73, 0x63,
+0x72, 0x69, 0x70, 0x74, 0x73, 0x22, 0x5d, 0x2c,
+0x0a, 0x5b, 0x22, 0x4e, 0x6f, 0x6e, 0x2d, 0x73,
+0x65, 0x67, 0x77, 0x69, 0x74, 0x3a, 0x20, 0x63,
+0x6f, 0x72, 0x72, 0x65, 0x63, 0x74, 0x20, 0x73,
+0x69, 0x67, 0x68, 0x61, 0x73, 0x68, 0x20, 0x28,
+0x77, 0x69, 0x74, 0x68, 0x20, 0x46, 0x69, 0x6e,
+0x64, 0x41, 0x6e, 0x64, 0x44, 0x65, 0x6c, 0x65,
+0x74, 0x65, 0x29, 0x20, 0x3d, 0x20, 0x31, 0x62,
+0x61, 0x31, 0x66, 0x65, 0x33, 0x62, 0x63, 0x39,
+0x30, 0x63, 0x35, 0x64, 0x31, 0x32, 0x36, 0x35,
+0x34, 0x36, 0x30, 0x65, 0x36, 0x38, 0x34, 0x63,
+0x65, 0x36, 0x37, 0x37, 0x34, 0x65, 0x33, 0x32,
+0x34, 0x66, 0x30, 0x66, 0x61, 0x62, 0x64, 0x66,
+0x36, 0x37, 0x36, 0x31, 0x39, 0x65, 0x64, 0x61,
+0x37, 0x32, 0x39, 0x65, 0x36, 0x34, 0x65, 0x38,
+0x62, 0x36, 0x62, 0x63, 0x30, 0x38, 0x22, 0x5d,
+0x2c, 0x0a, 0x5b, 0x5b, 0x5b, 0x22, 0x66, 0x31,
+0x38, 0x37, 0x38, 0x33, 0x61, 0x63, 0x65, 0x31,
+0x33, 0x38, 0x61, 0x62, 0x61, 0x63, 0x35, 0x64,
+0x33, 0x61, 0x37, 0x61, 0x35, 0x63, 0x66, 0x30,
+0x38, 0x65, 0x38, 0x38, 0x66, 0x65, 0x36, 0x39,
+0x31, 0x32, 0x66, 0x32, 0x36, 0x37, 0x65, 0x66,
+0x39, 0x33, 0x36, 0x34, 0x35, 0x32, 0x65, 0x30,
+0x63, 0x32, 0x37, 0x64, 0x30, 0x39, 0x30, 0x36,
+0x32, 0x31, 0x63, 0x31, 0x36, 0x39, 0x22, 0x2c,
+0x20, 0x37, 0x30, 0x30, 0x30, 0x2c, 0x20, 0x22,
+0x48, 0x41, 0x53, 0x48, 0x31, 0x36, 0x30, 0x20,
+0x30, 0x78, 0x31, 0x34, 0x20, 0x30, 0x78, 0x30,
+0x63, 0x37, 0x34, 0x36, 0x34, 0x38, 0x39, 0x65,
+0x32, 0x64, 0x38, 0x33, 0x63, 0x64, 0x62, 0x62,
+0x35, 0x62, 0x39, 0x30, 0x62, 0x34, 0x33, 0x32,
+0x37, 0x37, 0x33, 0x33, 0x34, 0x32, 0x62, 0x61,
+0x38, 0x30, 0x39, 0x63, 0x31, 0x33, 0x34, 0x20,
+0x45, 0x51, 0x55, 0x41, 0x4c, 0x22, 0x2c, 0x20,
+0x32, 0x30, 0x30, 0x30, 0x30, 0x30, 0x5d, 0x5d,
+0x2c, 0x0a, 0x22, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x31, 0x36, 0x39, 0x63,
+0x31, 0x32, 0x31, 0x30, 0x36, 0x30, 0x39, 0x37,
+0x64, 0x63, 0x32, 0x65, 0x30, 0x35, 0x32, 0x36,
+0x34, 0x39, 0x33, 0x65, 0x66, 0x36, 0x37, 0x66,
+0x32, 0x31, 0x32, 0x36, 0x39, 0x66, 0x65, 0x38,
+0x38, 0x38, 0x65, 0x66, 0x30, 0x35, 0x63, 0x37,
+0x61, 0x33, 0x61, 0x35, 0x64, 0x61, 0x63, 0x61,
+0x62, 0x33, 0x38, 0x65, 0x31, 0x61, 0x63, 0x38,
+0x33, 0x38, 0x37, 0x66, 0x31, 0x35, 0x38, 0x31,
+0x62, 0x30, 0x30, 0x30, 0x30, 0x62, 0x36, 0x34,
+0x38, 0x33, 0x30, 0x34, 0x35, 0x30, 0x32, 0x32,
+0x30, 0x34, 0x38, 0x37, 0x66, 0x62, 0x33, 0x38,
+0x32, 0x63, 0x34, 0x39, 0x37, 0x34, 0x64, 0x65,
+0x33, 0x66, 0x37, 0x64, 0x38, 0x33, 0x34, 0x63,
+0x31, 0x62, 0x36, 0x31, 0x37, 0x66, 0x65, 0x31,
+0x35, 0x38, 0x36, 0x30, 0x38, 0x32, 0x38, 0x63,
+0x37, 0x66, 0x39, 0x36, 0x34, 0x35, 0x34, 0x34,
+0x39, 0x30, 0x65, 0x64, 0x64, 0x36, 0x64, 0x38,
+0x39, 0x31, 0x35, 0x35, 0x36, 0x64, 0x63, 0x63,
+0x39, 0x30, 0x32, 0x32, 0x31, 0x30, 0x30, 0x62,
+0x61, 0x66, 0x39, 0x35, 0x66, 0x65, 0x62, 0x34,
+0x38, 0x66, 0x38, 0x34, 0x35, 0x64, 0x35, 0x62,
+0x66, 0x63, 0x39, 0x38, 0x38, 0x32, 0x65, 0x62,
+0x36, 0x61, 0x65, 0x65, 0x66, 0x61, 0x31, 0x62,
+0x63, 0x33, 0x37, 0x39, 0x30, 0x65, 0x33, 0x39,
+0x66, 0x35, 0x39, 0x65, 0x61, 0x61, 0x34, 0x36,
+0x66, 0x66, 0x37, 0x66, 0x31, 0x35, 0x61, 0x65,
+0x36, 0x32, 0x36, 0x63, 0x35, 0x33, 0x65, 0x30,
+0x31, 0x32, 0x31, 0x30, 0x33, 0x37, 0x61, 0x33,
+0x66, 0x62, 0x30, 0x34, 0x62, 0x63, 0x64, 0x62,
+0x30, 0x39, 0x65, 0x62, 0x61, 0x39, 0x30, 0x66,
+0x36, 0x39, 0x39, 0x36, 0x31, 0x62, 0x61, 0x31,
+0x36, 0x39, 0x32, 0x61, 0x33, 0x35, 0x32, 0x38,
+0x65, 0x34, 0x35, 0x65, 0x36, 0x37, 0x63, 0x38,
+0x35, 0x62, 0x32, 0x30, 0x30, 0x64, 0x66, 0x38,
+0x32, 0x30, 0x32, 0x31, 0x32, 0x64, 0x37, 0x35,
+0x39, 0x34, 0x64, 0x33, 0x33, 0x34, 0x61, 0x61,
+0x64, 0x34, 0x38, 0x33, 0x30, 0x34, 0x35, 0x30,
+0x32, 0x32, 0x30, 0x34, 0x38, 0x37, 0x66, 0x62,
+0x33, 0x38, 0x32, 0x63, 0x34, 0x39, 0x37, 0x34,
+0x64, 0x65, 0x33, 0x66, 0x37, 0x64, 0x38, 0x33,
+0x34, 0x63, 0x31, 0x62, 0x36, 0x31, 0x37, 0x66,
+0x65, 0x31, 0x35, 0x38, 0x36, 0x30, 0x38, 0x32,
+0x38, 0x63, 0x37, 0x66, 0x39, 0x36, 0x34, 0x35,
+0x34, 0x34, 0x39, 0x30, 0x65, 0x64, 0x64, 0x36,
+0x64, 0x38, 0x39, 0x31, 0x35, 0x35, 0x36, 0x64,
+0x63, 0x63, 0x39, 0x30, 0x32, 0x32, 0x31, 0x30,
+0x30, 0x62, 0x61, 0x66, 0x39, 0x35, 0x66, 0x65,
+0x62, 0x34, 0x38, 0x66, 0x38, 0x34, 0x35, 0x64,
+0x35, 0x62, 0x66, 0x63, 0x39, 0x38, 0x38, 0x32,
+0x65, 0x62, 0x36, 0x61, 0x65, 0x65, 0x66, 0x61,
+0x31, 0x62, 0x63, 0x33, 0x37, 0x39, 0x30, 0x65,
+0x33, 0x39, 0x66, 0x35, 0x39, 0x65, 0x61, 0x61,
+0x34, 0x36, 0x66, 0x66, 0x37, 0x66, 0x31, 0x35,
+0x61, 0x65, 0x36, 0x32, 0x36, 0x63, 0x35, 0x33,
+0x65, 0x30, 0x31, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x30, 0x31, 0x30, 0x31, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x22,
+0x2c, 0x20, 0x22, 0x50, 0x32, 0x53, 0x48, 0x2c,
+0x57, 0x49, 0x54, 0x4e, 0x45, 0x53, 0x53, 0x22,
+0x5d, 0x2c, 0x0a, 0x5b, 0x22, 0x42, 0x49, 0x50,
+0x31, 0x34, 0x33, 0x3a, 0x20, 0x63, 0x6f, 0x72,
+0x72, 0x65, 0x63, 0x74, 0x20, 0x73, 0x69, 0x67,
+0x68, 0x61, 0x73, 0x68, 0x20, 0x28, 0x77, 0x69,
+0x74, 0x68, 0x6f, 0x75, 0x74, 0x20, 0x46, 0x69,
+0x6e, 0x64, 0x41, 0x6e, 0x64, 0x44, 0x65, 0x6c,
+0x65, 0x74, 0x65, 0x29, 0x20, 0x3d, 0x20, 0x37,
+0x31, 0x63, 0x39, 0x63, 0x64, 0x39, 0x62, 0x32,
+0x38, 0x36, 0x39, 0x62, 0x39, 0x63, 0x37, 0x30,
+0x62, 0x30, 0x31, 0x62, 0x31, 0x66, 0x30, 0x33,
+0x36, 0x30, 0x63, 0x31, 0x34, 0x38, 0x66, 0x34,
+0x32, 0x64, 0x65, 0x65, 0x37, 0x32, 0x32, 0x39,
+0x37, 0x64, 0x62, 0x33, 0x31, 0x32, 0x36, 0x33,
+0x38, 0x64, 0x66, 0x31, 0x33, 0x36, 0x66, 0x34,
+0x33, 0x33, 0x31, 0x31, 0x66, 0x32, 0x33, 0x22,
+0x5d, 0x2c, 0x0a, 0x5b, 0x5b, 0x5b, 0x22, 0x66,
+0x31, 0x38, 0x37, 0x38, 0x33, 0x61, 0x63, 0x65,
+0x31, 0x33, 0x38, 0x61, 0x62, 0x61, 0x63, 0x35,
+0x64, 0x33, 0x61, 0x37, 0x61, 0x35, 0x63, 0x66,
+0x30, 0x38, 0x65, 0x38, 0x38, 0x66, 0x65, 0x36,
+0x39, 0x31, 0x32, 0x66, 0x32, 0x36, 0x37, 0x65,
+0x66, 0x39, 0x33, 0x36, 0x34, 0x35, 0x32, 0x65,
+0x30, 0x63, 0x32, 0x37, 0x64, 0x30, 0x39, 0x30,
+0x36, 0x32, 0x31, 0x63, 0x31, 0x36, 0x39, 0x22,
+0x2c, 0x20, 0x37, 0x35, 0x30, 0x30, 0x2c, 0x20,
+0x22, 0x30, 0x78, 0x30, 0x30, 0x20, 0x30, 0x78,
+0x32, 0x30, 0x20, 0x30, 0x78, 0x39, 0x65, 0x31,
+0x62, 0x65, 0x30, 0x37, 0x35, 0x35, 0x38, 0x65,
+0x61, 0x35, 0x63, 0x63, 0x38, 0x65, 0x30, 0x32,
+0x65, 0x64, 0x31, 0x64, 0x38, 0x30, 0x63, 0x30,
+0x39, 0x31, 0x31, 0x30, 0x34, 0x38, 0x61, 0x66,
+0x61, 0x64, 0x39, 0x34, 0x39, 0x61, 0x66, 0x66,
+0x61, 0x33, 0x36, 0x64, 0x35, 0x63, 0x33, 0x39,
+0x35, 0x31, 0x65, 0x33, 0x31, 0x35, 0x39, 0x64,
+0x62, 0x65, 0x61, 0x31, 0x39, 0x22, 0x2c, 0x20,
+0x32, 0x30, 0x30, 0x30, 0x30, 0x30, 0x5d, 0x5d,
+0x2c, 0x0a, 0x22, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x31, 0x30,
+0x31, 0x36, 0x39, 0x63, 0x31, 0x32, 0x31, 0x30,
+0x36, 0x30, 0x39, 0x37, 0x64, 0x63, 0x32, 0x65,
+0x30, 0x35, 0x32, 0x36, 0x34, 0x39, 0x33, 0x65,
+0x66, 0x36, 0x37, 0x66, 0x32, 0x31, 0x32, 0x36,
+0x39, 0x66, 0x65, 0x38, 0x38, 0x38, 0x65, 0x66,
+0x30, 0x35, 0x63, 0x37, 0x61, 0x33, 0x61, 0x35,
+0x64, 0x61, 0x63, 0x61, 0x62, 0x33, 0x38, 0x65,
+0x31, 0x61, 0x63, 0x38, 0x33, 0x38, 0x37, 0x66,
+0x31, 0x34, 0x63, 0x31, 0x64, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x30, 0x31, 0x30, 0x31, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x33, 0x34, 0x38, 0x33, 0x30, 0x34, 0x35, 0x30,
+0x32, 0x32, 0x30, 0x34, 0x38, 0x37, 0x66, 0x62,
+0x33, 0x38, 0x32, 0x63, 0x34, 0x39, 0x37, 0x34,
+0x64, 0x65, 0x33, 0x66, 0x37, 0x64, 0x38, 0x33,
+0x34, 0x63, 0x31, 0x62, 0x36, 0x31, 0x37, 0x66,
+0x65, 0x31, 0x35, 0x38, 0x36, 0x30, 0x38, 0x32,
+0x38, 0x63, 0x37, 0x66, 0x39, 0x36, 0x34, 0x35,
+0x34, 0x34, 0x39, 0x30, 0x65, 0x64, 0x64, 0x36,
+0x64, 0x38, 0x39, 0x31, 0x35, 0x35, 0x36, 0x64,
+0x63, 0x63, 0x39, 0x30, 0x32, 0x32, 0x31, 0x30,
+0x30, 0x62, 0x61, 0x66, 0x39, 0x35, 0x66, 0x65,
+0x62, 0x34, 0x38, 0x66, 0x38, 0x34, 0x35, 0x64,
+0x35, 0x62, 0x66, 0x63, 0x39, 0x38, 0x38, 0x32,
+0x65, 0x62, 0x36, 0x61, 0x65, 0x65, 0x66, 0x61,
+0x31, 0x62, 0x63, 0x33, 0x37, 0x39, 0x30, 0x65,
+0x33, 0x39, 0x66, 0x35, 0x39, 0x65, 0x61, 0x61,
+0x34, 0x36, 0x66, 0x66, 0x37, 0x66, 0x31, 0x35,
+0x61, 0x65, 0x36, 0x32, 0x36, 0x63, 0x35, 0x33,
+0x65, 0x30, 0x31, 0x32, 0x31, 0x30, 0x32, 0x61,
+0x39, 0x37, 0x38, 0x31, 0x64, 0x36, 0x36, 0x62,
+0x36, 0x31, 0x66, 0x62, 0x35, 0x61, 0x37, 0x65,
+0x66, 0x30, 0x30, 0x61, 0x63, 0x35, 0x61, 0x64,
+0x35, 0x62, 0x63, 0x36, 0x66, 0x66, 0x63, 0x37,
+0x38, 0x62, 0x65, 0x37, 0x62, 0x34, 0x34, 0x61,
+0x35, 0x36, 0x36, 0x65, 0x33, 0x63, 0x38, 0x37,
+0x38, 0x37, 0x30, 0x65, 0x31, 0x30, 0x37, 0x39,
+0x33, 0x36, 0x38, 0x64, 0x66, 0x34, 0x63, 0x34,
+0x61, 0x61, 0x64, 0x34, 0x38, 0x33, 0x30, 0x34,
+0x35, 0x30, 0x32, 0x32, 0x30, 0x34, 0x38, 0x37,
+0x66, 0x62, 0x33, 0x38, 0x32, 0x63, 0x34, 0x39,
+0x37, 0x34, 0x64, 0x65, 0x33, 0x66, 0x37, 0x64,
+0x38, 0x33, 0x34, 0x63, 0x31, 0x62, 0x36, 0x31,
+0x37, 0x66, 0x65, 0x31, 0x35, 0x38, 0x36, 0x30,
+0x38, 0x32, 0x38, 0x63, 0x37, 0x66, 0x39, 0x36,
+0x34, 0x35, 0x34, 0x34, 0x39, 0x30, 0x65, 0x64,
+0x64, 0x36, 0x64, 0x38, 0x39, 0x31, 0x35, 0x35,
+0x36, 0x64, 0x63, 0x63, 0x39, 0x30, 0x32, 0x32,
+0x31, 0x30, 0x30, 0x62, 0x61, 0x66, 0x39, 0x35,
+0x66, 0x65, 0x62, 0x34, 0x38, 0x66, 0x38, 0x34,
+0x35, 0x64, 0x35, 0x62, 0x66, 0x63, 0x39, 0x38,
+0x38, 0x32, 0x65, 0x62, 0x36, 0x61, 0x65, 0x65,
+0x66, 0x61, 0x31, 0x62, 0x63, 0x33, 0x37, 0x39,
+0x30, 0x65, 0x33, 0x39, 0x66, 0x35, 0x39, 0x65,
+0x61, 0x61, 0x34, 0x36, 0x66, 0x66, 0x37, 0x66,
+0x31, 0x35, 0x61, 0x65, 0x36, 0x32, 0x36, 0x63,
+0x35, 0x33, 0x65, 0x30, 0x31, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x22, 0x2c, 0x20,
+0x22, 0x50, 0x32, 0x53, 0x48, 0x2c, 0x57, 0x49,
+0x54, 0x4e, 0x45, 0x53, 0x53, 0x2c, 0x43, 0x4f,
+0x4e, 0x53, 0x54, 0x5f, 0x53, 0x43, 0x52, 0x49,
+0x50, 0x54, 0x43, 0x4f, 0x44, 0x45, 0x22, 0x5d,
+0x2c, 0x0a, 0x5b, 0x22, 0x54, 0x68, 0x69, 0x73,
+0x20, 0x69, 0x73, 0x20, 0x6d, 0x75, 0x6c, 0x74,
+0x69, 0x73, 0x69, 0x67, 0x20, 0x76, 0x65, 0x72,
+0x73, 0x69, 0x6f, 0x6e, 0x20, 0x6f, 0x66, 0x20,
+0x74, 0x68, 0x65, 0x20, 0x46, 0x69, 0x6e, 0x64,
+0x41, 0x6e, 0x64, 0x44, 0x65, 0x6c, 0x65, 0x74,
+0x65, 0x20, 0x74, 0x65, 0x73, 0x74, 0x73, 0x22,
+0x5d, 0x2c, 0x0a, 0x5b, 0x22, 0x53, 0x63, 0x72,
+0x69, 0x70, 0x74, 0x20, 0x69, 0x73, 0x20, 0x32,
+0x20, 0x43, 0x48, 0x45, 0x43, 0x4b, 0x4d, 0x55,
+0x4c, 0x54, 0x49, 0x53, 0x49, 0x47, 0x56, 0x45,
+0x52, 0x49, 0x46, 0x59, 0x20, 0x3c, 0x73, 0x69,
+0x67, 0x31, 0x3e, 0x20, 0x3c, 0x73, 0x69, 0x67,
+0x32, 0x3e, 0x20, 0x44, 0x52, 0x4f, 0x50, 0x22,
+0x5d, 0x2c, 0x0a, 0x5b, 0x22, 0x35, 0x32, 0x61,
+0x66, 0x34, 0x38, 0x33, 0x30, 0x34, 0x35, 0x30,
+0x32, 0x32, 0x30, 0x34, 0x38, 0x37, 0x66, 0x62,
+0x33, 0x38, 0x32, 0x63, 0x34, 0x39, 0x37, 0x34,
+0x64, 0x65, 0x33, 0x66, 0x37, 0x64, 0x38, 0x33,
+0x34, 0x63, 0x31, 0x62, 0x36, 0x31, 0x37, 0x66,
+0x65, 0x31, 0x35, 0x38, 0x36, 0x30, 0x38, 0x32,
+0x38, 0x63, 0x37, 0x66, 0x39, 0x36, 0x34, 0x35,
+0x34, 0x34, 0x39, 0x30, 0x65, 0x64, 0x64, 0x36,
+0x64, 0x38, 0x39, 0x31, 0x35, 0x35, 0x36, 0x64,
+0x63, 0x63, 0x39, 0x30, 0x32, 0x32, 0x31, 0x30,
+0x30, 0x62, 0x61, 0x66, 0x39, 0x35, 0x66, 0x65,
+0x62, 0x34, 0x38, 0x66, 0x38, 0x34, 0x35, 0x64,
+0x35, 0x62, 0x66, 0x63, 0x39, 0x38, 0x38, 0x32,
+0x65, 0x62, 0x36, 0x61, 0x65, 0x65, 0x66, 0x61,
+0x31, 0x62, 0x63, 0x33, 0x37, 0x39, 0x30, 0x65,
+0x33, 0x39, 0x66, 0x35, 0x39, 0x65, 0x61, 0x61,
+0x34, 0x36, 0x66, 0x66, 0x37, 0x66, 0x31, 0x35,
+0x61, 0x65, 0x36, 0x32, 0x36, 0x63, 0x35, 0x33,
+0x65, 0x30, 0x31, 0x34, 0x38, 0x33, 0x30, 0x34,
+0x35, 0x30, 0x32, 0x32, 0x30, 0x35, 0x32, 0x38,
+0x36, 0x66, 0x37, 0x32, 0x36, 0x36, 0x39, 0x30,
+0x62, 0x32, 0x65, 0x39, 0x62, 0x30, 0x32, 0x30,
+0x37, 0x66, 0x30, 0x33, 0x34, 0x35, 0x37, 0x31,
+0x31, 0x65, 0x36, 0x33, 0x66, 0x61, 0x37, 0x30,
+0x31, 0x32, 0x30, 0x34, 0x35, 0x62, 0x39, 0x65,
+0x62, 0x30, 0x66, 0x31, 0x39, 0x63, 0x32, 0x34,
+0x35, 0x38, 0x63, 0x65, 0x31, 0x64, 0x62, 0x39,
+0x30, 0x63, 0x66, 0x34, 0x33, 0x30, 0x32, 0x32,
+0x31, 0x30, 0x30, 0x65, 0x38, 0x39, 0x66, 0x31,
+0x37, 0x66, 0x38, 0x36, 0x61, 0x62, 0x63, 0x35,
+0x62, 0x31, 0x34, 0x39, 0x65, 0x62, 0x61, 0x34,
+0x31, 0x31, 0x35, 0x64, 0x34, 0x66, 0x31, 0x32,
+0x38, 0x62, 0x63, 0x66, 0x34, 0x35, 0x64, 0x37,
+0x37, 0x66, 0x62, 0x33, 0x65, 0x63, 0x64, 0x64,
+0x33, 0x34, 0x66, 0x35, 0x39, 0x34, 0x30, 0x39,
+0x31, 0x33, 0x34, 0x30, 0x63, 0x30, 0x33, 0x39,
+0x35, 0x39, 0x36, 0x30, 0x31, 0x37, 0x35, 0x22,
+0x5d, 0x2c, 0x0a, 0x5b, 0x22, 0x53, 0x69, 0x67,
+0x6e, 0x61, 0x74, 0x75, 0x72, 0x65, 0x20, 0x69,
+0x73, 0x20, 0x30, 0x20, 0x3c, 0x73, 0x69, 0x67,
+0x31, 0x3e, 0x20, 0x3c, 0x73, 0x69, 0x67, 0x32,
+0x3e, 0x20, 0x32, 0x20, 0x3c, 0x6b, 0x65, 0x79,
+0x31, 0x3e, 0x20, 0x3c, 0x6b, 0x65, 0x79, 0x32,
+0x3e, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x22, 0x4e,
+0x6f, 0x6e, 0x2d, 0x73, 0x65, 0x67, 0x77, 0x69,
+0x74, 0x3a, 0x20, 0x63, 0x6f, 0x72, 0x72, 0x65,
+0x63, 0x74, 0x20, 0x73, 0x69, 0x67, 0x68, 0x61,
+0x73, 0x68, 0x20, 0x28, 0x77, 0x69, 0x74, 0x68,
+0x20, 0x46, 0x69, 0x6e, 0x64, 0x41, 0x6e, 0x64,
+0x44, 0x65, 0x6c, 0x65, 0x74, 0x65, 0x29, 0x20,
+0x3d, 0x20, 0x31, 0x64, 0x35, 0x30, 0x66, 0x30,
+0x30, 0x62, 0x61, 0x34, 0x64, 0x62, 0x32, 0x39,
+0x31, 0x37, 0x62, 0x39, 0x30, 0x33, 0x62, 0x30,
+0x65, 0x63, 0x35, 0x30, 0x30, 0x32, 0x65, 0x30,
+0x31, 0x37, 0x33, 0x34, 0x33, 0x62, 0x62, 0x33,
+0x38, 0x38, 0x37, 0x36, 0x33, 0x39, 0x38, 0x63,
+0x39, 0x35, 0x31, 0x30, 0x35, 0x37, 0x30, 0x66,
+0x35, 0x64, 0x63, 0x65, 0x30, 0x39, 0x39, 0x32,
+0x39, 0x35, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b,
+0x5b, 0x22, 0x39, 0x36, 0x32, 0x38, 0x36, 0x36,
+0x37, 0x61, 0x64, 0x34, 0x38, 0x32, 0x31, 0x39,
+0x61, 0x31, 0x36, 0x39, 0x62, 0x34, 0x31, 0x62,
+0x30, 0x32, 0x30, 0x38, 0x30, 0x30, 0x31, 0x36,
+0x32, 0x32, 0x38, 0x37, 0x64, 0x32, 0x63, 0x30,
+0x66, 0x37, 0x31, 0x33, 0x63, 0x30, 0x34, 0x31,
+0x35, 0x37, 0x65, 0x39, 0x35, 0x63, 0x34, 0x38,
+0x34, 0x61, 0x38, 0x64, 0x63, 0x62, 0x37, 0x35,
+0x39, 0x32, 0x22, 0x2c, 0x20, 0x37, 0x30, 0x30,
+0x30, 0x2c, 0x20, 0x22, 0x48, 0x41, 0x53, 0x48,
+0x31, 0x36, 0x30, 0x20, 0x30, 0x78, 0x31, 0x34,
+0x20, 0x30, 0x78, 0x35, 0x37, 0x34, 0x38, 0x34,
+0x30, 0x37, 0x66, 0x35, 0x63, 0x61, 0x35, 0x63,
+0x64, 0x63, 0x61, 0x35, 0x33, 0x62, 0x61, 0x33,
+0x30, 0x62, 0x37, 0x39, 0x30, 0x34, 0x30, 0x32,
+0x36, 0x30, 0x37, 0x37, 0x30, 0x63, 0x39, 0x65,
+0x65, 0x31, 0x62, 0x20, 0x45, 0x51, 0x55, 0x41,
+0x4c, 0x22, 0x2c, 0x20, 0x32, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x5d, 0x5d, 0x2c, 0x0a, 0x22, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x39, 0x32, 0x37, 0x35, 0x63, 0x62, 0x38,
+0x64, 0x34, 0x61, 0x34, 0x38, 0x35, 0x63, 0x65,
+0x39, 0x35, 0x37, 0x34, 0x31, 0x63, 0x30, 0x31,
+0x33, 0x66, 0x37, 0x63, 0x30, 0x64, 0x32, 0x38,
+0x37, 0x32, 0x32, 0x31, 0x36, 0x30, 0x30, 0x30,
+0x38, 0x30, 0x32, 0x31, 0x62, 0x62, 0x34, 0x36,
+0x39, 0x61, 0x31, 0x31, 0x39, 0x38, 0x32, 0x64,
+0x34, 0x37, 0x61, 0x36, 0x36, 0x32, 0x38, 0x39,
+0x36, 0x35, 0x38, 0x31, 0x62, 0x30, 0x30, 0x30,
+0x30, 0x66, 0x64, 0x36, 0x66, 0x30, 0x31, 0x30,
+0x30, 0x34, 0x38, 0x33, 0x30, 0x34, 0x35, 0x30,
+0x32, 0x32, 0x30, 0x34, 0x38, 0x37, 0x66, 0x62,
+0x33, 0x38, 0x32, 0x63, 0x34, 0x39, 0x37, 0x34,
+0x64, 0x65, 0x33, 0x66, 0x37, 0x64, 0x38, 0x33,
+0x34, 0x63, 0x31, 0x62, 0x36, 0x31, 0x37, 0x66,
+0x65, 0x31, 0x35, 0x38, 0x36, 0x30, 0x38, 0x32,
+0x38, 0x63, 0x37, 0x66, 0x39, 0x36, 0x34, 0x35,
+0x34, 0x34, 0x39, 0x30, 0x65, 0x64, 0x64, 0x36,
+0x64, 0x38, 0x39, 0x31, 0x35, 0x35, 0x36, 0x64,
+0x63, 0x63, 0x39, 0x30, 0x32, 0x32, 0x31, 0x30,
+0x30, 0x62, 0x61, 0x66, 0x39, 0x35, 0x66, 0x65,
+0x62, 0x34, 0x38, 0x66, 0x38, 0x34, 0x35, 0x64,
+0x35, 0x62, 0x66, 0x63, 0x39, 0x38, 0x38, 0x32,
+0x65, 0x62, 0x36, 0x61, 0x65, 0x65, 0x66, 0x61,
+0x31, 0x62, 0x63, 0x33, 0x37, 0x39, 0x30, 0x65,
+0x33, 0x39, 0x66, 0x35, 0x39, 0x65, 0x61, 0x61,
+0x34, 0x36, 0x66, 0x66, 0x37, 0x66, 0x31, 0x35,
+0x61, 0x65, 0x36, 0x32, 0x36, 0x63, 0x35, 0x33,
+0x65, 0x30, 0x31, 0x34, 0x38, 0x33, 0x30, 0x34,
+0x35, 0x30, 0x32, 0x32, 0x30, 0x35, 0x32, 0x38,
+0x36, 0x66, 0x37, 0x32, 0x36, 0x36, 0x39, 0x30,
+0x62, 0x32, 0x65, 0x39, 0x62, 0x30, 0x32, 0x30,
+0x37, 0x66, 0x30, 0x33, 0x34, 0x35, 0x37, 0x31,
+0x31, 0x65, 0x36, 0x33, 0x66, 0x61, 0x37, 0x30,
+0x31, 0x32, 0x30, 0x34, 0x35, 0x62, 0x39, 0x65,
+0x62, 0x30, 0x66, 0x31, 0x39, 0x63, 0x32, 0x34,
+0x35, 0x38, 0x63, 0x65, 0x31, 0x64, 0x62, 0x39,
+0x30, 0x63, 0x66, 0x34, 0x33, 0x30, 0x32, 0x32,
+0x31, 0x30, 0x30, 0x65, 0x38, 0x39, 0x66, 0x31,
+0x37, 0x66, 0x38, 0x36, 0x61, 0x62, 0x63, 0x35,
+0x62, 0x31, 0x34, 0x39, 0x65, 0x62, 0x61, 0x34,
+0x31, 0x31, 0x35, 0x64, 0x34, 0x66, 0x31, 0x32,
+0x38, 0x62, 0x63, 0x66, 0x34, 0x35, 0x64, 0x37,
+0x37, 0x66, 0x62, 0x33, 0x65, 0x63, 0x64, 0x64,
+0x33, 0x34, 0x66, 0x35, 0x39, 0x34, 0x30, 0x39,
+0x31, 0x33, 0x34, 0x30, 0x63, 0x30, 0x33, 0x39,
+0x35, 0x39, 0x36, 0x30, 0x31, 0x35, 0x32, 0x32,
+0x31, 0x30, 0x32, 0x63, 0x64, 0x37, 0x34, 0x61,
+0x32, 0x38, 0x30, 0x39, 0x66, 0x66, 0x65, 0x65,
+0x65, 0x64, 0x30, 0x30, 0x39, 0x32, 0x62, 0x63,
+0x31, 0x32, 0x34, 0x66, 0x64, 0x37, 0x39, 0x38,
+0x33, 0x36, 0x37, 0x30, 0x36, 0x65, 0x34, 0x31,
+0x66, 0x30, 0x34, 0x38, 0x64, 0x62, 0x33, 0x66,
+0x36, 0x61, 0x65, 0x39, 0x64, 0x66, 0x38, 0x37,
+0x30, 0x38, 0x63, 0x65, 0x66, 0x62, 0x38, 0x33,
+0x61, 0x31, 0x63, 0x32, 0x31, 0x30, 0x32, 0x65,
+0x36, 0x31, 0x35, 0x39, 0x39, 0x39, 0x33, 0x37,
+0x32, 0x34, 0x32, 0x36, 0x65, 0x34, 0x36, 0x66,
+0x64, 0x31, 0x30, 0x37, 0x62, 0x37, 0x36, 0x65,
+0x61, 0x66, 0x30, 0x30, 0x37, 0x31, 0x35, 0x36,
+0x61, 0x35, 0x30, 0x37, 0x35, 0x38, 0x34, 0x61,
+0x61, 0x32, 0x63, 0x63, 0x32, 0x31, 0x64, 0x65,
+0x39, 0x65, 0x65, 0x65, 0x33, 0x62, 0x64, 0x62,
+0x64, 0x32, 0x36, 0x64, 0x33, 0x36, 0x63, 0x34,
+0x63, 0x39, 0x35, 0x35, 0x32, 0x61, 0x66, 0x34,
+0x38, 0x33, 0x30, 0x34, 0x35, 0x30, 0x32, 0x32,
+0x30, 0x34, 0x38, 0x37, 0x66, 0x62, 0x33, 0x38,
+0x32, 0x63, 0x34, 0x39, 0x37, 0x34, 0x64, 0x65,
+0x33, 0x66, 0x37, 0x64, 0x38, 0x33, 0x34, 0x63,
+0x31, 0x62, 0x36, 0x31, 0x37, 0x66, 0x65, 0x31,
+0x35, 0x38, 0x36, 0x30, 0x38, 0x32, 0x38, 0x63,
+0x37, 0x66, 0x39, 0x36, 0x34, 0x35, 0x34, 0x34,
+0x39, 0x30, 0x65, 0x64, 0x64, 0x36, 0x64, 0x38,
+0x39, 0x31, 0x35, 0x35, 0x36, 0x64, 0x63, 0x63,
+0x39, 0x30, 0x32, 0x32, 0x31, 0x30, 0x30, 0x62,
+0x61, 0x66, 0x39, 0x35, 0x66, 0x65, 0x62, 0x34,
+0x38, 0x66, 0x38, 0x34, 0x35, 0x64, 0x35, 0x62,
+0x66, 0x63, 0x39, 0x38, 0x38, 0x32, 0x65, 0x62,
+0x36, 0x61, 0x65, 0x65, 0x66, 0x61, 0x31, 0x62,
+0x63, 0x33, 0x37, 0x39, 0x30, 0x65, 0x33, 0x39,
+0x66, 0x35, 0x39, 0x65, 0x61, 0x61, 0x34, 0x36,
+0x66, 0x66, 0x37, 0x66, 0x31, 0x35, 0x61, 0x65,
+0x36, 0x32, 0x36, 0x63, 0x35, 0x33, 0x65, 0x30,
+0x31, 0x34, 0x38, 0x33, 0x30, 0x34, 0x35, 0x30,
+0x32, 0x32, 0x30, 0x35, 0x32, 0x38, 0x36, 0x66,
+0x37, 0x32, 0x36, 0x36, 0x39, 0x30, 0x62, 0x32,
+0x65, 0x39, 0x62, 0x30, 0x32, 0x30, 0x37, 0x66,
+0x30, 0x33, 0x34, 0x35, 0x37, 0x31, 0x31, 0x65,
+0x36, 0x33, 0x66, 0x61, 0x37, 0x30, 0x31, 0x32,
+0x30, 0x34, 0x35, 0x62, 0x39, 0x65, 0x62, 0x30,
+0x66, 0x31, 0x39, 0x63, 0x32, 0x34, 0x35, 0x38,
+0x63, 0x65, 0x31, 0x64, 0x62, 0x39, 0x30, 0x63,
+0x66, 0x34, 0x33, 0x30, 0x32, 0x32, 0x31, 0x30,
+0x30, 0x65, 0x38, 0x39, 0x66, 0x31, 0x37, 0x66,
+0x38, 0x36, 0x61, 0x62, 0x63, 0x35, 0x62, 0x31,
+0x34, 0x39, 0x65, 0x62, 0x61, 0x34, 0x31, 0x31,
+0x35, 0x64, 0x34, 0x66, 0x31, 0x32, 0x38, 0x62,
+0x63, 0x66, 0x34, 0x35, 0x64, 0x37, 0x37, 0x66,
+0x62, 0x33, 0x65, 0x63, 0x64, 0x64, 0x33, 0x34,
+0x66, 0x35, 0x39, 0x34, 0x30, 0x39, 0x31, 0x33,
+0x34, 0x30, 0x63, 0x30, 0x33, 0x39, 0x35, 0x39,
+0x36, 0x30, 0x31, 0x37, 0x35, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x30, 0x31, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x22, 0x2c, 0x20, 0x22, 0x50, 0x32, 0x53,
+0x48, 0x2c, 0x57, 0x49, 0x54, 0x4e, 0x45, 0x53,
+0x53, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x22, 0x42,
+0x49, 0x50, 0x31, 0x34, 0x33, 0x3a, 0x20, 0x63,
+0x6f, 0x72, 0x72, 0x65, 0x63, 0x74, 0x20, 0x73,
+0x69, 0x67, 0x68, 0x61, 0x73, 0x68, 0x20, 0x28,
+0x77, 0x69, 0x74, 0x68, 0x6f, 0x75, 0x74, 0x20,
+0x46, 0x69, 0x6e, 0x64, 0x41, 0x6e, 0x64, 0x44,
+0x65, 0x6c, 0x65, 0x74, 0x65, 0x29, 0x20, 0x3d,
+0x20, 0x63, 0x31, 0x36, 0x32, 0x38, 0x61, 0x31,
+0x65, 0x37, 0x63, 0x36, 0x37, 0x66, 0x31, 0x34,
+0x63, 0x61, 0x30, 0x63, 0x32, 0x37, 0x63, 0x30,
+0x36, 0x65, 0x34, 0x66, 0x64, 0x65, 0x65, 0x63,
+0x32, 0x65, 0x36, 0x64, 0x31, 0x61, 0x37, 0x33,
+0x63, 0x37, 0x61, 0x39, 0x31, 0x64, 0x37, 0x63,
+0x30, 0x34, 0x36, 0x66, 0x66, 0x38, 0x33, 0x65,
+0x38, 0x33, 0x35, 0x61, 0x65, 0x62, 0x62, 0x37,
+0x32, 0x22, 0x5d, 0x2c, 0x0a, 0x5b, 0x5b, 0x5b,
+0x22, 0x39, 0x36, 0x32, 0x38, 0x36, 0x36, 0x37,
+0x61, 0x64, 0x34, 0x38, 0x32, 0x31, 0x39, 0x61,
+0x31, 0x36, 0x39, 0x62, 0x34, 0x31, 0x62, 0x30,
+0x32, 0x30, 0x38, 0x30, 0x30, 0x31, 0x36, 0x32,
+0x32, 0x38, 0x37, 0x64, 0x32, 0x63, 0x30, 0x66,
+0x37, 0x31, 0x33, 0x63, 0x30, 0x34, 0x31, 0x35,
+0x37, 0x65, 0x39, 0x35, 0x63, 0x34, 0x38, 0x34,
+0x61, 0x38, 0x64, 0x63, 0x62, 0x37, 0x35, 0x39,
+0x32, 0x22, 0x2c, 0x20, 0x37, 0x35, 0x30, 0x30,
+0x2c, 0x20, 0x22, 0x30, 0x78, 0x30, 0x30, 0x20,
+0x30, 0x78, 0x32, 0x30, 0x20, 0x30, 0x78, 0x39,
+0x62, 0x36, 0x36, 0x63, 0x31, 0x35, 0x62, 0x34,
+0x65, 0x30, 0x62, 0x34, 0x65, 0x62, 0x34, 0x39,
+0x66, 0x61, 0x38, 0x37, 0x37, 0x39, 0x38, 0x32,
+0x63, 0x61, 0x66, 0x64, 0x65, 0x64, 0x32, 0x34,
+0x38, 0x35, 0x39, 0x66, 0x65, 0x35, 0x62, 0x30,
+0x65, 0x32, 0x64, 0x62, 0x66, 0x62, 0x65, 0x34,
+0x66, 0x30, 0x64, 0x66, 0x31, 0x64, 0x65, 0x37,
+0x37, 0x34, 0x33, 0x66, 0x64, 0x35, 0x32, 0x22,
+0x2c, 0x20, 0x32, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x5d, 0x5d, 0x2c, 0x0a, 0x22, 0x30, 0x31, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x31, 0x30, 0x31, 0x39, 0x32, 0x37, 0x35, 0x63,
+0x62, 0x38, 0x64, 0x34, 0x61, 0x34, 0x38, 0x35,
+0x63, 0x65, 0x39, 0x35, 0x37, 0x34, 0x31, 0x63,
+0x30, 0x31, 0x33, 0x66, 0x37, 0x63, 0x30, 0x64,
+0x32, 0x38, 0x37, 0x32, 0x32, 0x31, 0x36, 0x30,
+0x30, 0x30, 0x38, 0x30, 0x32, 0x31, 0x62, 0x62,
+0x34, 0x36, 0x39, 0x61, 0x31, 0x31, 0x39, 0x38,
+0x32, 0x64, 0x34, 0x37, 0x61, 0x36, 0x36, 0x32,
+0x38, 0x39, 0x36, 0x34, 0x63, 0x31, 0x64, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x66, 0x66, 0x66,
+0x66, 0x66, 0x66, 0x66, 0x66, 0x30, 0x31, 0x30,
+0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x37, 0x30, 0x30, 0x34, 0x38, 0x33,
+0x30, 0x34, 0x35, 0x30, 0x32, 0x32, 0x30, 0x34,
+0x38, 0x37, 0x66, 0x62, 0x33, 0x38, 0x32, 0x63,
+0x34, 0x39, 0x37, 0x34, 0x64, 0x65, 0x33, 0x66,
+0x37, 0x64, 0x38, 0x33, 0x34, 0x63, 0x31, 0x62,
+0x36, 0x31, 0x37, 0x66, 0x65, 0x31, 0x35, 0x38,
+0x36, 0x30, 0x38, 0x32, 0x38, 0x63, 0x37, 0x66,
+0x39, 0x36, 0x34, 0x35, 0x34, 0x34, 0x39, 0x30,
+0x65, 0x64, 0x64, 0x36, 0x64, 0x38, 0x39, 0x31,
+0x35, 0x35, 0x36, 0x64, 0x63, 0x63, 0x39, 0x30,
+0x32, 0x32, 0x31, 0x30, 0x30, 0x62, 0x61, 0x66,
+0x39, 0x35, 0x66, 0x65, 0x62, 0x34, 0x38, 0x66,
+0x38, 0x34, 0x35, 0x64, 0x35, 0x62, 0x66, 0x63,
+0x39, 0x38, 0x38, 0x32, 0x65, 0x62, 0x36, 0x61,
+0x65, 0x65, 0x66, 0x61, 0x31, 0x62, 0x63, 0x33,
+0x37, 0x39, 0x30, 0x65, 0x33, 0x39, 0x66, 0x35,
+0x39, 0x65, 0x61, 0x61, 0x34, 0x36, 0x66, 0x66,
+0x37, 0x66, 0x31, 0x35, 0x61, 0x65, 0x36, 0x32,
+0x36, 0x63, 0x35, 0x33, 0x65, 0x30, 0x31, 0x34,
+0x38, 0x33, 0x30, 0x34, 0x35, 0x30, 0x32, 0x32,
+0x30, 0x35, 0x32, 0x38, 0x36, 0x66, 0x37, 0x32,
+0x36, 0x36, 0x39, 0x30, 0x62, 0x32, 0x65, 0x39,
+0x62, 0x30, 0x32, 0x30, 0x37, 0x66, 0x30, 0x33,
+0x34, 0x35, 0x37, 0x31, 0x31, 0x65, 0x36, 0x33,
+0x66, 0x61, 0x37, 0x30, 0x31, 0x32, 0x30, 0x34,
+0x35, 0x62, 0x39, 0x65, 0x62, 0x30, 0x66, 0x31,
+0x39, 0x63, 0x32, 0x34, 0x35, 0x38, 0x63, 0x65,
+0x31, 0x64, 0x62, 0x39, 0x30, 0x63, 0x66, 0x34,
+0x33, 0x30, 0x32, 0x32, 0x31, 0x30, 0x30, 0x65,
+0x38, 0x39, 0x66, 0x31, 0x37, 0x66, 0x38, 0x36,
+0x61, 0x62, 0x63, 0x35, 0x62, 0x31, 0x34, 0x39,
+0x65, 0x62, 0x61, 0x34, 0x31, 0x31, 0x35, 0x64,
+0x34, 0x66, 0x31, 0x32, 0x38, 0x62, 0x63, 0x66,
+0x34, 0x35, 0x64, 0x37, 0x37, 0x66, 0x62, 0x33,
+0x65, 0x63, 0x64, 0x64, 0x33, 0x34, 0x66, 0x35,
+0x39, 0x34, 0x30, 0x39, 0x31, 0x33, 0x34, 0x30,
+0x63, 0x30, 0x33, 0x39, 0x35, 0x39, 0x36, 0x30,
+0x31, 0x30, 0x31, 0x30, 0x32, 0x32, 0x31, 0x30,
+0x32, 0x39, 0x36, 0x36, 0x66, 0x31, 0x30, 0x39,
+0x63, 0x35, 0x34, 0x65, 0x38, 0x35, 0x64, 0x33,
+0x61, 0x65, 0x65, 0x38, 0x33, 0x32, 0x31, 0x33,
+0x30, 0x31, 0x31, 0x33, 0x36, 0x63, 0x65, 0x64,
+0x65, 0x62, 0x39, 0x66, 0x63, 0x37, 0x31, 0x30,
+0x66, 0x64, 0x65, 0x66, 0x35, 0x38, 0x61, 0x39,
+0x64, 0x65, 0x38, 0x61, 0x37, 0x33, 0x39, 0x34,
+0x32, 0x66, 0x38, 0x65, 0x35, 0x36, 0x37, 0x63,
+0x30, 0x32, 0x31, 0x30, 0x33, 0x34, 0x66, 0x66,
+0x63, 0x39, 0x39, 0x64, 0x64, 0x39, 0x61, 0x37,
+0x39, 0x64, 0x64, 0x33, 0x63, 0x62, 0x33, 0x31,
+0x65, 0x32, 0x61, 0x62, 0x33, 0x65, 0x30, 0x62,
+0x30, 0x39, 0x65, 0x30, 0x65, 0x36, 0x37, 0x64,
+0x62, 0x34, 0x31, 0x61, 0x63, 0x30, 0x36, 0x38,
+0x63, 0x36, 0x32, 0x35, 0x63, 0x64, 0x31, 0x66,
+0x34, 0x39, 0x31, 0x35, 0x37, 0x36, 0x30, 0x31,
+0x36, 0x63, 0x38, 0x34, 0x65, 0x39, 0x35, 0x35,
+0x32, 0x61, 0x66, 0x34, 0x38, 0x33, 0x30, 0x34,
+0x35, 0x30, 0x32, 0x32, 0x30, 0x34, 0x38, 0x37,
+0x66, 0x62, 0x33, 0x38, 0x32, 0x63, 0x34, 0x39,
+0x37, 0x34, 0x64, 0x65, 0x33, 0x66, 0x37, 0x64,
+0x38, 0x33, 0x34, 0x63, 0x31, 0x62, 0x36, 0x31,
+0x37, 0x66, 0x65, 0x31, 0x35, 0x38, 0x36, 0x30,
+0x38, 0x32, 0x38, 0x63, 0x37, 0x66, 0x39, 0x36,
+0x34, 0x35, 0x34, 0x34, 0x39, 0x30, 0x65, 0x64,
+0x64, 0x36, 0x64, 0x38, 0x39, 0x31, 0x35, 0x35,
+0x36, 0x64, 0x63, 0x63, 0x39, 0x30, 0x32, 0x32,
+0x31, 0x30, 0x30, 0x62, 0x61, 0x66, 0x39, 0x35,
+0x66, 0x65, 0x62, 0x34, 0x38, 0x66, 0x38, 0x34,
+0x35, 0x64, 0x35, 0x62, 0x66, 0x63, 0x39, 0x38,
+0x38, 0x32, 0x65, 0x62, 0x36, 0x61, 0x65, 0x65,
+0x66, 0x61, 0x31, 0x62, 0x63, 0x33, 0x37, 0x39,
+0x30, 0x65, 0x33, 0x39, 0x66, 0x35, 0x39, 0x65,
+0x61, 0x61, 0x34, 0x36, 0x66, 0x66, 0x37, 0x66,
+0x31, 0x35, 0x61, 0x65, 0x36, 0x32, 0x36, 0x63,
+0x35, 0x33, 0x65, 0x30, 0x31, 0x34, 0x38, 0x33,
+0x30, 0x34, 0x35, 0x30, 0x32, 0x32, 0x30, 0x35,
+0x32, 0x38, 0x36, 0x66, 0x37, 0x32, 0x36, 0x36,
+0x39, 0x30, 0x62, 0x32, 0x65, 0x39, 0x62, 0x30,
+0x32, 0x30, 0x37, 0x66, 0x30, 0x33, 0x34, 0x35,
+0x37, 0x31, 0x31, 0x65, 0x36, 0x33, 0x66, 0x61,
+0x37, 0x30, 0x31, 0x32, 0x30, 0x34, 0x35, 0x62,
+0x39, 0x65, 0x62, 0x30, 0x66, 0x31, 0x39, 0x63,
+0x32, 0x34, 0x35, 0x38, 0x63, 0x65, 0x31, 0x64,
+0x62, 0x39, 0x30, 0x63, 0x66, 0x34, 0x33, 0x30,
+0x32, 0x32, 0x31, 0x30, 0x30, 0x65, 0x38, 0x39,
+0x66, 0x31, 0x37, 0x66, 0x38, 0x36, 0x61, 0x62,
+0x63, 0x35, 0x62, 0x31, 0x34, 0x39, 0x65, 0x62,
+0x61, 0x34, 0x31, 0x31, 0x35, 0x64, 0x34, 0x66,
+0x31, 0x32, 0x38, 0x62, 0x63, 0x66, 0x34, 0x35,
+0x64, 0x37, 0x37, 0x66, 0x62, 0x33, 0x65, 0x63,
+0x64, 0x64, 0x33, 0x34, 0x66, 0x35, 0x39, 0x34,
+0x30, 0x39, 0x31, 0x33, 0x34, 0x30, 0x63, 0x30,
+0x33, 0x39, 0x35, 0x39, 0x36, 0x30, 0x31, 0x37,
+0x35, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x22, 0x2c, 0x20, 0x22, 0x50, 0x32, 0x53,
+0x48, 0x2c, 0x57, 0x49, 0x54, 0x4e, 0x45, 0x53,
+0x53, 0x2c, 0x43, 0x4f, 0x4e, 0x53, 0x54, 0x5f,
+0x53, 0x43, 0x52, 0x49, 0x50, 0x54, 0x43, 0x4f,
+0x44, 0x45, 0x22, 0x5d, 0x2c, 0x0a, 0x0a, 0x5b,
+0x22, 0x54, 0x65, 0x73, 0x74, 0x20, 0x6c, 0x6f,
+0x6e, 0x67, 0x20, 0x6f, 0x75, 0x74, 0x70, 0x75,
+0x74, 0x73, 0x2c, 0x20, 0x77, 0x68, 0x69, 0x63,
+0x68, 0x20, 0x61, 0x72, 0x65, 0x20, 0x73, 0x74,
+0x72, 0x65, 0x61, 0x6d, 0x65, 0x64, 0x20, 0x75,
+0x73, 0x69, 0x6e, 0x67, 0x20, 0x6c, 0x65, 0x6e,
+0x67, 0x74, 0x68, 0x2d, 0x70, 0x72, 0x65, 0x66,
+0x69, 0x78, 0x65, 0x64, 0x20, 0x62, 0x69, 0x74,
+0x63, 0x6f, 0x69, 0x6e, 0x20, 0x73, 0x74, 0x72,
+0x69, 0x6e, 0x67, 0x73, 0x2e, 0x20, 0x54, 0x68,
+0x69, 0x73, 0x20, 0x6d, 0x69, 0x67, 0x68, 0x74,
+0x20, 0x62, 0x65, 0x20, 0x73, 0x75, 0x72, 0x70,
+0x72, 0x69, 0x73, 0x69, 0x6e, 0x67, 0x2e, 0x22,
+0x5d, 0x2c, 0x0a, 0x5b, 0x5b, 0x5b, 0x22, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x22,
+0x2c, 0x20, 0x30, 0x2c, 0x20, 0x22, 0x30, 0x78,
+0x30, 0x30, 0x20, 0x30, 0x78, 0x31, 0x34, 0x20,
+0x30, 0x78, 0x37, 0x35, 0x31, 0x65, 0x37, 0x36,
+0x65, 0x38, 0x31, 0x39, 0x39, 0x31, 0x39, 0x36,
+0x64, 0x34, 0x35, 0x34, 0x39, 0x34, 0x31, 0x63,
+0x34, 0x35, 0x64, 0x31, 0x62, 0x33, 0x61, 0x33,
+0x32, 0x33, 0x66, 0x31, 0x34, 0x33, 0x33, 0x62,
+0x64, 0x36, 0x22, 0x2c, 0x20, 0x35, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x5d, 0x5d, 0x2c, 0x0a,
+0x22, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x31, 0x30, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+0x66, 0x30, 0x31, 0x33, 0x30, 0x32, 0x34, 0x34,
+0x63, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x66, 0x64, 0x30, 0x32, 0x30,
+0x31, 0x34, 0x63, 0x64, 0x63, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+0x31, 0x31, 0x31, 0x31, 0x31, 0x37, 0x35, 0x32,
+0x31, 0x30, 0x32, 0x37, 0x39, 0x62, 0x65, 0x36,
+0x36, 0x37, 0x65, 0x66, 0x39, 0x64, 0x63, 0x62,
+0x62, 0x61, 0x63, 0x35, 0x35, 0x61, 0x30, 0x36,
+0x32, 0x39, 0x35, 0x63, 0x65, 0x38, 0x37, 0x30,
+0x62, 0x30, 0x37, 0x30, 0x32, 0x39, 0x62, 0x66,
+0x63, 0x64, 0x62, 0x32, 0x64, 0x63, 0x65, 0x32,
+0x38, 0x64, 0x39, 0x35, 0x39, 0x66, 0x32, 0x38,
+0x31, 0x35, 0x62, 0x31, 0x36, 0x66, 0x38, 0x31,
+0x37, 0x39, 0x38, 0x61, 0x63, 0x30, 0x32, 0x34,
+0x38, 0x33, 0x30, 0x34, 0x35, 0x30, 0x32, 0x32,
+0x31, 0x30, 0x30, 0x63, 0x31, 0x61, 0x34, 0x61,
+0x36, 0x35, 0x38, 0x31, 0x39, 0x39, 0x36, 0x61,
+0x37, 0x66, 0x64, 0x66, 0x65, 0x61, 0x37, 0x37,
+0x64, 0x35, 0x38, 0x64, 0x35, 0x33, 0x37, 0x39,
+0x35, 0x35, 0x61, 0x35, 0x36, 0x35, 0x35, 0x63,
+0x31, 0x64, 0x36, 0x31, 0x39, 0x62, 0x36, 0x66,
+0x33, 0x61, 0x62, 0x36, 0x38, 0x37, 0x34, 0x66,
+0x32, 0x38, 0x62, 0x62, 0x32, 0x65, 0x31, 0x39,
+0x37, 0x30, 0x38, 0x30, 0x32, 0x32, 0x30, 0x35,
+0x36, 0x34, 0x30, 0x32, 0x64, 0x62, 0x36, 0x66,
+0x65, 0x64, 0x65, 0x30, 0x33, 0x63, 0x61, 0x61,
+0x65, 0x30, 0x34, 0x35, 0x61, 0x33, 0x62, 0x65,
+0x36, 0x31, 0x36, 0x61, 0x31, 0x61, 0x32, 0x64,
+0x30, 0x39, 0x31, 0x39, 0x61, 0x34, 0x37, 0x35,
+0x65, 0x64, 0x34, 0x62, 0x65, 0x38, 0x32, 0x38,
+0x64, 0x63, 0x39, 0x66, 0x66, 0x32, 0x31, 0x66,
+0x32, 0x34, 0x30, 0x36, 0x33, 0x61, 0x61, 0x30,
+0x31, 0x32, 0x31, 0x30, 0x32, 0x37, 0x39, 0x62,
+0x65, 0x36, 0x36, 0x37, 0x65, 0x66, 0x39, 0x64,
+0x63, 0x62, 0x62, 0x61, 0x63, 0x35, 0x35, 0x61,
+0x30, 0x36, 0x32, 0x39, 0x35, 0x63, 0x65, 0x38,
+0x37, 0x30, 0x62, 0x30, 0x37, 0x30, 0x32, 0x39,
+0x62, 0x66, 0x63, 0x64, 0x62, 0x32, 0x64, 0x63,
+0x65, 0x32, 0x38, 0x64, 0x39, 0x35, 0x39, 0x66,
+0x32, 0x38, 0x31, 0x35, 0x62, 0x31, 0x36, 0x66,
+0x38, 0x31, 0x37, 0x39, 0x38, 0x30, 0x30, 0x30,
+0x30, 0x30, 0x30, 0x30, 0x30, 0x22, 0x2c, 0x20,
+0x22, 0x50, 0x32, 0x53, 0x48, 0x2c, 0x57, 0x49,
+0x54, 0x4e, 0x45, 0x53, 0x53, 0x22, 0x5d, 0x2c,
+0x0a, 0x0a, 0x5b, 0x22, 0x4d, 0x61, 0x6b, 0x65,
+0x20, 0x64, 0x69, 0x66, 0x66, 0x73, 0x20, 0x63,
+0x6c, 0x65, 0x61, 0x6e, 0x65, 0x72, 0x20, 0x62,
+0x79, 0x20, 0x6c, 0x65, 0x61, 0x76, 0x69, 0x6e,
+0x67, 0x20, 0x61, 0x20, 0x63, 0x6f, 0x6d, 0x6d,
+0x65, 0x6e, 0x74, 0x20, 0x68, 0x65, 0x72, 0x65,
+0x20, 0x77, 0x69, 0x74, 0x68, 0x6f, 0x75, 0x74,
+0x20, 0x63, 0x6f, 0x6d, 0x6d, 0x61, 0x20, 0x61,
+0x74, 0x20, 0x74, 0x68, 0x65, 0x20, 0x65, 0x6e,
+0x64, 0x22, 0x5d, 0x0a, 0x5d, 0x0a,
+};};
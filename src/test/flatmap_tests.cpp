@@ -0,0 +1,193 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <flatmap.h>
+#include <memusage.h>
+
+#include <test/test_bitcoin.h>
+
+#include <map>
+#include <string>
+
+#include <boost/test/unit_test.hpp>
+
+namespace {
+
+struct IntHasher {
+    size_t operator()(int k) const { return size_t(k) * 0x9E3779B97F4A7C15ULL; }
+};
+
+//! Hasher with lots of collisions, to exercise long probe sequences.
+struct CollidingHasher {
+    size_t operator()(int k) const { return k % 7; }
+};
+
+template <typename Hash>
+void CheckEqual(const flatmap<int, std::string, Hash>& map, const std::map<int, std::string>& expected)
+{
+    BOOST_CHECK_EQUAL(map.size(), expected.size());
+    size_t count = 0;
+    for (const auto& entry : map) {
+        auto it = expected.find(entry.first);
+        BOOST_CHECK(it != expected.end() && it->second == entry.second);
+        ++count;
+    }
+    BOOST_CHECK_EQUAL(count, expected.size());
+    for (const auto& entry : expected) {
+        auto it = map.find(entry.first);
+        BOOST_CHECK(it != map.end() && it->second == entry.second);
+    }
+}
+
+template <typename Hash>
+void RandomOperations()
+{
+    flatmap<int, std::string, Hash> map;
+    std::map<int, std::string> expected;
+
+    for (int i = 0; i < 100000; ++i) {
+        int key = InsecureRandRange(2000);
+        switch (InsecureRandRange(4)) {
+        case 0: {
+            auto ret = map.emplace(key, std::to_string(key));
+            BOOST_CHECK_EQUAL(ret.second, expected.emplace(key, std::to_string(key)).second);
+            BOOST_CHECK_EQUAL(ret.first->first, key);
+            break;
+        }
+        case 1:
+            BOOST_CHECK_EQUAL(map.erase(key), expected.erase(key));
+            break;
+        case 2:
+            map[key] += "x";
+            expected[key] += "x";
+            break;
+        case 3:
+            BOOST_CHECK_EQUAL(map.count(key), expected.count(key));
+            break;
+        }
+    }
+    CheckEqual(map, expected);
+
+    // Both erase-while-iterating idioms visit every element exactly once.
+    for (auto it = map.begin(); it != map.end();) {
+        if (it->first % 2) {
+            expected.erase(it->first);
+            it = map.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    CheckEqual(map, expected);
+    for (auto it = map.begin(); it != map.end();) {
+        if (it->first % 3 == 0) {
+            expected.erase(it->first);
+            map.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+    CheckEqual(map, expected);
+
+    map.clear();
+    BOOST_CHECK(map.empty());
+    BOOST_CHECK(map.begin() == map.end());
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(map), 0U);
+}
+
+} // namespace
+
+BOOST_FIXTURE_TEST_SUITE(flatmap_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(flatmap_random_operations)
+{
+    RandomOperations<IntHasher>();
+    RandomOperations<CollidingHasher>();
+}
+
+BOOST_AUTO_TEST_CASE(flatmap_reference_stability)
+{
+    flatmap<int, std::string, IntHasher> map;
+    std::string& first = map[0];
+    first = "first";
+    // Growing the storage and the index does not move existing elements.
+    for (int i = 1; i < 10000; ++i) {
+        map[i] = std::to_string(i);
+    }
+    BOOST_CHECK_EQUAL(&map.find(0)->second, &first);
+    BOOST_CHECK_EQUAL(first, "first");
+
+    // Erasing does not move other elements, and the hole is reused.
+    std::string& last = map[9999];
+    std::string& middle = map[5000];
+    map.erase(0);
+    map.erase(9998);
+    BOOST_CHECK_EQUAL(map.size(), 9998U);
+    BOOST_CHECK_EQUAL(&map.find(9999)->second, &last);
+    BOOST_CHECK_EQUAL(&map.find(5000)->second, &middle);
+    BOOST_CHECK_EQUAL(last, "9999");
+    BOOST_CHECK_EQUAL(middle, "5000");
+    map[10000] = "10000";
+    map[10001] = "10001";
+    BOOST_CHECK(&map.find(10000)->second == &first || &map.find(10001)->second == &first);
+    BOOST_CHECK_EQUAL(&map.find(9999)->second, &last);
+    BOOST_CHECK_EQUAL(map.size(), 10000U);
+
+    // Only shrink_to_fit() moves elements, to fill the holes.
+    map.erase(10000);
+    map.erase(10001);
+    map.shrink_to_fit();
+    BOOST_CHECK_EQUAL(map.size(), 9998U);
+    for (int i = 1; i < 10000; ++i) {
+        if (i == 9998) continue;
+        BOOST_CHECK_EQUAL(map.find(i)->second, std::to_string(i));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(flatmap_memusage)
+{
+    typedef flatmap<int, int64_t, IntHasher> map_type;
+    map_type map;
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(map), 0U);
+    for (int i = 0; i < 100000; ++i) {
+        map.emplace(i, i);
+    }
+    // Storage is allocated one chunk at a time; the index keeps a load factor
+    // of at least 3/8 once it is in use.
+    size_t usage = memusage::DynamicUsage(map);
+    size_t chunks = (map.size() + map_type::CHUNK_SIZE - 1) / map_type::CHUNK_SIZE;
+    BOOST_CHECK_EQUAL(map.chunk_count(), chunks);
+    BOOST_CHECK(map.bucket_count() * 3 <= map.size() * 8);
+    BOOST_CHECK(usage >= map.size() * sizeof(map_type::value_type));
+    BOOST_CHECK(usage <= chunks * memusage::MallocUsage(map_type::chunk_bytes()) + map.size() * 8 * map_type::bucket_bytes() / 3 + memusage::MallocUsage(chunks * 2 * sizeof(void*)) + memusage::MallocUsage(map.bitmap_bytes()) * 2);
+
+    // Erasing from the end releases chunks right away.
+    for (int i = 99999; i >= 90000; --i) {
+        map.erase(i);
+    }
+    BOOST_CHECK(map.chunk_count() <= (map.size() + map_type::CHUNK_SIZE - 1) / map_type::CHUNK_SIZE + 1);
+    BOOST_CHECK(memusage::DynamicUsage(map) < usage);
+    usage = memusage::DynamicUsage(map);
+
+    // Holes elsewhere keep their chunks until shrink_to_fit() fills them.
+    chunks = map.chunk_count();
+    for (int i = 0; i < 90000; i += 2) {
+        map.erase(i);
+    }
+    BOOST_CHECK_EQUAL(map.chunk_count(), chunks);
+    BOOST_CHECK(memusage::DynamicUsage(map) >= usage);
+
+    // The index only shrinks on request too.
+    size_t buckets = map.bucket_count();
+    map.shrink_to_fit();
+    BOOST_CHECK(map.chunk_count() <= (map.size() + map_type::CHUNK_SIZE - 1) / map_type::CHUNK_SIZE + 1);
+    BOOST_CHECK(memusage::DynamicUsage(map) < usage);
+    BOOST_CHECK(map.bucket_count() < buckets);
+    BOOST_CHECK(map.bucket_count() * 3 <= map.size() * 8);
+    BOOST_CHECK_EQUAL(map.size(), 45000U);
+    for (int i = 1; i < 90000; i += 2) {
+        BOOST_CHECK_EQUAL(map.find(i)->second, i);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
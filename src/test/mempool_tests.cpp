@@ -590,6 +590,117 @@ inline CTransactionRef make_tx(std::vector<CAmount>&& output_values, std::vector
 }
 
 
+BOOST_AUTO_TEST_CASE(MempoolSizeLimitBatchTest)
+{
+    // TrimToSize evicts in batches, which must leave the same transactions
+    // and descendant state as evicting one package at a time.
+    TestMemPoolEntryHelper entry;
+    std::vector<std::pair<CTransactionRef, CAmount>> txs;
+    for (int chain = 0; chain < 4; ++chain) {
+        CTransactionRef tx = make_tx({10 * COIN + chain});
+        txs.emplace_back(tx, 1000 + chain);
+        for (int depth = 1; depth < 10; ++depth) {
+            tx = make_tx({10 * COIN}, {tx});
+            txs.emplace_back(tx, 2000 - 150 * depth + 7 * chain);
+        }
+    }
+    // Pays for the tips of two chains
+    txs.emplace_back(make_tx({COIN}, {txs[9].first, txs[19].first}), 30000);
+
+    CTxMemPool batch_pool, single_pool;
+    LOCK2(batch_pool.cs, single_pool.cs);
+    int64_t time = 0;
+    for (const auto& tx : txs) {
+        batch_pool.addUnchecked(entry.Fee(tx.second).Time(++time).FromTx(tx.first));
+        single_pool.addUnchecked(entry.Fee(tx.second).Time(time).FromTx(tx.first));
+    }
+    BOOST_CHECK_EQUAL(batch_pool.DynamicMemoryUsage(), single_pool.DynamicMemoryUsage());
+
+    const size_t usage = batch_pool.DynamicMemoryUsage();
+    for (int quarters = 3; quarters >= 0; --quarters) {
+        const size_t limit = usage * quarters / 4;
+        batch_pool.TrimToSize(limit);
+        while (single_pool.size() && single_pool.DynamicMemoryUsage() > limit) {
+            single_pool.TrimToSize(single_pool.DynamicMemoryUsage() - 1);
+        }
+        BOOST_CHECK(batch_pool.size() == 0 || batch_pool.DynamicMemoryUsage() <= limit);
+        BOOST_CHECK_EQUAL(batch_pool.size(), single_pool.size());
+        BOOST_CHECK(batch_pool.GetMinFee(1) == single_pool.GetMinFee(1));
+        for (const auto& tx : txs) {
+            const uint256 txid = tx.first->GetHash();
+            BOOST_CHECK_EQUAL(batch_pool.exists(txid), single_pool.exists(txid));
+            if (!batch_pool.exists(txid) || !single_pool.exists(txid)) continue;
+            const CTxMemPoolEntry& batch_entry = *batch_pool.mapTx.find(txid);
+            const CTxMemPoolEntry& single_entry = *single_pool.mapTx.find(txid);
+            BOOST_CHECK_EQUAL(batch_entry.GetCountWithDescendants(), single_entry.GetCountWithDescendants());
+            BOOST_CHECK_EQUAL(batch_entry.GetSizeWithDescendants(), single_entry.GetSizeWithDescendants());
+            BOOST_CHECK_EQUAL(batch_entry.GetModFeesWithDescendants(), single_entry.GetModFeesWithDescendants());
+        }
+    }
+    BOOST_CHECK_EQUAL(batch_pool.size(), 0U);
+}
+
+static void CheckSameState(CTxMemPool& pool, CTxMemPool& expected) EXCLUSIVE_LOCKS_REQUIRED(pool.cs, expected.cs)
+{
+    BOOST_CHECK_EQUAL(pool.size(), expected.size());
+    for (const CTxMemPoolEntry& e : expected.mapTx) {
+        auto it = pool.mapTx.find(e.GetTx().GetHash());
+        BOOST_REQUIRE(it != pool.mapTx.end());
+        BOOST_CHECK_EQUAL(it->GetCountWithAncestors(), e.GetCountWithAncestors());
+        BOOST_CHECK_EQUAL(it->GetSizeWithAncestors(), e.GetSizeWithAncestors());
+        BOOST_CHECK_EQUAL(it->GetModFeesWithAncestors(), e.GetModFeesWithAncestors());
+        BOOST_CHECK_EQUAL(it->GetSigOpCostWithAncestors(), e.GetSigOpCostWithAncestors());
+        BOOST_CHECK_EQUAL(it->GetCountWithDescendants(), e.GetCountWithDescendants());
+        BOOST_CHECK_EQUAL(it->GetSizeWithDescendants(), e.GetSizeWithDescendants());
+        BOOST_CHECK_EQUAL(it->GetModFeesWithDescendants(), e.GetModFeesWithDescendants());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(MempoolBlockStateTest)
+{
+    // Transactions confirmed or returned to the mempool together update the
+    // state of their in-mempool relatives in one go, which must leave the
+    // same state as a mempool built up from scratch.
+    CTransactionRef a0 = make_tx({10 * COIN, COIN});
+    CTransactionRef a1 = make_tx({9 * COIN, COIN}, {a0});
+    CTransactionRef a2 = make_tx({8 * COIN}, {a1});
+    CTransactionRef a3 = make_tx({7 * COIN}, {a2});
+    CTransactionRef b0 = make_tx({5 * COIN});
+    CTransactionRef b1 = make_tx({4 * COIN}, {b0});
+    CTransactionRef joined = make_tx({COIN}, {a3, b1});
+    CTransactionRef side = make_tx({COIN / 2}, {a1}, {1});
+    const std::vector<CTransactionRef> all{a0, a1, a2, a3, b0, b1, joined, side};
+    const std::vector<CTransactionRef> block{a0, a1, b0};
+
+    TestMemPoolEntryHelper entry;
+    auto add = [&](CTxMemPool& pool, const CTransactionRef& tx) EXCLUSIVE_LOCKS_REQUIRED(pool.cs) {
+        const size_t i = std::find(all.begin(), all.end(), tx) - all.begin();
+        pool.addUnchecked(entry.Fee(1000 * (i + 1)).SigOpsCost(4 * (i + 1)).FromTx(tx));
+    };
+
+    CTxMemPool pool, remaining, full;
+    LOCK(pool.cs);
+    LOCK2(remaining.cs, full.cs);
+    for (const CTransactionRef& tx : all) {
+        add(pool, tx);
+        add(full, tx);
+        if (std::find(block.begin(), block.end(), tx) == block.end()) add(remaining, tx);
+    }
+
+    pool.removeForBlock(block, 1);
+    CheckSameState(pool, remaining);
+
+    // Disconnect the block again: its transactions are added back without
+    // their in-mempool children, which UpdateTransactionsFromBlock links.
+    std::vector<uint256> hashes;
+    for (const CTransactionRef& tx : block) {
+        add(pool, tx);
+        hashes.push_back(tx->GetHash());
+    }
+    pool.UpdateTransactionsFromBlock(hashes);
+    CheckSameState(pool, full);
+}
+
 BOOST_AUTO_TEST_CASE(MempoolAncestryTests)
 {
     size_t ancestors, descendants;
@@ -749,4 +860,129 @@ BOOST_AUTO_TEST_CASE(MempoolAncestryTests)
     BOOST_CHECK_EQUAL(descendants, 6ULL);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolSnapshotTest)
+{
+    CTxMemPool pool;
+    TestMemPoolEntryHelper entry;
+
+    // [tx1] <- [tx2] <- [tx4]
+    //       <- [tx3] <-/
+    // [tx5]
+    CMutableTransaction mtx1;
+    mtx1.vin.resize(1);
+    mtx1.vin[0].nSequence = 0; // signals BIP125 replaceability
+    mtx1.vout.resize(2);
+    mtx1.vout[0].nValue = mtx1.vout[1].nValue = 5 * COIN;
+    CTransactionRef tx1 = MakeTransactionRef(mtx1);
+    CTransactionRef tx2 = make_tx(/* output_values */ {4 * COIN}, /* inputs */ {tx1}, /* input_indices */ {0});
+    CTransactionRef tx3 = make_tx(/* output_values */ {4 * COIN}, /* inputs */ {tx1}, /* input_indices */ {1});
+    CTransactionRef tx4 = make_tx(/* output_values */ {7 * COIN}, /* inputs */ {tx2, tx3});
+    CTransactionRef tx5 = make_tx(/* output_values */ {1 * COIN});
+
+    std::shared_ptr<const MempoolSnapshot> empty = pool.GetSnapshot();
+    BOOST_CHECK(empty->Entries().empty());
+    BOOST_CHECK(empty->Find(tx1->GetHash()) == MempoolSnapshot::npos);
+    BOOST_CHECK(pool.GetSnapshot() == empty);
+
+    {
+        LOCK(pool.cs);
+        pool.addUnchecked(entry.Fee(1000LL).Time(10).FromTx(tx1));
+        pool.addUnchecked(entry.Fee(2000LL).FromTx(tx2));
+        pool.addUnchecked(entry.Fee(3000LL).FromTx(tx3));
+        pool.addUnchecked(entry.Fee(4000LL).FromTx(tx4));
+        pool.addUnchecked(entry.Fee(5000LL).FromTx(tx5));
+    }
+
+    // Snapshots are shared until the mempool changes.
+    std::shared_ptr<const MempoolSnapshot> snapshot = pool.GetSnapshot();
+    BOOST_CHECK(snapshot != empty);
+    BOOST_CHECK(pool.GetSnapshot() == snapshot);
+    BOOST_CHECK_EQUAL(snapshot->Entries().size(), 5U);
+
+    std::vector<uint256> vtxid;
+    pool.queryHashes(vtxid);
+    for (size_t pos = 0; pos < vtxid.size(); pos++) {
+        BOOST_CHECK(snapshot->Entries()[pos].txid == vtxid[pos]);
+        BOOST_CHECK_EQUAL(snapshot->Find(vtxid[pos]), pos);
+    }
+
+    const size_t pos1 = snapshot->Find(tx1->GetHash());
+    const size_t pos2 = snapshot->Find(tx2->GetHash());
+    const size_t pos3 = snapshot->Find(tx3->GetHash());
+    const size_t pos4 = snapshot->Find(tx4->GetHash());
+    const size_t pos5 = snapshot->Find(tx5->GetHash());
+    const MempoolSnapshot::Entry& e1 = snapshot->Entries()[pos1];
+    BOOST_CHECK(e1.wtxid == tx1->GetWitnessHash());
+    BOOST_CHECK_EQUAL(e1.fee, 1000);
+    BOOST_CHECK_EQUAL(e1.time, 10);
+    BOOST_CHECK_EQUAL(e1.count_with_descendants, 4U);
+    BOOST_CHECK_EQUAL(e1.mod_fees_with_descendants, 10000);
+    BOOST_CHECK(e1.parents.empty());
+    BOOST_CHECK_EQUAL(e1.children.size(), 2U);
+    BOOST_CHECK_EQUAL(snapshot->Entries()[pos4].count_with_ancestors, 4U);
+    BOOST_CHECK_EQUAL(snapshot->Entries()[pos4].parents.size(), 2U);
+
+    BOOST_CHECK(snapshot->CalculateAncestors(pos4) == std::set<size_t>({pos1, pos2, pos3}));
+    BOOST_CHECK(snapshot->CalculateAncestors(pos1).empty());
+    BOOST_CHECK(snapshot->CalculateDescendants(pos1) == std::set<size_t>({pos2, pos3, pos4}));
+    BOOST_CHECK(snapshot->CalculateDescendants(pos5).empty());
+
+    // Replaceability is inherited from ancestors.
+    BOOST_CHECK(e1.bip125_replaceable);
+    BOOST_CHECK(snapshot->Entries()[pos4].bip125_replaceable);
+    BOOST_CHECK(!snapshot->Entries()[pos5].bip125_replaceable);
+
+    // Changes publish a new snapshot, while the old one stays intact.
+    pool.PrioritiseTransaction(tx5->GetHash(), 100);
+    std::shared_ptr<const MempoolSnapshot> prioritised = pool.GetSnapshot();
+    BOOST_CHECK(prioritised != snapshot);
+    BOOST_CHECK_EQUAL(prioritised->Entries()[prioritised->Find(tx5->GetHash())].modified_fee, 5100);
+    BOOST_CHECK_EQUAL(snapshot->Entries()[pos5].modified_fee, 5000);
+
+    pool.removeRecursive(*tx2);
+    std::shared_ptr<const MempoolSnapshot> removed = pool.GetSnapshot();
+    BOOST_CHECK_EQUAL(removed->Entries().size(), 3U);
+    BOOST_CHECK(removed->Find(tx4->GetHash()) == MempoolSnapshot::npos);
+    BOOST_CHECK_EQUAL(removed->Entries()[removed->Find(tx1->GetHash())].children.size(), 1U);
+    BOOST_CHECK_EQUAL(snapshot->Entries().size(), 5U);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolArenaCompactTest)
+{
+    CTxMemPool pool;
+    TestMemPoolEntryHelper entry;
+    const CTxMemPool::ArenaStats empty = pool.GetArenaStats();
+
+    std::vector<CTransactionRef> txs;
+    for (int i = 0; i < 5000; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(InsecureRand256(), 0);
+        tx.vout.resize(1);
+        tx.vout[0].nValue = i;
+        txs.push_back(MakeTransactionRef(tx));
+        LOCK(pool.cs);
+        pool.addUnchecked(entry.FromTx(txs.back()));
+    }
+    const CTxMemPool::ArenaStats full = pool.GetArenaStats();
+    BOOST_CHECK(full.used_bytes > empty.used_bytes);
+    BOOST_CHECK(full.chunk_bytes >= full.used_bytes);
+
+    // Freed nodes stay in the arena until it is compacted.
+    for (const CTransactionRef& tx : txs) {
+        pool.removeRecursive(*tx);
+    }
+    BOOST_CHECK(pool.GetArenaStats().used_bytes <= empty.used_bytes);
+    BOOST_CHECK_EQUAL(pool.GetArenaStats().chunk_bytes, full.chunk_bytes);
+    BOOST_CHECK(pool.CompactArena() > 0);
+    BOOST_CHECK(pool.GetArenaStats().chunk_bytes < full.chunk_bytes);
+    BOOST_CHECK(pool.GetArenaStats().used_bytes <= empty.used_bytes);
+
+    // The compacted arena is used as before.
+    LOCK(pool.cs);
+    pool.addUnchecked(entry.FromTx(txs[0]));
+    BOOST_CHECK(pool.exists(txs[0]->GetHash()));
+    BOOST_CHECK(pool.GetArenaStats().used_bytes > empty.used_bytes);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
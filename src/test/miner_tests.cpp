@@ -12,11 +12,13 @@
 #include <miner.h>
 #include <policy/policy.h>
 #include <pubkey.h>
+#include <script/sign.h>
 #include <script/standard.h>
 #include <txmempool.h>
 #include <uint256.h>
 #include <util.h>
 #include <utilstrencodings.h>
+#include <validationinterface.h>
 
 #include <test/test_bitcoin.h>
 
@@ -521,4 +523,86 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     fCheckpointsEnabled = true;
 }
 
+static CTransactionRef SpendToMemPool(const CTransactionRef& prev, const CScript& scriptPubKey, const CKey& key, CAmount nFee)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(prev->GetHash(), 0);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = prev->vout[0].nValue - nFee;
+    tx.vout[0].scriptPubKey = scriptPubKey;
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, tx, 0, SIGHASH_ALL, 0, SigVersion::BASE);
+    BOOST_CHECK(key.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    tx.vin[0].scriptSig << vchSig;
+
+    CTransactionRef ptx = MakeTransactionRef(tx);
+    LOCK(cs_main);
+    CValidationState state;
+    BOOST_CHECK(AcceptToMemoryPool(mempool, state, ptx, nullptr /* pfMissingInputs */,
+                                   nullptr /* plTxnReplaced */, false /* bypass_limits */, 0 /* nAbsurdFee */));
+    return ptx;
+}
+
+BOOST_FIXTURE_TEST_CASE(block_template_cache, TestChain100Setup)
+{
+    const CChainParams& chainparams = Params();
+    const CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    const CAmount nSubsidy = GetBlockSubsidy(chainActive.Height() + 1, chainparams.GetConsensus());
+    GetMainSignals().RegisterWithMempoolSignals(mempool);
+    BlockTemplateCache cache(chainparams, CScript() << OP_TRUE);
+    RegisterValidationInterface(&cache);
+
+    std::unique_ptr<CBlockTemplate> tmpl = cache.GetBlockTemplate(true, BLOCK_TEMPLATE_MAX_STALE_AGE);
+    BOOST_CHECK_EQUAL(tmpl->block.vtx.size(), 1U);
+    BOOST_CHECK_EQUAL(cache.GetRebuildCount(), 1U);
+
+    // New transactions are appended, parents before children, without a rebuild.
+    CTransactionRef parent = SpendToMemPool(m_coinbase_txns[0], scriptPubKey, coinbaseKey, 10000);
+    CTransactionRef child = SpendToMemPool(parent, scriptPubKey, coinbaseKey, 20000);
+    SyncWithValidationInterfaceQueue();
+    tmpl = cache.GetBlockTemplate(true, BLOCK_TEMPLATE_MAX_STALE_AGE);
+    BOOST_CHECK_EQUAL(cache.GetRebuildCount(), 1U);
+    BOOST_REQUIRE_EQUAL(tmpl->block.vtx.size(), 3U);
+    BOOST_CHECK(tmpl->block.vtx[1] == parent);
+    BOOST_CHECK(tmpl->block.vtx[2] == child);
+    BOOST_CHECK_EQUAL(tmpl->vTxFees[0], -30000);
+    BOOST_CHECK_EQUAL(tmpl->vTxFees[2], 20000);
+    BOOST_CHECK_EQUAL(tmpl->block.vtx[0]->vout[0].nValue, nSubsidy + 30000);
+
+    // A full rebuild selects the same transactions.
+    std::unique_ptr<CBlockTemplate> rebuilt = BlockAssembler(chainparams).CreateNewBlock(CScript() << OP_TRUE);
+    BOOST_REQUIRE_EQUAL(rebuilt->block.vtx.size(), 3U);
+    BOOST_CHECK(rebuilt->block.vtx[0]->vout[0].nValue == tmpl->block.vtx[0]->vout[0].nValue);
+    BOOST_CHECK(rebuilt->block.vtx[1] == parent);
+    BOOST_CHECK(rebuilt->block.vtx[2] == child);
+
+    // Removing a transaction in the template forces a rebuild.
+    mempool.removeRecursive(*child, MemPoolRemovalReason::EXPIRY);
+    SyncWithValidationInterfaceQueue();
+    tmpl = cache.GetBlockTemplate(true, BLOCK_TEMPLATE_MAX_STALE_AGE);
+    BOOST_CHECK_EQUAL(cache.GetRebuildCount(), 2U);
+    BOOST_CHECK_EQUAL(tmpl->block.vtx.size(), 2U);
+
+    // A stale template is only rebuilt once it is old enough.
+    cache.MarkStale();
+    tmpl = cache.GetBlockTemplate(true, BLOCK_TEMPLATE_MAX_STALE_AGE);
+    BOOST_CHECK_EQUAL(cache.GetRebuildCount(), 2U);
+    tmpl = cache.GetBlockTemplate(true, -1);
+    BOOST_CHECK_EQUAL(cache.GetRebuildCount(), 3U);
+
+    // So does a new tip.
+    CreateAndProcessBlock({CMutableTransaction(*parent)}, scriptPubKey);
+    SyncWithValidationInterfaceQueue();
+    tmpl = cache.GetBlockTemplate(true, BLOCK_TEMPLATE_MAX_STALE_AGE);
+    BOOST_CHECK_EQUAL(cache.GetRebuildCount(), 4U);
+    BOOST_CHECK_EQUAL(tmpl->block.vtx.size(), 1U);
+    BOOST_CHECK(tmpl->block.hashPrevBlock == chainActive.Tip()->GetBlockHash());
+
+    UnregisterValidationInterface(&cache);
+    GetMainSignals().UnregisterWithMempoolSignals(mempool);
+    mempool.clear();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
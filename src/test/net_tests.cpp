@@ -9,6 +9,7 @@
 #include <serialize.h>
 #include <streams.h>
 #include <net.h>
+#include <netmessagemaker.h>
 #include <netbase.h>
 #include <chainparams.h>
 #include <util.h>
@@ -189,4 +190,47 @@ BOOST_AUTO_TEST_CASE(cnode_simple_test)
     BOOST_CHECK(pnode2->fFeeler == false);
 }
 
+BOOST_AUTO_TEST_CASE(framed_message_in_place_receive)
+{
+    // A payload spanning several receive buffers
+    std::vector<unsigned char> payload(300 * 1000 + 123);
+    for (size_t i = 0; i < payload.size(); i++) {
+        payload[i] = i * 7;
+    }
+    CFramedNetMsgRef framed = CConnman::FrameMessage(CNetMsgMaker(PROTOCOL_VERSION).Make("test", payload));
+    BOOST_CHECK_EQUAL(framed->command, "test");
+    BOOST_CHECK_EQUAL(framed->data.size() - framed->PayloadSize(), (size_t)CMessageHeader::HEADER_SIZE);
+    const char* pch = reinterpret_cast<const char*>(framed->data.data());
+    const unsigned int nSize = framed->data.size();
+
+    // Everything copied in
+    CNetMessage copied(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION);
+    unsigned int nPos = copied.readHeader(pch, nSize);
+    while (nPos < nSize) {
+        nPos += copied.readData(pch + nPos, std::min(nSize - nPos, 0x10000U));
+    }
+    BOOST_CHECK(copied.complete());
+
+    // Header copied in, payload received in place
+    CNetMessage in_place(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION);
+    nPos = in_place.readHeader(pch, nSize);
+    BOOST_CHECK_EQUAL(nPos, (unsigned int)CMessageHeader::HEADER_SIZE);
+    while (nPos < nSize) {
+        unsigned int nBytes = 0x10000;
+        char* buffer = in_place.dataBuffer(nBytes);
+        BOOST_CHECK(nBytes == std::min(nSize - nPos, 0x10000U));
+        memcpy(buffer, pch + nPos, nBytes);
+        in_place.dataReceived(nBytes);
+        nPos += nBytes;
+    }
+    BOOST_CHECK(in_place.complete());
+
+    BOOST_CHECK_EQUAL(in_place.hdr.GetCommand(), "test");
+    BOOST_CHECK(in_place.GetMessageHash() == copied.GetMessageHash());
+    BOOST_CHECK_EQUAL(memcmp(in_place.GetMessageHash().begin(), in_place.hdr.pchChecksum, CMessageHeader::CHECKSUM_SIZE), 0);
+    std::vector<unsigned char> received;
+    in_place.vRecv >> received;
+    BOOST_CHECK(received == payload);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,92 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <netmessagemaker.h>
+#include <netmsgcache.h>
+#include <protocol.h>
+#include <test/test_bitcoin.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(netmsgcache_tests, BasicTestingSetup)
+
+static CFramedNetMsgRef MakeFramed(const std::string& command, size_t payload_size)
+{
+    std::vector<unsigned char> payload(payload_size, 0x42);
+    return CConnman::FrameMessage(CNetMsgMaker(PROTOCOL_VERSION).Make(command, payload));
+}
+
+BOOST_AUTO_TEST_CASE(netmsgcache_keys)
+{
+    NetMsgCache cache(1000 * 1000);
+    const uint256 hash = InsecureRand256();
+    CFramedNetMsgRef tx = MakeFramed(NetMsgType::TX, 100);
+    CFramedNetMsgRef block = MakeFramed(NetMsgType::BLOCK, 100);
+
+    cache.Insert(hash, 0, tx);
+    BOOST_CHECK(cache.Find(hash, NetMsgType::TX, 0) == tx);
+    BOOST_CHECK(!cache.Find(hash, NetMsgType::TX, SERIALIZE_TRANSACTION_NO_WITNESS));
+    BOOST_CHECK(!cache.Find(hash, NetMsgType::BLOCK, 0));
+    BOOST_CHECK(!cache.Find(InsecureRand256(), NetMsgType::TX, 0));
+
+    cache.Insert(hash, 0, block);
+    BOOST_CHECK(cache.Find(hash, NetMsgType::TX, 0) == tx);
+    BOOST_CHECK(cache.Find(hash, NetMsgType::BLOCK, 0) == block);
+    BOOST_CHECK_EQUAL(cache.size(), 2U);
+
+    // Replacing a message does not count it twice
+    const size_t bytes = cache.Bytes();
+    CFramedNetMsgRef tx2 = MakeFramed(NetMsgType::TX, 100);
+    cache.Insert(hash, 0, tx2);
+    BOOST_CHECK(cache.Find(hash, NetMsgType::TX, 0) == tx2);
+    BOOST_CHECK_EQUAL(cache.size(), 2U);
+    BOOST_CHECK_EQUAL(cache.Bytes(), bytes);
+
+    cache.Clear();
+    BOOST_CHECK_EQUAL(cache.size(), 0U);
+    BOOST_CHECK_EQUAL(cache.Bytes(), 0U);
+    BOOST_CHECK(!cache.Find(hash, NetMsgType::TX, 0));
+}
+
+BOOST_AUTO_TEST_CASE(netmsgcache_eviction)
+{
+    NetMsgCache cache(100 * 1000);
+    std::vector<uint256> hashes;
+    for (int i = 0; i < 20; i++) {
+        hashes.push_back(InsecureRand256());
+        cache.Insert(hashes.back(), 0, MakeFramed(NetMsgType::TX, 10 * 1000));
+        BOOST_CHECK(cache.Bytes() <= 100 * 1000);
+        // The most recently used message stays
+        BOOST_CHECK(cache.Find(hashes.front(), NetMsgType::TX, 0));
+    }
+    BOOST_CHECK(cache.size() < 10);
+    BOOST_CHECK(cache.Find(hashes.back(), NetMsgType::TX, 0));
+    BOOST_CHECK(!cache.Find(hashes[1], NetMsgType::TX, 0));
+
+    // Too large to cache at all
+    const uint256 hash = InsecureRand256();
+    cache.Insert(hash, 0, MakeFramed(NetMsgType::BLOCK, 100 * 1000));
+    BOOST_CHECK(!cache.Find(hash, NetMsgType::BLOCK, 0));
+    BOOST_CHECK(cache.Find(hashes.front(), NetMsgType::TX, 0));
+}
+
+BOOST_AUTO_TEST_CASE(netmsgcache_get)
+{
+    NetMsgCache cache(1000 * 1000);
+    const uint256 hash = InsecureRand256();
+    int made = 0;
+    auto make = [&] {
+        ++made;
+        return CNetMsgMaker(PROTOCOL_VERSION).Make(NetMsgType::TX, std::vector<unsigned char>(100));
+    };
+    CFramedNetMsgRef first = cache.Get(hash, NetMsgType::TX, 0, make);
+    CFramedNetMsgRef second = cache.Get(hash, NetMsgType::TX, 0, make);
+    BOOST_CHECK_EQUAL(made, 1);
+    BOOST_CHECK(first == second);
+    BOOST_CHECK_EQUAL(first->command, NetMsgType::TX);
+    cache.Get(hash, NetMsgType::TX, SERIALIZE_TRANSACTION_NO_WITNESS, make);
+    BOOST_CHECK_EQUAL(made, 2);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
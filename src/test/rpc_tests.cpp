@@ -5,6 +5,7 @@
 #include <rpc/server.h>
 #include <rpc/client.h>
 
+#include <chainparams.h>
 #include <core_io.h>
 #include <key_io.h>
 #include <netbase.h>
@@ -17,6 +18,8 @@
 #include <univalue.h>
 
 #include <rpc/blockchain.h>
+#include <rpc/jsonstream.h>
+#include <validation.h>
 
 UniValue CallRPC(std::string args)
 {
@@ -416,4 +419,69 @@ BOOST_AUTO_TEST_CASE(rpc_getblockstats_calculate_percentiles_by_weight)
     }
 }
 
+
+BOOST_AUTO_TEST_CASE(rpc_json_stream)
+{
+    std::string out;
+    std::vector<std::string> chunks;
+    JSONStreamWriter writer([&](const std::string& chunk) {
+        chunks.push_back(chunk);
+        out += chunk;
+    }, 16);
+
+    UniValue inner(UniValue::VOBJ);
+    inner.pushKV("a", 1);
+    inner.pushKV("b\"", "x\ny");
+    UniValue members(UniValue::VOBJ);
+    members.pushKV("c", true);
+    members.pushKV("d", NullUniValue);
+
+    writer.BeginObject();
+    writer.Members(members);
+    writer.Key("list");
+    writer.BeginArray();
+    writer.Value(inner);
+    writer.BeginArray();
+    writer.EndArray();
+    writer.Value(2.5);
+    writer.EndArray();
+    writer.Key("empty");
+    writer.BeginObject();
+    writer.EndObject();
+    writer.EndObject();
+    writer.Flush();
+
+    UniValue list(UniValue::VARR);
+    list.push_back(inner);
+    list.push_back(UniValue(UniValue::VARR));
+    list.push_back(2.5);
+    UniValue expected(UniValue::VOBJ);
+    expected.pushKV("c", true);
+    expected.pushKV("d", NullUniValue);
+    expected.pushKV("list", list);
+    expected.pushKV("empty", UniValue(UniValue::VOBJ));
+
+    BOOST_CHECK_EQUAL(out, expected.write());
+    BOOST_CHECK(chunks.size() > 1);
+    for (size_t i = 0; i + 1 < chunks.size(); ++i) {
+        BOOST_CHECK(chunks[i].size() >= 16);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(rpc_json_stream_block)
+{
+    LOCK(cs_main);
+    const CBlockIndex* pindex = chainActive.Tip();
+    CBlock block;
+    BOOST_CHECK(ReadBlockFromDisk(block, pindex, Params().GetConsensus()));
+
+    for (bool tx_details : {false, true}) {
+        std::string out;
+        JSONStreamWriter writer([&](const std::string& chunk) { out += chunk; });
+        blockToJSON(writer, block, pindex, tx_details);
+        writer.Flush();
+        BOOST_CHECK_EQUAL(out, blockToJSON(block, pindex, tx_details).write());
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
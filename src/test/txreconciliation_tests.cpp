@@ -0,0 +1,160 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <streams.h>
+#include <txreconciliation.h>
+#include <version.h>
+#include <test/test_bitcoin.h>
+
+#include <algorithm>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(txreconciliation_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(sketch_decodes_difference)
+{
+    // Decoding fails with a small probability, use the same short ids every time
+    SeedInsecureRand(true);
+    for (size_t difference : {0, 1, 2, 5, 20, 100, 1000}) {
+        TxReconSketch ours(TxReconSketch::CellsForDifference(difference));
+        TxReconSketch theirs(TxReconSketch::CellsForDifference(difference));
+        BOOST_CHECK(ours.IsValid());
+        // Short ids both sides have cancel out
+        for (int i = 0; i < 500; i++) {
+            const uint32_t short_id = InsecureRandBits(32);
+            ours.Add(short_id);
+            theirs.Add(short_id);
+        }
+        std::vector<uint32_t> only_one;
+        for (size_t i = 0; i < difference; i++) {
+            const uint32_t short_id = InsecureRandBits(32);
+            if (i % 3) {
+                ours.Add(short_id);
+            } else {
+                theirs.Add(short_id);
+            }
+            only_one.push_back(short_id);
+        }
+
+        ours.Merge(theirs);
+        std::vector<uint32_t> decoded;
+        BOOST_CHECK(ours.Decode(decoded));
+        std::sort(only_one.begin(), only_one.end());
+        std::sort(decoded.begin(), decoded.end());
+        BOOST_CHECK(decoded == only_one);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sketch_too_small)
+{
+    TxReconSketch sketch(TxReconSketch::CellsForDifference(10));
+    for (int i = 0; i < 200; i++) {
+        sketch.Add(InsecureRandBits(32));
+    }
+    std::vector<uint32_t> decoded;
+    BOOST_CHECK(!sketch.Decode(decoded));
+}
+
+BOOST_AUTO_TEST_CASE(sketch_serialization)
+{
+    SeedInsecureRand(true);
+    TxReconSketch sketch(TxReconSketch::CellsForDifference(7));
+    std::vector<uint32_t> short_ids;
+    for (int i = 0; i < 7; i++) {
+        short_ids.push_back(InsecureRandBits(32));
+        sketch.Add(short_ids.back());
+    }
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << sketch;
+    BOOST_CHECK_EQUAL(stream.size(), 1 + sketch.Cells() * 8U);
+
+    TxReconSketch received;
+    stream >> received;
+    BOOST_CHECK_EQUAL(received.Cells(), sketch.Cells());
+    std::vector<uint32_t> decoded;
+    BOOST_CHECK(received.Decode(decoded));
+    std::sort(decoded.begin(), decoded.end());
+    std::sort(short_ids.begin(), short_ids.end());
+    BOOST_CHECK(decoded == short_ids);
+
+    // Cells must split into equal parts
+    CDataStream bad(SER_NETWORK, PROTOCOL_VERSION);
+    bad << std::vector<TxReconSketchCell>(TxReconSketch::NUM_HASHES + 1);
+    bad >> received;
+    BOOST_CHECK(!received.IsValid());
+}
+
+BOOST_AUTO_TEST_CASE(reconciliation_round)
+{
+    SeedInsecureRand(true);
+    const uint64_t salt_a = InsecureRandBits(64);
+    const uint64_t salt_b = InsecureRandBits(64);
+    TxReconciliationState initiator(true, salt_a, salt_b);
+    TxReconciliationState responder(false, salt_b, salt_a);
+
+    const uint256 txid = InsecureRand256();
+    BOOST_CHECK_EQUAL(initiator.ShortId(txid), responder.ShortId(txid));
+
+    std::vector<uint256> common, only_initiator, only_responder;
+    for (int i = 0; i < 50; i++) common.push_back(InsecureRand256());
+    for (int i = 0; i < 4; i++) only_initiator.push_back(InsecureRand256());
+    for (int i = 0; i < 3; i++) only_responder.push_back(InsecureRand256());
+    initiator.m_local_set.insert(common.begin(), common.end());
+    initiator.m_local_set.insert(only_initiator.begin(), only_initiator.end());
+    responder.m_local_set.insert(common.begin(), common.end());
+    responder.m_local_set.insert(only_responder.begin(), only_responder.end());
+
+    // reqrecon
+    initiator.StartRound();
+    BOOST_CHECK(initiator.m_local_set.empty());
+    const size_t initiator_size = initiator.m_round_set.size();
+
+    // sketch
+    responder.StartRound();
+    const size_t difference = EstimateReconDifference(responder.m_round_set.size(), initiator_size, initiator.m_q);
+    TxReconSketch sketch = responder.SketchRound(TxReconSketch::CellsForDifference(difference));
+
+    // reconcildiff
+    TxReconSketch decoded = initiator.SketchRound(sketch.Cells());
+    decoded.Merge(sketch);
+    std::vector<uint32_t> difference_ids;
+    BOOST_CHECK(decoded.Decode(difference_ids));
+    BOOST_CHECK_EQUAL(difference_ids.size(), only_initiator.size() + only_responder.size());
+    std::vector<uint256> initiator_announces = initiator.EndRound(difference_ids);
+    BOOST_CHECK(!initiator.m_round_active);
+    // What is left are the short ids only the responder has
+    BOOST_CHECK_EQUAL(difference_ids.size(), only_responder.size());
+    BOOST_CHECK_EQUAL(EstimateReconQ(7, initiator_size, initiator_size - initiator_announces.size() + difference_ids.size()), 6.0 / 53);
+
+    // The missing transactions are announced both ways
+    std::vector<uint256> responder_announces = responder.EndRound(difference_ids);
+    BOOST_CHECK(difference_ids.empty());
+    BOOST_CHECK(!responder.m_round_active);
+    BOOST_CHECK(responder.m_round_set.empty());
+    std::sort(initiator_announces.begin(), initiator_announces.end());
+    std::sort(only_initiator.begin(), only_initiator.end());
+    std::sort(responder_announces.begin(), responder_announces.end());
+    std::sort(only_responder.begin(), only_responder.end());
+    BOOST_CHECK(initiator_announces == only_initiator);
+    BOOST_CHECK(responder_announces == only_responder);
+
+    // A failed round announces everything in it
+    responder.m_local_set.insert(common.begin(), common.end());
+    responder.StartRound();
+    BOOST_CHECK_EQUAL(responder.EndRound().size(), common.size());
+}
+
+BOOST_AUTO_TEST_CASE(difference_estimate)
+{
+    BOOST_CHECK_EQUAL(EstimateReconDifference(0, 0, DEFAULT_RECON_Q), 1U);
+    BOOST_CHECK_EQUAL(EstimateReconDifference(10, 30, 0.5), 26U);
+    BOOST_CHECK_EQUAL(EstimateReconDifference(30, 10, 0.5), 26U);
+    BOOST_CHECK_EQUAL(EstimateReconQ(25, 10, 30), 0.5);
+    BOOST_CHECK_EQUAL(EstimateReconQ(20, 10, 30), 0);
+    BOOST_CHECK_EQUAL(EstimateReconQ(5, 0, 5), 0);
+    BOOST_CHECK_EQUAL(EstimateReconQ(1000, 10, 10), 2);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -8,7 +8,10 @@
 #include <consensus/validation.h>
 #include <primitives/transaction.h>
 #include <script/script.h>
+#include <script/sign.h>
 #include <test/test_bitcoin.h>
+#include <util.h>
+#include <validationinterface.h>
 
 #include <boost/test/unit_test.hpp>
 
@@ -58,4 +61,178 @@ BOOST_FIXTURE_TEST_CASE(tx_mempool_reject_coinbase, TestChain100Setup)
     BOOST_CHECK_EQUAL(nDoS, 100);
 }
 
+/**
+ * Ensure that a batch is accepted in order, with one result per transaction.
+ */
+BOOST_FIXTURE_TEST_CASE(tx_mempool_accept_batch, TestChain100Setup)
+{
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    auto spend = [&](const CTransactionRef& prev, uint32_t n, const std::vector<CAmount>& values, bool sign) {
+        CMutableTransaction tx;
+        tx.nVersion = 1;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(prev->GetHash(), n);
+        for (CAmount value : values) {
+            tx.vout.emplace_back(value, scriptPubKey);
+        }
+        std::vector<unsigned char> vchSig;
+        uint256 hash = SignatureHash(scriptPubKey, tx, 0, SIGHASH_ALL, 0, SigVersion::BASE);
+        BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        if (!sign) vchSig[10] ^= 1;
+        tx.vin[0].scriptSig << vchSig;
+        return MakeTransactionRef(std::move(tx));
+    };
+
+    // Only the first coinbase transaction is mature.
+    CTransactionRef parent = spend(m_coinbase_txns[0], 0, {20 * COIN, 20 * COIN}, true);
+    CTransactionRef child = spend(parent, 0, {19 * COIN}, true);
+    CTransactionRef double_spend = spend(m_coinbase_txns[0], 0, {30 * COIN}, true);
+    CTransactionRef bad_signature = spend(parent, 1, {19 * COIN}, false);
+    CTransactionRef orphan = spend(double_spend, 0, {29 * COIN}, true);
+    CTransactionRef other = spend(parent, 1, {18 * COIN}, true);
+
+    LOCK(cs_main);
+    unsigned int initialPoolSize = mempool.size();
+    std::vector<MempoolAcceptResult> results = AcceptToMemoryPoolBatch(mempool,
+        {parent, child, double_spend, bad_signature, orphan, other, parent}, false /* bypass_limits */, 0 /* nAbsurdFee */);
+    BOOST_REQUIRE_EQUAL(results.size(), 7U);
+
+    BOOST_CHECK(results[0].accepted);
+    BOOST_CHECK(results[1].accepted);
+    BOOST_CHECK(!results[2].accepted);
+    BOOST_CHECK_EQUAL(results[2].state.GetRejectReason(), "txn-mempool-conflict");
+    BOOST_CHECK(!results[3].accepted);
+    BOOST_CHECK(results[3].state.IsInvalid());
+    BOOST_CHECK(!results[4].accepted);
+    BOOST_CHECK(results[4].missing_inputs);
+    BOOST_CHECK(results[5].accepted);
+    BOOST_CHECK(!results[6].accepted);
+    BOOST_CHECK_EQUAL(results[6].state.GetRejectReason(), "txn-already-in-mempool");
+
+    BOOST_CHECK_EQUAL(mempool.size(), initialPoolSize + 3);
+    BOOST_CHECK(mempool.exists(parent->GetHash()));
+    BOOST_CHECK(mempool.exists(child->GetHash()));
+    BOOST_CHECK(mempool.exists(other->GetHash()));
+
+    BOOST_CHECK(AcceptToMemoryPoolBatch(mempool, {}, false /* bypass_limits */, 0 /* nAbsurdFee */).empty());
+}
+
+/**
+ * Ensure that transactions whose signatures are verified on the script check
+ * threads are accepted or rejected like any other.
+ */
+BOOST_FIXTURE_TEST_CASE(tx_mempool_accept_parallel_checks, TestChain100Setup)
+{
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    auto sign = [&](CMutableTransaction& tx, unsigned int nIn) {
+        std::vector<unsigned char> vchSig;
+        uint256 hash = SignatureHash(scriptPubKey, tx, nIn, SIGHASH_ALL, 0, SigVersion::BASE);
+        BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        tx.vin[nIn].scriptSig = CScript() << vchSig;
+    };
+
+    // Enough P2PK outputs for a transaction above the parallel check threshold.
+    const unsigned int nInputs = 20;
+    CMutableTransaction split;
+    split.nVersion = 1;
+    split.vin.emplace_back(COutPoint(m_coinbase_txns[0]->GetHash(), 0));
+    split.vout.assign(nInputs, CTxOut(2 * COIN, scriptPubKey));
+    sign(split, 0);
+    CBlock block = CreateAndProcessBlock({split}, scriptPubKey);
+    BOOST_REQUIRE(chainActive.Tip()->GetBlockHash() == block.GetHash());
+
+    CMutableTransaction spend;
+    spend.nVersion = 1;
+    for (unsigned int n = 0; n < nInputs; n++) {
+        spend.vin.emplace_back(COutPoint(split.GetHash(), n));
+    }
+    spend.vout.emplace_back(nInputs * 2 * COIN - 10000, scriptPubKey);
+    for (unsigned int n = 0; n < nInputs; n++) {
+        sign(spend, n);
+    }
+
+    LOCK(cs_main);
+    // One bad signature among many is found.
+    CMutableTransaction bad_signature(spend);
+    std::vector<unsigned char> vchSig(bad_signature.vin[13].scriptSig.begin() + 1, bad_signature.vin[13].scriptSig.end());
+    vchSig[10] ^= 1;
+    bad_signature.vin[13].scriptSig = CScript() << vchSig;
+    CValidationState state;
+    BOOST_CHECK(!AcceptToMemoryPool(mempool, state, MakeTransactionRef(bad_signature), nullptr /* pfMissingInputs */,
+                                    nullptr /* plTxnReplaced */, false /* bypass_limits */, 0 /* nAbsurdFee */));
+    BOOST_CHECK_EQUAL(state.GetRejectReason().find("mandatory-script-verify-flag-failed"), 0U);
+    BOOST_CHECK(!mempool.exists(bad_signature.GetHash()));
+
+    CValidationState state2;
+    BOOST_CHECK(AcceptToMemoryPool(mempool, state2, MakeTransactionRef(spend), nullptr /* pfMissingInputs */,
+                                   nullptr /* plTxnReplaced */, false /* bypass_limits */, 0 /* nAbsurdFee */));
+    BOOST_CHECK(mempool.exists(spend.GetHash()));
+}
+
+/**
+ * Ensure that transactions entering the mempool are journaled, and that the
+ * journal is replayed on load and folded into the next dump.
+ */
+BOOST_FIXTURE_TEST_CASE(tx_mempool_journal, TestChain100Setup)
+{
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    auto spend = [&](const CTransactionRef& prev, CAmount value) {
+        CMutableTransaction tx;
+        tx.nVersion = 1;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(prev->GetHash(), 0);
+        tx.vout.emplace_back(value, scriptPubKey);
+        std::vector<unsigned char> vchSig;
+        uint256 hash = SignatureHash(scriptPubKey, tx, 0, SIGHASH_ALL, 0, SigVersion::BASE);
+        BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        tx.vin[0].scriptSig << vchSig;
+        return MakeTransactionRef(std::move(tx));
+    };
+    CTransactionRef parent = spend(m_coinbase_txns[0], 49 * COIN);
+    CTransactionRef child = spend(parent, 48 * COIN);
+    const fs::path journal_path = GetDataDir() / "mempool.journal";
+
+    mempool.clear();
+    StartMempoolJournal();
+    BOOST_CHECK(DumpMempool());
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_CHECK(AcceptToMemoryPool(mempool, state, parent, nullptr /* pfMissingInputs */,
+                                       nullptr /* plTxnReplaced */, false /* bypass_limits */, 0 /* nAbsurdFee */));
+        BOOST_CHECK(AcceptToMemoryPool(mempool, state, child, nullptr /* pfMissingInputs */,
+                                       nullptr /* plTxnReplaced */, false /* bypass_limits */, 0 /* nAbsurdFee */));
+    }
+    const int64_t parent_time = mempool.info(parent->GetHash()).nTime;
+    SyncWithValidationInterfaceQueue();
+    StopMempoolJournal();
+
+    // A record cut short by an unclean shutdown is ignored.
+    FILE* file = fsbridge::fopen(journal_path, "ab");
+    BOOST_REQUIRE(file);
+    fputs("torn", file);
+    fclose(file);
+
+    // The dump holds neither transaction, the journal holds both.
+    mempool.clear();
+    BOOST_CHECK(LoadMempool());
+    BOOST_CHECK_EQUAL(mempool.size(), 2U);
+    BOOST_CHECK(mempool.exists(parent->GetHash()));
+    BOOST_CHECK(mempool.exists(child->GetHash()));
+    BOOST_CHECK_EQUAL(mempool.info(parent->GetHash()).nTime, parent_time);
+
+    // Dumping folds the journal into the dump.
+    BOOST_CHECK(DumpMempool());
+    BOOST_CHECK(!fs::exists(journal_path));
+    BOOST_CHECK(!fs::exists(GetDataDir() / "mempool.journal.old"));
+    mempool.clear();
+    BOOST_CHECK(LoadMempool());
+    BOOST_CHECK_EQUAL(mempool.size(), 2U);
+    BOOST_CHECK(mempool.exists(child->GetHash()));
+    mempool.clear();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -16,6 +16,7 @@
 #include <core_io.h>
 #include <keystore.h>
 #include <policy/policy.h>
+#include <script/sigcache.h>
 
 #include <boost/test/unit_test.hpp>
 
@@ -368,4 +369,36 @@ BOOST_FIXTURE_TEST_CASE(checkinputs_test, TestChain100Setup)
     }
 }
 
+BOOST_FIXTURE_TEST_CASE(sigcache_persist, TestingSetup)
+{
+    const uint256 nonce = InsecureRand256();
+    const std::vector<uint256> entries{InsecureRand256(), InsecureRand256()};
+    LoadSignatureCache(nonce, entries);
+    BOOST_CHECK(DumpSignatureCaches());
+
+    // Restoring the snapshot brings back the nonce and the entries.
+    LoadSignatureCache(InsecureRand256(), {});
+    BOOST_CHECK(LoadSignatureCaches());
+    uint256 loaded_nonce;
+    std::vector<uint256> loaded;
+    DumpSignatureCache(loaded_nonce, loaded);
+    BOOST_CHECK(loaded_nonce == nonce);
+    for (const uint256& entry : entries) {
+        BOOST_CHECK(std::find(loaded.begin(), loaded.end(), entry) != loaded.end());
+    }
+
+    // A corrupted snapshot is not used.
+    fs::path path = GetDataDir() / "sigcache.dat";
+    FILE* file = fsbridge::fopen(path, "r+b");
+    BOOST_REQUIRE(file);
+    BOOST_REQUIRE_EQUAL(fseek(file, 20, SEEK_SET), 0);
+    BOOST_REQUIRE_EQUAL(fputc(0xff ^ nonce.begin()[8], file), 0xff ^ nonce.begin()[8]);
+    fclose(file);
+    const uint256 other_nonce = InsecureRand256();
+    LoadSignatureCache(other_nonce, {});
+    BOOST_CHECK(!LoadSignatureCaches());
+    DumpSignatureCache(loaded_nonce, loaded);
+    BOOST_CHECK(loaded_nonce == other_nonce);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
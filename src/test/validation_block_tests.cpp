@@ -4,6 +4,7 @@
 
 #include <boost/test/unit_test.hpp>
 
+#include <arith_uint256.h>
 #include <chainparams.h>
 #include <consensus/merkle.h>
 #include <consensus/validation.h>
@@ -181,4 +182,48 @@ BOOST_AUTO_TEST_CASE(processnewblock_signals_ordering)
     BOOST_CHECK_EQUAL(sub.m_expected_tip, chainActive.Tip()->GetBlockHash());
 }
 
+BOOST_AUTO_TEST_CASE(checkblock_parallel)
+{
+    // Enough transactions for the merkle tree and the transaction checks to
+    // be spread over the script check threads.
+    CBlock block = *Block(Params().GenesisBlock().GetHash());
+    for (int i = 0; i < 1000; i++) {
+        CMutableTransaction tx;
+        tx.vin.emplace_back(COutPoint(InsecureRand256(), 0));
+        tx.vout.emplace_back(1, CScript() << OP_TRUE);
+        block.vtx.push_back(MakeTransactionRef(std::move(tx)));
+    }
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+    CValidationState state;
+    BOOST_CHECK(CheckBlock(block, state, Params().GetConsensus(), false, true));
+
+    // A different merkle root is detected.
+    block.fChecked = false;
+    block.hashMerkleRoot = ArithToUint256(UintToArith256(block.hashMerkleRoot) + 1);
+    BOOST_CHECK(!CheckBlock(block, state, Params().GetConsensus(), false, true));
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "bad-txnmrklroot");
+
+    // So is a mutated tree: a repeated pair of transactions at the end of an
+    // even number of transactions leaves the merkle root unchanged.
+    CBlock mutated = block;
+    mutated.vtx.push_back(block.vtx.back());
+    mutated.vtx.push_back(block.vtx.back());
+    mutated.hashMerkleRoot = BlockMerkleRoot(mutated);
+    state = CValidationState();
+    BOOST_CHECK(!CheckBlock(mutated, state, Params().GetConsensus(), false, true));
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "bad-txns-duplicate");
+
+    // The first invalid transaction in block order is reported.
+    for (size_t pos : {700, 300}) {
+        CMutableTransaction tx(*block.vtx[pos]);
+        tx.vout[0].nValue = -1;
+        block.vtx[pos] = MakeTransactionRef(std::move(tx));
+    }
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+    state = CValidationState();
+    BOOST_CHECK(!CheckBlock(block, state, Params().GetConsensus(), false, true));
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "bad-txns-vout-negative");
+    BOOST_CHECK(state.GetDebugMessage().find(block.vtx[300]->GetHash().ToString()) != std::string::npos);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
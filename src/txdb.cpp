@@ -57,21 +57,46 @@ CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(Get
 {
 }
 
+CCoinsViewDB::~CCoinsViewDB()
+{
+    WaitForWrite();
+}
+
+bool CCoinsViewDB::GetPendingCoin(const COutPoint &outpoint, Coin &coin) const {
+    LOCK(cs_pending);
+    if (!m_pending_coins) return false;
+    CCoinsMap::const_iterator it = m_pending_coins->find(outpoint);
+    if (it == m_pending_coins->end() || !(it->second.flags & CCoinsCacheEntry::DIRTY)) return false;
+    coin = it->second.coin;
+    return true;
+}
+
 bool CCoinsViewDB::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    if (GetPendingCoin(outpoint, coin)) return !coin.IsSpent();
     return db.Read(CoinEntry(&outpoint), coin);
 }
 
 bool CCoinsViewDB::HaveCoin(const COutPoint &outpoint) const {
+    Coin coin;
+    if (GetPendingCoin(outpoint, coin)) return !coin.IsSpent();
     return db.Exists(CoinEntry(&outpoint));
 }
 
-uint256 CCoinsViewDB::GetBestBlock() const {
+uint256 CCoinsViewDB::ReadBestBlock() const {
     uint256 hashBestChain;
     if (!db.Read(DB_BEST_BLOCK, hashBestChain))
         return uint256();
     return hashBestChain;
 }
 
+uint256 CCoinsViewDB::GetBestBlock() const {
+    {
+        LOCK(cs_pending);
+        if (m_pending_coins) return m_pending_block;
+    }
+    return ReadBestBlock();
+}
+
 std::vector<uint256> CCoinsViewDB::GetHeadBlocks() const {
     std::vector<uint256> vhashHeadBlocks;
     if (!db.Read(DB_HEAD_BLOCKS, vhashHeadBlocks)) {
@@ -80,7 +105,77 @@ std::vector<uint256> CCoinsViewDB::GetHeadBlocks() const {
     return vhashHeadBlocks;
 }
 
-bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase) {
+    LOCK(cs_writer);
+    if (!WaitForWriteLocked()) return false;
+    return WriteCoins(mapCoins, hashBlock, erase);
+}
+
+bool CCoinsViewDB::BatchWriteAsync(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    assert(!hashBlock.IsNull());
+
+    LOCK(cs_writer);
+    if (!WaitForWriteLocked()) return false;
+    {
+        LOCK(cs_pending);
+        m_pending_coins.reset(new CCoinsMap(std::move(mapCoins)));
+        m_pending_block = hashBlock;
+    }
+    m_writer = std::thread([this] {
+        RenameThread("bitcoin-coinsflush");
+        bool fOk = false;
+        try {
+            // The pending coins are not modified until the write completes,
+            // so they can be read concurrently without holding cs_pending.
+            fOk = WriteCoins(*m_pending_coins, m_pending_block, false);
+        } catch (const std::exception& e) {
+            LogPrintf("%s: %s\n", __func__, e.what());
+        }
+        if (fOk) {
+            ReleasePendingCoins();
+        } else {
+            // Keep serving the coins from memory, as the database lacks them,
+            // until the write is retried.
+            m_writer_ok = false;
+        }
+    });
+    return true;
+}
+
+void CCoinsViewDB::ReleasePendingCoins() {
+    std::unique_ptr<CCoinsMap> written;
+    {
+        LOCK(cs_pending);
+        written.swap(m_pending_coins);
+        m_pending_block.SetNull();
+    }
+    // Release the (possibly large) map outside of cs_pending.
+    written.reset();
+}
+
+bool CCoinsViewDB::WaitForWrite() {
+    LOCK(cs_writer);
+    return WaitForWriteLocked();
+}
+
+bool CCoinsViewDB::WaitForWriteLocked() {
+    if (m_writer.joinable()) m_writer.join();
+    if (!m_writer_ok) {
+        // Retry the failed write. Its coins stay pending until it succeeds.
+        bool fOk = false;
+        try {
+            fOk = WriteCoins(*m_pending_coins, m_pending_block, false);
+        } catch (const std::exception& e) {
+            LogPrintf("%s: %s\n", __func__, e.what());
+        }
+        if (!fOk) return false;
+        ReleasePendingCoins();
+        m_writer_ok = true;
+    }
+    return true;
+}
+
+bool CCoinsViewDB::WriteCoins(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase) {
     CDBBatch batch(db);
     size_t count = 0;
     size_t changed = 0;
@@ -88,7 +183,7 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     int crash_simulate = gArgs.GetArg("-dbcrashratio", 0);
     assert(!hashBlock.IsNull());
 
-    uint256 old_tip = GetBestBlock();
+    uint256 old_tip = ReadBestBlock();
     if (old_tip.IsNull()) {
         // We may be in the middle of replaying.
         std::vector<uint256> old_heads = GetHeadBlocks();
@@ -115,8 +210,12 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
+        if (erase) {
+            CCoinsMap::iterator itOld = it++;
+            mapCoins.erase(itOld);
+        } else {
+            ++it;
+        }
         if (batch.SizeEstimate() > batch_size) {
             LogPrint(BCLog::COINDB, "Writing partial batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
             db.WriteBatch(batch);
@@ -170,6 +269,8 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
 
 CCoinsViewCursor *CCoinsViewDB::Cursor() const
 {
+    // Iterate over the database only once it reflects the latest write.
+    const_cast<CCoinsViewDB*>(this)->WaitForWrite();
     CCoinsViewDBCursor *i = new CCoinsViewDBCursor(const_cast<CDBWrapper&>(db).NewIterator(), GetBestBlock());
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
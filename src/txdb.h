@@ -10,10 +10,12 @@
 #include <dbwrapper.h>
 #include <chain.h>
 #include <primitives/block.h>
+#include <sync.h>
 
 #include <map>
 #include <memory>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -40,24 +42,59 @@ static const int64_t nMaxTxIndexCache = 1024;
 //! Max memory allocated to coin DB specific cache (MiB)
 static const int64_t nMaxCoinsDBCache = 8;
 
-/** CCoinsView backed by the coin database (chainstate/) */
+/** CCoinsView backed by the coin database (chainstate/)
+ *
+ * Writes passed to BatchWriteAsync() are performed by a background thread.
+ * Until such a write succeeds, its coins are served from memory, so reads
+ * always reflect the latest write. Only one write is in progress at a time:
+ * any further write first waits for the previous one to complete.
+ */
 class CCoinsViewDB final : public CCoinsView
 {
 protected:
     CDBWrapper db;
 public:
     explicit CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    ~CCoinsViewDB();
 
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
     bool HaveCoin(const COutPoint &outpoint) const override;
+    bool HasConcurrentGetCoin() const override { return true; }
     uint256 GetBestBlock() const override;
     std::vector<uint256> GetHeadBlocks() const override;
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase) override;
+    bool BatchWriteAsync(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
     CCoinsViewCursor *Cursor() const override;
 
+    //! Wait for the background write, if any, to complete, and retry it if
+    //! it failed. Returns false if the write still fails.
+    bool WaitForWrite();
+
     //! Attempt to update from an older database format. Returns whether an error occurred.
     bool Upgrade();
     size_t EstimateSize() const override;
+
+private:
+    bool WriteCoins(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase);
+    uint256 ReadBestBlock() const;
+    //! Look up an outpoint among the coins of the write in progress. Returns
+    //! false if the write does not touch it; coin may be spent otherwise.
+    bool GetPendingCoin(const COutPoint &outpoint, Coin &coin) const;
+    //! Drop the coins of a write once it has completed.
+    void ReleasePendingCoins();
+    bool WaitForWriteLocked() EXCLUSIVE_LOCKS_REQUIRED(cs_writer);
+
+    //! Coins and best block of the write in progress, readable while the writer thread runs.
+    mutable Mutex cs_pending;
+    std::unique_ptr<CCoinsMap> m_pending_coins;
+    uint256 m_pending_block;
+
+    Mutex cs_writer;
+    std::thread m_writer;
+    //! Cleared by the writer thread when a background write fails, in which
+    //! case its coins stay pending until a retry succeeds. Only read after
+    //! joining it.
+    bool m_writer_ok = true;
 };
 
 /** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
@@ -11,6 +11,7 @@
 #include <validation.h>
 #include <policy/policy.h>
 #include <policy/fees.h>
+#include <policy/rbf.h>
 #include <reverse_iterator.h>
 #include <streams.h>
 #include <timedata.h>
@@ -18,6 +19,8 @@
 #include <utilmoneystr.h>
 #include <utiltime.h>
 
+#include <boost/multi_index/member.hpp>
+
 CTxMemPoolEntry::CTxMemPoolEntry(const CTransactionRef& _tx, const CAmount& _nFee,
                                  int64_t _nTime, unsigned int _entryHeight,
                                  bool _spendsCoinbase, int64_t _sigOpsCost, LockPoints lp)
@@ -56,16 +59,16 @@ size_t CTxMemPoolEntry::GetTxSize() const
 // Update the given tx for any in-mempool descendants.
 // Assumes that setMemPoolChildren is correct for the given tx and all
 // descendants.
-void CTxMemPool::UpdateForDescendants(txiter updateIt, cacheMap &cachedDescendants, const std::set<uint256> &setExclude)
+void CTxMemPool::UpdateForDescendants(txiter updateIt, cacheMap &cachedDescendants, const std::set<uint256> &setExclude, stateDeltaMap &ancestorDeltas)
 {
-    setEntries stageEntries, setAllDescendants;
-    stageEntries = GetMemPoolChildren(updateIt);
+    const setLinkEntries &setMemPoolChildren = GetMemPoolChildren(updateIt);
+    setEntries stageEntries(setMemPoolChildren.begin(), setMemPoolChildren.end()), setAllDescendants;
 
     while (!stageEntries.empty()) {
         const txiter cit = *stageEntries.begin();
         setAllDescendants.insert(cit);
         stageEntries.erase(cit);
-        const setEntries &setChildren = GetMemPoolChildren(cit);
+        const setLinkEntries &setChildren = GetMemPoolChildren(cit);
         for (txiter childEntry : setChildren) {
             cacheMap::iterator cacheIt = cachedDescendants.find(childEntry);
             if (cacheIt != cachedDescendants.end()) {
@@ -92,7 +95,11 @@ void CTxMemPool::UpdateForDescendants(txiter updateIt, cacheMap &cachedDescendan
             modifyCount++;
             cachedDescendants[updateIt].insert(cit);
             // Update ancestor state for each descendant
-            mapTx.modify(cit, update_ancestor_state(updateIt->GetTxSize(), updateIt->GetModifiedFee(), 1, updateIt->GetSigOpCost()));
+            StateDelta& delta = ancestorDeltas[cit];
+            delta.size += updateIt->GetTxSize();
+            delta.fee += updateIt->GetModifiedFee();
+            delta.count += 1;
+            delta.sigOpCost += updateIt->GetSigOpCost();
         }
     }
     mapTx.modify(updateIt, update_descendant_state(modifySize, modifyFee, modifyCount));
@@ -110,6 +117,9 @@ void CTxMemPool::UpdateTransactionsFromBlock(const std::vector<uint256> &vHashes
     // in-vHashesToUpdate transactions, so that we don't have to recalculate
     // descendants when we come across a previously seen entry.
     cacheMap mapMemPoolDescendantsToUpdate;
+    // A descendant of several of the transactions gets their changes to its
+    // ancestor state applied together at the end.
+    stateDeltaMap mapAncestorDeltas;
 
     // Use a set for lookups into vHashesToUpdate (these entries are already
     // accounted for in the state of their ancestors)
@@ -142,8 +152,14 @@ void CTxMemPool::UpdateTransactionsFromBlock(const std::vector<uint256> &vHashes
                 UpdateParent(childIter, it, true);
             }
         }
-        UpdateForDescendants(it, mapMemPoolDescendantsToUpdate, setAlreadyIncluded);
+        UpdateForDescendants(it, mapMemPoolDescendantsToUpdate, setAlreadyIncluded, mapAncestorDeltas);
+    }
+    for (const auto& delta : mapAncestorDeltas) {
+        mapTx.modify(delta.first, update_ancestor_state(delta.second.size, delta.second.fee, delta.second.count, delta.second.sigOpCost));
     }
+    // Descendant and ancestor state changed without entries being added or
+    // removed.
+    ++nTransactionsUpdated;
 }
 
 bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntries &setAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string &errString, bool fSearchForParents /* = true */) const
@@ -169,7 +185,8 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
         // If we're not searching for parents, we require this to be an
         // entry in the mempool already.
         txiter it = mapTx.iterator_to(entry);
-        parentHashes = GetMemPoolParents(it);
+        const setLinkEntries &setMemPoolParents = GetMemPoolParents(it);
+        parentHashes.insert(setMemPoolParents.begin(), setMemPoolParents.end());
     }
 
     size_t totalSizeWithAncestors = entry.GetTxSize();
@@ -192,7 +209,7 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
             return false;
         }
 
-        const setEntries & setMemPoolParents = GetMemPoolParents(stageit);
+        const setLinkEntries & setMemPoolParents = GetMemPoolParents(stageit);
         for (txiter phash : setMemPoolParents) {
             // If this is a new ancestor, add it.
             if (setAncestors.count(phash) == 0) {
@@ -210,7 +227,8 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
 
 void CTxMemPool::UpdateAncestorsOf(bool add, txiter it, setEntries &setAncestors)
 {
-    setEntries parentIters = GetMemPoolParents(it);
+    const setLinkEntries &setMemPoolParents = GetMemPoolParents(it);
+    setEntries parentIters(setMemPoolParents.begin(), setMemPoolParents.end());
     // add or remove this tx as a child of each parent
     for (txiter piter : parentIters) {
         UpdateChild(piter, it, add);
@@ -239,7 +257,7 @@ void CTxMemPool::UpdateEntryForAncestors(txiter it, const setEntries &setAncesto
 
 void CTxMemPool::UpdateChildrenForRemoval(txiter it)
 {
-    const setEntries &setMemPoolChildren = GetMemPoolChildren(it);
+    const setLinkEntries &setMemPoolChildren = GetMemPoolChildren(it);
     for (txiter updateIt : setMemPoolChildren) {
         UpdateParent(updateIt, it, false);
     }
@@ -257,18 +275,29 @@ void CTxMemPool::UpdateForRemoveFromMempool(const setEntries &entriesToRemove, b
         // Here we only update statistics and not data in mapLinks (which
         // we need to preserve until we're finished with all operations that
         // need to traverse the mempool).
+        // Descendants that stay in the mempool get the changes to their
+        // ancestor state summed up first, so that each of them is modified
+        // in mapTx once, however many of its ancestors are removed.
+        stateDeltaMap descendantDeltas;
         for (txiter removeIt : entriesToRemove) {
             setEntries setDescendants;
             CalculateDescendants(removeIt, setDescendants);
-            setDescendants.erase(removeIt); // don't update state for self
-            int64_t modifySize = -((int64_t)removeIt->GetTxSize());
-            CAmount modifyFee = -removeIt->GetModifiedFee();
-            int modifySigOps = -removeIt->GetSigOpCost();
             for (txiter dit : setDescendants) {
-                mapTx.modify(dit, update_ancestor_state(modifySize, modifyFee, -1, modifySigOps));
+                if (entriesToRemove.count(dit)) continue;
+                StateDelta& delta = descendantDeltas[dit];
+                delta.size -= removeIt->GetTxSize();
+                delta.fee -= removeIt->GetModifiedFee();
+                delta.count -= 1;
+                delta.sigOpCost -= removeIt->GetSigOpCost();
             }
         }
+        for (const auto& delta : descendantDeltas) {
+            mapTx.modify(delta.first, update_ancestor_state(delta.second.size, delta.second.fee, delta.second.count, delta.second.sigOpCost));
+        }
     }
+    // Likewise for the ancestors that stay in the mempool, and their
+    // descendant state.
+    stateDeltaMap ancestorDeltas;
     for (txiter removeIt : entriesToRemove) {
         setEntries setAncestors;
         const CTxMemPoolEntry &entry = *removeIt;
@@ -291,9 +320,23 @@ void CTxMemPool::UpdateForRemoveFromMempool(const setEntries &entriesToRemove, b
         // and it's important that we use the mapLinks[] notion of ancestor
         // transactions as the set of things to update for removal.
         CalculateMemPoolAncestors(entry, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
-        // Note that UpdateAncestorsOf severs the child links that point to
-        // removeIt in the entries for the parents of removeIt.
-        UpdateAncestorsOf(false, removeIt, setAncestors);
+        // Sever the child links that point to removeIt in the entries for the
+        // parents of removeIt.
+        const setLinkEntries &setMemPoolParents = GetMemPoolParents(removeIt);
+        setEntries parentIters(setMemPoolParents.begin(), setMemPoolParents.end());
+        for (txiter piter : parentIters) {
+            UpdateChild(piter, removeIt, false);
+        }
+        for (txiter ancestorIt : setAncestors) {
+            if (entriesToRemove.count(ancestorIt)) continue;
+            StateDelta& delta = ancestorDeltas[ancestorIt];
+            delta.size -= removeIt->GetTxSize();
+            delta.fee -= removeIt->GetModifiedFee();
+            delta.count -= 1;
+        }
+    }
+    for (const auto& delta : ancestorDeltas) {
+        mapTx.modify(delta.first, update_descendant_state(delta.second.size, delta.second.fee, delta.second.count));
     }
     // After updating all the ancestor sizes, we can now sever the link between each
     // transaction being removed and any mempool children (ie, update setMemPoolParents
@@ -324,8 +367,12 @@ void CTxMemPoolEntry::UpdateAncestorState(int64_t modifySize, CAmount modifyFee,
 }
 
 CTxMemPool::CTxMemPool(CBlockPolicyEstimator* estimator) :
-    nTransactionsUpdated(0), minerPolicyEstimator(estimator)
+    nTransactionsUpdated(0), minerPolicyEstimator(estimator),
+    mapTx(indexed_transaction_set::ctor_args_list(), indexed_transaction_set::allocator_type(&m_pool_resource)),
+    mapLinks(txlinksMap::key_compare(), txlinksMap::allocator_type(&m_pool_resource)),
+    mapNextTx(nextTxMap::allocator_type(&m_pool_resource))
 {
+    m_pool_base_usage = m_pool_resource.DynamicMemoryUsage();
     _clear(); //lock free clear
 
     // Sanity checks off by default for performance, because otherwise
@@ -359,7 +406,7 @@ void CTxMemPool::addUnchecked(const CTxMemPoolEntry &entry, setEntries &setAnces
     // Used by AcceptToMemoryPool(), which DOES do
     // all the appropriate checks.
     indexed_transaction_set::iterator newit = mapTx.insert(entry).first;
-    mapLinks.insert(make_pair(newit, TxLinks()));
+    mapLinks.insert(std::make_pair(newit, TxLinks(&m_pool_resource)));
 
     // Update transaction for any feeDelta created by PrioritiseTransaction
     // TODO: refactor so that the fee delta is calculated before inserting
@@ -421,7 +468,6 @@ void CTxMemPool::removeUnchecked(txiter it, MemPoolRemovalReason reason)
 
     totalTxSize -= it->GetTxSize();
     cachedInnerUsage -= it->DynamicMemoryUsage();
-    cachedInnerUsage -= memusage::DynamicUsage(mapLinks[it].parents) + memusage::DynamicUsage(mapLinks[it].children);
     mapLinks.erase(it);
     mapTx.erase(it);
     nTransactionsUpdated++;
@@ -448,7 +494,7 @@ void CTxMemPool::CalculateDescendants(txiter entryit, setEntries& setDescendants
         setDescendants.insert(it);
         stage.erase(it);
 
-        const setEntries &setChildren = GetMemPoolChildren(it);
+        const setLinkEntries &setChildren = GetMemPoolChildren(it);
         for (txiter childiter : setChildren) {
             if (!setDescendants.count(childiter)) {
                 stage.insert(childiter);
@@ -560,14 +606,20 @@ void CTxMemPool::removeForBlock(const std::vector<CTransactionRef>& vtx, unsigne
     }
     // Before the txs in the new block have been removed from the mempool, update policy estimates
     if (minerPolicyEstimator) {minerPolicyEstimator->processBlock(nBlockHeight, entries);}
+    // Remove all of the block's transactions together, so that the state of
+    // their in-mempool relatives is updated once rather than once per
+    // transaction in the block they descend from or lead to.
+    setEntries stage;
     for (const auto& tx : vtx)
     {
         txiter it = mapTx.find(tx->GetHash());
         if (it != mapTx.end()) {
-            setEntries stage;
             stage.insert(it);
-            RemoveStaged(stage, true, MemPoolRemovalReason::BLOCK);
         }
+    }
+    RemoveStaged(stage, true, MemPoolRemovalReason::BLOCK);
+    for (const auto& tx : vtx)
+    {
         removeConflicts(*tx);
         ClearPrioritisation(tx->GetHash());
     }
@@ -626,10 +678,7 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
         checkTotal += it->GetTxSize();
         innerUsage += it->DynamicMemoryUsage();
         const CTransaction& tx = it->GetTx();
-        txlinksMap::const_iterator linksiter = mapLinks.find(it);
-        assert(linksiter != mapLinks.end());
-        const TxLinks &links = linksiter->second;
-        innerUsage += memusage::DynamicUsage(links.parents) + memusage::DynamicUsage(links.children);
+        assert(mapLinks.count(it));
         bool fDependsWait = false;
         setEntries setParentCheck;
         for (const CTxIn &txin : tx.vin) {
@@ -650,7 +699,8 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
             assert(it3->second == &tx);
             i++;
         }
-        assert(setParentCheck == GetMemPoolParents(it));
+        const setLinkEntries &setMemPoolParents = GetMemPoolParents(it);
+        assert(setParentCheck.size() == setMemPoolParents.size() && std::equal(setParentCheck.begin(), setParentCheck.end(), setMemPoolParents.begin()));
         // Verify ancestor state is correct.
         setEntries setAncestors;
         uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
@@ -683,7 +733,8 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
                 child_sizes += childit->GetTxSize();
             }
         }
-        assert(setChildrenCheck == GetMemPoolChildren(it));
+        const setLinkEntries &setMemPoolChildren = GetMemPoolChildren(it);
+        assert(setChildrenCheck.size() == setMemPoolChildren.size() && std::equal(setChildrenCheck.begin(), setChildrenCheck.end(), setMemPoolChildren.begin()));
         // Also check to make sure size is greater than sum with immediate children.
         // just a sanity check, not definitive that this calc is correct...
         assert(it->GetSizeWithDescendants() >= child_sizes + it->GetTxSize());
@@ -777,6 +828,100 @@ void CTxMemPool::queryHashes(std::vector<uint256>& vtxid)
     }
 }
 
+size_t MempoolSnapshot::Find(const uint256& txid) const
+{
+    auto it = m_positions.find(txid);
+    return it == m_positions.end() ? npos : it->second;
+}
+
+std::set<size_t> MempoolSnapshot::CalculateAncestors(size_t pos) const
+{
+    std::set<size_t> ancestors;
+    std::vector<size_t> todo(m_entries[pos].parents);
+    while (!todo.empty()) {
+        const size_t next = todo.back();
+        todo.pop_back();
+        if (ancestors.insert(next).second) {
+            todo.insert(todo.end(), m_entries[next].parents.begin(), m_entries[next].parents.end());
+        }
+    }
+    return ancestors;
+}
+
+std::set<size_t> MempoolSnapshot::CalculateDescendants(size_t pos) const
+{
+    std::set<size_t> descendants;
+    std::vector<size_t> todo(m_entries[pos].children);
+    while (!todo.empty()) {
+        const size_t next = todo.back();
+        todo.pop_back();
+        if (descendants.insert(next).second) {
+            todo.insert(todo.end(), m_entries[next].children.begin(), m_entries[next].children.end());
+        }
+    }
+    return descendants;
+}
+
+std::shared_ptr<const MempoolSnapshot> CTxMemPool::GetSnapshot() const
+{
+    {
+        LOCK(m_snapshot_mutex);
+        if (m_snapshot && m_snapshot->GetSequence() == nTransactionsUpdated) return m_snapshot;
+    }
+
+    LOCK(cs);
+    // Another reader may have taken a snapshot while we waited for the lock.
+    const unsigned int sequence = nTransactionsUpdated;
+    {
+        LOCK(m_snapshot_mutex);
+        if (m_snapshot && m_snapshot->GetSequence() == sequence) return m_snapshot;
+    }
+
+    std::shared_ptr<MempoolSnapshot> snapshot = std::make_shared<MempoolSnapshot>(sequence);
+    std::vector<MempoolSnapshot::Entry>& entries = snapshot->m_entries;
+    // Parents sort before their children, as they have fewer ancestors.
+    const std::vector<indexed_transaction_set::const_iterator> iters = GetSortedDepthAndScore();
+    entries.resize(iters.size());
+    snapshot->m_positions.reserve(iters.size());
+    for (size_t pos = 0; pos < iters.size(); pos++) {
+        snapshot->m_positions.emplace(iters[pos]->GetTx().GetHash(), pos);
+    }
+    auto positions_of = [&](const setLinkEntries& links, std::vector<size_t>& out) {
+        out.reserve(links.size());
+        for (txiter link : links) {
+            out.push_back(snapshot->m_positions.at(link->GetTx().GetHash()));
+        }
+    };
+    for (size_t pos = 0; pos < iters.size(); pos++) {
+        const CTxMemPoolEntry& e = *iters[pos];
+        MempoolSnapshot::Entry& entry = entries[pos];
+        entry.txid = e.GetTx().GetHash();
+        entry.wtxid = e.GetTx().GetWitnessHash();
+        entry.fee = e.GetFee();
+        entry.modified_fee = e.GetModifiedFee();
+        entry.tx_size = e.GetTxSize();
+        entry.time = e.GetTime();
+        entry.height = e.GetHeight();
+        entry.count_with_descendants = e.GetCountWithDescendants();
+        entry.size_with_descendants = e.GetSizeWithDescendants();
+        entry.mod_fees_with_descendants = e.GetModFeesWithDescendants();
+        entry.count_with_ancestors = e.GetCountWithAncestors();
+        entry.size_with_ancestors = e.GetSizeWithAncestors();
+        entry.mod_fees_with_ancestors = e.GetModFeesWithAncestors();
+        positions_of(GetMemPoolParents(iters[pos]), entry.parents);
+        positions_of(GetMemPoolChildren(iters[pos]), entry.children);
+        // See IsRBFOptIn(); the parents have been handled already.
+        entry.bip125_replaceable = SignalsOptInRBF(e.GetTx());
+        for (size_t parent : entry.parents) {
+            entry.bip125_replaceable |= entries[parent].bip125_replaceable;
+        }
+    }
+
+    LOCK(m_snapshot_mutex);
+    m_snapshot = std::move(snapshot);
+    return m_snapshot;
+}
+
 static TxMempoolInfo GetInfo(CTxMemPool::indexed_transaction_set::const_iterator it) {
     return TxMempoolInfo{it->GetSharedTx(), it->GetTime(), CFeeRate(it->GetFee(), it->GetTxSize()), it->GetModifiedFee() - it->GetFee()};
 }
@@ -910,8 +1055,25 @@ bool CCoinsViewMemPool::GetCoin(const COutPoint &outpoint, Coin &coin) const {
 
 size_t CTxMemPool::DynamicMemoryUsage() const {
     LOCK(cs);
-    // Estimate the overhead of mapTx to be 12 pointers + an allocation, as no exact formula for boost::multi_index_contained is implemented.
-    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 12 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(mapLinks) + memusage::DynamicUsage(vTxHashes) + cachedInnerUsage;
+    // The nodes of mapTx, mapLinks and mapNextTx come from m_pool_resource, which accounts for them exactly.
+    // Like for the other containers, what they use while empty is not counted.
+    return std::max(m_pool_resource.DynamicMemoryUsage(), m_pool_base_usage) - m_pool_base_usage + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(vTxHashes) + cachedInnerUsage;
+}
+
+CTxMemPool::ArenaStats CTxMemPool::GetArenaStats() const
+{
+    LOCK(cs);
+    return ArenaStats{m_pool_resource.ChunkBytes(), m_pool_resource.ChunkUsedBytes()};
+}
+
+size_t CTxMemPool::CompactArena()
+{
+    LOCK(cs);
+    const size_t released = m_pool_resource.Compact();
+    if (released > 0) {
+        LogPrint(BCLog::MEMPOOL, "Released %u kB of unused mempool arena memory, %u kB remain\n", released / 1024, m_pool_resource.ChunkBytes() / 1024);
+    }
+    return released;
 }
 
 void CTxMemPool::RemoveStaged(setEntries &stage, bool updateDescendants, MemPoolRemovalReason reason) {
@@ -949,25 +1111,27 @@ void CTxMemPool::addUnchecked(const CTxMemPoolEntry &entry, bool validFeeEstimat
 
 void CTxMemPool::UpdateChild(txiter entry, txiter child, bool add)
 {
-    setEntries s;
-    if (add && mapLinks[entry].children.insert(child).second) {
-        cachedInnerUsage += memusage::IncrementalDynamicUsage(s);
-    } else if (!add && mapLinks[entry].children.erase(child)) {
-        cachedInnerUsage -= memusage::IncrementalDynamicUsage(s);
+    txlinksMap::iterator it = mapLinks.find(entry);
+    assert(it != mapLinks.end());
+    if (add) {
+        it->second.children.insert(child);
+    } else {
+        it->second.children.erase(child);
     }
 }
 
 void CTxMemPool::UpdateParent(txiter entry, txiter parent, bool add)
 {
-    setEntries s;
-    if (add && mapLinks[entry].parents.insert(parent).second) {
-        cachedInnerUsage += memusage::IncrementalDynamicUsage(s);
-    } else if (!add && mapLinks[entry].parents.erase(parent)) {
-        cachedInnerUsage -= memusage::IncrementalDynamicUsage(s);
+    txlinksMap::iterator it = mapLinks.find(entry);
+    assert(it != mapLinks.end());
+    if (add) {
+        it->second.parents.insert(parent);
+    } else {
+        it->second.parents.erase(parent);
     }
 }
 
-const CTxMemPool::setEntries & CTxMemPool::GetMemPoolParents(txiter entry) const
+const CTxMemPool::setLinkEntries & CTxMemPool::GetMemPoolParents(txiter entry) const
 {
     assert (entry != mapTx.end());
     txlinksMap::const_iterator it = mapLinks.find(entry);
@@ -975,7 +1139,7 @@ const CTxMemPool::setEntries & CTxMemPool::GetMemPoolParents(txiter entry) const
     return it->second.parents;
 }
 
-const CTxMemPool::setEntries & CTxMemPool::GetMemPoolChildren(txiter entry) const
+const CTxMemPool::setLinkEntries & CTxMemPool::GetMemPoolChildren(txiter entry) const
 {
     assert (entry != mapTx.end());
     txlinksMap::const_iterator it = mapLinks.find(entry);
@@ -1015,25 +1179,140 @@ void CTxMemPool::trackPackageRemoved(const CFeeRate& rate) {
     }
 }
 
-void CTxMemPool::TrimToSize(size_t sizelimit, std::vector<COutPoint>* pvNoSpendsRemaining) {
-    LOCK(cs);
+namespace {
+/** Descendant state of an entry, some of whose descendants have been selected
+ *  for eviction. Sorts like the entry would in mapTx after their removal. */
+struct EvictionModifiedEntry
+{
+    EvictionModifiedEntry(CTxMemPool::txiter entry, uint64_t size_with_descendants, CAmount mod_fees_with_descendants) :
+        iter(entry), nSizeWithDescendants(size_with_descendants),
+        nModFeesWithDescendants(mod_fees_with_descendants) {}
+    explicit EvictionModifiedEntry(CTxMemPool::txiter entry) :
+        EvictionModifiedEntry(entry, entry->GetSizeWithDescendants(), entry->GetModFeesWithDescendants()) {}
+
+    CAmount GetModifiedFee() const { return iter->GetModifiedFee(); }
+    size_t GetTxSize() const { return iter->GetTxSize(); }
+    int64_t GetTime() const { return iter->GetTime(); }
+    uint64_t GetSizeWithDescendants() const { return nSizeWithDescendants; }
+    CAmount GetModFeesWithDescendants() const { return nModFeesWithDescendants; }
+
+    CTxMemPool::txiter iter;
+    uint64_t nSizeWithDescendants;
+    CAmount nModFeesWithDescendants;
+};
 
-    unsigned nTxnRemoved = 0;
-    CFeeRate maxFeeRateRemoved(0);
-    while (!mapTx.empty() && DynamicMemoryUsage() > sizelimit) {
-        indexed_transaction_set::index<descendant_score>::type::iterator it = mapTx.get<descendant_score>().begin();
+typedef boost::multi_index_container<
+    EvictionModifiedEntry,
+    boost::multi_index::indexed_by<
+        boost::multi_index::ordered_unique<
+            boost::multi_index::member<EvictionModifiedEntry, CTxMemPool::txiter, &EvictionModifiedEntry::iter>,
+            CTxMemPool::CompareIteratorByHash
+        >,
+        // sorted by modified descendant score
+        boost::multi_index::ordered_non_unique<
+            boost::multi_index::tag<descendant_score>,
+            boost::multi_index::identity<EvictionModifiedEntry>,
+            CompareTxMemPoolEntryByDescendantScore
+        >
+    >
+> indexed_eviction_set;
+} // namespace
+
+void CTxMemPool::SelectForEviction(size_t bytes_to_free, setEntries& stage, CFeeRate& maxFeeRateRemoved)
+{
+    AssertLockHeld(cs);
+
+    // The memory a transaction frees is estimated as its share of the whole
+    // usage, by its own usage. This is doubled so that a batch errs towards
+    // removing too little, which the next batch makes up for, rather than
+    // evicting packages that removing one package at a time would have kept.
+    const double usage_scale = cachedInnerUsage ? 2.0 * DynamicMemoryUsage() / cachedInnerUsage : 1.0;
+    double estimated_freed = 0;
+
+    // Candidates come from mapTx in descendant score order, and from modified,
+    // which holds the entries whose package was found to have shrunk since it
+    // was scored. The ancestors of selected transactions are not updated as
+    // they are selected, as that makes taking a chain apart from its tip
+    // quadratic. Instead the package of every candidate is recomputed from
+    // its remaining descendants, which is needed to select it anyway, and a
+    // candidate whose score turns out to be stale goes back into modified.
+    indexed_eviction_set modified;
+    indexed_transaction_set::index<descendant_score>::type::iterator mi = mapTx.get<descendant_score>().begin();
+    while (estimated_freed < bytes_to_free) {
+        while (mi != mapTx.get<descendant_score>().end() &&
+               (stage.count(mapTx.project<0>(mi)) || modified.count(mapTx.project<0>(mi)))) {
+            ++mi;
+        }
+        auto modit = modified.get<descendant_score>().begin();
+        const bool use_modified = modit != modified.get<descendant_score>().end() &&
+            (mi == mapTx.get<descendant_score>().end() ||
+             CompareTxMemPoolEntryByDescendantScore()(*modit, EvictionModifiedEntry(mapTx.project<0>(mi))));
+        txiter it;
+        uint64_t scored_size;
+        CAmount scored_fees;
+        if (use_modified) {
+            it = modit->iter;
+            scored_size = modit->nSizeWithDescendants;
+            scored_fees = modit->nModFeesWithDescendants;
+            modified.get<descendant_score>().erase(modit);
+        } else if (mi != mapTx.get<descendant_score>().end()) {
+            it = mapTx.project<0>(mi);
+            scored_size = it->GetSizeWithDescendants();
+            scored_fees = it->GetModFeesWithDescendants();
+            ++mi;
+        } else {
+            break;
+        }
+
+        // Descendants that have been selected already are skipped, along
+        // with their own descendants, which have all been selected with them.
+        setEntries package;
+        uint64_t package_size = 0;
+        CAmount package_fees = 0;
+        std::vector<txiter> to_visit{it};
+        while (!to_visit.empty()) {
+            const txiter visit = to_visit.back();
+            to_visit.pop_back();
+            if (!package.insert(visit).second) continue;
+            package_size += visit->GetTxSize();
+            package_fees += visit->GetModifiedFee();
+            for (txiter child : GetMemPoolChildren(visit)) {
+                if (!stage.count(child) && !package.count(child)) to_visit.push_back(child);
+            }
+        }
+        if (package_size != scored_size || package_fees != scored_fees) {
+            modified.insert(EvictionModifiedEntry(it, package_size, package_fees));
+            continue;
+        }
 
         // We set the new mempool min fee to the feerate of the removed set, plus the
         // "minimum reasonable fee rate" (ie some value under which we consider txn
         // to have 0 fee). This way, we don't allow txn to enter mempool with feerate
         // equal to txn which were removed with no block in between.
-        CFeeRate removed(it->GetModFeesWithDescendants(), it->GetSizeWithDescendants());
+        CFeeRate removed(package_fees, package_size);
         removed += incrementalRelayFee;
         trackPackageRemoved(removed);
         maxFeeRateRemoved = std::max(maxFeeRateRemoved, removed);
 
+        for (txiter removeIt : package) {
+            stage.insert(removeIt);
+            modified.erase(removeIt);
+            estimated_freed += removeIt->DynamicMemoryUsage() * usage_scale;
+        }
+    }
+}
+
+void CTxMemPool::TrimToSize(size_t sizelimit, std::vector<COutPoint>* pvNoSpendsRemaining) {
+    LOCK(cs);
+
+    unsigned nTxnRemoved = 0;
+    CFeeRate maxFeeRateRemoved(0);
+    size_t usage;
+    while (!mapTx.empty() && (usage = DynamicMemoryUsage()) > sizelimit) {
+        // Evict the packages expected to bring usage down to the limit in one
+        // batch, so that the ancestors they leave behind are updated once.
         setEntries stage;
-        CalculateDescendants(mapTx.project<0>(it), stage);
+        SelectForEviction(usage - sizelimit, stage, maxFeeRateRemoved);
         nTxnRemoved += stage.size();
 
         std::vector<CTransaction> txn;
@@ -1068,7 +1347,7 @@ uint64_t CTxMemPool::CalculateDescendantMaximum(txiter entry) const {
         txiter candidate = candidates.back();
         candidates.pop_back();
         if (!counted.insert(candidate).second) continue;
-        const setEntries& parents = GetMemPoolParents(candidate);
+        const setLinkEntries& parents = GetMemPoolParents(candidate);
         if (parents.size() == 0) {
             maximum = std::max(maximum, candidate->GetCountWithDescendants());
         } else {
@@ -6,9 +6,11 @@
 #ifndef BITCOIN_TXMEMPOOL_H
 #define BITCOIN_TXMEMPOOL_H
 
+#include <atomic>
 #include <memory>
 #include <set>
 #include <map>
+#include <unordered_map>
 #include <vector>
 #include <utility>
 #include <string>
@@ -20,6 +22,7 @@
 #include <primitives/transaction.h>
 #include <sync.h>
 #include <random.h>
+#include <support/allocators/pool.h>
 
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/hashed_index.hpp>
@@ -33,6 +36,9 @@ extern CCriticalSection cs_main;
 /** Fake height value used in Coin to signify they are only in the memory pool (since 0.8) */
 static const uint32_t MEMPOOL_HEIGHT = 0x7FFFFFFF;
 
+/** Time in seconds between attempts to give unused mempool arena chunks back to the system */
+static const int64_t MEMPOOL_ARENA_COMPACT_INTERVAL = 10 * 60;
+
 struct LockPoints
 {
     // Will be set to the blockchain height and median time past
@@ -205,7 +211,8 @@ struct mempoolentry_txid
 class CompareTxMemPoolEntryByDescendantScore
 {
 public:
-    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    template<typename T>
+    bool operator()(const T& a, const T& b) const
     {
         double a_mod_fee, a_size, b_mod_fee, b_size;
 
@@ -223,7 +230,8 @@ public:
     }
 
     // Return the fee/size we're using for sorting this entry.
-    void GetModFeeAndSize(const CTxMemPoolEntry &a, double &mod_fee, double &size) const
+    template<typename T>
+    void GetModFeeAndSize(const T &a, double &mod_fee, double &size) const
     {
         // Compare feerate with descendants to feerate of the transaction, and
         // return the fee/size for the max.
@@ -366,6 +374,63 @@ public:
     }
 };
 
+/**
+ * Immutable copy of what the RPC and REST interfaces report about the
+ * mempool, published by CTxMemPool::GetSnapshot(). Readers share a snapshot
+ * without holding the mempool lock, and a new one is only taken after the
+ * mempool has changed.
+ */
+class MempoolSnapshot
+{
+public:
+    struct Entry {
+        uint256 txid;
+        uint256 wtxid;
+        CAmount fee;
+        CAmount modified_fee;
+        size_t tx_size;
+        int64_t time;
+        unsigned int height;
+        uint64_t count_with_descendants;
+        uint64_t size_with_descendants;
+        CAmount mod_fees_with_descendants;
+        uint64_t count_with_ancestors;
+        uint64_t size_with_ancestors;
+        CAmount mod_fees_with_ancestors;
+        //! Whether the transaction or one of its ancestors signals BIP125 replaceability
+        bool bip125_replaceable;
+        //! Positions of the direct in-mempool parents and children, sorted by txid
+        std::vector<size_t> parents;
+        std::vector<size_t> children;
+    };
+
+    //! Returned by Find() for transactions that are not in the snapshot
+    static const size_t npos = size_t(-1);
+
+    explicit MempoolSnapshot(unsigned int sequence) : m_sequence(sequence) {}
+
+    //! Value of CTxMemPool::GetTransactionsUpdated() at the time of the snapshot
+    unsigned int GetSequence() const { return m_sequence; }
+
+    //! All entries, sorted by depth and score like CTxMemPool::queryHashes()
+    const std::vector<Entry>& Entries() const { return m_entries; }
+
+    //! Position of the entry with the given txid, or npos
+    size_t Find(const uint256& txid) const;
+
+    //! Positions of all in-mempool ancestors of the entry at pos, excluding itself
+    std::set<size_t> CalculateAncestors(size_t pos) const;
+    //! Positions of all in-mempool descendants of the entry at pos, excluding itself
+    std::set<size_t> CalculateDescendants(size_t pos) const;
+
+private:
+    friend class CTxMemPool;
+
+    const unsigned int m_sequence;
+    std::vector<Entry> m_entries;
+    std::unordered_map<uint256, size_t, SaltedTxidHasher> m_positions;
+};
+
 /**
  * CTxMemPool stores valid-according-to-the-current-best-chain transactions
  * that may be included in the next block.
@@ -442,7 +507,7 @@ class CTxMemPool
 {
 private:
     uint32_t nCheckFrequency GUARDED_BY(cs); //!< Value n means that n times in 2^32 we check.
-    unsigned int nTransactionsUpdated; //!< Used by getblocktemplate to trigger CreateNewBlock() invocation
+    std::atomic<unsigned int> nTransactionsUpdated; //!< Used by getblocktemplate to trigger CreateNewBlock() invocation, and to detect stale snapshots
     CBlockPolicyEstimator* minerPolicyEstimator;
 
     uint64_t totalTxSize;      //!< sum of all mempool tx's virtual sizes. Differs from serialized tx size since witness data is discounted. Defined in BIP 141.
@@ -481,10 +546,20 @@ public:
                 boost::multi_index::identity<CTxMemPoolEntry>,
                 CompareTxMemPoolEntryByAncestorFee
             >
-        >
+        >,
+        PoolAllocator<CTxMemPoolEntry>
     > indexed_transaction_set;
 
     mutable CCriticalSection cs;
+private:
+    //! Protects m_snapshot; may be taken while holding cs, but not the other way around
+    mutable Mutex m_snapshot_mutex;
+    mutable std::shared_ptr<const MempoolSnapshot> m_snapshot GUARDED_BY(m_snapshot_mutex);
+    //! Memory for the nodes of mapTx, mapLinks (including the links) and mapNextTx
+    PoolResource m_pool_resource GUARDED_BY(cs);
+    //! Memory used by the empty containers, which is not accounted for
+    size_t m_pool_base_usage;
+public:
     indexed_transaction_set mapTx GUARDED_BY(cs);
 
     using txiter = indexed_transaction_set::nth_index<0>::type::const_iterator;
@@ -496,19 +571,35 @@ public:
         }
     };
     typedef std::set<txiter, CompareIteratorByHash> setEntries;
+    //! Direct parents or children of an entry, which live in mapLinks
+    typedef std::set<txiter, CompareIteratorByHash, PoolAllocator<txiter> > setLinkEntries;
 
-    const setEntries & GetMemPoolParents(txiter entry) const EXCLUSIVE_LOCKS_REQUIRED(cs);
-    const setEntries & GetMemPoolChildren(txiter entry) const EXCLUSIVE_LOCKS_REQUIRED(cs);
+    const setLinkEntries & GetMemPoolParents(txiter entry) const EXCLUSIVE_LOCKS_REQUIRED(cs);
+    const setLinkEntries & GetMemPoolChildren(txiter entry) const EXCLUSIVE_LOCKS_REQUIRED(cs);
     uint64_t CalculateDescendantMaximum(txiter entry) const EXCLUSIVE_LOCKS_REQUIRED(cs);
 private:
     typedef std::map<txiter, setEntries, CompareIteratorByHash> cacheMap;
 
+    /** Change to the ancestor or descendant state of an entry, summed up over
+     *  all the transactions added to or removed from the mempool together, so
+     *  that the entry is modified in mapTx, and re-sorted, only once. */
+    struct StateDelta {
+        int64_t size = 0;
+        CAmount fee = 0;
+        int64_t count = 0;
+        int64_t sigOpCost = 0;
+    };
+    typedef std::map<txiter, StateDelta, CompareIteratorByHash> stateDeltaMap;
+
     struct TxLinks {
-        setEntries parents;
-        setEntries children;
+        explicit TxLinks(PoolResource* resource) :
+            parents(CompareIteratorByHash(), PoolAllocator<txiter>(resource)),
+            children(CompareIteratorByHash(), PoolAllocator<txiter>(resource)) {}
+        setLinkEntries parents;
+        setLinkEntries children;
     };
 
-    typedef std::map<txiter, TxLinks, CompareIteratorByHash> txlinksMap;
+    typedef std::map<txiter, TxLinks, CompareIteratorByHash, PoolAllocator<std::pair<const txiter, TxLinks> > > txlinksMap;
     txlinksMap mapLinks;
 
     void UpdateParent(txiter entry, txiter parent, bool add);
@@ -517,7 +608,8 @@ private:
     std::vector<indexed_transaction_set::const_iterator> GetSortedDepthAndScore() const EXCLUSIVE_LOCKS_REQUIRED(cs);
 
 public:
-    indirectmap<COutPoint, const CTransaction*> mapNextTx GUARDED_BY(cs);
+    typedef indirectmap<COutPoint, const CTransaction*, PoolAllocator<std::pair<const COutPoint* const, const CTransaction*> > > nextTxMap;
+    nextTxMap mapNextTx GUARDED_BY(cs);
     std::map<uint256, CAmount> mapDeltas;
 
     /** Create a new CTxMemPool.
@@ -659,6 +751,25 @@ public:
 
     size_t DynamicMemoryUsage() const;
 
+    /** Memory of the arena that the nodes of mapTx, mapLinks and mapNextTx
+     *  are allocated from. */
+    struct ArenaStats {
+        size_t chunk_bytes; //!< Memory held in arena chunks
+        size_t used_bytes;  //!< Memory of the live nodes in those chunks
+    };
+    ArenaStats GetArenaStats() const;
+
+    /** Give arena chunks without live nodes back to the system. The arena
+     *  keeps freed nodes for reuse otherwise, so after a large mempool has
+     *  shrunk, most of its memory would stay allocated. Returns the number
+     *  of bytes released. */
+    size_t CompactArena();
+
+    /** Return a snapshot of the mempool. The previous snapshot is returned as
+     *  long as the mempool did not change since it was taken, without taking
+     *  the mempool lock. */
+    std::shared_ptr<const MempoolSnapshot> GetSnapshot() const;
+
     boost::signals2::signal<void (CTransactionRef)> NotifyEntryAdded;
     boost::signals2::signal<void (CTransactionRef, MemPoolRemovalReason)> NotifyEntryRemoved;
 
@@ -675,10 +786,15 @@ private:
      *  cachedDescendants will be updated with the descendants of the transaction
      *  being updated, so that future invocations don't need to walk the
      *  same transaction again, if encountered in another transaction chain.
+     *
+     *  The changes to the ancestor state of the descendants are added to
+     *  ancestorDeltas, for the caller to apply once all transactions have
+     *  been updated.
      */
     void UpdateForDescendants(txiter updateIt,
             cacheMap &cachedDescendants,
-            const std::set<uint256> &setExclude) EXCLUSIVE_LOCKS_REQUIRED(cs);
+            const std::set<uint256> &setExclude,
+            stateDeltaMap &ancestorDeltas) EXCLUSIVE_LOCKS_REQUIRED(cs);
     /** Update ancestors of hash to add/remove it as a descendant transaction. */
     void UpdateAncestorsOf(bool add, txiter hash, setEntries &setAncestors) EXCLUSIVE_LOCKS_REQUIRED(cs);
     /** Set ancestor state for an entry */
@@ -689,6 +805,10 @@ private:
     void UpdateForRemoveFromMempool(const setEntries &entriesToRemove, bool updateDescendants) EXCLUSIVE_LOCKS_REQUIRED(cs);
     /** Sever link between specified transaction and direct children. */
     void UpdateChildrenForRemoval(txiter entry) EXCLUSIVE_LOCKS_REQUIRED(cs);
+    /** Select packages for eviction in the order TrimToSize evicts them, until
+     *  their estimated memory usage reaches bytes_to_free, without changing
+     *  mapTx, so that the whole batch can be removed at once. */
+    void SelectForEviction(size_t bytes_to_free, setEntries& stage, CFeeRate& maxFeeRateRemoved) EXCLUSIVE_LOCKS_REQUIRED(cs);
 
     /** Before calling removeUnchecked for a given transaction,
      *  UpdateForRemoveFromMempool must be called on the entire (dependent) set
@@ -720,6 +840,7 @@ protected:
 public:
     CCoinsViewMemPool(CCoinsView* baseIn, const CTxMemPool& mempoolIn);
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
+    bool HasConcurrentGetCoin() const override { return false; }
 };
 
 /**
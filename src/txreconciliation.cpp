@@ -0,0 +1,193 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <txreconciliation.h>
+
+#include <crypto/common.h>
+#include <crypto/sha256.h>
+#include <hash.h>
+
+#include <algorithm>
+#include <assert.h>
+#include <map>
+
+namespace {
+
+/** Finalizer of splitmix64. Short ids are already uniformly distributed, this only derives independent values from them. */
+uint64_t Mix(uint64_t x)
+{
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+uint32_t CheckSum(uint32_t short_id)
+{
+    return Mix(short_id ^ 0xc2b2ae3d27d4eb4fULL) >> 32;
+}
+
+size_t CellIndex(uint32_t short_id, size_t hash, size_t cells)
+{
+    const size_t part = cells / TxReconSketch::NUM_HASHES;
+    return hash * part + Mix(short_id + (hash + 1) * 0x9e3779b97f4a7c15ULL) % part;
+}
+
+void ToggleCell(TxReconSketchCell& cell, uint32_t short_id)
+{
+    cell.key_sum ^= short_id;
+    cell.check_sum ^= CheckSum(short_id);
+}
+
+bool IsEmpty(const TxReconSketchCell& cell)
+{
+    return cell.key_sum == 0 && cell.check_sum == 0;
+}
+
+/** Whether the cell holds a single short id, up to a 2^-32 chance of a false positive */
+bool IsPure(const TxReconSketchCell& cell)
+{
+    return !IsEmpty(cell) && cell.check_sum == CheckSum(cell.key_sum);
+}
+
+} // namespace
+
+TxReconSketch::TxReconSketch(size_t cells) : m_cells((cells + NUM_HASHES - 1) / NUM_HASHES * NUM_HASHES) {}
+
+size_t TxReconSketch::CellsForDifference(size_t difference)
+{
+    // Peeling succeeds with high probability from about 1.3 cells per short
+    // id for large differences. Small ones fail when a few short ids share
+    // all their cells, which the extra cells make rare.
+    const size_t cells = difference + difference / 2 + 4 * NUM_HASHES;
+    return (cells + NUM_HASHES - 1) / NUM_HASHES * NUM_HASHES;
+}
+
+void TxReconSketch::Add(uint32_t short_id)
+{
+    if (m_cells.empty()) return;
+    for (size_t i = 0; i < NUM_HASHES; i++) {
+        ToggleCell(m_cells[CellIndex(short_id, i, m_cells.size())], short_id);
+    }
+}
+
+void TxReconSketch::Merge(const TxReconSketch& other)
+{
+    assert(other.m_cells.size() == m_cells.size());
+    for (size_t i = 0; i < m_cells.size(); i++) {
+        m_cells[i].key_sum ^= other.m_cells[i].key_sum;
+        m_cells[i].check_sum ^= other.m_cells[i].check_sum;
+    }
+}
+
+bool TxReconSketch::Decode(std::vector<uint32_t>& short_ids) const
+{
+    short_ids.clear();
+    std::vector<TxReconSketchCell> cells = m_cells;
+    std::vector<size_t> pending(cells.size());
+    for (size_t i = 0; i < cells.size(); i++) {
+        pending[i] = i;
+    }
+    // Take the short id out of every cell that holds only one, until no such cell is left
+    while (!pending.empty()) {
+        const TxReconSketchCell cell = cells[pending.back()];
+        pending.pop_back();
+        if (!IsPure(cell)) continue;
+        // A sketch that keeps producing short ids is not one of a difference that fits it
+        if (short_ids.size() >= cells.size()) return false;
+        short_ids.push_back(cell.key_sum);
+        for (size_t i = 0; i < NUM_HASHES; i++) {
+            const size_t index = CellIndex(cell.key_sum, i, cells.size());
+            ToggleCell(cells[index], cell.key_sum);
+            pending.push_back(index);
+        }
+    }
+    for (const TxReconSketchCell& cell : cells) {
+        if (!IsEmpty(cell)) return false;
+    }
+    return true;
+}
+
+TxReconciliationState::TxReconciliationState(bool initiator, uint64_t local_salt, uint64_t remote_salt) : m_initiator(initiator)
+{
+    // Both sides derive the same keys, whichever one they are
+    static const std::string TAG = "Tx Relay Salting";
+    unsigned char salt[8];
+    CSHA256 hasher;
+    hasher.Write((const unsigned char*)TAG.data(), TAG.size());
+    WriteLE64(salt, std::min(local_salt, remote_salt));
+    hasher.Write(salt, sizeof(salt));
+    WriteLE64(salt, std::max(local_salt, remote_salt));
+    hasher.Write(salt, sizeof(salt));
+    uint256 keys;
+    hasher.Finalize(keys.begin());
+    m_k0 = keys.GetUint64(0);
+    m_k1 = keys.GetUint64(1);
+}
+
+uint32_t TxReconciliationState::ShortId(const uint256& txid) const
+{
+    return SipHashUint256(m_k0, m_k1, txid);
+}
+
+void TxReconciliationState::StartRound()
+{
+    m_round_set.assign(m_local_set.begin(), m_local_set.end());
+    m_local_set.clear();
+    m_round_active = true;
+}
+
+std::vector<uint256> TxReconciliationState::EndRound()
+{
+    std::vector<uint256> txids;
+    txids.swap(m_round_set);
+    m_round_active = false;
+    return txids;
+}
+
+std::vector<uint256> TxReconciliationState::EndRound(std::vector<uint32_t>& short_ids)
+{
+    std::map<uint32_t, uint256> by_short_id;
+    for (const uint256& txid : m_round_set) {
+        by_short_id.emplace(ShortId(txid), txid);
+    }
+    std::vector<uint256> txids;
+    std::vector<uint32_t> others;
+    for (uint32_t short_id : short_ids) {
+        auto it = by_short_id.find(short_id);
+        if (it != by_short_id.end()) {
+            txids.push_back(it->second);
+            by_short_id.erase(it);
+        } else {
+            others.push_back(short_id);
+        }
+    }
+    short_ids.swap(others);
+    m_round_set.clear();
+    m_round_active = false;
+    return txids;
+}
+
+TxReconSketch TxReconciliationState::SketchRound(size_t cells) const
+{
+    TxReconSketch sketch(cells);
+    for (const uint256& txid : m_round_set) {
+        sketch.Add(ShortId(txid));
+    }
+    return sketch;
+}
+
+size_t EstimateReconDifference(size_t local_size, size_t remote_size, double q)
+{
+    const size_t min_size = std::min(local_size, remote_size);
+    const size_t max_size = std::max(local_size, remote_size);
+    return max_size - min_size + static_cast<size_t>(q * min_size) + 1;
+}
+
+double EstimateReconQ(size_t difference, size_t local_size, size_t remote_size)
+{
+    const size_t min_size = std::min(local_size, remote_size);
+    const size_t max_size = std::max(local_size, remote_size);
+    if (min_size == 0 || difference <= max_size - min_size) return 0;
+    return std::min(2.0, double(difference - (max_size - min_size)) / min_size);
+}
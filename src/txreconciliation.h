@@ -0,0 +1,139 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_TXRECONCILIATION_H
+#define BITCOIN_TXRECONCILIATION_H
+
+#include <serialize.h>
+#include <uint256.h>
+
+#include <set>
+#include <stdint.h>
+#include <vector>
+
+/** Version of the transaction reconciliation protocol sent in sendrecon */
+static const uint32_t TXRECON_VERSION = 1;
+/** Most transactions waiting to be reconciled with one peer, the ones after it are announced by inv */
+static const size_t MAX_RECON_SET_SIZE = 2000;
+/** Largest set difference a sketch may be sized for */
+static const size_t MAX_RECON_DIFFERENCE = 3 * MAX_RECON_SET_SIZE;
+/** Average delay between reconciliation requests to an outbound peer, in seconds */
+static const unsigned int RECON_REQUEST_INTERVAL = 4;
+/** Seconds to wait for the sketch of a requested reconciliation before announcing the transactions by inv */
+static const int64_t RECON_RESPONSE_TIMEOUT = 30;
+/** Outbound peers a transaction is flooded to on average, instead of being reconciled with them */
+static const int RECON_FLOOD_OUTBOUND = 1;
+/** q coefficient to estimate the set difference with before the first reconciliation */
+static constexpr double DEFAULT_RECON_Q = 0.25;
+/** Fixed point scale of the q coefficient in reqrecon */
+static const uint16_t RECON_Q_PRECISION = 1 << 14;
+
+/** One cell of a TxReconSketch */
+struct TxReconSketchCell
+{
+    uint32_t key_sum = 0;
+    uint32_t check_sum = 0;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(key_sum);
+        READWRITE(check_sum);
+    }
+};
+
+/**
+ * Invertible Bloom lookup table of the short ids of a set of transactions.
+ *
+ * Merging the sketches of two sets, with as many cells, leaves a sketch of
+ * the symmetric difference of the sets. That one decodes as long as the
+ * difference is small enough for the number of cells, no matter how large
+ * the sets are. Which set a decoded short id came from is up to the caller
+ * to tell.
+ */
+class TxReconSketch
+{
+public:
+    /** Cells every short id is added to, one in each part of the table */
+    static const size_t NUM_HASHES = 4;
+
+    TxReconSketch() {}
+    explicit TxReconSketch(size_t cells);
+
+    /** Cells that decode a difference of this many short ids with high probability */
+    static size_t CellsForDifference(size_t difference);
+
+    void Add(uint32_t short_id);
+    /** Merge a sketch with as many cells */
+    void Merge(const TxReconSketch& other);
+    /** Get the short ids added to the sketch an odd number of times */
+    bool Decode(std::vector<uint32_t>& short_ids) const;
+
+    size_t Cells() const { return m_cells.size(); }
+    bool IsValid() const { return m_cells.size() % NUM_HASHES == 0; }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(m_cells);
+    }
+
+private:
+    std::vector<TxReconSketchCell> m_cells;
+};
+
+/**
+ * Transaction reconciliation with one peer.
+ *
+ * The outbound side of a connection initiates the rounds: it sends the size
+ * of its set in reqrecon, the peer answers with a sketch of its own set, and
+ * the initiator decodes the difference. Each side then announces by inv the
+ * transactions the other one lacks. Transactions both sides have are never
+ * announced at all.
+ */
+class TxReconciliationState
+{
+public:
+    TxReconciliationState(bool initiator, uint64_t local_salt, uint64_t remote_salt);
+
+    /** Whether we send the reconciliation requests */
+    const bool m_initiator;
+
+    /** Transactions to reconcile in the next round */
+    std::set<uint256> m_local_set;
+    /** Transactions of the round in progress */
+    std::vector<uint256> m_round_set;
+    /** Whether a round is in progress */
+    bool m_round_active = false;
+    /** Initiator: time the round in progress was requested, or the next one will be */
+    int64_t m_request_time = 0;
+    /** Initiator: q coefficient estimated by the last successful round */
+    double m_q = DEFAULT_RECON_Q;
+
+    /** Short id of a transaction in the sketches exchanged with this peer */
+    uint32_t ShortId(const uint256& txid) const;
+
+    /** Start a round with the transactions collected so far */
+    void StartRound();
+    /** End the round and get the transactions of it that are still to be announced */
+    std::vector<uint256> EndRound();
+    /** End the round and get the transactions of it with these short ids, taking their short ids out of short_ids */
+    std::vector<uint256> EndRound(std::vector<uint32_t>& short_ids);
+
+    /** Sketch of the round's transactions */
+    TxReconSketch SketchRound(size_t cells) const;
+
+private:
+    uint64_t m_k0;
+    uint64_t m_k1;
+};
+
+/** Estimated size of the difference between two sets of transactions to reconcile */
+size_t EstimateReconDifference(size_t local_size, size_t remote_size, double q);
+/** q coefficient that estimates the difference a round turned out to have */
+double EstimateReconQ(size_t difference, size_t local_size, size_t remote_size);
+
+#endif // BITCOIN_TXRECONCILIATION_H
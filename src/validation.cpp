@@ -6,6 +6,7 @@
 #include <validation.h>
 
 #include <arith_uint256.h>
+#include <blockfilemap.h>
 #include <chain.h>
 #include <chainparams.h>
 #include <checkpoints.h>
@@ -14,6 +15,8 @@
 #include <consensus/merkle.h>
 #include <consensus/tx_verify.h>
 #include <consensus/validation.h>
+#include <crypto/common.h>
+#include <crypto/sha256.h>
 #include <cuckoocache.h>
 #include <hash.h>
 #include <index/txindex.h>
@@ -43,6 +46,7 @@
 
 #include <future>
 #include <sstream>
+#include <thread>
 
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/thread.hpp>
@@ -229,6 +233,7 @@ bool fIsBareMultisigStd = DEFAULT_PERMIT_BAREMULTISIG;
 bool fRequireStandard = true;
 bool fCheckBlockIndex = false;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
+bool g_async_coins_flush = DEFAULT_ASYNC_COINS_FLUSH;
 size_t nCoinCacheUsage = 5000 * 300;
 uint64_t nPruneTarget = 0;
 int64_t nMaxTipAge = DEFAULT_MAX_TIP_AGE;
@@ -310,6 +315,7 @@ static void FindFilesToPruneManual(std::set<int>& setFilesToPrune, int nManualPr
 static void FindFilesToPrune(std::set<int>& setFilesToPrune, uint64_t nPruneAfterHeight);
 bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheSigStore, bool cacheFullScriptStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks = nullptr);
 static FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly = false);
+static void ParallelForEach(size_t count, const std::function<void(size_t)>& fn);
 
 bool CheckFinalTx(const CTransaction &tx, int flags)
 {
@@ -557,6 +563,20 @@ static bool CheckInputsFromMempoolAndCache(const CTransaction& tx, CValidationSt
     return CheckInputs(tx, state, view, true, flags, cacheSigStore, true, txdata);
 }
 
+/** Transactions with at least this sigop cost, and more than one input, have
+ *  their signatures verified on the script check threads when they enter the
+ *  mempool. Cheaper transactions are verified faster on the calling thread. */
+static const int64_t MEMPOOL_PARALLEL_CHECK_MIN_SIGOPS_COST = 16 * WITNESS_SCALE_FACTOR;
+
+/** Run script checks on the script check threads, so that the signatures
+ *  they verify are in the signature cache when the scripts are checked again
+ *  on the calling thread. The outcome of the checks is not used; failing
+ *  checks are simply not cached. */
+static void WarmSignatureCache(std::vector<CScriptCheck>& checks)
+{
+    ParallelForEach(checks.size(), [&checks](size_t i) { checks[i](); });
+}
+
 static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool& pool, CValidationState& state, const CTransactionRef& ptx,
                               bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced,
                               bool bypass_limits, const CAmount& nAbsurdFee, std::vector<COutPoint>& coins_to_uncache, bool test_accept) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
@@ -890,6 +910,14 @@ static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
         PrecomputedTransactionData txdata(tx);
+        if (nScriptCheckThreads && tx.vin.size() > 1 && nSigOpsCost >= MEMPOOL_PARALLEL_CHECK_MIN_SIGOPS_COST) {
+            // Spread the expensive part of large transactions over the script
+            // check threads; the checks below then only execute the scripts.
+            std::vector<CScriptCheck> checks;
+            CValidationState stateDummy;
+            CheckInputs(tx, stateDummy, view, true, scriptVerifyFlags, true, false, txdata, &checks);
+            WarmSignatureCache(checks);
+        }
         if (!CheckInputs(tx, state, view, true, scriptVerifyFlags, true, false, txdata)) {
             // SCRIPT_VERIFY_CLEANSTACK requires SCRIPT_VERIFY_WITNESS, so we
             // need to turn both off, and compare against just turning off CLEANSTACK
@@ -990,6 +1018,79 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
     return AcceptToMemoryPoolWithTime(chainparams, pool, state, tx, pfMissingInputs, GetTime(), plTxnReplaced, bypass_limits, nAbsurdFee, test_accept);
 }
 
+/** Verify the scripts of a batch of transactions on the script check threads,
+ *  so that their signatures are in the signature cache by the time the
+ *  transactions are accepted one by one. The outcome of the checks is not
+ *  used: transactions whose inputs are unknown, or whose checks fail, simply
+ *  find nothing in the cache. Coins that were loaded into pcoinsTip for the
+ *  transaction at index i are added to coins_to_uncache[i]. */
+static void PrevalidateScripts(CTxMemPool& pool, const std::vector<CTransactionRef>& txs, std::vector<std::vector<COutPoint>>& coins_to_uncache) EXCLUSIVE_LOCKS_REQUIRED(cs_main, pool.cs)
+{
+    CCoinsView dummy;
+    CCoinsViewCache view(&dummy);
+    CCoinsViewMemPool viewMemPool(pcoinsTip.get(), pool);
+    view.SetBackend(viewMemPool);
+
+    // Checks keep pointers to their transaction data, which must not move.
+    std::vector<PrecomputedTransactionData> txdata;
+    txdata.reserve(txs.size());
+    std::vector<CScriptCheck> checks;
+    for (size_t i = 0; i < txs.size(); i++) {
+        const CTransaction& tx = *txs[i];
+        if (tx.IsCoinBase() || pool.exists(tx.GetHash())) continue;
+        bool have_inputs = true;
+        for (const CTxIn& txin : tx.vin) {
+            if (!pcoinsTip->HaveCoinInCache(txin.prevout)) {
+                coins_to_uncache[i].push_back(txin.prevout);
+            }
+            if (!view.HaveCoin(txin.prevout)) {
+                have_inputs = false;
+                break;
+            }
+        }
+        if (!have_inputs) continue;
+        txdata.emplace_back(tx);
+        CValidationState state;
+        CheckInputs(tx, state, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, true, false, txdata.back(), &checks);
+        // Later transactions of the batch may spend this one.
+        AddCoins(view, tx, MEMPOOL_HEIGHT, true);
+    }
+
+    WarmSignatureCache(checks);
+}
+
+std::vector<MempoolAcceptResult> AcceptToMemoryPoolBatch(CTxMemPool& pool, const std::vector<CTransactionRef>& txs,
+                        bool bypass_limits, const CAmount nAbsurdFee, const std::vector<int64_t>* accept_times)
+{
+    AssertLockHeld(cs_main);
+    assert(!accept_times || accept_times->size() == txs.size());
+    const CChainParams& chainparams = Params();
+    const int64_t nAcceptTime = GetTime();
+    std::vector<MempoolAcceptResult> results(txs.size());
+    std::vector<std::vector<COutPoint>> coins_to_uncache(txs.size());
+    {
+        LOCK(pool.cs);
+        // Without script check threads this would only verify every script twice.
+        if (nScriptCheckThreads && txs.size() > 1) {
+            PrevalidateScripts(pool, txs, coins_to_uncache);
+        }
+        for (size_t i = 0; i < txs.size(); i++) {
+            MempoolAcceptResult& result = results[i];
+            result.accepted = AcceptToMemoryPoolWorker(chainparams, pool, result.state, txs[i], &result.missing_inputs, accept_times ? (*accept_times)[i] : nAcceptTime,
+                                                       nullptr /* plTxnReplaced */, bypass_limits, nAbsurdFee, coins_to_uncache[i], false /* test_accept */);
+        }
+    }
+    for (size_t i = 0; i < txs.size(); i++) {
+        if (results[i].accepted) continue;
+        for (const COutPoint& hashTx : coins_to_uncache[i])
+            pcoinsTip->Uncache(hashTx);
+    }
+    // After we've (potentially) uncached entries, ensure our coins cache is still within its size limits
+    CValidationState stateDummy;
+    FlushStateToDisk(chainparams, stateDummy, FlushStateMode::PERIODIC);
+    return results;
+}
+
 /**
  * Return transaction in txOut, and if it was found inside a block, its hash is placed in hashBlock.
  * If blockIndex is provided, the transaction is fetched from the corresponding block.
@@ -1064,18 +1165,56 @@ static bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMes
     return true;
 }
 
+static std::unique_ptr<BlockFileMap> g_block_file_map;
+
+void InitBlockFileMap(size_t max_files)
+{
+    g_block_file_map.reset();
+    if (max_files > 0) {
+        g_block_file_map.reset(new BlockFileMap(max_files, [](int nFile) { return GetBlockPosFilename(CDiskBlockPos(nFile, 0), "blk"); }));
+    }
+}
+
+/** Locate the block stored at pos in a memory mapped block file. Returns
+ *  false if block files are not mapped, or if anything looks off, in which
+ *  case the caller should fall back to (and report errors from) a regular read. */
+static bool MapBlockFromDisk(CRawBlock& block, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars* message_start)
+{
+    if (!g_block_file_map || pos.nPos < 8) return false;
+    std::shared_ptr<const MappedFile> file = g_block_file_map->Get(pos.nFile, pos.nPos);
+    if (!file) return false;
+    // Check the meta header preceding the block: message start and size.
+    const uint8_t* header = file->Data().data() + pos.nPos - 8;
+    if (message_start && memcmp(header, *message_start, CMessageHeader::MESSAGE_START_SIZE)) return false;
+    uint32_t blk_size = ReadLE32(header + CMessageHeader::MESSAGE_START_SIZE);
+    if (blk_size > MAX_SIZE) return false;
+    if (file->size() < (size_t)pos.nPos + blk_size) {
+        file = g_block_file_map->Get(pos.nFile, (size_t)pos.nPos + blk_size);
+        if (!file) return false;
+    }
+    block.data = file->Data().subspan(pos.nPos, blk_size);
+    block.file = std::move(file);
+    block.buffer.clear();
+    return true;
+}
+
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
 {
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
-
     // Read block
     try {
-        filein >> block;
+        CRawBlock raw;
+        if (MapBlockFromDisk(raw, pos, nullptr)) {
+            // Deserialize straight from the mapped file
+            SpanReader(SER_DISK, CLIENT_VERSION, raw.data) >> block;
+        } else {
+            // Open history file to read
+            CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+            if (filein.IsNull())
+                return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+            filein >> block;
+        }
     }
     catch (const std::exception& e) {
         return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
@@ -1106,6 +1245,12 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
 
 bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& message_start)
 {
+    CRawBlock raw;
+    if (MapBlockFromDisk(raw, pos, &message_start)) {
+        block.assign(raw.data.begin(), raw.data.end());
+        return true;
+    }
+
     CDiskBlockPos hpos = pos;
     hpos.nPos -= 8; // Seek back 8 bytes for meta header
     CAutoFile filein(OpenBlockFile(hpos, true), SER_DISK, CLIENT_VERSION);
@@ -1150,6 +1295,21 @@ bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CBlockIndex* pindex
     return ReadRawBlockFromDisk(block, block_pos, message_start);
 }
 
+bool ReadRawBlockFromDisk(CRawBlock& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& message_start)
+{
+    CDiskBlockPos block_pos;
+    {
+        LOCK(cs_main);
+        block_pos = pindex->GetBlockPos();
+    }
+
+    if (MapBlockFromDisk(block, block_pos, &message_start)) return true;
+    block.file.reset();
+    if (!ReadRawBlockFromDisk(block.buffer, block_pos, message_start)) return false;
+    block.data = Span<const uint8_t>(block.buffer.data(), block.buffer.size());
+    return true;
+}
+
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
 {
     int halvings = nHeight / consensusParams.nSubsidyHalvingInterval;
@@ -1783,6 +1943,7 @@ static unsigned int GetBlockScriptFlags(const CBlockIndex* pindex, const Consens
 
 static int64_t nTimeCheck = 0;
 static int64_t nTimeForks = 0;
+static int64_t nTimePrefetch = 0;
 static int64_t nTimeVerify = 0;
 static int64_t nTimeConnect = 0;
 static int64_t nTimeIndex = 0;
@@ -1790,6 +1951,32 @@ static int64_t nTimeCallbacks = 0;
 static int64_t nTimeTotal = 0;
 static int64_t nBlocksTotal = 0;
 
+/** Load the coins spent by a block into the view it is connected to before
+ *  its inputs are checked one by one, so that ConnectBlock() and the script
+ *  check queue do not stall on serial database lookups. The lookups run on
+ *  the script check threads. Outputs created by the block itself are
+ *  skipped, as they cannot be on disk yet. */
+static size_t PrefetchBlockInputs(const CBlock& block, const CCoinsViewCache& view)
+{
+    std::set<uint256> block_txids;
+    size_t nInputs = 0;
+    for (const auto& tx : block.vtx) {
+        block_txids.insert(tx->GetHash());
+        nInputs += tx->vin.size();
+    }
+
+    std::vector<COutPoint> prevouts;
+    prevouts.reserve(nInputs);
+    for (size_t i = 1; i < block.vtx.size(); i++) {
+        for (const CTxIn& txin : block.vtx[i]->vin) {
+            if (!block_txids.count(txin.prevout.hash)) {
+                prevouts.push_back(txin.prevout);
+            }
+        }
+    }
+    return view.PrefetchCoins(prevouts, ParallelForEach);
+}
+
 /** Apply the effects of this block (with given index) on the UTXO set represented by coins.
  *  Validity checks that depend on the UTXO set are also done; ConnectBlock()
  *  can fail if those validity checks fail (among other reasons). */
@@ -1969,6 +2156,10 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
     int64_t nTime2 = GetTimeMicros(); nTimeForks += nTime2 - nTime1;
     LogPrint(BCLog::BENCH, "    - Fork checks: %.2fms [%.2fs (%.2fms/blk)]\n", MILLI * (nTime2 - nTime1), nTimeForks * MICRO, nTimeForks * MILLI / nBlocksTotal);
 
+    size_t nPrefetched = PrefetchBlockInputs(block, view);
+    int64_t nTime2a = GetTimeMicros(); nTimePrefetch += nTime2a - nTime2;
+    LogPrint(BCLog::BENCH, "    - Prefetch %u inputs: %.2fms [%.2fs (%.2fms/blk)]\n", (unsigned)nPrefetched, MILLI * (nTime2a - nTime2), nTimePrefetch * MICRO, nTimePrefetch * MILLI / nBlocksTotal);
+
     CBlockUndo blockundo;
 
     CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : nullptr);
@@ -2038,8 +2229,8 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
         }
         UpdateCoins(tx, view, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight);
     }
-    int64_t nTime3 = GetTimeMicros(); nTimeConnect += nTime3 - nTime2;
-    LogPrint(BCLog::BENCH, "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs (%.2fms/blk)]\n", (unsigned)block.vtx.size(), MILLI * (nTime3 - nTime2), MILLI * (nTime3 - nTime2) / block.vtx.size(), nInputs <= 1 ? 0 : MILLI * (nTime3 - nTime2) / (nInputs-1), nTimeConnect * MICRO, nTimeConnect * MILLI / nBlocksTotal);
+    int64_t nTime3 = GetTimeMicros(); nTimeConnect += nTime3 - nTime2a;
+    LogPrint(BCLog::BENCH, "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs (%.2fms/blk)]\n", (unsigned)block.vtx.size(), MILLI * (nTime3 - nTime2a), MILLI * (nTime3 - nTime2a) / block.vtx.size(), nInputs <= 1 ? 0 : MILLI * (nTime3 - nTime2a) / (nInputs-1), nTimeConnect * MICRO, nTimeConnect * MILLI / nBlocksTotal);
 
     CAmount blockReward = nFees + GetBlockSubsidy(pindex->nHeight, chainparams.GetConsensus());
     if (block.vtx[0]->GetValueOut() > blockReward)
@@ -2050,8 +2241,8 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
 
     if (!control.Wait())
         return state.DoS(100, error("%s: CheckQueue failed", __func__), REJECT_INVALID, "block-validation-failed");
-    int64_t nTime4 = GetTimeMicros(); nTimeVerify += nTime4 - nTime2;
-    LogPrint(BCLog::BENCH, "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs (%.2fms/blk)]\n", nInputs - 1, MILLI * (nTime4 - nTime2), nInputs <= 1 ? 0 : MILLI * (nTime4 - nTime2) / (nInputs-1), nTimeVerify * MICRO, nTimeVerify * MILLI / nBlocksTotal);
+    int64_t nTime4 = GetTimeMicros(); nTimeVerify += nTime4 - nTime2a;
+    LogPrint(BCLog::BENCH, "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs (%.2fms/blk)]\n", nInputs - 1, MILLI * (nTime4 - nTime2a), nInputs <= 1 ? 0 : MILLI * (nTime4 - nTime2a) / (nInputs-1), nTimeVerify * MICRO, nTimeVerify * MILLI / nBlocksTotal);
 
     if (fJustCheck)
         return true;
@@ -2159,9 +2350,13 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
                     return AbortNode(state, "Failed to write to block index database");
                 }
             }
-            // Finally remove any pruned files
-            if (fFlushForPrune)
+            // Finally remove any pruned files, once any background chainstate
+            // write that may still need them for replay has completed.
+            if (fFlushForPrune) {
+                if (!pcoinsdbview->WaitForWrite())
+                    return AbortNode(state, "Failed to write to coin database");
                 UnlinkPrunedFiles(setFilesToPrune);
+            }
             nLastWrite = nNow;
         }
         // Flush best chain related state. This can only be done if the blocks / block index write was also done.
@@ -2174,8 +2369,14 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
             if (!CheckDiskSpace(48 * 2 * 2 * pcoinsTip->GetCacheSize()))
                 return state.Error("out of disk space");
             // Flush the chainstate (which may refer to block index entries).
-            if (!pcoinsTip->Flush())
+            // Flushes we are not forced to complete right away are left to
+            // finish in the background, so block processing can continue.
+            bool fAsync = g_async_coins_flush && (mode == FlushStateMode::PERIODIC || mode == FlushStateMode::IF_NEEDED) && !fFlushForPrune;
+            if (!pcoinsTip->Sync(fAsync))
                 return AbortNode(state, "Failed to write to coin database");
+            // Keep the most recently used coins cached rather than starting
+            // over with an empty cache.
+            pcoinsTip->Trim(nTotalSpace * COINS_CACHE_RETAIN_PERCENT / 100);
             nLastFlush = nNow;
             full_flush_completed = true;
         }
@@ -3068,6 +3269,79 @@ static bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos,
     return true;
 }
 
+/** Blocks with at least this many transactions have their context-free checks
+ *  and merkle roots computed on the script check threads. */
+static const size_t PARALLEL_CHECK_MIN_TXS = 64;
+/** Number of merkle tree nodes hashed by one job when a level of the tree is computed in parallel. */
+static const size_t PARALLEL_MERKLE_BATCH = 256;
+
+/** Call fn(i) for every i in [0, count) on the script check threads, or on
+ *  the calling thread if those are not available or are in use. */
+static void ParallelForEach(size_t count, const std::function<void(size_t)>& fn)
+{
+    if (nScriptCheckThreads && count > 1) {
+        // Checks of a block may run concurrently, or while a block is being
+        // connected; never wait for the queue in that case.
+        boost::unique_lock<boost::mutex> control(scriptcheckqueue.ControlMutex, boost::try_to_lock);
+        if (control.owns_lock()) {
+            scriptcheckqueue.ForEach(count, fn);
+            return;
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        fn(i);
+    }
+}
+
+/** ComputeMerkleRoot(), with the hashing of every level of the tree spread
+ *  over the script check threads. */
+static uint256 ParallelMerkleRoot(std::vector<uint256> hashes, bool* mutated)
+{
+    bool mutation = false;
+    std::vector<uint256> next;
+    while (hashes.size() > 1) {
+        for (size_t pos = 0; pos + 1 < hashes.size(); pos += 2) {
+            if (hashes[pos] == hashes[pos + 1]) mutation = true;
+        }
+        if (hashes.size() & 1) {
+            hashes.push_back(hashes.back());
+        }
+        const size_t pairs = hashes.size() / 2;
+        next.resize(pairs);
+        ParallelForEach((pairs + PARALLEL_MERKLE_BATCH - 1) / PARALLEL_MERKLE_BATCH, [&](size_t batch) {
+            const size_t begin = batch * PARALLEL_MERKLE_BATCH;
+            SHA256D64(next[begin].begin(), hashes[2 * begin].begin(), std::min(PARALLEL_MERKLE_BATCH, pairs - begin));
+        });
+        hashes.swap(next);
+    }
+    if (mutated) *mutated = mutation;
+    if (hashes.size() == 0) return uint256();
+    return hashes[0];
+}
+
+//! BlockMerkleRoot(), computed in parallel for large blocks.
+static uint256 ParallelBlockMerkleRoot(const CBlock& block, bool* mutated)
+{
+    if (block.vtx.size() < PARALLEL_CHECK_MIN_TXS) return BlockMerkleRoot(block, mutated);
+    std::vector<uint256> leaves(block.vtx.size());
+    for (size_t s = 0; s < block.vtx.size(); s++) {
+        leaves[s] = block.vtx[s]->GetHash();
+    }
+    return ParallelMerkleRoot(std::move(leaves), mutated);
+}
+
+//! BlockWitnessMerkleRoot(), computed in parallel for large blocks.
+static uint256 ParallelBlockWitnessMerkleRoot(const CBlock& block, bool* mutated)
+{
+    if (block.vtx.size() < PARALLEL_CHECK_MIN_TXS) return BlockWitnessMerkleRoot(block, mutated);
+    // Unlike txids, witness hashes are not cached, so compute them in parallel too.
+    std::vector<uint256> leaves(block.vtx.size());
+    ParallelForEach(block.vtx.size() - 1, [&](size_t i) {
+        leaves[i + 1] = block.vtx[i + 1]->GetWitnessHash();
+    });
+    return ParallelMerkleRoot(std::move(leaves), mutated);
+}
+
 static bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true)
 {
     // Check proof of work matches claimed amount
@@ -3092,7 +3366,7 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
     // Check the merkle root.
     if (fCheckMerkleRoot) {
         bool mutated;
-        uint256 hashMerkleRoot2 = BlockMerkleRoot(block, &mutated);
+        uint256 hashMerkleRoot2 = ParallelBlockMerkleRoot(block, &mutated);
         if (block.hashMerkleRoot != hashMerkleRoot2)
             return state.DoS(100, false, REJECT_INVALID, "bad-txnmrklroot", true, "hashMerkleRoot mismatch");
 
@@ -3121,15 +3395,36 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
             return state.DoS(100, false, REJECT_INVALID, "bad-cb-multiple", false, "more than one coinbase");
 
     // Check transactions
-    for (const auto& tx : block.vtx)
-        if (!CheckTransaction(*tx, state, true))
-            return state.Invalid(false, state.GetRejectCode(), state.GetRejectReason(),
-                                 strprintf("Transaction check failed (tx hash %s) %s", tx->GetHash().ToString(), state.GetDebugMessage()));
-
     unsigned int nSigOps = 0;
-    for (const auto& tx : block.vtx)
-    {
-        nSigOps += GetLegacySigOpCount(*tx);
+    if (block.vtx.size() >= PARALLEL_CHECK_MIN_TXS) {
+        // Check all transactions in parallel, then report the first failure
+        // in block order, so the result does not depend on scheduling.
+        std::vector<char> vTxOk(block.vtx.size());
+        std::vector<unsigned int> vTxSigOps(block.vtx.size());
+        ParallelForEach(block.vtx.size(), [&](size_t i) {
+            CValidationState txState;
+            vTxOk[i] = CheckTransaction(*block.vtx[i], txState, true);
+            vTxSigOps[i] = GetLegacySigOpCount(*block.vtx[i]);
+        });
+        for (size_t i = 0; i < block.vtx.size(); i++) {
+            if (!vTxOk[i]) {
+                const CTransaction& tx = *block.vtx[i];
+                CheckTransaction(tx, state, true);
+                return state.Invalid(false, state.GetRejectCode(), state.GetRejectReason(),
+                                     strprintf("Transaction check failed (tx hash %s) %s", tx.GetHash().ToString(), state.GetDebugMessage()));
+            }
+            nSigOps += vTxSigOps[i];
+        }
+    } else {
+        for (const auto& tx : block.vtx)
+            if (!CheckTransaction(*tx, state, true))
+                return state.Invalid(false, state.GetRejectCode(), state.GetRejectReason(),
+                                     strprintf("Transaction check failed (tx hash %s) %s", tx->GetHash().ToString(), state.GetDebugMessage()));
+
+        for (const auto& tx : block.vtx)
+        {
+            nSigOps += GetLegacySigOpCount(*tx);
+        }
     }
     if (nSigOps * WITNESS_SCALE_FACTOR > MAX_BLOCK_SIGOPS_COST)
         return state.DoS(100, false, REJECT_INVALID, "bad-blk-sigops", false, "out-of-bounds SigOpCount");
@@ -3306,7 +3601,7 @@ static bool ContextualCheckBlock(const CBlock& block, CValidationState& state, c
         int commitpos = GetWitnessCommitmentIndex(block);
         if (commitpos != -1) {
             bool malleated = false;
-            uint256 hashWitness = BlockWitnessMerkleRoot(block, &malleated);
+            uint256 hashWitness = ParallelBlockWitnessMerkleRoot(block, &malleated);
             // The malleation check is ignored; as the transaction tree itself
             // already does not permit it, it is impossible to trigger in the
             // witness tree.
@@ -3637,6 +3932,7 @@ void UnlinkPrunedFiles(const std::set<int>& setFilesToPrune)
 {
     for (std::set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
         CDiskBlockPos pos(*it, 0);
+        if (g_block_file_map) g_block_file_map->Erase(*it);
         fs::remove(GetBlockPosFilename(pos, "blk"));
         fs::remove(GetBlockPosFilename(pos, "rev"));
         LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
@@ -4344,10 +4640,83 @@ bool LoadGenesisBlock(const CChainParams& chainparams)
     return g_chainstate.LoadGenesisBlock(chainparams);
 }
 
+// Map of disk positions for blocks with unknown parent (only used for reindex)
+static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
+
+/** Accept a block read from a block file or external file, followed by any
+ *  earlier read blocks that were waiting for it as their parent. Returns
+ *  false if importing has to stop. */
+static bool ImportBlock(const CChainParams& chainparams, const std::shared_ptr<CBlock>& pblock, const uint256& hash, CDiskBlockPos* dbp, int& nLoaded)
+{
+    const CBlock& block = *pblock;
+    {
+        LOCK(cs_main);
+        // detect out of order blocks, and store them for later
+        if (hash != chainparams.GetConsensus().hashGenesisBlock && !LookupBlockIndex(block.hashPrevBlock)) {
+            LogPrint(BCLog::REINDEX, "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
+                    block.hashPrevBlock.ToString());
+            if (dbp)
+                mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
+            return true;
+        }
+
+        // process in case the block isn't known yet
+        CBlockIndex* pindex = LookupBlockIndex(hash);
+        if (!pindex || (pindex->nStatus & BLOCK_HAVE_DATA) == 0) {
+          CValidationState state;
+          if (g_chainstate.AcceptBlock(pblock, state, chainparams, nullptr, true, dbp, nullptr)) {
+              nLoaded++;
+          }
+          if (state.IsError()) {
+              return false;
+          }
+        } else if (hash != chainparams.GetConsensus().hashGenesisBlock && pindex->nHeight % 1000 == 0) {
+          LogPrint(BCLog::REINDEX, "Block Import: already had block %s at height %d\n", hash.ToString(), pindex->nHeight);
+        }
+    }
+
+    // Activate the genesis block so normal node progress can continue
+    if (hash == chainparams.GetConsensus().hashGenesisBlock) {
+        CValidationState state;
+        if (!ActivateBestChain(state, chainparams)) {
+            return false;
+        }
+    }
+
+    NotifyHeaderTip();
+
+    // Recursively process earlier encountered successors of this block
+    std::deque<uint256> queue;
+    queue.push_back(hash);
+    while (!queue.empty()) {
+        uint256 head = queue.front();
+        queue.pop_front();
+        std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
+        while (range.first != range.second) {
+            std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
+            std::shared_ptr<CBlock> pblockrecursive = std::make_shared<CBlock>();
+            if (ReadBlockFromDisk(*pblockrecursive, it->second, chainparams.GetConsensus()))
+            {
+                LogPrint(BCLog::REINDEX, "%s: Processing out of order child %s of %s\n", __func__, pblockrecursive->GetHash().ToString(),
+                        head.ToString());
+                LOCK(cs_main);
+                CValidationState dummy;
+                if (g_chainstate.AcceptBlock(pblockrecursive, dummy, chainparams, nullptr, true, &it->second, nullptr))
+                {
+                    nLoaded++;
+                    queue.push_back(pblockrecursive->GetHash());
+                }
+            }
+            range.first++;
+            mapBlocksUnknownParent.erase(it);
+            NotifyHeaderTip();
+        }
+    }
+    return true;
+}
+
 bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp)
 {
-    // Map of disk positions for blocks with unknown parent (only used for reindex)
-    static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
     int64_t nStart = GetTimeMillis();
 
     int nLoaded = 0;
@@ -4390,69 +4759,8 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
                 blkdat >> block;
                 nRewind = blkdat.GetPos();
 
-                uint256 hash = block.GetHash();
-                {
-                    LOCK(cs_main);
-                    // detect out of order blocks, and store them for later
-                    if (hash != chainparams.GetConsensus().hashGenesisBlock && !LookupBlockIndex(block.hashPrevBlock)) {
-                        LogPrint(BCLog::REINDEX, "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
-                                block.hashPrevBlock.ToString());
-                        if (dbp)
-                            mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
-                        continue;
-                    }
-
-                    // process in case the block isn't known yet
-                    CBlockIndex* pindex = LookupBlockIndex(hash);
-                    if (!pindex || (pindex->nStatus & BLOCK_HAVE_DATA) == 0) {
-                      CValidationState state;
-                      if (g_chainstate.AcceptBlock(pblock, state, chainparams, nullptr, true, dbp, nullptr)) {
-                          nLoaded++;
-                      }
-                      if (state.IsError()) {
-                          break;
-                      }
-                    } else if (hash != chainparams.GetConsensus().hashGenesisBlock && pindex->nHeight % 1000 == 0) {
-                      LogPrint(BCLog::REINDEX, "Block Import: already had block %s at height %d\n", hash.ToString(), pindex->nHeight);
-                    }
-                }
-
-                // Activate the genesis block so normal node progress can continue
-                if (hash == chainparams.GetConsensus().hashGenesisBlock) {
-                    CValidationState state;
-                    if (!ActivateBestChain(state, chainparams)) {
-                        break;
-                    }
-                }
-
-                NotifyHeaderTip();
-
-                // Recursively process earlier encountered successors of this block
-                std::deque<uint256> queue;
-                queue.push_back(hash);
-                while (!queue.empty()) {
-                    uint256 head = queue.front();
-                    queue.pop_front();
-                    std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
-                    while (range.first != range.second) {
-                        std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
-                        std::shared_ptr<CBlock> pblockrecursive = std::make_shared<CBlock>();
-                        if (ReadBlockFromDisk(*pblockrecursive, it->second, chainparams.GetConsensus()))
-                        {
-                            LogPrint(BCLog::REINDEX, "%s: Processing out of order child %s of %s\n", __func__, pblockrecursive->GetHash().ToString(),
-                                    head.ToString());
-                            LOCK(cs_main);
-                            CValidationState dummy;
-                            if (g_chainstate.AcceptBlock(pblockrecursive, dummy, chainparams, nullptr, true, &it->second, nullptr))
-                            {
-                                nLoaded++;
-                                queue.push_back(pblockrecursive->GetHash());
-                            }
-                        }
-                        range.first++;
-                        mapBlocksUnknownParent.erase(it);
-                        NotifyHeaderTip();
-                    }
+                if (!ImportBlock(chainparams, pblock, block.GetHash(), dbp, nLoaded)) {
+                    break;
                 }
             } catch (const std::exception& e) {
                 LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
@@ -4466,6 +4774,340 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
     return nLoaded > 0;
 }
 
+namespace {
+
+//! Amount of serialized block data the reindex pipeline reads ahead of the blocks being accepted
+static const size_t REINDEX_MAX_BYTES_IN_FLIGHT = 64 * 1024 * 1024;
+
+/** Counters behind GetReindexProgress(). */
+struct ReindexCounters {
+    std::atomic<bool> active{false};
+    std::atomic<int64_t> start_time{0};
+    std::atomic<int> file{0};
+    std::atomic<uint64_t> blocks_read{0};
+    std::atomic<uint64_t> bytes_read{0};
+    std::atomic<uint64_t> blocks_checked{0};
+    std::atomic<uint64_t> blocks_loaded{0};
+};
+ReindexCounters g_reindex_counters;
+
+/** Block read from a block file during -reindex. */
+struct ReindexBlock {
+    CDiskBlockPos pos;
+    std::vector<unsigned char> raw;  //!< Serialized block, released once deserialized
+    std::shared_ptr<CBlock> block;   //!< Deserialized block, null if that failed
+    uint256 hash;
+    std::string error;
+    bool ready = false;              //!< Whether a checker thread is done with this block
+};
+
+/**
+ * Reads the block files for -reindex in a pipeline.
+ *
+ * One thread scans the blk?????.dat files in order for serialized blocks,
+ * which are then deserialized, hashed and run through the context-free
+ * CheckBlock() by a pool of checker threads. Next() hands out the blocks in
+ * file order, so that they can be accepted exactly as a single-threaded
+ * scan would. Blocks that pass CheckBlock() are marked as checked, so
+ * AcceptBlock() does not check them again.
+ *
+ * A single-threaded scan that fails to deserialize a block continues
+ * scanning one byte after its header, as the block may be garbage hiding
+ * the start of a valid one. The reader cannot know that in advance, so it
+ * goes on after the block. When Next() hands out a block that failed, the
+ * blocks read after it are dropped and the reader starts again from there.
+ */
+class ReindexPipeline
+{
+public:
+    ReindexPipeline(const CChainParams& chainparams, int nCheckers) : m_chainparams(chainparams)
+    {
+        m_reader = std::thread(&ReindexPipeline::ThreadRead, this);
+        for (int i = 0; i < nCheckers; ++i) {
+            m_checkers.emplace_back(&ReindexPipeline::ThreadCheck, this);
+        }
+    }
+
+    ~ReindexPipeline()
+    {
+        {
+            LOCK(m_mutex);
+            m_stop = true;
+        }
+        m_cv.notify_all();
+        m_reader.join();
+        for (std::thread& thread : m_checkers) {
+            thread.join();
+        }
+    }
+
+    //! The next block in file order, or nullptr once all block files have been read.
+    std::shared_ptr<ReindexBlock> Next()
+    {
+        while (true) {
+            boost::this_thread::interruption_point();
+            WAIT_LOCK(m_mutex, lock);
+            if (!m_queue.empty() && m_queue.front()->ready) {
+                std::shared_ptr<ReindexBlock> item = std::move(m_queue.front());
+                m_queue.pop_front();
+                --m_next_check;
+                m_bytes_in_flight -= m_sizes.front();
+                m_sizes.pop_front();
+                if (!item->block) {
+                    // Rescan from just after the header of the failed block.
+                    // Checkers still working on dropped blocks hold their own
+                    // references to them.
+                    m_queue.clear();
+                    m_sizes.clear();
+                    m_next_check = 0;
+                    m_bytes_in_flight = 0;
+                    m_rescan_pos = CDiskBlockPos(item->pos.nFile, item->pos.nPos - 8 + 1);
+                    ++m_generation;
+                    m_read_done = false;
+                }
+                m_cv.notify_all();
+                return item;
+            }
+            if (m_queue.empty() && m_read_done) return nullptr;
+            m_cv.wait_for(lock, std::chrono::milliseconds(100));
+        }
+    }
+
+private:
+    //! Queue a block read by a scan started at the given generation. Returns
+    //! false if a rescan was requested since, in which case the block is dropped.
+    bool Push(std::shared_ptr<ReindexBlock> item, uint64_t generation)
+    {
+        const size_t nSize = item->raw.size();
+        WAIT_LOCK(m_mutex, lock);
+        while (!m_stop && m_generation == generation && !m_queue.empty() && m_bytes_in_flight + nSize > REINDEX_MAX_BYTES_IN_FLIGHT) {
+            m_cv.wait(lock);
+        }
+        if (m_generation != generation) return false;
+        m_queue.push_back(std::move(item));
+        m_sizes.push_back(nSize);
+        m_bytes_in_flight += nSize;
+        m_cv.notify_all();
+        return true;
+    }
+
+    bool Stopping()
+    {
+        LOCK(m_mutex);
+        return m_stop;
+    }
+
+    //! Whether the scan started at the given generation should stop.
+    bool Interrupted(uint64_t generation)
+    {
+        LOCK(m_mutex);
+        return m_stop || m_generation != generation;
+    }
+
+    /** Scan one block file for serialized blocks from position nStartPos on, the
+     *  same way LoadExternalBlockFile does. Returns false if it was interrupted. */
+    bool ReadFile(FILE* fileIn, int nFile, uint64_t nStartPos, uint64_t generation)
+    {
+        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor.
+        // Its positions are relative to nStartPos, where fileIn was opened.
+        CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION);
+        uint64_t nRewind = blkdat.GetPos();
+        while (!blkdat.eof()) {
+            if (Interrupted(generation)) return false;
+            blkdat.SetPos(nRewind);
+            nRewind++; // start one byte further next time, in case of failure
+            blkdat.SetLimit(); // remove former limit
+            unsigned int nSize = 0;
+            try {
+                // locate a header
+                unsigned char buf[CMessageHeader::MESSAGE_START_SIZE];
+                blkdat.FindByte(m_chainparams.MessageStart()[0]);
+                nRewind = blkdat.GetPos()+1;
+                blkdat >> buf;
+                if (memcmp(buf, m_chainparams.MessageStart(), CMessageHeader::MESSAGE_START_SIZE))
+                    continue;
+                // read size
+                blkdat >> nSize;
+                if (nSize < 80 || nSize > MAX_BLOCK_SERIALIZED_SIZE)
+                    continue;
+            } catch (const std::exception&) {
+                // no valid block header found; don't complain
+                break;
+            }
+            try {
+                // read the serialized block; it is deserialized by a checker,
+                // and scanning goes on after it unless that fails (see Next())
+                std::shared_ptr<ReindexBlock> item = std::make_shared<ReindexBlock>();
+                uint64_t nBlockPos = blkdat.GetPos();
+                item->pos = CDiskBlockPos(nFile, nStartPos + nBlockPos);
+                blkdat.SetLimit(nBlockPos + nSize);
+                blkdat.SetPos(nBlockPos);
+                item->raw.resize(nSize);
+                blkdat.read((char*)item->raw.data(), nSize);
+                nRewind = blkdat.GetPos();
+                g_reindex_counters.blocks_read++;
+                g_reindex_counters.bytes_read += nSize;
+                if (!Push(std::move(item), generation)) return false;
+            } catch (const std::exception& e) {
+                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+            }
+        }
+        return true;
+    }
+
+    void ThreadRead()
+    {
+        RenameThread("bitcoin-reindex");
+        CDiskBlockPos pos(0, 0);
+        uint64_t generation = 0;
+        while (true) {
+            bool fInterrupted = false;
+            try {
+                while (!fInterrupted) {
+                    if (!fs::exists(GetBlockPosFilename(pos, "blk")))
+                        break; // No block files left to reindex
+                    FILE *file = OpenBlockFile(pos, true);
+                    if (!file)
+                        break; // This error is logged in OpenBlockFile
+                    if (pos.nPos == 0) LogPrintf("Reindexing block file blk%05u.dat...\n", (unsigned int)pos.nFile);
+                    g_reindex_counters.file = pos.nFile;
+                    fInterrupted = !ReadFile(file, pos.nFile, pos.nPos, generation);
+                    pos = CDiskBlockPos(pos.nFile + 1, 0);
+                }
+            } catch (const std::runtime_error& e) {
+                AbortNode(std::string("System error: ") + e.what());
+            }
+
+            // Wait for a rescan to be requested, until the pipeline is stopped.
+            WAIT_LOCK(m_mutex, lock);
+            if (m_generation == generation) {
+                m_read_done = true;
+                m_cv.notify_all();
+            }
+            while (!m_stop && m_generation == generation) {
+                m_cv.wait(lock);
+            }
+            if (m_stop) return;
+            generation = m_generation;
+            pos = m_rescan_pos;
+        }
+    }
+
+    void ThreadCheck()
+    {
+        RenameThread("bitcoin-reindexchk");
+        while (true) {
+            std::shared_ptr<ReindexBlock> item;
+            {
+                WAIT_LOCK(m_mutex, lock);
+                while (!m_stop && m_next_check == m_queue.size()) {
+                    m_cv.wait(lock);
+                }
+                if (m_stop) return;
+                item = m_queue[m_next_check++];
+            }
+            try {
+                std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+                VectorReader(SER_DISK, CLIENT_VERSION, item->raw, 0, *pblock);
+                item->hash = pblock->GetHash();
+                // The result is remembered in fChecked; failures are reported
+                // (and the block marked invalid) when it is accepted.
+                CValidationState state;
+                CheckBlock(*pblock, state, m_chainparams.GetConsensus());
+                item->block = std::move(pblock);
+                g_reindex_counters.blocks_checked++;
+            } catch (const std::exception& e) {
+                item->error = e.what();
+            }
+            std::vector<unsigned char>().swap(item->raw);
+            {
+                LOCK(m_mutex);
+                item->ready = true;
+            }
+            m_cv.notify_all();
+        }
+    }
+
+    const CChainParams& m_chainparams;
+
+    Mutex m_mutex;
+    std::condition_variable m_cv;
+    //! Blocks read and not yet handed out, in file order
+    std::deque<std::shared_ptr<ReindexBlock>> m_queue;
+    //! Serialized sizes of the blocks in m_queue
+    std::deque<size_t> m_sizes;
+    //! Index in m_queue of the first block no checker has picked up yet
+    size_t m_next_check = 0;
+    size_t m_bytes_in_flight = 0;
+    bool m_read_done = false;
+    bool m_stop = false;
+    //! Incremented whenever the reader has to rescan from m_rescan_pos
+    uint64_t m_generation = 0;
+    CDiskBlockPos m_rescan_pos;
+
+    std::thread m_reader;
+    std::vector<std::thread> m_checkers;
+};
+
+} // namespace
+
+void ReindexBlockFiles(const CChainParams& chainparams)
+{
+    g_reindex_counters.start_time = GetTimeMillis();
+    g_reindex_counters.file = 0;
+    g_reindex_counters.blocks_read = 0;
+    g_reindex_counters.bytes_read = 0;
+    g_reindex_counters.blocks_checked = 0;
+    g_reindex_counters.blocks_loaded = 0;
+    g_reindex_counters.active = true;
+
+    int nLoaded = 0;
+    {
+        ReindexPipeline pipeline(chainparams, std::max(nScriptCheckThreads, 1));
+        int64_t nLastLog = GetTimeMillis();
+        while (std::shared_ptr<ReindexBlock> item = pipeline.Next()) {
+            if (!item->block) {
+                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, item->error);
+                continue;
+            }
+            try {
+                if (!ImportBlock(chainparams, item->block, item->hash, &item->pos, nLoaded)) {
+                    break;
+                }
+            } catch (const std::exception& e) {
+                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+            }
+            g_reindex_counters.blocks_loaded = nLoaded;
+            if (GetTimeMillis() - nLastLog > 10000) {
+                nLastLog = GetTimeMillis();
+                ReindexProgress progress = GetReindexProgress();
+                LogPrintf("Reindex progress: blk%05u.dat, %u blocks read, %u loaded, %.1f blocks/s, %.1f MiB/s\n",
+                    progress.nFile, progress.nBlocksRead, progress.nBlocksLoaded, progress.dBlocksPerSecond, progress.dMiBPerSecond);
+            }
+        }
+    }
+
+    ReindexProgress progress = GetReindexProgress();
+    LogPrintf("Reindexed %u blocks (%.1f MiB) in %.1fs, %.1f blocks/s, %.1f MiB/s\n", progress.nBlocksRead, progress.nBytesRead / 1048576.0,
+        progress.dElapsed, progress.dBlocksPerSecond, progress.dMiBPerSecond);
+    g_reindex_counters.active = false;
+}
+
+ReindexProgress GetReindexProgress()
+{
+    ReindexProgress progress;
+    progress.fActive = g_reindex_counters.active;
+    progress.nFile = g_reindex_counters.file;
+    progress.nBlocksRead = g_reindex_counters.blocks_read;
+    progress.nBytesRead = g_reindex_counters.bytes_read;
+    progress.nBlocksChecked = g_reindex_counters.blocks_checked;
+    progress.nBlocksLoaded = g_reindex_counters.blocks_loaded;
+    progress.dElapsed = std::max<int64_t>(GetTimeMillis() - g_reindex_counters.start_time, 1) / 1000.0;
+    progress.dBlocksPerSecond = progress.nBlocksRead / progress.dElapsed;
+    progress.dMiBPerSecond = progress.nBytesRead / 1048576.0 / progress.dElapsed;
+    return progress;
+}
+
 void CChainState::CheckBlockIndex(const Consensus::Params& consensusParams)
 {
     if (!fCheckBlockIndex) {
@@ -4681,88 +5323,278 @@ int VersionBitsTipStateSinceHeight(const Consensus::Params& params, Consensus::D
 }
 
 static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+static const uint64_t MEMPOOL_JOURNAL_VERSION = 1;
 
-bool LoadMempool()
-{
-    const CChainParams& chainparams = Params();
-    int64_t nExpiryTimeout = gArgs.GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60;
-    FILE* filestr = fsbridge::fopen(GetDataDir() / "mempool.dat", "rb");
-    CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
-    if (file.IsNull()) {
-        LogPrintf("Failed to open mempool file from disk. Continuing anyway.\n");
-        return false;
-    }
+static fs::path MempoolJournalPath() { return GetDataDir() / "mempool.journal"; }
+static fs::path MempoolJournalOldPath() { return GetDataDir() / "mempool.journal.old"; }
+
+namespace {
 
+/** Adds transactions read from disk to the mempool in batches, so that their
+ *  scripts are verified in parallel on the script check threads, and cs_main
+ *  is free in between batches for the rest of the node, e.g. relay. */
+class MempoolLoader
+{
+public:
     int64_t count = 0;
     int64_t expired = 0;
     int64_t failed = 0;
     int64_t already_there = 0;
-    int64_t nNow = GetTime();
 
+    MempoolLoader() : m_expiry_timeout(gArgs.GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60), m_now(GetTime()) {}
+
+    void Add(const CTransactionRef& tx, int64_t nTime, int64_t nFeeDelta)
+    {
+        CAmount amountdelta = nFeeDelta;
+        if (amountdelta) {
+            mempool.PrioritiseTransaction(tx->GetHash(), amountdelta);
+        }
+        if (nTime + m_expiry_timeout <= m_now) {
+            ++expired;
+            return;
+        }
+        m_txs.push_back(tx);
+        m_times.push_back(nTime);
+        if (m_txs.size() >= MEMPOOL_LOAD_BATCH_SIZE) Flush();
+    }
+
+    void Flush()
+    {
+        if (m_txs.empty()) return;
+        std::vector<MempoolAcceptResult> results;
+        {
+            LOCK(cs_main);
+            results = AcceptToMemoryPoolBatch(mempool, m_txs, false /* bypass_limits */, 0 /* nAbsurdFee */, &m_times);
+        }
+        for (size_t i = 0; i < m_txs.size(); i++) {
+            if (results[i].accepted) {
+                ++count;
+            } else if (mempool.exists(m_txs[i]->GetHash())) {
+                // mempool may contain the transaction already, e.g. from
+                // wallet(s) or peers having added it while we were processing
+                // mempool transactions, or from an earlier journal record;
+                // consider these as valid, instead of failed, but mark them
+                // as 'already there'
+                ++already_there;
+            } else {
+                ++failed;
+            }
+        }
+        m_txs.clear();
+        m_times.clear();
+    }
+
+private:
+    const int64_t m_expiry_timeout;
+    const int64_t m_now;
+    std::vector<CTransactionRef> m_txs;
+    std::vector<int64_t> m_times;
+};
+
+/** Appends every transaction that enters the mempool to mempool.journal, so
+ *  that the mempool survives an unclean shutdown without being dumped in full
+ *  every time it changes. DumpMempool moves the journal aside before taking its
+ *  snapshot and deletes it once the dump is on disk. */
+class MempoolJournal final : public CValidationInterface
+{
+public:
+    ~MempoolJournal()
+    {
+        if (m_file) fclose(m_file);
+    }
+
+    void Start()
+    {
+        {
+            LOCK(m_cs);
+            if (m_started) return;
+            m_started = true;
+            Open();
+        }
+        RegisterValidationInterface(this);
+    }
+
+    void Stop()
+    {
+        UnregisterValidationInterface(this);
+        LOCK(m_cs);
+        m_started = false;
+        Close();
+    }
+
+    /** Move the journal to mempool.journal.old, continuing in an empty one. */
+    void Rotate()
+    {
+        LOCK(m_cs);
+        Close();
+        if (fs::exists(MempoolJournalPath()) && !RenameOver(MempoolJournalPath(), MempoolJournalOldPath())) {
+            LogPrintf("Failed to rotate mempool journal\n");
+        }
+        if (m_started) Open();
+    }
+
+    uint64_t Size()
+    {
+        LOCK(m_cs);
+        return m_file ? m_size : 0;
+    }
+
+protected:
+    void TransactionAddedToMempool(const CTransactionRef& ptx) override
+    {
+        // The transaction may have left the mempool again by now, in which case
+        // there is nothing to persist.
+        TxMempoolInfo info = mempool.info(ptx->GetHash());
+        if (!info.tx) return;
+        CDataStream record(SER_DISK, CLIENT_VERSION);
+        record << *info.tx << (int64_t)info.nTime << (int64_t)info.nFeeDelta;
+
+        LOCK(m_cs);
+        if (!m_file) return;
+        if (fwrite(record.data(), 1, record.size(), m_file) != record.size() || fflush(m_file) != 0) {
+            LogPrintf("Failed to write to mempool journal, disabling it until the next mempool dump\n");
+            Close();
+            return;
+        }
+        m_size += record.size();
+    }
+
+private:
+    CCriticalSection m_cs;
+    bool m_started GUARDED_BY(m_cs) = false;
+    FILE* m_file GUARDED_BY(m_cs) = nullptr;
+    uint64_t m_size GUARDED_BY(m_cs) = 0;
+
+    void Open() EXCLUSIVE_LOCKS_REQUIRED(m_cs)
+    {
+        m_file = fsbridge::fopen(MempoolJournalPath(), "ab");
+        if (!m_file) {
+            LogPrintf("Failed to open mempool journal %s\n", MempoolJournalPath().string());
+            return;
+        }
+        fseek(m_file, 0, SEEK_END);
+        long pos = ftell(m_file);
+        m_size = pos > 0 ? pos : 0;
+        if (m_size == 0) {
+            CDataStream header(SER_DISK, CLIENT_VERSION);
+            header << MEMPOOL_JOURNAL_VERSION;
+            if (fwrite(header.data(), 1, header.size(), m_file) != header.size() || fflush(m_file) != 0) {
+                LogPrintf("Failed to write mempool journal header\n");
+                Close();
+                return;
+            }
+            m_size = header.size();
+        }
+    }
+
+    void Close() EXCLUSIVE_LOCKS_REQUIRED(m_cs)
+    {
+        if (m_file) fclose(m_file);
+        m_file = nullptr;
+    }
+};
+
+MempoolJournal g_mempool_journal;
+
+} // namespace
+
+/** Feed the records of a mempool journal to the loader. Returns whether the journal was found. */
+static bool ReplayMempoolJournal(const fs::path& path, MempoolLoader& loader)
+{
+    CAutoFile file(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) return false;
+
+    int64_t records = 0;
     try {
         uint64_t version;
         file >> version;
-        if (version != MEMPOOL_DUMP_VERSION) {
+        if (version != MEMPOOL_JOURNAL_VERSION) {
+            LogPrintf("Unknown mempool journal version %u in %s. Continuing anyway.\n", version, path.string());
             return false;
         }
-        uint64_t num;
-        file >> num;
-        while (num--) {
+        while (!ShutdownRequested()) {
             CTransactionRef tx;
             int64_t nTime;
             int64_t nFeeDelta;
             file >> tx;
             file >> nTime;
             file >> nFeeDelta;
+            loader.Add(tx, nTime, nFeeDelta);
+            ++records;
+        }
+    } catch (const std::exception& e) {
+        // The journal is only ever appended to, so reading ends at the end of
+        // the file, or at a last record cut short by an unclean shutdown.
+    }
+    LogPrint(BCLog::MEMPOOL, "Replayed %i records of mempool journal %s\n", records, path.string());
+    return true;
+}
 
-            CAmount amountdelta = nFeeDelta;
-            if (amountdelta) {
-                mempool.PrioritiseTransaction(tx->GetHash(), amountdelta);
+bool LoadMempool()
+{
+    MempoolLoader loader;
+    bool loaded = false;
+
+    FILE* filestr = fsbridge::fopen(GetDataDir() / "mempool.dat", "rb");
+    CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        LogPrintf("Failed to open mempool file from disk. Continuing anyway.\n");
+    } else {
+        try {
+            uint64_t version;
+            file >> version;
+            if (version != MEMPOOL_DUMP_VERSION) {
+                throw std::runtime_error(strprintf("unknown version %u", version));
             }
-            CValidationState state;
-            if (nTime + nExpiryTimeout > nNow) {
-                LOCK(cs_main);
-                AcceptToMemoryPoolWithTime(chainparams, mempool, state, tx, nullptr /* pfMissingInputs */, nTime,
-                                           nullptr /* plTxnReplaced */, false /* bypass_limits */, 0 /* nAbsurdFee */,
-                                           false /* test_accept */);
-                if (state.IsValid()) {
-                    ++count;
-                } else {
-                    // mempool may contain the transaction already, e.g. from
-                    // wallet(s) having loaded it while we were processing
-                    // mempool transactions; consider these as valid, instead of
-                    // failed, but mark them as 'already there'
-                    if (mempool.exists(tx->GetHash())) {
-                        ++already_there;
-                    } else {
-                        ++failed;
-                    }
-                }
-            } else {
-                ++expired;
+            uint64_t num;
+            file >> num;
+            while (num--) {
+                CTransactionRef tx;
+                int64_t nTime;
+                int64_t nFeeDelta;
+                file >> tx;
+                file >> nTime;
+                file >> nFeeDelta;
+                loader.Add(tx, nTime, nFeeDelta);
+                if (ShutdownRequested())
+                    return false;
             }
-            if (ShutdownRequested())
-                return false;
-        }
-        std::map<uint256, CAmount> mapDeltas;
-        file >> mapDeltas;
+            std::map<uint256, CAmount> mapDeltas;
+            file >> mapDeltas;
 
-        for (const auto& i : mapDeltas) {
-            mempool.PrioritiseTransaction(i.first, i.second);
+            for (const auto& i : mapDeltas) {
+                mempool.PrioritiseTransaction(i.first, i.second);
+            }
+            loaded = true;
+        } catch (const std::exception& e) {
+            LogPrintf("Failed to deserialize mempool data on disk: %s. Continuing anyway.\n", e.what());
         }
-    } catch (const std::exception& e) {
-        LogPrintf("Failed to deserialize mempool data on disk: %s. Continuing anyway.\n", e.what());
-        return false;
     }
 
-    LogPrintf("Imported mempool transactions from disk: %i succeeded, %i failed, %i expired, %i already there\n", count, failed, expired, already_there);
-    return true;
+    // Transactions that entered the mempool after the dump was taken. A journal
+    // moved aside by a dump that did not complete comes first.
+    loaded |= ReplayMempoolJournal(MempoolJournalOldPath(), loader);
+    loaded |= ReplayMempoolJournal(MempoolJournalPath(), loader);
+    if (ShutdownRequested())
+        return false;
+    loader.Flush();
+
+    LogPrintf("Imported mempool transactions from disk: %i succeeded, %i failed, %i expired, %i already there\n", loader.count, loader.failed, loader.expired, loader.already_there);
+    return loaded;
 }
 
 bool DumpMempool()
 {
+    // Dumps from the RPC, the journal compaction and shutdown must not interleave.
+    static CCriticalSection cs_dump;
+    LOCK(cs_dump);
+
     int64_t start = GetTimeMicros();
 
+    // Everything journaled so far is in the mempool at the time of the snapshot
+    // below, unless it has left it since; later additions go to a new journal.
+    g_mempool_journal.Rotate();
+
     std::map<uint256, CAmount> mapDeltas;
     std::vector<TxMempoolInfo> vinfo;
 
@@ -4800,6 +5632,7 @@ bool DumpMempool()
             throw std::runtime_error("FileCommit failed");
         file.fclose();
         RenameOver(GetDataDir() / "mempool.dat.new", GetDataDir() / "mempool.dat");
+        fs::remove(MempoolJournalOldPath());
         int64_t last = GetTimeMicros();
         LogPrintf("Dumped mempool: %gs to copy, %gs to dump\n", (mid-start)*MICRO, (last-mid)*MICRO);
     } catch (const std::exception& e) {
@@ -4809,6 +5642,120 @@ bool DumpMempool()
     return true;
 }
 
+void StartMempoolJournal()
+{
+    g_mempool_journal.Start();
+}
+
+void StopMempoolJournal()
+{
+    g_mempool_journal.Stop();
+}
+
+void CompactMempoolJournal()
+{
+    uint64_t size = g_mempool_journal.Size();
+    if (size > MEMPOOL_JOURNAL_COMPACT_SIZE) {
+        LogPrint(BCLog::MEMPOOL, "Mempool journal has grown to %u bytes, dumping mempool\n", size);
+        DumpMempool();
+    }
+}
+
+static const uint64_t SIGCACHE_DUMP_VERSION = 1;
+
+bool LoadSignatureCaches()
+{
+    int64_t start = GetTimeMicros();
+    FILE* filestr = fsbridge::fopen(GetDataDir() / "sigcache.dat", "rb");
+    CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        LogPrintf("Failed to open signature cache file from disk. Continuing anyway.\n");
+        return false;
+    }
+
+    uint256 sigNonce, scriptNonce;
+    std::vector<uint256> sigEntries, scriptEntries;
+    try {
+        // Entries are only meaningful together with the nonce they were
+        // computed with, so a corrupted file must not be used at all.
+        CHashVerifier<CAutoFile> verifier(&file);
+        uint64_t version;
+        verifier >> version;
+        if (version != SIGCACHE_DUMP_VERSION) {
+            return false;
+        }
+        CMessageHeader::MessageStartChars pchMessageStart;
+        verifier >> pchMessageStart;
+        if (memcmp(pchMessageStart, Params().MessageStart(), sizeof(pchMessageStart))) {
+            LogPrintf("Signature cache file is for a different network. Continuing anyway.\n");
+            return false;
+        }
+        verifier >> sigNonce >> sigEntries >> scriptNonce >> scriptEntries;
+        uint256 hash;
+        file >> hash;
+        if (hash != verifier.GetHash()) {
+            LogPrintf("Signature cache file is corrupted. Continuing anyway.\n");
+            return false;
+        }
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to deserialize signature cache data on disk: %s. Continuing anyway.\n", e.what());
+        return false;
+    }
+
+    LoadSignatureCache(sigNonce, sigEntries);
+    {
+        LOCK(cs_main);
+        scriptExecutionCacheNonce = scriptNonce;
+        for (const uint256& entry : scriptEntries) {
+            scriptExecutionCache.insert(entry);
+        }
+    }
+    LogPrintf("Imported %u signature cache and %u script execution cache entries from disk in %gs\n", sigEntries.size(), scriptEntries.size(), (GetTimeMicros() - start) * MICRO);
+    return true;
+}
+
+bool DumpSignatureCaches()
+{
+    int64_t start = GetTimeMicros();
+
+    uint256 sigNonce, scriptNonce;
+    std::vector<uint256> sigEntries, scriptEntries;
+    DumpSignatureCache(sigNonce, sigEntries);
+    {
+        LOCK(cs_main);
+        scriptNonce = scriptExecutionCacheNonce;
+        scriptExecutionCache.for_each([&scriptEntries](const uint256& entry) { scriptEntries.push_back(entry); });
+    }
+
+    int64_t mid = GetTimeMicros();
+
+    try {
+        FILE* filestr = fsbridge::fopen(GetDataDir() / "sigcache.dat.new", "wb");
+        if (!filestr) {
+            return false;
+        }
+
+        CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+        CHashWriter hasher(SER_DISK, CLIENT_VERSION);
+
+        uint64_t version = SIGCACHE_DUMP_VERSION;
+        file << version << Params().MessageStart() << sigNonce << sigEntries << scriptNonce << scriptEntries;
+        hasher << version << Params().MessageStart() << sigNonce << sigEntries << scriptNonce << scriptEntries;
+        file << hasher.GetHash();
+
+        if (!FileCommit(file.Get()))
+            throw std::runtime_error("FileCommit failed");
+        file.fclose();
+        RenameOver(GetDataDir() / "sigcache.dat.new", GetDataDir() / "sigcache.dat");
+        int64_t last = GetTimeMicros();
+        LogPrintf("Dumped %u signature cache and %u script execution cache entries: %gs to copy, %gs to dump\n", sigEntries.size(), scriptEntries.size(), (mid-start)*MICRO, (last-mid)*MICRO);
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to dump signature cache: %s. Continuing anyway.\n", e.what());
+        return false;
+    }
+    return true;
+}
+
 //! Guess how far we are in the verification process at the given block index
 //! require cs_main if pindex has not been validated yet (because nChainTx might be unset)
 double GuessVerificationProgress(const ChainTxData& data, const CBlockIndex *pindex) {
@@ -12,10 +12,12 @@
 
 #include <amount.h>
 #include <coins.h>
+#include <consensus/validation.h>
 #include <fs.h>
 #include <protocol.h> // For CMessageHeader::MessageStartChars
 #include <policy/feerate.h>
 #include <script/script_error.h>
+#include <span.h>
 #include <sync.h>
 #include <versionbits.h>
 
@@ -37,10 +39,10 @@ class CChainParams;
 class CCoinsViewDB;
 class CInv;
 class CConnman;
+class MappedFile;
 class CScriptCheck;
 class CBlockPolicyEstimator;
 class CTxMemPool;
-class CValidationState;
 struct ChainTxData;
 
 struct PrecomputedTransactionData;
@@ -102,6 +104,8 @@ static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
 static const unsigned int DATABASE_WRITE_INTERVAL = 60 * 60;
 /** Time to wait (in seconds) between flushing chainstate to disk. */
 static const unsigned int DATABASE_FLUSH_INTERVAL = 24 * 60 * 60;
+/** Percentage of the coins cache budget that stays in use after flushing chainstate to disk. */
+static const unsigned int COINS_CACHE_RETAIN_PERCENT = 50;
 /** Maximum length of reject messages. */
 static const unsigned int MAX_REJECT_MESSAGE_LENGTH = 111;
 /** Block download timeout base, expressed in millionths of the block interval (i.e. 10 min) */
@@ -117,9 +121,21 @@ static const int64_t MAX_FEE_ESTIMATION_TIP_AGE = 3 * 60 * 60;
 static const bool DEFAULT_PERMIT_BAREMULTISIG = true;
 static const bool DEFAULT_CHECKPOINTS_ENABLED = true;
 static const bool DEFAULT_TXINDEX = false;
+/** Default for -blockmmapfiles, the number of block files kept memory mapped (only on 64-bit platforms) */
+static const unsigned int DEFAULT_BLOCK_MMAP_FILES = sizeof(void*) >= 8 ? 16 : 0;
+/** Default for -dbasyncflush, writing the chainstate in the background on periodic flushes */
+static const bool DEFAULT_ASYNC_COINS_FLUSH = true;
 static const unsigned int DEFAULT_BANSCORE_THRESHOLD = 100;
 /** Default for -persistmempool */
 static const bool DEFAULT_PERSIST_MEMPOOL = true;
+/** Number of transactions read from disk that are added to the mempool at once while loading it */
+static const unsigned int MEMPOOL_LOAD_BATCH_SIZE = 64;
+/** Size in bytes past which the mempool journal is folded into a new mempool dump */
+static const uint64_t MEMPOOL_JOURNAL_COMPACT_SIZE = 32 * 1024 * 1024;
+/** Interval in seconds between checks of the mempool journal size */
+static const int64_t MEMPOOL_JOURNAL_CHECK_INTERVAL = 10 * 60;
+/** Default for -persistsigcache */
+static const bool DEFAULT_PERSIST_SIGCACHE = true;
 /** Default for -mempoolreplacement */
 static const bool DEFAULT_ENABLE_REPLACEMENT = true;
 /** Default for using fee filter */
@@ -161,6 +177,7 @@ extern bool fIsBareMultisigStd;
 extern bool fRequireStandard;
 extern bool fCheckBlockIndex;
 extern bool fCheckpointsEnabled;
+extern bool g_async_coins_flush;
 extern size_t nCoinCacheUsage;
 /** A fee rate smaller than this is considered zero fee (for relaying, mining and transaction creation) */
 extern CFeeRate minRelayTxFee;
@@ -251,6 +268,26 @@ FILE* OpenBlockFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 fs::path GetBlockPosFilename(const CDiskBlockPos &pos, const char *prefix);
 /** Import blocks from an external file */
 bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp = nullptr);
+/** Import all blocks from the block files (blk?????.dat), for -reindex. Blocks
+ *  are read, deserialized and checked by worker threads (one per -par script
+ *  verification thread), and accepted in file order on the calling thread. */
+void ReindexBlockFiles(const CChainParams& chainparams);
+
+/** Progress and throughput of ReindexBlockFiles() */
+struct ReindexProgress
+{
+    bool fActive;             //!< Whether a reindex is running
+    int nFile;                //!< Block file being read
+    uint64_t nBlocksRead;     //!< Blocks read from the block files so far
+    uint64_t nBytesRead;      //!< Serialized size of those blocks
+    uint64_t nBlocksChecked;  //!< Blocks deserialized and checked
+    uint64_t nBlocksLoaded;   //!< Blocks accepted into the block index
+    double dElapsed;          //!< Seconds since the reindex started
+    double dBlocksPerSecond;  //!< Blocks read per second
+    double dMiBPerSecond;     //!< MiB read per second
+};
+/** Get the progress of the current (or last) reindex */
+ReindexProgress GetReindexProgress();
 /** Ensures we have a genesis block in the block tree, possibly writing one to disk. */
 bool LoadGenesisBlock(const CChainParams& chainparams);
 /** Load the block tree and coins database from disk,
@@ -304,6 +341,23 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
                         bool* pfMissingInputs, std::list<CTransactionRef>* plTxnReplaced,
                         bool bypass_limits, const CAmount nAbsurdFee, bool test_accept=false) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
+/** Outcome of adding one transaction of a batch to the memory pool. */
+struct MempoolAcceptResult {
+    CValidationState state;
+    bool accepted = false;
+    bool missing_inputs = false;
+};
+
+/** (try to) add a batch of transactions to memory pool, in order
+ * Transactions may spend outputs of earlier transactions in the batch. The
+ * scripts of all transactions are verified in parallel on the script check
+ * threads first, after which the transactions are accepted one by one without
+ * releasing the locks. Returns one result per transaction. If accept_times is
+ * given, it holds the time each transaction entered the memory pool instead of
+ * the current time. **/
+std::vector<MempoolAcceptResult> AcceptToMemoryPoolBatch(CTxMemPool& pool, const std::vector<CTransactionRef>& txs,
+                        bool bypass_limits, const CAmount nAbsurdFee, const std::vector<int64_t>* accept_times = nullptr) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
 /** Convert CValidationState to a human-readable message for logging */
 std::string FormatStateMessage(const CValidationState &state);
 
@@ -388,11 +442,25 @@ public:
 void InitScriptExecutionCache();
 
 
+/** A block as serialized on disk. When block files are memory mapped (see
+ *  -blockmmapfiles), data points into the mapped file, which is kept mapped
+ *  for as long as this object exists. Otherwise data points into buffer. */
+struct CRawBlock
+{
+    std::shared_ptr<const MappedFile> file;
+    std::vector<uint8_t> buffer;
+    Span<const uint8_t> data;
+};
+
 /** Functions for disk access for blocks */
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
 bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& message_start);
 bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& message_start);
+bool ReadRawBlockFromDisk(CRawBlock& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& message_start);
+
+/** Keep up to max_files block files memory mapped for block reads (0 disables mapping). */
+void InitBlockFileMap(size_t max_files);
 
 /** Functions for validating blocks and updating the block tree */
 
@@ -488,12 +556,27 @@ static const unsigned int REJECT_HIGHFEE = 0x100;
 /** Get block file info entry for one block file */
 CBlockFileInfo* GetBlockFileInfo(size_t n);
 
-/** Dump the mempool to disk. */
+/** Dump the mempool to disk, and discard the journal entries it replaces. */
 bool DumpMempool();
 
-/** Load the mempool from disk. */
+/** Load the mempool from disk, replaying the journal after the last dump. */
 bool LoadMempool();
 
+/** Start appending transactions that enter the mempool to the mempool journal. */
+void StartMempoolJournal();
+
+/** Stop appending to the mempool journal. */
+void StopMempoolJournal();
+
+/** Dump the mempool if its journal has grown past MEMPOOL_JOURNAL_COMPACT_SIZE. */
+void CompactMempoolJournal();
+
+/** Dump the signature and script execution caches to disk. */
+bool DumpSignatureCaches();
+
+/** Load the signature and script execution caches from disk. */
+bool LoadSignatureCaches();
+
 //! Check whether the block associated with this index entry is pruned or not.
 inline bool IsBlockPruned(const CBlockIndex* pblockindex)
 {
@@ -0,0 +1,130 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Measure the bandwidth of transaction announcements with -txreconciliation.
+
+Relay the same number of transactions through a small network of nodes,
+first announcing them by inv only and then by reconciliation. Report the
+bytes sent per message type in both runs, and check that reconciliation
+announced every transaction with fewer bytes.
+"""
+
+import random
+import time
+
+from test_framework.address import script_to_p2wsh
+from test_framework.messages import COIN, COutPoint, CTransaction, CTxIn, CTxInWitness, CTxOut, sha256, ToHex
+from test_framework.script import CScript, OP_TRUE
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal, connect_nodes, sync_blocks, sync_mempools
+
+ANNOUNCEMENT_MESSAGES = ['inv', 'sendrecon', 'reqrecon', 'sketch', 'reconcildiff']
+RELAY_MESSAGES = ANNOUNCEMENT_MESSAGES + ['getdata', 'tx']
+
+# Transactions relayed in each run, and the delay between them
+TXS_PER_RUN = 200
+TX_INTERVAL = 0.05
+
+FEE = 10000
+
+class TxReconciliationTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 8
+
+    def setup_network(self):
+        self.setup_nodes()
+        self.connect_mesh()
+
+    def connect_mesh(self):
+        # Every node makes three outbound connections and accepts three inbound
+        # ones. Inv flooding wastes more the more peers a node has.
+        for i in range(self.num_nodes):
+            for j in range(1, 4):
+                connect_nodes(self.nodes[i], (i + j) % self.num_nodes)
+
+    def spend(self, outpoint, value):
+        tx = CTransaction()
+        tx.vin.append(CTxIn(outpoint))
+        tx.vout.append(CTxOut(value - FEE, self.script_pubkey))
+        tx.wit.vtxinwit.append(CTxInWitness())
+        tx.wit.vtxinwit[0].scriptWitness.stack = [self.script]
+        tx.rehash()
+        return tx
+
+    def fan_out(self, node, coinbase_txid, outputs):
+        tx = CTransaction()
+        tx.vin.append(CTxIn(COutPoint(int(coinbase_txid, 16), 0)))
+        value = (50 * COIN - FEE) // outputs
+        for _ in range(outputs):
+            tx.vout.append(CTxOut(value, self.script_pubkey))
+        tx.wit.vtxinwit.append(CTxInWitness())
+        tx.wit.vtxinwit[0].scriptWitness.stack = [self.script]
+        tx.rehash()
+        node.sendrawtransaction(ToHex(tx))
+        return [(COutPoint(tx.sha256, i), value) for i in range(outputs)]
+
+    def relay_stats(self):
+        stats = dict.fromkeys(RELAY_MESSAGES, 0)
+        for node in self.nodes:
+            for peer in node.getpeerinfo():
+                for msg in RELAY_MESSAGES:
+                    stats[msg] += peer['bytessent_per_msg'].get(msg, 0)
+        return stats
+
+    def relay_run(self, utxos):
+        before = self.relay_stats()
+        start = time.time()
+        for outpoint, value in utxos:
+            # Enter each transaction at a different node, the others hear of it from their peers
+            self.nodes[random.randrange(self.num_nodes)].sendrawtransaction(ToHex(self.spend(outpoint, value)))
+            time.sleep(TX_INTERVAL)
+        sync_mempools(self.nodes, timeout=120)
+        duration = time.time() - start
+        after = self.relay_stats()
+        for node in self.nodes:
+            assert_equal(node.getmempoolinfo()['size'], len(utxos))
+        return {msg: after[msg] - before[msg] for msg in RELAY_MESSAGES}, duration
+
+    def run_test(self):
+        random.seed(1)
+        self.script = CScript([OP_TRUE])
+        self.script_pubkey = CScript([0, sha256(self.script)])
+        address = script_to_p2wsh(self.script)
+
+        self.log.info("Mine coins to spend")
+        self.nodes[0].generatetoaddress(102, address)
+        coinbases = [self.nodes[0].getblock(self.nodes[0].getblockhash(h))['tx'][0] for h in (1, 2)]
+        sync_blocks(self.nodes)
+
+        # Each run spends the outputs of one fan out transaction
+        utxos = [self.fan_out(self.nodes[0], txid, TXS_PER_RUN) for txid in coinbases]
+        self.nodes[0].generatetoaddress(1, address)
+        sync_blocks(self.nodes)
+
+        self.log.info("Relay %d transactions by inv", TXS_PER_RUN)
+        inv_stats, inv_duration = self.relay_run(utxos[0])
+        self.nodes[0].generatetoaddress(1, address)
+        sync_blocks(self.nodes)
+
+        self.log.info("Relay %d transactions by reconciliation", TXS_PER_RUN)
+        for i in range(self.num_nodes):
+            self.restart_node(i, extra_args=['-txreconciliation'])
+        self.connect_mesh()
+        recon_stats, recon_duration = self.relay_run(utxos[1])
+
+        self.log.info("Bytes sent by all nodes:")
+        self.log.info("  %-12s %10s %10s", "message", "inv", "recon")
+        for msg in RELAY_MESSAGES:
+            self.log.info("  %-12s %10d %10d", msg, inv_stats[msg], recon_stats[msg])
+        inv_announced = sum(inv_stats[msg] for msg in ANNOUNCEMENT_MESSAGES)
+        recon_announced = sum(recon_stats[msg] for msg in ANNOUNCEMENT_MESSAGES)
+        self.log.info("  %-12s %10d %10d", "announced", inv_announced, recon_announced)
+        self.log.info("  %-12s %10.1f %10.1f", "seconds", inv_duration, recon_duration)
+
+        assert recon_stats['sketch'] > 0
+        assert recon_announced < inv_announced
+
+if __name__ == '__main__':
+    TxReconciliationTest().main()
@@ -104,6 +104,7 @@ BASE_SCRIPTS = [
     'wallet_address_types.py',
     'feature_bip68_sequence.py',
     'p2p_feefilter.py',
+    'p2p_txrecon.py',
     'feature_reindex.py',
     # vv Tests less than 30s vv
     'wallet_keypool_topup.py',